@@ -58,6 +58,13 @@ static Looper* _async_socket_get_looper(AsyncSocket* as);
 static AsyncIOAction _async_socket_io_timed_out(AsyncSocket* as,
                                                 AsyncSocketIO* asio);
 
+/* Adds an I/O to the socket's deadline queue, unless its deadline is
+ * infinite. */
+static void _async_socket_add_deadline(AsyncSocket* as, AsyncSocketIO* asio);
+
+/* Removes an I/O from the socket's deadline queue, if it's there. */
+static void _async_socket_remove_deadline(AsyncSocket* as, AsyncSocketIO* asio);
+
 /********************************************************************************
  *                  Asynchronous Socket Reader / Writer
  *******************************************************************************/
@@ -67,8 +74,11 @@ struct AsyncSocketIO {
     AsyncSocketIO*      next;
     /* Asynchronous socket for this I/O. */
     AsyncSocket*        as;
-    /* Timer used for time outs on this I/O. */
-    LoopTimer           timer[1];
+    /* Previous and next I/O in the socket's deadline queue. */
+    AsyncSocketIO*      dl_prev;
+    AsyncSocketIO*      dl_next;
+    /* Flags whether (1) or not (0) the I/O is in the deadline queue. */
+    int                 dl_queued;
     /* An opaque pointer associated with this I/O. */
     void*               io_opaque;
     /* Buffer where to read / write data. */
@@ -103,13 +113,13 @@ static int _recycled_asio_count         = 0;
 /* Maximum number of I/O descriptors that can be recycled. */
 static const int _max_recycled_asio_num = 32;
 
-/* Handler for an I/O time-out timer event.
+/* Handler for an I/O time-out.
  * When this routine is invoked, it indicates that a time out has occurred on an
  * I/O.
  * Param:
- *  opaque - AsyncSocketIO instance representing the timed out I/O.
+ *  asio - AsyncSocketIO instance representing the timed out I/O.
  */
-static void _on_async_socket_io_timed_out(void* opaque);
+static void _on_async_socket_io_timed_out(AsyncSocketIO* asio);
 
 /* Creates new I/O descriptor.
  * Param:
@@ -153,9 +163,8 @@ _async_socket_rw_new(AsyncSocket* as,
     asio->state         = ASIO_STATE_QUEUED;
     asio->ref_count     = 1;
     asio->deadline      = deadline;
-    loopTimer_init(asio->timer, _async_socket_get_looper(as),
-                   _on_async_socket_io_timed_out, asio);
-    loopTimer_startAbsolute(asio->timer, deadline);
+    asio->dl_queued     = 0;
+    _async_socket_add_deadline(as, asio);
 
     /* Reference socket that is holding this I/O. */
     async_socket_reference(as);
@@ -175,7 +184,7 @@ _async_socket_io_free(AsyncSocketIO* asio)
     T("ASocket %s: %s I/O descriptor %p is destroyed.",
       _async_socket_string(as), asio->is_io_read ? "READ" : "WRITE", asio);
 
-    loopTimer_done(asio->timer);
+    _async_socket_remove_deadline(as, asio);
 
     /* Try to recycle it first, and free the memory if recycler is full. */
     if (_recycled_asio_count < _max_recycled_asio_num) {
@@ -269,9 +278,8 @@ _async_socket_writer_new(AsyncSocket* as,
 
 /* I/O timed out. */
 static void
-_on_async_socket_io_timed_out(void* opaque)
+_on_async_socket_io_timed_out(AsyncSocketIO* asio)
 {
-    AsyncSocketIO* const asio = (AsyncSocketIO*)opaque;
     AsyncSocket* const as = asio->as;
 
     D("ASocket %s: %s I/O with deadline %lld has timed out at %lld",
@@ -298,7 +306,7 @@ async_socket_io_get_socket(const AsyncSocketIO* asio)
 void
 async_socket_io_cancel_time_out(AsyncSocketIO* asio)
 {
-    loopTimer_stop(asio->timer);
+    _async_socket_remove_deadline(asio->as, asio);
 }
 
 void*
@@ -368,6 +376,11 @@ struct AsyncSocket {
     LoopIo              io[1];
     /* Timer to use for reconnection attempts. */
     LoopTimer           reconnect_timer[1];
+    /* Timer for the earliest deadline in the deadline queue. */
+    LoopTimer           io_timer[1];
+    /* Queue of the I/O with a finite deadline, sorted by deadline. */
+    AsyncSocketIO*      deadlines_head;
+    AsyncSocketIO*      deadlines_tail;
     /* Head of the list of the active readers. */
     AsyncSocketIO*      readers_head;
     /* Tail of the list of the active readers. */
@@ -398,6 +411,101 @@ _async_socket_get_looper(AsyncSocket* as)
     return as->looper;
 }
 
+/* Arms the socket's I/O timer for the earliest deadline in the queue. */
+static void
+_async_socket_arm_io_timer(AsyncSocket* as)
+{
+    if (as->deadlines_head != NULL) {
+        loopTimer_startAbsolute(as->io_timer, as->deadlines_head->deadline);
+    } else {
+        loopTimer_stop(as->io_timer);
+    }
+}
+
+static void
+_async_socket_add_deadline(AsyncSocket* as, AsyncSocketIO* asio)
+{
+    AsyncSocketIO* prev = as->deadlines_tail;
+
+    if (asio->deadline == DURATION_INFINITE) {
+        return;
+    }
+
+    /* I/O are mostly queued in the order of their deadlines, so look for the
+     * insertion point from the tail. */
+    while (prev != NULL && prev->deadline > asio->deadline) {
+        prev = prev->dl_prev;
+    }
+    asio->dl_prev = prev;
+    if (prev != NULL) {
+        asio->dl_next = prev->dl_next;
+        prev->dl_next = asio;
+    } else {
+        asio->dl_next = as->deadlines_head;
+        as->deadlines_head = asio;
+    }
+    if (asio->dl_next != NULL) {
+        asio->dl_next->dl_prev = asio;
+    } else {
+        as->deadlines_tail = asio;
+    }
+    asio->dl_queued = 1;
+
+    if (as->deadlines_head == asio) {
+        _async_socket_arm_io_timer(as);
+    }
+}
+
+static void
+_async_socket_remove_deadline(AsyncSocket* as, AsyncSocketIO* asio)
+{
+    const int was_first = (as->deadlines_head == asio);
+
+    if (!asio->dl_queued) {
+        return;
+    }
+
+    if (asio->dl_prev != NULL) {
+        asio->dl_prev->dl_next = asio->dl_next;
+    } else {
+        as->deadlines_head = asio->dl_next;
+    }
+    if (asio->dl_next != NULL) {
+        asio->dl_next->dl_prev = asio->dl_prev;
+    } else {
+        as->deadlines_tail = asio->dl_prev;
+    }
+    asio->dl_prev = asio->dl_next = NULL;
+    asio->dl_queued = 0;
+
+    if (was_first) {
+        _async_socket_arm_io_timer(as);
+    }
+}
+
+/* I/O timer callback: times out all I/O whose deadline has passed.
+ * Param:
+ *  opaque - AsyncSocket instance.
+ */
+static void
+_on_async_socket_io_timer(void* opaque)
+{
+    AsyncSocket* const as = (AsyncSocket*)opaque;
+    const Duration now = looper_now(as->looper);
+
+    /* Reference the socket while we're working with it in this callback. */
+    async_socket_reference(as);
+
+    while (as->deadlines_head != NULL && as->deadlines_head->deadline <= now) {
+        AsyncSocketIO* const asio = as->deadlines_head;
+        _async_socket_remove_deadline(as, asio);
+        _on_async_socket_io_timed_out(asio);
+    }
+    _async_socket_arm_io_timer(as);
+
+    async_socket_release(as);
+}
+
 /* Pulls first reader out of the list.
  * Param:
  *  as - Initialized AsyncSocket instance.
@@ -492,48 +600,20 @@ _async_socket_remove_io(AsyncSocket* as,
     return 1;
 }
 
-/* Advances to the next I/O in the list.
+/* Checks whether an I/O is in a list of active I/O.
  * Param:
- *  as - Initialized AsyncSocket instance.
- *  list_head, list_tail - Pointers to the list head and tail.
+ *  list_head - List head.
+ *  io - I/O to look for.
+ * Return:
+ *  Boolean: 1 if I/O is in the list, or 0 if it's not.
  */
-static void
-_async_socket_advance_io(AsyncSocket* as,
-                         AsyncSocketIO** list_head,
-                         AsyncSocketIO** list_tail)
+static int
+_async_socket_has_io(AsyncSocketIO* list_head, AsyncSocketIO* io)
 {
-    AsyncSocketIO* first_io = *list_head;
-    if (first_io != NULL) {
-        *list_head = first_io->next;
-        first_io->next = NULL;
-    }
-    if (*list_head == NULL) {
-        *list_tail = NULL;
-    }
-    if (first_io != NULL) {
-        /* Release I/O removed from the head of the list. */
-        async_socket_io_release(first_io);
+    while (list_head != NULL && list_head != io) {
+        list_head = list_head->next;
     }
-}
-
-/* Advances to the next reader in the list.
- * Param:
- *  as - Initialized AsyncSocket instance.
- */
-static void
-_async_socket_advance_reader(AsyncSocket* as)
-{
-    _async_socket_advance_io(as, &as->readers_head, &as->readers_tail);
-}
-
-/* Advances to the next writer in the list.
- * Param:
- *  as - Initialized AsyncSocket instance.
- */
-static void
-_async_socket_advance_writer(AsyncSocket* as)
-{
-    _async_socket_advance_io(as, &as->writers_head, &as->writers_tail);
+    return list_head != NULL;
 }
 
 /* Completes an I/O.
@@ -665,9 +745,12 @@ _async_socket_cancel_all_io(AsyncSocket* as)
     /* Stop the reconnection timer. */
     loopTimer_stop(as->reconnect_timer);
 
-    /* Stop read / write on the socket. */
-    loopIo_dontWantWrite(as->io);
-    loopIo_dontWantRead(as->io);
+    /* Stop read / write on the socket. Its I/O watcher only exists while it
+     * is connected. */
+    if (async_socket_is_connected(as)) {
+        loopIo_dontWantWrite(as->io);
+        loopIo_dontWantRead(as->io);
+    }
 
     /* Cancel active readers and writers. */
     _async_socket_cancel_readers(as);
@@ -706,6 +789,7 @@ _async_socket_free(AsyncSocket* as)
         /* Free allocated resources. */
         if (as->looper != NULL) {
             loopTimer_done(as->reconnect_timer);
+            loopTimer_done(as->io_timer);
             if (as->owns_looper) {
                 looper_free(as->looper);
             }
@@ -782,113 +866,211 @@ _on_async_socket_failure(AsyncSocket* as, AsyncSocketIO* asio)
     return _async_socket_io_failure(as, asio, errno);
 }
 
-/* A callback that is invoked when there is data available to read.
+/* Maximum number of queued I/O transferred with a single system call. */
+#define ASYNC_SOCKET_MAX_BATCH  16
+
+/* Enables, or disables read or write I/O callback, depending on whether or
+ * not there are still active I/O in the given list. */
+static void
+_async_socket_update_wants(AsyncSocket* as, int is_read)
+{
+    if (is_read) {
+        if (as->readers_head != NULL) {
+            loopIo_wantRead(as->io);
+        } else {
+            loopIo_dontWantRead(as->io);
+        }
+    } else {
+        if (as->writers_head != NULL) {
+            loopIo_wantWrite(as->io);
+        } else {
+            loopIo_dontWantWrite(as->io);
+        }
+    }
+}
+
+/* Transfers data for the I/O at the head of the reader, or writer list.
+ * Consecutive I/O in the list are batched into a single scatter/gather system
+ * call, so streams of small messages don't cost a system call per message.
+ * Only the I/O at the head is told that it's in progress before the transfer,
+ * as data is about to flow for it. The I/O behind it are told that they have
+ * started once some of their data has actually been transferred.
  * Param:
  *  as - Initialized AsyncSocket instance.
+ *  is_read - I/O type selector: 1 - read, 0 - write.
  * Return:
  *  0 on success, or -1 on failure. Failure returned from this routine will
- *  skip writes (if awailable) behind this read.
+ *  skip I/O of the other type (if available) behind this one.
  */
 static int
-_on_async_socket_recv(AsyncSocket* as)
+_async_socket_transfer(AsyncSocket* as, int is_read)
 {
-    AsyncIOAction action;
-
-    /* Get current reader. */
-    AsyncSocketIO* const asr = as->readers_head;
-    if (asr == NULL) {
-        D("ASocket %s: No reader is available.", _async_socket_string(as));
-        loopIo_dontWantRead(as->io);
+    AsyncSocketIO** const list_head =
+            is_read ? &as->readers_head : &as->writers_head;
+    AsyncSocketIO** const list_tail =
+            is_read ? &as->readers_tail : &as->writers_tail;
+    AsyncSocketIO* batch[ASYNC_SOCKET_MAX_BATCH];
+    SocketIoVec vec[ASYNC_SOCKET_MAX_BATCH];
+    AsyncSocketIO* asio = *list_head;
+    int count = 0;
+    int res, n;
+
+    if (asio == NULL) {
+        D("ASocket %s: No %s is available.", _async_socket_string(as),
+          is_read ? "reader" : "writer");
+        _async_socket_update_wants(as, is_read);
         return 0;
     }
 
-    /* Reference the reader while we're working with it in this callback. */
-    async_socket_io_reference(asr);
+    /* Collect the I/O to transfer, and inform the client of the head I/O that
+     * it's in progress. */
+    while (asio != NULL && count < ASYNC_SOCKET_MAX_BATCH) {
+        AsyncSocketIO* next;
+        AsyncIOAction action = ASIO_ACTION_DONE;
 
-    /* Bump I/O state, and inform the client that I/O is in progress. */
-    if (asr->state == ASIO_STATE_QUEUED) {
-        asr->state = ASIO_STATE_STARTED;
-    } else {
-        asr->state = ASIO_STATE_CONTINUES;
-    }
-    action = asr->on_io(asr->io_opaque, asr, asr->state);
-    if (action == ASIO_ACTION_ABORT) {
-        D("ASocket %s: Read is aborted by the client.", _async_socket_string(as));
-        /* Move on to the next reader. */
-        _async_socket_advance_reader(as);
-        /* Lets see if there are still active readers, and enable, or disable
-         * read I/O callback accordingly. */
-        if (as->readers_head != NULL) {
-            loopIo_wantRead(as->io);
+        /* Reference the I/O while we're working with it in this callback. */
+        async_socket_io_reference(asio);
+
+        if (count == 0) {
+            /* Bump I/O state, and inform the client that I/O is in
+             * progress. */
+            if (asio->state == ASIO_STATE_QUEUED) {
+                asio->state = ASIO_STATE_STARTED;
+            } else {
+                asio->state = ASIO_STATE_CONTINUES;
+            }
+            action = asio->on_io(asio->io_opaque, asio, asio->state);
+        }
+        next = asio->next;
+        if (action == ASIO_ACTION_ABORT) {
+            D("ASocket %s: %s is aborted by the client.",
+              _async_socket_string(as), is_read ? "Read" : "Write");
+            _async_socket_remove_io(as, list_head, list_tail, asio);
+            async_socket_io_release(asio);
         } else {
-            loopIo_dontWantRead(as->io);
+            batch[count] = asio;
+            vec[count].base = asio->buffer + asio->transferred;
+            vec[count].len = asio->to_transfer - asio->transferred;
+            count++;
+        }
+        asio = next;
+    }
+
+    if (count == 0 || !async_socket_is_connected(as)) {
+        if (async_socket_is_connected(as)) {
+            _async_socket_update_wants(as, is_read);
+        }
+        for (n = 0; n < count; n++) {
+            async_socket_io_release(batch[n]);
         }
-        async_socket_io_release(asr);
         return 0;
     }
 
-    /* Read next chunk of data. */
-    int res = HANDLE_EINTR(
-            socket_recv(as->fd,
-                        asr->buffer + asr->transferred,
-                        asr->to_transfer - asr->transferred));
+    /* Transfer next chunk of data. */
+    if (count == 1) {
+        res = is_read ? socket_recv(as->fd, vec[0].base, vec[0].len) :
+                        socket_send(as->fd, vec[0].base, vec[0].len);
+    } else {
+        res = is_read ? socket_recvv(as->fd, vec, count) :
+                        socket_sendv(as->fd, vec, count);
+    }
+
     if (res == 0) {
         /* Socket has been disconnected. */
         errno = ECONNRESET;
         _on_async_socket_disconnected(as);
-        async_socket_io_release(asr);
+        for (n = 0; n < count; n++) {
+            async_socket_io_release(batch[n]);
+        }
         return -1;
     }
 
     if (res < 0) {
         if (errno == EWOULDBLOCK || errno == EAGAIN) {
-            /* Yield to writes behind this read. */
-            loopIo_wantRead(as->io);
-            async_socket_io_release(asr);
+            /* Yield to I/O of the other type behind this one. */
+            if (is_read) {
+                loopIo_wantRead(as->io);
+            } else {
+                loopIo_wantWrite(as->io);
+            }
+            for (n = 0; n < count; n++) {
+                async_socket_io_release(batch[n]);
+            }
             return 0;
         }
 
-        /* An I/O error. */
-        action = _on_async_socket_failure(as, asr);
-        if (action != ASIO_ACTION_RETRY) {
-            D("ASocket %s: Read is aborted on failure.", _async_socket_string(as));
-            /* Move on to the next reader. */
-            _async_socket_advance_reader(as);
-            /* Lets see if there are still active readers, and enable, or disable
-             * read I/O callback accordingly. */
-            if (as->readers_head != NULL) {
-                loopIo_wantRead(as->io);
-            } else {
-                loopIo_dontWantRead(as->io);
+        /* An I/O error, reported to the first I/O of the batch. */
+        if (_on_async_socket_failure(as, batch[0]) != ASIO_ACTION_RETRY) {
+            D("ASocket %s: %s is aborted on failure.",
+              _async_socket_string(as), is_read ? "Read" : "Write");
+            _async_socket_remove_io(as, list_head, list_tail, batch[0]);
+            if (async_socket_is_connected(as)) {
+                _async_socket_update_wants(as, is_read);
             }
         }
-        async_socket_io_release(asr);
+        for (n = 0; n < count; n++) {
+            async_socket_io_release(batch[n]);
+        }
         return -1;
     }
 
-    /* Update the reader's descriptor. */
-    asr->transferred += res;
-    if (asr->transferred == asr->to_transfer) {
-        /* This read is completed. Move on to the next reader. */
-        _async_socket_advance_reader(as);
+    /* Update the descriptors, and complete the I/O that are done. Note that a
+     * callback may cancel the I/O behind it, in which case they are no longer
+     * in the list. */
+    for (n = 0; n < count && res > 0; n++) {
+        AsyncSocketIO* const cur = batch[n];
+        uint32_t chunk = cur->to_transfer - cur->transferred;
 
-        /* Notify reader completion. */
-        _async_socket_complete_io(as, asr);
+        if (chunk > (uint32_t)res) {
+            chunk = res;
+        }
+        cur->transferred += chunk;
+        res -= chunk;
+
+        /* Inform the client that the I/O has started, now that its data is
+         * flowing. */
+        if (cur->state == ASIO_STATE_QUEUED &&
+            _async_socket_has_io(*list_head, cur)) {
+            cur->state = ASIO_STATE_STARTED;
+            if (cur->on_io(cur->io_opaque, cur, ASIO_STATE_STARTED) ==
+                    ASIO_ACTION_ABORT) {
+                D("ASocket %s: %s is aborted by the client.",
+                  _async_socket_string(as), is_read ? "Read" : "Write");
+                _async_socket_remove_io(as, list_head, list_tail, cur);
+                continue;
+            }
+        }
+        if (cur->transferred == cur->to_transfer &&
+            _async_socket_remove_io(as, list_head, list_tail, cur)) {
+            /* Notify I/O completion. */
+            _async_socket_complete_io(as, cur);
+        }
     }
 
-    /* Lets see if there are still active readers, and enable, or disable read
-     * I/O callback accordingly. */
-    if (as->readers_head != NULL) {
-        loopIo_wantRead(as->io);
-    } else {
-        loopIo_dontWantRead(as->io);
+    if (async_socket_is_connected(as)) {
+        _async_socket_update_wants(as, is_read);
     }
 
-    async_socket_io_release(asr);
+    for (n = 0; n < count; n++) {
+        async_socket_io_release(batch[n]);
+    }
 
     return 0;
 }
 
+/* A callback that is invoked when there is data available to read.
+ * Param:
+ *  as - Initialized AsyncSocket instance.
+ * Return:
+ *  0 on success, or -1 on failure. Failure returned from this routine will
+ *  skip writes (if awailable) behind this read.
+ */
+static int
+_on_async_socket_recv(AsyncSocket* as)
+{
+    return _async_socket_transfer(as, 1);
+}
+
 /* A callback that is invoked when there is data available to write.
  * Param:
  *  as - Initialized AsyncSocket instance.
@@ -899,101 +1081,7 @@ _on_async_socket_recv(AsyncSocket* as)
 static int
 _on_async_socket_send(AsyncSocket* as)
 {
-    AsyncIOAction action;
-
-    /* Get current writer. */
-    AsyncSocketIO* const asw = as->writers_head;
-    if (asw == NULL) {
-        D("ASocket %s: No writer is available.", _async_socket_string(as));
-        loopIo_dontWantWrite(as->io);
-        return 0;
-    }
-
-    /* Reference the writer while we're working with it in this callback. */
-    async_socket_io_reference(asw);
-
-    /* Bump I/O state, and inform the client that I/O is in progress. */
-    if (asw->state == ASIO_STATE_QUEUED) {
-        asw->state = ASIO_STATE_STARTED;
-    } else {
-        asw->state = ASIO_STATE_CONTINUES;
-    }
-    action = asw->on_io(asw->io_opaque, asw, asw->state);
-    if (action == ASIO_ACTION_ABORT) {
-        D("ASocket %s: Write is aborted by the client.", _async_socket_string(as));
-        /* Move on to the next writer. */
-        _async_socket_advance_writer(as);
-        /* Lets see if there are still active writers, and enable, or disable
-         * write I/O callback accordingly. */
-        if (as->writers_head != NULL) {
-            loopIo_wantWrite(as->io);
-        } else {
-            loopIo_dontWantWrite(as->io);
-        }
-        async_socket_io_release(asw);
-        return 0;
-    }
-
-    /* Write next chunk of data. */
-    int res = HANDLE_EINTR(
-            socket_send(as->fd,
-                        asw->buffer + asw->transferred,
-                        asw->to_transfer - asw->transferred));
-    if (res == 0) {
-        /* Socket has been disconnected. */
-        errno = ECONNRESET;
-        _on_async_socket_disconnected(as);
-        async_socket_io_release(asw);
-        return -1;
-    }
-
-    if (res < 0) {
-        if (errno == EWOULDBLOCK || errno == EAGAIN) {
-            /* Yield to reads behind this write. */
-            loopIo_wantWrite(as->io);
-            async_socket_io_release(asw);
-            return 0;
-        }
-
-        /* An I/O error. */
-        action = _on_async_socket_failure(as, asw);
-        if (action != ASIO_ACTION_RETRY) {
-            D("ASocket %s: Write is aborted on failure.", _async_socket_string(as));
-            /* Move on to the next writer. */
-            _async_socket_advance_writer(as);
-            /* Lets see if there are still active writers, and enable, or disable
-             * write I/O callback accordingly. */
-            if (as->writers_head != NULL) {
-                loopIo_wantWrite(as->io);
-            } else {
-                loopIo_dontWantWrite(as->io);
-            }
-        }
-        async_socket_io_release(asw);
-        return -1;
-    }
-
-    /* Update the writer descriptor. */
-    asw->transferred += res;
-    if (asw->transferred == asw->to_transfer) {
-        /* This write is completed. Move on to the next writer. */
-        _async_socket_advance_writer(as);
-
-        /* Notify writer completion. */
-        _async_socket_complete_io(as, asw);
-    }
-
-    /* Lets see if there are still active writers, and enable, or disable write
-     * I/O callback accordingly. */
-    if (as->writers_head != NULL) {
-        loopIo_wantWrite(as->io);
-    } else {
-        loopIo_dontWantWrite(as->io);
-    }
-
-    async_socket_io_release(asw);
-
-    return 0;
+    return _async_socket_transfer(as, 0);
 }
 
 /* A callback that is invoked when an I/O is available on socket.
@@ -1131,6 +1219,7 @@ async_socket_new(int port,
     }
 
     loopTimer_init(as->reconnect_timer, as->looper, _on_async_socket_reconnect, as);
+    loopTimer_init(as->io_timer, as->looper, _on_async_socket_io_timer, as);
 
     T("ASocket %s: Descriptor is created.", _async_socket_string(as));
 
@@ -0,0 +1,355 @@
+// Copyright 2015 The Android Open Source Project
+//
+// This software is licensed under the terms of the GNU General Public
+// License version 2, as published by the Free Software Foundation, and
+// may be copied, distributed, and modified under those terms.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+extern "C" {
+#include "android/async-socket.h"
+#include "android/looper.h"
+}
+
+#include "android/base/sockets/SocketUtils.h"
+
+#include <gtest/gtest.h>
+
+#include <vector>
+
+using android::base::socketAcceptAny;
+using android::base::socketClose;
+using android::base::socketGetPort;
+using android::base::socketRecv;
+using android::base::socketSend;
+using android::base::socketSetNonBlocking;
+using android::base::socketTcpLoopbackServer;
+
+// async-socket.c uses the core looper when it isn't given one, which lives in
+// the emulator core. The tests always pass a generic looper.
+extern "C" ::Looper* looper_newCore(void) {
+    return looper_newGeneric();
+}
+
+namespace {
+
+// Number of I/O that succeeded so far.
+int sCompletions = 0;
+
+// Records the states an I/O goes through, what it had transferred when it
+// was told that it started, and when it succeeded.
+struct IoRecord {
+    IoRecord()
+        : startedAt(-1), completion(-1), abortOnStart(false), asio(NULL) {}
+
+    bool has(AsyncIOState state) const {
+        for (size_t n = 0; n < states.size(); ++n) {
+            if (states[n] == state) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    bool done() const {
+        return has(ASIO_STATE_SUCCEEDED) || has(ASIO_STATE_TIMED_OUT) ||
+               has(ASIO_STATE_CANCELLED) || has(ASIO_STATE_FAILED);
+    }
+
+    std::vector<AsyncIOState> states;
+    int startedAt;
+    int completion;
+    bool abortOnStart;
+    AsyncSocketIO* asio;
+};
+
+AsyncIOAction onIo(void* opaque, AsyncSocketIO* asio, AsyncIOState state) {
+    IoRecord* record = static_cast<IoRecord*>(opaque);
+    record->states.push_back(state);
+    record->asio = asio;
+    if (state == ASIO_STATE_STARTED) {
+        record->startedAt = async_socket_io_get_transferred(asio);
+        if (record->abortOnStart) {
+            return ASIO_ACTION_ABORT;
+        }
+    } else if (state == ASIO_STATE_SUCCEEDED) {
+        record->completion = sCompletions++;
+    }
+    return ASIO_ACTION_DONE;
+}
+
+// Connects an AsyncSocket to the accepted end of a loopback TCP connection,
+// since AsyncSocket only connects to TCP ports, and runs a generic looper for
+// it.
+class AsyncSocketTest : public ::testing::Test {
+protected:
+    AsyncSocketTest()
+        : mLooper(NULL), mServer(-1), mPeer(-1), mSocket(NULL),
+          mConnected(false), mFailed(false) {}
+
+    virtual void SetUp() {
+        mLooper = looper_newGeneric();
+        mServer = socketTcpLoopbackServer(0);
+        ASSERT_GE(mServer, 0);
+        mSocket = async_socket_new(socketGetPort(mServer), 1000,
+                                   onConnection, this, mLooper);
+        ASSERT_TRUE(mSocket != NULL);
+        async_socket_connect(mSocket, 1000);
+        ASSERT_TRUE(runUntil(&mConnected));
+        mPeer = socketAcceptAny(mServer);
+        ASSERT_GE(mPeer, 0);
+        socketSetNonBlocking(mPeer);
+    }
+
+    virtual void TearDown() {
+        if (mSocket) {
+            async_socket_release(mSocket);
+        }
+        if (mPeer >= 0) {
+            socketClose(mPeer);
+        }
+        if (mServer >= 0) {
+            socketClose(mServer);
+        }
+        looper_free(mLooper);
+    }
+
+    static AsyncIOAction onConnection(void* opaque,
+                                      AsyncSocket* as,
+                                      AsyncIOState state) {
+        AsyncSocketTest* test = static_cast<AsyncSocketTest*>(opaque);
+        switch (state) {
+            case ASIO_STATE_SUCCEEDED:
+                test->mConnected = true;
+                return ASIO_ACTION_DONE;
+            case ASIO_STATE_FAILED:
+                // Don't reconnect after a disconnection.
+                test->mFailed = true;
+                return test->mConnected ? ASIO_ACTION_DONE : ASIO_ACTION_RETRY;
+            default:
+                // Keep the connection attempt going.
+                return ASIO_ACTION_RETRY;
+        }
+    }
+
+    // Runs the looper until |*flag| is set, or for at most |timeoutMs|.
+    bool runUntil(const bool* flag, int timeoutMs = 5000) {
+        const Duration deadline = looper_now(mLooper) + timeoutMs;
+        while (!*flag && looper_now(mLooper) < deadline) {
+            looper_runWithTimeout(mLooper, 5);
+        }
+        return *flag;
+    }
+
+    // Runs the looper until |record| is done, or for at most |timeoutMs|.
+    bool runUntilDone(const IoRecord& record, int timeoutMs = 5000) {
+        const Duration deadline = looper_now(mLooper) + timeoutMs;
+        while (!record.done() && looper_now(mLooper) < deadline) {
+            looper_runWithTimeout(mLooper, 5);
+        }
+        return record.done();
+    }
+
+    // Reads what the peer end has received so far into |mReceived|.
+    void receive() {
+        char buf[65536];
+        for (;;) {
+            ssize_t len = socketRecv(mPeer, buf, sizeof(buf));
+            if (len <= 0) {
+                break;
+            }
+            mReceived.insert(mReceived.end(), buf, buf + len);
+        }
+    }
+
+    ::Looper* mLooper;
+    int mServer;
+    int mPeer;
+    AsyncSocket* mSocket;
+    bool mConnected;
+    bool mFailed;
+    std::vector<uint8_t> mReceived;
+};
+
+std::vector<uint8_t> makeData(size_t size, int seed) {
+    std::vector<uint8_t> data(size);
+    for (size_t n = 0; n < size; ++n) {
+        data[n] = (uint8_t)(n * 13 + n / 253 + seed);
+    }
+    return data;
+}
+
+}  // namespace
+
+TEST_F(AsyncSocketTest, PartialReadvStartsOnlyTheReadsThatGetData) {
+    const int kReads = 3;
+    std::vector<uint8_t> data = makeData(10 * kReads, 0);
+    uint8_t buf[kReads][10];
+    IoRecord records[kReads];
+    for (int n = 0; n < kReads; ++n) {
+        async_socket_read_rel(mSocket, buf[n], 10, onIo, &records[n], -1);
+    }
+
+    // Half of the second read's data arrives with the first read's.
+    ASSERT_EQ(15, socketSend(mPeer, &data[0], 15));
+    ASSERT_TRUE(runUntilDone(records[0]));
+    EXPECT_EQ(ASIO_STATE_STARTED, records[0].states[0]);
+    EXPECT_EQ(ASIO_STATE_SUCCEEDED, records[0].states[1]);
+    EXPECT_EQ(0, memcmp(buf[0], &data[0], 10));
+    // The second read is told it started once its bytes are in.
+    ASSERT_EQ(1U, records[1].states.size());
+    EXPECT_EQ(ASIO_STATE_STARTED, records[1].states[0]);
+    EXPECT_EQ(5, records[1].startedAt);
+    // The third read hasn't got anything yet.
+    EXPECT_TRUE(records[2].states.empty());
+
+    ASSERT_EQ(15, socketSend(mPeer, &data[15], 15));
+    ASSERT_TRUE(runUntilDone(records[2]));
+    EXPECT_TRUE(records[1].has(ASIO_STATE_CONTINUES));
+    EXPECT_TRUE(records[1].has(ASIO_STATE_SUCCEEDED));
+    EXPECT_EQ(ASIO_STATE_STARTED, records[2].states[0]);
+    EXPECT_TRUE(records[2].has(ASIO_STATE_SUCCEEDED));
+    EXPECT_EQ(0, memcmp(buf[1], &data[10], 10));
+    EXPECT_EQ(0, memcmp(buf[2], &data[20], 10));
+}
+
+TEST_F(AsyncSocketTest, PartialWritevKeepsDataInOrder) {
+    // Writes much larger than the socket buffers, so that each writev only
+    // sends part of them.
+    const int kWrites = 4;
+    const size_t kSize = 1024 * 1024;
+    std::vector<uint8_t> data[kWrites];
+    IoRecord records[kWrites];
+    std::vector<uint8_t> expected;
+    for (int n = 0; n < kWrites; ++n) {
+        data[n] = makeData(kSize, n);
+        expected.insert(expected.end(), data[n].begin(), data[n].end());
+        async_socket_write_rel(mSocket, &data[n][0], kSize, onIo, &records[n],
+                               -1);
+    }
+
+    const Duration deadline = looper_now(mLooper) + 10000;
+    while (mReceived.size() < expected.size() &&
+           looper_now(mLooper) < deadline) {
+        looper_runWithTimeout(mLooper, 1);
+        receive();
+    }
+    ASSERT_TRUE(mReceived == expected);
+
+    for (int n = 0; n < kWrites; ++n) {
+        SCOPED_TRACE(testing::Message() << "write " << n);
+        ASSERT_TRUE(records[n].done());
+        EXPECT_EQ(ASIO_STATE_STARTED, records[n].states[0]);
+        EXPECT_TRUE(records[n].has(ASIO_STATE_SUCCEEDED));
+        if (n > 0) {
+            EXPECT_GT(records[n].completion, records[n - 1].completion);
+        }
+    }
+    // Some writes couldn't be sent at once.
+    int continued = 0;
+    for (int n = 0; n < kWrites; ++n) {
+        continued += records[n].has(ASIO_STATE_CONTINUES);
+    }
+    EXPECT_GT(continued, 0);
+}
+
+TEST_F(AsyncSocketTest, TimeoutsExpireInDeadlineOrder) {
+    uint8_t buf[2][4];
+    IoRecord records[2];
+    const Duration start = looper_now(mLooper);
+    async_socket_read_rel(mSocket, buf[0], 4, onIo, &records[0], 200);
+    async_socket_read_rel(mSocket, buf[1], 4, onIo, &records[1], 50);
+
+    // The second read is behind the first one, but expires first.
+    ASSERT_TRUE(runUntilDone(records[1]));
+    EXPECT_TRUE(records[1].has(ASIO_STATE_TIMED_OUT));
+    EXPECT_GE(looper_now(mLooper) - start, 50);
+    EXPECT_FALSE(records[0].done());
+
+    ASSERT_TRUE(runUntilDone(records[0]));
+    EXPECT_TRUE(records[0].has(ASIO_STATE_TIMED_OUT));
+    EXPECT_GE(looper_now(mLooper) - start, 200);
+
+    // The socket still works.
+    IoRecord record;
+    async_socket_read_rel(mSocket, buf[0], 4, onIo, &record, 1000);
+    ASSERT_EQ(4, socketSend(mPeer, "abcd", 4));
+    ASSERT_TRUE(runUntilDone(record));
+    EXPECT_TRUE(record.has(ASIO_STATE_SUCCEEDED));
+    EXPECT_EQ(0, memcmp(buf[0], "abcd", 4));
+}
+
+TEST_F(AsyncSocketTest, CompletedIoDoesNotTimeOut) {
+    uint8_t buf[4];
+    IoRecord record;
+    async_socket_read_rel(mSocket, buf, 4, onIo, &record, 50);
+    ASSERT_EQ(4, socketSend(mPeer, "abcd", 4));
+    ASSERT_TRUE(runUntilDone(record));
+    looper_runWithTimeout(mLooper, 100);
+    EXPECT_TRUE(record.has(ASIO_STATE_SUCCEEDED));
+    EXPECT_FALSE(record.has(ASIO_STATE_TIMED_OUT));
+}
+
+TEST_F(AsyncSocketTest, AbortOnStartSkipsToTheNextRead) {
+    uint8_t buf[2][4];
+    IoRecord records[2];
+    records[0].abortOnStart = true;
+    async_socket_read_rel(mSocket, buf[0], 4, onIo, &records[0], -1);
+    async_socket_read_rel(mSocket, buf[1], 4, onIo, &records[1], -1);
+    ASSERT_EQ(4, socketSend(mPeer, "abcd", 4));
+    ASSERT_TRUE(runUntilDone(records[1]));
+    EXPECT_FALSE(records[0].has(ASIO_STATE_SUCCEEDED));
+    EXPECT_TRUE(records[0].has(ASIO_STATE_FINISHED));
+    EXPECT_TRUE(records[1].has(ASIO_STATE_SUCCEEDED));
+    EXPECT_EQ(0, memcmp(buf[1], "abcd", 4));
+}
+
+TEST_F(AsyncSocketTest, DisconnectCancelsPendingIo) {
+    uint8_t buf[2][4];
+    IoRecord records[4];
+    async_socket_read_rel(mSocket, buf[0], 4, onIo, &records[0], 1000);
+    async_socket_read_rel(mSocket, buf[1], 4, onIo, &records[1], -1);
+    std::vector<uint8_t> data = makeData(4 * 1024 * 1024, 0);
+    async_socket_write_rel(mSocket, &data[0], data.size(), onIo, &records[2],
+                           1000);
+    async_socket_write_rel(mSocket, "abcd", 4, onIo, &records[3], -1);
+    looper_runWithTimeout(mLooper, 10);
+
+    async_socket_disconnect(mSocket);
+    EXPECT_FALSE(async_socket_is_connected(mSocket));
+    for (int n = 0; n < 4; ++n) {
+        SCOPED_TRACE(testing::Message() << "I/O " << n);
+        EXPECT_TRUE(records[n].has(ASIO_STATE_CANCELLED));
+        EXPECT_EQ(ASIO_STATE_FINISHED, records[n].states.back());
+    }
+    // The cancelled I/O don't time out later.
+    looper_runWithTimeout(mLooper, 1100);
+    for (int n = 0; n < 4; ++n) {
+        EXPECT_FALSE(records[n].has(ASIO_STATE_TIMED_OUT));
+    }
+}
+
+TEST_F(AsyncSocketTest, PeerCloseCancelsPendingReads) {
+    uint8_t buf[2][4];
+    IoRecord records[2];
+    async_socket_read_rel(mSocket, buf[0], 4, onIo, &records[0], -1);
+    async_socket_read_rel(mSocket, buf[1], 4, onIo, &records[1], -1);
+    ASSERT_EQ(2, socketSend(mPeer, "ab", 2));
+    socketClose(mPeer);
+    mPeer = -1;
+
+    ASSERT_TRUE(runUntil(&mFailed));
+    EXPECT_FALSE(async_socket_is_connected(mSocket));
+    EXPECT_TRUE(records[0].has(ASIO_STATE_CANCELLED));
+    EXPECT_TRUE(records[1].has(ASIO_STATE_CANCELLED));
+    EXPECT_FALSE(records[0].has(ASIO_STATE_SUCCEEDED));
+}
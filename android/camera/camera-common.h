@@ -145,9 +145,8 @@ typedef struct CameraInfo {
 /* Allocates CameraInfo instance. */
 static __inline__ CameraInfo* _camera_info_alloc(void)
 {
-    CameraInfo* ci;
-    ANEW0(ci);
-    return ci;
+    /* Not ANEW0(), so that C++ code, e.g. unit tests, can include this. */
+    return (CameraInfo*)android_alloc0(sizeof(CameraInfo));
 }
 
 /* Frees all resources allocated for CameraInfo instance (including the
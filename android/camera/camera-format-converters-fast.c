@@ -0,0 +1,859 @@
+/*
+ * Copyright (C) 2015 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Contains implementation of the specialized pixel format converters.
+ *
+ * All the converters are built from a handful of row kernels, which come in a
+ * portable C version, and in SSE2 / SSSE3 versions that produce exactly the
+ * same output. The kernel set is selected at runtime from the host CPU
+ * features (see camera_fast_get_best_level()).
+ *
+ * Color math matches the integer BT.601 formulas of the generic converters:
+ *
+ *      R = clamp((298 * (Y - 16) + 409 * (V - 128) + 128) >> 8)
+ *      G = clamp((298 * (Y - 16) - 100 * (U - 128) - 208 * (V - 128) + 128) >> 8)
+ *      B = clamp((298 * (Y - 16) + 516 * (U - 128) + 128) >> 8)
+ *
+ * Exposure compensation is applied to the luminance only, as an 8.8
+ * fixed-point factor: Y' = min(255, (Y * exposure) >> 8).
+ *
+ * As with the generic converters, 4:2:0 destinations take their chroma from
+ * the odd lines of a 4:2:2 source.
+ */
+
+#include <string.h>
+
+#include "android/camera/camera-format-converters-fast.h"
+#include "android/utils/x86_cpuid.h"
+
+#if defined(__i386__) || defined(__x86_64__)
+#  ifdef __SSE2__
+#    include <emmintrin.h>
+#    define HAVE_SSE2_KERNELS  1
+/* SSSE3 kernels are compiled with a target attribute, so they don't require
+ * the whole emulator to be built for SSSE3. */
+#    if defined(__SSSE3__)
+#      include <tmmintrin.h>
+#      define HAVE_SSSE3_KERNELS  1
+#      define SSSE3_TARGET
+#    elif defined(__clang__) || \
+          (defined(__GNUC__) && \
+           (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9)))
+#      include <tmmintrin.h>
+#      define HAVE_SSSE3_KERNELS  1
+#      define SSSE3_TARGET  __attribute__((target("ssse3")))
+#    endif
+#  endif
+#endif
+
+/* Same as v4l2_fourcc(), which is not available on all hosts. */
+#define FOURCC(a, b, c, d) \
+    ((uint32_t)(a) | ((uint32_t)(b) << 8) | \
+     ((uint32_t)(c) << 16) | ((uint32_t)(d) << 24))
+
+#define FOURCC_RGB32  FOURCC('R', 'G', 'B', '4')
+#define FOURCC_YUYV   FOURCC('Y', 'U', 'Y', 'V')
+#define FOURCC_YV12   FOURCC('Y', 'V', '1', '2')
+#define FOURCC_NV21   FOURCC('N', 'V', '2', '1')
+
+/* Maximum frame width supported by the converters, which use on-stack
+ * buffers for chroma lines. */
+#define MAX_WIDTH  4096
+
+/* Exposure value that leaves luminance unchanged. */
+#define EXPOSURE_NONE  256
+
+/* Maximum exposure value. This keeps exposed luminance values in the signed
+ * 16-bit range used by the SIMD kernels. */
+#define EXPOSURE_MAX   32767
+
+/********************************************************************************
+ * Portable kernels
+ *******************************************************************************/
+
+static __inline__ int
+_clamp(int x)
+{
+    if (x > 255) return 255;
+    if (x < 0)   return 0;
+    return x;
+}
+
+static __inline__ uint8_t
+_expose(int y, int exposure)
+{
+    y = (y * exposure) >> 8;
+    return (uint8_t)(y > 255 ? 255 : y);
+}
+
+/* Saves an RGB32 pixel for the given (exposed) Y, and U, V values. */
+static __inline__ void
+_yuv_to_rgb32(int y, int u, int v, uint8_t* rgb)
+{
+    const int c = 298 * (y - 16) + 128;
+    const int d = u - 128;
+    const int e = v - 128;
+    rgb[0] = (uint8_t)_clamp((c + 409 * e) >> 8);
+    rgb[1] = (uint8_t)_clamp((c - 100 * d - 208 * e) >> 8);
+    rgb[2] = (uint8_t)_clamp((c + 516 * d) >> 8);
+    rgb[3] = 0xff;
+}
+
+/* Converts a line of 'width' pixels from YUYV to RGB32, starting at pixel
+ * 'x'. The SIMD kernels below use this for the end of lines. */
+static void
+_yuyv_to_rgb32_c(const uint8_t* src, uint8_t* dst, int x, int width,
+                 int exposure)
+{
+    for (src += x * 2, dst += x * 4; x < width; x += 2, src += 4, dst += 8) {
+        _yuv_to_rgb32(_expose(src[0], exposure), src[1], src[3], dst);
+        _yuv_to_rgb32(_expose(src[2], exposure), src[1], src[3], dst + 4);
+    }
+}
+
+/* Converts a line of 'width' pixels from planar Y, U, V to RGB32, starting at
+ * pixel 'x'. U and V values are 'uv_inc' bytes apart, which allows to use this
+ * for both the YV12 and NV21 formats. */
+static void
+_yuv420_to_rgb32_c(const uint8_t* py, const uint8_t* pu, const uint8_t* pv,
+                   int uv_inc, uint8_t* dst, int x, int width, int exposure)
+{
+    pu += (x / 2) * uv_inc;
+    pv += (x / 2) * uv_inc;
+    for (dst += x * 4; x < width; x += 2, pu += uv_inc, pv += uv_inc, dst += 8) {
+        _yuv_to_rgb32(_expose(py[x], exposure), *pu, *pv, dst);
+        _yuv_to_rgb32(_expose(py[x + 1], exposure), *pu, *pv, dst + 4);
+    }
+}
+
+/* Splits a YUYV line into its Y, U, and V components, starting at pixel 'x'.
+ * 'pu' and 'pv' can be NULL if chroma is not needed for this line. */
+static void
+_yuyv_split_c(const uint8_t* src, uint8_t* py, uint8_t* pu, uint8_t* pv,
+              int x, int width, int exposure)
+{
+    for (src += x * 2; x < width; x += 2, src += 4) {
+        py[x] = _expose(src[0], exposure);
+        py[x + 1] = _expose(src[2], exposure);
+        if (pu != NULL) {
+            pu[x / 2] = src[1];
+            pv[x / 2] = src[3];
+        }
+    }
+}
+
+/* Applies exposure compensation to 'count' luminance values. */
+static void
+_expose_line_c(const uint8_t* src, uint8_t* dst, int x, int count,
+               int exposure)
+{
+    for (; x < count; x++) {
+        dst[x] = _expose(src[x], exposure);
+    }
+}
+
+/* Splits 'count' VU pairs into separate U and V lines. */
+static void
+_split_vu_c(const uint8_t* vu, uint8_t* pu, uint8_t* pv, int x, int count)
+{
+    for (; x < count; x++) {
+        pv[x] = vu[x * 2];
+        pu[x] = vu[x * 2 + 1];
+    }
+}
+
+/* Merges 'count' values from U and V lines into a line of VU pairs. */
+static void
+_merge_vu_c(const uint8_t* pu, const uint8_t* pv, uint8_t* vu, int x, int count)
+{
+    for (; x < count; x++) {
+        vu[x * 2] = pv[x];
+        vu[x * 2 + 1] = pu[x];
+    }
+}
+
+/********************************************************************************
+ * SSE2 / SSSE3 kernels
+ *
+ * These process 16 pixels at a time, and finish lines with the portable
+ * kernels.
+ *******************************************************************************/
+
+#ifdef HAVE_SSE2_KERNELS
+
+/* Applies exposure to 16 luminance bytes, returning the result as two vectors
+ * of 8 16-bit values in the 0-255 range. */
+static __inline__ void
+_expose_16(__m128i y, __m128i exposure, __m128i* lo, __m128i* hi)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i max = _mm_set1_epi16(255);
+    /* (Y << 8) * exposure >> 16 == (Y * exposure) >> 8 */
+    *lo = _mm_min_epi16(_mm_mulhi_epu16(_mm_unpacklo_epi8(zero, y), exposure),
+                        max);
+    *hi = _mm_min_epi16(_mm_mulhi_epu16(_mm_unpackhi_epi8(zero, y), exposure),
+                        max);
+}
+
+/* Computes R, G, B for 4 pixels, given (Y - 16, 1) and (U - 128, V - 128)
+ * pairs of 16-bit values. Results are 32-bit values, before clamping. */
+static __inline__ void
+_yuv_to_rgb_4(__m128i c1, __m128i de, __m128i* r, __m128i* g, __m128i* b)
+{
+    /* 298 * (Y - 16) + 128 */
+    const __m128i c = _mm_madd_epi16(c1, _mm_setr_epi16(298, 128, 298, 128,
+                                                        298, 128, 298, 128));
+    *r = _mm_add_epi32(c, _mm_madd_epi16(de, _mm_setr_epi16(0, 409, 0, 409,
+                                                            0, 409, 0, 409)));
+    *g = _mm_add_epi32(c, _mm_madd_epi16(de, _mm_setr_epi16(-100, -208,
+                                                            -100, -208,
+                                                            -100, -208,
+                                                            -100, -208)));
+    *b = _mm_add_epi32(c, _mm_madd_epi16(de, _mm_setr_epi16(516, 0, 516, 0,
+                                                            516, 0, 516, 0)));
+}
+
+/* Computes R, G, B for 8 pixels, given their exposed Y, and U, V values as
+ * 16-bit values. Results are 16-bit values, not clamped to 0-255 yet. */
+static __inline__ void
+_yuv_to_rgb_8(__m128i y, __m128i u, __m128i v,
+              __m128i* r, __m128i* g, __m128i* b)
+{
+    const __m128i one = _mm_set1_epi16(1);
+    const __m128i c = _mm_sub_epi16(y, _mm_set1_epi16(16));
+    const __m128i d = _mm_sub_epi16(u, _mm_set1_epi16(128));
+    const __m128i e = _mm_sub_epi16(v, _mm_set1_epi16(128));
+    __m128i rl, gl, bl, rh, gh, bh;
+
+    _yuv_to_rgb_4(_mm_unpacklo_epi16(c, one), _mm_unpacklo_epi16(d, e),
+                  &rl, &gl, &bl);
+    _yuv_to_rgb_4(_mm_unpackhi_epi16(c, one), _mm_unpackhi_epi16(d, e),
+                  &rh, &gh, &bh);
+    *r = _mm_packs_epi32(_mm_srai_epi32(rl, 8), _mm_srai_epi32(rh, 8));
+    *g = _mm_packs_epi32(_mm_srai_epi32(gl, 8), _mm_srai_epi32(gh, 8));
+    *b = _mm_packs_epi32(_mm_srai_epi32(bl, 8), _mm_srai_epi32(bh, 8));
+}
+
+/* Converts 16 pixels to RGB32, given 16 luminance bytes, and 8 U, V values
+ * for pixel pairs as 16-bit values. */
+static __inline__ void
+_yuv_to_rgb32_16(__m128i y, __m128i u, __m128i v, __m128i exposure,
+                 uint8_t* dst)
+{
+    __m128i ylo, yhi, r0, g0, b0, r1, g1, b1, r, g, b, rg, ba;
+    const __m128i alpha = _mm_set1_epi8((char)0xff);
+
+    _expose_16(y, exposure, &ylo, &yhi);
+    _yuv_to_rgb_8(ylo, _mm_unpacklo_epi16(u, u), _mm_unpacklo_epi16(v, v),
+                  &r0, &g0, &b0);
+    _yuv_to_rgb_8(yhi, _mm_unpackhi_epi16(u, u), _mm_unpackhi_epi16(v, v),
+                  &r1, &g1, &b1);
+
+    /* Clamp, and interleave into R, G, B, A bytes. */
+    r = _mm_packus_epi16(r0, r1);
+    g = _mm_packus_epi16(g0, g1);
+    b = _mm_packus_epi16(b0, b1);
+
+    rg = _mm_unpacklo_epi8(r, g);
+    ba = _mm_unpacklo_epi8(b, alpha);
+    _mm_storeu_si128((__m128i*)dst, _mm_unpacklo_epi16(rg, ba));
+    _mm_storeu_si128((__m128i*)(dst + 16), _mm_unpackhi_epi16(rg, ba));
+    rg = _mm_unpackhi_epi8(r, g);
+    ba = _mm_unpackhi_epi8(b, alpha);
+    _mm_storeu_si128((__m128i*)(dst + 32), _mm_unpacklo_epi16(rg, ba));
+    _mm_storeu_si128((__m128i*)(dst + 48), _mm_unpackhi_epi16(rg, ba));
+}
+
+/* Splits 16 YUYV pixels into 16 Y bytes, and 8 U, V values as 16-bit
+ * values. */
+static __inline__ void
+_yuyv_load_16_sse2(const uint8_t* src, __m128i* y, __m128i* u, __m128i* v)
+{
+    const __m128i mask = _mm_set1_epi16(0x00ff);
+    const __m128i a = _mm_loadu_si128((const __m128i*)src);
+    const __m128i b = _mm_loadu_si128((const __m128i*)(src + 16));
+    const __m128i uv = _mm_packus_epi16(_mm_srli_epi16(a, 8),
+                                        _mm_srli_epi16(b, 8));
+
+    *y = _mm_packus_epi16(_mm_and_si128(a, mask), _mm_and_si128(b, mask));
+    *u = _mm_and_si128(uv, mask);
+    *v = _mm_srli_epi16(uv, 8);
+}
+
+static void
+_yuyv_to_rgb32_sse2(const uint8_t* src, uint8_t* dst, int width, int exposure)
+{
+    const __m128i exp = _mm_set1_epi16((short)exposure);
+    int x;
+
+    for (x = 0; x + 16 <= width; x += 16) {
+        __m128i y, u, v;
+        _yuyv_load_16_sse2(src + x * 2, &y, &u, &v);
+        _yuv_to_rgb32_16(y, u, v, exp, dst + x * 4);
+    }
+    _yuyv_to_rgb32_c(src, dst, x, width, exposure);
+}
+
+static void
+_yuyv_split_sse2(const uint8_t* src, uint8_t* py, uint8_t* pu, uint8_t* pv,
+                 int width, int exposure)
+{
+    const __m128i exp = _mm_set1_epi16((short)exposure);
+    int x;
+
+    for (x = 0; x + 16 <= width; x += 16) {
+        __m128i y, u, v, ylo, yhi;
+        _yuyv_load_16_sse2(src + x * 2, &y, &u, &v);
+        _expose_16(y, exp, &ylo, &yhi);
+        _mm_storeu_si128((__m128i*)(py + x), _mm_packus_epi16(ylo, yhi));
+        if (pu != NULL) {
+            _mm_storel_epi64((__m128i*)(pu + x / 2), _mm_packus_epi16(u, u));
+            _mm_storel_epi64((__m128i*)(pv + x / 2), _mm_packus_epi16(v, v));
+        }
+    }
+    _yuyv_split_c(src, py, pu, pv, x, width, exposure);
+}
+
+static void
+_yv12_to_rgb32_sse2(const uint8_t* py, const uint8_t* pu, const uint8_t* pv,
+                    uint8_t* dst, int width, int exposure)
+{
+    const __m128i exp = _mm_set1_epi16((short)exposure);
+    const __m128i zero = _mm_setzero_si128();
+    int x;
+
+    for (x = 0; x + 16 <= width; x += 16) {
+        const __m128i y = _mm_loadu_si128((const __m128i*)(py + x));
+        const __m128i u = _mm_loadl_epi64((const __m128i*)(pu + x / 2));
+        const __m128i v = _mm_loadl_epi64((const __m128i*)(pv + x / 2));
+        _yuv_to_rgb32_16(y, _mm_unpacklo_epi8(u, zero),
+                         _mm_unpacklo_epi8(v, zero), exp, dst + x * 4);
+    }
+    _yuv420_to_rgb32_c(py, pu, pv, 1, dst, x, width, exposure);
+}
+
+static void
+_nv21_to_rgb32_sse2(const uint8_t* py, const uint8_t* vu, uint8_t* dst,
+                    int width, int exposure)
+{
+    const __m128i exp = _mm_set1_epi16((short)exposure);
+    const __m128i mask = _mm_set1_epi16(0x00ff);
+    int x;
+
+    for (x = 0; x + 16 <= width; x += 16) {
+        const __m128i y = _mm_loadu_si128((const __m128i*)(py + x));
+        const __m128i c = _mm_loadu_si128((const __m128i*)(vu + x));
+        _yuv_to_rgb32_16(y, _mm_srli_epi16(c, 8), _mm_and_si128(c, mask),
+                         exp, dst + x * 4);
+    }
+    _yuv420_to_rgb32_c(py, vu + 1, vu, 2, dst, x, width, exposure);
+}
+
+static void
+_expose_line_sse2(const uint8_t* src, uint8_t* dst, int count, int exposure)
+{
+    const __m128i exp = _mm_set1_epi16((short)exposure);
+    int x;
+
+    for (x = 0; x + 16 <= count; x += 16) {
+        __m128i lo, hi;
+        _expose_16(_mm_loadu_si128((const __m128i*)(src + x)), exp, &lo, &hi);
+        _mm_storeu_si128((__m128i*)(dst + x), _mm_packus_epi16(lo, hi));
+    }
+    _expose_line_c(src, dst, x, count, exposure);
+}
+
+static void
+_split_vu_sse2(const uint8_t* vu, uint8_t* pu, uint8_t* pv, int count)
+{
+    const __m128i mask = _mm_set1_epi16(0x00ff);
+    int x;
+
+    for (x = 0; x + 16 <= count; x += 16) {
+        const __m128i a = _mm_loadu_si128((const __m128i*)(vu + x * 2));
+        const __m128i b = _mm_loadu_si128((const __m128i*)(vu + x * 2 + 16));
+        _mm_storeu_si128((__m128i*)(pv + x),
+                         _mm_packus_epi16(_mm_and_si128(a, mask),
+                                          _mm_and_si128(b, mask)));
+        _mm_storeu_si128((__m128i*)(pu + x),
+                         _mm_packus_epi16(_mm_srli_epi16(a, 8),
+                                          _mm_srli_epi16(b, 8)));
+    }
+    _split_vu_c(vu, pu, pv, x, count);
+}
+
+static void
+_merge_vu_sse2(const uint8_t* pu, const uint8_t* pv, uint8_t* vu, int count)
+{
+    int x;
+
+    for (x = 0; x + 16 <= count; x += 16) {
+        const __m128i u = _mm_loadu_si128((const __m128i*)(pu + x));
+        const __m128i v = _mm_loadu_si128((const __m128i*)(pv + x));
+        _mm_storeu_si128((__m128i*)(vu + x * 2), _mm_unpacklo_epi8(v, u));
+        _mm_storeu_si128((__m128i*)(vu + x * 2 + 16), _mm_unpackhi_epi8(v, u));
+    }
+    _merge_vu_c(pu, pv, vu, x, count);
+}
+
+#endif  /* HAVE_SSE2_KERNELS */
+
+#ifdef HAVE_SSSE3_KERNELS
+
+/* Same as _yuyv_load_16_sse2(), using byte shuffles. */
+static __inline__ SSSE3_TARGET void
+_yuyv_load_16_ssse3(const uint8_t* src, __m128i* y, __m128i* u, __m128i* v)
+{
+    /* Y0..Y7, U0..U3, V0..V3 */
+    const __m128i shuffle = _mm_setr_epi8(0, 2, 4, 6, 8, 10, 12, 14,
+                                          1, 5, 9, 13, 3, 7, 11, 15);
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i a = _mm_shuffle_epi8(
+            _mm_loadu_si128((const __m128i*)src), shuffle);
+    const __m128i b = _mm_shuffle_epi8(
+            _mm_loadu_si128((const __m128i*)(src + 16)), shuffle);
+    /* U0..U7, V0..V7 */
+    const __m128i uv = _mm_unpackhi_epi32(a, b);
+
+    *y = _mm_unpacklo_epi64(a, b);
+    *u = _mm_unpacklo_epi8(uv, zero);
+    *v = _mm_unpackhi_epi8(uv, zero);
+}
+
+static SSSE3_TARGET void
+_yuyv_to_rgb32_ssse3(const uint8_t* src, uint8_t* dst, int width, int exposure)
+{
+    const __m128i exp = _mm_set1_epi16((short)exposure);
+    int x;
+
+    for (x = 0; x + 16 <= width; x += 16) {
+        __m128i y, u, v;
+        _yuyv_load_16_ssse3(src + x * 2, &y, &u, &v);
+        _yuv_to_rgb32_16(y, u, v, exp, dst + x * 4);
+    }
+    _yuyv_to_rgb32_c(src, dst, x, width, exposure);
+}
+
+static SSSE3_TARGET void
+_yuyv_split_ssse3(const uint8_t* src, uint8_t* py, uint8_t* pu, uint8_t* pv,
+                  int width, int exposure)
+{
+    const __m128i exp = _mm_set1_epi16((short)exposure);
+    int x;
+
+    for (x = 0; x + 16 <= width; x += 16) {
+        __m128i y, u, v, ylo, yhi;
+        _yuyv_load_16_ssse3(src + x * 2, &y, &u, &v);
+        _expose_16(y, exp, &ylo, &yhi);
+        _mm_storeu_si128((__m128i*)(py + x), _mm_packus_epi16(ylo, yhi));
+        if (pu != NULL) {
+            _mm_storel_epi64((__m128i*)(pu + x / 2), _mm_packus_epi16(u, u));
+            _mm_storel_epi64((__m128i*)(pv + x / 2), _mm_packus_epi16(v, v));
+        }
+    }
+    _yuyv_split_c(src, py, pu, pv, x, width, exposure);
+}
+
+#endif  /* HAVE_SSSE3_KERNELS */
+
+/********************************************************************************
+ * Kernel selection
+ *******************************************************************************/
+
+/* Row kernels used by the converters. */
+typedef struct FastKernels {
+    void (*yuyv_to_rgb32)(const uint8_t* src, uint8_t* dst, int width,
+                          int exposure);
+    void (*yv12_to_rgb32)(const uint8_t* py, const uint8_t* pu,
+                          const uint8_t* pv, uint8_t* dst, int width,
+                          int exposure);
+    void (*nv21_to_rgb32)(const uint8_t* py, const uint8_t* vu, uint8_t* dst,
+                          int width, int exposure);
+    void (*yuyv_split)(const uint8_t* src, uint8_t* py, uint8_t* pu,
+                       uint8_t* pv, int width, int exposure);
+    void (*expose_line)(const uint8_t* src, uint8_t* dst, int count,
+                        int exposure);
+    void (*split_vu)(const uint8_t* vu, uint8_t* pu, uint8_t* pv, int count);
+    void (*merge_vu)(const uint8_t* pu, const uint8_t* pv, uint8_t* vu,
+                     int count);
+} FastKernels;
+
+/* Adapters for the portable kernels, which take a start pixel. */
+
+static void
+_yuyv_to_rgb32_scalar(const uint8_t* src, uint8_t* dst, int width, int exposure)
+{
+    _yuyv_to_rgb32_c(src, dst, 0, width, exposure);
+}
+
+static void
+_yv12_to_rgb32_scalar(const uint8_t* py, const uint8_t* pu, const uint8_t* pv,
+                      uint8_t* dst, int width, int exposure)
+{
+    _yuv420_to_rgb32_c(py, pu, pv, 1, dst, 0, width, exposure);
+}
+
+static void
+_nv21_to_rgb32_scalar(const uint8_t* py, const uint8_t* vu, uint8_t* dst,
+                      int width, int exposure)
+{
+    _yuv420_to_rgb32_c(py, vu + 1, vu, 2, dst, 0, width, exposure);
+}
+
+static void
+_yuyv_split_scalar(const uint8_t* src, uint8_t* py, uint8_t* pu, uint8_t* pv,
+                   int width, int exposure)
+{
+    _yuyv_split_c(src, py, pu, pv, 0, width, exposure);
+}
+
+static void
+_expose_line_scalar(const uint8_t* src, uint8_t* dst, int count, int exposure)
+{
+    _expose_line_c(src, dst, 0, count, exposure);
+}
+
+static void
+_split_vu_scalar(const uint8_t* vu, uint8_t* pu, uint8_t* pv, int count)
+{
+    _split_vu_c(vu, pu, pv, 0, count);
+}
+
+static void
+_merge_vu_scalar(const uint8_t* pu, const uint8_t* pv, uint8_t* vu, int count)
+{
+    _merge_vu_c(pu, pv, vu, 0, count);
+}
+
+static const FastKernels _scalar_kernels = {
+    .yuyv_to_rgb32  = _yuyv_to_rgb32_scalar,
+    .yv12_to_rgb32  = _yv12_to_rgb32_scalar,
+    .nv21_to_rgb32  = _nv21_to_rgb32_scalar,
+    .yuyv_split     = _yuyv_split_scalar,
+    .expose_line    = _expose_line_scalar,
+    .split_vu       = _split_vu_scalar,
+    .merge_vu       = _merge_vu_scalar,
+};
+
+#ifdef HAVE_SSE2_KERNELS
+static const FastKernels _sse2_kernels = {
+    .yuyv_to_rgb32  = _yuyv_to_rgb32_sse2,
+    .yv12_to_rgb32  = _yv12_to_rgb32_sse2,
+    .nv21_to_rgb32  = _nv21_to_rgb32_sse2,
+    .yuyv_split     = _yuyv_split_sse2,
+    .expose_line    = _expose_line_sse2,
+    .split_vu       = _split_vu_sse2,
+    .merge_vu       = _merge_vu_sse2,
+};
+#endif
+
+#ifdef HAVE_SSSE3_KERNELS
+static const FastKernels _ssse3_kernels = {
+    .yuyv_to_rgb32  = _yuyv_to_rgb32_ssse3,
+    .yv12_to_rgb32  = _yv12_to_rgb32_sse2,
+    .nv21_to_rgb32  = _nv21_to_rgb32_sse2,
+    .yuyv_split     = _yuyv_split_ssse3,
+    .expose_line    = _expose_line_sse2,
+    .split_vu       = _split_vu_sse2,
+    .merge_vu       = _merge_vu_sse2,
+};
+#endif
+
+/* Level requested with camera_fast_set_level(), or -1 to use the best one. */
+static int _requested_level = -1;
+
+CameraFastLevel
+camera_fast_get_best_level(void)
+{
+    static int best_level = -1;
+
+    if (best_level < 0) {
+        uint32_t ecx = 0, edx = 0;
+        best_level = CAMERA_FAST_SCALAR;
+        android_get_x86_cpuid(1, 0, NULL, NULL, &ecx, &edx);
+#ifdef HAVE_SSE2_KERNELS
+        if (edx & CPUID_EDX_SSE2) {
+            best_level = CAMERA_FAST_SSE2;
+#ifdef HAVE_SSSE3_KERNELS
+            if (ecx & CPUID_ECX_SSSE3) {
+                best_level = CAMERA_FAST_SSSE3;
+            }
+#endif
+        }
+#endif
+    }
+    return (CameraFastLevel)best_level;
+}
+
+CameraFastLevel
+camera_fast_get_level(void)
+{
+    const CameraFastLevel best = camera_fast_get_best_level();
+    if (_requested_level >= 0 && _requested_level < (int)best) {
+        return (CameraFastLevel)_requested_level;
+    }
+    return best;
+}
+
+void
+camera_fast_set_level(CameraFastLevel level)
+{
+    _requested_level = (int)level;
+}
+
+static const FastKernels*
+_get_kernels(void)
+{
+    switch (camera_fast_get_level()) {
+#ifdef HAVE_SSSE3_KERNELS
+        case CAMERA_FAST_SSSE3:
+            return &_ssse3_kernels;
+#endif
+#ifdef HAVE_SSE2_KERNELS
+        case CAMERA_FAST_SSE2:
+            return &_sse2_kernels;
+#endif
+        default:
+            return &_scalar_kernels;
+    }
+}
+
+/********************************************************************************
+ * Frame converters
+ *******************************************************************************/
+
+/* Describes the location of the Y, U, and V values of a planar 4:2:0 frame. */
+typedef struct FastPlanes {
+    uint8_t*    y;
+    uint8_t*    u;
+    uint8_t*    v;
+    /* Distance between two U / V values on a line. */
+    int         uv_inc;
+    /* Distance between two chroma lines. */
+    int         uv_stride;
+} FastPlanes;
+
+/* Fills in planes description for a YV12 or NV21 frame. */
+static void
+_get_planes(uint32_t fourcc, const void* frame, int width, int height,
+            FastPlanes* planes)
+{
+    uint8_t* const base = (uint8_t*)frame;
+    const int y_size = width * height;
+
+    planes->y = base;
+    if (fourcc == FOURCC_YV12) {
+        /* V pane follows Y pane, U pane follows V pane. */
+        planes->v = base + y_size;
+        planes->u = base + y_size + y_size / 4;
+        planes->uv_inc = 1;
+        planes->uv_stride = width / 2;
+    } else {
+        /* VU pairs follow Y pane. */
+        planes->v = base + y_size;
+        planes->u = base + y_size + 1;
+        planes->uv_inc = 2;
+        planes->uv_stride = width;
+    }
+}
+
+/* Converts lines 'y_begin' to 'y_end' (excluded) of a YUYV, YV12 or NV21
+ * frame to RGB32. */
+static void
+_convert_to_rgb32(const FastKernels* k, uint32_t from, const uint8_t* src,
+                  uint8_t* dst, int width, int height, int y_begin, int y_end,
+                  int exposure)
+{
+    int y;
+
+    if (from == FOURCC_YUYV) {
+        for (y = y_begin; y < y_end; y++) {
+            k->yuyv_to_rgb32(src + y * width * 2, dst + y * width * 4,
+                             width, exposure);
+        }
+    } else {
+        FastPlanes sp;
+        _get_planes(from, src, width, height, &sp);
+        for (y = y_begin; y < y_end; y++) {
+            const int uv_off = (y / 2) * sp.uv_stride;
+            if (from == FOURCC_YV12) {
+                k->yv12_to_rgb32(sp.y + y * width, sp.u + uv_off,
+                                 sp.v + uv_off, dst + y * width * 4,
+                                 width, exposure);
+            } else {
+                k->nv21_to_rgb32(sp.y + y * width, sp.v + uv_off,
+                                 dst + y * width * 4, width, exposure);
+            }
+        }
+    }
+}
+
+/* Writes a line of chroma values to a YV12 or NV21 frame. */
+static void
+_put_chroma(const FastKernels* k, const FastPlanes* dp, int line,
+            const uint8_t* pu, const uint8_t* pv, int count)
+{
+    const int off = line * dp->uv_stride;
+    if (dp->uv_inc == 1) {
+        memcpy(dp->u + off, pu, count);
+        memcpy(dp->v + off, pv, count);
+    } else {
+        k->merge_vu(pu, pv, dp->v + off, count);
+    }
+}
+
+/* Converts lines 'y_begin' to 'y_end' (excluded) of a YUYV, YV12 or NV21
+ * frame to YV12 or NV21. Both line numbers must be even. */
+static void
+_convert_to_yuv420(const FastKernels* k, uint32_t from, uint32_t to,
+                   const uint8_t* src, uint8_t* dst, int width, int height,
+                   int y_begin, int y_end, int exposure)
+{
+    const int lines = y_end - y_begin;
+    FastPlanes dp;
+    int y;
+
+    _get_planes(to, dst, width, height, &dp);
+
+    if (from == FOURCC_YUYV) {
+        uint8_t u[MAX_WIDTH / 2];
+        uint8_t v[MAX_WIDTH / 2];
+        for (y = y_begin; y < y_end; y++) {
+            /* Chroma comes from the odd lines. */
+            const int odd = y & 1;
+            k->yuyv_split(src + y * width * 2, dp.y + y * width,
+                          odd ? u : NULL, odd ? v : NULL, width, exposure);
+            if (odd) {
+                _put_chroma(k, &dp, y / 2, u, v, width / 2);
+            }
+        }
+        return;
+    }
+
+    /* Luminance. */
+    if (exposure == EXPOSURE_NONE) {
+        memcpy(dp.y + y_begin * width, src + y_begin * width, width * lines);
+    } else {
+        k->expose_line(src + y_begin * width, dp.y + y_begin * width,
+                       width * lines, exposure);
+    }
+
+    /* Chroma. */
+    if (from == to) {
+        /* Both 4:2:0 layouts store the chroma of each line pair in 'width'
+         * consecutive bytes, per plane for YV12. */
+        const int y_size = width * height;
+        if (from == FOURCC_NV21) {
+            memcpy(dst + y_size + (y_begin / 2) * width,
+                   src + y_size + (y_begin / 2) * width, width * lines / 2);
+        } else {
+            const int c_off = (y_begin / 2) * (width / 2);
+            const int c_size = (width / 2) * (lines / 2);
+            memcpy(dst + y_size + c_off, src + y_size + c_off, c_size);
+            memcpy(dst + y_size + y_size / 4 + c_off,
+                   src + y_size + y_size / 4 + c_off, c_size);
+        }
+    } else {
+        FastPlanes sp;
+        _get_planes(from, src, width, height, &sp);
+        for (y = y_begin / 2; y < y_end / 2; y++) {
+            const int off = y * sp.uv_stride;
+            if (from == FOURCC_YV12) {
+                /* YV12 to NV21 */
+                k->merge_vu(sp.u + off, sp.v + off, dp.v + y * dp.uv_stride,
+                            width / 2);
+            } else {
+                /* NV21 to YV12 */
+                k->split_vu(sp.v + off, dp.u + y * dp.uv_stride,
+                            dp.v + y * dp.uv_stride, width / 2);
+            }
+        }
+    }
+}
+
+int
+camera_fast_exposure(float exp_comp)
+{
+    const float scaled = exp_comp * 256.0f + 0.5f;
+    if (!(scaled > 0.0f)) {
+        return 0;
+    }
+    if (scaled >= (float)EXPOSURE_MAX) {
+        return EXPOSURE_MAX;
+    }
+    return (int)scaled;
+}
+
+int
+camera_fast_supported(uint32_t from,
+                      uint32_t to,
+                      int width,
+                      int height,
+                      int exposure)
+{
+    if (from != FOURCC_YUYV && from != FOURCC_YV12 && from != FOURCC_NV21) {
+        return 0;
+    }
+    if (to != FOURCC_RGB32 && to != FOURCC_YV12 && to != FOURCC_NV21) {
+        return 0;
+    }
+    /* 4:2:0 frames need even dimensions. */
+    if (width <= 0 || height <= 0 || width > MAX_WIDTH ||
+        (width & 1) != 0 || (height & 1) != 0) {
+        return 0;
+    }
+    return exposure >= 0 && exposure <= EXPOSURE_MAX;
+}
+
+void
+camera_fast_convert_lines(uint32_t from,
+                          uint32_t to,
+                          const void* src,
+                          void* dst,
+                          int width,
+                          int height,
+                          int y_begin,
+                          int y_end,
+                          int exposure)
+{
+    const FastKernels* const k = _get_kernels();
+
+    if (to == FOURCC_RGB32) {
+        _convert_to_rgb32(k, from, (const uint8_t*)src, (uint8_t*)dst,
+                          width, height, y_begin, y_end, exposure);
+    } else {
+        _convert_to_yuv420(k, from, to, (const uint8_t*)src, (uint8_t*)dst,
+                           width, height, y_begin, y_end, exposure);
+    }
+}
+
+int
+camera_fast_convert(uint32_t from,
+                    uint32_t to,
+                    const void* src,
+                    void* dst,
+                    int width,
+                    int height,
+                    int exposure)
+{
+    if (!camera_fast_supported(from, to, width, height, exposure)) {
+        return -1;
+    }
+    camera_fast_convert_lines(from, to, src, dst, width, height, 0, height,
+                              exposure);
+    return 0;
+}
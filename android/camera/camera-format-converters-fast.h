@@ -0,0 +1,109 @@
+/*
+ * Copyright (C) 2015 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_CAMERA_CAMERA_FORMAT_CONVERTERS_FAST_H
+#define ANDROID_CAMERA_CAMERA_FORMAT_CONVERTERS_FAST_H
+
+/*
+ * Contains declaration of specialized converters for the pixel format pairs
+ * that are commonly used by the camera emulation: YUYV, NV21 and YV12 frames
+ * captured from the host, converted into the YV12 / NV21 video frames and the
+ * RGB32 preview frames requested by the guest.
+ *
+ * Unlike the generic converters in camera-format-converters.c, these use
+ * fixed-point color math, and SSE2 / SSSE3 kernels when the host CPU supports
+ * them. White balance is not supported, so they are only used when it is
+ * neutral.
+ */
+
+#include <stdint.h>
+
+#include "android/utils/compiler.h"
+
+ANDROID_BEGIN_HEADER
+
+/* Implementation levels for the converters. */
+typedef enum CameraFastLevel {
+    /* Portable C code. */
+    CAMERA_FAST_SCALAR = 0,
+    /* SSE2 kernels. */
+    CAMERA_FAST_SSE2 = 1,
+    /* SSE2 kernels, with SSSE3 shuffles for packed YUV. */
+    CAMERA_FAST_SSSE3 = 2,
+} CameraFastLevel;
+
+/* Returns the best implementation level supported by the host CPU, and by the
+ * compiler used to build the emulator. */
+extern CameraFastLevel camera_fast_get_best_level(void);
+
+/* Returns the implementation level used by camera_fast_convert(). */
+extern CameraFastLevel camera_fast_get_level(void);
+
+/* Sets the implementation level used by camera_fast_convert(). Values higher
+ * than camera_fast_get_best_level() are lowered to it. This is used by tests
+ * and benchmarks. */
+extern void camera_fast_set_level(CameraFastLevel level);
+
+/* Converts exposure compensation into the 8.8 fixed-point value expected by
+ * camera_fast_convert(). */
+extern int camera_fast_exposure(float exp_comp);
+
+/* Converts a frame from one pixel format to another.
+ * Param:
+ *  from, to - "FOURCC" (V4L2_PIX_FMT_XXX) pixel formats of the source and
+ *      destination frames.
+ *  src, dst - Source and destination frames.
+ *  width, height - Frame dimensions.
+ *  exposure - 8.8 fixed-point exposure compensation, as returned by
+ *      camera_fast_exposure(). 256 means no compensation.
+ * Return:
+ *  0 on success, or -1 if there is no specialized converter for these formats
+ *  or dimensions, in which case 'dst' is untouched.
+ */
+extern int camera_fast_convert(uint32_t from,
+                               uint32_t to,
+                               const void* src,
+                               void* dst,
+                               int width,
+                               int height,
+                               int exposure);
+
+/* Returns 1 if camera_fast_convert() has a specialized converter for these
+ * formats, dimensions, and exposure, or 0 otherwise. */
+extern int camera_fast_supported(uint32_t from,
+                                 uint32_t to,
+                                 int width,
+                                 int height,
+                                 int exposure);
+
+/* Same as camera_fast_convert(), for lines 'y_begin' to 'y_end' (excluded)
+ * of the frame only. This allows callers to convert a frame in tiles, e.g.
+ * from several threads. Both line numbers must be even, and the conversion
+ * must be supported (see camera_fast_supported()).
+ */
+extern void camera_fast_convert_lines(uint32_t from,
+                                      uint32_t to,
+                                      const void* src,
+                                      void* dst,
+                                      int width,
+                                      int height,
+                                      int y_begin,
+                                      int y_end,
+                                      int exposure);
+
+ANDROID_END_HEADER
+
+#endif  /* ANDROID_CAMERA_CAMERA_FORMAT_CONVERTERS_FAST_H */
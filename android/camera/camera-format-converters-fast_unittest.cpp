@@ -0,0 +1,330 @@
+// Copyright 2015 The Android Open Source Project
+//
+// This software is licensed under the terms of the GNU General Public
+// License version 2, as published by the Free Software Foundation, and
+// may be copied, distributed, and modified under those terms.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+#include "android/camera/camera-format-converters-fast.h"
+
+extern "C" {
+#include "android/camera/camera-format-converters.h"
+}
+
+#include <gtest/gtest.h>
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include <vector>
+
+namespace {
+
+#define FOURCC(a, b, c, d) \
+    ((uint32_t)(a) | ((uint32_t)(b) << 8) | \
+     ((uint32_t)(c) << 16) | ((uint32_t)(d) << 24))
+
+const uint32_t kRGB32 = FOURCC('R', 'G', 'B', '4');
+const uint32_t kYUYV = FOURCC('Y', 'U', 'Y', 'V');
+const uint32_t kYV12 = FOURCC('Y', 'V', '1', '2');
+const uint32_t kNV21 = FOURCC('N', 'V', '2', '1');
+const uint32_t kSources[] = { kYUYV, kYV12, kNV21 };
+const uint32_t kDestinations[] = { kRGB32, kYV12, kNV21 };
+
+// Maximum difference between values written by the specialized converters,
+// and by the generic converters, see MatchesGenericConverters. The difference
+// is up to 3 with neutral exposure, and exposures above 1 scale it up.
+const int kGenericTolerance = 4;
+
+typedef std::vector<uint8_t> Frame;
+
+size_t frameSize(uint32_t fourcc, int width, int height) {
+    if (fourcc == kRGB32) {
+        return width * height * 4;
+    }
+    if (fourcc == kYUYV) {
+        return width * height * 2;
+    }
+    return width * height * 3 / 2;
+}
+
+int clamp(int x) {
+    return x < 0 ? 0 : (x > 255 ? 255 : x);
+}
+
+uint8_t rgbToY(int r, int g, int b) {
+    return (uint8_t)(((66 * r + 129 * g + 25 * b + 128) >> 8) + 16);
+}
+
+uint8_t rgbToU(int r, int g, int b) {
+    return (uint8_t)(((-38 * r - 74 * g + 112 * b + 128) >> 8) + 128);
+}
+
+uint8_t rgbToV(int r, int g, int b) {
+    return (uint8_t)(((112 * r - 94 * g - 18 * b + 128) >> 8) + 128);
+}
+
+// Converts a frame with the per-format converters of
+// camera-format-converters.c, which the specialized converters replace.
+Frame genericConvert(uint32_t from, uint32_t to, const Frame& src,
+                     int width, int height, float exp_comp) {
+    // The generic converters leave RGB32 alpha values alone, while the
+    // specialized ones make pixels opaque.
+    Frame dst(frameSize(to, width, height), 0xff);
+    ClientFrameBuffer fb;
+    fb.pixel_format = to;
+    fb.framebuffer = &dst[0];
+    EXPECT_EQ(0, convert_frame_generic(&src[0], from, src.size(), width,
+                                       height, &fb, 1, 1.0f, 1.0f, 1.0f,
+                                       exp_comp));
+    return dst;
+}
+
+// Builds a frame from random colors. Each 2x2 block of pixels shares the same
+// color, with some noise on luminance, which keeps the values in the range
+// of colors that survive the RGB round-trip of the generic converters.
+Frame makeFrame(uint32_t fourcc, int width, int height, unsigned seed) {
+    Frame f(frameSize(fourcc, width, height));
+    srand(seed);
+    for (int y = 0; y < height; y += 2) {
+        for (int x = 0; x < width; x += 2) {
+            const int r = rand() & 0xff, g = rand() & 0xff, b = rand() & 0xff;
+            const uint8_t u = rgbToU(r, g, b);
+            const uint8_t v = rgbToV(r, g, b);
+            for (int dy = 0; dy < 2; dy++) {
+                for (int dx = 0; dx < 2; dx++) {
+                    const int yy = clamp(rgbToY(r, g, b) + (rand() % 5) - 2);
+                    const int px = x + dx, py = y + dy;
+                    if (fourcc == kYUYV) {
+                        uint8_t* p = &f[(py * width + x) * 2];
+                        p[dx * 2] = yy;
+                        p[1] = u;
+                        p[3] = v;
+                        continue;
+                    }
+                    const int ysize = width * height;
+                    f[py * width + px] = yy;
+                    if (fourcc == kYV12) {
+                        const int off = (py / 2) * (width / 2) + px / 2;
+                        f[ysize + off] = v;
+                        f[ysize + ysize / 4 + off] = u;
+                    } else {
+                        const int off = (py / 2) * width + x;
+                        f[ysize + off] = v;
+                        f[ysize + off + 1] = u;
+                    }
+                }
+            }
+        }
+    }
+    return f;
+}
+
+// Builds a frame of random bytes.
+Frame makeNoise(uint32_t fourcc, int width, int height, unsigned seed) {
+    Frame f(frameSize(fourcc, width, height));
+    srand(seed);
+    for (size_t n = 0; n < f.size(); n++) {
+        f[n] = rand() & 0xff;
+    }
+    return f;
+}
+
+Frame fastConvert(uint32_t from, uint32_t to, const Frame& src,
+                  int width, int height, int exposure) {
+    Frame dst(frameSize(to, width, height));
+    EXPECT_EQ(0, camera_fast_convert(from, to, &src[0], &dst[0],
+                                     width, height, exposure));
+    return dst;
+}
+
+class CameraFastConvertersTest : public ::testing::Test {
+protected:
+    virtual void TearDown() {
+        camera_fast_set_level(camera_fast_get_best_level());
+    }
+};
+
+}  // namespace
+
+TEST_F(CameraFastConvertersTest, Exposure) {
+    EXPECT_EQ(256, camera_fast_exposure(1.0f));
+    EXPECT_EQ(128, camera_fast_exposure(0.5f));
+    EXPECT_EQ(0, camera_fast_exposure(-1.0f));
+    EXPECT_EQ(32767, camera_fast_exposure(1000.0f));
+}
+
+TEST_F(CameraFastConvertersTest, UnsupportedConversions) {
+    uint8_t src[64 * 4] = { 0 }, dst[64 * 4];
+    // RGB32 sources are handled by the generic converters.
+    EXPECT_EQ(-1, camera_fast_convert(kRGB32, kYV12, src, dst, 4, 4, 256));
+    // So are YUYV destinations.
+    EXPECT_EQ(-1, camera_fast_convert(kYV12, kYUYV, src, dst, 4, 4, 256));
+    // Odd dimensions.
+    EXPECT_EQ(-1, camera_fast_convert(kYUYV, kRGB32, src, dst, 3, 4, 256));
+    EXPECT_EQ(-1, camera_fast_convert(kYUYV, kRGB32, src, dst, 4, 3, 256));
+    EXPECT_EQ(0, camera_fast_supported(kYUYV, kRGB32, 4, 3, 256));
+    EXPECT_EQ(1, camera_fast_supported(kYUYV, kRGB32, 4, 4, 256));
+}
+
+// The generic converters go through RGB, and back to YUV, to apply exposure
+// compensation, even when it is neutral. This loses some precision, so the
+// specialized converters, which don't, can differ from them by a few steps.
+// For frames made of colors that survive the round trip, all implementation
+// levels must stay within kGenericTolerance of them.
+TEST_F(CameraFastConvertersTest, MatchesGenericConverters) {
+    const int width = 64, height = 16;
+    static const float kExposures[] = { 1.0f, 0.8f, 1.3f };
+    const CameraFastLevel best = camera_fast_get_best_level();
+    for (size_t s = 0; s < sizeof(kSources) / sizeof(kSources[0]); s++) {
+        const uint32_t from = kSources[s];
+        const Frame src = makeFrame(from, width, height, 1234);
+        for (size_t d = 0; d < sizeof(kDestinations) / sizeof(kDestinations[0]);
+             d++) {
+            const uint32_t to = kDestinations[d];
+            for (size_t e = 0; e < sizeof(kExposures) / sizeof(kExposures[0]);
+                 e++) {
+                const Frame expected = genericConvert(from, to, src, width,
+                                                      height, kExposures[e]);
+                for (int level = CAMERA_FAST_SCALAR; level <= best; level++) {
+                    camera_fast_set_level((CameraFastLevel)level);
+                    const Frame actual = fastConvert(
+                            from, to, src, width, height,
+                            camera_fast_exposure(kExposures[e]));
+                    ASSERT_EQ(expected.size(), actual.size());
+                    int max_diff = 0;
+                    for (size_t n = 0; n < expected.size(); n++) {
+                        const int diff = abs((int)expected[n] - (int)actual[n]);
+                        max_diff = diff > max_diff ? diff : max_diff;
+                    }
+                    EXPECT_LE(max_diff, kGenericTolerance)
+                            << "level " << level << " exposure "
+                            << kExposures[e] << " from " << std::hex << from
+                            << " to " << to;
+                }
+            }
+        }
+    }
+}
+
+TEST_F(CameraFastConvertersTest, SameFormatIsCopied) {
+    const int width = 32, height = 8;
+    const Frame yv12 = makeNoise(kYV12, width, height, 1);
+    EXPECT_TRUE(yv12 == fastConvert(kYV12, kYV12, yv12, width, height, 256));
+    const Frame nv21 = makeNoise(kNV21, width, height, 2);
+    EXPECT_TRUE(nv21 == fastConvert(kNV21, kNV21, nv21, width, height, 256));
+}
+
+// Converting a frame in tiles, as the one-pass converter does, must give the
+// same result as converting it at once.
+TEST_F(CameraFastConvertersTest, LinesMatchWholeFrame) {
+    const int width = 34, height = 22, kTileLines = 4;
+    static const int kExposures[] = { 256, 300 };
+    for (size_t s = 0; s < sizeof(kSources) / sizeof(kSources[0]); s++) {
+        const uint32_t from = kSources[s];
+        const Frame src = makeNoise(from, width, height, 7);
+        for (size_t d = 0; d < sizeof(kDestinations) / sizeof(kDestinations[0]);
+             d++) {
+            const uint32_t to = kDestinations[d];
+            for (size_t e = 0; e < sizeof(kExposures) / sizeof(kExposures[0]);
+                 e++) {
+                const Frame expected = fastConvert(from, to, src, width,
+                                                   height, kExposures[e]);
+                Frame tiled(expected.size());
+                // Last tile first, to catch writes outside of a tile.
+                for (int y = (height - 1) / kTileLines * kTileLines; y >= 0;
+                     y -= kTileLines) {
+                    const int y_end = y + kTileLines < height ?
+                                      y + kTileLines : height;
+                    camera_fast_convert_lines(from, to, &src[0], &tiled[0],
+                                              width, height, y, y_end,
+                                              kExposures[e]);
+                }
+                EXPECT_TRUE(expected == tiled)
+                        << "from " << std::hex << from << " to " << to;
+            }
+        }
+    }
+}
+
+TEST_F(CameraFastConvertersTest, ExposureScalesLuminance) {
+    const int width = 16, height = 2;
+    Frame src = makeNoise(kNV21, width, height, 3);
+    src[0] = 100;
+    src[1] = 200;
+    const Frame dst = fastConvert(kNV21, kYV12, src, width, height,
+                                  camera_fast_exposure(1.5f));
+    EXPECT_EQ(150, dst[0]);
+    EXPECT_EQ(255, dst[1]);
+    // Chroma is not changed.
+    EXPECT_EQ(src[width * height], dst[width * height]);
+}
+
+// Check that all SIMD kernels produce the same output as the portable ones,
+// including for odd widths that use the portable code for the end of lines.
+TEST_F(CameraFastConvertersTest, AllLevelsMatch) {
+    static const int kWidths[] = { 2, 14, 16, 34, 64, 118 };
+    static const int kExposures[] = { 0, 200, 256, 300, 32767 };
+    const CameraFastLevel best = camera_fast_get_best_level();
+
+    for (size_t w = 0; w < sizeof(kWidths) / sizeof(kWidths[0]); w++) {
+        const int width = kWidths[w], height = 6;
+        for (size_t s = 0; s < sizeof(kSources) / sizeof(kSources[0]); s++) {
+            const uint32_t from = kSources[s];
+            const Frame src = makeNoise(from, width, height, 42 + width);
+            for (size_t d = 0;
+                 d < sizeof(kDestinations) / sizeof(kDestinations[0]); d++) {
+                const uint32_t to = kDestinations[d];
+                for (size_t e = 0;
+                     e < sizeof(kExposures) / sizeof(kExposures[0]); e++) {
+                    camera_fast_set_level(CAMERA_FAST_SCALAR);
+                    const Frame expected = fastConvert(from, to, src, width,
+                                                       height, kExposures[e]);
+                    for (int level = CAMERA_FAST_SSE2; level <= best; level++) {
+                        camera_fast_set_level((CameraFastLevel)level);
+                        EXPECT_TRUE(expected == fastConvert(from, to, src,
+                                                            width, height,
+                                                            kExposures[e]))
+                                << "level " << level << " width " << width
+                                << " from " << std::hex << from << " to " << to;
+                    }
+                }
+            }
+        }
+    }
+}
+
+// Not a real test: prints the time needed to convert a 1280x720 frame with
+// each implementation level. Run with --gtest_also_run_disabled_tests.
+TEST_F(CameraFastConvertersTest, DISABLED_Benchmark) {
+    const int width = 1280, height = 720, kFrames = 100;
+    const CameraFastLevel best = camera_fast_get_best_level();
+
+    for (size_t s = 0; s < sizeof(kSources) / sizeof(kSources[0]); s++) {
+        const uint32_t from = kSources[s];
+        const Frame src = makeNoise(from, width, height, 7);
+        for (size_t d = 0; d < sizeof(kDestinations) / sizeof(kDestinations[0]);
+             d++) {
+            const uint32_t to = kDestinations[d];
+            Frame dst(frameSize(to, width, height));
+            for (int level = CAMERA_FAST_SCALAR; level <= best; level++) {
+                camera_fast_set_level((CameraFastLevel)level);
+                const clock_t start = clock();
+                for (int n = 0; n < kFrames; n++) {
+                    camera_fast_convert(from, to, &src[0], &dst[0],
+                                        width, height, 300);
+                }
+                const double ms = (double)(clock() - start) * 1000. /
+                                  CLOCKS_PER_SEC / kFrames;
+                printf("%.4s -> %.4s level %d: %.3f ms/frame\n",
+                       (const char*)&from, (const char*)&to, level, ms);
+            }
+        }
+    }
+}
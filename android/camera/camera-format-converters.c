@@ -22,7 +22,9 @@
 #else
 #include <linux/videodev2.h>
 #endif
-#include "android/camera/camera-format-converters.h"
+#include "android/camera/camera-format-converters.h"
+#include "android/camera/camera-format-converters-fast.h"
+#include "android/utils/worker-pool.h"
 
 #define  E(...)    derror(__VA_ARGS__)
 #define  W(...)    dwarning(__VA_ARGS__)
@@ -420,10 +422,15 @@ _change_white_balance_RGB_b(uint8_t* r,
  * calculated.
  *
  * Performance considerations:
- * Since converters implemented here are intended to work as part of the camera
- * emulation, making the code super performant is not a priority at all. There
- * will be enough loses in other parts of the emultion to overlook any slight
- * inefficiences in the conversion algorithm as neglectable.
+ * The converters implemented here are generic, and go through per-pixel
+ * callbacks and floating point math. The pixel format pairs that are used by
+ * the camera emulation on every frame (YUYV, YV12 and NV21 into YV12, NV21 and
+ * RGB32) are handled by the specialized converters in
+ * camera-format-converters-fast.c instead, as long as white balance is
+ * neutral. All other framebuffers are filled by the one-pass converter (see
+ * _pass_convert()), which decodes the source frame once for all of them. The
+ * per-format converters below remain the reference implementation, and are
+ * used for frames with odd widths, or wider than MAX_PASS_WIDTH.
  */
 
 typedef struct RGBDesc RGBDesc;
@@ -1602,6 +1609,375 @@ _get_pixel_format_descriptor(uint32_t pixel_format)
     return NULL;
 }
 
+/* Converts a frame with the per-format converters.
+ * Return:
+ *  0 on success, or -1 if there is no converter for these formats.
+ */
+static int
+_convert_generic(const PIXFormat* src_desc,
+                 const PIXFormat* dst_desc,
+                 const void* frame,
+                 void* dst,
+                 int width,
+                 int height,
+                 float r_scale,
+                 float g_scale,
+                 float b_scale,
+                 float exp_comp)
+{
+    switch (src_desc->format_sel) {
+        case PIX_FMT_RGB:
+            if (dst_desc->format_sel == PIX_FMT_RGB) {
+                RGBToRGB(src_desc->desc.rgb_desc, dst_desc->desc.rgb_desc,
+                         frame, dst, width, height,
+                         r_scale, g_scale, b_scale, exp_comp);
+            } else if (dst_desc->format_sel == PIX_FMT_YUV) {
+                RGBToYUV(src_desc->desc.rgb_desc, dst_desc->desc.yuv_desc,
+                         frame, dst, width, height,
+                         r_scale, g_scale, b_scale, exp_comp);
+            } else {
+                E("%s: Unexpected destination pixel format %d",
+                  __FUNCTION__, dst_desc->format_sel);
+                return -1;
+            }
+            break;
+        case PIX_FMT_YUV:
+            if (dst_desc->format_sel == PIX_FMT_RGB) {
+                YUVToRGB(src_desc->desc.yuv_desc, dst_desc->desc.rgb_desc,
+                         frame, dst, width, height,
+                         r_scale, g_scale, b_scale, exp_comp);
+            } else if (dst_desc->format_sel == PIX_FMT_YUV) {
+                YUVToYUV(src_desc->desc.yuv_desc, dst_desc->desc.yuv_desc,
+                         frame, dst, width, height,
+                         r_scale, g_scale, b_scale, exp_comp);
+            } else {
+                E("%s: Unexpected destination pixel format %d",
+                  __FUNCTION__, dst_desc->format_sel);
+                return -1;
+            }
+            break;
+        case PIX_FMT_BAYER:
+            if (dst_desc->format_sel == PIX_FMT_RGB) {
+                BAYERToRGB(src_desc->desc.bayer_desc, dst_desc->desc.rgb_desc,
+                          frame, dst, width, height,
+                          r_scale, g_scale, b_scale, exp_comp);
+            } else if (dst_desc->format_sel == PIX_FMT_YUV) {
+                BAYERToYUV(src_desc->desc.bayer_desc, dst_desc->desc.yuv_desc,
+                           frame, dst, width, height,
+                           r_scale, g_scale, b_scale, exp_comp);
+            } else {
+                E("%s: Unexpected destination pixel format %d",
+                  __FUNCTION__, dst_desc->format_sel);
+                return -1;
+            }
+            break;
+        default:
+            E("%s: Unexpected source pixel format %d",
+              __FUNCTION__, src_desc->format_sel);
+            return -1;
+    }
+    return 0;
+}
+
+/********************************************************************************
+ * One-pass converter
+ *******************************************************************************/
+
+/*
+ * The generic converters above go through the entire source frame once per
+ * destination framebuffer, decoding every source pixel, and applying white
+ * balance and exposure compensation to it each time. The one-pass converter
+ * below decodes each source line once into intermediate RGB and / or YUV
+ * lines, applies white balance and exposure compensation there, and then writes
+ * all destination framebuffers from the intermediate lines, while they are
+ * still in the cache.
+ *
+ * The frame is split into tiles of TILE_LINES lines. Large frames are converted
+ * by the shared worker pool (see android/utils/worker-pool.h), each thread
+ * converting whole tiles. Tiles always
+ * contain an even number of lines, so the lines sharing chroma values in 4:2:0
+ * formats are converted by the same thread.
+ *
+ * Destinations supported by the specialized converters (see
+ * camera-format-converters-fast.h) are written by their row kernels, tile by
+ * tile, in the same pass, so that all destinations are written while the
+ * source tile is still in the cache.
+ *
+ * Note that unlike the generic converters, this one skips white balance and
+ * exposure compensation altogether when they are neutral, and when both are
+ * neutral, YUV to YUV conversions copy Y, U, and V values as is.
+ */
+
+/* Maximum number of framebuffers converted in one pass. */
+#define MAX_PASS_FBS        4
+
+/* Maximum frame width supported by the one-pass converter. */
+#define MAX_PASS_WIDTH      4096
+
+/* Number of lines in a tile. Must be even. */
+#define TILE_LINES          16
+
+/* Frames with at least this many pixels are converted by the worker pool. */
+#define POOL_MIN_PIXELS     (640 * 480)
+
+/* Describes a frame conversion done in one pass. */
+typedef struct PassJob {
+    /* Source frame and its format. */
+    const void*         frame;
+    uint32_t            pixel_format;
+    const PIXFormat*    src_desc;
+    /* Frame dimensions. */
+    int                 width;
+    int                 height;
+    /* Destination framebuffers and their formats. */
+    void*               dst[MAX_PASS_FBS];
+    const PIXFormat*    dst_desc[MAX_PASS_FBS];
+    /* Destination formats for the specialized converters, or 0 for the
+     * destinations written from the intermediate lines. */
+    uint32_t            fast_to[MAX_PASS_FBS];
+    int                 dst_num;
+    /* Whether there are RGB, or YUV destinations written from the
+     * intermediate lines. */
+    int                 need_rgb;
+    int                 need_yuv;
+    /* Exposure compensation for the specialized converters. */
+    int                 fast_exposure;
+    /* White balance and exposure compensation. */
+    float               r_scale;
+    float               g_scale;
+    float               b_scale;
+    float               exp_comp;
+    int                 white_balance;
+    int                 exposure;
+    /* Number of tiles in the frame. */
+    int                 tile_num;
+} PassJob;
+
+/* Intermediate lines. */
+typedef struct PassLine {
+    /* R, G, and B values for each pixel. */
+    uint8_t     rgb[MAX_PASS_WIDTH * 3];
+    /* Y values for each pixel. */
+    uint8_t     y[MAX_PASS_WIDTH];
+    /* U, and V values for each pair of pixels. */
+    uint8_t     u[MAX_PASS_WIDTH / 2];
+    uint8_t     v[MAX_PASS_WIDTH / 2];
+} PassLine;
+
+/* Decodes a source line into the intermediate RGB line, or into the
+ * intermediate YUV line if the source is YUV, and there is no white balance or
+ * exposure compensation to apply.
+ * Return:
+ *  1 if the YUV line has been filled, or 0 if the RGB line has been filled.
+ */
+static int
+_pass_decode_line(const PassJob* job, PassLine* line, int y)
+{
+    const int width = job->width;
+    int x;
+
+    switch (job->src_desc->format_sel) {
+        case PIX_FMT_RGB: {
+            const RGBDesc* const fmt = job->src_desc->desc.rgb_desc;
+            const void* src =
+                (const uint8_t*)job->frame + (size_t)y * width * fmt->rgb_inc;
+            uint8_t* rgb = line->rgb;
+            for (x = 0; x < width; x++, rgb += 3) {
+                src = fmt->load_rgb(src, &rgb[0], &rgb[1], &rgb[2]);
+            }
+            return 0;
+        }
+
+        case PIX_FMT_YUV: {
+            const YUVDesc* const fmt = job->src_desc->desc.yuv_desc;
+            const uint8_t* const frame = (const uint8_t*)job->frame;
+            const uint8_t* pY = frame + fmt->Y_offset +
+                                (size_t)y * (width / 2) * fmt->Y_next_pair;
+            const uint8_t* pU = frame + fmt->u_offset(fmt, y, width,
+                                                      job->height);
+            const uint8_t* pV = frame + fmt->v_offset(fmt, y, width,
+                                                      job->height);
+            if (!job->white_balance && !job->exposure) {
+                for (x = 0; x < width; x += 2, pY += fmt->Y_next_pair,
+                                       pU += fmt->UV_inc, pV += fmt->UV_inc) {
+                    line->y[x] = pY[0];
+                    line->y[x + 1] = pY[fmt->Y_inc];
+                    line->u[x / 2] = *pU;
+                    line->v[x / 2] = *pV;
+                }
+                return 1;
+            }
+            for (x = 0; x < width; x += 2, pY += fmt->Y_next_pair,
+                                   pU += fmt->UV_inc, pV += fmt->UV_inc) {
+                uint8_t* const rgb = line->rgb + x * 3;
+                YUVToRGBPix(pY[0], *pU, *pV, &rgb[0], &rgb[1], &rgb[2]);
+                YUVToRGBPix(pY[fmt->Y_inc], *pU, *pV, &rgb[3], &rgb[4], &rgb[5]);
+            }
+            return 0;
+        }
+
+        case PIX_FMT_BAYER:
+        default: {
+            const BayerDesc* const fmt = job->src_desc->desc.bayer_desc;
+            const int shift = (fmt->mask == kBayer12) ? 4 :
+                              (fmt->mask == kBayer10) ? 2 : 0;
+            uint8_t* rgb = line->rgb;
+            for (x = 0; x < width; x++, rgb += 3) {
+                int r, g, b;
+                _get_bayerRGB(fmt, job->frame, x, y, width, job->height,
+                              &r, &g, &b);
+                rgb[0] = clamp(r >> shift);
+                rgb[1] = clamp(g >> shift);
+                rgb[2] = clamp(b >> shift);
+            }
+            return 0;
+        }
+    }
+}
+
+/* Applies white balance and exposure compensation to the intermediate RGB
+ * line. */
+static void
+_pass_adjust_line(const PassJob* job, PassLine* line)
+{
+    uint8_t* rgb = line->rgb;
+    int x;
+
+    for (x = 0; x < job->width; x++, rgb += 3) {
+        if (job->white_balance) {
+            rgb[0] = clamp((int)((float)rgb[0] / job->r_scale));
+            rgb[1] = clamp((int)((float)rgb[1] / job->g_scale));
+            rgb[2] = clamp((int)((float)rgb[2] / job->b_scale));
+        }
+        if (job->exposure) {
+            _change_exposure_RGB(&rgb[0], &rgb[1], &rgb[2], job->exp_comp);
+        }
+    }
+}
+
+/* Converts the intermediate RGB line into the intermediate YUV line. Chroma
+ * values are taken from the first pixel of each pair, like the generic
+ * converters do. */
+static void
+_pass_rgb_to_yuv_line(const PassJob* job, PassLine* line)
+{
+    const uint8_t* rgb = line->rgb;
+    int x;
+
+    for (x = 0; x < job->width; x += 2, rgb += 6) {
+        R8G8B8ToYUV(rgb[0], rgb[1], rgb[2],
+                    &line->y[x], &line->u[x / 2], &line->v[x / 2]);
+        line->y[x + 1] = RGB2Y((int)rgb[3], (int)rgb[4], (int)rgb[5]);
+    }
+}
+
+/* Converts the intermediate YUV line into the intermediate RGB line. */
+static void
+_pass_yuv_to_rgb_line(const PassJob* job, PassLine* line)
+{
+    uint8_t* rgb = line->rgb;
+    int x;
+
+    for (x = 0; x < job->width; x += 2, rgb += 6) {
+        const uint8_t U = line->u[x / 2];
+        const uint8_t V = line->v[x / 2];
+        YUVToRGBPix(line->y[x], U, V, &rgb[0], &rgb[1], &rgb[2]);
+        YUVToRGBPix(line->y[x + 1], U, V, &rgb[3], &rgb[4], &rgb[5]);
+    }
+}
+
+/* Writes the intermediate lines into a destination framebuffer. */
+static void
+_pass_write_line(const PassJob* job,
+                 const PassLine* line,
+                 int n,
+                 int y)
+{
+    const int width = job->width;
+    int x;
+
+    if (job->dst_desc[n]->format_sel == PIX_FMT_RGB) {
+        const RGBDesc* const fmt = job->dst_desc[n]->desc.rgb_desc;
+        void* dst = (uint8_t*)job->dst[n] + (size_t)y * width * fmt->rgb_inc;
+        const uint8_t* rgb = line->rgb;
+        for (x = 0; x < width; x++, rgb += 3) {
+            dst = fmt->save_rgb(dst, rgb[0], rgb[1], rgb[2]);
+        }
+    } else {
+        const YUVDesc* const fmt = job->dst_desc[n]->desc.yuv_desc;
+        uint8_t* const frame = (uint8_t*)job->dst[n];
+        uint8_t* pY = frame + fmt->Y_offset +
+                      (size_t)y * (width / 2) * fmt->Y_next_pair;
+        uint8_t* pU = frame + fmt->u_offset(fmt, y, width, job->height);
+        uint8_t* pV = frame + fmt->v_offset(fmt, y, width, job->height);
+        for (x = 0; x < width; x += 2, pY += fmt->Y_next_pair,
+                               pU += fmt->UV_inc, pV += fmt->UV_inc) {
+            pY[0] = line->y[x];
+            pY[fmt->Y_inc] = line->y[x + 1];
+            *pU = line->u[x / 2];
+            *pV = line->v[x / 2];
+        }
+    }
+}
+
+/* Converts a tile of a job. This is called concurrently by the worker pool
+ * threads for large frames. */
+static void
+_pass_run_tile(void* opaque, int tile)
+{
+    PassJob* const job = (PassJob*)opaque;
+    PassLine line;
+    const int y_begin = tile * TILE_LINES;
+    const int y_end = MIN(y_begin + TILE_LINES, job->height);
+    int y, n;
+
+    for (n = 0; n < job->dst_num; n++) {
+        if (job->fast_to[n] != 0) {
+            camera_fast_convert_lines(job->pixel_format, job->fast_to[n],
+                                      job->frame, job->dst[n],
+                                      job->width, job->height,
+                                      y_begin, y_end, job->fast_exposure);
+        }
+    }
+    if (!job->need_rgb && !job->need_yuv) {
+        return;
+    }
+    for (y = y_begin; y < y_end; y++) {
+        if (_pass_decode_line(job, &line, y)) {
+            if (job->need_rgb) {
+                _pass_yuv_to_rgb_line(job, &line);
+            }
+        } else {
+            _pass_adjust_line(job, &line);
+            if (job->need_yuv) {
+                _pass_rgb_to_yuv_line(job, &line);
+            }
+        }
+        for (n = 0; n < job->dst_num; n++) {
+            if (job->fast_to[n] == 0) {
+                _pass_write_line(job, &line, n, y);
+            }
+        }
+    }
+}
+
+/* Converts a frame into all destination framebuffers of a job. */
+static void
+_pass_convert(PassJob* job)
+{
+    int tile;
+
+    job->tile_num = (job->height + TILE_LINES - 1) / TILE_LINES;
+
+    if (job->width * job->height >= POOL_MIN_PIXELS) {
+        worker_pool_run(_pass_run_tile, job, job->tile_num);
+        return;
+    }
+    for (tile = 0; tile < job->tile_num; tile++) {
+        _pass_run_tile(job, tile);
+    }
+}
+
 /********************************************************************************
  * Public API
  *******************************************************************************/
@@ -1631,6 +2007,12 @@ convert_frame(const void* frame,
               float exp_comp)
 {
     int n;
+    /* Specialized converters don't support white balance. */
+    const int use_fast = r_scale == 1.0f && g_scale == 1.0f && b_scale == 1.0f;
+    const int exposure = camera_fast_exposure(exp_comp);
+    /* Framebuffers converted in one pass. */
+    PassJob job;
+    const int use_pass = (width & 1) == 0 && width <= MAX_PASS_WIDTH;
     const PIXFormat* src_desc = _get_pixel_format_descriptor(pixel_format);
     if (src_desc == NULL) {
         E("%s: Source pixel format %.4s is unknown",
@@ -1638,6 +2020,20 @@ convert_frame(const void* frame,
         return -1;
     }
 
+    memset(&job, 0, sizeof(job));
+    job.frame = frame;
+    job.pixel_format = pixel_format;
+    job.src_desc = src_desc;
+    job.width = width;
+    job.height = height;
+    job.r_scale = r_scale;
+    job.g_scale = g_scale;
+    job.b_scale = b_scale;
+    job.exp_comp = exp_comp;
+    job.white_balance = !use_fast;
+    job.exposure = exp_comp != 1.0f;
+    job.fast_exposure = exposure;
+
     for (n = 0; n < fbs_num; n++) {
         /* Note that we need to apply white balance, exposure compensation, etc.
          * when we transfer the captured frame to the user framebuffer. So, even
@@ -1650,56 +2046,84 @@ convert_frame(const void* frame,
               __FUNCTION__, (const char*)&framebuffers[n].pixel_format);
             return -1;
         }
-        switch (src_desc->format_sel) {
-            case PIX_FMT_RGB:
-                if (dst_desc->format_sel == PIX_FMT_RGB) {
-                    RGBToRGB(src_desc->desc.rgb_desc, dst_desc->desc.rgb_desc,
-                             frame, framebuffers[n].framebuffer, width, height,
-                             r_scale, g_scale, b_scale, exp_comp);
-                } else if (dst_desc->format_sel == PIX_FMT_YUV) {
-                    RGBToYUV(src_desc->desc.rgb_desc, dst_desc->desc.yuv_desc,
-                             frame, framebuffers[n].framebuffer, width, height,
-                             r_scale, g_scale, b_scale, exp_comp);
-                } else {
-                    E("%s: Unexpected destination pixel format %d",
-                      __FUNCTION__, dst_desc->format_sel);
-                    return -1;
-                }
-                break;
-            case PIX_FMT_YUV:
-                if (dst_desc->format_sel == PIX_FMT_RGB) {
-                    YUVToRGB(src_desc->desc.yuv_desc, dst_desc->desc.rgb_desc,
-                             frame, framebuffers[n].framebuffer, width, height,
-                             r_scale, g_scale, b_scale, exp_comp);
-                } else if (dst_desc->format_sel == PIX_FMT_YUV) {
-                    YUVToYUV(src_desc->desc.yuv_desc, dst_desc->desc.yuv_desc,
-                             frame, framebuffers[n].framebuffer, width, height,
-                             r_scale, g_scale, b_scale, exp_comp);
-                } else {
-                    E("%s: Unexpected destination pixel format %d",
-                      __FUNCTION__, dst_desc->format_sel);
-                    return -1;
-                }
-                break;
-            case PIX_FMT_BAYER:
+        if (use_pass && job.dst_num < MAX_PASS_FBS) {
+            if (use_fast &&
+                camera_fast_supported(pixel_format,
+                                      framebuffers[n].pixel_format,
+                                      width, height, exposure)) {
+                job.dst[job.dst_num] = framebuffers[n].framebuffer;
+                job.dst_desc[job.dst_num] = dst_desc;
+                job.fast_to[job.dst_num] = framebuffers[n].pixel_format;
+                job.dst_num++;
+                continue;
+            }
+            if (dst_desc->format_sel == PIX_FMT_RGB ||
+                dst_desc->format_sel == PIX_FMT_YUV) {
+                job.dst[job.dst_num] = framebuffers[n].framebuffer;
+                job.dst_desc[job.dst_num] = dst_desc;
+                job.dst_num++;
                 if (dst_desc->format_sel == PIX_FMT_RGB) {
-                    BAYERToRGB(src_desc->desc.bayer_desc, dst_desc->desc.rgb_desc,
-                              frame, framebuffers[n].framebuffer, width, height,
-                              r_scale, g_scale, b_scale, exp_comp);
-                } else if (dst_desc->format_sel == PIX_FMT_YUV) {
-                    BAYERToYUV(src_desc->desc.bayer_desc, dst_desc->desc.yuv_desc,
-                               frame, framebuffers[n].framebuffer, width, height,
-                               r_scale, g_scale, b_scale, exp_comp);
+                    job.need_rgb = 1;
                 } else {
-                    E("%s: Unexpected destination pixel format %d",
-                      __FUNCTION__, dst_desc->format_sel);
-                    return -1;
+                    job.need_yuv = 1;
                 }
-                break;
-            default:
-                E("%s: Unexpected source pixel format %d",
-                  __FUNCTION__, dst_desc->format_sel);
-                return -1;
+                continue;
+            }
+        }
+        /* More framebuffers than a pass supports. */
+        if (use_fast &&
+            camera_fast_convert(pixel_format, framebuffers[n].pixel_format,
+                                frame, framebuffers[n].framebuffer,
+                                width, height, exposure) == 0) {
+            continue;
+        }
+        if (_convert_generic(src_desc, dst_desc, frame,
+                             framebuffers[n].framebuffer, width, height,
+                             r_scale, g_scale, b_scale, exp_comp)) {
+            return -1;
+        }
+    }
+
+    if (job.dst_num != 0) {
+        _pass_convert(&job);
+    }
+
+    return 0;
+}
+
+int
+convert_frame_generic(const void* frame,
+                      uint32_t pixel_format,
+                      size_t framebuffer_size,
+                      int width,
+                      int height,
+                      ClientFrameBuffer* framebuffers,
+                      int fbs_num,
+                      float r_scale,
+                      float g_scale,
+                      float b_scale,
+                      float exp_comp)
+{
+    int n;
+    const PIXFormat* src_desc = _get_pixel_format_descriptor(pixel_format);
+    if (src_desc == NULL) {
+        E("%s: Source pixel format %.4s is unknown",
+          __FUNCTION__, (const char*)&pixel_format);
+        return -1;
+    }
+
+    for (n = 0; n < fbs_num; n++) {
+        const PIXFormat* dst_desc =
+            _get_pixel_format_descriptor(framebuffers[n].pixel_format);
+        if (dst_desc == NULL) {
+            E("%s: Destination pixel format %.4s is unknown",
+              __FUNCTION__, (const char*)&framebuffers[n].pixel_format);
+            return -1;
+        }
+        if (_convert_generic(src_desc, dst_desc, frame,
+                             framebuffers[n].framebuffer, width, height,
+                             r_scale, g_scale, b_scale, exp_comp)) {
+            return -1;
         }
     }
 
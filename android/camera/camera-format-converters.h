@@ -70,4 +70,21 @@ extern int convert_frame(const void* frame,
                          float b_scale,
                          float exp_comp);
 
+/* Same as convert_frame(), but only uses the per-format converters, which are
+ * the reference implementation for the specialized and one-pass converters
+ * that convert_frame() uses whenever it can. This is slower, and only meant
+ * to test these converters against.
+ */
+extern int convert_frame_generic(const void* frame,
+                                 uint32_t pixel_format,
+                                 size_t framebuffer_size,
+                                 int width,
+                                 int height,
+                                 ClientFrameBuffer* framebuffers,
+                                 int fbs_num,
+                                 float r_scale,
+                                 float g_scale,
+                                 float b_scale,
+                                 float exp_comp);
+
 #endif  /* ANDROID_CAMERA_CAMERA_FORMAT_CONVERTERS_H */
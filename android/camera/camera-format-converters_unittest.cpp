@@ -0,0 +1,340 @@
+// Copyright 2015 The Android Open Source Project
+//
+// This software is licensed under the terms of the GNU General Public
+// License version 2, as published by the Free Software Foundation, and
+// may be copied, distributed, and modified under those terms.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+extern "C" {
+#include "android/camera/camera-format-converters.h"
+}
+#include "android/utils/worker-pool.h"
+
+#include <gtest/gtest.h>
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#include <algorithm>
+#include <vector>
+
+// These tests cover the one-pass converter used by convert_frame(), which
+// writes all destination framebuffers from one decoding of the source frame.
+
+namespace {
+
+typedef std::vector<uint8_t> Frame;
+
+// Frames at least this large are converted by the worker pool.
+const int kPoolWidth = 640;
+const int kPoolHeight = 480;
+
+// convert_frame() converts at most that many framebuffers in one pass. The
+// others go through the per-format converters.
+const int kMaxPassFbs = 4;
+
+size_t frameSize(uint32_t fourcc, int width, int height) {
+    switch (fourcc) {
+        case V4L2_PIX_FMT_RGB32:
+            return width * height * 4;
+        case V4L2_PIX_FMT_RGB24:
+            return width * height * 3;
+        case V4L2_PIX_FMT_RGB565:
+        case V4L2_PIX_FMT_YUYV:
+        case V4L2_PIX_FMT_UYVY:
+        case V4L2_PIX_FMT_SGRBG10:
+        case V4L2_PIX_FMT_SRGGB12:
+            return width * height * 2;
+        case V4L2_PIX_FMT_SBGGR8:
+            return width * height;
+        default:
+            // 4:2:0 formats.
+            return width * height * 3 / 2;
+    }
+}
+
+Frame makeNoise(uint32_t fourcc, int width, int height, unsigned seed) {
+    Frame frame(frameSize(fourcc, width, height));
+    srand(seed);
+    for (size_t n = 0; n < frame.size(); n++) {
+        frame[n] = (uint8_t)(rand() >> 4);
+    }
+    if (fourcc == V4L2_PIX_FMT_SGRBG10 || fourcc == V4L2_PIX_FMT_SRGGB12) {
+        // Keep the unused high bits clear.
+        const uint8_t mask = fourcc == V4L2_PIX_FMT_SGRBG10 ? 0x03 : 0x0f;
+        for (size_t n = 1; n < frame.size(); n += 2) {
+            frame[n] &= mask;
+        }
+    }
+    return frame;
+}
+
+// Makes a Bayer frame where all pixels have the same |value|.
+Frame makeFlatBayer(uint32_t fourcc, int width, int height, int value) {
+    Frame frame(frameSize(fourcc, width, height));
+    if (fourcc == V4L2_PIX_FMT_SBGGR8) {
+        std::fill(frame.begin(), frame.end(), (uint8_t)value);
+    } else {
+        for (size_t n = 0; n < frame.size(); n += 2) {
+            frame[n] = (uint8_t)value;
+            frame[n + 1] = (uint8_t)(value >> 8);
+        }
+    }
+    return frame;
+}
+
+struct Settings {
+    float r_scale;
+    float g_scale;
+    float b_scale;
+    float exp_comp;
+};
+
+// Neutral, exposure only, white balance only, and both.
+const Settings kSettings[] = {
+    { 1.0f, 1.0f, 1.0f, 1.0f },
+    { 1.0f, 1.0f, 1.0f, 1.3f },
+    { 0.8f, 1.0f, 1.25f, 1.0f },
+    { 1.2f, 1.0f, 0.9f, 0.7f },
+};
+
+// Converts |src| to each of the |to| formats with a single convert_frame()
+// call.
+std::vector<Frame> convert(const Frame& src,
+                           uint32_t from,
+                           int width,
+                           int height,
+                           const std::vector<uint32_t>& to,
+                           const Settings& s) {
+    std::vector<Frame> dst(to.size());
+    std::vector<ClientFrameBuffer> fbs(to.size());
+    for (size_t n = 0; n < to.size(); n++) {
+        // Garbage, to catch pixels that are not written. RGB32 alpha values
+        // are not written, so all framebuffers get the same garbage.
+        dst[n] = makeNoise(to[n], width, height, 100);
+        fbs[n].pixel_format = to[n];
+        fbs[n].framebuffer = &dst[n][0];
+    }
+    EXPECT_EQ(0, convert_frame(&src[0], from, src.size(), width, height,
+                               &fbs[0], fbs.size(), s.r_scale, s.g_scale,
+                               s.b_scale, s.exp_comp));
+    return dst;
+}
+
+Frame convert(const Frame& src,
+              uint32_t from,
+              int width,
+              int height,
+              uint32_t to,
+              const Settings& s) {
+    return convert(src, from, width, height, std::vector<uint32_t>(1, to),
+                   s)[0];
+}
+
+// Converts |src| to |to| with the per-format converters, by passing more
+// framebuffers than a pass converts.
+Frame convertGeneric(const Frame& src,
+                     uint32_t from,
+                     int width,
+                     int height,
+                     uint32_t to,
+                     const Settings& s) {
+    return convert(src, from, width, height,
+                   std::vector<uint32_t>(kMaxPassFbs + 1, to), s)
+            [kMaxPassFbs];
+}
+
+class CameraFormatConvertersTest : public ::testing::Test {
+protected:
+    virtual void SetUp() {
+        // Start a few workers, so that large frames are converted by several
+        // threads even on a single CPU host. The first test to run decides.
+        worker_pool_start(3);
+    }
+};
+
+}  // namespace
+
+TEST_F(CameraFormatConvertersTest, SeveralDestinationsMatchSingleOnes) {
+    static const uint32_t kSources[] = {
+        V4L2_PIX_FMT_RGB24, V4L2_PIX_FMT_RGB565, V4L2_PIX_FMT_YUYV,
+        V4L2_PIX_FMT_UYVY, V4L2_PIX_FMT_NV21, V4L2_PIX_FMT_YVU420,
+        V4L2_PIX_FMT_NV12, V4L2_PIX_FMT_SBGGR8, V4L2_PIX_FMT_SGRBG10,
+    };
+    // A mix of destinations written by the specialized converters and from
+    // the intermediate lines.
+    std::vector<uint32_t> to;
+    to.push_back(V4L2_PIX_FMT_RGB32);
+    to.push_back(V4L2_PIX_FMT_NV21);
+    to.push_back(V4L2_PIX_FMT_YVU420);
+    to.push_back(V4L2_PIX_FMT_RGB565);
+    // A height that is not a multiple of the tile height, with all settings,
+    // and a frame that is converted by the worker pool, with neutral settings
+    // and with both white balance and exposure, to keep the test fast.
+    static const struct {
+        int width;
+        int height;
+        int settings_step;
+    } kSizes[] = {
+        { 34, 22, 1 },
+        { kPoolWidth, kPoolHeight, 3 },
+    };
+
+    for (size_t d = 0; d < sizeof(kSizes) / sizeof(kSizes[0]); d++) {
+        const int width = kSizes[d].width, height = kSizes[d].height;
+        for (size_t f = 0; f < sizeof(kSources) / sizeof(kSources[0]); f++) {
+            const Frame src = makeNoise(kSources[f], width, height, f);
+            for (size_t s = 0; s < sizeof(kSettings) / sizeof(kSettings[0]);
+                 s += kSizes[d].settings_step) {
+                SCOPED_TRACE(testing::Message()
+                             << width << "x" << height << " from " << std::hex
+                             << kSources[f] << std::dec << " settings " << s);
+                const std::vector<Frame> all =
+                        convert(src, kSources[f], width, height, to,
+                                kSettings[s]);
+                for (size_t n = 0; n < to.size(); n++) {
+                    EXPECT_TRUE(all[n] == convert(src, kSources[f], width,
+                                                  height, to[n], kSettings[s]))
+                            << "to " << std::hex << to[n];
+                }
+            }
+        }
+    }
+}
+
+TEST_F(CameraFormatConvertersTest, MatchesGenericConvertersWithoutOverflow) {
+    // White balance scales above 1 don't overflow, so the per-format
+    // converters compute the same values.
+    static const Settings kDimming = { 1.0f, 1.25f, 1.1f, 0.8f };
+    static const uint32_t kSources[] = {
+        V4L2_PIX_FMT_RGB24, V4L2_PIX_FMT_YUYV, V4L2_PIX_FMT_NV12,
+    };
+    static const uint32_t kDestinations[] = {
+        V4L2_PIX_FMT_RGB32, V4L2_PIX_FMT_RGB565,
+    };
+    const int width = kPoolWidth, height = kPoolHeight;
+    for (size_t f = 0; f < sizeof(kSources) / sizeof(kSources[0]); f++) {
+        const Frame src = makeNoise(kSources[f], width, height, f);
+        for (size_t t = 0; t < sizeof(kDestinations) / sizeof(kDestinations[0]);
+             t++) {
+            EXPECT_TRUE(convert(src, kSources[f], width, height,
+                                kDestinations[t], kDimming) ==
+                        convertGeneric(src, kSources[f], width, height,
+                                       kDestinations[t], kDimming))
+                    << "from " << std::hex << kSources[f] << " to "
+                    << kDestinations[t];
+        }
+    }
+}
+
+TEST_F(CameraFormatConvertersTest, WhiteBalanceIsClamped) {
+    const int width = 16, height = 4;
+    Frame src(frameSize(V4L2_PIX_FMT_RGB24, width, height), 200);
+    // Doubles red and blue, and halves green.
+    static const Settings kBoost = { 0.5f, 2.0f, 0.5f, 1.0f };
+    const Frame dst = convert(src, V4L2_PIX_FMT_RGB24, width, height,
+                              V4L2_PIX_FMT_RGB32, kBoost);
+    for (size_t n = 0; n < dst.size(); n += 4) {
+        ASSERT_EQ(255, dst[n]) << "at " << n;
+        ASSERT_EQ(100, dst[n + 1]) << "at " << n;
+        ASSERT_EQ(255, dst[n + 2]) << "at " << n;
+    }
+
+    // The per-format converters wrap around instead.
+    const Frame generic = convertGeneric(src, V4L2_PIX_FMT_RGB24, width,
+                                         height, V4L2_PIX_FMT_RGB32, kBoost);
+    EXPECT_EQ((400 & 0xff), generic[0]);
+}
+
+TEST_F(CameraFormatConvertersTest, BayerMatchesRgb) {
+    // A flat grey Bayer frame must convert like a flat grey RGB frame, for
+    // all sample sizes, with and without exposure compensation.
+    static const struct {
+        uint32_t fourcc;
+        int value;
+    } kBayers[] = {
+        { V4L2_PIX_FMT_SBGGR8, 128 },
+        { V4L2_PIX_FMT_SGRBG10, 128 << 2 },
+        { V4L2_PIX_FMT_SRGGB12, 128 << 4 },
+    };
+    static const uint32_t kDestinations[] = {
+        V4L2_PIX_FMT_RGB32, V4L2_PIX_FMT_YVU420, V4L2_PIX_FMT_YUYV,
+    };
+    static const Settings kExposures[] = {
+        { 1.0f, 1.0f, 1.0f, 1.0f },
+        { 1.0f, 1.0f, 1.0f, 1.5f },
+    };
+    const int width = 32, height = 20;
+    const Frame rgb(frameSize(V4L2_PIX_FMT_RGB24, width, height), 128);
+
+    for (size_t b = 0; b < sizeof(kBayers) / sizeof(kBayers[0]); b++) {
+        const Frame bayer = makeFlatBayer(kBayers[b].fourcc, width, height,
+                                          kBayers[b].value);
+        for (size_t t = 0; t < sizeof(kDestinations) / sizeof(kDestinations[0]);
+             t++) {
+            for (size_t e = 0; e < sizeof(kExposures) / sizeof(kExposures[0]);
+                 e++) {
+                EXPECT_TRUE(convert(bayer, kBayers[b].fourcc, width, height,
+                                    kDestinations[t], kExposures[e]) ==
+                            convert(rgb, V4L2_PIX_FMT_RGB24, width, height,
+                                    kDestinations[t], kExposures[e]))
+                        << "from " << std::hex << kBayers[b].fourcc << " to "
+                        << kDestinations[t] << std::dec << " exposure " << e;
+            }
+        }
+    }
+
+    // Grey 128 has Y = 126, which the exposure brings to 189, i.e. RGB 201,
+    // instead of saturating.
+    const Frame exposed = convert(makeFlatBayer(V4L2_PIX_FMT_SBGGR8, width,
+                                                height, 128),
+                                  V4L2_PIX_FMT_SBGGR8, width, height,
+                                  V4L2_PIX_FMT_RGB32, kExposures[1]);
+    EXPECT_EQ(201, exposed[0]);
+    EXPECT_EQ(201, exposed[1]);
+    EXPECT_EQ(201, exposed[2]);
+}
+
+TEST_F(CameraFormatConvertersTest, NeutralYuvToYuvIsExact) {
+    static const Settings kNeutral = { 1.0f, 1.0f, 1.0f, 1.0f };
+    const int width = 34, height = 22;
+    const int ySize = width * height;
+    const int cWidth = width / 2, cHeight = height / 2;
+
+    // NV12 has interleaved U and V values, YV12 has a V plane, then a U plane.
+    const Frame nv12 = makeNoise(V4L2_PIX_FMT_NV12, width, height, 1);
+    const Frame yv12 = convert(nv12, V4L2_PIX_FMT_NV12, width, height,
+                               V4L2_PIX_FMT_YVU420, kNeutral);
+    ASSERT_TRUE(std::equal(nv12.begin(), nv12.begin() + ySize, yv12.begin()));
+    for (int n = 0; n < cWidth * cHeight; n++) {
+        ASSERT_EQ(nv12[ySize + 2 * n], yv12[ySize + cWidth * cHeight + n])
+                << "U at " << n;
+        ASSERT_EQ(nv12[ySize + 2 * n + 1], yv12[ySize + n]) << "V at " << n;
+    }
+
+    // 4:2:2 lines take the chroma of their line pair.
+    const Frame yuyv = convert(nv12, V4L2_PIX_FMT_NV12, width, height,
+                               V4L2_PIX_FMT_YUYV, kNeutral);
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x += 2) {
+            const uint8_t* pair = &yuyv[(y * width + x) * 2];
+            const uint8_t* uv = &nv12[ySize + (y / 2) * width + x];
+            ASSERT_EQ(nv12[y * width + x], pair[0]);
+            ASSERT_EQ(uv[0], pair[1]);
+            ASSERT_EQ(nv12[y * width + x + 1], pair[2]);
+            ASSERT_EQ(uv[1], pair[3]);
+        }
+    }
+
+    // Same layout, with bytes in another order.
+    const Frame uyvy = convert(yuyv, V4L2_PIX_FMT_YUYV, width, height,
+                               V4L2_PIX_FMT_UYVY, kNeutral);
+    for (size_t n = 0; n < yuyv.size(); n += 2) {
+        ASSERT_EQ(yuyv[n], uyvy[n + 1]) << "at " << n;
+        ASSERT_EQ(yuyv[n + 1], uyvy[n]) << "at " << n;
+    }
+}
@@ -27,6 +27,7 @@
 #include "android/camera/camera-capture.h"
 #include "android/camera/camera-format-converters.h"
 #include "android/camera/camera-service.h"
+#include "android/camera/camera-virtual.h"
 
 #define  E(...)    derror(__VA_ARGS__)
 #define  W(...)    dwarning(__VA_ARGS__)
@@ -307,6 +308,27 @@ _wecam_setup(CameraServiceDesc* csd,
       csd->camera_count++;
 }
 
+/* Initialized virtual camera emulation record in camera service descriptor.
+ * Param:
+ *  csd - Camera service descriptor to initialize a record in.
+ *  mode - Virtual camera mode ('virtual[:<source>][@<fps>]').
+ *  dir - Direction ('back', or 'front') that emulated camera is facing.
+ */
+static void
+_virtual_camera_setup(CameraServiceDesc* csd, const char* mode, const char* dir)
+{
+    CameraInfo* const ci = csd->camera_info + csd->camera_count;
+
+    if (camera_virtual_setup(mode, dir, ci)) {
+        W("Unable to set up virtual camera '%s' facing %s", mode, dir);
+        return;
+    }
+    D("Camera %d '%s' is a virtual camera facing %s using %.4s pixel format",
+      csd->camera_count, ci->display_name, ci->direction,
+      (const char*)&ci->pixel_format);
+    csd->camera_count++;
+}
+
 /* Initializes camera service descriptor.
  */
 static void
@@ -320,6 +342,14 @@ _camera_service_init(CameraServiceDesc* csd)
     memset(csd->camera_info, 0, sizeof(CameraInfo) * MAX_CAMERA);
     csd->camera_count = 0;
 
+    /* Set up virtual cameras. These don't need any device on the host. */
+    if (camera_virtual_is_mode(android_hw->hw_camera_back)) {
+        _virtual_camera_setup(csd, android_hw->hw_camera_back, "back");
+    }
+    if (camera_virtual_is_mode(android_hw->hw_camera_front)) {
+        _virtual_camera_setup(csd, android_hw->hw_camera_front, "front");
+    }
+
     /* Lets see if HW config uses web cameras. */
     if (memcmp(android_hw->hw_camera_back, "webcam", 6) &&
         memcmp(android_hw->hw_camera_front, "webcam", 6)) {
@@ -589,6 +619,8 @@ struct CameraClient
     const CameraInfo*   camera_info;
     /* Emulated camera device descriptor. */
     CameraDevice*       camera;
+    /* Set if the camera is a virtual camera, rather than a web camera. */
+    int                 is_virtual;
     /* Buffer allocated for video frames.
      * Note that memory allocated for this buffer
      * also contains preview framebuffer. */
@@ -612,6 +644,63 @@ struct CameraClient
     int                 frames_cached;
 };
 
+/*
+ * Camera device API dispatch between web cameras and virtual cameras.
+ */
+
+static CameraDevice*
+_camera_client_device_open(CameraClient* cc)
+{
+    return cc->is_virtual ? camera_virtual_open(cc->device_name) :
+                            camera_device_open(cc->device_name, cc->inp_channel);
+}
+
+static int
+_camera_client_device_start_capturing(CameraClient* cc,
+                                      uint32_t pixel_format,
+                                      int frame_width,
+                                      int frame_height)
+{
+    return cc->is_virtual ?
+        camera_virtual_start_capturing(cc->camera, pixel_format,
+                                       frame_width, frame_height) :
+        camera_device_start_capturing(cc->camera, pixel_format,
+                                      frame_width, frame_height);
+}
+
+static int
+_camera_client_device_stop_capturing(CameraClient* cc)
+{
+    return cc->is_virtual ? camera_virtual_stop_capturing(cc->camera) :
+                            camera_device_stop_capturing(cc->camera);
+}
+
+static int
+_camera_client_device_read_frame(CameraClient* cc,
+                                 ClientFrameBuffer* framebuffers,
+                                 int fbs_num,
+                                 float r_scale,
+                                 float g_scale,
+                                 float b_scale,
+                                 float exp_comp)
+{
+    return cc->is_virtual ?
+        camera_virtual_read_frame(cc->camera, framebuffers, fbs_num,
+                                  r_scale, g_scale, b_scale, exp_comp) :
+        camera_device_read_frame(cc->camera, framebuffers, fbs_num,
+                                 r_scale, g_scale, b_scale, exp_comp);
+}
+
+static void
+_camera_client_device_close(CameraClient* cc)
+{
+    if (cc->is_virtual) {
+        camera_virtual_close(cc->camera);
+    } else {
+        camera_device_close(cc->camera);
+    }
+}
+
 /* Frees emulated camera client descriptor. */
 static void
 _camera_client_free(CameraClient* cc)
@@ -622,7 +711,7 @@ _camera_client_free(CameraClient* cc)
         ((CameraInfo*)cc->camera_info)->in_use = 0;
     }
     if (cc->camera != NULL) {
-        camera_device_close(cc->camera);
+        _camera_client_device_close(cc);
     }
     if (cc->video_frame != NULL) {
         free(cc->video_frame);
@@ -705,6 +794,7 @@ _camera_client_create(CameraServiceDesc* csd, const char* param)
     /* We're done. Set camera in use, and succeed the connection. */
     ci->in_use = 1;
     cc->camera_info = ci;
+    cc->is_virtual = camera_virtual_is_device(cc->device_name);
 
     D("%s: Camera service is created for device '%s' using input channel %d",
       __FUNCTION__, cc->device_name, cc->inp_channel);
@@ -733,7 +823,7 @@ _camera_client_query_connect(CameraClient* cc, QemudClient* qc, const char* para
     }
 
     /* Open camera device. */
-    cc->camera = camera_device_open(cc->device_name, cc->inp_channel);
+    cc->camera = _camera_client_device_open(cc);
     if (cc->camera == NULL) {
         E("%s: Unable to open camera device '%s'", __FUNCTION__, cc->device_name);
         _qemu_client_reply_ko(qc, "Unable to open camera device.");
@@ -773,7 +863,7 @@ _camera_client_query_disconnect(CameraClient* cc,
     }
 
     /* Close camera device. */
-    camera_device_close(cc->camera);
+    _camera_client_device_close(cc);
     cc->camera = NULL;
 
     D("Camera device '%s' is now disconnected", cc->device_name);
@@ -929,8 +1019,8 @@ _camera_client_query_start(CameraClient* cc, QemudClient* qc, const char* param)
     cc->preview_frame = (uint16_t*)(cc->video_frame + cc->video_frame_size);
 
     /* Start the camera. */
-    if (camera_device_start_capturing(cc->camera, cc->camera_info->pixel_format,
-                                      cc->width, cc->height)) {
+    if (_camera_client_device_start_capturing(cc, cc->camera_info->pixel_format,
+                                              cc->width, cc->height)) {
         E("%s: Cannot start camera '%s' for %.4s[%dx%d]: %s",
           __FUNCTION__, cc->device_name, (const char*)&cc->pixel_format,
           cc->width, cc->height, strerror(errno));
@@ -964,7 +1054,7 @@ _camera_client_query_stop(CameraClient* cc, QemudClient* qc, const char* param)
     }
 
     /* Stop the camera. */
-    if (camera_device_stop_capturing(cc->camera)) {
+    if (_camera_client_device_stop_capturing(cc)) {
         E("%s: Cannot stop camera device '%s': %s",
           __FUNCTION__, cc->device_name, strerror(errno));
         _qemu_client_reply_ko(qc, "Cannot stop camera device");
@@ -1000,7 +1090,11 @@ _camera_client_query_frame(CameraClient* cc, QemudClient* qc, const char* param)
     int repeat;
     ClientFrameBuffer fbs[2];
     int fbs_num = 0;
+    int n;
     size_t payload_size;
+    char payload_size_str[9];
+    struct iovec iov[4];
+    int iovcnt = 0;
     uint64_t tick;
     float r_scale = 1.0f, g_scale = 1.0f, b_scale = 1.0f, exp_comp = 1.0f;
     char tmp[256];
@@ -1069,8 +1163,9 @@ _camera_client_query_frame(CameraClient* cc, QemudClient* qc, const char* param)
 
     /* Capture new frame. */
     tick = _get_timestamp();
-    repeat = camera_device_read_frame(cc->camera, fbs, fbs_num,
-                                      r_scale, g_scale, b_scale, exp_comp);
+    repeat = _camera_client_device_read_frame(cc, fbs, fbs_num,
+                                              r_scale, g_scale, b_scale,
+                                              exp_comp);
 
     /* Note that there is no (known) way how to wait on next frame being
      * available, so we could dequeue frame buffer from the device only when we
@@ -1087,8 +1182,9 @@ _camera_client_query_frame(CameraClient* cc, QemudClient* qc, const char* param)
            (_get_timestamp() - tick) < 2000000LL) {
         /* Sleep for 10 millisec before repeating the attempt. */
         _camera_sleep(10);
-        repeat = camera_device_read_frame(cc->camera, fbs, fbs_num,
-                                          r_scale, g_scale, b_scale, exp_comp);
+        repeat = _camera_client_device_read_frame(cc, fbs, fbs_num,
+                                                  r_scale, g_scale, b_scale,
+                                                  exp_comp);
     }
     if (repeat == 1 && !cc->frames_cached) {
         /* Waited too long for the first frame. */
@@ -1116,26 +1212,70 @@ _camera_client_query_frame(CameraClient* cc, QemudClient* qc, const char* param)
     payload_size = 3 + video_size + preview_size;
 
     /* Send payload size first. */
-    _qemu_client_reply_payload(qc, payload_size);
+    snprintf(payload_size_str, sizeof(payload_size_str), "%08zx", payload_size);
+    iov[iovcnt].iov_base = payload_size_str;
+    iov[iovcnt++].iov_len = 8;
 
     /* After that send the 'ok:'. Note that if there is no frames sent, we should
      * use prefix "ok" instead of "ok:" */
-    if (video_size || preview_size) {
-        qemud_client_send(qc, (const uint8_t*)"ok:", 3);
-    } else {
-        /* Still 3 bytes: zero terminator is required in this case. */
-        qemud_client_send(qc, (const uint8_t*)"ok", 3);
-    }
+    iov[iovcnt].iov_base = (void*)((video_size || preview_size) ? "ok:" : "ok");
+    /* Still 3 bytes: zero terminator is required in "ok" case. */
+    iov[iovcnt++].iov_len = 3;
+
+    /* After that send video and preview frames (if requested). Note that the
+     * device may have pointed the framebuffers at its own copy of the frames,
+     * so take the addresses from there. Framebuffers are in the same order as
+     * in the reply. */
+    for (n = 0; n < fbs_num; n++) {
+        iov[iovcnt].iov_base = fbs[n].framebuffer;
+        iov[iovcnt++].iov_len =
+            (n == 0 && video_size) ? video_size : preview_size;
+    }
+
+    /* Send the whole reply at once, the client is not framed so this is
+     * the same stream of bytes for the guest. */
+    qemud_client_sendv(qc, iov, iovcnt);
+}
 
-    /* After that send video frame (if requested). */
-    if (video_size) {
-        qemud_client_send(qc, cc->video_frame, video_size);
-    }
+/* Client has queried frame delivery statistics.
+ * Statistics are only available for virtual cameras. The reply is a string
+ * formatted as such:
+ *  'frames=<n> repeated=<n> skipped=<n> hits=<n> misses=<n> bytes=<n>
+ *   elapsed_us=<n> latency_avg_us=<n> latency_max_us=<n> fps=<n>'
+ * Param:
+ *  cc - Queried camera client descriptor.
+ *  qc - Qemu client for the emulated camera.
+ *  param - Query parameters. There are no parameters expected for this query.
+ */
+static void
+_camera_client_query_stats(CameraClient* cc, QemudClient* qc, const char* param)
+{
+    CameraVirtualStats stats;
+    char reply[512];
 
-    /* After that send preview frame (if requested). */
-    if (preview_size) {
-        qemud_client_send(qc, (const uint8_t*)cc->preview_frame, preview_size);
+    if (cc->camera == NULL || !cc->is_virtual) {
+        _qemu_client_reply_ko(qc, "Statistics are not available");
+        return;
     }
+
+    camera_virtual_get_stats(cc->camera, &stats);
+    snprintf(reply, sizeof(reply),
+             "frames=%llu repeated=%llu skipped=%llu hits=%llu misses=%llu "
+             "bytes=%llu elapsed_us=%llu latency_avg_us=%llu "
+             "latency_max_us=%llu fps=%.2f",
+             (unsigned long long)stats.frames_delivered,
+             (unsigned long long)stats.frames_repeated,
+             (unsigned long long)stats.frames_skipped,
+             (unsigned long long)stats.cache_hits,
+             (unsigned long long)stats.cache_misses,
+             (unsigned long long)stats.bytes_delivered,
+             (unsigned long long)stats.elapsed_us,
+             (unsigned long long)(stats.frames_delivered ?
+                 stats.latency_total_us / stats.frames_delivered : 0),
+             (unsigned long long)stats.latency_max_us,
+             stats.elapsed_us ?
+                 stats.frames_delivered * 1000000.0 / stats.elapsed_us : 0.0);
+    _qemu_client_reply_ok(qc, reply);
 }
 
 /* Handles a message received from the emulated camera client.
@@ -1145,6 +1285,7 @@ _camera_client_query_frame(CameraClient* cc, QemudClient* qc, const char* param)
  * - 'start' - Starts capturing video from the connected camera device.
  * - 'stop' - Stop capturing video from the connected camera device.
  * - 'frame' - Queries video and preview frames captured from the camera.
+ * - 'stats' - Queries frame delivery statistics of a virtual camera.
  * Param:
  *  opaque - Camera service descriptor.
  *  msg, msglen - Message received from the camera factory client.
@@ -1170,6 +1311,8 @@ _camera_client_recv(void*         opaque,
     static const char _query_stop[]       = "stop";
     /* Query frame(s). */
     static const char _query_frame[]      = "frame";
+    /* Query frame delivery statistics. */
+    static const char _query_stats[]      = "stats";
 
     char query_name[64];
     const char* query_param = NULL;
@@ -1204,6 +1347,9 @@ _camera_client_recv(void*         opaque,
     } else if (!strcmp(query_name, _query_stop)) {
         /* Stop capturing is queried. */
         _camera_client_query_stop(cc, client, query_param);
+    } else if (!strcmp(query_name, _query_stats)) {
+        /* Frame delivery statistics are queried. */
+        _camera_client_query_stats(cc, client, query_param);
     } else {
         E("%s: Unknown query '%s'", __FUNCTION__, (char*)msg);
         _qemu_client_reply_ko(client, "Unknown query");
@@ -0,0 +1,1174 @@
+/*
+ * Copyright (C) 2015 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Contains code that implements virtual camera devices, streaming frames that
+ * are generated, or loaded from a file, instead of captured from a real
+ * camera device. See camera-virtual.h for details.
+ */
+
+#include <setjmp.h>
+#include <stdio.h>
+#include "jinclude.h"
+#include "jpeglib.h"
+#include "android/camera/camera-virtual.h"
+#include "android/camera/camera-format-converters.h"
+#include "android/utils/panic.h"
+#include "android/utils/path.h"
+
+#define  E(...)    derror(__VA_ARGS__)
+#define  W(...)    dwarning(__VA_ARGS__)
+#define  D(...)    VERBOSE_PRINT(camera,__VA_ARGS__)
+#define  D_ACTIVE  VERBOSE_CHECK(camera)
+
+/* Maximum number of virtual cameras: one facing back, and one facing front. */
+#define VIRTUAL_CAMERA_MAX      2
+
+/* Frame rate used when none is given in the camera mode or source file. */
+#define DEFAULT_FPS             30
+
+/* Maximum frame rate that can be requested. */
+#define MAX_FPS                 120
+
+/* Number of frames in the animated pattern. */
+#define PATTERN_FRAMES          30
+
+/* Maximum number of bytes used by decoded source frames. Longer files are
+ * truncated. */
+#define MAX_SOURCE_BYTES        (256 * 1024 * 1024)
+
+/* Maximum number of bytes used by the frame cache of a camera. Frames that
+ * don't fit in the cache are converted on every read. */
+#define MAX_CACHE_BYTES         (64 * 1024 * 1024)
+
+/* Maximum number of pixel formats cached for a camera. The camera service
+ * only ever uses two: the video format, and RGB32 for the preview. */
+#define MAX_CACHE_FORMATS       4
+
+/* Maximum frame dimension accepted from a file. */
+#define MAX_FRAME_DIM           4096
+
+/* Defines the type of a virtual camera source. */
+typedef enum VirtualSourceType {
+    /* Generated color bar pattern. */
+    VIRTUAL_SOURCE_PATTERN,
+    /* YUV4MPEG2 file. */
+    VIRTUAL_SOURCE_Y4M,
+    /* Concatenated JPEG images. */
+    VIRTUAL_SOURCE_MJPEG,
+} VirtualSourceType;
+
+/* Describes the source of a virtual camera.
+ * Instances of this structure are created by camera_virtual_setup(), and live
+ * as long as the emulator does.
+ */
+typedef struct VirtualSource {
+    /* Device name assigned to the camera. */
+    char*               device_name;
+    /* Source type. */
+    VirtualSourceType   type;
+    /* Frame rate. */
+    int                 fps;
+    /* Pixel format of the source frames. */
+    uint32_t            pixel_format;
+    /* Frame dimensions. Zero for the pattern, that is generated at the
+     * dimensions requested when capturing starts. */
+    int                 width;
+    int                 height;
+    /* Byte size of a source frame. */
+    size_t              frame_size;
+    /* Source frames. Each entry points inside the 'data' buffer. */
+    const uint8_t**     frames;
+    /* Number of source frames. */
+    int                 frame_num;
+    /* Buffer containing source frames. */
+    uint8_t*            data;
+    /* Set while a device is opened for this source. */
+    int                 in_use;
+} VirtualSource;
+
+/* Describes cached frames converted into one pixel format. */
+typedef struct VirtualFrameCache {
+    /* Pixel format of the cached frames, or 0 if this entry is not used. */
+    uint32_t    pixel_format;
+    /* Byte size of a cached frame. */
+    size_t      frame_size;
+    /* Cached frames, indexed by source frame. NULL entries are not converted
+     * yet. */
+    uint8_t**   frames;
+} VirtualFrameCache;
+
+typedef struct VirtualCameraDevice VirtualCameraDevice;
+/* Describes a virtual camera device. */
+struct VirtualCameraDevice {
+    /* Common header. */
+    CameraDevice        header;
+    /* Camera source. */
+    VirtualSource*      source;
+
+    /*
+     * Set when capturing is started.
+     */
+
+    /* Set while capturing. */
+    int                 started;
+    /* Source frames. Same as in 'source', except for the pattern which is
+     * generated for each capture. */
+    const uint8_t**     frames;
+    int                 frame_num;
+    uint8_t*            pattern;
+    int                 width;
+    int                 height;
+    /* Converted frame cache. */
+    VirtualFrameCache   cache[MAX_CACHE_FORMATS];
+    /* Number of bytes allocated for cached frames. */
+    size_t              cache_bytes;
+    /* Color parameters used for the cached frames. */
+    float               r_scale;
+    float               g_scale;
+    float               b_scale;
+    float               exp_comp;
+    /* Time capturing has started at. */
+    uint64_t            start_time;
+    /* Frame tick of the last frame delivered, or -1. */
+    int64_t             last_tick;
+    /* Capturing statistics. */
+    CameraVirtualStats  stats;
+};
+
+/* Virtual camera sources. */
+static VirtualSource    _sources[VIRTUAL_CAMERA_MAX];
+/* Number of entries used in '_sources'. */
+static int              _sources_num;
+
+/* Frame dimensions reported for the pattern. */
+static const CameraFrameDim _pattern_dims[] = {
+    { 640, 480 }, { 352, 288 }, { 320, 240 }, { 176, 144 }
+};
+
+/* Returns byte size of a frame in the given pixel format, or 0 if the format
+ * is not known. */
+static size_t
+_frame_size(uint32_t pixel_format, int width, int height)
+{
+    switch (pixel_format) {
+        case V4L2_PIX_FMT_RGB32:
+        case V4L2_PIX_FMT_BGR32:
+            return (size_t)width * height * 4;
+        case V4L2_PIX_FMT_RGB24:
+        case V4L2_PIX_FMT_BGR24:
+            return (size_t)width * height * 3;
+        case V4L2_PIX_FMT_RGB565:
+        case V4L2_PIX_FMT_YUYV:
+            return (size_t)width * height * 2;
+        case V4L2_PIX_FMT_YUV420:
+        case V4L2_PIX_FMT_YVU420:
+        case V4L2_PIX_FMT_NV12:
+        case V4L2_PIX_FMT_NV21:
+            return (size_t)width * height * 3 / 2;
+        default:
+            return 0;
+    }
+}
+
+/********************************************************************************
+ * Pattern source
+ *******************************************************************************/
+
+/* YUV colors of the pattern bars. */
+static const uint8_t _bar_colors[8][3] = {
+    { 235, 128, 128 },  /* White */
+    { 210,  16, 146 },  /* Yellow */
+    { 170, 166,  16 },  /* Cyan */
+    { 145,  54,  34 },  /* Green */
+    { 106, 202, 222 },  /* Magenta */
+    {  81,  90, 240 },  /* Red */
+    {  41, 240, 110 },  /* Blue */
+    {  16, 128, 128 },  /* Black */
+};
+
+/* Generates a frame of the animated pattern in YUYV format.
+ * The top of the frame contains color bars, and the bottom contains a luma
+ * ramp with a white block moving across it, so the guest can see that frames
+ * are changing.
+ */
+static void
+_pattern_generate(uint8_t* frame, int width, int height, int index)
+{
+    const int bars_height = height * 2 / 3;
+    const int block_width = (width / 8) & ~1;
+    const int block_x =
+        ((width - block_width) * index / (PATTERN_FRAMES - 1)) & ~1;
+    int x, y;
+
+    for (y = 0; y < height; y++) {
+        uint8_t* line = frame + (size_t)y * width * 2;
+        for (x = 0; x < width; x += 2) {
+            uint8_t yy, u, v;
+            if (y < bars_height) {
+                const uint8_t* c = _bar_colors[x * 8 / width];
+                yy = c[0]; u = c[1]; v = c[2];
+            } else if (x >= block_x && x < block_x + block_width) {
+                yy = 235; u = v = 128;
+            } else {
+                yy = 16 + x * 200 / width; u = v = 128;
+            }
+            line[x * 2] = yy;
+            line[x * 2 + 1] = u;
+            line[x * 2 + 2] = yy;
+            line[x * 2 + 3] = v;
+        }
+    }
+}
+
+/********************************************************************************
+ * YUV4MPEG2 source
+ *******************************************************************************/
+
+/* Parses a numeric YUV4MPEG2 header parameter. Return -1 on failure. */
+static int
+_y4m_parse_int(const char* p, const char* end, int* value)
+{
+    int v = 0;
+    if (p == end || *p < '0' || *p > '9') {
+        return -1;
+    }
+    for (; p < end && *p >= '0' && *p <= '9'; p++) {
+        v = v * 10 + (*p - '0');
+        if (v > 1000000) {
+            return -1;
+        }
+    }
+    *value = v;
+    return 0;
+}
+
+/* Loads frames from a YUV4MPEG2 file.
+ * The file format is a text header line, followed by frames that each start
+ * with a 'FRAME' line. Only 4:2:0 frames are supported, which are stored as
+ * YUV420 (a.k.a. I420).
+ */
+static int
+_y4m_load(VirtualSource* src, const char* path)
+{
+    static const char magic[] = "YUV4MPEG2 ";
+    size_t size = 0;
+    uint8_t* data = path_load_file(path, &size);
+    const char* p;
+    const char* eol;
+    size_t pos;
+    int fps_num = 0, fps_den = 1;
+
+    if (data == NULL) {
+        E("%s: Unable to load '%s'", __FUNCTION__, path);
+        return -1;
+    }
+    if (size > MAX_SOURCE_BYTES) {
+        E("%s: File '%s' is too large", __FUNCTION__, path);
+        goto fail;
+    }
+    eol = memchr(data, '\n', size);
+    if (eol == NULL || size < sizeof(magic) - 1 ||
+        memcmp(data, magic, sizeof(magic) - 1)) {
+        E("%s: '%s' is not a YUV4MPEG2 file", __FUNCTION__, path);
+        goto fail;
+    }
+
+    /* Parse header parameters. */
+    p = (const char*)data + sizeof(magic) - 1;
+    while (p < eol) {
+        const char* next = memchr(p, ' ', eol - p);
+        if (next == NULL) {
+            next = eol;
+        }
+        switch (*p) {
+            case 'W':
+                if (_y4m_parse_int(p + 1, next, &src->width)) {
+                    goto bad_header;
+                }
+                break;
+            case 'H':
+                if (_y4m_parse_int(p + 1, next, &src->height)) {
+                    goto bad_header;
+                }
+                break;
+            case 'F': {
+                const char* colon = memchr(p, ':', next - p);
+                if (colon == NULL ||
+                    _y4m_parse_int(p + 1, colon, &fps_num) ||
+                    _y4m_parse_int(colon + 1, next, &fps_den) ||
+                    fps_den == 0) {
+                    goto bad_header;
+                }
+                break;
+            }
+            case 'C':
+                if (next - p < 4 || memcmp(p + 1, "420", 3)) {
+                    E("%s: Unsupported color space '%.*s' in '%s'",
+                      __FUNCTION__, (int)(next - p - 1), p + 1, path);
+                    goto fail;
+                }
+                break;
+            default:
+                /* Interlacing, aspect ratio and extensions are ignored. */
+                break;
+        }
+        p = next + 1;
+    }
+    if (src->width <= 0 || src->height <= 0 ||
+        src->width > MAX_FRAME_DIM || src->height > MAX_FRAME_DIM ||
+        (src->width & 1) || (src->height & 1)) {
+        E("%s: Unsupported frame dimensions %dx%d in '%s'",
+          __FUNCTION__, src->width, src->height, path);
+        goto fail;
+    }
+    if (src->fps == 0 && fps_num > 0) {
+        src->fps = (fps_num + fps_den / 2) / fps_den;
+    }
+
+    src->pixel_format = V4L2_PIX_FMT_YUV420;
+    src->frame_size = _frame_size(src->pixel_format, src->width, src->height);
+
+    /* Index frames. Frame data is used in place. */
+    pos = (const uint8_t*)eol - data + 1;
+    while (pos < size) {
+        const uint8_t* frame_eol = memchr(data + pos, '\n', size - pos);
+        if (frame_eol == NULL || size - pos < 5 ||
+            memcmp(data + pos, "FRAME", 5)) {
+            W("%s: Ignoring garbage at offset %zu in '%s'",
+              __FUNCTION__, pos, path);
+            break;
+        }
+        pos = frame_eol - data + 1;
+        if (size - pos < src->frame_size) {
+            W("%s: Ignoring truncated frame in '%s'", __FUNCTION__, path);
+            break;
+        }
+        src->frames = realloc(src->frames,
+                              (src->frame_num + 1) * sizeof(*src->frames));
+        if (src->frames == NULL) {
+            APANIC("%s: Out of memory", __FUNCTION__);
+        }
+        src->frames[src->frame_num++] = data + pos;
+        pos += src->frame_size;
+    }
+    if (src->frame_num == 0) {
+        E("%s: No frames in '%s'", __FUNCTION__, path);
+        goto fail;
+    }
+
+    src->data = data;
+    return 0;
+
+bad_header:
+    E("%s: Invalid header in '%s'", __FUNCTION__, path);
+fail:
+    free(data);
+    return -1;
+}
+
+/********************************************************************************
+ * MJPEG source
+ *******************************************************************************/
+
+/* Error manager for the JPEG decoder, that returns to the caller on errors
+ * instead of exiting. */
+typedef struct JpegErrorMgr {
+    struct jpeg_error_mgr   common;
+    jmp_buf                 jmp;
+} JpegErrorMgr;
+
+static void
+_on_jpeg_error(j_common_ptr cinfo)
+{
+    JpegErrorMgr* const err = (JpegErrorMgr*)cinfo->err;
+    char msg[JMSG_LENGTH_MAX];
+    (*cinfo->err->format_message)(cinfo, msg);
+    D("%s: %s", __FUNCTION__, msg);
+    longjmp(err->jmp, 1);
+}
+
+static void
+_on_jpeg_output_message(j_common_ptr cinfo)
+{
+    /* Warnings are ignored. */
+}
+
+static void
+_on_init_source(j_decompress_ptr cinfo)
+{
+}
+
+/* Called by the decoder when it runs out of data, which means the image is
+ * truncated. Feed a fake EOI marker, like the stdio source manager does. */
+static boolean
+_on_fill_input_buffer(j_decompress_ptr cinfo)
+{
+    static const JOCTET eoi[2] = { 0xFF, JPEG_EOI };
+    cinfo->src->next_input_byte = eoi;
+    cinfo->src->bytes_in_buffer = 2;
+    return TRUE;
+}
+
+static void
+_on_skip_input_data(j_decompress_ptr cinfo, long num_bytes)
+{
+    struct jpeg_source_mgr* const src = cinfo->src;
+    if (num_bytes <= 0) {
+        return;
+    }
+    if ((size_t)num_bytes > src->bytes_in_buffer) {
+        _on_fill_input_buffer(cinfo);
+    } else {
+        src->next_input_byte += num_bytes;
+        src->bytes_in_buffer -= num_bytes;
+    }
+}
+
+static void
+_on_term_source(j_decompress_ptr cinfo)
+{
+}
+
+/* Finds the next JPEG image in a MJPEG stream.
+ * Param:
+ *  data, size - MJPEG stream.
+ *  pos - Offset where to start looking for the image. Upon return contains the
+ *      offset right after the image.
+ *  image, image_size - Upon success contain the image found.
+ * Return:
+ *  0 on success, or -1 if there are no more images.
+ */
+static int
+_mjpeg_next_image(const uint8_t* data,
+                  size_t size,
+                  size_t* pos,
+                  const uint8_t** image,
+                  size_t* image_size)
+{
+    size_t p = *pos;
+    size_t start;
+
+    /* Find the SOI marker. */
+    while (p + 1 < size && !(data[p] == 0xFF && data[p + 1] == 0xD8)) {
+        p++;
+    }
+    if (p + 1 >= size) {
+        return -1;
+    }
+    start = p;
+    p += 2;
+
+    /* Walk marker segments. Entropy-coded data following the SOS segments is
+     * scanned for the next marker, knowing that 0xFF bytes in there are
+     * always followed by 0x00, or by a RSTn marker. */
+    while (p + 1 < size) {
+        uint8_t marker;
+        if (data[p] != 0xFF) {
+            p++;
+            continue;
+        }
+        marker = data[p + 1];
+        if (marker == 0xFF) {
+            /* Fill byte. */
+            p++;
+        } else if (marker == 0x00 || (marker >= 0xD0 && marker <= 0xD7)) {
+            p += 2;
+        } else if (marker == 0xD9) {
+            /* EOI. */
+            p += 2;
+            *image = data + start;
+            *image_size = p - start;
+            *pos = p;
+            return 0;
+        } else if (marker == 0xD8) {
+            /* SOI without EOI: truncated image. Restart from there. */
+            start = p;
+            p += 2;
+        } else {
+            size_t len;
+            if (p + 3 >= size) {
+                break;
+            }
+            len = (data[p + 2] << 8) | data[p + 3];
+            p += 2 + len;
+        }
+    }
+
+    *pos = size;
+    return -1;
+}
+
+/* Decodes a JPEG image into a RGB24 frame.
+ * Param:
+ *  image, image_size - JPEG image to decode.
+ *  frame - Destination frame. If NULL, only image dimensions are returned.
+ *  width, height - Expected image dimensions, or zero if 'frame' is NULL. Upon
+ *      return contain image dimensions.
+ * Return:
+ *  0 on success, or -1 on failure.
+ */
+static int
+_mjpeg_decode(const uint8_t* image,
+              size_t image_size,
+              uint8_t* frame,
+              int* width,
+              int* height)
+{
+    struct jpeg_decompress_struct cinfo;
+    struct jpeg_source_mgr src;
+    JpegErrorMgr err;
+    JSAMPROW row;
+
+    cinfo.err = jpeg_std_error(&err.common);
+    err.common.error_exit = _on_jpeg_error;
+    err.common.output_message = _on_jpeg_output_message;
+    if (setjmp(err.jmp)) {
+        jpeg_destroy_decompress(&cinfo);
+        return -1;
+    }
+    jpeg_create_decompress(&cinfo);
+
+    src.init_source = _on_init_source;
+    src.fill_input_buffer = _on_fill_input_buffer;
+    src.skip_input_data = _on_skip_input_data;
+    src.resync_to_restart = jpeg_resync_to_restart;
+    src.term_source = _on_term_source;
+    src.next_input_byte = image;
+    src.bytes_in_buffer = image_size;
+    cinfo.src = &src;
+
+    jpeg_read_header(&cinfo, TRUE);
+    cinfo.out_color_space = JCS_RGB;
+    jpeg_calc_output_dimensions(&cinfo);
+
+    if (frame == NULL) {
+        *width = cinfo.output_width;
+        *height = cinfo.output_height;
+        jpeg_destroy_decompress(&cinfo);
+        return 0;
+    }
+    if ((int)cinfo.output_width != *width ||
+        (int)cinfo.output_height != *height) {
+        jpeg_destroy_decompress(&cinfo);
+        return -1;
+    }
+
+    jpeg_start_decompress(&cinfo);
+    while (cinfo.output_scanline < cinfo.output_height) {
+        row = frame + (size_t)cinfo.output_scanline * cinfo.output_width * 3;
+        jpeg_read_scanlines(&cinfo, &row, 1);
+    }
+    jpeg_finish_decompress(&cinfo);
+    jpeg_destroy_decompress(&cinfo);
+    return 0;
+}
+
+/* Loads and decodes frames from a MJPEG file.
+ * All images in the file must have the same dimensions, which are defined by
+ * the first one. Images with other dimensions, or that fail to decode, are
+ * skipped. Decoded frames are stored in RGB24 format.
+ */
+static int
+_mjpeg_load(VirtualSource* src, const char* path)
+{
+    size_t size = 0;
+    uint8_t* data = path_load_file(path, &size);
+    size_t pos = 0;
+    const uint8_t* image;
+    size_t image_size;
+    int max_frames, capacity = 0, skipped = 0;
+
+    if (data == NULL) {
+        E("%s: Unable to load '%s'", __FUNCTION__, path);
+        return -1;
+    }
+
+    /* The first image defines frame dimensions. */
+    if (_mjpeg_next_image(data, size, &pos, &image, &image_size) ||
+        _mjpeg_decode(image, image_size, NULL, &src->width, &src->height)) {
+        E("%s: '%s' is not a MJPEG file", __FUNCTION__, path);
+        free(data);
+        return -1;
+    }
+    if (src->width > MAX_FRAME_DIM || src->height > MAX_FRAME_DIM ||
+        (src->width & 1) || (src->height & 1)) {
+        E("%s: Unsupported frame dimensions %dx%d in '%s'",
+          __FUNCTION__, src->width, src->height, path);
+        free(data);
+        return -1;
+    }
+
+    src->pixel_format = V4L2_PIX_FMT_RGB24;
+    src->frame_size = _frame_size(src->pixel_format, src->width, src->height);
+    max_frames = MAX_SOURCE_BYTES / src->frame_size;
+
+    /* Decode all images. */
+    pos = 0;
+    while (!_mjpeg_next_image(data, size, &pos, &image, &image_size)) {
+        uint8_t* frame;
+        if (src->frame_num == max_frames) {
+            W("%s: '%s' is too long, only %d frames are used",
+              __FUNCTION__, path, max_frames);
+            break;
+        }
+        if (src->frame_num == capacity) {
+            capacity = capacity ? capacity * 2 : 8;
+            if (capacity > max_frames) {
+                capacity = max_frames;
+            }
+            src->data = realloc(src->data, capacity * src->frame_size);
+            if (src->data == NULL) {
+                APANIC("%s: Out of memory", __FUNCTION__);
+            }
+        }
+        frame = src->data + src->frame_num * src->frame_size;
+        if (_mjpeg_decode(image, image_size, frame,
+                          &src->width, &src->height)) {
+            skipped++;
+            continue;
+        }
+        src->frame_num++;
+    }
+    free(data);
+
+    if (skipped) {
+        W("%s: %d images could not be decoded in '%s'",
+          __FUNCTION__, skipped, path);
+    }
+    if (src->frame_num == 0) {
+        E("%s: No frames in '%s'", __FUNCTION__, path);
+        free(src->data);
+        src->data = NULL;
+        return -1;
+    }
+
+    /* Frames are indexed once the buffer won't move anymore. */
+    src->frames = malloc(src->frame_num * sizeof(*src->frames));
+    if (src->frames == NULL) {
+        APANIC("%s: Out of memory", __FUNCTION__);
+    }
+    for (pos = 0; pos < (size_t)src->frame_num; pos++) {
+        src->frames[pos] = src->data + pos * src->frame_size;
+    }
+    return 0;
+}
+
+/********************************************************************************
+ * Frame cache
+ *******************************************************************************/
+
+/* Frees all cached frames. */
+static void
+_cache_reset(VirtualCameraDevice* vcd)
+{
+    int n, f;
+    for (n = 0; n < MAX_CACHE_FORMATS; n++) {
+        VirtualFrameCache* const cache = &vcd->cache[n];
+        if (cache->frames != NULL) {
+            for (f = 0; f < vcd->frame_num; f++) {
+                free(cache->frames[f]);
+            }
+            free(cache->frames);
+        }
+        memset(cache, 0, sizeof(*cache));
+    }
+    vcd->cache_bytes = 0;
+}
+
+/* Returns the cache entry for a pixel format, creating it if needed.
+ * Returns NULL if the format can't be cached. */
+static VirtualFrameCache*
+_cache_get(VirtualCameraDevice* vcd, uint32_t pixel_format)
+{
+    int n;
+    for (n = 0; n < MAX_CACHE_FORMATS; n++) {
+        if (vcd->cache[n].pixel_format == pixel_format) {
+            return &vcd->cache[n];
+        }
+    }
+    for (n = 0; n < MAX_CACHE_FORMATS; n++) {
+        VirtualFrameCache* const cache = &vcd->cache[n];
+        if (cache->pixel_format == 0) {
+            cache->frame_size =
+                _frame_size(pixel_format, vcd->width, vcd->height);
+            if (cache->frame_size == 0) {
+                return NULL;
+            }
+            cache->frames = calloc(vcd->frame_num, sizeof(*cache->frames));
+            if (cache->frames == NULL) {
+                return NULL;
+            }
+            cache->pixel_format = pixel_format;
+            return cache;
+        }
+    }
+    return NULL;
+}
+
+/********************************************************************************
+ * Virtual camera API
+ *******************************************************************************/
+
+int
+camera_virtual_is_mode(const char* mode)
+{
+    const size_t len = sizeof(CAMERA_VIRTUAL_MODE) - 1;
+    return mode != NULL && !strncmp(mode, CAMERA_VIRTUAL_MODE, len) &&
+           (mode[len] == '\0' || mode[len] == ':' || mode[len] == '@');
+}
+
+int
+camera_virtual_is_device(const char* device_name)
+{
+    int n;
+    for (n = 0; n < _sources_num; n++) {
+        if (!strcmp(_sources[n].device_name, device_name)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+int
+camera_virtual_setup(const char* mode, const char* dir, CameraInfo* ci)
+{
+    VirtualSource* src;
+    const char* source;
+    const char* at;
+    char* path;
+    char name[16];
+    int res;
+
+    if (!camera_virtual_is_mode(mode)) {
+        E("%s: Invalid virtual camera mode '%s'", __FUNCTION__, mode);
+        return -1;
+    }
+    if (_sources_num == VIRTUAL_CAMERA_MAX) {
+        E("%s: Too many virtual cameras", __FUNCTION__);
+        return -1;
+    }
+    src = &_sources[_sources_num];
+    memset(src, 0, sizeof(*src));
+
+    /* Split the mode into source and frame rate. */
+    source = mode + sizeof(CAMERA_VIRTUAL_MODE) - 1;
+    if (*source == ':') {
+        source++;
+    }
+    at = strrchr(source, '@');
+    if (at != NULL) {
+        char* end;
+        const long fps = strtol(at + 1, &end, 10);
+        if (at[1] == '\0' || *end != '\0' || fps <= 0 || fps > MAX_FPS) {
+            E("%s: Invalid frame rate in virtual camera mode '%s'",
+              __FUNCTION__, mode);
+            return -1;
+        }
+        src->fps = (int)fps;
+        path = ASTRDUP(source);
+        path[at - source] = '\0';
+    } else {
+        path = ASTRDUP(source);
+    }
+
+    /* Load the source. */
+    if (path[0] == '\0' || !strcmp(path, "pattern")) {
+        src->type = VIRTUAL_SOURCE_PATTERN;
+        src->pixel_format = V4L2_PIX_FMT_YUYV;
+        res = 0;
+    } else if (strlen(path) > 4 && !strcmp(path + strlen(path) - 4, ".y4m")) {
+        src->type = VIRTUAL_SOURCE_Y4M;
+        res = _y4m_load(src, path);
+    } else {
+        src->type = VIRTUAL_SOURCE_MJPEG;
+        res = _mjpeg_load(src, path);
+    }
+    AFREE(path);
+    if (res) {
+        return -1;
+    }
+    if (src->fps == 0) {
+        src->fps = DEFAULT_FPS;
+    }
+
+    snprintf(name, sizeof(name), "virtual%d", _sources_num);
+    src->device_name = ASTRDUP(name);
+    _sources_num++;
+
+    /* Describe the camera. */
+    memset(ci, 0, sizeof(*ci));
+    ci->display_name = ASTRDUP(name);
+    ci->device_name = ASTRDUP(name);
+    ci->direction = ASTRDUP(dir);
+    ci->pixel_format = src->pixel_format;
+    if (src->type == VIRTUAL_SOURCE_PATTERN) {
+        ci->frame_sizes_num = sizeof(_pattern_dims) / sizeof(*_pattern_dims);
+        ci->frame_sizes = malloc(sizeof(_pattern_dims));
+        if (ci->frame_sizes == NULL) {
+            APANIC("%s: Out of memory", __FUNCTION__);
+        }
+        memcpy(ci->frame_sizes, _pattern_dims, sizeof(_pattern_dims));
+    } else {
+        ci->frame_sizes_num = 1;
+        ci->frame_sizes = malloc(sizeof(CameraFrameDim));
+        if (ci->frame_sizes == NULL) {
+            APANIC("%s: Out of memory", __FUNCTION__);
+        }
+        ci->frame_sizes[0].width = src->width;
+        ci->frame_sizes[0].height = src->height;
+    }
+
+    D("%s: Virtual camera '%s' uses '%s': %d frames of %dx%d %.4s at %d fps",
+      __FUNCTION__, name, mode, src->frame_num, src->width, src->height,
+      (const char*)&src->pixel_format, src->fps);
+    return 0;
+}
+
+void
+camera_virtual_reset(void)
+{
+    int n;
+    for (n = 0; n < _sources_num; n++) {
+        VirtualSource* const src = &_sources[n];
+        if (src->in_use) {
+            APANIC("%s: Virtual camera '%s' is opened",
+                   __FUNCTION__, src->device_name);
+        }
+        AFREE(src->device_name);
+        free(src->frames);
+        free(src->data);
+        memset(src, 0, sizeof(*src));
+    }
+    _sources_num = 0;
+}
+
+CameraDevice*
+camera_virtual_open(const char* device_name)
+{
+    VirtualCameraDevice* vcd;
+    int n;
+
+    for (n = 0; n < _sources_num; n++) {
+        if (!strcmp(_sources[n].device_name, device_name)) {
+            break;
+        }
+    }
+    if (n == _sources_num) {
+        E("%s: Unknown virtual camera '%s'", __FUNCTION__, device_name);
+        return NULL;
+    }
+    if (_sources[n].in_use) {
+        E("%s: Virtual camera '%s' is already opened",
+          __FUNCTION__, device_name);
+        return NULL;
+    }
+
+    ANEW0(vcd);
+    vcd->header.opaque = vcd;
+    vcd->source = &_sources[n];
+    vcd->source->in_use = 1;
+    return &vcd->header;
+}
+
+int
+camera_virtual_start_capturing(CameraDevice* cd,
+                               uint32_t pixel_format,
+                               int frame_width,
+                               int frame_height)
+{
+    VirtualCameraDevice* const vcd = (VirtualCameraDevice*)cd->opaque;
+    VirtualSource* const src = vcd->source;
+
+    if (vcd->started) {
+        E("%s: Virtual camera '%s' is already started",
+          __FUNCTION__, src->device_name);
+        return -1;
+    }
+    if (pixel_format != src->pixel_format) {
+        E("%s: Virtual camera '%s' doesn't support %.4s pixel format",
+          __FUNCTION__, src->device_name, (const char*)&pixel_format);
+        return -1;
+    }
+
+    if (src->type == VIRTUAL_SOURCE_PATTERN) {
+        const size_t frame_size =
+            _frame_size(src->pixel_format, frame_width, frame_height);
+        int n;
+        if (frame_width <= 0 || frame_height <= 0 ||
+            frame_width > MAX_FRAME_DIM || frame_height > MAX_FRAME_DIM ||
+            (frame_width & 1) || (frame_height & 1)) {
+            E("%s: Unsupported frame dimensions %dx%d",
+              __FUNCTION__, frame_width, frame_height);
+            return -1;
+        }
+        vcd->pattern = malloc(frame_size * PATTERN_FRAMES);
+        vcd->frames = malloc(PATTERN_FRAMES * sizeof(*vcd->frames));
+        if (vcd->pattern == NULL || vcd->frames == NULL) {
+            E("%s: Not enough memory for the pattern", __FUNCTION__);
+            free(vcd->pattern);
+            free(vcd->frames);
+            vcd->pattern = NULL;
+            vcd->frames = NULL;
+            return -1;
+        }
+        for (n = 0; n < PATTERN_FRAMES; n++) {
+            uint8_t* const frame = vcd->pattern + n * frame_size;
+            _pattern_generate(frame, frame_width, frame_height, n);
+            vcd->frames[n] = frame;
+        }
+        vcd->frame_num = PATTERN_FRAMES;
+    } else {
+        if (frame_width != src->width || frame_height != src->height) {
+            E("%s: Virtual camera '%s' only supports %dx%d frames",
+              __FUNCTION__, src->device_name, src->width, src->height);
+            return -1;
+        }
+        vcd->frames = src->frames;
+        vcd->frame_num = src->frame_num;
+    }
+
+    vcd->width = frame_width;
+    vcd->height = frame_height;
+    vcd->r_scale = vcd->g_scale = vcd->b_scale = vcd->exp_comp = 1.0f;
+    vcd->start_time = _get_timestamp();
+    vcd->last_tick = -1;
+    memset(&vcd->stats, 0, sizeof(vcd->stats));
+    vcd->started = 1;
+    return 0;
+}
+
+int
+camera_virtual_stop_capturing(CameraDevice* cd)
+{
+    VirtualCameraDevice* const vcd = (VirtualCameraDevice*)cd->opaque;
+
+    if (!vcd->started) {
+        E("%s: Virtual camera '%s' is not started",
+          __FUNCTION__, vcd->source->device_name);
+        return -1;
+    }
+
+    if (D_ACTIVE) {
+        CameraVirtualStats stats;
+        camera_virtual_get_stats(cd, &stats);
+        D("%s: Virtual camera '%s' delivered %llu frames in %llu ms: "
+          "%llu repeated, %llu skipped, %llu cache hits, %llu misses, "
+          "average latency %llu us, max %llu us",
+          __FUNCTION__, vcd->source->device_name,
+          (unsigned long long)stats.frames_delivered,
+          (unsigned long long)(stats.elapsed_us / 1000),
+          (unsigned long long)stats.frames_repeated,
+          (unsigned long long)stats.frames_skipped,
+          (unsigned long long)stats.cache_hits,
+          (unsigned long long)stats.cache_misses,
+          (unsigned long long)(stats.frames_delivered ?
+              stats.latency_total_us / stats.frames_delivered : 0),
+          (unsigned long long)stats.latency_max_us);
+    }
+
+    _cache_reset(vcd);
+    if (vcd->pattern != NULL) {
+        free(vcd->pattern);
+        free(vcd->frames);
+        vcd->pattern = NULL;
+    }
+    vcd->frames = NULL;
+    vcd->frame_num = 0;
+    vcd->stats.elapsed_us = _get_timestamp() - vcd->start_time;
+    vcd->started = 0;
+    return 0;
+}
+
+/* Framebuffers that camera_virtual_read_frame() converts in one
+ * convert_frame() call. */
+typedef struct VirtualConversion {
+    /* Destination framebuffers, either client framebuffers, or frames of the
+     * cache. */
+    ClientFrameBuffer   fbs[MAX_CACHE_FORMATS];
+    /* Cache entries of the destinations, or NULL for client framebuffers. */
+    VirtualFrameCache*  caches[MAX_CACHE_FORMATS];
+    int                 fbs_num;
+} VirtualConversion;
+
+/* Converts a source frame into all framebuffers of a conversion at once, and
+ * empties it. Frames allocated in the cache for the conversion are dropped if
+ * it fails.
+ * Return:
+ *  0 on success, or -1 on failure.
+ */
+static int
+_convert_pending(VirtualCameraDevice* vcd,
+                 VirtualConversion* conv,
+                 const uint8_t* frame,
+                 int index)
+{
+    int res = 0;
+    int n;
+
+    if (conv->fbs_num == 0) {
+        return 0;
+    }
+    if (convert_frame(frame, vcd->source->pixel_format,
+                      vcd->source->frame_size, vcd->width, vcd->height,
+                      conv->fbs, conv->fbs_num, vcd->r_scale, vcd->g_scale,
+                      vcd->b_scale, vcd->exp_comp)) {
+        for (n = 0; n < conv->fbs_num; n++) {
+            VirtualFrameCache* const cache = conv->caches[n];
+            if (cache != NULL) {
+                free(cache->frames[index]);
+                cache->frames[index] = NULL;
+                vcd->cache_bytes -= cache->frame_size;
+            }
+        }
+        res = -1;
+    }
+    conv->fbs_num = 0;
+    return res;
+}
+
+int
+camera_virtual_read_frame(CameraDevice* cd,
+                          ClientFrameBuffer* framebuffers,
+                          int fbs_num,
+                          float r_scale,
+                          float g_scale,
+                          float b_scale,
+                          float exp_comp)
+{
+    VirtualCameraDevice* const vcd = (VirtualCameraDevice*)cd->opaque;
+    VirtualSource* const src = vcd->source;
+    const uint64_t start = _get_timestamp();
+    VirtualConversion conv;
+    const uint8_t* frame;
+    uint64_t latency;
+    int64_t tick;
+    int index, n;
+
+    if (!vcd->started) {
+        E("%s: Virtual camera '%s' is not started",
+          __FUNCTION__, src->device_name);
+        return -1;
+    }
+
+    /* Pick the frame that is due at this time. */
+    tick = (int64_t)((start - vcd->start_time) * src->fps / 1000000);
+    index = (int)(tick % vcd->frame_num);
+    frame = vcd->frames[index];
+
+    /* Cached frames are only good for the color parameters they were
+     * converted with. */
+    if (r_scale != vcd->r_scale || g_scale != vcd->g_scale ||
+        b_scale != vcd->b_scale || exp_comp != vcd->exp_comp) {
+        _cache_reset(vcd);
+        vcd->r_scale = r_scale;
+        vcd->g_scale = g_scale;
+        vcd->b_scale = b_scale;
+        vcd->exp_comp = exp_comp;
+    }
+
+    /* Serve framebuffers from the cache, and collect the others, so that the
+     * source frame is converted once for all of them. Converted frames go
+     * into the cache if possible, or into the client framebuffers otherwise.
+     */
+    conv.fbs_num = 0;
+    for (n = 0; n < fbs_num; n++) {
+        ClientFrameBuffer* const fb = &framebuffers[n];
+        VirtualFrameCache* const cache = _cache_get(vcd, fb->pixel_format);
+        uint8_t* cached = NULL;
+
+        if (cache != NULL) {
+            cached = cache->frames[index];
+            if (cached != NULL) {
+                vcd->stats.cache_hits++;
+                vcd->stats.bytes_delivered += cache->frame_size;
+                fb->framebuffer = cached;
+                continue;
+            }
+            if (vcd->cache_bytes + cache->frame_size <= MAX_CACHE_BYTES) {
+                cached = malloc(cache->frame_size);
+            }
+        }
+
+        vcd->stats.cache_misses++;
+        if (conv.fbs_num == MAX_CACHE_FORMATS &&
+            _convert_pending(vcd, &conv, frame, index)) {
+            free(cached);
+            return -1;
+        }
+        conv.fbs[conv.fbs_num].pixel_format = fb->pixel_format;
+        if (cached != NULL) {
+            /* Framebuffers in the same format that follow are served from
+             * this frame, once converted. */
+            cache->frames[index] = cached;
+            vcd->cache_bytes += cache->frame_size;
+            vcd->stats.bytes_delivered += cache->frame_size;
+            fb->framebuffer = cached;
+            conv.fbs[conv.fbs_num].framebuffer = cached;
+            conv.caches[conv.fbs_num] = cache;
+        } else {
+            vcd->stats.bytes_delivered +=
+                _frame_size(fb->pixel_format, vcd->width, vcd->height);
+            conv.fbs[conv.fbs_num].framebuffer = fb->framebuffer;
+            conv.caches[conv.fbs_num] = NULL;
+        }
+        conv.fbs_num++;
+    }
+    if (_convert_pending(vcd, &conv, frame, index)) {
+        return -1;
+    }
+
+    /* Update statistics. */
+    if (vcd->last_tick >= 0) {
+        if (tick == vcd->last_tick) {
+            vcd->stats.frames_repeated++;
+        } else if (tick > vcd->last_tick + 1) {
+            vcd->stats.frames_skipped += tick - vcd->last_tick - 1;
+        }
+    }
+    vcd->last_tick = tick;
+    vcd->stats.frames_delivered++;
+    latency = _get_timestamp() - start;
+    vcd->stats.latency_total_us += latency;
+    if (latency > vcd->stats.latency_max_us) {
+        vcd->stats.latency_max_us = latency;
+    }
+
+    return 0;
+}
+
+void
+camera_virtual_close(CameraDevice* cd)
+{
+    VirtualCameraDevice* const vcd = (VirtualCameraDevice*)cd->opaque;
+
+    if (vcd->started) {
+        camera_virtual_stop_capturing(cd);
+    }
+    vcd->source->in_use = 0;
+    AFREE(vcd);
+}
+
+void
+camera_virtual_get_stats(CameraDevice* cd, CameraVirtualStats* stats)
+{
+    VirtualCameraDevice* const vcd = (VirtualCameraDevice*)cd->opaque;
+
+    *stats = vcd->stats;
+    if (vcd->started) {
+        stats->elapsed_us = _get_timestamp() - vcd->start_time;
+    }
+}
@@ -0,0 +1,133 @@
+/*
+ * Copyright (C) 2015 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_CAMERA_CAMERA_VIRTUAL_H
+#define ANDROID_CAMERA_CAMERA_VIRTUAL_H
+
+/*
+ * Contains declarations for the virtual camera devices, which let the camera
+ * service emulate a "webcam" on hosts that don't have one.
+ *
+ * A virtual camera is selected with a 'virtual[:<source>][@<fps>]' camera mode
+ * (see -camera-back / -camera-front), where <source> is one of:
+ *  - 'pattern' (the default) - An animated color bar pattern generated at any
+ *    frame dimensions requested by the guest.
+ *  - A path to a YUV4MPEG2 (.y4m) file with 4:2:0 frames.
+ *  - A path to a MJPEG file, i.e. a sequence of concatenated JPEG images.
+ * Files are loaded and decoded once, when the camera is set up. Frames are
+ * delivered at the requested frame rate (or the one from the .y4m header, or
+ * 30 fps by default), looping over the source frames.
+ *
+ * Frames converted into the pixel formats requested by the guest are kept in a
+ * cache, so once all source frames have been seen, reading a frame doesn't
+ * convert nor copy anything: camera_virtual_read_frame() just points the
+ * client framebuffers at the cached frames.
+ */
+
+#include "android/camera/camera-common.h"
+
+/* Prefix of the camera modes selecting a virtual camera. */
+#define CAMERA_VIRTUAL_MODE     "virtual"
+
+/* Statistics collected by a virtual camera device since capturing has started.
+ */
+typedef struct CameraVirtualStats {
+    /* Number of frames delivered to the client. */
+    uint64_t    frames_delivered;
+    /* Number of times the same source frame has been delivered again, because
+     * the client reads frames faster than the camera frame rate. */
+    uint64_t    frames_repeated;
+    /* Number of source frames that have never been delivered, because the
+     * client reads frames slower than the camera frame rate. */
+    uint64_t    frames_skipped;
+    /* Number of client framebuffers served from the frame cache. */
+    uint64_t    cache_hits;
+    /* Number of client framebuffers that required a conversion. */
+    uint64_t    cache_misses;
+    /* Total byte size of the client framebuffers delivered. */
+    uint64_t    bytes_delivered;
+    /* Total and maximum time spent to deliver a frame, in microseconds. */
+    uint64_t    latency_total_us;
+    uint64_t    latency_max_us;
+    /* Time elapsed since capturing has started, in microseconds. */
+    uint64_t    elapsed_us;
+} CameraVirtualStats;
+
+/* Checks if a camera mode selects a virtual camera. */
+extern int camera_virtual_is_mode(const char* mode);
+
+/* Checks if a device name was assigned to a virtual camera by
+ * camera_virtual_setup(). */
+extern int camera_virtual_is_device(const char* device_name);
+
+/* Sets up a virtual camera, loading its source.
+ * Param:
+ *  mode - Camera mode, as described at the top of this file.
+ *  dir - Direction ('back', or 'front') that the camera is facing.
+ *  ci - Upon success contains information about the virtual camera. It's the
+ *      responsibility of the caller to free the memory allocated for it.
+ * Return:
+ *  0 on success, or -1 on failure.
+ */
+extern int camera_virtual_setup(const char* mode,
+                                const char* dir,
+                                CameraInfo* ci);
+
+/* Frees all virtual cameras set up with camera_virtual_setup(), none of
+ * which must be opened. Mostly used for unit testing. */
+extern void camera_virtual_reset(void);
+
+/* Opens a virtual camera device set up with camera_virtual_setup().
+ * Param:
+ *  device_name - Device name returned in CameraInfo by camera_virtual_setup().
+ * Return:
+ *  Virtual camera device descriptor on success, or NULL on failure.
+ */
+extern CameraDevice* camera_virtual_open(const char* device_name);
+
+/* Starts capturing frames. See camera_device_start_capturing(). */
+extern int camera_virtual_start_capturing(CameraDevice* cd,
+                                          uint32_t pixel_format,
+                                          int frame_width,
+                                          int frame_height);
+
+/* Stops capturing frames. See camera_device_stop_capturing(). */
+extern int camera_virtual_stop_capturing(CameraDevice* cd);
+
+/* Reads the current frame. See camera_device_read_frame().
+ * Note that unlike camera_device_read_frame(), this routine may replace the
+ * 'framebuffer' pointers in the 'framebuffers' array with pointers to its own
+ * frame cache, instead of filling the client framebuffers. These pointers are
+ * valid until the next call to this routine, or until capturing is stopped.
+ * This routine never returns 1: a frame is always available.
+ */
+extern int camera_virtual_read_frame(CameraDevice* cd,
+                                     ClientFrameBuffer* framebuffers,
+                                     int fbs_num,
+                                     float r_scale,
+                                     float g_scale,
+                                     float b_scale,
+                                     float exp_comp);
+
+/* Closes a virtual camera device opened with camera_virtual_open(). */
+extern void camera_virtual_close(CameraDevice* cd);
+
+/* Gets statistics collected by a virtual camera device since capturing has
+ * last started. */
+extern void camera_virtual_get_stats(CameraDevice* cd,
+                                     CameraVirtualStats* stats);
+
+#endif  /* ANDROID_CAMERA_CAMERA_VIRTUAL_H */
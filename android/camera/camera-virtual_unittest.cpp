@@ -0,0 +1,328 @@
+// Copyright 2015 The Android Open Source Project
+//
+// This software is licensed under the terms of the GNU General Public
+// License version 2, as published by the Free Software Foundation, and
+// may be copied, distributed, and modified under those terms.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+extern "C" {
+#include "android/camera/camera-virtual.h"
+}
+#include "android/utils/jpeg-compress.h"
+
+#include "android/base/String.h"
+#include "android/base/StringFormat.h"
+#include "android/base/testing/TestTempDir.h"
+
+#include <gtest/gtest.h>
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <vector>
+
+using android::base::String;
+using android::base::StringFormat;
+using android::base::TestTempDir;
+
+namespace {
+
+typedef std::vector<uint8_t> Frame;
+
+Frame makeNoise(size_t size, unsigned seed) {
+    Frame frame(size);
+    srand(seed);
+    for (size_t n = 0; n < size; n++) {
+        frame[n] = (uint8_t)(rand() >> 4);
+    }
+    return frame;
+}
+
+bool writeFile(const String& path, const Frame& data) {
+    FILE* file = fopen(path.c_str(), "wb");
+    if (!file) {
+        return false;
+    }
+    const bool ok = fwrite(&data[0], 1, data.size(), file) == data.size();
+    return fclose(file) == 0 && ok;
+}
+
+void append(Frame* data, const char* text) {
+    data->insert(data->end(), text, text + strlen(text));
+}
+
+// Compresses a |width| x |height| image of a single RGB color.
+Frame makeJpeg(int width, int height, uint8_t r, uint8_t g, uint8_t b) {
+    Frame fb(width * height * 4);
+    for (size_t n = 0; n < fb.size(); n += 4) {
+        fb[n] = r;
+        fb[n + 1] = g;
+        fb[n + 2] = b;
+    }
+    AJPEGDesc* dsc = jpeg_compressor_create(0, 4096);
+    jpeg_compressor_compress_fb(dsc, 0, 0, width, height, height, 4,
+                                width * 4, &fb[0], 90, 1);
+    const uint8_t* jpeg =
+            static_cast<const uint8_t*>(jpeg_compressor_get_buffer(dsc));
+    Frame image(jpeg, jpeg + jpeg_compressor_get_jpeg_size(dsc));
+    jpeg_compressor_destroy(dsc);
+    return image;
+}
+
+class CameraVirtualTest : public ::testing::Test {
+protected:
+    CameraVirtualTest() : mTempDir("camera-virtual"), mDevice(NULL) {
+        memset(&mInfo, 0, sizeof(mInfo));
+    }
+
+    virtual void TearDown() {
+        if (mDevice) {
+            camera_virtual_close(mDevice);
+        }
+        free(mInfo.display_name);
+        free(mInfo.device_name);
+        free(mInfo.direction);
+        free(mInfo.frame_sizes);
+        camera_virtual_reset();
+    }
+
+    // Sets up a virtual camera with |mode|, and opens it.
+    bool open(const char* mode) {
+        if (camera_virtual_setup(mode, "back", &mInfo) != 0) {
+            return false;
+        }
+        mDevice = camera_virtual_open(mInfo.device_name);
+        return mDevice != NULL;
+    }
+
+    String makeFile(const char* name, const Frame& data) {
+        String path = mTempDir.makeSubPath(name);
+        EXPECT_TRUE(writeFile(path, data));
+        return path;
+    }
+
+    CameraVirtualStats getStats() {
+        CameraVirtualStats stats;
+        camera_virtual_get_stats(mDevice, &stats);
+        return stats;
+    }
+
+    TestTempDir mTempDir;
+    CameraInfo mInfo;
+    CameraDevice* mDevice;
+};
+
+}  // namespace
+
+TEST_F(CameraVirtualTest, ParsesModes) {
+    EXPECT_TRUE(camera_virtual_is_mode("virtual"));
+    EXPECT_TRUE(camera_virtual_is_mode("virtual:pattern"));
+    EXPECT_TRUE(camera_virtual_is_mode("virtual@15"));
+    EXPECT_TRUE(camera_virtual_is_mode("virtual:/tmp/a@b.y4m@15"));
+    EXPECT_FALSE(camera_virtual_is_mode("virtually"));
+    EXPECT_FALSE(camera_virtual_is_mode("webcam0"));
+    EXPECT_FALSE(camera_virtual_is_mode(NULL));
+
+    EXPECT_EQ(-1, camera_virtual_setup("virtual@0", "back", &mInfo));
+    EXPECT_EQ(-1, camera_virtual_setup("virtual@121", "back", &mInfo));
+    EXPECT_EQ(-1, camera_virtual_setup("virtual@fast", "back", &mInfo));
+    EXPECT_EQ(-1, camera_virtual_setup("virtual:/does/not/exist.y4m", "back",
+                                       &mInfo));
+    EXPECT_EQ(-1, camera_virtual_setup("webcam0", "back", &mInfo));
+}
+
+TEST_F(CameraVirtualTest, PatternIsServedFromTheCache) {
+    ASSERT_TRUE(open("virtual:pattern"));
+    EXPECT_STREQ("virtual0", mInfo.device_name);
+    EXPECT_TRUE(camera_virtual_is_device("virtual0"));
+    EXPECT_EQ(V4L2_PIX_FMT_YUYV, mInfo.pixel_format);
+    ASSERT_EQ(4, mInfo.frame_sizes_num);
+    EXPECT_EQ(640, mInfo.frame_sizes[0].width);
+    EXPECT_EQ(480, mInfo.frame_sizes[0].height);
+
+    // Only the source format is supported.
+    EXPECT_EQ(-1, camera_virtual_start_capturing(mDevice, V4L2_PIX_FMT_NV21,
+                                                 320, 240));
+    ASSERT_EQ(0, camera_virtual_start_capturing(mDevice, V4L2_PIX_FMT_YUYV,
+                                                320, 240));
+
+    const int width = 320, height = 240;
+    Frame video(width * height * 2);
+    Frame preview(width * height * 4);
+    ClientFrameBuffer fbs[2];
+    fbs[0].pixel_format = V4L2_PIX_FMT_YUYV;
+    fbs[0].framebuffer = &video[0];
+    fbs[1].pixel_format = V4L2_PIX_FMT_RGB32;
+    fbs[1].framebuffer = &preview[0];
+    ASSERT_EQ(0, camera_virtual_read_frame(mDevice, fbs, 2,
+                                           1.0f, 1.0f, 1.0f, 1.0f));
+
+    // Frames are converted into the cache, and never into the client
+    // framebuffers.
+    EXPECT_NE(&video[0], fbs[0].framebuffer);
+    EXPECT_NE(&preview[0], fbs[1].framebuffer);
+    CameraVirtualStats stats = getStats();
+    EXPECT_EQ(1U, stats.frames_delivered);
+    EXPECT_EQ(0U, stats.cache_hits);
+    EXPECT_EQ(2U, stats.cache_misses);
+    EXPECT_EQ(video.size() + preview.size(), stats.bytes_delivered);
+
+    // The top left corner is in the white bar, the next one is yellow.
+    const uint8_t* yuyv = static_cast<const uint8_t*>(fbs[0].framebuffer);
+    EXPECT_EQ(235, yuyv[0]);
+    EXPECT_EQ(128, yuyv[1]);
+    EXPECT_EQ(235, yuyv[2]);
+    EXPECT_EQ(128, yuyv[3]);
+    const uint8_t* rgb32 = static_cast<const uint8_t*>(fbs[1].framebuffer);
+    EXPECT_EQ(255, rgb32[0]);
+    EXPECT_EQ(255, rgb32[1]);
+    EXPECT_EQ(255, rgb32[2]);
+    const uint8_t* yellow = rgb32 + (width / 8 + 2) * 4;
+    EXPECT_LT(200, yellow[0]);
+    EXPECT_LT(200, yellow[1]);
+    EXPECT_GT(50, yellow[2]);
+
+    // Reading all pattern frames converts each of them once, after which
+    // everything comes from the cache.
+    const int kPatternFrames = 30;
+    for (int n = 0; n < kPatternFrames; n++) {
+        ClientFrameBuffer again[2];
+        memcpy(again, fbs, sizeof(again));
+        ASSERT_EQ(0, camera_virtual_read_frame(mDevice, again, 2,
+                                               1.0f, 1.0f, 1.0f, 1.0f));
+    }
+    stats = getStats();
+    EXPECT_EQ(kPatternFrames + 1U, stats.frames_delivered);
+    EXPECT_GE(2U * kPatternFrames, stats.cache_misses);
+    EXPECT_EQ(2U * (kPatternFrames + 1), stats.cache_hits + stats.cache_misses);
+
+    // Changing the exposure flushes the cache.
+    const uint64_t misses = stats.cache_misses;
+    ASSERT_EQ(0, camera_virtual_read_frame(mDevice, fbs, 2,
+                                           1.0f, 1.0f, 1.0f, 0.5f));
+    EXPECT_EQ(misses + 2, getStats().cache_misses);
+    EXPECT_GT(255, static_cast<const uint8_t*>(fbs[1].framebuffer)[0]);
+
+    EXPECT_EQ(0, camera_virtual_stop_capturing(mDevice));
+    EXPECT_EQ(-1, camera_virtual_stop_capturing(mDevice));
+}
+
+TEST_F(CameraVirtualTest, RawFramesAreDeliveredAsIs) {
+    const int width = 8, height = 4;
+    const size_t frameSize = width * height * 3 / 2;
+    const Frame frame0 = makeNoise(frameSize, 1);
+    const Frame frame1 = makeNoise(frameSize, 2);
+    Frame y4m;
+    append(&y4m, "YUV4MPEG2 W8 H4 F15:1 Ip A1:1 C420jpeg\n");
+    append(&y4m, "FRAME\n");
+    y4m.insert(y4m.end(), frame0.begin(), frame0.end());
+    append(&y4m, "FRAME Ixyz\n");
+    y4m.insert(y4m.end(), frame1.begin(), frame1.end());
+    // A truncated frame is ignored.
+    append(&y4m, "FRAME\n");
+    y4m.insert(y4m.end(), frame1.begin(), frame1.begin() + 5);
+    const String path = makeFile("raw.y4m", y4m);
+
+    ASSERT_TRUE(open(StringFormat("virtual:%s", path.c_str()).c_str()));
+    EXPECT_EQ(V4L2_PIX_FMT_YUV420, mInfo.pixel_format);
+    ASSERT_EQ(1, mInfo.frame_sizes_num);
+    EXPECT_EQ(width, mInfo.frame_sizes[0].width);
+    EXPECT_EQ(height, mInfo.frame_sizes[0].height);
+
+    // Only the file dimensions are supported.
+    EXPECT_EQ(-1, camera_virtual_start_capturing(mDevice, V4L2_PIX_FMT_YUV420,
+                                                 16, 8));
+    ASSERT_EQ(0, camera_virtual_start_capturing(mDevice, V4L2_PIX_FMT_YUV420,
+                                                width, height));
+
+    // With neutral colors, YUV frames are copied as they are.
+    Frame dst(frameSize);
+    ClientFrameBuffer fb;
+    fb.pixel_format = V4L2_PIX_FMT_YUV420;
+    fb.framebuffer = &dst[0];
+    ASSERT_EQ(0, camera_virtual_read_frame(mDevice, &fb, 1,
+                                           1.0f, 1.0f, 1.0f, 1.0f));
+    const Frame read(static_cast<const uint8_t*>(fb.framebuffer),
+                     static_cast<const uint8_t*>(fb.framebuffer) + frameSize);
+    EXPECT_TRUE(read == frame0 || read == frame1);
+}
+
+TEST_F(CameraVirtualTest, MjpegFramesAreDecoded) {
+    const int width = 16, height = 16;
+    Frame mjpeg = makeJpeg(width, height, 255, 0, 0);
+    // Garbage between images is skipped.
+    append(&mjpeg, "garbage");
+    const Frame blue = makeJpeg(width, height, 0, 0, 255);
+    mjpeg.insert(mjpeg.end(), blue.begin(), blue.end());
+    // So are images with other dimensions.
+    const Frame large = makeJpeg(2 * width, height, 0, 255, 0);
+    mjpeg.insert(mjpeg.end(), large.begin(), large.end());
+    const String path = makeFile("frames.mjpeg", mjpeg);
+
+    // One frame per second, so that the first frame is read.
+    ASSERT_TRUE(open(StringFormat("virtual:%s@1", path.c_str()).c_str()));
+    EXPECT_EQ(V4L2_PIX_FMT_RGB24, mInfo.pixel_format);
+    ASSERT_EQ(1, mInfo.frame_sizes_num);
+    EXPECT_EQ(width, mInfo.frame_sizes[0].width);
+    EXPECT_EQ(height, mInfo.frame_sizes[0].height);
+    ASSERT_EQ(0, camera_virtual_start_capturing(mDevice, V4L2_PIX_FMT_RGB24,
+                                                width, height));
+
+    Frame dst(width * height * 4);
+    ClientFrameBuffer fb;
+    fb.pixel_format = V4L2_PIX_FMT_RGB32;
+    fb.framebuffer = &dst[0];
+    ASSERT_EQ(0, camera_virtual_read_frame(mDevice, &fb, 1,
+                                           1.0f, 1.0f, 1.0f, 1.0f));
+    const uint8_t* rgb32 = static_cast<const uint8_t*>(fb.framebuffer);
+    for (int n = 0; n < width * height; n++, rgb32 += 4) {
+        ASSERT_NEAR(255, rgb32[0], 8) << "at " << n;
+        ASSERT_NEAR(0, rgb32[1], 8) << "at " << n;
+        ASSERT_NEAR(0, rgb32[2], 8) << "at " << n;
+    }
+}
+
+TEST_F(CameraVirtualTest, FramesArePacedAtTheFrameRate) {
+    const int width = 176, height = 144;
+    ASSERT_TRUE(open("virtual@10"));
+    ASSERT_EQ(0, camera_virtual_start_capturing(mDevice, V4L2_PIX_FMT_YUYV,
+                                                width, height));
+    Frame dst(width * height * 2);
+    ClientFrameBuffer fb;
+    fb.pixel_format = V4L2_PIX_FMT_YUYV;
+
+    // Reading faster than 10 fps repeats frames. At most one of these reads
+    // can start a new 100 ms frame.
+    for (int n = 0; n < 5; n++) {
+        fb.framebuffer = &dst[0];
+        ASSERT_EQ(0, camera_virtual_read_frame(mDevice, &fb, 1,
+                                               1.0f, 1.0f, 1.0f, 1.0f));
+    }
+    CameraVirtualStats stats = getStats();
+    EXPECT_LE(3U, stats.frames_repeated);
+    EXPECT_EQ(0U, stats.frames_skipped);
+
+    // Reading slower skips frames.
+    _camera_sleep(350);
+    fb.framebuffer = &dst[0];
+    ASSERT_EQ(0, camera_virtual_read_frame(mDevice, &fb, 1,
+                                           1.0f, 1.0f, 1.0f, 1.0f));
+    stats = getStats();
+    EXPECT_LE(2U, stats.frames_skipped);
+    EXPECT_EQ(6U, stats.frames_delivered);
+    EXPECT_EQ(6U * dst.size(), stats.bytes_delivered);
+    EXPECT_LE(stats.latency_max_us, stats.latency_total_us);
+    EXPECT_LE(350000U, stats.elapsed_us);
+
+    // Statistics are kept once capturing has stopped.
+    ASSERT_EQ(0, camera_virtual_stop_capturing(mDevice));
+    const CameraVirtualStats stopped = getStats();
+    EXPECT_EQ(6U, stopped.frames_delivered);
+    EXPECT_LE(stats.elapsed_us, stopped.elapsed_us);
+}
@@ -10,6 +10,7 @@
 ** GNU General Public License for more details.
 */
 #include "sysemu/char.h"
+#include "android/charpipe.h"
 #include "android/cbuffer.h"
 #include "android/qemu-debug.h"
 
@@ -26,10 +27,19 @@
  * between two QEMU character drivers that merge well into the
  * QEMU event loop.
  *
- * each half of the channel has its own object and buffer, and
- * we implement communication through charpipe_poll() which
- * must be called by the main event loop after its call to select()
+ * each half of the channel has its own object and buffer. Data that
+ * can't be delivered to the peer immediately is queued, and a bottom
+ * half is scheduled to deliver it from the event loop. If the peer still
+ * can't read everything, it must call qemu_chr_accept_input() once it
+ * can read more (e.g. the goldfish tty does when the guest drains its
+ * buffer), or change its handlers, which runs the bottom half again. As
+ * a fallback for readers that don't, the bottom half is also re-scheduled
+ * in idle mode (i.e. polled at least every 10ms). Idle pipes don't cost
+ * anything to the event loop.
  *
+ * the queue is a list of BipBuffers. A BipBuffer either holds a copy of
+ * the data in its own small circular buffer, or references a buffer that
+ * was handed over through charpipe_send_buffer().
  */
 
 #define  BIP_BUFFER_SIZE  512
@@ -38,6 +48,12 @@ typedef struct BipBuffer {
     struct BipBuffer*  next;
     CBuffer            cb[1];
     char               buff[ BIP_BUFFER_SIZE ];
+    /* external buffer, if any */
+    uint8_t*           ext;
+    int                ext_pos;
+    int                ext_len;
+    CharPipeReleaseFunc  ext_release;
+    void*              ext_opaque;
 } BipBuffer;
 
 static BipBuffer*  _free_bip_buffers;
@@ -56,6 +72,7 @@ bip_buffer_alloc( void )
         }
     }
     bip->next = NULL;
+    bip->ext  = NULL;
     cbuffer_reset( bip->cb, bip->buff, sizeof(bip->buff) );
     return bip;
 }
@@ -63,16 +80,111 @@ bip_buffer_alloc( void )
 static void
 bip_buffer_free( BipBuffer*  bip )
 {
+    if (bip->ext != NULL) {
+        bip->ext_release( bip->ext_opaque, bip->ext );
+        bip->ext = NULL;
+    }
     bip->next         = _free_bip_buffers;
     _free_bip_buffers = bip;
 }
 
+/* return the address and size of the next contiguous data in a BipBuffer */
+static int
+bip_buffer_peek( BipBuffer*  bip, uint8_t*  *pbase )
+{
+    if (bip->ext != NULL) {
+        *pbase = bip->ext + bip->ext_pos;
+        return bip->ext_len - bip->ext_pos;
+    }
+    return cbuffer_read_peek( bip->cb, pbase );
+}
+
+static void
+bip_buffer_step( BipBuffer*  bip, int  count )
+{
+    if (bip->ext != NULL)
+        bip->ext_pos += count;
+    else
+        cbuffer_read_step( bip->cb, count );
+}
+
+/* a queue of BipBuffers */
+typedef struct BipQueue {
+    BipBuffer*  first;
+    BipBuffer*  last;
+} BipQueue;
+
+static void
+bip_queue_clear( BipQueue*  q )
+{
+    while (q->first) {
+        BipBuffer*  bip = q->first;
+        q->first = bip->next;
+        bip_buffer_free(bip);
+    }
+    q->last = NULL;
+}
+
+static void
+bip_queue_append( BipQueue*  q, BipBuffer*  bip )
+{
+    if (q->last == NULL)
+        q->first = bip;
+    else
+        q->last->next = bip;
+    q->last = bip;
+}
+
+/* copy data at the end of the queue */
+static void
+bip_queue_write( BipQueue*  q, const uint8_t*  buf, int  len )
+{
+    BipBuffer*  bip = q->last;
+
+    while (len > 0) {
+        int  len2;
+
+        if (bip == NULL || bip->ext != NULL) {
+            bip = bip_buffer_alloc();
+            bip_queue_append(q, bip);
+        }
+
+        len2 = cbuffer_write( bip->cb, buf, len );
+        buf += len2;
+        len -= len2;
+        if (len > 0)
+            bip = NULL;  /* ok, we need another buffer */
+    }
+}
+
+/* return the next contiguous data in the queue, or 0 if it is empty */
+static int
+bip_queue_peek( BipQueue*  q, uint8_t*  *pbase )
+{
+    for (;;) {
+        BipBuffer*  bip = q->first;
+        int         avail;
+
+        if (bip == NULL)
+            return 0;
+
+        avail = bip_buffer_peek( bip, pbase );
+        if (avail > 0)
+            return avail;
+
+        q->first = bip->next;
+        if (q->first == NULL)
+            q->last = NULL;
+        bip_buffer_free(bip);
+    }
+}
+
 /* this models each half of the charpipe */
 typedef struct CharPipeHalf {
     CharDriverState       cs[1];
-    BipBuffer*            bip_first;
-    BipBuffer*            bip_last;
+    BipQueue              queue[1];
     struct CharPipeHalf*  peer;         /* NULL if closed */
+    QEMUBH*               bh;
 } CharPipeHalf;
 
 
@@ -82,120 +194,109 @@ charpipehalf_close( CharDriverState*  cs )
 {
     CharPipeHalf*  ph = cs->opaque;
 
-    while (ph->bip_first) {
-        BipBuffer*  bip = ph->bip_first;
-        ph->bip_first = bip->next;
-        bip_buffer_free(bip);
-    }
-    ph->bip_last    = NULL;
+    bip_queue_clear( ph->queue );
+    qemu_bh_cancel( ph->bh );
     ph->peer        = NULL;
 }
 
 
+/* send as much data as possible to the peer, return the number of bytes
+ * sent. */
 static int
-charpipehalf_write( CharDriverState*  cs, const uint8_t*  buf, int  len )
+charpipehalf_deliver( CharPipeHalf*  ph, const uint8_t*  buf, int  len )
 {
-    CharPipeHalf*  ph   = cs->opaque;
     CharPipeHalf*  peer = ph->peer;
-    BipBuffer*     bip  = ph->bip_last;
     int            ret  = 0;
 
-    D("%s: writing %d bytes to %p: '%s'", __FUNCTION__,
-      len, ph, quote_bytes( buf, len ));
+    if (peer == NULL || peer->cs->chr_read == NULL)
+        return 0;
 
-    if (bip == NULL && peer != NULL && peer->cs->chr_read != NULL) {
-        /* no buffered data, try to write directly to the peer */
-        while (len > 0) {
-            int  size;
+    while (len > 0) {
+        int  size;
 
-            if (peer->cs->chr_can_read) {
-                size = qemu_chr_can_read( peer->cs );
-                if (size == 0)
-                    break;
+        if (peer->cs->chr_can_read) {
+            size = qemu_chr_can_read( peer->cs );
+            if (size == 0)
+                break;
 
-                if (size > len)
-                    size = len;
-            } else
+            if (size > len)
                 size = len;
+        } else
+            size = len;
 
-            qemu_chr_read( peer->cs, (uint8_t*)buf, size );
-            buf += size;
-            len -= size;
-            ret += size;
-        }
+        qemu_chr_read( peer->cs, (uint8_t*)buf, size );
+        buf += size;
+        len -= size;
+        ret += size;
     }
+    return ret;
+}
 
-    if (len == 0)
-        return ret;
-
-    /* buffer the remaining data */
-    if (bip == NULL) {
-        bip = bip_buffer_alloc();
-        ph->bip_first = ph->bip_last = bip;
-    }
 
-    while (len > 0) {
-        int  len2 = cbuffer_write( bip->cb, buf, len );
+static int
+charpipehalf_write( CharDriverState*  cs, const uint8_t*  buf, int  len )
+{
+    CharPipeHalf*  ph   = cs->opaque;
+    int            ret  = 0;
 
-        buf += len2;
-        ret += len2;
-        len -= len2;
-        if (len == 0)
-            break;
+    D("%s: writing %d bytes to %p: '%s'", __FUNCTION__,
+      len, ph, quote_bytes( buf, len ));
 
-        /* ok, we need another buffer */
-        ph->bip_last = bip_buffer_alloc();
-        bip->next = ph->bip_last;
-        bip       = ph->bip_last;
+    if (ph->queue->first == NULL) {
+        /* no buffered data, try to write directly to the peer */
+        ret = charpipehalf_deliver( ph, buf, len );
+        buf += ret;
+        len -= ret;
     }
-    return  ret;
+
+    if (len == 0)
+        return ret;
+
+    /* buffer the remaining data */
+    bip_queue_write( ph->queue, buf, len );
+    qemu_bh_schedule( ph->bh );
+    return  ret + len;
 }
 
 
 static void
-charpipehalf_poll( CharPipeHalf*  ph )
+charpipehalf_flush( void*  opaque )
 {
-    CharPipeHalf*   peer = ph->peer;
-    int             size;
+    CharPipeHalf*   ph = opaque;
 
-    if (peer == NULL || peer->cs->chr_read == NULL)
-        return;
+    for (;;) {
+        uint8_t*  base;
+        int       avail = bip_queue_peek( ph->queue, &base );
+        int       sent;
 
-    while (1) {
-        BipBuffer*  bip = ph->bip_first;
-        uint8_t*    base;
-        int         avail;
+        if (avail == 0)
+            return;
 
-        if (bip == NULL)
-            break;
-
-        size = cbuffer_read_avail(bip->cb);
-        if (size == 0) {
-            ph->bip_first = bip->next;
-            if (ph->bip_first == NULL)
-                ph->bip_last = NULL;
-            bip_buffer_free(bip);
-            continue;
-        }
-
-        if (ph->cs->chr_can_read) {
-            int  size2 = qemu_chr_can_read(peer->cs);
+        D("%s: sending %d bytes from %p: '%s'", __FUNCTION__,
+            avail, ph, quote_bytes( base, avail ));
 
-            if (size2 == 0)
-                break;
+        sent = charpipehalf_deliver( ph, base, avail );
+        /* the peer may have closed the pipe meanwhile */
+        if (ph->queue->first == NULL)
+            return;
+        bip_buffer_step( ph->queue->first, sent );
+        if (sent < avail)
+            break;
+    }
 
-            if (size > size2)
-                size = size2;
-        }
+    /* the peer can't read everything yet, try again later */
+    qemu_bh_schedule_idle( ph->bh );
+}
 
-        avail = cbuffer_read_peek( bip->cb, &base );
-        if (avail > size)
-            avail = size;
-        D("%s: sending %d bytes from %p: '%s'", __FUNCTION__,
-            avail, ph, quote_bytes( base, avail ));
+/* called when the peer of 'cs' may be able to read more data */
+static void
+charpipehalf_kick( CharDriverState*  cs )
+{
+    CharPipeHalf*  ph = cs->opaque;
 
-        qemu_chr_read( peer->cs, base, avail );
-        cbuffer_read_step( bip->cb, avail );
+    if (ph->peer != NULL && ph->peer->queue->first != NULL) {
+        qemu_bh_cancel( ph->peer->bh );
+        qemu_bh_schedule( ph->peer->bh );
     }
 }
 
@@ -205,44 +306,90 @@ charpipehalf_init( CharPipeHalf*  ph, CharPipeHalf*  peer )
 {
     CharDriverState*  cs = ph->cs;
 
-    ph->bip_first   = NULL;
-    ph->bip_last    = NULL;
-    ph->peer        = peer;
+    ph->queue->first = NULL;
+    ph->queue->last  = NULL;
+    ph->peer         = peer;
+    if (ph->bh == NULL)
+        ph->bh = qemu_bh_new( charpipehalf_flush, ph );
 
-    cs->chr_write            = charpipehalf_write;
-    cs->chr_ioctl            = NULL;
-    cs->chr_send_event       = NULL;
-    cs->chr_close            = charpipehalf_close;
-    cs->opaque               = ph;
+    cs->chr_write               = charpipehalf_write;
+    cs->chr_ioctl               = NULL;
+    cs->chr_send_event          = NULL;
+    cs->chr_close               = charpipehalf_close;
+    cs->chr_update_read_handler = charpipehalf_kick;
+    cs->chr_accept_input        = charpipehalf_kick;
+    cs->opaque                  = ph;
 }
 
 
-typedef struct CharPipeState {
-    CharPipeHalf  a[1];
-    CharPipeHalf  b[1];
-} CharPipeState;
+void
+charpipe_send_buffer( CharDriverState*     cs,
+                      uint8_t*             buf,
+                      int                  len,
+                      CharPipeReleaseFunc  release,
+                      void*                opaque )
+{
+    CharPipeHalf*  ph = cs->opaque;
+    BipBuffer*     bip;
+    int            sent = 0;
 
+    if (cs->chr_write != charpipehalf_write) {
+        qemu_chr_write( cs, buf, len );
+        release( opaque, buf );
+        return;
+    }
 
+    if (ph->queue->first == NULL)
+        sent = charpipehalf_deliver( ph, buf, len );
 
-#define   MAX_CHAR_PIPES   8
+    if (sent == len || ph->peer == NULL) {
+        release( opaque, buf );
+        return;
+    }
 
-static CharPipeState  _s_charpipes[ MAX_CHAR_PIPES ];
+    /* hand the buffer over to the queue */
+    bip = bip_buffer_alloc();
+    bip->ext         = buf;
+    bip->ext_pos     = sent;
+    bip->ext_len     = len;
+    bip->ext_release = release;
+    bip->ext_opaque  = opaque;
+    bip_queue_append( ph->queue, bip );
+    qemu_bh_schedule( ph->bh );
+}
+
+
+typedef struct CharPipeState {
+    CharPipeHalf           a[1];
+    CharPipeHalf           b[1];
+    struct CharPipeState*  next;
+} CharPipeState;
+
+
+/* all the charpipes opened so far. closed ones are reused, along with
+ * their bottom halves, which can't be deleted */
+static CharPipeState*  _s_charpipes;
 
 int
 qemu_chr_open_charpipe( CharDriverState*  *pfirst, CharDriverState*  *psecond )
 {
-    CharPipeState*  cp     = _s_charpipes;
-    CharPipeState*  cp_end = cp + MAX_CHAR_PIPES;
+    CharPipeState*  cp;
 
-    for ( ; cp < cp_end; cp++ ) {
+    for (cp = _s_charpipes; cp != NULL; cp = cp->next) {
         if ( cp->a->peer == NULL && cp->b->peer == NULL )
             break;
     }
 
-    if (cp == cp_end) {  /* can't allocate one */
-        *pfirst  = NULL;
-        *psecond = NULL;
-        return -1;
+    if (cp == NULL) {
+        cp = calloc( 1, sizeof(*cp) );
+        if (cp == NULL) {
+            derror( "%s: not enough memory", __FUNCTION__ );
+            *pfirst  = NULL;
+            *psecond = NULL;
+            return -1;
+        }
+        cp->next     = _s_charpipes;
+        _s_charpipes = cp;
     }
 
     charpipehalf_init( cp->a, cp->b );
@@ -264,10 +411,10 @@ qemu_chr_open_charpipe( CharDriverState*  *pfirst, CharDriverState*  *psecond )
 
 typedef struct CharBuffer {
     CharDriverState  cs[1];
-    BipBuffer*       bip_first;
-    BipBuffer*       bip_last;
+    BipQueue         queue[1];
     CharDriverState* endpoint;  /* NULL if closed */
     char             closing;
+    QEMUBH*          bh;
 } CharBuffer;
 
 
@@ -276,12 +423,8 @@ charbuffer_close( CharDriverState*  cs )
 {
     CharBuffer*  cbuf = cs->opaque;
 
-    while (cbuf->bip_first) {
-        BipBuffer*  bip = cbuf->bip_first;
-        cbuf->bip_first = bip->next;
-        bip_buffer_free(bip);
-    }
-    cbuf->bip_last = NULL;
+    bip_queue_clear( cbuf->queue );
+    qemu_bh_cancel( cbuf->bh );
     cbuf->endpoint = NULL;
 
     if (cbuf->endpoint != NULL) {
@@ -295,13 +438,12 @@ charbuffer_write( CharDriverState*  cs, const uint8_t*  buf, int  len )
 {
     CharBuffer*       cbuf = cs->opaque;
     CharDriverState*  peer = cbuf->endpoint;
-    BipBuffer*        bip  = cbuf->bip_last;
     int               ret  = 0;
 
     D("%s: writing %d bytes to %p: '%s'", __FUNCTION__,
       len, cbuf, quote_bytes( buf, len ));
 
-    if (bip == NULL && peer != NULL) {
+    if (cbuf->queue->first == NULL && peer != NULL) {
         /* no buffered data, try to write directly to the peer */
         int  size = qemu_chr_write(peer, buf, len);
 
@@ -319,54 +461,28 @@ charbuffer_write( CharDriverState*  cs, const uint8_t*  buf, int  len )
         return ret;
 
     /* buffer the remaining data */
-    if (bip == NULL) {
-        bip = bip_buffer_alloc();
-        cbuf->bip_first = cbuf->bip_last = bip;
-    }
-
-    while (len > 0) {
-        int  len2 = cbuffer_write( bip->cb, buf, len );
-
-        buf += len2;
-        ret += len2;
-        len -= len2;
-        if (len == 0)
-            break;
-
-        /* ok, we need another buffer */
-        cbuf->bip_last = bip_buffer_alloc();
-        bip->next = cbuf->bip_last;
-        bip       = cbuf->bip_last;
-    }
-    return  ret;
+    bip_queue_write( cbuf->queue, buf, len );
+    qemu_bh_schedule( cbuf->bh );
+    return  ret + len;
 }
 
 
 static void
-charbuffer_poll( CharBuffer*  cbuf )
+charbuffer_flush( void*  opaque )
 {
+    CharBuffer*       cbuf = opaque;
     CharDriverState*  peer = cbuf->endpoint;
 
     if (peer == NULL)
         return;
 
-    while (1) {
-        BipBuffer*  bip = cbuf->bip_first;
-        uint8_t*    base;
-        int         avail;
-        int         size;
+    for (;;) {
+        uint8_t*  base;
+        int       avail = bip_queue_peek( cbuf->queue, &base );
+        int       size;
 
-        if (bip == NULL)
-            break;
-
-        avail = cbuffer_read_peek( bip->cb, &base );
-        if (avail == 0) {
-            cbuf->bip_first = bip->next;
-            if (cbuf->bip_first == NULL)
-                cbuf->bip_last = NULL;
-            bip_buffer_free(bip);
-            continue;
-        }
+        if (avail == 0)
+            return;
 
         size = qemu_chr_write( peer, base, avail );
 
@@ -375,11 +491,14 @@ charbuffer_poll( CharBuffer*  cbuf )
         else if (size > avail)
             size = avail;
 
-        cbuffer_read_step( bip->cb, size );
+        bip_buffer_step( cbuf->queue->first, size );
 
         if (size < avail)
             break;
     }
+
+    /* the endpoint is busy, try again later */
+    qemu_bh_schedule_idle( cbuf->bh );
 }
 
 
@@ -401,9 +520,11 @@ charbuffer_init( CharBuffer*  cbuf, CharDriverState*  endpoint )
 {
     CharDriverState*  cs = cbuf->cs;
 
-    cbuf->bip_first   = NULL;
-    cbuf->bip_last    = NULL;
-    cbuf->endpoint    = endpoint;
+    cbuf->queue->first = NULL;
+    cbuf->queue->last  = NULL;
+    cbuf->endpoint     = endpoint;
+    if (cbuf->bh == NULL)
+        cbuf->bh = qemu_bh_new( charbuffer_flush, cbuf );
 
     cs->chr_write               = charbuffer_write;
     cs->chr_ioctl               = NULL;
@@ -437,33 +558,3 @@ qemu_chr_open_buffer( CharDriverState*  endpoint )
     charbuffer_init(cbuf, endpoint);
     return cbuf->cs;
 }
-
-
-void
-charpipe_poll( void )
-{
-    CharPipeState*  cp     = _s_charpipes;
-    CharPipeState*  cp_end = cp + MAX_CHAR_PIPES;
-
-    CharBuffer*     cb     = _s_charbuffers;
-    CharBuffer*     cb_end = cb + MAX_CHAR_BUFFERS;
-
-    /* poll the charpipes */
-    for ( ; cp < cp_end; cp++ ) {
-        CharPipeHalf*  half;
-
-        half = cp->a;
-        if (half->peer != NULL)
-            charpipehalf_poll(half);
-
-        half = cp->b;
-        if (half->peer != NULL)
-            charpipehalf_poll(half);
-    }
-
-    /* poll the charbuffers */
-    for ( ; cb < cb_end; cb++ ) {
-        if (cb->endpoint != NULL)
-            charbuffer_poll(cb);
-    }
-}
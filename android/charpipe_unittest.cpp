@@ -0,0 +1,543 @@
+// Copyright 2015 The Android Open Source Project
+//
+// This software is licensed under the terms of the GNU General Public
+// License version 2, as published by the Free Software Foundation, and
+// may be copied, distributed, and modified under those terms.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+extern "C" {
+#include "android/charpipe.h"
+#include "sysemu/char.h"
+}
+
+#include <gtest/gtest.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <algorithm>
+#include <vector>
+
+// Bottom halves and char driver helpers used by charpipe.c. The main loop
+// isn't linked into the tests, so they are implemented here the same way,
+// and the tests run the scheduled bottom halves themselves.
+
+struct QEMUBH {
+    QEMUBHFunc* cb;
+    void* opaque;
+    int scheduled;
+    int idle;
+};
+
+namespace {
+
+std::vector<QEMUBH*> sBottomHalves;
+
+// Runs the scheduled bottom halves, like an iteration of the main loop.
+// Idle ones only run if |runIdle| is true, since the main loop may wait up
+// to 10 ms before running them. Returns the number of bottom halves run.
+int runBottomHalves(bool runIdle) {
+    int count = 0;
+    for (size_t n = 0; n < sBottomHalves.size(); ++n) {
+        QEMUBH* bh = sBottomHalves[n];
+        if (bh->scheduled && (runIdle || !bh->idle)) {
+            bh->scheduled = 0;
+            bh->idle = 0;
+            bh->cb(bh->opaque);
+            count++;
+        }
+    }
+    return count;
+}
+
+bool hasScheduledBottomHalves(bool idle) {
+    for (size_t n = 0; n < sBottomHalves.size(); ++n) {
+        QEMUBH* bh = sBottomHalves[n];
+        if (bh->scheduled && bh->idle == (int)idle) {
+            return true;
+        }
+    }
+    return false;
+}
+
+}  // namespace
+
+extern "C" {
+
+QEMUBH* qemu_bh_new(QEMUBHFunc* cb, void* opaque) {
+    QEMUBH* bh = new QEMUBH();
+    bh->cb = cb;
+    bh->opaque = opaque;
+    sBottomHalves.push_back(bh);
+    return bh;
+}
+
+void qemu_bh_schedule(QEMUBH* bh) {
+    if (bh->scheduled) {
+        return;
+    }
+    bh->scheduled = 1;
+    bh->idle = 0;
+}
+
+void qemu_bh_schedule_idle(QEMUBH* bh) {
+    if (bh->scheduled) {
+        return;
+    }
+    bh->scheduled = 1;
+    bh->idle = 1;
+}
+
+void qemu_bh_cancel(QEMUBH* bh) {
+    bh->scheduled = 0;
+}
+
+int qemu_chr_write(CharDriverState* s, const uint8_t* buf, int len) {
+    return s->chr_write(s, buf, len);
+}
+
+int qemu_chr_can_read(CharDriverState* s) {
+    if (!s->chr_can_read) {
+        return 0;
+    }
+    return s->chr_can_read(s->handler_opaque);
+}
+
+void qemu_chr_read(CharDriverState* s, uint8_t* buf, int len) {
+    s->chr_read(s->handler_opaque, buf, len);
+}
+
+void qemu_chr_accept_input(CharDriverState* s) {
+    if (s->chr_accept_input) {
+        s->chr_accept_input(s);
+    }
+}
+
+void qemu_chr_add_handlers(CharDriverState* s,
+                           IOCanReadHandler* fd_can_read,
+                           IOReadHandler* fd_read,
+                           IOEventHandler* fd_event,
+                           void* opaque) {
+    s->chr_can_read = fd_can_read;
+    s->chr_read = fd_read;
+    s->chr_event = fd_event;
+    s->handler_opaque = opaque;
+    if (s->chr_update_read_handler) {
+        s->chr_update_read_handler(s);
+    }
+}
+
+void qemu_chr_close(CharDriverState* s) {
+    if (s->chr_close) {
+        s->chr_close(s);
+    }
+}
+
+}  // extern "C"
+
+namespace {
+
+// A reader with a small receive buffer, like the goldfish tty, which only
+// takes as many bytes as it has room for. The guest empties it with
+// drain(), after which the device calls qemu_chr_accept_input().
+class TtyReader {
+public:
+    explicit TtyReader(CharDriverState* cs, int capacity = 128)
+        : mCs(cs), mCapacity(capacity), mCount(0) {
+        qemu_chr_add_handlers(cs, canRead, read, NULL, this);
+    }
+
+    ~TtyReader() {
+        qemu_chr_add_handlers(mCs, NULL, NULL, NULL, NULL);
+    }
+
+    // Empties the receive buffer into |received()|, and tells the pipe
+    // about it if |acceptInput| is true.
+    void drain(bool acceptInput) {
+        mReceived.insert(mReceived.end(), mBuffer.begin(),
+                         mBuffer.begin() + mCount);
+        mCount = 0;
+        if (acceptInput) {
+            qemu_chr_accept_input(mCs);
+        }
+    }
+
+    int pending() const { return mCount; }
+    const std::vector<uint8_t>& received() const { return mReceived; }
+    void clearReceived() { mReceived.clear(); }
+
+private:
+    static int canRead(void* opaque) {
+        TtyReader* r = static_cast<TtyReader*>(opaque);
+        return r->mCapacity - r->mCount;
+    }
+
+    static void read(void* opaque, const uint8_t* buf, int len) {
+        TtyReader* r = static_cast<TtyReader*>(opaque);
+        ASSERT_LE(len, r->mCapacity - r->mCount);
+        if (r->mBuffer.size() < (size_t)r->mCapacity) {
+            r->mBuffer.resize(r->mCapacity);
+        }
+        memcpy(&r->mBuffer[r->mCount], buf, len);
+        r->mCount += len;
+    }
+
+    CharDriverState* mCs;
+    int mCapacity;
+    int mCount;
+    std::vector<uint8_t> mBuffer;
+    std::vector<uint8_t> mReceived;
+};
+
+std::vector<uint8_t> makeData(size_t size) {
+    std::vector<uint8_t> data(size);
+    for (size_t n = 0; n < size; ++n) {
+        data[n] = (uint8_t)(n * 7 + n / 251);
+    }
+    return data;
+}
+
+class CharPipeTest : public ::testing::Test {
+protected:
+    virtual void SetUp() {
+        ASSERT_EQ(0, qemu_chr_open_charpipe(&mWriter, &mReaderCs));
+    }
+
+    virtual void TearDown() {
+        qemu_chr_close(mWriter);
+        qemu_chr_close(mReaderCs);
+        runBottomHalves(true);
+    }
+
+    CharDriverState* mWriter;
+    CharDriverState* mReaderCs;
+};
+
+}  // namespace
+
+TEST_F(CharPipeTest, WritesGoStraightToTheReader) {
+    TtyReader reader(mReaderCs, 1024);
+    std::vector<uint8_t> data = makeData(1000);
+    EXPECT_EQ(1000, qemu_chr_write(mWriter, &data[0], 1000));
+    EXPECT_EQ(1000, reader.pending());
+    EXPECT_FALSE(hasScheduledBottomHalves(false));
+    EXPECT_FALSE(hasScheduledBottomHalves(true));
+    reader.drain(false);
+    EXPECT_EQ(data, reader.received());
+}
+
+TEST_F(CharPipeTest, AcceptInputDeliversQueuedData) {
+    TtyReader reader(mReaderCs);
+    std::vector<uint8_t> data = makeData(1000);
+    EXPECT_EQ(1000, qemu_chr_write(mWriter, &data[0], 1000));
+    EXPECT_EQ(128, reader.pending());
+
+    // Nothing more can be delivered until the reader has room, the bottom
+    // half is then only polled.
+    EXPECT_EQ(1, runBottomHalves(false));
+    EXPECT_EQ(128, reader.pending());
+    EXPECT_FALSE(hasScheduledBottomHalves(false));
+    EXPECT_TRUE(hasScheduledBottomHalves(true));
+
+    // Each qemu_chr_accept_input() brings the next bytes in the next
+    // iteration of the main loop.
+    for (;;) {
+        reader.drain(true);
+        if (reader.received().size() == data.size()) {
+            break;
+        }
+        EXPECT_TRUE(hasScheduledBottomHalves(false));
+        runBottomHalves(false);
+    }
+    EXPECT_EQ(data, reader.received());
+    runBottomHalves(true);
+    EXPECT_FALSE(hasScheduledBottomHalves(false));
+    EXPECT_FALSE(hasScheduledBottomHalves(true));
+}
+
+TEST_F(CharPipeTest, IdleBottomHalfDeliversQueuedData) {
+    // Readers that don't call qemu_chr_accept_input() still get their data
+    // from the idle bottom half.
+    TtyReader reader(mReaderCs);
+    std::vector<uint8_t> data = makeData(1000);
+    EXPECT_EQ(1000, qemu_chr_write(mWriter, &data[0], 1000));
+    while (reader.received().size() < data.size()) {
+        reader.drain(false);
+        runBottomHalves(true);
+    }
+    EXPECT_EQ(data, reader.received());
+}
+
+TEST_F(CharPipeTest, ChangingHandlersDeliversQueuedData) {
+    std::vector<uint8_t> data = makeData(300);
+    EXPECT_EQ(300, qemu_chr_write(mWriter, &data[0], 300));
+    TtyReader reader(mReaderCs, 1024);
+    EXPECT_EQ(0, reader.pending());
+    runBottomHalves(false);
+    EXPECT_EQ(300, reader.pending());
+}
+
+TEST_F(CharPipeTest, KeepsDataInOrder) {
+    TtyReader reader(mReaderCs, 100);
+    std::vector<uint8_t> data = makeData(200000);
+    srand(1);
+    size_t sent = 0;
+    while (sent < data.size()) {
+        int len = 1 + rand() % 2000;
+        if (len > (int)(data.size() - sent)) {
+            len = data.size() - sent;
+        }
+        EXPECT_EQ(len, qemu_chr_write(mWriter, &data[sent], len));
+        sent += len;
+        reader.drain(rand() % 2 == 0);
+        runBottomHalves(rand() % 4 == 0);
+    }
+    while (reader.received().size() < data.size()) {
+        reader.drain(true);
+        runBottomHalves(false);
+    }
+    EXPECT_EQ(data, reader.received());
+}
+
+TEST(CharPipe, OpensManyIndependentPipes) {
+    const int kPipes = 300;
+    std::vector<CharDriverState*> writers(kPipes);
+    std::vector<CharDriverState*> readerCss(kPipes);
+    std::vector<TtyReader*> readers(kPipes);
+    for (int n = 0; n < kPipes; ++n) {
+        ASSERT_EQ(0, qemu_chr_open_charpipe(&writers[n], &readerCss[n]));
+        readers[n] = new TtyReader(readerCss[n]);
+    }
+    for (int n = 0; n < kPipes; ++n) {
+        const uint8_t byte = (uint8_t)n;
+        EXPECT_EQ(1, qemu_chr_write(writers[n], &byte, 1));
+    }
+    for (int n = 0; n < kPipes; ++n) {
+        readers[n]->drain(false);
+        ASSERT_EQ(1U, readers[n]->received().size()) << n;
+        EXPECT_EQ((uint8_t)n, readers[n]->received()[0]) << n;
+        delete readers[n];
+        qemu_chr_close(writers[n]);
+        qemu_chr_close(readerCss[n]);
+    }
+    // Closed pipes are reused.
+    CharDriverState* writer;
+    CharDriverState* readerCs;
+    ASSERT_EQ(0, qemu_chr_open_charpipe(&writer, &readerCs));
+    EXPECT_TRUE(std::find(writers.begin(), writers.end(), writer) !=
+                writers.end());
+    qemu_chr_close(writer);
+    qemu_chr_close(readerCs);
+    runBottomHalves(true);
+}
+
+namespace {
+
+// Counts the buffers released by a charpipe.
+struct ReleaseCounter {
+    ReleaseCounter() : count(0), last(NULL) {}
+
+    static void release(void* opaque, uint8_t* buf) {
+        ReleaseCounter* c = static_cast<ReleaseCounter*>(opaque);
+        c->count++;
+        c->last = buf;
+    }
+
+    int count;
+    uint8_t* last;
+};
+
+}  // namespace
+
+TEST_F(CharPipeTest, SendBufferGoesStraightToTheReader) {
+    TtyReader reader(mReaderCs, 1024);
+    std::vector<uint8_t> data = makeData(1000);
+    ReleaseCounter released;
+    charpipe_send_buffer(mWriter, &data[0], 1000, ReleaseCounter::release,
+                         &released);
+    EXPECT_EQ(1, released.count);
+    EXPECT_EQ(&data[0], released.last);
+    EXPECT_FALSE(hasScheduledBottomHalves(false));
+    reader.drain(false);
+    EXPECT_EQ(data, reader.received());
+}
+
+TEST_F(CharPipeTest, SendBufferIsReleasedOnceRead) {
+    // The buffer is queued between copied writes, and kept until the reader
+    // has taken all of it.
+    TtyReader reader(mReaderCs);
+    std::vector<uint8_t> data = makeData(1300);
+    ReleaseCounter released;
+    EXPECT_EQ(100, qemu_chr_write(mWriter, &data[0], 100));
+    charpipe_send_buffer(mWriter, &data[100], 1000, ReleaseCounter::release,
+                         &released);
+    EXPECT_EQ(200, qemu_chr_write(mWriter, &data[1100], 200));
+    EXPECT_EQ(0, released.count);
+    while (reader.received().size() < data.size()) {
+        EXPECT_EQ(reader.received().size() + reader.pending() < 1100 ? 0 : 1,
+                  released.count);
+        reader.drain(true);
+        runBottomHalves(false);
+    }
+    EXPECT_EQ(1, released.count);
+    EXPECT_EQ(&data[100], released.last);
+    EXPECT_EQ(data, reader.received());
+}
+
+TEST_F(CharPipeTest, SendBufferIsReleasedOnClose) {
+    TtyReader reader(mReaderCs);
+    std::vector<uint8_t> data = makeData(1000);
+    ReleaseCounter released;
+    charpipe_send_buffer(mWriter, &data[0], 1000, ReleaseCounter::release,
+                         &released);
+    EXPECT_EQ(128, reader.pending());
+    EXPECT_EQ(0, released.count);
+    qemu_chr_close(mWriter);
+    EXPECT_EQ(1, released.count);
+}
+
+namespace {
+
+// Simulates sending |size| bytes through a pipe to a tty-like reader that
+// the guest drains every |drainUs| microseconds, while the main loop runs
+// idle bottom halves every 10 ms. Returns the simulated throughput in KB/s.
+double simulateThroughput(size_t size, int drainUs, bool acceptInput) {
+    CharDriverState* writer;
+    CharDriverState* readerCs;
+    EXPECT_EQ(0, qemu_chr_open_charpipe(&writer, &readerCs));
+    TtyReader reader(readerCs);
+    std::vector<uint8_t> data = makeData(size);
+    qemu_chr_write(writer, &data[0], size);
+
+    long long nowUs = 0;
+    long long idleUs = 0;
+    while (reader.received().size() < size) {
+        nowUs += drainUs;
+        reader.drain(acceptInput);
+        runBottomHalves(false);
+        if (nowUs - idleUs >= 10000) {
+            runBottomHalves(true);
+            idleUs = nowUs;
+        }
+    }
+    EXPECT_EQ(data, reader.received());
+    qemu_chr_close(writer);
+    qemu_chr_close(readerCs);
+    runBottomHalves(true);
+    return (double)size / 1024. * 1e6 / nowUs;
+}
+
+}  // namespace
+
+// Compares how fast data gets through a pipe to the goldfish tty when the
+// tty calls qemu_chr_accept_input() after the guest reads its buffer, and
+// when the pipe only retries from its idle bottom half, which the main loop
+// runs every 10 ms at worst. Also measures the cost of the pipe itself.
+// Run with --gtest_also_run_disabled_tests.
+TEST(CharPipeBenchmark, DISABLED_Benchmark) {
+    const size_t kSize = 256 * 1024;
+    printf("tty reader, guest reads every 100 us: %8.1f KB/s with "
+           "accept_input, %8.1f KB/s with idle retries\n",
+           simulateThroughput(kSize, 100, true),
+           simulateThroughput(kSize, 100, false));
+
+    CharDriverState* writer;
+    CharDriverState* readerCs;
+    ASSERT_EQ(0, qemu_chr_open_charpipe(&writer, &readerCs));
+    TtyReader reader(readerCs, 4096);
+    std::vector<uint8_t> data = makeData(64 * 1024);
+    const int kRounds = 2000;
+    size_t total = 0;
+    srand(1);
+    clock_t start = clock();
+    for (int n = 0; n < kRounds; ++n) {
+        for (size_t sent = 0; sent < data.size(); ) {
+            size_t len = 1 + rand() % 4096;
+            if (len > data.size() - sent) {
+                len = data.size() - sent;
+            }
+            qemu_chr_write(writer, &data[sent], len);
+            sent += len;
+            reader.drain(true);
+            runBottomHalves(false);
+        }
+        total += data.size();
+        reader.clearReceived();
+    }
+    while (runBottomHalves(true) > 0) {
+        reader.drain(true);
+    }
+    double seconds = (double)(clock() - start) / CLOCKS_PER_SEC;
+    printf("random 1..4096 byte writes to a 4096 byte reader: %.1f MB/s\n",
+           total / (1024. * 1024.) / seconds);
+    qemu_chr_close(writer);
+    qemu_chr_close(readerCs);
+    runBottomHalves(true);
+}
+
+namespace {
+
+// Runs |iterations| iterations of the main loop's bottom half pass, with one
+// pipe carrying a short message in each of them. Returns the time per
+// iteration in nanoseconds.
+double mainLoopNs(int iterations) {
+    CharDriverState* writer;
+    CharDriverState* readerCs;
+    EXPECT_EQ(0, qemu_chr_open_charpipe(&writer, &readerCs));
+    TtyReader reader(readerCs, 64);
+    std::vector<uint8_t> data = makeData(100);
+    clock_t start = clock();
+    for (int n = 0; n < iterations; ++n) {
+        qemu_chr_write(writer, &data[0], data.size());
+        reader.drain(true);
+        runBottomHalves(n % 10 == 0);
+        reader.clearReceived();
+    }
+    double ns = (double)(clock() - start) * 1e9 / CLOCKS_PER_SEC / iterations;
+    qemu_chr_close(writer);
+    qemu_chr_close(readerCs);
+    runBottomHalves(true);
+    return ns;
+}
+
+}  // namespace
+
+// Measures what idle pipes cost to the main loop. They only have unscheduled
+// bottom halves, which the main loop skips, instead of being polled on each
+// iteration. Run with --gtest_also_run_disabled_tests.
+TEST(CharPipeBenchmark, DISABLED_IdlePipes) {
+    const int kIterations = 200000;
+    const int kIdlePipes = 500;
+    mainLoopNs(kIterations);  // warm up
+    const double aloneNs = mainLoopNs(kIterations);
+
+    std::vector<CharDriverState*> pipes;
+    std::vector<TtyReader*> readers;
+    for (int n = 0; n < kIdlePipes; ++n) {
+        CharDriverState* a;
+        CharDriverState* b;
+        ASSERT_EQ(0, qemu_chr_open_charpipe(&a, &b));
+        pipes.push_back(a);
+        pipes.push_back(b);
+        readers.push_back(new TtyReader(a));
+        readers.push_back(new TtyReader(b));
+    }
+    const double idleNs = mainLoopNs(kIterations);
+    printf("main loop iteration with one busy pipe: %7.1f ns alone, "
+           "%7.1f ns with %d idle pipes (%.2fx)\n",
+           aloneNs, idleNs, kIdlePipes, idleNs / aloneNs);
+
+    for (size_t n = 0; n < readers.size(); ++n) {
+        delete readers[n];
+    }
+    for (size_t n = 0; n < pipes.size(); ++n) {
+        qemu_chr_close(pipes[n]);
+    }
+    runBottomHalves(true);
+}
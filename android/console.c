@@ -690,6 +690,21 @@ do_network_status( ControlClient  client, char*  args )
 
     control_write( client, "  minimum latency:  %ld ms\r\n", qemu_net_min_latency );
     control_write( client, "  maximum latency:  %ld ms\r\n", qemu_net_max_latency );
+    {
+        DnsCacheStats  dns;
+        slirp_get_dns_cache_stats(&dns);
+        control_write( client, "  dns cache:        %d entries, %llu hits, %llu misses, %llu coalesced\r\n",
+                       dns.entries, (unsigned long long)dns.hits,
+                       (unsigned long long)dns.misses,
+                       (unsigned long long)dns.coalesced );
+    }
+    if (qemu_tcpdump_active) {
+        uint64_t  count, size, dropped;
+        qemu_tcpdump_stats(&count, &size, &dropped);
+        control_write( client, "  capture:          %llu packets, %llu bytes, %llu dropped\r\n",
+                       (unsigned long long)count, (unsigned long long)size,
+                       (unsigned long long)dropped );
+    }
     return 0;
 }
 
@@ -783,13 +798,31 @@ do_network_capture_stop( ControlClient  client, char*  args )
     return 0;
 }
 
+static int
+do_network_capture_status( ControlClient  client, char*  args )
+{
+    uint64_t  count, size, dropped;
+
+    if (!qemu_tcpdump_active) {
+        control_write( client, "no capture in progress\r\n" );
+        return 0;
+    }
+    qemu_tcpdump_stats(&count, &size, &dropped);
+    control_write( client, "captured packets: %llu\r\n", (unsigned long long)count );
+    control_write( client, "captured bytes:   %llu\r\n", (unsigned long long)size );
+    control_write( client, "dropped packets:  %llu\r\n", (unsigned long long)dropped );
+    return 0;
+}
+
 static const CommandDefRec  network_capture_commands[] =
 {
     { "start", "start network capture",
       "'network capture start <file>' starts a new capture of network packets\r\n"
       "into a specific <file>. This will stop any capture already in progress.\r\n"
       "the capture file can later be analyzed by tools like WireShark. It uses\r\n"
-      "the libpcap file format.\r\n\r\n"
+      "the pcapng file format.\r\n\r\n"
+      "<file> can be followed by the same comma-separated options as the\r\n"
+      "-tcpdump option, see 'emulator -help-tcpdump' for details.\r\n\r\n"
       "you can stop the capture anytime with 'network capture stop'\r\n", NULL,
       do_network_capture_start, NULL },
 
@@ -798,6 +831,12 @@ static const CommandDefRec  network_capture_commands[] =
       "you can start one with 'network capture start <file>'\r\n", NULL,
       do_network_capture_stop, NULL },
 
+    { "status", "show network capture statistics",
+      "'network capture status' shows the number of packets captured so far, their\r\n"
+      "total size, and the number of packets dropped because the capture file\r\n"
+      "couldn't be written fast enough.\r\n", NULL,
+      do_network_capture_status, NULL },
+
     { NULL, NULL, NULL, NULL, NULL, NULL }
 };
 
@@ -2020,6 +2059,13 @@ do_event_text( ControlClient  client, char*  args )
     return 0;
 }
 
+static int
+do_event_stats( ControlClient  client, char*  args )
+{
+    events_dev_display_stats(do_control_write, client);
+    return 0;
+}
+
 static const CommandDefRec  event_commands[] =
 {
     { "send", "send a series of events to the kernel",
@@ -2041,6 +2087,10 @@ static const CommandDefRec  event_commands[] =
     "according to the current device keyboard. unsupported characters will be discarded\r\n"
     "silently\r\n", NULL, do_event_text, NULL },
 
+    { "stats", "display event delivery statistics",
+    "'event stats' displays how many input events were queued, delivered to the kernel\r\n"
+    "or dropped, and the current and maximum event rates\r\n", NULL, do_event_stats, NULL },
+
     { NULL, NULL, NULL, NULL, NULL, NULL }
 };
 
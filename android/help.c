@@ -1390,7 +1390,21 @@ help_tcpdump(stralloc_t  *out)
     "  really happens.\n\n"
 
     "  note that this captures all Ethernet packets, and is not limited to TCP\n"
-    "  connections.\n\n"
+    "  connections. The capture file uses the pcapng format.\n\n"
+
+    "  the file name can be followed by comma-separated options. These are\n"
+    "  only recognized at the end, so the file name may contain commas:\n\n"
+
+    "    -tcpdump <file>[,snaplen=<bytes>][,filter=<expr>][,filesize=<size>][,files=<count>]\n\n"
+
+    "    snaplen=<bytes>   only capture the first <bytes> of each packet\n"
+    "    filter=<expr>     only capture packets matching <expr>, a simple\n"
+    "                      expression made of 'arp', 'ip', 'ip6', 'tcp', 'udp',\n"
+    "                      'icmp', 'port <num>' and 'host <a.b.c.d>' combined\n"
+    "                      with 'and', 'or' and 'not'\n"
+    "    filesize=<size>   rotate the capture file when it grows past <size>\n"
+    "                      (a k, m or g suffix can be used)\n"
+    "    files=<count>     number of rotated files to keep (default 2)\n\n"
 
     "  you can also start/stop the packet capture dynamically through the console;\n"
     "  see the 'network capture start' and 'network capture stop' commands for\n"
@@ -1480,6 +1494,12 @@ help_camera_back(stralloc_t* out)
 
     "     emulated  -> camera will be emulated using software ('fake') camera emulation\n"
     "     webcam<N> -> camera will be emulated using a webcamera connected to the host\n"
+    "     virtual[:<source>][@<fps>]\n"
+    "               -> camera will be emulated using a virtual camera, streaming\n"
+    "                  frames from <source> at <fps> frames per second, where\n"
+    "                  <source> is 'pattern' (the default) for generated color\n"
+    "                  bars, or the path to a .y4m file (YUV 4:2:0 frames), or to\n"
+    "                  a MJPEG file (concatenated JPEG images)\n"
     "     none      -> camera emulation will be disabled\n\n"
     );
 }
@@ -1493,6 +1513,12 @@ help_camera_front(stralloc_t* out)
 
     "     emulated  -> camera will be emulated using software ('fake') camera emulation\n"
     "     webcam<N> -> camera will be emulated using a webcamera connected to the host\n"
+    "     virtual[:<source>][@<fps>]\n"
+    "               -> camera will be emulated using a virtual camera, streaming\n"
+    "                  frames from <source> at <fps> frames per second, where\n"
+    "                  <source> is 'pattern' (the default) for generated color\n"
+    "                  bars, or the path to a .y4m file (YUV 4:2:0 frames), or to\n"
+    "                  a MJPEG file (concatenated JPEG images)\n"
     "     none      -> camera emulation will be disabled\n\n"
     );
 }
@@ -27,6 +27,10 @@
 #include "android/looper.h"
 #include "hw/android/goldfish/pipe.h"
 
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+
 /* Implement the OpenGL fast-pipe */
 
 /* Set to 1 or 2 for debug traces */
@@ -69,6 +73,10 @@ typedef struct {
     int             wakeWanted;
     LoopIo          io[1];
     AsyncConnector  connector[1];
+    /* In-process renderer channel, used by the 'opengles' pipe instead of
+     * a socket when available. In this case, |io| watches the channel's
+     * notification file descriptor. */
+    void*           channel;
 } NetPipe;
 
 static void
@@ -473,6 +481,173 @@ static const GoldfishPipeFuncs  netPipeUnix_funcs = {
 };
 #endif
 
+/**********************************************************************
+ **********************************************************************
+ *****
+ *****  O P E N G L E S   C H A N N E L S
+ *****
+ *****/
+
+/* When the renderer supports it, the 'opengles' pipe exchanges data with
+ * its render thread through an in-process channel instead of a socket.
+ * This avoids two copies through the kernel and a system call per transfer.
+ * The channel never blocks; it signals a file descriptor, watched by |io|,
+ * when an event requested with android_gles_channel_poll() happens.
+ */
+
+#ifndef _WIN32
+static void
+channelPipe_free( NetPipe*  pipe )
+{
+    loopIo_done(pipe->io);
+    android_gles_channel_close(pipe->channel);
+    AFREE(pipe);
+}
+
+/* Ask the channel to signal the events the guest waits for. The close of
+ * the channel is only watched for once the guest has read everything the
+ * render thread sent before exiting. */
+static void
+channelPipe_resetState( NetPipe*  pipe )
+{
+    unsigned  wanted = 0;
+
+    if ((pipe->wakeWanted & PIPE_WAKE_READ) != 0)
+        wanted |= ANDROID_GLES_CHANNEL_CAN_READ;
+    if ((pipe->wakeWanted & PIPE_WAKE_WRITE) != 0)
+        wanted |= ANDROID_GLES_CHANNEL_CAN_WRITE;
+    if (pipe->state == STATE_CONNECTED) {
+        unsigned  state = android_gles_channel_poll(pipe->channel, 0);
+        if ((state & ANDROID_GLES_CHANNEL_CLOSED) == 0 ||
+            (state & ANDROID_GLES_CHANNEL_CAN_READ) == 0)
+            wanted |= ANDROID_GLES_CHANNEL_CLOSED;
+    }
+
+    if (wanted != 0)
+        android_gles_channel_poll(pipe->channel, wanted);
+}
+
+static void
+channelPipe_io_func( void* opaque, int fd, unsigned events )
+{
+    NetPipe*  pipe = opaque;
+    uint64_t  value;
+    unsigned  state;
+    int       wakeFlags = 0;
+
+    (void)events;
+
+    /* Drain the notification, then look at what changed */
+    while (read(fd, &value, sizeof(value)) > 0) {
+    }
+
+    state = android_gles_channel_poll(pipe->channel, 0);
+
+    if ((state & ANDROID_GLES_CHANNEL_CLOSED) != 0 &&
+        (state & ANDROID_GLES_CHANNEL_CAN_READ) == 0 &&
+        pipe->state == STATE_CONNECTED) {
+        /* The render thread exited, and the guest has read all its
+         * replies: tell the guest, like netPipe_closeFromSocket() does. */
+        if (pipe->hwpipe != NULL) {
+            goldfish_pipe_close(pipe->hwpipe);
+            pipe->hwpipe = NULL;
+        }
+        pipe->state = STATE_CLOSING_SOCKET;
+        loopIo_dontWantRead(pipe->io);
+        return;
+    }
+
+    if ((state & ANDROID_GLES_CHANNEL_CAN_READ) != 0 &&
+        (pipe->wakeWanted & PIPE_WAKE_READ) != 0) {
+        wakeFlags |= PIPE_WAKE_READ;
+    }
+    if ((state & ANDROID_GLES_CHANNEL_CAN_WRITE) != 0 &&
+        (pipe->wakeWanted & PIPE_WAKE_WRITE) != 0) {
+        wakeFlags |= PIPE_WAKE_WRITE;
+    }
+
+    if (wakeFlags != 0) {
+        goldfish_pipe_wake(pipe->hwpipe, wakeFlags);
+        pipe->wakeWanted &= ~wakeFlags;
+    }
+
+    channelPipe_resetState(pipe);
+}
+
+/* Try to create a pipe backed by a renderer channel. Return NULL if the
+ * renderer doesn't support channels. */
+static NetPipe*
+channelPipe_init( void* hwpipe, Looper* looper )
+{
+    NetPipe*  pipe;
+    void*     channel = android_gles_channel_open();
+
+    if (channel == NULL)
+        return NULL;
+
+    ANEW0(pipe);
+    pipe->hwpipe  = hwpipe;
+    pipe->channel = channel;
+    pipe->state   = STATE_CONNECTED;
+    loopIo_init(pipe->io, looper, android_gles_channel_notify_fd(channel),
+                channelPipe_io_func, pipe);
+    loopIo_wantRead(pipe->io);
+    channelPipe_resetState(pipe);
+    return pipe;
+}
+
+static int
+channelPipe_sendBuffers( NetPipe* pipe, const GoldfishPipeBuffer* buffers, int numBuffers )
+{
+    int  ret;
+
+    if (pipe->state != STATE_CONNECTED)
+        return (pipe->hwpipe == NULL) ? PIPE_ERROR_INVAL : PIPE_ERROR_IO;
+
+    ret = android_gles_channel_send(pipe->channel,
+                                    (const AndroidGlesBuffer*)buffers,
+                                    numBuffers);
+    if (ret == 0)
+        return PIPE_ERROR_AGAIN;
+    if (ret < 0)
+        return PIPE_ERROR_IO;
+    return ret;
+}
+
+static int
+channelPipe_recvBuffers( NetPipe* pipe, GoldfishPipeBuffer* buffers, int numBuffers )
+{
+    int  ret = android_gles_channel_recv(pipe->channel,
+                                         (AndroidGlesBuffer*)buffers,
+                                         numBuffers);
+    if (ret == 0)
+        return PIPE_ERROR_AGAIN;
+    if (ret < 0)
+        return PIPE_ERROR_IO;
+    /* If the render thread has exited, this may have been the last of
+     * its data, after which the close must be reported. */
+    if (pipe->state == STATE_CONNECTED)
+        channelPipe_resetState(pipe);
+    return ret;
+}
+
+static unsigned
+channelPipe_poll( NetPipe* pipe )
+{
+    unsigned  state = android_gles_channel_poll(pipe->channel, 0);
+    unsigned  ret   = 0;
+
+    if (state & ANDROID_GLES_CHANNEL_CAN_READ)
+        ret |= PIPE_POLL_IN;
+    if (state & ANDROID_GLES_CHANNEL_CAN_WRITE)
+        ret |= PIPE_POLL_OUT;
+    if (state & ANDROID_GLES_CHANNEL_CLOSED)
+        ret |= PIPE_POLL_HUP;
+
+    return ret;
+}
+#endif /* !_WIN32 */
+
 /* This is set to 1 in android_init_opengles() below, and tested
  * by openglesPipe_init() to refuse a pipe connection if the function
  * was never called.
@@ -491,6 +666,16 @@ openglesPipe_init( void* hwpipe, void* _looper, const char* args )
         return NULL;
     }
 
+#ifndef _WIN32
+    if (android_gles_fast_pipes) {
+        pipe = channelPipe_init(hwpipe, _looper);
+        if (pipe != NULL) {
+            D("Creating in-process OpenGLES pipe for GPU emulation!");
+            return pipe;
+        }
+    }
+#endif
+
     char server_addr[PATH_MAX];
     android_gles_server_path(server_addr, sizeof(server_addr));
 #ifndef _WIN32
@@ -526,13 +711,76 @@ openglesPipe_init( void* hwpipe, void* _looper, const char* args )
     return pipe;
 }
 
+/* The functions below dispatch to the channel or the socket implementation,
+ * depending on how openglesPipe_init() created the pipe. */
+
+static void
+openglesPipe_closeFromGuest( void* opaque )
+{
+#ifndef _WIN32
+    NetPipe*  pipe = opaque;
+    if (pipe->channel != NULL) {
+        channelPipe_free(pipe);
+        return;
+    }
+#endif
+    netPipe_closeFromGuest(opaque);
+}
+
+static int
+openglesPipe_sendBuffers( void* opaque, const GoldfishPipeBuffer* buffers, int numBuffers )
+{
+#ifndef _WIN32
+    NetPipe*  pipe = opaque;
+    if (pipe->channel != NULL)
+        return channelPipe_sendBuffers(pipe, buffers, numBuffers);
+#endif
+    return netPipe_sendBuffers(opaque, buffers, numBuffers);
+}
+
+static int
+openglesPipe_recvBuffers( void* opaque, GoldfishPipeBuffer* buffers, int numBuffers )
+{
+#ifndef _WIN32
+    NetPipe*  pipe = opaque;
+    if (pipe->channel != NULL)
+        return channelPipe_recvBuffers(pipe, buffers, numBuffers);
+#endif
+    return netPipe_recvBuffers(opaque, buffers, numBuffers);
+}
+
+static unsigned
+openglesPipe_poll( void* opaque )
+{
+#ifndef _WIN32
+    NetPipe*  pipe = opaque;
+    if (pipe->channel != NULL)
+        return channelPipe_poll(pipe);
+#endif
+    return netPipe_poll(opaque);
+}
+
+static void
+openglesPipe_wakeOn( void* opaque, int flags )
+{
+#ifndef _WIN32
+    NetPipe*  pipe = opaque;
+    if (pipe->channel != NULL) {
+        pipe->wakeWanted |= flags;
+        channelPipe_resetState(pipe);
+        return;
+    }
+#endif
+    netPipe_wakeOn(opaque, flags);
+}
+
 static const GoldfishPipeFuncs  openglesPipe_funcs = {
     openglesPipe_init,
-    netPipe_closeFromGuest,
-    netPipe_sendBuffers,
-    netPipe_recvBuffers,
-    netPipe_poll,
-    netPipe_wakeOn,
+    openglesPipe_closeFromGuest,
+    openglesPipe_sendBuffers,
+    openglesPipe_recvBuffers,
+    openglesPipe_poll,
+    openglesPipe_wakeOn,
     NULL,  /* we can't save these */
     NULL,  /* we can't load these */
 };
@@ -10,6 +10,7 @@
 ** GNU General Public License for more details.
 */
 #include "android/hw-qemud.h"
+#include "android/qemud-buffer.h"
 #include "android/utils/debug.h"
 #include "android/utils/misc.h"
 #include "android/utils/system.h"
@@ -20,6 +21,7 @@
 #include "sysemu/char.h"
 #include "android/charpipe.h"
 #include "android/cbuffer.h"
+#include "qemu/iov.h"
 #include "utils/panic.h"
 
 #define  D(...)    VERBOSE_PRINT(qemud,__VA_ARGS__)
@@ -202,6 +204,9 @@ qemud_sink_needed( QemudSink*  ss )
 #define  CHANNEL_OFFSET 0
 #define  CHANNEL_SIZE   2
 
+/* number of distinct channel ids that can be encoded in a header */
+#define  MAX_CHANNELS   (1 << (4*CHANNEL_SIZE))
+
 #if SUPPORT_LEGACY_QEMUD
 typedef enum {
     QEMUD_VERSION_UNKNOWN,
@@ -214,7 +219,7 @@ typedef enum {
 #endif
 
 /* length of the framed header */
-#define  FRAME_HEADER_SIZE  4
+#define  FRAME_HEADER_SIZE  QEMUD_FRAME_HEADER_SIZE
 
 #define  BUFFER_SIZE    MAX_SERIAL_PAYLOAD
 
@@ -512,6 +517,28 @@ qemud_serial_init( QemudSerial*        s,
                            s );
 }
 
+/* write the header of a 'len'-byte packet for 'channel' to the serial port */
+static void
+qemud_serial_write_header( QemudSerial*  s, int  channel, int  len )
+{
+    uint8_t   header[HEADER_SIZE];
+
+#if SUPPORT_LEGACY_QEMUD
+    if (s->version == QEMUD_VERSION_LEGACY) {
+        int2hex(header + LEGACY_LENGTH_OFFSET,  LENGTH_SIZE,  len);
+        int2hex(header + LEGACY_CHANNEL_OFFSET, CHANNEL_SIZE, channel);
+    } else {
+        int2hex(header + LENGTH_OFFSET,  LENGTH_SIZE,  len);
+        int2hex(header + CHANNEL_OFFSET, CHANNEL_SIZE, channel);
+    }
+#else
+    int2hex(header + LENGTH_OFFSET,  LENGTH_SIZE,  len);
+    int2hex(header + CHANNEL_OFFSET, CHANNEL_SIZE, channel);
+#endif
+    T("%s: '%.*s'", __FUNCTION__, HEADER_SIZE, header);
+    qemu_chr_write(s->cs, header, HEADER_SIZE);
+}
+
 /* send a message to the serial port. This will add the necessary
  * header.
  */
@@ -522,7 +549,6 @@ qemud_serial_send( QemudSerial*    s,
                    const uint8_t*  msg,
                    int             msglen )
 {
-    uint8_t   header[HEADER_SIZE];
     uint8_t   frame[FRAME_HEADER_SIZE];
     int       avail, len = msglen;
 
@@ -545,20 +571,7 @@ qemud_serial_send( QemudSerial*    s,
             avail = MAX_SERIAL_PAYLOAD;
 
         /* write this packet's header */
-#if SUPPORT_LEGACY_QEMUD
-        if (s->version == QEMUD_VERSION_LEGACY) {
-            int2hex(header + LEGACY_LENGTH_OFFSET,  LENGTH_SIZE,  avail);
-            int2hex(header + LEGACY_CHANNEL_OFFSET, CHANNEL_SIZE, channel);
-        } else {
-            int2hex(header + LENGTH_OFFSET,  LENGTH_SIZE,  avail);
-            int2hex(header + CHANNEL_OFFSET, CHANNEL_SIZE, channel);
-        }
-#else
-        int2hex(header + LENGTH_OFFSET,  LENGTH_SIZE,  avail);
-        int2hex(header + CHANNEL_OFFSET, CHANNEL_SIZE, channel);
-#endif
-        T("%s: '%.*s'", __FUNCTION__, HEADER_SIZE, header);
-        qemu_chr_write(s->cs, header, HEADER_SIZE);
+        qemud_serial_write_header(s, channel, avail);
 
         /* insert frame header when needed */
         if (framing) {
@@ -578,31 +591,49 @@ qemud_serial_send( QemudSerial*    s,
     }
 }
 
-/** CLIENTS
- **/
+/* called by the charpipe once it is done with a message of a QemudBuffer */
+static void
+qemud_serial_release_buffer( void*  opaque, uint8_t*  msg )
+{
+    qemud_buffer_unref((QemudBuffer*)opaque);
+}
 
-/* Descriptor for a data buffer pending to be sent to a qemud pipe client.
- *
- * When a service decides to send data to the client, there could be cases when
- * client is not ready to read them. In this case there is no GoldfishPipeBuffer
- * available to write service's data to, So, we need to cache that data into the
- * client descriptor, and "send" them over to the client in _qemudPipe_recvBuffers
- * callback. Pending service data is stored in the client descriptor as a list
- * of QemudPipeMessage instances.
- */
-typedef struct QemudPipeMessage QemudPipeMessage;
-struct QemudPipeMessage {
-    /* Message to send. */
-    uint8_t*            message;
-    /* Message size. */
-    size_t              size;
-    /* Offset in the message buffer of the chunk, that has not been sent
-     * to the pipe yet. */
-    size_t              offset;
-    /* Links next message in the client. */
-    QemudPipeMessage*   next;
-};
+/* send 'msglen' bytes at 'msg' in 'buf' to the serial port, like
+ * qemud_serial_send() without framing. The payload isn't copied: each
+ * packet hands a reference to 'buf' over to the serial charpipe.
+ */
+static void
+qemud_serial_send_buffer( QemudSerial*  s,
+                          int           channel,
+                          QemudBuffer*  buf,
+                          uint8_t*      msg,
+                          int           msglen )
+{
+    if (msglen <= 0 || channel < 0)
+        return;
+
+    D("%s: channel=%2d len=%3d '%s'",
+      __FUNCTION__, channel, msglen,
+      quote_bytes((const void*)msg, msglen));
+
+    while (msglen > 0) {
+        int  avail = msglen;
+        if (avail > MAX_SERIAL_PAYLOAD)
+            avail = MAX_SERIAL_PAYLOAD;
 
+        qemud_serial_write_header(s, channel, avail);
+
+        T("%s: '%.*s'", __FUNCTION__, avail, msg);
+        qemud_buffer_ref(buf);
+        charpipe_send_buffer(s->cs, msg, avail,
+                             qemud_serial_release_buffer, buf);
+        msg    += avail;
+        msglen -= avail;
+    }
+}
+
+/** CLIENTS
+ **/
 
 /* A QemudClient models a single client as seen by the emulator.
  * Each client has its own channel id (for the serial qemud), or pipe descriptor
@@ -653,8 +684,11 @@ struct QemudClient {
     QemudClientLoad   clie_load;
     QemudService*     service;
     QemudClient*      next_serv; /* next in same service */
+    QemudClient**     pref_serv;
     QemudClient*      next;
     QemudClient**     pref;
+    /* slot in the multiplexer's channel index, serial clients only */
+    QemudClient**     pchannel;
 
     /* framing support */
     int               framing;
@@ -675,6 +709,9 @@ struct QemudClient {
         struct {
             QemudPipe*          qemud_pipe;
             QemudPipeMessage*   messages;
+            /* Points to the 'next' field of the last message, or to
+             * 'messages' when the list is empty. */
+            QemudPipeMessage**  messages_tail;
         } Pipe;
     } ProtocolSelector;
 };
@@ -688,7 +725,7 @@ _is_pipe_client(QemudClient* client)
 static void  qemud_service_remove_client( QemudService*  service,
                                           QemudClient*   client );
 
-/* remove a QemudClient from global list */
+/* remove a QemudClient from global list, and from the channel index */
 static void
 qemud_client_remove( QemudClient*  c )
 {
@@ -698,6 +735,14 @@ qemud_client_remove( QemudClient*  c )
 
     c->next = NULL;
     c->pref = &c->next;
+
+    /* the slot may have been taken over by a newer client on the
+     * same channel id */
+    if (c->pchannel != NULL) {
+        if (*c->pchannel == c)
+            *c->pchannel = NULL;
+        c->pchannel = NULL;
+    }
 }
 
 /* add a QemudClient to global list */
@@ -800,6 +845,11 @@ qemud_client_recv( void*  opaque, uint8_t*  msg, int  msglen )
 static void
 _qemud_pipe_send(QemudClient*  client, const uint8_t*  msg, int  msglen);
 
+/* Frees all messages pending for a pipe-based client.
+ */
+static void
+_qemud_pipe_free_messages(QemudClient*  client);
+
 /* Frees memory allocated for the qemud client.
  */
 static void
@@ -808,12 +858,7 @@ _qemud_client_free(QemudClient* c)
     if ( c != NULL) {
         if (_is_pipe_client(c)) {
             /* Free outstanding messages. */
-            QemudPipeMessage** msg_list = &c->ProtocolSelector.Pipe.messages;
-            while (*msg_list != NULL) {
-                QemudPipeMessage* to_free = *msg_list;
-                *msg_list = to_free->next;
-                free(to_free);
-            }
+            _qemud_pipe_free_messages(c);
         }
         if (c->param != NULL) {
             free(c->param);
@@ -901,7 +946,8 @@ qemud_client_alloc( int               channel_id,
                     QemudClientSave   clie_save,
                     QemudClientLoad   clie_load,
                     QemudSerial*      serial,
-                    QemudClient**     pclients )
+                    QemudClient**     pclients,
+                    QemudClient**     pchannels )
 {
     QemudClient*  c;
 
@@ -911,12 +957,18 @@ qemud_client_alloc( int               channel_id,
         /* Allocating a pipe client. */
         c->protocol = QEMUD_PROTOCOL_PIPE;
         c->ProtocolSelector.Pipe.messages   = NULL;
+        c->ProtocolSelector.Pipe.messages_tail =
+                &c->ProtocolSelector.Pipe.messages;
         c->ProtocolSelector.Pipe.qemud_pipe = NULL;
     } else {
         /* Allocating a serial client. */
         c->protocol = QEMUD_PROTOCOL_SERIAL;
         c->ProtocolSelector.Serial.serial   = serial;
         c->ProtocolSelector.Serial.channel  = channel_id;
+        if (channel_id < MAX_CHANNELS) {
+            c->pchannel  = &pchannels[channel_id];
+            *c->pchannel = c;
+        }
     }
     c->param       = client_param ? ASTRDUP(client_param) : NULL;
     c->clie_opaque = clie_opaque;
@@ -926,6 +978,7 @@ qemud_client_alloc( int               channel_id,
     c->clie_load   = clie_load;
     c->service     = NULL;
     c->next_serv   = NULL;
+    c->pref_serv   = NULL;
     c->next        = NULL;
     c->framing     = 0;
     c->need_header = 1;
@@ -937,10 +990,12 @@ qemud_client_alloc( int               channel_id,
 }
 
 /* forward */
+typedef struct QemudMultiplexer  QemudMultiplexer;
+
 static void  qemud_service_save_name( QEMUFile* f, QemudService* s );
 static char* qemud_service_load_name( QEMUFile* f );
-static QemudService* qemud_service_find(  QemudService*  service_list,
-                                          const char*    service_name );
+static QemudService* qemud_service_find(  QemudMultiplexer*  m,
+                                          const char*        service_name );
 static QemudClient*  qemud_service_connect_client(  QemudService  *sv,
                                                     int           channel_id,
                                                     const char* client_param);
@@ -980,14 +1035,14 @@ qemud_serial_client_save(QEMUFile* f, QemudClient* c)
  * loaded along with the pipe to which they were attached.
  */
 static int
-qemud_serial_client_load(QEMUFile* f, QemudService* current_services, int version )
+qemud_serial_client_load(QEMUFile* f, QemudMultiplexer* m, int version )
 {
     char *service_name = qemud_service_load_name(f);
     if (service_name == NULL)
         return -EIO;
     char* param = qemu_get_string(f);
     /* get current service instance */
-    QemudService *sv = qemud_service_find(current_services, service_name);
+    QemudService *sv = qemud_service_find(m, service_name);
     if (sv == NULL) {
         D("%s: load failed: unknown service \"%s\"\n",
           __FUNCTION__, service_name);
@@ -1001,6 +1056,11 @@ qemud_serial_client_load(QEMUFile* f, QemudService* current_services, int versio
           __FUNCTION__);
         return -EIO;
     }
+    if (channel < 0 || channel >= MAX_CHANNELS) {
+        D("%s: illegal snapshot: invalid channel id %d\n",
+          __FUNCTION__, channel);
+        return -EIO;
+    }
 
     /* re-connect client */
     QemudClient* c = qemud_service_connect_client(sv, channel, param);
@@ -1077,8 +1137,24 @@ struct QemudService {
     QemudServiceLoad     serv_load;
     void*                serv_opaque;
     QemudService*        next;
+    /* next in same bucket of the multiplexer's service index */
+    QemudService*        next_hash;
+    unsigned             hash;
 };
 
+/* compute the hash of a service name */
+static unsigned
+qemud_service_hash( const char*  name )
+{
+    /* FNV-1a */
+    unsigned  h = 2166136261U;
+    for ( ; *name; name++) {
+        h ^= (uint8_t)*name;
+        h *= 16777619U;
+    }
+    return h;
+}
+
 /* Create a new QemudService object */
 static QemudService*
 qemud_service_new( const char*          name,
@@ -1096,6 +1172,7 @@ qemud_service_new( const char*          name,
     s->max_clients = max_clients;
     s->num_clients = 0;
     s->clients     = NULL;
+    s->hash        = qemud_service_hash(name);
 
     s->serv_opaque  = serv_opaque;
     s->serv_connect = serv_connect;
@@ -1115,7 +1192,10 @@ qemud_service_add_client( QemudService*  s, QemudClient*  c )
 {
     c->service      = s;
     c->next_serv    = s->clients;
+    c->pref_serv    = &s->clients;
     s->clients      = c;
+    if (c->next_serv)
+        c->next_serv->pref_serv = &c->next_serv;
     s->num_clients += 1;
 }
 
@@ -1123,23 +1203,19 @@ qemud_service_add_client( QemudService*  s, QemudClient*  c )
 static void
 qemud_service_remove_client( QemudService*  s, QemudClient*  c )
 {
-    QemudClient**  pnode = &s->clients;
-    QemudClient*   node;
+    if (c->service != s || c->pref_serv == NULL) {
+        D("%s: could not find client for service '%s'",
+          __FUNCTION__, s->name);
+        return;
+    }
 
     /* remove from clients linked-list */
-    for (;;) {
-        node = *pnode;
-        if (node == NULL) {
-            D("%s: could not find client for service '%s'",
-              __FUNCTION__, s->name);
-            return;
-        }
-        if (node == c)
-            break;
-        pnode = &node->next_serv;
-    }
+    c->pref_serv[0] = c->next_serv;
+    if (c->next_serv)
+        c->next_serv->pref_serv = c->pref_serv;
 
-    *pnode          = node->next_serv;
+    c->next_serv    = NULL;
+    c->pref_serv    = NULL;
     s->num_clients -= 1;
 }
 
@@ -1166,20 +1242,6 @@ qemud_service_connect_client(QemudService *sv,
     return client;
 }
 
-/* find a registered service by name.
- */
-static QemudService*
-qemud_service_find( QemudService*  service_list, const char*  service_name)
-{
-    QemudService*  sv = NULL;
-    for (sv = service_list; sv != NULL; sv = sv->next) {
-        if (!strcmp(sv->name, service_name)) {
-            break;
-        }
-    }
-    return sv;
-}
-
 /* Save the name of the given service.
  */
 static void
@@ -1235,17 +1297,17 @@ qemud_service_save(QEMUFile* f, QemudService* s)
  * of that service to mirror the loaded state. If the service is not running,
  * the load process is aborted.
  *
- * Parameter 'current_services' should be the list of active services.
+ * Parameter 'm' is the multiplexer holding the active services.
  */
 static int
-qemud_service_load(  QEMUFile*  f, QemudService*  current_services  )
+qemud_service_load(  QEMUFile*  f, QemudMultiplexer*  m  )
 {
     char* service_name = qemud_service_load_name(f);
     if (service_name == NULL)
         return -EIO;
 
     /* get current service instance */
-    QemudService *sv = qemud_service_find(current_services, service_name);
+    QemudService *sv = qemud_service_find(m, service_name);
     if (sv == NULL) {
         D("%s: loading failed: service \"%s\" not available\n",
           __FUNCTION__, service_name);
@@ -1281,20 +1343,62 @@ qemud_service_load(  QEMUFile*  f, QemudService*  current_services  )
  * QemudClient.
  *
  * It also has a global list of clients, and a global list of
- * services.
+ * services. Services are indexed by name, and serial clients by
+ * channel id, so that lookups don't need to walk the lists.
  *
  * Finally, the QemudMultiplexer has a special QemudClient used
  * to handle channel 0, i.e. the control channel used to handle
  * connections and disconnections of clients.
  */
-typedef struct QemudMultiplexer  QemudMultiplexer;
+/* number of buckets in the service index, must be a power of 2 */
+#define  SERVICE_HASH_SIZE  64
 
 struct QemudMultiplexer {
     QemudSerial    serial[1];
     QemudClient*   clients;
     QemudService*  services;
+    QemudService*  service_hash[SERVICE_HASH_SIZE];
+    QemudClient*   channels[MAX_CHANNELS];
 };
 
+/* add a newly created service to the multiplexer's index */
+static void
+qemud_multiplexer_add_service( QemudMultiplexer*  m, QemudService*  sv )
+{
+    QemudService**  pbucket = &m->service_hash[sv->hash & (SERVICE_HASH_SIZE-1)];
+
+    /* prepend, so that the latest service registered with a given
+     * name is found first, as with the global list */
+    sv->next_hash = *pbucket;
+    *pbucket      = sv;
+}
+
+/* find a registered service by name.
+ */
+static QemudService*
+qemud_service_find( QemudMultiplexer*  m, const char*  service_name )
+{
+    unsigned       hash = qemud_service_hash(service_name);
+    QemudService*  sv   = m->service_hash[hash & (SERVICE_HASH_SIZE-1)];
+
+    for ( ; sv != NULL; sv = sv->next_hash) {
+        if (sv->hash == hash && !strcmp(sv->name, service_name)) {
+            break;
+        }
+    }
+    return sv;
+}
+
+/* find a serial client by channel id */
+static QemudClient*
+qemud_multiplexer_find_channel( QemudMultiplexer*  m, int  channel )
+{
+    if (channel < 0 || channel >= MAX_CHANNELS)
+        return NULL;
+
+    return m->channels[channel];
+}
+
 /* this is the serial_recv callback that is called
  * whenever an incoming message arrives through the serial port
  */
@@ -1305,17 +1409,15 @@ qemud_multiplexer_serial_recv( void*     opaque,
                                int       msglen )
 {
     QemudMultiplexer*  m = opaque;
-    QemudClient*       c = m->clients;
+    QemudClient*       c = qemud_multiplexer_find_channel(m, channel);
 
     /* dispatch to an existing client if possible
      * note that channel 0 is handled by a special
      * QemudClient that is setup in qemud_multiplexer_init()
      */
-    for ( ; c != NULL; c = c->next ) {
-        if (!_is_pipe_client(c) && c->ProtocolSelector.Serial.channel == channel) {
-            qemud_client_recv(c, msg, msglen);
-            return;
-        }
+    if (c != NULL) {
+        qemud_client_recv(c, msg, msglen);
+        return;
     }
 
     D("%s: ignoring %d bytes for unknown channel %d",
@@ -1333,7 +1435,7 @@ qemud_multiplexer_connect( QemudMultiplexer*  m,
                            int                channel_id )
 {
     /* find the corresponding registered service by name */
-    QemudService*  sv = qemud_service_find(m->services, service_name);
+    QemudService*  sv = qemud_service_find(m, service_name);
     if (sv == NULL) {
         D("%s: no registered '%s' service", __FUNCTION__, service_name);
         return -1;
@@ -1358,20 +1460,18 @@ static void
 qemud_multiplexer_disconnect( QemudMultiplexer*  m,
                               int                channel )
 {
-    QemudClient*  c;
-
     /* find the client by its channel id, then disconnect it */
-    for (c = m->clients; c; c = c->next) {
-        if (!_is_pipe_client(c) && c->ProtocolSelector.Serial.channel == channel) {
-            D("%s: disconnecting client %d",
-              __FUNCTION__, channel);
-            /* note thatt this removes the client from
-             * m->clients automatically.
-             */
-            c->ProtocolSelector.Serial.channel = -1; /* no need to send disconnect:<id> */
-            qemud_client_disconnect(c, 0);
-            return;
-        }
+    QemudClient*  c = qemud_multiplexer_find_channel(m, channel);
+
+    if (c != NULL) {
+        D("%s: disconnecting client %d",
+          __FUNCTION__, channel);
+        /* note thatt this removes the client from
+         * m->clients and m->channels automatically.
+         */
+        c->ProtocolSelector.Serial.channel = -1; /* no need to send disconnect:<id> */
+        qemud_client_disconnect(c, 0);
+        return;
     }
     D("%s: disconnecting unknown channel %d",
       __FUNCTION__, channel);
@@ -1559,7 +1659,8 @@ qemud_multiplexer_init( QemudMultiplexer*  mult,
                        qemud_multiplexer_control_recv,
                        NULL, NULL, NULL,
                        mult->serial,
-                       &mult->clients );
+                       &mult->clients,
+                       mult->channels );
 }
 
 /* the global multiplexer state */
@@ -1597,83 +1698,81 @@ qemud_client_new( QemudService*     service,
                                                clie_save,
                                                clie_load,
                                                m->serial,
-                                               &m->clients );
+                                               &m->clients,
+                                               m->channels );
 
     qemud_service_add_client(service, c);
     return c;
 }
 
-/* Caches a service message into the client's descriptor.
+/* Queues 'size' bytes of 'buf', starting at 'message', to the client's list
+ * of pending messages, and wakes up the guest reader.
  *
  * See comments on QemudPipeMessage structure for more info.
  */
 static void
-_qemud_pipe_cache_buffer(QemudClient* client, const uint8_t*  msg, int  msglen)
-{
-    QemudPipeMessage* buf;
-    QemudPipeMessage** ins_at = &client->ProtocolSelector.Pipe.messages;
-
-    /* Allocate descriptor big enough to contain message as well. */
-    buf = (QemudPipeMessage*)malloc(msglen + sizeof(QemudPipeMessage));
-    if (buf != NULL) {
-        /* Message starts right after the descriptor. */
-        buf->message = (uint8_t*)buf + sizeof(QemudPipeMessage);
-        buf->size = msglen;
-        memcpy(buf->message, msg, msglen);
-        buf->offset = 0;
-        buf->next = NULL;
-        while (*ins_at != NULL) {
-            ins_at = &(*ins_at)->next;
-        }
-        *ins_at = buf;
-        /* Notify the pipe that there is data to read. */
-        goldfish_pipe_wake(client->ProtocolSelector.Pipe.qemud_pipe->hwpipe,
-                           PIPE_WAKE_READ);
-    }
+_qemud_pipe_queue_buffer(QemudClient*  client,
+                         QemudBuffer*  buf,
+                         uint8_t*      message,
+                         size_t        size)
+{
+    QemudPipeMessage* msg = qemud_pipe_message_new(buf, message, size);
+
+    *client->ProtocolSelector.Pipe.messages_tail = msg;
+    client->ProtocolSelector.Pipe.messages_tail = &msg->next;
+
+    /* Notify the pipe that there is data to read. */
+    goldfish_pipe_wake(client->ProtocolSelector.Pipe.qemud_pipe->hwpipe,
+                       PIPE_WAKE_READ);
 }
 
-/* Sends service message to the client.
- */
 static void
-_qemud_pipe_send(QemudClient*  client, const uint8_t*  msg, int  msglen)
+_qemud_pipe_free_messages(QemudClient*  client)
 {
-    uint8_t   frame[FRAME_HEADER_SIZE];
-    int       avail, len = msglen;
-    int framing = client->framing;
+    QemudPipeMessage** msg_list = &client->ProtocolSelector.Pipe.messages;
 
-    if (msglen <= 0)
-        return;
+    while (*msg_list != NULL) {
+        QemudPipeMessage* to_free = *msg_list;
+        *msg_list = to_free->next;
+        qemud_pipe_message_free(to_free);
+    }
+    client->ProtocolSelector.Pipe.messages_tail = msg_list;
+}
 
-    D("%s: len=%3d '%s'",
-      __FUNCTION__, msglen, quote_bytes((const void*)msg, msglen));
+/* Sends an encoded message (see qemud_buffer_encode()) to the client. The
+ * frame header is skipped if the client doesn't use framing.
+ */
+static void
+_qemud_client_send_buffer(QemudClient*  client, QemudBuffer*  buf)
+{
+    uint8_t*  msg    = buf->data;
+    int       msglen = buf->size;
 
-    if (framing) {
-        len += FRAME_HEADER_SIZE;
+    if (!client->framing) {
+        msg    += FRAME_HEADER_SIZE;
+        msglen -= FRAME_HEADER_SIZE;
     }
 
-    /* packetize the payload for the serial MTU */
-    while (len > 0)
-    {
-        avail = len;
-        if (avail > MAX_SERIAL_PAYLOAD)
-            avail = MAX_SERIAL_PAYLOAD;
+    if (_is_pipe_client(client)) {
+        _qemud_pipe_queue_buffer(client, buf, msg, msglen);
+    } else {
+        /* the frame header is already part of the message */
+        qemud_serial_send_buffer(client->ProtocolSelector.Serial.serial,
+                                 client->ProtocolSelector.Serial.channel,
+                                 buf, msg, msglen);
+    }
+}
 
-        /* insert frame header when needed */
-        if (framing) {
-            int2hex(frame, FRAME_HEADER_SIZE, msglen);
-            T("%s: '%.*s'", __FUNCTION__, FRAME_HEADER_SIZE, frame);
-            _qemud_pipe_cache_buffer(client, frame, FRAME_HEADER_SIZE);
-            avail  -= FRAME_HEADER_SIZE;
-            len    -= FRAME_HEADER_SIZE;
-            framing = 0;
-        }
+/* Sends service message to the client.
+ */
+static void
+_qemud_pipe_send(QemudClient*  client, const uint8_t*  msg, int  msglen)
+{
+    struct iovec  iov;
 
-        /* write message content */
-        T("%s: '%.*s'", __FUNCTION__, avail, msg);
-        _qemud_pipe_cache_buffer(client, msg, avail);
-        msg += avail;
-        len -= avail;
-    }
+    iov.iov_base = (void*)msg;
+    iov.iov_len  = msglen;
+    qemud_client_sendv(client, &iov, 1);
 }
 
 /* this can be used by a service implementation to send an answer
@@ -1682,13 +1781,32 @@ _qemud_pipe_send(QemudClient*  client, const uint8_t*  msg, int  msglen)
 void
 qemud_client_send ( QemudClient*  client, const uint8_t*  msg, int  msglen )
 {
-    if (_is_pipe_client(client)) {
-        _qemud_pipe_send(client, msg, msglen);
+    struct iovec  iov;
+
+    iov.iov_base = (void*)msg;
+    iov.iov_len  = msglen;
+    qemud_client_sendv(client, &iov, 1);
+}
+
+void
+qemud_client_sendv( QemudClient*  client, const struct iovec*  iov, int  iovcnt )
+{
+    QemudBuffer*  buf;
+    int           msglen = (int)iov_size(iov, iovcnt);
+
+    if (msglen <= 0)
+        return;
+
+    if (D_ACTIVE && iovcnt == 1) {
+        D("%s: len=%3d '%s'", __FUNCTION__, msglen,
+          quote_bytes((const void*)iov->iov_base, msglen));
     } else {
-        qemud_serial_send(client->ProtocolSelector.Serial.serial,
-                          client->ProtocolSelector.Serial.channel,
-                          client->framing != 0, msg, msglen);
+        D("%s: len=%3d (%d segments)", __FUNCTION__, msglen, iovcnt);
     }
+
+    buf = qemud_buffer_encode(iov, iovcnt, msglen);
+    _qemud_client_send_buffer(client, buf);
+    qemud_buffer_unref(buf);
 }
 
 /* enable framing for this client. When TRUE, this will
@@ -1785,12 +1903,12 @@ qemud_save(QEMUFile* f, void* opaque)
  * snapshot was made.
  */
 static int
-qemud_load_services( QEMUFile*  f, QemudService*  current_services )
+qemud_load_services( QEMUFile*  f, QemudMultiplexer*  m )
 {
     int i, ret;
     int service_count = qemu_get_be32(f);
     for (i = 0; i < service_count; i++) {
-        if ((ret = qemud_service_load(f, current_services)))
+        if ((ret = qemud_service_load(f, m)))
             return ret;
     }
 
@@ -1818,7 +1936,7 @@ qemud_load_clients(QEMUFile* f, QemudMultiplexer* m, int version )
     int client_count = qemu_get_be32(f);
     int i, ret;
     for (i = 0; i < client_count; i++) {
-        if ((ret = qemud_serial_client_load(f, m->services, version))) {
+        if ((ret = qemud_serial_client_load(f, m, version))) {
             return ret;
         }
     }
@@ -1837,7 +1955,7 @@ qemud_load(QEMUFile *f, void* opaque, int version)
 
     if ((ret = qemud_serial_load(f, m->serial)))
         return ret;
-    if ((ret = qemud_load_services(f, m->services)))
+    if ((ret = qemud_load_services(f, m)))
         return ret;
     if ((ret = qemud_load_clients(f, m, version)))
         return ret;
@@ -1872,18 +1990,13 @@ _load_pipe_message(QEMUFile* f)
 
     uint32_t size = qemu_get_be32(f);
     while (size != 0) {
-        QemudPipeMessage* wrk;
-        ANEW0(wrk);
+        QemudBuffer* buf = qemud_buffer_alloc(size);
+        QemudPipeMessage* wrk = qemud_pipe_message_new(buf, buf->data, size);
+        qemud_buffer_unref(buf);
         *next = wrk;
-        wrk->size = size;
         wrk->offset = qemu_get_be32(f);
-        wrk->message = malloc(wrk->size);
-        if (wrk->message == NULL) {
-            APANIC("Unable to allocate buffer for pipe's pending message.");
-        }
         qemu_get_buffer(f, wrk->message, wrk->size);
         next = &wrk->next;
-        *next = NULL;
         size = qemu_get_be32(f);
     }
 
@@ -1899,7 +2012,7 @@ static void*
 _qemudPipe_init(void* hwpipe, void* _looper, const char* args)
 {
     QemudMultiplexer *m = _multiplexer;
-    QemudService* sv = m->services;
+    QemudService* sv;
     QemudClient* client;
     QemudPipe* pipe = NULL;
     char service_name[512];
@@ -1931,9 +2044,7 @@ _qemudPipe_init(void* hwpipe, void* _looper, const char* args)
     service_name[srv_name_len] = '\0';
 
     /* Lookup registered service by its name. */
-    while (sv != NULL && strcmp(sv->name, service_name)) {
-        sv = sv->next;
-    }
+    sv = qemud_service_find(m, service_name);
     if (sv == NULL) {
         D("%s: Service '%s' has not been registered!", __FUNCTION__, service_name);
         return NULL;
@@ -2051,7 +2162,10 @@ _qemudPipe_recvBuffers(void* opaque, GoldfishPipeBuffer* buffers, int numBuffers
         if (msg->size == msg->offset) {
             /* We're done with the current message. Go to the next one. */
             *msg_list = msg->next;
-            free(msg);
+            if (*msg_list == NULL) {
+                client->ProtocolSelector.Pipe.messages_tail = msg_list;
+            }
+            qemud_pipe_message_free(msg);
         }
         if (off_in_buff == buff->size) {
             /* Current pipe buffer is full. Continue with the next one. */
@@ -2135,7 +2249,7 @@ _qemudPipe_load(void* hwpipe, void* pipeOpaque, const char* args, QEMUFile* f)
     if (service_name == NULL)
         return NULL;
     /* get service instance for the loading client*/
-    QemudService *sv = qemud_service_find(_multiplexer->services, service_name);
+    QemudService *sv = qemud_service_find(_multiplexer, service_name);
     if (sv == NULL) {
         D("%s: load failed: unknown service \"%s\"\n",
           __FUNCTION__, service_name);
@@ -2151,7 +2265,12 @@ _qemudPipe_load(void* hwpipe, void* pipeOpaque, const char* args, QEMUFile* f)
         return NULL;
 
     /* Load pending messages. */
+    _qemud_pipe_free_messages(c);
     c->ProtocolSelector.Pipe.messages = _load_pipe_message(f);
+    while (*c->ProtocolSelector.Pipe.messages_tail != NULL) {
+        c->ProtocolSelector.Pipe.messages_tail =
+                &(*c->ProtocolSelector.Pipe.messages_tail)->next;
+    }
 
     /* load client-specific state */
     if (c->clie_load && c->clie_load(f, c, c->clie_opaque)) {
@@ -2321,6 +2440,7 @@ qemud_service_register( const char*          service_name,
                            serv_save,
                            serv_load,
                            &m->services);
+    qemud_multiplexer_add_service(m, sv);
     D("Registered QEMUD service %s", service_name);
     return sv;
 }
@@ -2333,9 +2453,19 @@ qemud_service_broadcast( QemudService*  sv,
                          int             msglen )
 {
     QemudClient*  c;
+    QemudBuffer*  buf;
+    struct iovec  iov;
+
+    if (msglen <= 0 || sv->clients == NULL)
+        return;
 
+    /* encode the message only once for all clients */
+    iov.iov_base = (void*)msg;
+    iov.iov_len  = msglen;
+    buf = qemud_buffer_encode(&iov, 1, msglen);
     for (c = sv->clients; c; c = c->next_serv)
-        qemud_client_send(c, msg, msglen);
+        _qemud_client_send_buffer(c, buf);
+    qemud_buffer_unref(buf);
 }
 
 
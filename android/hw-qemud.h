@@ -106,6 +106,12 @@ extern void           qemud_client_set_framing( QemudClient*  client, int  enabl
  */
 extern void   qemud_client_send ( QemudClient*  client, const uint8_t*  msg, int  msglen );
 
+/* Send a message made of 'iovcnt' segments to a given qemud client. The
+ * segments are sent as a single message, i.e. with a single frame header
+ * when framing is enabled on the client.
+ */
+extern void   qemud_client_sendv( QemudClient*  client, const struct iovec*  iov, int  iovcnt );
+
 /* Force-close the connection to a given qemud client.
  */
 extern void   qemud_client_close( QemudClient*  client );
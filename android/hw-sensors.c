@@ -132,39 +132,82 @@ typedef struct {
  *   a given sensor (e.g. "accelerometer"), and <flag> must be either
  *   "1" (to enable) or "0" (to disable).
  *
- * - Once at least one sensor is "enabled", this code should periodically
- *   send information about the corresponding enabled sensors. The default
- *   period is 200ms.
+ * - Once at least one sensor is "enabled", this code sends information
+ *   about the corresponding enabled sensors, at most once per sensor
+ *   delay, and only when their value changed (unchanged values are
+ *   still refreshed every SENSORS_REFRESH_MS).
  *
  * - the HAL module sends "set-delay:<delay>", where <delay> is an integer
  *   corresponding to a time delay in milli-seconds. This corresponds to
  *   a new interval between sensor events sent by this code to the HAL
- *   module.
+ *   module, for all sensors.
+ *
+ * - the HAL module sends "set-delay:<sensor>:<delay>" to set the delay of
+ *   a single sensor, e.g. "set-delay:acceleration:5" for 200 Hz.
  *
  * - the HAL module can also send a "wake" command. This code should simply
  *   send the "wake" back to the module. This is used internally to wake a
  *   blocking read that happens in a different thread. This ping-pong makes
  *   the code in the HAL module very simple.
  *
- * - each timer tick, this code sends sensor reports in the following
- *   format (each line corresponds to a different line sent to the module):
+ * - each report is made of the following lines (each line corresponds to
+ *   a different message sent to the module):
  *
  *      acceleration:<x>:<y>:<z>
- *      magnetic-field:<x>:<y>:<z>
+ *      magnetic:<x>:<y>:<z>
  *      orientation:<azimuth>:<pitch>:<roll>
  *      temperature:<celsius>
+ *      proximity:<value>
  *      sync:<time_us>
  *
  *   Where each line before the sync:<time_us> is optional and will only
- *   appear if the corresponding sensor has been enabled by the HAL module.
+ *   appear if the corresponding sensor has been enabled by the HAL module,
+ *   and has a new sample to report.
  *
  *   Note that <time_us> is the VM time in micro-seconds when the report
  *   was "taken" by this code. This is adjusted by the HAL module to
  *   emulated system time (using the first sync: to compute an adjustment
  *   offset).
+ *
+ * - newer HAL modules can send "set-format:compact", followed by "wake".
+ *   This code replies with "format:compact" (older emulators ignore the
+ *   command, so the module only gets the "wake" back and keeps using the
+ *   text format). From then on, each report is a single binary message,
+ *   all values being little-endian:
+ *
+ *      uint8    0 (never the first byte of a text message)
+ *      uint8    format version (1)
+ *      uint16   number of samples
+ *      int64    base time in micro-seconds
+ *      then, for each sample:
+ *        uint8    sensor id (see SENSORS_LIST)
+ *        uint8    number of values
+ *        uint32   sample time, relative to the base time, in micro-seconds
+ *        float32  values
+ *
+ * - in compact mode, the HAL module can send "set-batch:<latency>" to let
+ *   this code hold samples for up to <latency> milli-seconds, and send all
+ *   samples taken meanwhile as a single message.
  */
-#define  HEADER_SIZE  4
-#define  BUFFER_SIZE  512
+
+/* Minimum delay between two samples of a sensor, and minimum delay for
+ * the legacy (global) "set-delay:" command.
+ */
+#define  SENSORS_MIN_DELAY_MS         2
+#define  SENSORS_MIN_LEGACY_DELAY_MS  20
+
+/* Interval at which unchanged sensor values are sent again */
+#define  SENSORS_REFRESH_MS  200
+
+/* Maximum size of a compact message */
+#define  COMPACT_MAX_SIZE     4096
+#define  COMPACT_HEADER_SIZE  12
+#define  COMPACT_SAMPLE_SIZE  (6 + 3*4)
+
+typedef enum {
+    SENSORS_FORMAT_TEXT = 0,
+    SENSORS_FORMAT_COMPACT,
+} SensorsFormat;
 
 typedef struct HwSensorClient   HwSensorClient;
 
@@ -175,13 +218,29 @@ typedef struct {
     AndroidSensorsPort* sensors_port;
 } HwSensors;
 
+/* Per-client state of a given sensor */
+typedef struct {
+    int32_t       delay_ms;
+    /* VM time of the last sample sent, valid if 'sent' is set */
+    int64_t       last_ns;
+    SensorValues  last;
+    char          sent;
+} HwSensorClientSensor;
+
 struct HwSensorClient {
-    HwSensorClient*  next;
-    HwSensors*       sensors;
-    QemudClient*     client;
-    QEMUTimer*       timer;
-    uint32_t         enabledMask;
-    int32_t          delay_ms;
+    HwSensorClient*       next;
+    HwSensors*            sensors;
+    QemudClient*          client;
+    QEMUTimer*            timer;
+    uint32_t              enabledMask;
+    HwSensorClientSensor  state[MAX_SENSORS];
+    SensorsFormat         format;
+    int32_t               batch_ms;
+    /* pending compact message, and VM time of its first sample */
+    uint8_t               batch[COMPACT_MAX_SIZE];
+    int                   batch_len;
+    int                   batch_count;
+    int64_t               batch_ns;
 };
 
 static void
@@ -221,19 +280,32 @@ _hwSensorClient_free( HwSensorClient*  cl )
 /* forward */
 static void  _hwSensorClient_tick(void*  opaque);
 
+static void
+_hwSensorClient_setDelay( HwSensorClient*  cl, int  sensorId, int  delay_ms )
+{
+    if (delay_ms < SENSORS_MIN_DELAY_MS)
+        delay_ms = SENSORS_MIN_DELAY_MS;
+
+    cl->state[sensorId].delay_ms = delay_ms;
+}
 
 static HwSensorClient*
 _hwSensorClient_new( HwSensors*  sensors )
 {
     HwSensorClient*  cl;
+    int              nn;
 
     ANEW0(cl);
 
     cl->sensors     = sensors;
     cl->enabledMask = 0;
-    cl->delay_ms    = 800;
+    cl->format      = SENSORS_FORMAT_TEXT;
+    cl->batch_ms    = 0;
     cl->timer       = timer_new(QEMU_CLOCK_VIRTUAL, SCALE_NS, _hwSensorClient_tick, cl);
 
+    for (nn = 0; nn < MAX_SENSORS; nn++)
+        _hwSensorClient_setDelay(cl, nn, 800);
+
     cl->next         = sensors->clients;
     sensors->clients = cl;
 
@@ -281,78 +353,252 @@ _hwSensorClient_enabled( HwSensorClient*  cl, int  sensorId )
     return (cl->enabledMask & (1 << sensorId)) != 0;
 }
 
-/* this function is called periodically to send sensor reports
- * to the HAL module, and re-arm the timer if necessary
- */
+/* Returns the number of meaningful values of a given sensor */
+static int
+_sensorValueCount( AndroidSensor  id )
+{
+    /* this switch ensures that a warning is raised when a new sensor is
+     * added and is not added here as well.
+     */
+    switch (id) {
+    case ANDROID_SENSOR_ACCELERATION:
+    case ANDROID_SENSOR_MAGNETIC_FIELD:
+    case ANDROID_SENSOR_ORIENTATION:
+        return 3;
+    case ANDROID_SENSOR_TEMPERATURE:
+    case ANDROID_SENSOR_PROXIMITY:
+        return 1;
+    case MAX_SENSORS:
+        break;
+    }
+    return 0;
+}
+
+/* send a sensor sample as a text line */
 static void
-_hwSensorClient_tick( void*  opaque )
+_hwSensorClient_sendText( HwSensorClient*  cl, int  sensorId )
 {
-    HwSensorClient*  cl = opaque;
-    HwSensors*       hw  = cl->sensors;
-    int64_t          delay = cl->delay_ms;
-    int64_t          now_ns;
-    uint32_t         mask  = cl->enabledMask;
-    Sensor*          sensor;
-    char             buffer[128];
-
-    if (_hwSensorClient_enabled(cl, ANDROID_SENSOR_ACCELERATION)) {
-        sensor = &hw->sensors[ANDROID_SENSOR_ACCELERATION];
+    Sensor*  sensor = &cl->sensors->sensors[sensorId];
+    char     buffer[128];
+
+    switch (sensorId) {
+    case ANDROID_SENSOR_ACCELERATION:
         snprintf(buffer, sizeof buffer, "acceleration:%g:%g:%g",
                  sensor->u.acceleration.x,
                  sensor->u.acceleration.y,
                  sensor->u.acceleration.z);
-        _hwSensorClient_send(cl, (uint8_t*)buffer, strlen(buffer));
-    }
-
-    if (_hwSensorClient_enabled(cl, ANDROID_SENSOR_MAGNETIC_FIELD)) {
-        sensor = &hw->sensors[ANDROID_SENSOR_MAGNETIC_FIELD];
+        break;
+    case ANDROID_SENSOR_MAGNETIC_FIELD:
         /* NOTE: sensors HAL expects "magnetic", not "magnetic-field" name here. */
         snprintf(buffer, sizeof buffer, "magnetic:%g:%g:%g",
                  sensor->u.magnetic.x,
                  sensor->u.magnetic.y,
                  sensor->u.magnetic.z);
-        _hwSensorClient_send(cl, (uint8_t*)buffer, strlen(buffer));
-    }
-
-    if (_hwSensorClient_enabled(cl, ANDROID_SENSOR_ORIENTATION)) {
-        sensor = &hw->sensors[ANDROID_SENSOR_ORIENTATION];
+        break;
+    case ANDROID_SENSOR_ORIENTATION:
         snprintf(buffer, sizeof buffer, "orientation:%g:%g:%g",
                  sensor->u.orientation.azimuth,
                  sensor->u.orientation.pitch,
                  sensor->u.orientation.roll);
-        _hwSensorClient_send(cl, (uint8_t*)buffer, strlen(buffer));
-    }
-
-    if (_hwSensorClient_enabled(cl, ANDROID_SENSOR_TEMPERATURE)) {
-        sensor = &hw->sensors[ANDROID_SENSOR_TEMPERATURE];
+        break;
+    case ANDROID_SENSOR_TEMPERATURE:
         snprintf(buffer, sizeof buffer, "temperature:%g",
                  sensor->u.temperature.celsius);
-        _hwSensorClient_send(cl, (uint8_t*)buffer, strlen(buffer));
-    }
-
-    if (_hwSensorClient_enabled(cl, ANDROID_SENSOR_PROXIMITY)) {
-        sensor = &hw->sensors[ANDROID_SENSOR_PROXIMITY];
+        break;
+    case ANDROID_SENSOR_PROXIMITY:
         snprintf(buffer, sizeof buffer, "proximity:%g",
                  sensor->u.proximity.value);
-        _hwSensorClient_send(cl, (uint8_t*) buffer, strlen(buffer));
+        break;
+    default:
+        return;
     }
+    _hwSensorClient_send(cl, (uint8_t*)buffer, strlen(buffer));
+}
+
+static void
+_putLe16( uint8_t*  p, uint32_t  v )
+{
+    p[0] = (uint8_t)v;
+    p[1] = (uint8_t)(v >> 8);
+}
 
-    now_ns = qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL);
+static void
+_putLe32( uint8_t*  p, uint32_t  v )
+{
+    p[0] = (uint8_t)v;
+    p[1] = (uint8_t)(v >> 8);
+    p[2] = (uint8_t)(v >> 16);
+    p[3] = (uint8_t)(v >> 24);
+}
 
-    snprintf(buffer, sizeof buffer, "sync:%" PRId64, now_ns/1000);
-    _hwSensorClient_send(cl, (uint8_t*)buffer, strlen(buffer));
+static void
+_putLeFloat( uint8_t*  p, float  f )
+{
+    uint32_t  v;
+    memcpy(&v, &f, sizeof v);
+    _putLe32(p, v);
+}
 
-    /* rearm timer, use a minimum delay of 20 ms, just to
-     * be safe.
-     */
-    if (mask == 0)
+/* send the pending compact message, if any */
+static void
+_hwSensorClient_flushBatch( HwSensorClient*  cl )
+{
+    int64_t  base_us;
+
+    if (cl->batch_count == 0)
+        return;
+
+    base_us = cl->batch_ns / 1000;
+    cl->batch[0] = 0;
+    cl->batch[1] = 1;
+    _putLe16(cl->batch + 2, cl->batch_count);
+    _putLe32(cl->batch + 4, (uint32_t)base_us);
+    _putLe32(cl->batch + 8, (uint32_t)(base_us >> 32));
+
+    T("%s: %d samples, %d bytes", __FUNCTION__, cl->batch_count, cl->batch_len);
+    qemud_client_send(cl->client, cl->batch, cl->batch_len);
+
+    cl->batch_len   = 0;
+    cl->batch_count = 0;
+}
+
+/* append a sensor sample to the pending compact message */
+static void
+_hwSensorClient_addSample( HwSensorClient*  cl, int  sensorId, int64_t  now_ns )
+{
+    Sensor*   sensor = &cl->sensors->sensors[sensorId];
+    int       count  = _sensorValueCount(sensorId);
+    uint8_t*  p;
+    int       nn;
+
+    if (cl->batch_len + COMPACT_SAMPLE_SIZE > COMPACT_MAX_SIZE ||
+        (cl->batch_count > 0 && now_ns - cl->batch_ns >= (1LL << 32) * 1000))
+        _hwSensorClient_flushBatch(cl);
+
+    if (cl->batch_count == 0) {
+        cl->batch_len = COMPACT_HEADER_SIZE;
+        cl->batch_ns  = now_ns;
+    }
+
+    p = cl->batch + cl->batch_len;
+    p[0] = (uint8_t)sensorId;
+    p[1] = (uint8_t)count;
+    _putLe32(p + 2, (uint32_t)((now_ns - cl->batch_ns) / 1000));
+    p += 6;
+    for (nn = 0; nn < count; nn++, p += 4) {
+        float  v = (nn == 0) ? sensor->u.value.a :
+                   (nn == 1) ? sensor->u.value.b : sensor->u.value.c;
+        _putLeFloat(p, v);
+    }
+    cl->batch_len = p - cl->batch;
+    cl->batch_count++;
+}
+
+/* Returns the VM time at which a sensor should be reported next */
+static int64_t
+_hwSensorClient_nextSample( HwSensorClient*  cl, int  sensorId )
+{
+    HwSensorClientSensor*  st    = &cl->state[sensorId];
+    Sensor*                s     = &cl->sensors->sensors[sensorId];
+    int64_t                delay = st->delay_ms;
+
+    if (!st->sent)
+        return 0;
+
+    if (!memcmp(&st->last, &s->u.value, sizeof st->last)) {
+        if (delay < SENSORS_REFRESH_MS)
+            delay = SENSORS_REFRESH_MS;
+    }
+    return st->last_ns + delay * 1000000LL;
+}
+
+/* arm the client timer for the next sample or batch deadline */
+static void
+_hwSensorClient_schedule( HwSensorClient*  cl )
+{
+    int64_t  next = INT64_MAX;
+    int      nn;
+
+    for (nn = 0; nn < MAX_SENSORS; nn++) {
+        if (_hwSensorClient_enabled(cl, nn)) {
+            int64_t  when = _hwSensorClient_nextSample(cl, nn);
+            if (when < next)
+                next = when;
+        }
+    }
+
+    if (cl->batch_count > 0) {
+        int64_t  when = cl->batch_ns + cl->batch_ms * 1000000LL;
+        if (when < next)
+            next = when;
+    }
+
+    if (next == INT64_MAX) {
+        timer_del(cl->timer);
         return;
+    }
+    timer_mod(cl->timer, next);
+}
 
-    if (delay < 20)
-        delay = 20;
+/* this function is called when sensor samples are due, to send them to
+ * the HAL module, and re-arm the timer if necessary
+ */
+static void
+_hwSensorClient_tick( void*  opaque )
+{
+    HwSensorClient*  cl = opaque;
+    HwSensors*       hw = cl->sensors;
+    int64_t          now_ns = qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL);
+    int              count  = 0;
+    int              nn;
+
+    for (nn = 0; nn < MAX_SENSORS; nn++) {
+        HwSensorClientSensor*  st = &cl->state[nn];
 
-    delay *= 1000000LL;  /* convert to nanoseconds */
-    timer_mod(cl->timer, now_ns + delay);
+        if (!_hwSensorClient_enabled(cl, nn) ||
+            _hwSensorClient_nextSample(cl, nn) > now_ns)
+            continue;
+
+        if (cl->format == SENSORS_FORMAT_COMPACT)
+            _hwSensorClient_addSample(cl, nn, now_ns);
+        else
+            _hwSensorClient_sendText(cl, nn);
+
+        st->last    = hw->sensors[nn].u.value;
+        st->last_ns = now_ns;
+        st->sent    = 1;
+        count++;
+    }
+
+    if (cl->format == SENSORS_FORMAT_COMPACT) {
+        if (cl->batch_count > 0 &&
+            now_ns >= cl->batch_ns + cl->batch_ms * 1000000LL)
+            _hwSensorClient_flushBatch(cl);
+    } else if (count > 0) {
+        char  buffer[64];
+        snprintf(buffer, sizeof buffer, "sync:%" PRId64, now_ns/1000);
+        _hwSensorClient_send(cl, (uint8_t*)buffer, strlen(buffer));
+    }
+
+    _hwSensorClient_schedule(cl);
+}
+
+/* set the report format, and send back the one in use */
+static void
+_hwSensorClient_setFormat( HwSensorClient*  cl, const char*  name )
+{
+    const char*  reply;
+
+    _hwSensorClient_flushBatch(cl);
+
+    if (!strcmp(name, "compact"))
+        cl->format = SENSORS_FORMAT_COMPACT;
+    else if (!strcmp(name, "text"))
+        cl->format = SENSORS_FORMAT_TEXT;
+
+    reply = (cl->format == SENSORS_FORMAT_COMPACT) ? "format:compact"
+                                                   : "format:text";
+    _hwSensorClient_send(cl, (const uint8_t*)reply, strlen(reply));
 }
 
 /* handle incoming messages from the HAL module */
@@ -391,13 +637,52 @@ _hwSensorClient_receive( HwSensorClient*  cl, uint8_t*  msg, int  msglen )
     }
 
     /* "set-delay:<delay>" is used to set the delay in milliseconds
-     * between sensor events
+     * between sensor events, and "set-delay:<name>:<delay>" to set
+     * it for a single sensor.
      */
     if (msglen > 10 && !memcmp(msg, "set-delay:", 10)) {
-        cl->delay_ms = atoi((const char*)msg+10);
+        char*  q = strchr((char*)msg + 10, ':');
+        int    nn;
+
+        if (q == NULL) {
+            int  delay = atoi((const char*)msg+10);
+
+            if (delay < SENSORS_MIN_LEGACY_DELAY_MS)
+                delay = SENSORS_MIN_LEGACY_DELAY_MS;
+            for (nn = 0; nn < MAX_SENSORS; nn++)
+                _hwSensorClient_setDelay(cl, nn, delay);
+        } else {
+            int  id;
+
+            *q++ = 0;
+            id = _sensorIdFromName((const char*)msg + 10);
+            if (id < 0 || id >= MAX_SENSORS) {
+                D("%s: ignore unknown sensor name '%s'", __FUNCTION__, msg + 10);
+                return;
+            }
+            _hwSensorClient_setDelay(cl, id, atoi(q));
+        }
+
         if (cl->enabledMask != 0)
-            _hwSensorClient_tick(cl);
+            _hwSensorClient_schedule(cl);
+
+        return;
+    }
 
+    /* "set-format:<format>" selects the report format, see above. */
+    if (msglen > 11 && !memcmp(msg, "set-format:", 11)) {
+        _hwSensorClient_setFormat(cl, (const char*)msg + 11);
+        return;
+    }
+
+    /* "set-batch:<latency>" sets the maximum time samples can be held
+     * before being sent, in compact mode.
+     */
+    if (msglen > 10 && !memcmp(msg, "set-batch:", 10)) {
+        cl->batch_ms = atoi((const char*)msg + 10);
+        if (cl->batch_ms < 0)
+            cl->batch_ms = 0;
+        _hwSensorClient_schedule(cl);
         return;
     }
 
@@ -435,6 +720,8 @@ _hwSensorClient_receive( HwSensorClient*  cl, uint8_t*  msg, int  msglen )
         if (cl->enabledMask != (uint32_t)oldEnabledMask) {
             D("%s: %s %s sensor", __FUNCTION__,
                 (cl->enabledMask & (1 << id))  ? "enabling" : "disabling",  msg);
+            /* report the current value as soon as the sensor is enabled */
+            cl->state[id].sent = 0;
         }
 
         /* If emulating device is connected update sensor state there too. */
@@ -453,14 +740,24 @@ _hwSensorClient_receive( HwSensorClient*  cl, uint8_t*  msg, int  msglen )
     D("%s: ignoring unknown query", __FUNCTION__);
 }
 
+/* Marker written in place of the delay by _hwSensorClient_save(), which
+ * older snapshots can't contain since delays are positive. */
+#define  SENSOR_CLIENT_SAVE_V2  (-2)
+
 /* Saves sensor-specific client data to snapshot */
 static void
 _hwSensorClient_save( QEMUFile*  f, QemudClient*  client, void*  opaque  )
 {
     HwSensorClient* sc = opaque;
+    int             nn;
 
-    qemu_put_be32(f, sc->delay_ms);
+    qemu_put_sbe32(f, SENSOR_CLIENT_SAVE_V2);
     qemu_put_be32(f, sc->enabledMask);
+    qemu_put_be32(f, sc->format);
+    qemu_put_be32(f, sc->batch_ms);
+    qemu_put_be32(f, MAX_SENSORS);
+    for (nn = 0; nn < MAX_SENSORS; nn++)
+        qemu_put_be32(f, sc->state[nn].delay_ms);
     timer_put(f, sc->timer);
 }
 
@@ -469,11 +766,39 @@ static int
 _hwSensorClient_load( QEMUFile*  f, QemudClient*  client, void*  opaque  )
 {
     HwSensorClient* sc = opaque;
-
-    sc->delay_ms = qemu_get_be32(f);
-    sc->enabledMask = qemu_get_be32(f);
+    int32_t         delay = qemu_get_sbe32(f);
+    int             nn;
+
+    if (delay >= 0) {
+        /* snapshot taken before per-sensor delays */
+        sc->enabledMask = qemu_get_be32(f);
+        for (nn = 0; nn < MAX_SENSORS; nn++)
+            _hwSensorClient_setDelay(sc, nn, delay);
+    } else if (delay == SENSOR_CLIENT_SAVE_V2) {
+        int  num_sensors;
+
+        sc->enabledMask = qemu_get_be32(f);
+        sc->format      = (qemu_get_be32(f) == SENSORS_FORMAT_COMPACT) ?
+                          SENSORS_FORMAT_COMPACT : SENSORS_FORMAT_TEXT;
+        sc->batch_ms    = qemu_get_be32(f);
+        num_sensors     = qemu_get_be32(f);
+        for (nn = 0; nn < num_sensors; nn++) {
+            delay = qemu_get_be32(f);
+            if (nn < MAX_SENSORS)
+                _hwSensorClient_setDelay(sc, nn, delay);
+        }
+    } else {
+        D("%s: cannot load: unknown client state version\n", __FUNCTION__);
+        return -EIO;
+    }
     timer_get(f, sc->timer);
 
+    /* samples pending at save time were lost, report all sensors again */
+    sc->batch_len   = 0;
+    sc->batch_count = 0;
+    for (nn = 0; nn < MAX_SENSORS; nn++)
+        sc->state[nn].sent = 0;
+
     return 0;
 }
 
@@ -502,9 +827,17 @@ _hwSensors_setSensorValue( HwSensors*  h, int sensor_id, float a, float b, float
 {
     Sensor* s = &h->sensors[sensor_id];
 
+    HwSensorClient*  cl;
+
     s->u.value.a = a;
     s->u.value.b = b;
     s->u.value.c = c;
+
+    /* let clients report the new value as soon as their rate allows */
+    for (cl = h->clients; cl != NULL; cl = cl->next) {
+        if (_hwSensorClient_enabled(cl, sensor_id))
+            _hwSensorClient_schedule(cl);
+    }
 }
 
 /* Saves available sensors to allow checking availability when loaded.
@@ -618,8 +951,7 @@ _hwSensors_load( QEMUFile*  f, QemudService*  s, void*  opaque)
 static void
 _hwSensors_setProximity( HwSensors*  h, float value )
 {
-    Sensor*  s = &h->sensors[ANDROID_SENSOR_PROXIMITY];
-    s->u.proximity.value = value;
+    _hwSensors_setSensorValue(h, ANDROID_SENSOR_PROXIMITY, value, 0., 0.);
 }
 
 /* change the coarse orientation (landscape/portrait) of the emulated device */
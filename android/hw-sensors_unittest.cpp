@@ -0,0 +1,542 @@
+// Copyright 2015 The Android Open Source Project
+//
+// This software is licensed under the terms of the GNU General Public
+// License version 2, as published by the Free Software Foundation, and
+// may be copied, distributed, and modified under those terms.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+extern "C" {
+#include "qemu-common.h"
+#include "qemu/timer.h"
+#include "migration/qemu-file.h"
+#include "android/globals.h"
+#include "android/hw-qemud.h"
+#include "android/hw-sensors.h"
+#include "android/sensors-port.h"
+}
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+// hw-sensors.c talks to the qemud service, the virtual clock timers and the
+// snapshot files of the emulator core. These fakes record the messages sent
+// to each client, and let the tests advance the virtual clock.
+
+namespace {
+
+struct FakeClient {
+    void* opaque;
+    QemudClientRecv recv;
+    QemudClientClose close;
+    QemudClientSave save;
+    QemudClientLoad load;
+    std::vector<std::string> messages;
+};
+
+QemudServiceConnect sConnect = NULL;
+void* sServiceOpaque = NULL;
+
+int64_t sNowNs = 0;
+std::vector<QEMUTimer*> sTimers;
+
+}  // namespace
+
+struct QEMUFile {
+    std::vector<uint8_t> data;
+    size_t pos;
+};
+
+extern "C" {
+
+QemudService* qemud_service_register(const char* serviceName,
+                                     int max_clients,
+                                     void* serv_opaque,
+                                     QemudServiceConnect serv_connect,
+                                     QemudServiceSave serv_save,
+                                     QemudServiceLoad serv_load) {
+    sConnect = serv_connect;
+    sServiceOpaque = serv_opaque;
+    return reinterpret_cast<QemudService*>(&sConnect);
+}
+
+QemudClient* qemud_client_new(QemudService* service,
+                              int channel_id,
+                              const char* client_param,
+                              void* clie_opaque,
+                              QemudClientRecv clie_recv,
+                              QemudClientClose clie_close,
+                              QemudClientSave clie_save,
+                              QemudClientLoad clie_load) {
+    FakeClient* client = new FakeClient();
+    client->opaque = clie_opaque;
+    client->recv = clie_recv;
+    client->close = clie_close;
+    client->save = clie_save;
+    client->load = clie_load;
+    return reinterpret_cast<QemudClient*>(client);
+}
+
+void qemud_client_set_framing(QemudClient* client, int enabled) {}
+
+void qemud_client_send(QemudClient* client, const uint8_t* msg, int msglen) {
+    reinterpret_cast<FakeClient*>(client)->messages.push_back(
+            std::string(reinterpret_cast<const char*>(msg), msglen));
+}
+
+void qemud_client_close(QemudClient* client) {}
+
+AndroidSensorsPort* sensors_port_create(void* opaque) {
+    return NULL;
+}
+
+int sensors_port_enable_sensor(AndroidSensorsPort* asp, const char* name) {
+    return 0;
+}
+
+int sensors_port_disable_sensor(AndroidSensorsPort* asp, const char* name) {
+    return 0;
+}
+
+QEMUTimerListGroup main_loop_tlg;
+
+int64_t qemu_clock_get_ns(QEMUClockType type) {
+    return sNowNs;
+}
+
+void timer_init(QEMUTimer* ts,
+                QEMUTimerList* timer_list,
+                int scale,
+                QEMUTimerCB* cb,
+                void* opaque) {
+    ts->expire_time = -1;
+    ts->timer_list = timer_list;
+    ts->cb = cb;
+    ts->opaque = opaque;
+    ts->scale = scale;
+    sTimers.push_back(ts);
+}
+
+void timer_mod(QEMUTimer* ts, int64_t expire_time) {
+    ts->expire_time = expire_time * ts->scale;
+}
+
+void timer_del(QEMUTimer* ts) {
+    ts->expire_time = -1;
+}
+
+void timer_free(QEMUTimer* ts) {
+    sTimers.erase(std::find(sTimers.begin(), sTimers.end(), ts));
+    g_free(ts);
+}
+
+void qemu_put_be32(QEMUFile* f, unsigned int v) {
+    for (int shift = 24; shift >= 0; shift -= 8) {
+        f->data.push_back(static_cast<uint8_t>(v >> shift));
+    }
+}
+
+unsigned int qemu_get_be32(QEMUFile* f) {
+    unsigned int v = 0;
+    for (int n = 0; n < 4; ++n) {
+        v = (v << 8) | (f->pos < f->data.size() ? f->data[f->pos++] : 0);
+    }
+    return v;
+}
+
+void qemu_put_float(QEMUFile* f, float v) {
+    uint32_t bits;
+    memcpy(&bits, &v, sizeof(bits));
+    qemu_put_be32(f, bits);
+}
+
+float qemu_get_float(QEMUFile* f) {
+    uint32_t bits = qemu_get_be32(f);
+    float v;
+    memcpy(&v, &bits, sizeof(v));
+    return v;
+}
+
+// Like the real ones, these save the expiration time, or -1.
+void timer_put(QEMUFile* f, QEMUTimer* ts) {
+    uint64_t expire_time = static_cast<uint64_t>(ts->expire_time);
+    qemu_put_be32(f, static_cast<uint32_t>(expire_time >> 32));
+    qemu_put_be32(f, static_cast<uint32_t>(expire_time));
+}
+
+void timer_get(QEMUFile* f, QEMUTimer* ts) {
+    uint64_t expire_time = static_cast<uint64_t>(qemu_get_be32(f)) << 32;
+    expire_time |= qemu_get_be32(f);
+    ts->expire_time = static_cast<int64_t>(expire_time);
+}
+
+}  // extern "C"
+
+namespace {
+
+const int64_t kMs = 1000000LL;
+
+// Virtual time at the start of each test.
+const int64_t kStartNs = 1000 * kMs;
+
+// Run the timers that expire up to |ns|, in order, and leave the virtual
+// clock at |ns|.
+void runUntil(int64_t ns) {
+    for (;;) {
+        QEMUTimer* next = NULL;
+        for (size_t n = 0; n < sTimers.size(); ++n) {
+            QEMUTimer* ts = sTimers[n];
+            if (ts->expire_time >= 0 && ts->expire_time <= ns &&
+                (!next || ts->expire_time < next->expire_time)) {
+                next = ts;
+            }
+        }
+        if (!next) {
+            break;
+        }
+        sNowNs = std::max(sNowNs, next->expire_time);
+        next->expire_time = -1;
+        next->cb(next->opaque);
+    }
+    sNowNs = ns;
+}
+
+// A sample decoded from a compact report.
+struct Sample {
+    int id;
+    int64_t timeUs;
+    std::vector<float> values;
+};
+
+uint32_t getLe32(const std::string& msg, size_t pos) {
+    const uint8_t* p = reinterpret_cast<const uint8_t*>(msg.data()) + pos;
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+// Decode a compact report into |samples|, with absolute times. Return false
+// if it is malformed.
+bool decodeCompact(const std::string& msg, std::vector<Sample>* samples) {
+    if (msg.size() < 12 || msg[0] != 0 || msg[1] != 1) {
+        return false;
+    }
+    const uint8_t* p = reinterpret_cast<const uint8_t*>(msg.data());
+    int count = p[2] | (p[3] << 8);
+    int64_t baseUs = getLe32(msg, 4) | ((int64_t)getLe32(msg, 8) << 32);
+    size_t pos = 12;
+    for (int n = 0; n < count; ++n) {
+        if (pos + 6 > msg.size()) {
+            return false;
+        }
+        Sample sample;
+        sample.id = p[pos];
+        int numValues = p[pos + 1];
+        sample.timeUs = baseUs + getLe32(msg, pos + 2);
+        pos += 6;
+        if (pos + 4 * numValues > msg.size()) {
+            return false;
+        }
+        for (int v = 0; v < numValues; ++v, pos += 4) {
+            uint32_t bits = getLe32(msg, pos);
+            float value;
+            memcpy(&value, &bits, sizeof(value));
+            sample.values.push_back(value);
+        }
+        samples->push_back(sample);
+    }
+    return pos == msg.size();
+}
+
+class HwSensorsTest : public ::testing::Test {
+protected:
+    virtual void SetUp() {
+        static bool sInitialized = false;
+        if (!sInitialized) {
+            android_hw->hw_accelerometer = 1;
+            android_hw->hw_sensors_magnetic_field = 1;
+            android_hw->hw_sensors_temperature = 1;
+            android_hw_sensors_init();
+            sInitialized = true;
+        }
+        ASSERT_TRUE(sConnect != NULL);
+        sNowNs = kStartNs;
+        android_sensors_set(ANDROID_SENSOR_ACCELERATION, 0, 0, 0);
+        android_sensors_set(ANDROID_SENSOR_MAGNETIC_FIELD, 0, 0, 0);
+        android_sensors_set(ANDROID_SENSOR_TEMPERATURE, 20, 0, 0);
+        mClient = connect();
+    }
+
+    virtual void TearDown() {
+        disconnect(mClient);
+    }
+
+    FakeClient* connect() {
+        return reinterpret_cast<FakeClient*>(
+                sConnect(sServiceOpaque, NULL, 1, NULL));
+    }
+
+    void disconnect(FakeClient* client) {
+        client->close(client->opaque);
+        delete client;
+    }
+
+    void send(FakeClient* client, const char* command) {
+        std::string msg(command);
+        client->recv(client->opaque,
+                     reinterpret_cast<uint8_t*>(&msg[0]),
+                     msg.size(),
+                     reinterpret_cast<QemudClient*>(client));
+    }
+
+    void send(const char* command) {
+        send(mClient, command);
+    }
+
+    // Return the number of text messages that start with |prefix|.
+    int countMessages(const char* prefix) const {
+        int count = 0;
+        for (size_t n = 0; n < mClient->messages.size(); ++n) {
+            if (!mClient->messages[n].compare(0, strlen(prefix), prefix)) {
+                count++;
+            }
+        }
+        return count;
+    }
+
+    FakeClient* mClient;
+};
+
+}  // namespace
+
+TEST_F(HwSensorsTest, ListsSensorsAndEchoesWake) {
+    send("list-sensors");
+    send("wake");
+    ASSERT_EQ(2U, mClient->messages.size());
+    const int mask = (1 << ANDROID_SENSOR_ACCELERATION) |
+                     (1 << ANDROID_SENSOR_MAGNETIC_FIELD) |
+                     (1 << ANDROID_SENSOR_TEMPERATURE);
+    char expected[16];
+    snprintf(expected, sizeof(expected), "%d", mask);
+    EXPECT_EQ(expected, mClient->messages[0]);
+    EXPECT_EQ("wake", mClient->messages[1]);
+}
+
+TEST_F(HwSensorsTest, ReportsSensorAsSoonAsEnabled) {
+    android_sensors_set(ANDROID_SENSOR_ACCELERATION, 1, 2.5, -3);
+    send("set:acceleration:1");
+    ASSERT_EQ(2U, mClient->messages.size());
+    EXPECT_EQ("acceleration:1:2.5:-3", mClient->messages[0]);
+    EXPECT_EQ("sync:1000000", mClient->messages[1]);
+}
+
+TEST_F(HwSensorsTest, SensorsHaveTheirOwnRates) {
+    send("set-delay:acceleration:5");
+    send("set-delay:magnetic-field:100");
+    send("set:acceleration:1");
+    send("set:magnetic-field:1");
+    // Values change every millisecond, for 200 ms.
+    for (int ms = 1; ms <= 200; ++ms) {
+        android_sensors_set(ANDROID_SENSOR_ACCELERATION, ms, 0, 0);
+        android_sensors_set(ANDROID_SENSOR_MAGNETIC_FIELD, 0, ms, 0);
+        runUntil(kStartNs + ms * kMs);
+    }
+    EXPECT_EQ(41, countMessages("acceleration:"));
+    EXPECT_EQ(3, countMessages("magnetic:"));
+    // Enabling each sensor sends a report of its own.
+    EXPECT_EQ(42, countMessages("sync:"));
+    EXPECT_EQ("acceleration:200:0:0", mClient->messages.end()[-3]);
+    EXPECT_EQ("magnetic:0:200:0", mClient->messages.end()[-2]);
+}
+
+TEST_F(HwSensorsTest, LegacyDelayAppliesToAllSensorsWithItsMinimum) {
+    send("set-delay:5");
+    send("set:acceleration:1");
+    send("set:magnetic-field:1");
+    for (int ms = 1; ms <= 200; ++ms) {
+        android_sensors_set(ANDROID_SENSOR_ACCELERATION, ms, 0, 0);
+        android_sensors_set(ANDROID_SENSOR_MAGNETIC_FIELD, 0, ms, 0);
+        runUntil(kStartNs + ms * kMs);
+    }
+    EXPECT_EQ(11, countMessages("acceleration:"));
+    EXPECT_EQ(11, countMessages("magnetic:"));
+}
+
+TEST_F(HwSensorsTest, UnchangedValuesAreOnlyRefreshed) {
+    send("set-delay:acceleration:10");
+    send("set:acceleration:1");
+    runUntil(kStartNs + 1000 * kMs);
+    // Sent when enabled, then every 200 ms.
+    EXPECT_EQ(6, countMessages("acceleration:0:0:0"));
+
+    // A change is reported as soon as the sensor rate allows.
+    runUntil(kStartNs + 1005 * kMs);
+    android_sensors_set(ANDROID_SENSOR_ACCELERATION, 1, 2, 3);
+    runUntil(kStartNs + 1009 * kMs);
+    EXPECT_EQ(0, countMessages("acceleration:1:2:3"));
+    runUntil(kStartNs + 1010 * kMs);
+    EXPECT_EQ(1, countMessages("acceleration:1:2:3"));
+    EXPECT_EQ("sync:2010000", mClient->messages.back());
+
+    // Disabled sensors are not reported.
+    send("set:acceleration:0");
+    size_t count = mClient->messages.size();
+    android_sensors_set(ANDROID_SENSOR_ACCELERATION, 4, 5, 6);
+    runUntil(kStartNs + 2000 * kMs);
+    EXPECT_EQ(count, mClient->messages.size());
+}
+
+TEST_F(HwSensorsTest, NegotiatesCompactFormat) {
+    send("set-format:compact");
+    send("wake");
+    ASSERT_EQ(2U, mClient->messages.size());
+    EXPECT_EQ("format:compact", mClient->messages[0]);
+    EXPECT_EQ("wake", mClient->messages[1]);
+
+    // Unknown formats don't change the current one.
+    send("set-format:protobuf");
+    EXPECT_EQ("format:compact", mClient->messages.back());
+
+    // Without a batch latency, each report is sent right away.
+    android_sensors_set(ANDROID_SENSOR_ACCELERATION, 1, 2, 3);
+    send("set:acceleration:1");
+    ASSERT_EQ(4U, mClient->messages.size());
+    std::vector<Sample> samples;
+    ASSERT_TRUE(decodeCompact(mClient->messages.back(), &samples));
+    ASSERT_EQ(1U, samples.size());
+    EXPECT_EQ(ANDROID_SENSOR_ACCELERATION, samples[0].id);
+    EXPECT_EQ(kStartNs / 1000, samples[0].timeUs);
+    ASSERT_EQ(3U, samples[0].values.size());
+    EXPECT_EQ(1, samples[0].values[0]);
+    EXPECT_EQ(2, samples[0].values[1]);
+    EXPECT_EQ(3, samples[0].values[2]);
+
+    send("set-format:text");
+    EXPECT_EQ("format:text", mClient->messages.back());
+    android_sensors_set(ANDROID_SENSOR_ACCELERATION, 4, 5, 6);
+    runUntil(kStartNs + 1000 * kMs);
+    EXPECT_EQ(1, countMessages("acceleration:4:5:6"));
+}
+
+TEST_F(HwSensorsTest, BatchesCompactSamples) {
+    send("set-format:compact");
+    send("set-delay:acceleration:5");
+    send("set-batch:50");
+    send("set:temperature:1");
+    send("set:acceleration:1");
+    for (int ms = 1; ms <= 100; ++ms) {
+        android_sensors_set(ANDROID_SENSOR_ACCELERATION, ms, 2 * ms, 3 * ms);
+        runUntil(kStartNs + ms * kMs);
+    }
+    runUntil(kStartNs + 105 * kMs);
+
+    // The batch latency is counted from the first sample of a batch.
+    ASSERT_EQ(3U, mClient->messages.size());
+    std::vector<Sample> first;
+    std::vector<Sample> second;
+    ASSERT_TRUE(decodeCompact(mClient->messages[1], &first));
+    ASSERT_TRUE(decodeCompact(mClient->messages[2], &second));
+    ASSERT_EQ(12U, first.size());
+    ASSERT_EQ(10U, second.size());
+
+    EXPECT_EQ(ANDROID_SENSOR_TEMPERATURE, first[0].id);
+    EXPECT_EQ(kStartNs / 1000, first[0].timeUs);
+    ASSERT_EQ(1U, first[0].values.size());
+    EXPECT_EQ(20, first[0].values[0]);
+
+    std::vector<Sample> samples(first.begin() + 1, first.end());
+    samples.insert(samples.end(), second.begin(), second.end());
+    for (size_t n = 0; n < samples.size(); ++n) {
+        const int ms = 5 * n;
+        SCOPED_TRACE(testing::Message() << "sample at " << ms << " ms");
+        EXPECT_EQ(ANDROID_SENSOR_ACCELERATION, samples[n].id);
+        EXPECT_EQ((kStartNs + ms * kMs) / 1000, samples[n].timeUs);
+        ASSERT_EQ(3U, samples[n].values.size());
+        EXPECT_EQ(ms, samples[n].values[0]);
+        EXPECT_EQ(2 * ms, samples[n].values[1]);
+        EXPECT_EQ(3 * ms, samples[n].values[2]);
+    }
+}
+
+TEST_F(HwSensorsTest, LoadsSnapshotWithoutPerSensorDelays) {
+    // Client state saved by emulators that had a single delay.
+    QEMUFile f;
+    f.pos = 0;
+    qemu_put_be32(&f, 100);
+    qemu_put_be32(&f, 1 << ANDROID_SENSOR_ACCELERATION);
+    qemu_put_be32(&f, 0);
+    qemu_put_be32(&f, static_cast<uint32_t>(kStartNs));
+    ASSERT_EQ(0, mClient->load(&f, reinterpret_cast<QemudClient*>(mClient),
+                               mClient->opaque));
+    EXPECT_EQ(f.data.size(), f.pos);
+
+    for (int ms = 10; ms <= 1000; ms += 10) {
+        android_sensors_set(ANDROID_SENSOR_ACCELERATION, ms, 0, 0);
+        runUntil(kStartNs + ms * kMs);
+    }
+    // Reported when the timer fires, then every 100 ms, as text.
+    EXPECT_EQ(11, countMessages("acceleration:"));
+    EXPECT_EQ(11, countMessages("sync:"));
+    EXPECT_EQ(0, countMessages("magnetic:"));
+}
+
+TEST_F(HwSensorsTest, RejectsUnknownSnapshotVersion) {
+    QEMUFile f;
+    f.pos = 0;
+    qemu_put_be32(&f, static_cast<uint32_t>(-3));
+    EXPECT_GT(0, mClient->load(&f, reinterpret_cast<QemudClient*>(mClient),
+                               mClient->opaque));
+}
+
+TEST_F(HwSensorsTest, SnapshotKeepsRatesAndFormat) {
+    send("set-format:compact");
+    send("set-delay:acceleration:5");
+    send("set-delay:magnetic-field:1000");
+    send("set-batch:20");
+    send("set:acceleration:1");
+    send("set:magnetic-field:1");
+
+    QEMUFile f;
+    f.pos = 0;
+    mClient->save(&f, reinterpret_cast<QemudClient*>(mClient),
+                  mClient->opaque);
+    disconnect(mClient);
+
+    mClient = connect();
+    ASSERT_EQ(0, mClient->load(&f, reinterpret_cast<QemudClient*>(mClient),
+                               mClient->opaque));
+    for (int ms = 1; ms <= 100; ++ms) {
+        android_sensors_set(ANDROID_SENSOR_ACCELERATION, ms, 0, 0);
+        android_sensors_set(ANDROID_SENSOR_MAGNETIC_FIELD, ms, 0, 0);
+        runUntil(kStartNs + ms * kMs);
+    }
+
+    // Samples pending at save time are reported again after loading.
+    std::vector<Sample> samples;
+    for (size_t n = 0; n < mClient->messages.size(); ++n) {
+        std::vector<Sample> batch;
+        ASSERT_TRUE(decodeCompact(mClient->messages[n], &batch));
+        ASSERT_FALSE(batch.empty());
+        EXPECT_GE(batch[0].timeUs + 20000, batch.back().timeUs);
+        samples.insert(samples.end(), batch.begin(), batch.end());
+    }
+    int accelerations = 0;
+    int magnetics = 0;
+    for (size_t n = 0; n < samples.size(); ++n) {
+        if (samples[n].id == ANDROID_SENSOR_ACCELERATION) {
+            accelerations++;
+        } else if (samples[n].id == ANDROID_SENSOR_MAGNETIC_FIELD) {
+            magnetics++;
+        }
+    }
+    EXPECT_EQ(20, accelerations);
+    EXPECT_EQ(1, magnetics);
+}
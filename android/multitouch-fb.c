@@ -0,0 +1,332 @@
+/*
+ * Copyright (C) 2015 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "android/multitouch-fb.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+/* Full memory barrier, used to publish updates of the shared framebuffer. */
+#define MTFB_BARRIER()  __sync_synchronize()
+
+/* Alignment of the pixels in the shadow framebuffer block. */
+#define MTFB_PIXELS_ALIGN   64
+
+static int
+_mtfb_min(int a, int b)
+{
+    return a < b ? a : b;
+}
+
+static int
+_mtfb_max(int a, int b)
+{
+    return a > b ? a : b;
+}
+
+/* Gets a line of a framebuffer, given its top-down index. */
+static const uint8_t*
+_mtfb_line(const uint8_t* fb, int bpl, int height, int ydir, int line)
+{
+    return fb + (size_t)(ydir < 0 ? height - 1 - line : line) * bpl;
+}
+
+static int
+_mtfb_tiles(int size)
+{
+    return (size + MTFB_TILE_SIZE - 1) / MTFB_TILE_SIZE;
+}
+
+static size_t
+_mtfb_tiles_offset(void)
+{
+    return sizeof(MTFbSharedHeader);
+}
+
+static size_t
+_mtfb_pixels_offset(int width, int height)
+{
+    const size_t end = _mtfb_tiles_offset() +
+            sizeof(uint32_t) * _mtfb_tiles(width) * _mtfb_tiles(height);
+    return (end + MTFB_PIXELS_ALIGN - 1) & ~(size_t)(MTFB_PIXELS_ALIGN - 1);
+}
+
+size_t
+mtfb_shadow_block_size(int width, int height, int bpp)
+{
+    return _mtfb_pixels_offset(width, height) + (size_t)width * height * bpp;
+}
+
+/* Allocates the shadow framebuffer block, either on the heap, or in the shared
+ * memory. The block is zeroed.
+ * Return:
+ *  Block on success, or NULL on failure.
+ */
+static void*
+_mtfb_block_alloc(MTFbShadow* shadow, size_t size)
+{
+    void* block;
+
+    if (shadow->shm_path == NULL) {
+        return calloc(1, size);
+    }
+
+#ifdef _WIN32
+    shadow->shm_handle = CreateFileMappingA(INVALID_HANDLE_VALUE, NULL,
+                                            PAGE_READWRITE, 0, (DWORD)size,
+                                            shadow->shm_path);
+    if (shadow->shm_handle == NULL) {
+        return NULL;
+    }
+    block = MapViewOfFile((HANDLE)shadow->shm_handle, FILE_MAP_ALL_ACCESS,
+                          0, 0, size);
+    if (block == NULL) {
+        CloseHandle((HANDLE)shadow->shm_handle);
+        shadow->shm_handle = NULL;
+        return NULL;
+    }
+    memset(block, 0, size);
+#else
+    shadow->shm_fd = open(shadow->shm_path, O_RDWR | O_CREAT, 0600);
+    if (shadow->shm_fd < 0) {
+        return NULL;
+    }
+    /* Truncating first makes sure that the whole block reads as zeroes. */
+    if (ftruncate(shadow->shm_fd, 0) < 0 ||
+        ftruncate(shadow->shm_fd, size) < 0) {
+        close(shadow->shm_fd);
+        shadow->shm_fd = -1;
+        return NULL;
+    }
+    block = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                 shadow->shm_fd, 0);
+    if (block == MAP_FAILED) {
+        close(shadow->shm_fd);
+        shadow->shm_fd = -1;
+        return NULL;
+    }
+#endif
+    return block;
+}
+
+/* Frees the shadow framebuffer block. */
+static void
+_mtfb_block_free(MTFbShadow* shadow)
+{
+    if (shadow->header == NULL) {
+        return;
+    }
+
+    if (shadow->shm_path == NULL) {
+        free(shadow->header);
+    } else {
+#ifdef _WIN32
+        UnmapViewOfFile(shadow->header);
+        CloseHandle((HANDLE)shadow->shm_handle);
+        shadow->shm_handle = NULL;
+#else
+        munmap(shadow->header, shadow->header->total_size);
+        close(shadow->shm_fd);
+        shadow->shm_fd = -1;
+#endif
+    }
+    shadow->header = NULL;
+    shadow->tile_frames = NULL;
+    shadow->pixels = NULL;
+}
+
+/* (Re)allocates the shadow framebuffer block for the given geometry.
+ * Return:
+ *  0 on success, or -1 on failure.
+ */
+static int
+_mtfb_shadow_resize(MTFbShadow* shadow, int width, int height, int bpp)
+{
+    const size_t size = mtfb_shadow_block_size(width, height, bpp);
+    MTFbSharedHeader* header;
+
+    _mtfb_block_free(shadow);
+
+    header = (MTFbSharedHeader*)_mtfb_block_alloc(shadow, size);
+    if (header == NULL) {
+        return -1;
+    }
+
+    header->header_size = sizeof(MTFbSharedHeader);
+    header->total_size = (uint32_t)size;
+    header->tiles_offset = (uint32_t)_mtfb_tiles_offset();
+    header->pixels_offset = (uint32_t)_mtfb_pixels_offset(width, height);
+    header->width = width;
+    header->height = height;
+    header->bpp = bpp;
+    header->bpl = width * bpp;
+    header->tile_size = MTFB_TILE_SIZE;
+    header->tiles_x = _mtfb_tiles(width);
+    header->tiles_y = _mtfb_tiles(height);
+    header->version = MTFB_SHARED_VERSION;
+    /* Consumers check the magic last. */
+    MTFB_BARRIER();
+    header->magic = MTFB_SHARED_MAGIC;
+
+    shadow->header = header;
+    shadow->tile_frames = (uint32_t*)((uint8_t*)header + header->tiles_offset);
+    shadow->pixels = (uint8_t*)header + header->pixels_offset;
+    return 0;
+}
+
+void
+mtfb_shadow_init(MTFbShadow* shadow, const char* shm_path)
+{
+    memset(shadow, 0, sizeof(*shadow));
+    shadow->shm_fd = -1;
+    if (shm_path != NULL) {
+        shadow->shm_path = strdup(shm_path);
+    }
+}
+
+void
+mtfb_shadow_done(MTFbShadow* shadow)
+{
+    _mtfb_block_free(shadow);
+    free(shadow->shm_path);
+    shadow->shm_path = NULL;
+}
+
+int
+mtfb_shadow_update(MTFbShadow* shadow,
+                   const uint8_t* fb,
+                   int width,
+                   int height,
+                   int bpp,
+                   int bpl,
+                   int ydir,
+                   const MTFbRect* rect,
+                   MTFbRect* dirty)
+{
+    MTFbSharedHeader* header = shadow->header;
+    int x0, y0, x1, y1, tx, ty;
+    int min_tx, min_ty, max_tx, max_ty;
+    int changed = 0;
+    int full;
+    uint32_t frame;
+
+    dirty->x = dirty->y = dirty->w = dirty->h = 0;
+
+    /* Reallocate the shadow framebuffer on geometry changes. */
+    full = (header == NULL || header->width != (uint32_t)width ||
+            header->height != (uint32_t)height || header->bpp != (uint32_t)bpp);
+    if (full) {
+        if (_mtfb_shadow_resize(shadow, width, height, bpp)) {
+            return -1;
+        }
+        header = shadow->header;
+        x0 = y0 = 0;
+        x1 = width;
+        y1 = height;
+    } else {
+        /* Clip the updated region, and align it to the tiles. */
+        x0 = _mtfb_max(rect->x, 0);
+        y0 = _mtfb_max(rect->y, 0);
+        x1 = _mtfb_min(rect->x + rect->w, width);
+        y1 = _mtfb_min(rect->y + rect->h, height);
+        if (x0 >= x1 || y0 >= y1) {
+            return 0;
+        }
+    }
+
+    min_tx = x0 / MTFB_TILE_SIZE;
+    min_ty = y0 / MTFB_TILE_SIZE;
+    max_tx = (x1 - 1) / MTFB_TILE_SIZE;
+    max_ty = (y1 - 1) / MTFB_TILE_SIZE;
+
+    frame = header->frame + 1;
+    header->seq++;
+    MTFB_BARRIER();
+
+    /* Bounding box of the changed tiles, in tiles. */
+    x0 = max_tx + 1;
+    y0 = max_ty + 1;
+    x1 = y1 = -1;
+
+    for (ty = min_ty; ty <= max_ty; ty++) {
+        const int row = ty * MTFB_TILE_SIZE;
+        const int rows = _mtfb_min(row + MTFB_TILE_SIZE, height) - row;
+
+        for (tx = min_tx; tx <= max_tx; tx++) {
+            const int col = tx * MTFB_TILE_SIZE;
+            const size_t tile_bpl =
+                    (size_t)(_mtfb_min(col + MTFB_TILE_SIZE, width) - col) *
+                    bpp;
+            int line = 0;
+
+            if (!full) {
+                /* Find the first line that differs. */
+                for (; line < rows; line++) {
+                    if (memcmp(shadow->pixels + col * bpp +
+                                   (size_t)(row + line) * header->bpl,
+                               _mtfb_line(fb, bpl, height,
+                                          ydir, row + line) + col * bpp,
+                               tile_bpl)) {
+                        break;
+                    }
+                }
+                if (line == rows) {
+                    continue;
+                }
+            }
+
+            /* Copy the tile, starting at the first line that differs. */
+            for (; line < rows; line++) {
+                memcpy(shadow->pixels +
+                       (size_t)(row + line) * header->bpl + col * bpp,
+                       _mtfb_line(fb, bpl, height,
+                                  ydir, row + line) + col * bpp,
+                       tile_bpl);
+            }
+            shadow->tile_frames[ty * header->tiles_x + tx] = frame;
+            changed++;
+            x0 = _mtfb_min(x0, tx);
+            y0 = _mtfb_min(y0, ty);
+            x1 = _mtfb_max(x1, tx);
+            y1 = _mtfb_max(y1, ty);
+        }
+    }
+
+    if (changed) {
+        dirty->x = x0 * MTFB_TILE_SIZE;
+        dirty->y = y0 * MTFB_TILE_SIZE;
+        dirty->w = _mtfb_min((x1 + 1) * MTFB_TILE_SIZE, width) - dirty->x;
+        dirty->h = _mtfb_min((y1 + 1) * MTFB_TILE_SIZE, height) - dirty->y;
+        header->frame = frame;
+        header->dirty_x = dirty->x;
+        header->dirty_y = dirty->y;
+        header->dirty_w = dirty->w;
+        header->dirty_h = dirty->h;
+    }
+
+    MTFB_BARRIER();
+    header->seq++;
+
+    return changed;
+}
@@ -0,0 +1,165 @@
+/*
+ * Copyright (C) 2015 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_MULTITOUCH_FB_H_
+#define ANDROID_MULTITOUCH_FB_H_
+
+/*
+ * Contains declarations for the shadow framebuffer used by the multi-touch
+ * screen emulation to find out which parts of the emulator display have really
+ * changed between two framebuffer updates.
+ *
+ * The shadow framebuffer is split into square tiles. Each update compares the
+ * updated region of the emulator framebuffer with the shadow copy, tile by
+ * tile, copies the tiles that differ, and stamps them with the update's frame
+ * number. The bounding rectangle of the changed tiles is what actually needs
+ * to be sent to the device, and unchanged updates are dropped entirely.
+ *
+ * The shadow framebuffer can live in a file mapped in shared memory, so that
+ * a consumer running on the same host can read the frames without going
+ * through the SDK controller socket. The mapping starts with MTFbSharedHeader,
+ * followed by the per-tile frame numbers, followed by the pixels. A consumer
+ * only needs to copy the tiles whose frame number is greater than the last
+ * frame it has seen.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "android/utils/compiler.h"
+
+ANDROID_BEGIN_HEADER
+
+/* Width and height of a shadow framebuffer tile, in pixels. */
+#define MTFB_TILE_SIZE          32
+
+/* Value of MTFbSharedHeader.magic ('MTFB'). */
+#define MTFB_SHARED_MAGIC       0x4246544d
+
+/* Version of the shared framebuffer layout. */
+#define MTFB_SHARED_VERSION     1
+
+/* Header at the beginning of the shadow framebuffer block.
+ *
+ * Updates are published with a sequence lock: 'seq' is odd while an update is
+ * being written. A consumer reads 'seq', copies what it needs, and retries if
+ * 'seq' was odd or has changed meanwhile.
+ */
+typedef struct MTFbSharedHeader {
+    /* Must be MTFB_SHARED_MAGIC. */
+    uint32_t    magic;
+    /* Must be MTFB_SHARED_VERSION. */
+    uint32_t    version;
+    /* Byte size of this header. */
+    uint32_t    header_size;
+    /* Byte size of the entire block. */
+    uint32_t    total_size;
+    /* Offsets of the per-tile frame numbers and the pixels in the block. */
+    uint32_t    tiles_offset;
+    uint32_t    pixels_offset;
+    /* Geometry of the framebuffer. Lines are always top-down, and are tightly
+     * packed (bpl == width * bpp). */
+    uint32_t    width;
+    uint32_t    height;
+    uint32_t    bpp;
+    uint32_t    bpl;
+    /* Tile size, and number of tiles in a row and a column. */
+    uint32_t    tile_size;
+    uint32_t    tiles_x;
+    uint32_t    tiles_y;
+    /* Sequence lock counter. */
+    volatile uint32_t seq;
+    /* Number of the last update that has changed the framebuffer. */
+    uint32_t    frame;
+    /* Bounding rectangle of the tiles changed by the last update. */
+    int32_t     dirty_x;
+    int32_t     dirty_y;
+    int32_t     dirty_w;
+    int32_t     dirty_h;
+} MTFbSharedHeader;
+
+/* A framebuffer rectangle. */
+typedef struct MTFbRect {
+    int x;
+    int y;
+    int w;
+    int h;
+} MTFbRect;
+
+/* Shadow framebuffer descriptor. */
+typedef struct MTFbShadow {
+    /* Beginning of the shadow framebuffer block, or NULL if no frame has been
+     * received yet. */
+    MTFbSharedHeader*   header;
+    /* Frame numbers of the last update that has changed each tile. */
+    uint32_t*           tile_frames;
+    /* Shadow framebuffer pixels. */
+    uint8_t*            pixels;
+    /* Path of the file mapped in shared memory, or NULL to allocate the block
+     * on the heap. On Windows, this is the name of the file mapping object. */
+    char*               shm_path;
+    /* File descriptor, or file mapping handle of the shared memory. */
+    int                 shm_fd;
+    void*               shm_handle;
+} MTFbShadow;
+
+/* Initializes a shadow framebuffer descriptor.
+ * Param:
+ *  shadow - Descriptor to initialize.
+ *  shm_path - Path of the file to map the shadow framebuffer to, or NULL to
+ *      keep it private to the process.
+ */
+extern void mtfb_shadow_init(MTFbShadow* shadow, const char* shm_path);
+
+/* Releases the shadow framebuffer, and unmaps the shared memory. The file
+ * itself is left in place. */
+extern void mtfb_shadow_done(MTFbShadow* shadow);
+
+/* Updates the shadow framebuffer with a region of the emulator framebuffer.
+ * If the framebuffer geometry has changed, the shadow framebuffer is
+ * reallocated, and the whole frame is considered changed.
+ * Param:
+ *  shadow - Initialized shadow framebuffer descriptor.
+ *  fb - Beginning of the emulator framebuffer.
+ *  width, height - Framebuffer dimensions.
+ *  bpp - Number of bytes per pixel in the framebuffer.
+ *  bpl - Number of bytes per line in the framebuffer.
+ *  ydir - Indicates direction in which lines are arranged in the framebuffer.
+ *      If this value is negative, lines are arranged in bottom-up format.
+ *  rect - Updated region of the framebuffer, in top-down coordinates.
+ *  dirty - Upon return contains the bounding rectangle of the changed tiles, in
+ *      top-down coordinates, clipped to the framebuffer. Empty if nothing has
+ *      changed.
+ * Return:
+ *  Number of changed tiles, or -1 if the shadow framebuffer could not be
+ *  allocated.
+ */
+extern int mtfb_shadow_update(MTFbShadow* shadow,
+                              const uint8_t* fb,
+                              int width,
+                              int height,
+                              int bpp,
+                              int bpl,
+                              int ydir,
+                              const MTFbRect* rect,
+                              MTFbRect* dirty);
+
+/* Computes the byte size of a shadow framebuffer block. */
+extern size_t mtfb_shadow_block_size(int width, int height, int bpp);
+
+ANDROID_END_HEADER
+
+#endif  /* ANDROID_MULTITOUCH_FB_H_ */
@@ -0,0 +1,306 @@
+// Copyright 2015 The Android Open Source Project
+//
+// This software is licensed under the terms of the GNU General Public
+// License version 2, as published by the Free Software Foundation, and
+// may be copied, distributed, and modified under those terms.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+#include "android/multitouch-fb.h"
+#include "android/utils/jpeg-compress.h"
+
+#include <gtest/gtest.h>
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/time.h>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#include <vector>
+
+namespace {
+
+typedef std::vector<uint8_t> Frame;
+
+const int kWidth = 100;
+const int kHeight = 70;
+const int kBpp = 4;
+
+Frame makeFrame(int width, int height, int bpp, uint8_t seed) {
+    Frame frame(width * height * bpp);
+    for (size_t n = 0; n < frame.size(); n++) {
+        frame[n] = (uint8_t)(n * 31 + seed);
+    }
+    return frame;
+}
+
+void setPixel(Frame* frame, int width, int bpp, int x, int y, uint8_t value) {
+    memset(&(*frame)[(y * width + x) * bpp], value, bpp);
+}
+
+uint64_t nowUs() {
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return (uint64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+class MultitouchFbTest : public testing::Test {
+protected:
+    virtual void SetUp() { mtfb_shadow_init(&mShadow, NULL); }
+    virtual void TearDown() { mtfb_shadow_done(&mShadow); }
+
+    int update(const Frame& frame, int ydir, int x, int y, int w, int h,
+               MTFbRect* dirty) {
+        const MTFbRect rect = { x, y, w, h };
+        return mtfb_shadow_update(&mShadow, &frame[0], kWidth, kHeight, kBpp,
+                                  kWidth * kBpp, ydir, &rect, dirty);
+    }
+
+    int updateAll(const Frame& frame, MTFbRect* dirty) {
+        return update(frame, 1, 0, 0, kWidth, kHeight, dirty);
+    }
+
+    bool shadowEquals(const Frame& frame) {
+        return !memcmp(mShadow.pixels, &frame[0], frame.size());
+    }
+
+    MTFbShadow mShadow;
+};
+
+}  // namespace
+
+TEST_F(MultitouchFbTest, FirstUpdateIsFull) {
+    const Frame frame = makeFrame(kWidth, kHeight, kBpp, 1);
+    MTFbRect dirty;
+
+    // 100x70 pixels make 4x3 tiles.
+    EXPECT_EQ(12, update(frame, 1, 10, 10, 1, 1, &dirty));
+    EXPECT_EQ(0, dirty.x);
+    EXPECT_EQ(0, dirty.y);
+    EXPECT_EQ(kWidth, dirty.w);
+    EXPECT_EQ(kHeight, dirty.h);
+    EXPECT_TRUE(shadowEquals(frame));
+
+    const MTFbSharedHeader* header = mShadow.header;
+    EXPECT_EQ((uint32_t)MTFB_SHARED_MAGIC, header->magic);
+    EXPECT_EQ(4U, header->tiles_x);
+    EXPECT_EQ(3U, header->tiles_y);
+    EXPECT_EQ((uint32_t)(kWidth * kBpp), header->bpl);
+    EXPECT_EQ(1U, header->frame);
+    EXPECT_EQ(0U, header->seq & 1);
+}
+
+TEST_F(MultitouchFbTest, UnchangedFrameIsDropped) {
+    const Frame frame = makeFrame(kWidth, kHeight, kBpp, 1);
+    MTFbRect dirty;
+
+    updateAll(frame, &dirty);
+    EXPECT_EQ(0, updateAll(frame, &dirty));
+    EXPECT_EQ(0, dirty.w);
+    EXPECT_EQ(0, dirty.h);
+    EXPECT_EQ(1U, mShadow.header->frame);
+}
+
+TEST_F(MultitouchFbTest, SinglePixelChange) {
+    Frame frame = makeFrame(kWidth, kHeight, kBpp, 1);
+    MTFbRect dirty;
+
+    updateAll(frame, &dirty);
+    setPixel(&frame, kWidth, kBpp, 70, 40, 0xaa);
+    EXPECT_EQ(1, updateAll(frame, &dirty));
+    EXPECT_EQ(64, dirty.x);
+    EXPECT_EQ(32, dirty.y);
+    EXPECT_EQ(32, dirty.w);
+    EXPECT_EQ(32, dirty.h);
+    EXPECT_TRUE(shadowEquals(frame));
+
+    // Only the changed tile is stamped with the new frame number.
+    const MTFbSharedHeader* header = mShadow.header;
+    for (uint32_t n = 0; n < header->tiles_x * header->tiles_y; n++) {
+        EXPECT_EQ(n == 1 * 4 + 2 ? 2U : 1U, mShadow.tile_frames[n]);
+    }
+}
+
+TEST_F(MultitouchFbTest, DirtyRectIsClippedToFrame) {
+    Frame frame = makeFrame(kWidth, kHeight, kBpp, 1);
+    MTFbRect dirty;
+
+    updateAll(frame, &dirty);
+    setPixel(&frame, kWidth, kBpp, 10, 5, 0xaa);
+    setPixel(&frame, kWidth, kBpp, kWidth - 1, kHeight - 1, 0xaa);
+    EXPECT_EQ(2, updateAll(frame, &dirty));
+    EXPECT_EQ(0, dirty.x);
+    EXPECT_EQ(0, dirty.y);
+    EXPECT_EQ(kWidth, dirty.w);
+    EXPECT_EQ(kHeight, dirty.h);
+    EXPECT_TRUE(shadowEquals(frame));
+}
+
+TEST_F(MultitouchFbTest, OnlyUpdatedRegionIsCompared) {
+    Frame frame = makeFrame(kWidth, kHeight, kBpp, 1);
+    MTFbRect dirty;
+
+    updateAll(frame, &dirty);
+    setPixel(&frame, kWidth, kBpp, 5, 5, 0xaa);
+    setPixel(&frame, kWidth, kBpp, 80, 60, 0xaa);
+    EXPECT_EQ(1, update(frame, 1, 70, 50, 10, 10, &dirty));
+    EXPECT_EQ(64, dirty.x);
+    EXPECT_EQ(32, dirty.y);
+    EXPECT_EQ(32, dirty.w);
+    EXPECT_EQ(32, dirty.h);
+    EXPECT_FALSE(shadowEquals(frame));
+}
+
+TEST_F(MultitouchFbTest, BottomUpFrame) {
+    Frame frame = makeFrame(kWidth, kHeight, kBpp, 1);
+    Frame flipped(frame.size());
+    const int bpl = kWidth * kBpp;
+    MTFbRect dirty;
+
+    for (int y = 0; y < kHeight; y++) {
+        memcpy(&flipped[y * bpl], &frame[(kHeight - 1 - y) * bpl], bpl);
+    }
+    updateAll(frame, &dirty);
+    EXPECT_EQ(0, update(flipped, -1, 0, 0, kWidth, kHeight, &dirty));
+
+    // Change the top line of the frame: that's the last line of the buffer.
+    setPixel(&flipped, kWidth, kBpp, 0, kHeight - 1, 0xaa);
+    setPixel(&frame, kWidth, kBpp, 0, 0, 0xaa);
+    EXPECT_EQ(1, update(flipped, -1, 0, 0, kWidth, kHeight, &dirty));
+    EXPECT_EQ(0, dirty.x);
+    EXPECT_EQ(0, dirty.y);
+    EXPECT_TRUE(shadowEquals(frame));
+}
+
+TEST_F(MultitouchFbTest, GeometryChange) {
+    const Frame frame = makeFrame(kWidth, kHeight, kBpp, 1);
+    const Frame small = makeFrame(40, 40, 2, 1);
+    const MTFbRect rect = { 0, 0, 1, 1 };
+    MTFbRect dirty;
+
+    updateAll(frame, &dirty);
+    EXPECT_EQ(4, mtfb_shadow_update(&mShadow, &small[0], 40, 40, 2, 80, 1,
+                                    &rect, &dirty));
+    EXPECT_EQ(40, dirty.w);
+    EXPECT_EQ(40, dirty.h);
+    EXPECT_EQ(80U, mShadow.header->bpl);
+    EXPECT_EQ(0, memcmp(mShadow.pixels, &small[0], small.size()));
+}
+
+#ifndef _WIN32
+TEST(MultitouchFbShared, ConsumerSeesFrames) {
+    char path[] = "/tmp/mtfb-XXXXXX";
+    const int fd = mkstemp(path);
+    ASSERT_GE(fd, 0);
+
+    MTFbShadow shadow;
+    mtfb_shadow_init(&shadow, path);
+    Frame frame = makeFrame(kWidth, kHeight, kBpp, 3);
+    const MTFbRect rect = { 0, 0, kWidth, kHeight };
+    MTFbRect dirty;
+    EXPECT_EQ(12, mtfb_shadow_update(&shadow, &frame[0], kWidth, kHeight, kBpp,
+                                     kWidth * kBpp, 1, &rect, &dirty));
+    setPixel(&frame, kWidth, kBpp, 1, 1, 0xaa);
+    EXPECT_EQ(1, mtfb_shadow_update(&shadow, &frame[0], kWidth, kHeight, kBpp,
+                                    kWidth * kBpp, 1, &rect, &dirty));
+
+    // Map the file as a consumer would.
+    const size_t size = mtfb_shadow_block_size(kWidth, kHeight, kBpp);
+    void* block = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+    ASSERT_NE(MAP_FAILED, block);
+    const MTFbSharedHeader* header = (const MTFbSharedHeader*)block;
+    EXPECT_EQ((uint32_t)MTFB_SHARED_MAGIC, header->magic);
+    EXPECT_EQ((uint32_t)size, header->total_size);
+    EXPECT_EQ(2U, header->frame);
+    EXPECT_EQ(0, header->dirty_x);
+    EXPECT_EQ(32, header->dirty_w);
+    const uint32_t* tiles =
+            (const uint32_t*)((const uint8_t*)block + header->tiles_offset);
+    EXPECT_EQ(2U, tiles[0]);
+    EXPECT_EQ(1U, tiles[1]);
+    EXPECT_EQ(0, memcmp((const uint8_t*)block + header->pixels_offset,
+                        &frame[0], frame.size()));
+
+    munmap(block, size);
+    mtfb_shadow_done(&shadow);
+    close(fd);
+    unlink(path);
+}
+#endif  // !_WIN32
+
+// Simulates a mostly static 1280x720 screen with a moving 48x48 sprite, and a
+// small "clock" that changes every 10 frames. Reports the time to diff each
+// frame, and the time to encode and the size of the JPEG image sent to the
+// device, for the whole frame as before, and for the dirty rectangle.
+TEST(MultitouchFbBenchmark, DISABLED_Benchmark) {
+    const int width = 1280, height = 720, bpp = 4, kFrames = 300;
+    // Same quality as the multi-touch port.
+    const int kJpegQuality = 10;
+    Frame frame = makeFrame(width, height, bpp, 7);
+    const MTFbRect rect = { 0, 0, width, height };
+    MTFbShadow shadow;
+    MTFbRect dirty;
+    AJPEGDesc* jpeg = jpeg_compressor_create(0, 65536);
+    uint64_t diff_us = 0, tile_bytes = 0;
+    uint64_t full_us = 0, full_jpeg = 0, dirty_us = 0, dirty_jpeg = 0;
+
+    mtfb_shadow_init(&shadow, NULL);
+    mtfb_shadow_update(&shadow, &frame[0], width, height, bpp, width * bpp,
+                       -1, &rect, &dirty);
+
+    for (int n = 0; n < kFrames; n++) {
+        const int sx = (n * 7) % (width - 48);
+        const int sy = (n * 3) % (height - 48);
+        for (int y = 0; y < 48; y++) {
+            memset(&frame[((sy + y) * width + sx) * bpp], n, 48 * bpp);
+        }
+        if (n % 10 == 0) {
+            setPixel(&frame, width, bpp, width - 20, 10, n);
+        }
+        uint64_t start = nowUs();
+        const int tiles = mtfb_shadow_update(&shadow, &frame[0], width, height,
+                                             bpp, width * bpp, -1, &rect,
+                                             &dirty);
+        diff_us += nowUs() - start;
+        tile_bytes += tiles * MTFB_TILE_SIZE * MTFB_TILE_SIZE * bpp;
+
+        // What was sent before: the whole frame, from the renderer's buffer.
+        start = nowUs();
+        jpeg_compressor_compress_fb(jpeg, 0, 0, width, height, height, bpp,
+                                    width * bpp, &frame[0], kJpegQuality, -1);
+        full_us += nowUs() - start;
+        full_jpeg += jpeg_compressor_get_jpeg_size(jpeg);
+
+        // What is sent now: the dirty rectangle, from the shadow copy.
+        if (tiles > 0) {
+            start = nowUs();
+            jpeg_compressor_compress_fb(jpeg, dirty.x, dirty.y, dirty.w,
+                                        dirty.h, height, bpp,
+                                        shadow.header->bpl, shadow.pixels,
+                                        kJpegQuality, 1);
+            dirty_us += nowUs() - start;
+            dirty_jpeg += jpeg_compressor_get_jpeg_size(jpeg);
+        }
+    }
+    mtfb_shadow_done(&shadow);
+    jpeg_compressor_destroy(jpeg);
+
+    printf("%dx%d: %.3f ms/frame to diff, %llu bytes/frame in dirty tiles\n",
+           width, height, diff_us / 1000. / kFrames,
+           (unsigned long long)(tile_bytes / kFrames));
+    printf("  full frame: %.3f ms/frame to encode, %llu JPEG bytes/frame\n",
+           full_us / 1000. / kFrames,
+           (unsigned long long)(full_jpeg / kFrames));
+    printf("  dirty rect: %.3f ms/frame to encode, %llu JPEG bytes/frame\n",
+           dirty_us / 1000. / kFrames,
+           (unsigned long long)(dirty_jpeg / kFrames));
+}
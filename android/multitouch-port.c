@@ -76,6 +76,12 @@ struct AndroidMTSPort {
     AJPEGDesc*          jpeg_compressor;
     /* Direct packet descriptor for framebuffer updates. */
     SDKCtlDirectPacket* fb_packet;
+    /* Number of framebuffer updates sent to the device. */
+    uint64_t            frames_sent;
+    /* Total number of bytes sent in framebuffer updates. */
+    uint64_t            bytes_sent;
+    /* Total time spent compressing framebuffer updates, in microseconds. */
+    uint64_t            encode_us;
 };
 
 /* Data sent with SDKCTL_MT_QUERY_START */
@@ -104,6 +110,16 @@ typedef struct AndroidMTPtr {
     int     pid;
 } AndroidMTPtr;
 
+/* Gets current time in microseconds. */
+static uint64_t
+_mts_port_now_us(void)
+{
+    struct timeval t;
+    t.tv_sec = t.tv_usec = 0;
+    gettimeofday(&t, NULL);
+    return (uint64_t)t.tv_sec * 1000000LL + t.tv_usec;
+}
+
 /* Destroys and frees the descriptor. */
 static void
 _mts_port_free(AndroidMTSPort* mtsp)
@@ -255,7 +271,7 @@ _on_multitouch_port_connection(void* opaque,
         case SDKCTL_PORT_DISCONNECTED:
             D("Multi-touch: SDK Controller is disconnected");
             // Disable OpenGLES framebuffer updates.
-            if (android_hw->hw_gpu_enabled) {
+            if (android_hw->hw_gpu_enabled && !multitouch_is_fb_shared()) {
                 android_setPostCallback(NULL, NULL);
             }
             break;
@@ -273,7 +289,7 @@ _on_multitouch_port_connection(void* opaque,
         case SDKCTL_PORT_DISABLED:
             D("Multi-touch: SDK Controller port is disabled.");
             // Disable OpenGLES framebuffer updates.
-            if (android_hw->hw_gpu_enabled) {
+            if (android_hw->hw_gpu_enabled && !multitouch_is_fb_shared()) {
                 android_setPostCallback(NULL, NULL);
             }
             break;
@@ -439,7 +455,9 @@ mts_port_send_frame(AndroidMTSPort* mtsp,
 
     /* Compress framebuffer region. 10% quality seems to be sufficient. */
     fmt->format = MTFB_JPEG;
+    const uint64_t encode_start = _mts_port_now_us();
     _fb_compress(mtsp, fmt, fb, 10, ydir);
+    const uint64_t encode_us = _mts_port_now_us() - encode_start;
 
     /* Total size of the update data: header + JPEG image. */
     const int update_size =
@@ -465,8 +483,14 @@ mts_port_send_frame(AndroidMTSPort* mtsp,
     /* Send update to the device. */
     sdkctl_direct_packet_send(mtsp->fb_packet, msg, cb, cb_opaque);
 
-    T("Multi-touch: Sent %d bytes in framebuffer update. Compression rate is %.2f%%",
-      update_size, comp_rate);
+    mtsp->frames_sent++;
+    mtsp->bytes_sent += update_size;
+    mtsp->encode_us += encode_us;
+    T("Multi-touch: Sent %d bytes in framebuffer update. Compression rate is %.2f%%, "
+      "encoded in %llu us. Average per frame: %llu bytes, %llu us",
+      update_size, comp_rate, (unsigned long long)encode_us,
+      (unsigned long long)(mtsp->bytes_sent / mtsp->frames_sent),
+      (unsigned long long)(mtsp->encode_us / mtsp->frames_sent));
 
     return 0;
 }
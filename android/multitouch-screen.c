@@ -19,12 +19,15 @@
 #include "android/display-core.h"
 #include "android/globals.h"  /* for android_hw */
 #include "android/hw-events.h"
+#include "android/multitouch-fb.h"
+#include "android/opengles.h"
 #include "android/skin/charmap.h"
 #include "android/user-events.h"
 #include "android/utils/misc.h"
 #include "android/utils/debug.h"
 
 #include "qemu-common.h"
+#include "qemu/thread.h"
 
 #define  E(...)    derror(__VA_ARGS__)
 #define  W(...)    dwarning(__VA_ARGS__)
@@ -42,6 +45,9 @@
 
 /* Maximum number of pointers, supported by multi-touch emulation. */
 #define MTS_POINTERS_NUM    10
+/* Environment variable that contains a path of the file where the framebuffer
+ * is shared with a consumer running on the same host (see multitouch-fb.h). */
+#define MTS_FB_SHM_ENV      "ANDROID_MTS_FB_SHM"
 /* Signals that pointer is not tracked (or is "up"). */
 #define MTS_POINTER_UP      -1
 /* Special tracking ID for a mouse pointer. */
@@ -86,6 +92,14 @@ typedef struct MTSState {
     int             ydir;
     /* Current framebuffer pointer. */
     uint8_t*        current_fb;
+    /* Shadow framebuffer, used to drop the parts of the framebuffer updates
+     * that haven't really changed. */
+    MTFbShadow      shadow;
+    /* Protects the shadow framebuffer and the framebuffer update state. The
+     * OpenGLES renderer posts frames from its own thread, while the pending
+     * updates are compressed from the shadow framebuffer on the main thread
+     * once the previous one has been sent. */
+    QemuMutex       fb_lock;
 } MTSState;
 
 /* Default multi-touch screen descriptor */
@@ -251,7 +265,10 @@ _on_fb_sent(void* opaque, SDKCtlDirectPacket* packet, AsyncIOState status)
 {
     MTSState* const mts_state = (MTSState*)opaque;
 
+    /* Failures can be reported from within mts_port_send_frame(), with the
+     * lock held, so only take it on success. */
     if (status == ASIO_STATE_SUCCEEDED) {
+        qemu_mutex_lock(&mts_state->fb_lock);
         /* Lets see if we have accumulated more changes while transmission has been
          * in progress. */
         if (mts_state->fb_header.w && mts_state->fb_header.h &&
@@ -264,6 +281,7 @@ _on_fb_sent(void* opaque, SDKCtlDirectPacket* packet, AsyncIOState status)
                 mts_state->fb_transfer_in_progress = 0;
             }
         }
+        qemu_mutex_unlock(&mts_state->fb_lock);
     }
 
     return ASIO_ACTION_DONE;
@@ -323,6 +341,64 @@ _mt_fb_common_update(MTSState* mts_state, int x, int y, int w, int h)
     }
 }
 
+/* Passes a framebuffer update through the shadow framebuffer, and sends the
+ * part of it that has really changed to the device.
+ * Param:
+ *  mts_state - MTS state descriptor.
+ *  fb - Beginning of the framebuffer.
+ *  width, height, bpp, bpl - Framebuffer geometry.
+ *  ydir - Direction in which lines are arranged in the framebuffer.
+ *  x, y, w, h - Defines an updated rectangle inside the framebuffer.
+ */
+static void
+_mt_fb_shadow_update(MTSState* mts_state,
+                     uint8_t* fb,
+                     int width,
+                     int height,
+                     int bpp,
+                     int bpl,
+                     int ydir,
+                     int x, int y, int w, int h)
+{
+    const MTFbRect rect = { x, y, w, h };
+    MTFbRect dirty;
+    int changed;
+
+    qemu_mutex_lock(&mts_state->fb_lock);
+    changed = mtfb_shadow_update(&mts_state->shadow, fb, width, height, bpp,
+                                 bpl, ydir, &rect, &dirty);
+
+    /* Framebuffer properties can change on the fly, so copy them over in every
+     * update. */
+    mts_state->fb_header.bpp = bpp;
+    mts_state->fb_header.disp_width = width;
+    mts_state->fb_header.disp_height = height;
+
+    if (changed < 0) {
+        /* No shadow framebuffer: send the update as is. */
+        mts_state->fb_header.bpl = bpl;
+        mts_state->current_fb = fb;
+        mts_state->ydir = ydir;
+        _mt_fb_common_update(mts_state, x, y, w, h);
+        qemu_mutex_unlock(&mts_state->fb_lock);
+        return;
+    }
+
+    /* Send updates from the shadow framebuffer, which, unlike the renderer's
+     * buffer, stays valid after the post callback returns. Pending updates
+     * are compressed from it with the lock held, so they always see whole
+     * frames. */
+    mts_state->fb_header.bpl = mts_state->shadow.header->bpl;
+    mts_state->current_fb = mts_state->shadow.pixels;
+    mts_state->ydir = 1;
+    if (changed) {
+        T("Multi-touch: %d tiles changed: %d:%d -> %dx%d",
+          changed, dirty.x, dirty.y, dirty.w, dirty.h);
+        _mt_fb_common_update(mts_state, dirty.x, dirty.y, dirty.w, dirty.h);
+    }
+    qemu_mutex_unlock(&mts_state->fb_lock);
+}
+
 /* A callback invoked on framebuffer updates by software renderer.
  * Param:
  *  opaque - MTSState instance.
@@ -337,17 +413,9 @@ _mt_fb_update(void* opaque, int x, int y, int w, int h)
     T("Multi-touch: Software renderer framebuffer update: %d:%d -> %dx%d",
       x, y, w, h);
 
-    /* TODO: For sofware renderer general framebuffer properties can change on
-     * the fly. Find a callback that can catch that. For now, just copy FB
-     * properties over in every FB update. */
-    mts_state->fb_header.bpp = surface->pf.bytes_per_pixel;
-    mts_state->fb_header.bpl = surface->linesize;
-    mts_state->fb_header.disp_width = surface->width;
-    mts_state->fb_header.disp_height = surface->height;
-    mts_state->current_fb = surface->data;
-    mts_state->ydir = 1;
-
-    _mt_fb_common_update(mts_state, x, y, w, h);
+    _mt_fb_shadow_update(mts_state, surface->data, surface->width,
+                         surface->height, surface->pf.bytes_per_pixel,
+                         surface->linesize, 1, x, y, w, h);
 }
 
 void
@@ -365,16 +433,9 @@ multitouch_opengles_fb_update(void* context,
 
     T("Multi-touch: openGLES framebuffer update: 0:0 -> %dx%d", w, h);
 
-    /* GLES format is always RGBA8888 */
-    mts_state->fb_header.bpp = 4;
-    mts_state->fb_header.bpl = 4 * w;
-    mts_state->fb_header.disp_width = w;
-    mts_state->fb_header.disp_height = h;
-    mts_state->current_fb = pixels;
-    mts_state->ydir = ydir;
-
-    /* GLES emulator alwas update the entire framebuffer. */
-    _mt_fb_common_update(mts_state, 0, 0, w, h);
+    /* GLES format is always RGBA8888, and the emulator always updates the
+     * entire framebuffer. */
+    _mt_fb_shadow_update(mts_state, pixels, w, h, 4, 4 * w, ydir, 0, 0, w, h);
 }
 
 void
@@ -388,10 +449,12 @@ multitouch_refresh_screen(void)
     }
 
     /* Lets see if any updates have been received so far. */
+    qemu_mutex_lock(&mts_state->fb_lock);
     if (NULL != mts_state->current_fb) {
         _mt_fb_common_update(mts_state, 0, 0, mts_state->fb_header.disp_width,
                              mts_state->fb_header.disp_height);
     }
+    qemu_mutex_unlock(&mts_state->fb_lock);
 }
 
 void
@@ -399,6 +462,8 @@ multitouch_fb_updated(void)
 {
     MTSState* const mts_state = &_MTSState;
 
+    qemu_mutex_lock(&mts_state->fb_lock);
+
     /* This concludes framebuffer update. */
     mts_state->fb_transfer_in_progress = 0;
 
@@ -413,6 +478,8 @@ multitouch_fb_updated(void)
             mts_state->fb_transfer_in_progress = 0;
         }
     }
+
+    qemu_mutex_unlock(&mts_state->fb_lock);
 }
 
 void
@@ -437,6 +504,8 @@ multitouch_init(AndroidMTSPort* mtsp)
         mts_state->mtsp = mtsp;
         mts_state->fb_header.header_size = sizeof(MTFrameHeader);
         mts_state->fb_transfer_in_progress = 0;
+        mtfb_shadow_init(&mts_state->shadow, getenv(MTS_FB_SHM_ENV));
+        qemu_mutex_init(&mts_state->fb_lock);
 
         /*
          * Set framebuffer update listener.
@@ -459,9 +528,21 @@ multitouch_init(AndroidMTSPort* mtsp)
         register_displayupdatelistener(ds, dul);
 
         _is_mt_initialized = 1;
+
+        /* A local consumer of the shared framebuffer needs OpenGLES
+         * framebuffer updates whether or not the device is connected. */
+        if (multitouch_is_fb_shared() && android_hw->hw_gpu_enabled) {
+            android_setPostCallback(multitouch_opengles_fb_update, NULL);
+        }
     }
 }
 
+int
+multitouch_is_fb_shared(void)
+{
+    return _MTSState.shadow.shm_path != NULL;
+}
+
 void
 multitouch_update_pointer(MTESource source,
                           int tracking_id,
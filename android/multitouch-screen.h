@@ -103,4 +103,11 @@ extern void multitouch_refresh_screen(void);
 /* Framebuffer update has been handled by the device. */
 extern void multitouch_fb_updated(void);
 
+/* Checks if the framebuffer is shared with a local consumer, in which case
+ * OpenGLES framebuffer updates must stay enabled when the device disconnects.
+ * The framebuffer is shared when the ANDROID_MTS_FB_SHM environment variable
+ * contains the path of the file to map it to (see multitouch-fb.h).
+ */
+extern int multitouch_is_fb_shared(void);
+
 #endif  /* ANDROID_MULTITOUCH_SCREEN_H_ */
@@ -16,14 +16,13 @@
 
 #include "android/base/async/Looper.h"
 #include "android/base/Log.h"
-#include "android/base/synchronization/Lock.h"
 #include "android/base/sockets/SocketUtils.h"
-#include "android/base/synchronization/MessageChannel.h"
 
 #include <stdlib.h>
 #include <string.h>
 
 #ifdef _WIN32
+#include <windows.h>
 #undef ERROR
 #endif
 
@@ -31,29 +30,80 @@ namespace android {
 namespace opengl {
 
 using android::base::Looper;
-using android::base::MessageChannel;
 
 namespace {
 
-// A small structure to model a single frame of the GPU display,
-// as passed between the EmuGL and main loop thread.
+#ifdef _WIN32
+typedef LONG AtomicType;
+#else
+typedef int AtomicType;
+#endif
+
+// Atomically replace |*ptr| with |value| and return its previous value.
+// This is a full memory barrier.
+AtomicType atomicExchange(AtomicType volatile* ptr, AtomicType value) {
+#ifdef _WIN32
+    return InterlockedExchange(ptr, value);
+#elif defined(__GNUC__)
+    AtomicType old;
+    do {
+        old = *ptr;
+    } while (__sync_val_compare_and_swap(ptr, old, value) != old);
+    return old;
+#else
+#error "Your compiler is not supported"
+#endif
+}
+
+AtomicType atomicAdd(AtomicType volatile* ptr, AtomicType value) {
+#ifdef _WIN32
+    return InterlockedExchangeAdd(ptr, value) + value;
+#elif defined(__GNUC__)
+    return __sync_add_and_fetch(ptr, value);
+#else
+#error "Your compiler is not supported"
+#endif
+}
+
+// A small structure to model a single frame of the GPU display. Its pixel
+// buffer is reused for the following frames.
 struct Frame {
     int width;
     int height;
     void* pixels;
+    size_t capacity;
 
-    Frame(int w, int h, const void* pixels) :
-            width(w), height(h), pixels(NULL) {
-        this->pixels = ::calloc(w * 4, h);
-        ::memcpy(this->pixels, pixels, w * 4 * h);
-    }
+    Frame() : width(0), height(0), pixels(NULL), capacity(0) {}
 
     ~Frame() {
         ::free(pixels);
     }
+
+    // Copy a new image into this frame. Return false if out of memory.
+    bool set(int w, int h, const void* src) {
+        size_t size = static_cast<size_t>(w) * 4 * h;
+        if (size > capacity) {
+            void* newPixels = ::realloc(pixels, size);
+            if (!newPixels) {
+                return false;
+            }
+            pixels = newPixels;
+            capacity = size;
+        }
+        ::memcpy(pixels, src, size);
+        width = w;
+        height = h;
+        return true;
+    }
 };
 
 // Real implementation of GpuFrameBridge interface.
+//
+// Frames are triple-buffered: the EmuGL thread owns the 'back' frame, which
+// it fills, the looper thread owns the 'front' frame, which it passes to the
+// callback, and the third one sits in between. Each thread swaps its frame
+// with the middle one with a single atomic exchange, so neither ever waits
+// for the other, and frames are never copied after postFrame().
 class Bridge : public GpuFrameBridge {
 public:
     // Constructor.
@@ -63,7 +113,12 @@ public:
             mInSocket(-1),
             mOutSocket(-1),
             mFdWatch(NULL),
-            mFrames(),
+            mBackIndex(0),
+            mFrontIndex(1),
+            mMiddle(2),
+            mProduced(0),
+            mConsumed(0),
+            mDropped(0),
             mCallback(callback),
             mCallbackOpaque(callbackOpaque) {
         if (::android::base::socketCreatePair(&mInSocket, &mOutSocket) < 0) {
@@ -97,33 +152,60 @@ public:
         if (mInSocket < 0) {
             return;
         }
-        Frame* frame = new Frame(width, height, pixels);
-        ::memcpy(frame->pixels, pixels, width * 4 * height);
-        mFrames.send(frame);
-        char c = 1;
-        android::base::socketSend(mInSocket, &c, 1);
+        if (!mFrames[mBackIndex].set(width, height, pixels)) {
+            LOG(ERROR) << "Could not allocate frame";
+            return;
+        }
+        atomicAdd(&mProduced, 1);
+
+        AtomicType old = atomicExchange(&mMiddle, mBackIndex | kFreshBit);
+        mBackIndex = old & kIndexMask;
+        if (old & kFreshBit) {
+            // The looper thread didn't pick up the previous frame yet, and
+            // has already been woken up for it.
+            atomicAdd(&mDropped, 1);
+        } else {
+            char c = 1;
+            android::base::socketSend(mInSocket, &c, 1);
+        }
+    }
+
+    virtual void getStats(Stats* stats) {
+        // atomicAdd() is only used for its barrier.
+        stats->produced = atomicAdd(&mProduced, 0);
+        stats->consumed = atomicAdd(&mConsumed, 0);
+        stats->dropped = atomicAdd(&mDropped, 0);
     }
 
 private:
     enum {
-        kMaxFrames = 16
+        kNumFrames = 3,
+        // Set in |mMiddle| when the middle frame hasn't been consumed.
+        kFreshBit = 4,
+        kIndexMask = 3,
     };
 
-    // Called from the looper thread when a new Frame instance is available.
+    // Called from the looper thread to pass the latest frame, if any, to
+    // the callback.
+    void consumeFrame() {
+        // Only this thread clears kFreshBit.
+        if (!(atomicAdd(&mMiddle, 0) & kFreshBit)) {
+            return;
+        }
+        AtomicType old = atomicExchange(&mMiddle, mFrontIndex);
+        mFrontIndex = old & kIndexMask;
+        const Frame& frame = mFrames[mFrontIndex];
+        mCallback(mCallbackOpaque, frame.width, frame.height, frame.pixels);
+        atomicAdd(&mConsumed, 1);
+    }
+
+    // Called from the looper thread when a new frame is available.
     static void onSocketEvent(void* opaque, int fd, unsigned events) {
         Bridge* bridge = reinterpret_cast<Bridge*>(opaque);
         if (events & Looper::FdWatch::kEventRead) {
             char c = 0;
             android::base::socketRecv(bridge->mOutSocket, &c, 1);
-            Frame* frame = NULL;
-            bridge->mFrames.receive(&frame);
-            if (frame) {
-                bridge->mCallback(bridge->mCallbackOpaque,
-                                  frame->width,
-                                  frame->height,
-                                  frame->pixels);
-                delete frame;
-            }
+            bridge->consumeFrame();
         }
     }
 
@@ -131,7 +213,16 @@ private:
     int mInSocket;
     int mOutSocket;
     Looper::FdWatch* mFdWatch;
-    MessageChannel<Frame*, kMaxFrames> mFrames;
+    Frame mFrames[kNumFrames];
+    // Index of the frame owned by the EmuGL thread.
+    int mBackIndex;
+    // Index of the frame owned by the looper thread.
+    int mFrontIndex;
+    // Index of the third frame, plus kFreshBit.
+    AtomicType volatile mMiddle;
+    AtomicType volatile mProduced;
+    AtomicType volatile mConsumed;
+    AtomicType volatile mDropped;
     Callback* mCallback;
     void* mCallbackOpaque;
 };
@@ -38,13 +38,17 @@ namespace opengl {
 //  2) In the EmuGL callback, which runs in its own EmuGL thread, call the
 //     postFrame() method.
 //
+// Only the latest frame matters: if the main loop is late, frames that it
+// hasn't picked up yet are replaced by newer ones, and postFrame() never
+// waits for it.
+//
 class GpuFrameBridge {
 public:
     // Type of function that is called to transfer the content of a new
     // GPU frame to the main thread. |opaque| is a user-provided pointer,
     // |width| and |height| are dimensions in pixels, and |pixels| is
-    // the memory buffer of 32-bit RGBA image data. This buffer is freed
-    // when the function returns.
+    // the memory buffer of 32-bit RGBA image data. This buffer is only
+    // valid until the function returns.
     typedef void (Callback)(void* opaque,
                             int width,
                             int height,
@@ -63,6 +67,20 @@ public:
     // Post a new frame from the EmuGL thread.
     virtual void postFrame(int width, int height, const void* pixels) = 0;
 
+    // Frame counters. Once the main loop has caught up, |produced| is
+    // the sum of |consumed| and |dropped|.
+    struct Stats {
+        // Number of frames passed to postFrame().
+        unsigned produced;
+        // Number of frames passed to the callback.
+        unsigned consumed;
+        // Number of frames replaced by a newer one before being consumed.
+        unsigned dropped;
+    };
+
+    // Retrieve the current frame counters. Can be called from any thread.
+    virtual void getStats(Stats* stats) = 0;
+
 protected:
     GpuFrameBridge() {}
     GpuFrameBridge(const GpuFrameBridge& other);
@@ -17,18 +17,27 @@
 #include "android/base/async/Looper.h"
 #include "android/base/Log.h"
 #include "android/base/memory/ScopedPtr.h"
+#include "android/base/threads/Thread.h"
 
 #include <gtest/gtest.h>
 
 #include <errno.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+
 namespace android {
 namespace opengl {
 
 using android::base::ScopedPtr;
 using android::base::Looper;
+using android::base::Thread;
 
 namespace {
 
@@ -96,6 +105,121 @@ private:
     Frame* mFrames[kMaxFrames];
 };
 
+void sleepUs(int us) {
+#ifdef _WIN32
+    ::Sleep((us + 999) / 1000);
+#else
+    ::usleep(us);
+#endif
+}
+
+const int kStressWidth = 16;
+const int kStressHeight = 16;
+const int kStressPixels = kStressWidth * kStressHeight;
+
+// Posts |count| frames, each filled with its index, pausing |pauseUs| every
+// |pauseEvery| frames.
+class ProducerThread : public Thread {
+public:
+    ProducerThread(GpuFrameBridge* bridge,
+                   int count,
+                   int pauseEvery,
+                   int pauseUs) :
+            Thread(),
+            mBridge(bridge),
+            mCount(count),
+            mPauseEvery(pauseEvery),
+            mPauseUs(pauseUs) {}
+
+    virtual intptr_t main() {
+        uint32_t pixels[kStressPixels];
+        for (int n = 0; n < mCount; ++n) {
+            for (int i = 0; i < kStressPixels; ++i) {
+                pixels[i] = static_cast<uint32_t>(n);
+            }
+            mBridge->postFrame(kStressWidth, kStressHeight, pixels);
+            if ((n + 1) % mPauseEvery == 0) {
+                sleepUs(mPauseUs);
+            }
+        }
+        return 0;
+    }
+
+private:
+    GpuFrameBridge* mBridge;
+    int mCount;
+    int mPauseEvery;
+    int mPauseUs;
+};
+
+// Checks that frames arrive intact and in order, sleeping |delayUs| in
+// each callback to emulate a slow consumer.
+struct FrameChecker {
+    int delayUs;
+    int numFrames;
+    int lastIndex;
+    int errors;
+
+    explicit FrameChecker(int delay) :
+            delayUs(delay), numFrames(0), lastIndex(-1), errors(0) {}
+
+    static void check(void* context, int w, int h, const void* pixels) {
+        FrameChecker* checker = reinterpret_cast<FrameChecker*>(context);
+        const uint32_t* data = reinterpret_cast<const uint32_t*>(pixels);
+        int index = static_cast<int>(data[0]);
+        if (w != kStressWidth || h != kStressHeight ||
+            index <= checker->lastIndex) {
+            checker->errors++;
+        }
+        for (int i = 1; i < kStressPixels; ++i) {
+            if (data[i] != data[0]) {
+                checker->errors++;
+                break;
+            }
+        }
+        checker->lastIndex = index;
+        checker->numFrames++;
+        if (checker->delayUs) {
+            sleepUs(checker->delayUs);
+        }
+    }
+};
+
+// Run a producer thread against a consumer running |looper|, and check the
+// final counters.
+void runStressTest(int numFrames,
+                   int pauseEvery,
+                   int pauseUs,
+                   int consumerDelayUs) {
+    ScopedPtr<Looper> looper(Looper::create());
+    ASSERT_TRUE(looper.get());
+    FrameChecker checker(consumerDelayUs);
+    ScopedPtr<GpuFrameBridge> bridge(GpuFrameBridge::create(
+            looper.get(), FrameChecker::check, &checker));
+
+    ProducerThread producer(bridge.get(), numFrames, pauseEvery, pauseUs);
+    ASSERT_TRUE(producer.start());
+
+    GpuFrameBridge::Stats stats;
+    for (int n = 0; n < 2000; ++n) {
+        looper->runWithTimeoutMs(5);
+        bridge->getStats(&stats);
+        if (stats.produced == static_cast<unsigned>(numFrames) &&
+            stats.consumed + stats.dropped == stats.produced) {
+            break;
+        }
+    }
+    EXPECT_TRUE(producer.wait(NULL));
+
+    bridge->getStats(&stats);
+    EXPECT_EQ(static_cast<unsigned>(numFrames), stats.produced);
+    EXPECT_EQ(stats.produced, stats.consumed + stats.dropped);
+    EXPECT_EQ(static_cast<unsigned>(checker.numFrames), stats.consumed);
+    EXPECT_EQ(0, checker.errors);
+    // The latest frame always wins.
+    EXPECT_EQ(numFrames - 1, checker.lastIndex);
+}
+
 }  // namespace
 
 TEST(GpuFrameBridge, postFrameWithinSingleThread) {
@@ -126,5 +250,44 @@ TEST(GpuFrameBridge, postFrameWithinSingleThread) {
     }
 }
 
+TEST(GpuFrameBridge, keepsLatestFrame) {
+    ScopedPtr<Looper> looper(Looper::create());
+    ASSERT_TRUE(looper.get());
+
+    FrameList list;
+    ScopedPtr<GpuFrameBridge> bridge(
+            GpuFrameBridge::create(looper.get(), FrameList::add, &list));
+
+    uint32_t pixels[4];
+    for (uint32_t n = 0; n < 5; ++n) {
+        for (int i = 0; i < 4; ++i) {
+            pixels[i] = n;
+        }
+        bridge->postFrame(2, 2, pixels);
+    }
+
+    EXPECT_EQ(ETIMEDOUT, looper->runWithTimeoutMs(100));
+
+    ASSERT_EQ(1, list.count());
+    const Frame* frame = list.get(0);
+    EXPECT_EQ(2, frame->width);
+    EXPECT_EQ(2, frame->height);
+    EXPECT_EQ(0, ::memcmp(pixels, frame->pixels, sizeof(pixels)));
+
+    GpuFrameBridge::Stats stats;
+    bridge->getStats(&stats);
+    EXPECT_EQ(5U, stats.produced);
+    EXPECT_EQ(1U, stats.consumed);
+    EXPECT_EQ(4U, stats.dropped);
+}
+
+TEST(GpuFrameBridge, stressFastProducer) {
+    runStressTest(5000, 100, 1000, 200);
+}
+
+TEST(GpuFrameBridge, stressFastConsumer) {
+    runStressTest(500, 1, 200, 0);
+}
+
 }  // namespace opengl
 }  // namespace android
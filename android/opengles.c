@@ -48,6 +48,11 @@ typedef void* FBNativeWindowType;
 #define STREAM_MODE_UNIX      2
 #define STREAM_MODE_PIPE      3
 
+typedef struct {
+    unsigned char* data;
+    size_t size;
+} RenderChannelBuffer;
+
 #define RENDERER_FUNCTIONS_LIST \
   FUNCTION_(int, initLibrary, (void), ()) \
   FUNCTION_(int, setStreamMode, (int mode), (mode)) \
@@ -60,6 +65,16 @@ typedef void* FBNativeWindowType;
   FUNCTION_VOID_(repaintOpenGLDisplay, (void), ()) \
   FUNCTION_(int, stopOpenGLRenderer, (void), ()) \
 
+/* Functions that older renderer libraries don't provide. The corresponding
+ * features are disabled when they are missing. */
+#define RENDERER_OPTIONAL_FUNCTIONS_LIST \
+  FUNCTION_(void*, openRenderChannel, (void), ()) \
+  FUNCTION_(int, renderChannelGetNotifyFd, (void* channel), (channel)) \
+  FUNCTION_(int, renderChannelSend, (void* channel, const RenderChannelBuffer* buffers, int numBuffers), (channel, buffers, numBuffers)) \
+  FUNCTION_(int, renderChannelRecv, (void* channel, RenderChannelBuffer* buffers, int numBuffers), (channel, buffers, numBuffers)) \
+  FUNCTION_(unsigned, renderChannelPoll, (void* channel, unsigned wanted), (channel, wanted)) \
+  FUNCTION_VOID_(closeRenderChannel, (void* channel), (channel)) \
+
 #include <stdio.h>
 #include <stdlib.h>
 
@@ -81,9 +96,13 @@ typedef void* FBNativeWindowType;
 #define FUNCTION_VOID_(name, sig, params) \
         static void (*name) sig = NULL;
 RENDERER_FUNCTIONS_LIST
+RENDERER_OPTIONAL_FUNCTIONS_LIST
 #undef FUNCTION_
 #undef FUNCTION_VOID_
 
+// True if all the functions from RENDERER_OPTIONAL_FUNCTIONS_LIST were found.
+static bool hasRenderChannels;
+
 // Define a function that initializes the function pointers by looking up
 // the symbols from the shared library.
 static int
@@ -104,6 +123,21 @@ initOpenglesEmulationFuncs(ADynamicLibrary* rendererLib)
 #define FUNCTION_VOID_(name, sig, params) FUNCTION_(void, name, sig, params)
 RENDERER_FUNCTIONS_LIST
 #undef FUNCTION_VOID_
+#undef FUNCTION_
+
+#define FUNCTION_(ret, name, sig, params) \
+    symbol = adynamicLibrary_findSymbol(rendererLib, #name, &error); \
+    if (symbol != NULL) { \
+        name = symbol; \
+    } else { \
+        D("GLES emulation: Optional symbol not found (%s): %s", #name, error); \
+        free(error); \
+        hasRenderChannels = false; \
+    }
+#define FUNCTION_VOID_(name, sig, params) FUNCTION_(void, name, sig, params)
+    hasRenderChannels = true;
+RENDERER_OPTIONAL_FUNCTIONS_LIST
+#undef FUNCTION_VOID_
 #undef FUNCTION_
 
     return 0;
@@ -318,3 +352,50 @@ android_gles_server_path(char* buff, size_t buffsize)
 {
     strncpy_safe(buff, rendererAddress, buffsize);
 }
+
+void*
+android_gles_channel_open(void)
+{
+    if (!rendererStarted || !hasRenderChannels) {
+        return NULL;
+    }
+    return openRenderChannel();
+}
+
+int
+android_gles_channel_notify_fd(void* channel)
+{
+    return renderChannelGetNotifyFd(channel);
+}
+
+int
+android_gles_channel_send(void* channel,
+                          const AndroidGlesBuffer* buffers,
+                          int numBuffers)
+{
+    return renderChannelSend(channel,
+                             (const RenderChannelBuffer*)buffers,
+                             numBuffers);
+}
+
+int
+android_gles_channel_recv(void* channel,
+                          AndroidGlesBuffer* buffers,
+                          int numBuffers)
+{
+    return renderChannelRecv(channel,
+                             (RenderChannelBuffer*)buffers,
+                             numBuffers);
+}
+
+unsigned
+android_gles_channel_poll(void* channel, unsigned wanted)
+{
+    return renderChannelPoll(channel, wanted);
+}
+
+void
+android_gles_channel_close(void* channel)
+{
+    closeRenderChannel(channel);
+}
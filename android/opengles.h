@@ -13,6 +13,7 @@
 #define ANDROID_OPENGLES_H
 
 #include <stddef.h>
+#include <stdint.h>
 
 #include "android/utils/compiler.h"
 
@@ -67,6 +68,52 @@ extern int  android_gles_fast_pipes;
  */
 void android_gles_server_path(char* buff, size_t buffsize);
 
+/* In-process channels to the renderer, used instead of a socket by the
+ * OpenGLES pipe when the renderer supports them. See the description of
+ * the renderChannelXXX() functions in render_api.entries.
+ */
+
+/* Layout-compatible with GoldfishPipeBuffer. */
+typedef struct {
+    uint8_t* data;
+    size_t   size;
+} AndroidGlesBuffer;
+
+/* Flags returned by android_gles_channel_poll(). */
+#define ANDROID_GLES_CHANNEL_CAN_READ   (1 << 0)
+#define ANDROID_GLES_CHANNEL_CAN_WRITE  (1 << 1)
+#define ANDROID_GLES_CHANNEL_CLOSED     (1 << 2)
+
+/* Open a new channel. Return NULL if the renderer is not started, or doesn't
+ * support channels, in which case the caller should connect to the address
+ * returned by android_gles_server_path() instead.
+ */
+void* android_gles_channel_open(void);
+
+/* Return a file descriptor that becomes readable after an event requested
+ * with android_gles_channel_poll(). The caller must drain it.
+ */
+int android_gles_channel_notify_fd(void* channel);
+
+/* Send or receive data without blocking. Return the number of bytes
+ * transferred, 0 if the channel is full (or empty), or -1 if it is closed.
+ */
+int android_gles_channel_send(void* channel,
+                              const AndroidGlesBuffer* buffers,
+                              int numBuffers);
+int android_gles_channel_recv(void* channel,
+                              AndroidGlesBuffer* buffers,
+                              int numBuffers);
+
+/* Return the current ANDROID_GLES_CHANNEL_XXX state of the channel, and
+ * arrange for the notify file descriptor to be signaled once when any of
+ * the |wanted| flags becomes true.
+ */
+unsigned android_gles_channel_poll(void* channel, unsigned wanted);
+
+/* Close a channel and release it. */
+void android_gles_channel_close(void* channel);
+
 ANDROID_END_HEADER
 
 #endif /* ANDROID_OPENGLES_H */
@@ -10,68 +10,728 @@
 ** GNU General Public License for more details.
 */
 #include "android/tcpdump.h"
+#include "android/utils/debug.h"
+#include "qemu/atomic.h"
+#include "qemu/thread.h"
+#include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <sys/time.h>
+#include <time.h>
+
+/* Packets are captured on the networking path (i.e. the main loop) and
+ * written to disk by a dedicated writer thread. The two sides communicate
+ * through a single-producer / single-consumer ring of variable-sized
+ * records, so the packet path never touches the file system. When the ring
+ * is full, the packet is dropped and accounted for in the stats.
+ *
+ * The capture file uses the pcapng format, with nanosecond timestamps,
+ * see http://www.winpcap.org/ntar/draft/PCAP-DumpFileFormat.html
+ *
+ * The capture specification given to qemu_tcpdump_start() is:
+ *
+ *     <file>[,snaplen=<bytes>][,filter=<expr>][,filesize=<size>][,files=<count>]
+ *
+ * where <size> accepts a k/m/g suffix. When 'filesize' is set, the capture
+ * is rotated each time the current file grows past it: <file> is renamed
+ * to <file>.1, <file>.1 to <file>.2, etc, keeping at most 'files' files
+ * (the default is 2, i.e. <file> and <file>.1).
+ *
+ * <expr> is a tiny subset of the BPF filter syntax: a list of primitives
+ * joined by 'and' / 'or' ('and' binds tighter), each one optionally
+ * preceded by 'not'. Supported primitives are 'arp', 'ip', 'ip6', 'tcp',
+ * 'udp', 'icmp', 'port <num>' and 'host <a.b.c.d>'.
+ */
 
 int  qemu_tcpdump_active;
 
-static FILE*     capture_file;
-static uint64_t  capture_count;
-static uint64_t  capture_size;
-static int       capture_init;
+#define  CAPTURE_RING_SIZE      (1U << 20)
+#define  CAPTURE_RING_MASK      (CAPTURE_RING_SIZE - 1)
+#define  CAPTURE_RECORD_ALIGN   16
 
-static void
-capture_atexit(void)
-{
-    if (qemu_tcpdump_active) {
-        fclose(capture_file);
-        qemu_tcpdump_active = 0;
-    }
-}
+/* record.size value used to mark the unused tail of the ring buffer */
+#define  CAPTURE_RECORD_WRAP    0x80000000U
+
+#define  CAPTURE_DEFAULT_FILES  2
+
+typedef struct {
+    uint32_t  size;      /* total record size, including this header */
+    uint32_t  orig_len;  /* original packet length */
+    uint64_t  ts_ns;     /* capture time, nanoseconds since the Epoch */
+} CaptureRecord;
+
+/* Filter primitives */
+enum {
+    CAPTURE_MATCH_ARP = 0,
+    CAPTURE_MATCH_IP,
+    CAPTURE_MATCH_IP6,
+    CAPTURE_MATCH_TCP,
+    CAPTURE_MATCH_UDP,
+    CAPTURE_MATCH_ICMP,
+    CAPTURE_MATCH_PORT,
+    CAPTURE_MATCH_HOST,
+};
+
+#define  CAPTURE_FILTER_MAX  16
+
+typedef struct {
+    uint8_t   kind;
+    uint8_t   negate;
+    uint8_t   new_group;  /* 1 if this term starts a new 'or' group */
+    uint32_t  value;      /* port number or IPv4 address (host order) */
+} CaptureFilterTerm;
 
-/* See http://wiki.wireshark.org/Development/LibpcapFileFormat for
- * the complete description of the packet capture file format
+typedef struct {
+    /* ring buffer, 'head' is only written by the producer, 'tail' by the
+     * writer thread. Both are free-running counters. */
+    uint8_t*        buffer;
+    uint32_t        head;
+    uint32_t        tail;
+    QemuEvent       event;
+    QemuThread      thread;
+    int             quit;
+
+    /* capture configuration */
+    char*           path;
+    uint32_t        snaplen;
+    uint64_t        max_file_size;
+    int             max_files;
+    int             filter_count;
+    CaptureFilterTerm  filter[CAPTURE_FILTER_MAX];
+
+    /* writer thread state */
+    FILE*           file;
+    uint64_t        file_size;
+
+    /* statistics */
+    uint64_t        count;
+    uint64_t        size;
+    uint64_t        dropped;
+} CaptureState;
+
+static CaptureState  _capture[1];
+static int           capture_init;
+
+/* See http://wiki.wireshark.org/Development/PcapNg for the complete
+ * description of the blocks written below.
  */
 
-#define  PCAP_MAGIC     0xa1b2c3d4
-#define  PCAP_MAJOR     2
-#define  PCAP_MINOR     4
-#define  PCAP_SNAPLEN   65535
-#define  PCAP_ETHERNET  1
+#define  PCAPNG_BLOCK_SHB       0x0A0D0D0A
+#define  PCAPNG_BLOCK_IDB       0x00000001
+#define  PCAPNG_BLOCK_EPB       0x00000006
+#define  PCAPNG_BYTE_ORDER      0x1A2B3C4D
+#define  PCAPNG_MAJOR           1
+#define  PCAPNG_MINOR           0
+#define  PCAPNG_OPT_TSRESOL     9
+#define  PCAPNG_SNAPLEN         65535
+#define  PCAPNG_ETHERNET        1
 
 static int
-pcap_write_header( FILE*  out )
+pcapng_write_header( FILE*  out, uint32_t  snaplen )
 {
     typedef struct {
-        uint32_t   magic;
+        uint32_t   block_type;
+        uint32_t   block_len;
+        uint32_t   byte_order;
         uint16_t   version_major;
         uint16_t   version_minor;
-        int32_t    this_zone;
-        uint32_t   sigfigs;
+        uint32_t   section_len_lo;
+        uint32_t   section_len_hi;
+        uint32_t   block_len2;
+    } PcapngSectionHeader;
+
+    typedef struct {
+        uint32_t   block_type;
+        uint32_t   block_len;
+        uint16_t   link_type;
+        uint16_t   reserved;
         uint32_t   snaplen;
-        uint32_t   network;
-    } PcapHeader;
+        uint16_t   tsresol_code;
+        uint16_t   tsresol_len;
+        uint8_t    tsresol[4];   /* 1 byte value + 3 bytes padding */
+        uint16_t   end_code;
+        uint16_t   end_len;
+        uint32_t   block_len2;
+    } PcapngInterface;
+
+    PcapngSectionHeader  shb;
+    PcapngInterface      idb;
+
+    shb.block_type     = PCAPNG_BLOCK_SHB;
+    shb.block_len      = sizeof(shb);
+    shb.byte_order     = PCAPNG_BYTE_ORDER;
+    shb.version_major  = PCAPNG_MAJOR;
+    shb.version_minor  = PCAPNG_MINOR;
+    shb.section_len_lo = 0xffffffff;  /* unknown section length */
+    shb.section_len_hi = 0xffffffff;
+    shb.block_len2     = sizeof(shb);
+
+    memset(&idb, 0, sizeof(idb));
+    idb.block_type   = PCAPNG_BLOCK_IDB;
+    idb.block_len    = sizeof(idb);
+    idb.link_type    = PCAPNG_ETHERNET;
+    idb.snaplen      = snaplen;
+    idb.tsresol_code = PCAPNG_OPT_TSRESOL;
+    idb.tsresol_len  = 1;
+    idb.tsresol[0]   = 9;  /* 10^-9 seconds */
+    idb.block_len2   = sizeof(idb);
+
+    if (fwrite(&shb, sizeof(shb), 1, out) != 1 ||
+        fwrite(&idb, sizeof(idb), 1, out) != 1) {
+        return -1;
+    }
+    return sizeof(shb) + sizeof(idb);
+}
+
+static int
+pcapng_write_packet( FILE*  out, const CaptureRecord*  rec, uint32_t  snaplen )
+{
+    typedef struct {
+        uint32_t  block_type;
+        uint32_t  block_len;
+        uint32_t  interface_id;
+        uint32_t  ts_high;
+        uint32_t  ts_low;
+        uint32_t  incl_len;
+        uint32_t  orig_len;
+    } PcapngPacketHeader;
+
+    static const uint8_t  zeroes[4];
+    PcapngPacketHeader    h;
+    uint32_t              incl_len = rec->orig_len;
+    uint32_t              padding;
+    uint32_t              block_len;
+
+    /* the record size is aligned, so recompute the captured length */
+    if (incl_len > snaplen)
+        incl_len = snaplen;
+
+    padding   = (4 - (incl_len & 3)) & 3;
+    block_len = sizeof(h) + incl_len + padding + sizeof(uint32_t);
+
+    h.block_type   = PCAPNG_BLOCK_EPB;
+    h.block_len    = block_len;
+    h.interface_id = 0;
+    h.ts_high      = (uint32_t)(rec->ts_ns >> 32);
+    h.ts_low       = (uint32_t) rec->ts_ns;
+    h.incl_len     = incl_len;
+    h.orig_len     = rec->orig_len;
+
+    if (fwrite(&h, sizeof(h), 1, out) != 1 ||
+        fwrite(rec + 1, 1, incl_len, out) != incl_len ||
+        fwrite(zeroes, 1, padding, out) != padding ||
+        fwrite(&block_len, sizeof(block_len), 1, out) != 1) {
+        return -1;
+    }
+    return block_len;
+}
+
+static uint64_t
+capture_now_ns( void )
+{
+#if defined(CLOCK_REALTIME) && !defined(_WIN32)
+    struct timespec  ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+#else
+    struct timeval  tv;
+    gettimeofday(&tv, NULL);
+    return (uint64_t)tv.tv_sec * 1000000000ULL + tv.tv_usec * 1000ULL;
+#endif
+}
+
+/***********************************************************************/
+/***********************************************************************/
+/*****                                                             *****/
+/*****               P A C K E T   F I L T E R                     *****/
+/*****                                                             *****/
+/***********************************************************************/
+/***********************************************************************/
+
+#define  ETH_HEADER_LEN     14
+#define  ETH_P_IP_          0x0800
+#define  ETH_P_ARP_         0x0806
+#define  ETH_P_VLAN_        0x8100
+#define  ETH_P_IPV6_        0x86dd
+#define  IPPROTO_ICMP_      1
+#define  IPPROTO_TCP_       6
+#define  IPPROTO_UDP_       17
+#define  IPPROTO_ICMPV6_    58
+
+static uint32_t
+capture_get_be16( const uint8_t*  p )
+{
+    return ((uint32_t)p[0] << 8) | p[1];
+}
+
+static uint32_t
+capture_get_be32( const uint8_t*  p )
+{
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) |
+           ((uint32_t)p[2] << 8)  | p[3];
+}
+
+/* Decoded packet fields used by the filter */
+typedef struct {
+    uint32_t        ethertype;
+    int             proto;      /* IP protocol, or -1 */
+    int             has_addrs;  /* 1 if src/dst below are valid IPv4 */
+    uint32_t        src;
+    uint32_t        dst;
+    int             has_ports;
+    uint32_t        sport;
+    uint32_t        dport;
+} CapturePacketInfo;
+
+static void
+capture_decode_packet( const uint8_t*  p, int  len, CapturePacketInfo*  info )
+{
+    int  off = ETH_HEADER_LEN;
+    int  l4  = -1;
+
+    memset(info, 0, sizeof(*info));
+    info->proto = -1;
+
+    if (len < ETH_HEADER_LEN)
+        return;
+
+    info->ethertype = capture_get_be16(p + 12);
+    if (info->ethertype == ETH_P_VLAN_ && len >= ETH_HEADER_LEN + 4) {
+        info->ethertype = capture_get_be16(p + 16);
+        off += 4;
+    }
+
+    if (info->ethertype == ETH_P_IP_ && len >= off + 20) {
+        const uint8_t*  ip  = p + off;
+        int             ihl = (ip[0] & 15) * 4;
+
+        info->proto     = ip[9];
+        info->has_addrs = 1;
+        info->src       = capture_get_be32(ip + 12);
+        info->dst       = capture_get_be32(ip + 16);
+        /* only the first fragment has a transport header */
+        if ((capture_get_be16(ip + 6) & 0x1fff) == 0)
+            l4 = off + ihl;
+    } else if (info->ethertype == ETH_P_IPV6_ && len >= off + 40) {
+        info->proto = p[off + 6];
+        l4 = off + 40;
+    }
+
+    if (l4 >= 0 && len >= l4 + 4 &&
+        (info->proto == IPPROTO_TCP_ || info->proto == IPPROTO_UDP_)) {
+        info->has_ports = 1;
+        info->sport     = capture_get_be16(p + l4);
+        info->dport     = capture_get_be16(p + l4 + 2);
+    }
+}
+
+static int
+capture_filter_term_match( const CaptureFilterTerm*  term,
+                           const CapturePacketInfo*  info )
+{
+    switch (term->kind) {
+    case CAPTURE_MATCH_ARP:
+        return info->ethertype == ETH_P_ARP_;
+    case CAPTURE_MATCH_IP:
+        return info->ethertype == ETH_P_IP_;
+    case CAPTURE_MATCH_IP6:
+        return info->ethertype == ETH_P_IPV6_;
+    case CAPTURE_MATCH_TCP:
+        return info->proto == IPPROTO_TCP_;
+    case CAPTURE_MATCH_UDP:
+        return info->proto == IPPROTO_UDP_;
+    case CAPTURE_MATCH_ICMP:
+        return info->proto == IPPROTO_ICMP_ ||
+               info->proto == IPPROTO_ICMPV6_;
+    case CAPTURE_MATCH_PORT:
+        return info->has_ports &&
+               (info->sport == term->value || info->dport == term->value);
+    case CAPTURE_MATCH_HOST:
+        return info->has_addrs &&
+               (info->src == term->value || info->dst == term->value);
+    default:
+        return 0;
+    }
+}
+
+/* Returns 1 if the packet must be captured, 0 otherwise */
+static int
+capture_filter_match( CaptureState*  cs, const void*  base, int  len )
+{
+    CapturePacketInfo  info;
+    int                nn, group_ok = 1;
+
+    if (cs->filter_count == 0)
+        return 1;
+
+    capture_decode_packet(base, len, &info);
+
+    for (nn = 0; nn < cs->filter_count; nn++) {
+        const CaptureFilterTerm*  term = &cs->filter[nn];
+        int                       match;
+
+        if (term->new_group && nn > 0) {
+            if (group_ok)
+                return 1;
+            group_ok = 1;
+        }
+        if (!group_ok)
+            continue;
+
+        match = capture_filter_term_match(term, &info);
+        if (term->negate)
+            match = !match;
+        if (!match)
+            group_ok = 0;
+    }
+    return group_ok;
+}
+
+/* Parse a filter expression into 'cs'. Returns 0 on success, -1 on error */
+static int
+capture_filter_parse( CaptureState*  cs, const char*  expr )
+{
+    static const struct {
+        const char*  name;
+        int          kind;
+        int          has_arg;
+    } primitives[] = {
+        { "arp",  CAPTURE_MATCH_ARP,  0 },
+        { "ip",   CAPTURE_MATCH_IP,   0 },
+        { "ip6",  CAPTURE_MATCH_IP6,  0 },
+        { "tcp",  CAPTURE_MATCH_TCP,  0 },
+        { "udp",  CAPTURE_MATCH_UDP,  0 },
+        { "icmp", CAPTURE_MATCH_ICMP, 0 },
+        { "port", CAPTURE_MATCH_PORT, 1 },
+        { "host", CAPTURE_MATCH_HOST, 1 },
+    };
+
+    char*   copy = strdup(expr);
+    char*   save = NULL;
+    char*   tok;
+    int     negate = 0, new_group = 1, expect_term = 1;
+    int     ret = -1;
+
+    cs->filter_count = 0;
+
+    for (tok = strtok_r(copy, " \t", &save); tok != NULL;
+         tok = strtok_r(NULL, " \t", &save)) {
+        CaptureFilterTerm*  term;
+        int                 nn;
+
+        if (!strcmp(tok, "not") || !strcmp(tok, "!")) {
+            negate = !negate;
+            continue;
+        }
+        if (!strcmp(tok, "and") || !strcmp(tok, "&&") ||
+            !strcmp(tok, "or") || !strcmp(tok, "||")) {
+            if (expect_term)
+                goto Exit;
+            new_group   = (tok[0] == 'o' || tok[0] == '|');
+            expect_term = 1;
+            continue;
+        }
+        if (!expect_term || cs->filter_count >= CAPTURE_FILTER_MAX)
+            goto Exit;
+
+        for (nn = 0; nn < (int)(sizeof(primitives)/sizeof(primitives[0])); nn++) {
+            if (!strcmp(tok, primitives[nn].name))
+                break;
+        }
+        if (nn == (int)(sizeof(primitives)/sizeof(primitives[0])))
+            goto Exit;
 
-    PcapHeader  h;
+        term = &cs->filter[cs->filter_count++];
+        term->kind      = primitives[nn].kind;
+        term->negate    = negate;
+        term->new_group = new_group;
+        term->value     = 0;
 
-    h.magic         = PCAP_MAGIC;
-    h.version_major = PCAP_MAJOR;
-    h.version_minor = PCAP_MINOR;
-    h.this_zone     = 0;
-    h.sigfigs       = 0;  /* all tools set it to 0 in practice */
-    h.snaplen       = PCAP_SNAPLEN;
-    h.network       = PCAP_ETHERNET;
+        if (primitives[nn].has_arg) {
+            char*  arg = strtok_r(NULL, " \t", &save);
+            char*  end;
 
-    if (fwrite(&h, sizeof(h), 1, out) != 1) {
+            if (arg == NULL)
+                goto Exit;
+
+            if (term->kind == CAPTURE_MATCH_PORT) {
+                long  port = strtol(arg, &end, 10);
+                if (*end != 0 || port < 0 || port > 65535)
+                    goto Exit;
+                term->value = (uint32_t)port;
+            } else {
+                unsigned  a, b, c, d;
+                char      dummy;
+                if (sscanf(arg, "%u.%u.%u.%u%c", &a, &b, &c, &d, &dummy) != 4 ||
+                    a > 255 || b > 255 || c > 255 || d > 255)
+                    goto Exit;
+                term->value = (a << 24) | (b << 16) | (c << 8) | d;
+            }
+        }
+        negate      = 0;
+        new_group   = 0;
+        expect_term = 0;
+    }
+    if (!expect_term || cs->filter_count == 0)
+        ret = 0;
+
+Exit:
+    if (ret < 0)
+        cs->filter_count = 0;
+    free(copy);
+    return ret;
+}
+
+/***********************************************************************/
+/***********************************************************************/
+/*****                                                             *****/
+/*****               W R I T E R   T H R E A D                     *****/
+/*****                                                             *****/
+/***********************************************************************/
+/***********************************************************************/
+
+static int
+capture_open_file( CaptureState*  cs )
+{
+    int  ret;
+
+    cs->file = fopen(cs->path, "wb");
+    if (cs->file == NULL)
+        return -1;
+
+    /* large stdio buffer, the writer thread is the only user */
+    setvbuf(cs->file, NULL, _IOFBF, 256*1024);
+
+    ret = pcapng_write_header(cs->file, cs->snaplen);
+    if (ret < 0) {
+        fclose(cs->file);
+        cs->file = NULL;
         return -1;
     }
+    cs->file_size = ret;
     return 0;
 }
 
+static void
+capture_rotate_file( CaptureState*  cs )
+{
+    size_t  pathlen = strlen(cs->path);
+    char*   src     = malloc(pathlen + 16);
+    char*   dst     = malloc(pathlen + 16);
+    int     nn;
+
+    fclose(cs->file);
+    cs->file = NULL;
+
+    /* <file>.N-2 -> <file>.N-1, ..., <file> -> <file>.1 */
+    for (nn = cs->max_files - 1; nn > 0; nn--) {
+        if (nn == 1)
+            strcpy(src, cs->path);
+        else
+            sprintf(src, "%s.%d", cs->path, nn - 1);
+        sprintf(dst, "%s.%d", cs->path, nn);
+        /* rename() doesn't overwrite existing files on Windows */
+        remove(dst);
+        rename(src, dst);
+    }
+    free(src);
+    free(dst);
+
+    if (capture_open_file(cs) < 0) {
+        derror("could not rotate packet capture file %s: %s",
+               cs->path, strerror(errno));
+    }
+}
+
+/* Write all records currently in the ring. Returns 1 if anything was
+ * consumed, 0 if the ring was empty. */
+static int
+capture_ring_drain( CaptureState*  cs )
+{
+    uint32_t  head = atomic_read(&cs->head);
+    uint32_t  tail = cs->tail;
+
+    if (head == tail)
+        return 0;
+
+    smp_rmb();
+
+    while (tail != head) {
+        const CaptureRecord*  rec = (const CaptureRecord*)
+                (cs->buffer + (tail & CAPTURE_RING_MASK));
+
+        if (rec->size & CAPTURE_RECORD_WRAP) {
+            tail += rec->size & ~CAPTURE_RECORD_WRAP;
+            continue;
+        }
+
+        if (cs->file != NULL) {
+            int  ret = pcapng_write_packet(cs->file, rec, cs->snaplen);
+            if (ret < 0) {
+                atomic_inc(&cs->dropped);
+            } else {
+                cs->file_size += ret;
+                if (cs->max_file_size > 0 &&
+                    cs->file_size >= cs->max_file_size) {
+                    capture_rotate_file(cs);
+                }
+            }
+        } else {
+            atomic_inc(&cs->dropped);
+        }
+        tail += rec->size;
+    }
+
+    /* make sure all reads from the ring are done before releasing it */
+    smp_mb();
+    atomic_set(&cs->tail, tail);
+    return 1;
+}
+
+static void*
+capture_writer_thread( void*  opaque )
+{
+    CaptureState*  cs = opaque;
+
+    for (;;) {
+        qemu_event_reset(&cs->event);
+        if (capture_ring_drain(cs))
+            continue;
+        if (atomic_read(&cs->quit))
+            break;
+        if (cs->file != NULL)
+            fflush(cs->file);
+        qemu_event_wait(&cs->event);
+    }
+    capture_ring_drain(cs);
+    return NULL;
+}
+
+/***********************************************************************/
+/***********************************************************************/
+/*****                                                             *****/
+/*****               P U B L I C   I N T E R F A C E               *****/
+/*****                                                             *****/
+/***********************************************************************/
+/***********************************************************************/
+
+static void
+capture_atexit(void)
+{
+    qemu_tcpdump_stop();
+}
+
+/* Parse a size with an optional k/m/g suffix. Returns 0 on error. */
+static uint64_t
+capture_parse_size( const char*  str )
+{
+    char*     end;
+    uint64_t  size = strtoull(str, &end, 10);
+
+    switch (*end) {
+    case 'k': case 'K': size <<= 10; end++; break;
+    case 'm': case 'M': size <<= 20; end++; break;
+    case 'g': case 'G': size <<= 30; end++; break;
+    }
+    if (*end != 0)
+        return 0;
+    return size;
+}
+
+/* Returns 1 if 'str' starts with one of the options of a capture spec. */
+static int
+capture_is_option( const char*  str )
+{
+    static const char* const  options[] = {
+        "snaplen=", "filter=", "filesize=", "files=",
+    };
+    int  nn;
+
+    for (nn = 0; nn < (int)(sizeof(options)/sizeof(options[0])); nn++) {
+        if (!strncmp(str, options[nn], strlen(options[nn])))
+            return 1;
+    }
+    return 0;
+}
+
+/* Parse '<file>[,<name>=<value>]...'. Options are recognized from the end
+ * of the spec, so that the file path can contain commas. */
+static int
+capture_parse_spec( CaptureState*  cs, const char*  spec )
+{
+    char*  copy = strdup(spec);
+    char*  opt  = NULL;
+    char*  p;
+    int    ret  = 0;
+
+    cs->snaplen       = PCAPNG_SNAPLEN;
+    cs->max_file_size = 0;
+    cs->max_files     = CAPTURE_DEFAULT_FILES;
+    cs->filter_count  = 0;
+
+    /* find the first of the trailing options; option values don't contain
+     * commas */
+    for (p = copy + strlen(copy); p > copy; p--) {
+        if (p[-1] != ',')
+            continue;
+        if (!capture_is_option(p))
+            break;
+        opt = p;
+    }
+    if (opt != NULL)
+        opt[-1] = 0;
+    cs->path = strdup(copy);
+
+    while (opt != NULL && ret == 0) {
+        char*  next  = strchr(opt, ',');
+        char*  value = strchr(opt, '=');
+
+        if (next != NULL)
+            *next++ = 0;
+
+        if (value == NULL) {
+            ret = -1;
+            break;
+        }
+        *value++ = 0;
+
+        if (!strcmp(opt, "snaplen")) {
+            long  snaplen = strtol(value, NULL, 10);
+            if (snaplen <= 0 || snaplen > PCAPNG_SNAPLEN)
+                ret = -1;
+            else
+                cs->snaplen = (uint32_t)snaplen;
+        } else if (!strcmp(opt, "filter")) {
+            ret = capture_filter_parse(cs, value);
+        } else if (!strcmp(opt, "filesize")) {
+            cs->max_file_size = capture_parse_size(value);
+            if (cs->max_file_size == 0)
+                ret = -1;
+        } else if (!strcmp(opt, "files")) {
+            cs->max_files = (int)strtol(value, NULL, 10);
+            if (cs->max_files < 1)
+                ret = -1;
+        } else {
+            ret = -1;
+        }
+        opt = next;
+    }
+    free(copy);
+
+    if (ret < 0) {
+        free(cs->path);
+        cs->path = NULL;
+        errno = EINVAL;
+    }
+    return ret;
+}
+
 int
-qemu_tcpdump_start( const char*  filepath )
+qemu_tcpdump_start( const char*  spec )
 {
+    CaptureState*  cs = _capture;
+
     if (!capture_init) {
         capture_init = 1;
         atexit(capture_atexit);
@@ -79,15 +739,29 @@ qemu_tcpdump_start( const char*  filepath )
 
     qemu_tcpdump_stop();
 
-    if (filepath == NULL)
+    if (spec == NULL)
         return -1;
 
-    capture_file = fopen(filepath, "wb");
-    if (capture_file == NULL)
+    if (capture_parse_spec(cs, spec) < 0)
         return -1;
 
-    if (pcap_write_header(capture_file) < 0)
+    if (capture_open_file(cs) < 0) {
+        free(cs->path);
+        cs->path = NULL;
         return -1;
+    }
+
+    cs->buffer  = malloc(CAPTURE_RING_SIZE);
+    cs->head    = 0;
+    cs->tail    = 0;
+    cs->quit    = 0;
+    cs->count   = 0;
+    cs->size    = 0;
+    cs->dropped = 0;
+
+    qemu_event_init(&cs->event, false);
+    qemu_thread_create(&cs->thread, capture_writer_thread, cs,
+                       QEMU_THREAD_JOINABLE);
 
     qemu_tcpdump_active = 1;
     return 0;
@@ -96,52 +770,84 @@ qemu_tcpdump_start( const char*  filepath )
 void
 qemu_tcpdump_stop( void )
 {
+    CaptureState*  cs = _capture;
+
     if (!qemu_tcpdump_active)
         return;
 
     qemu_tcpdump_active = 0;
 
-    capture_count = 0;
-    capture_size  = 0;
+    atomic_mb_set(&cs->quit, 1);
+    qemu_event_set(&cs->event);
+    qemu_thread_join(&cs->thread);
+    qemu_event_destroy(&cs->event);
 
-    fclose(capture_file);
-    capture_file = NULL;
+    if (cs->file != NULL) {
+        fclose(cs->file);
+        cs->file = NULL;
+    }
+    free(cs->buffer);
+    cs->buffer = NULL;
+    free(cs->path);
+    cs->path = NULL;
 }
 
 void
 qemu_tcpdump_packet( const void*  base, int  len )
 {
-    typedef struct {
-        uint32_t  ts_sec;
-        uint32_t  ts_usec;
-        uint32_t  incl_len;
-        uint32_t  orig_len;
-    } PacketHeader;
+    CaptureState*   cs = _capture;
+    CaptureRecord*  rec;
+    uint32_t        caplen = (uint32_t) len;
+    uint32_t        need, pad, head, tail, offset, contig;
+
+    if (!capture_filter_match(cs, base, len))
+        return;
 
-    PacketHeader    h;
-    struct timeval  now;
-    int             len2 = len;
+    if (caplen > cs->snaplen)
+        caplen = cs->snaplen;
 
-    if (len2 > PCAP_SNAPLEN)
-        len2 = PCAP_SNAPLEN;
+    need = (sizeof(*rec) + caplen + CAPTURE_RECORD_ALIGN - 1) &
+           ~(CAPTURE_RECORD_ALIGN - 1);
 
-    gettimeofday(&now, NULL);
-    h.ts_sec   = (uint32_t) now.tv_sec;
-    h.ts_usec  = (uint32_t) now.tv_usec;
-    h.incl_len = (uint32_t) len2;
-    h.orig_len = (uint32_t) len;
+    head   = cs->head;
+    tail   = atomic_read(&cs->tail);
+    /* don't let writes to the ring pass the read of 'tail' */
+    smp_mb();
 
-    fwrite( &h, sizeof(h), 1, capture_file );
-    fwrite( base, 1, len2, capture_file );
+    offset = head & CAPTURE_RING_MASK;
+    contig = CAPTURE_RING_SIZE - offset;
+    pad    = (contig < need) ? contig : 0;
+
+    if (CAPTURE_RING_SIZE - (head - tail) < need + pad) {
+        atomic_inc(&cs->dropped);
+        return;
+    }
 
-    capture_count += 1;
-    capture_size  += len2;
+    if (pad) {
+        rec = (CaptureRecord*)(cs->buffer + offset);
+        rec->size = CAPTURE_RECORD_WRAP | pad;
+        head  += pad;
+        offset = 0;
+    }
+
+    rec = (CaptureRecord*)(cs->buffer + offset);
+    rec->size     = need;
+    rec->orig_len = (uint32_t) len;
+    rec->ts_ns    = capture_now_ns();
+    memcpy(rec + 1, base, caplen);
+
+    smp_wmb();
+    atomic_set(&cs->head, head + need);
+    qemu_event_set(&cs->event);
+
+    cs->count += 1;
+    cs->size  += caplen;
 }
 
 void
-qemu_tcpdump_stats( uint64_t  *pcount, uint64_t*  psize )
+qemu_tcpdump_stats( uint64_t  *pcount, uint64_t*  psize, uint64_t*  pdropped )
 {
-    *pcount = capture_count;
-    *psize  = capture_size;
+    *pcount   = _capture->count;
+    *psize    = _capture->size;
+    *pdropped = atomic_read(&_capture->dropped);
 }
-
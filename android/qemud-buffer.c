@@ -0,0 +1,119 @@
+/* Copyright (C) 2015 The Android Open Source Project
+**
+** This software is licensed under the terms of the GNU General Public
+** License version 2, as published by the Free Software Foundation, and
+** may be copied, distributed, and modified under those terms.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+*/
+#include "qemu-common.h"
+#include "android/qemud-buffer.h"
+#include "android/utils/misc.h"
+#include "android/utils/system.h"
+#include "android/utils/panic.h"
+
+static QemudBuffer*       _qemud_free_buffers;
+static int                _qemud_free_buffers_count;
+static QemudPipeMessage*  _qemud_free_messages;
+static int                _qemud_free_messages_count;
+
+QemudBuffer*
+qemud_buffer_alloc( int  size )
+{
+    QemudBuffer*  buf;
+
+    if (size <= QEMUD_POOL_BUFFER_SIZE && _qemud_free_buffers != NULL) {
+        buf = _qemud_free_buffers;
+        _qemud_free_buffers = buf->next_free;
+        _qemud_free_buffers_count--;
+    } else {
+        int  capacity = size;
+        if (capacity < QEMUD_POOL_BUFFER_SIZE)
+            capacity = QEMUD_POOL_BUFFER_SIZE;
+
+        /* Data starts right after the descriptor. */
+        buf = malloc(sizeof(*buf) + capacity);
+        if (buf == NULL) {
+            APANIC("Unable to allocate %d bytes for qemud message.", size);
+        }
+        buf->capacity = capacity;
+        buf->data     = (uint8_t*)(buf + 1);
+    }
+    buf->refcount  = 1;
+    buf->size      = size;
+    buf->next_free = NULL;
+    return buf;
+}
+
+void
+qemud_buffer_ref( QemudBuffer*  buf )
+{
+    buf->refcount++;
+}
+
+void
+qemud_buffer_unref( QemudBuffer*  buf )
+{
+    if (--buf->refcount > 0)
+        return;
+
+    if (buf->capacity == QEMUD_POOL_BUFFER_SIZE &&
+        _qemud_free_buffers_count < QEMUD_POOL_MAX_FREE) {
+        buf->next_free = _qemud_free_buffers;
+        _qemud_free_buffers = buf;
+        _qemud_free_buffers_count++;
+    } else {
+        free(buf);
+    }
+}
+
+QemudBuffer*
+qemud_buffer_encode( const struct iovec*  iov, int  iovcnt, int  msglen )
+{
+    QemudBuffer*  buf = qemud_buffer_alloc(QEMUD_FRAME_HEADER_SIZE + msglen);
+    uint8_t*      p   = buf->data + QEMUD_FRAME_HEADER_SIZE;
+    int           n;
+
+    int2hex(buf->data, QEMUD_FRAME_HEADER_SIZE, msglen);
+    for (n = 0; n < iovcnt; n++) {
+        memcpy(p, iov[n].iov_base, iov[n].iov_len);
+        p += iov[n].iov_len;
+    }
+    return buf;
+}
+
+QemudPipeMessage*
+qemud_pipe_message_new( QemudBuffer*  buf, uint8_t*  message, size_t  size )
+{
+    QemudPipeMessage*  msg = _qemud_free_messages;
+
+    if (msg != NULL) {
+        _qemud_free_messages = msg->next;
+        _qemud_free_messages_count--;
+    } else {
+        ANEW0(msg);
+    }
+    qemud_buffer_ref(buf);
+    msg->buffer  = buf;
+    msg->message = message;
+    msg->size    = size;
+    msg->offset  = 0;
+    msg->next    = NULL;
+    return msg;
+}
+
+void
+qemud_pipe_message_free( QemudPipeMessage*  msg )
+{
+    qemud_buffer_unref(msg->buffer);
+    if (_qemud_free_messages_count < QEMUD_POOL_MAX_FREE) {
+        msg->next = _qemud_free_messages;
+        _qemud_free_messages = msg;
+        _qemud_free_messages_count++;
+    } else {
+        AFREE(msg);
+    }
+}
@@ -0,0 +1,112 @@
+/* Copyright (C) 2015 The Android Open Source Project
+**
+** This software is licensed under the terms of the GNU General Public
+** License version 2, as published by the Free Software Foundation, and
+** may be copied, distributed, and modified under those terms.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+*/
+#ifndef _android_qemud_buffer_h
+#define _android_qemud_buffer_h
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct iovec;
+
+/* Buffers for the outgoing messages of qemud services (see hw-qemud.c).
+ *
+ * Messages are encoded once, with room for the frame header in front of the
+ * payload, and the same buffer is then queued to all the clients that must
+ * receive it (see qemud_service_broadcast()). Clients that don't use framing
+ * simply skip the header.
+ *
+ * Small buffers and message descriptors are recycled through free lists,
+ * since high-rate services (e.g. sensors) send lots of short messages.
+ */
+
+/* Size of the frame header, i.e. the message length as 4 hex digits. */
+#define  QEMUD_FRAME_HEADER_SIZE  4
+
+/* Capacity of pooled buffers, larger messages use a dedicated allocation. */
+#define  QEMUD_POOL_BUFFER_SIZE   512
+
+/* Maximum number of free buffers and descriptors kept around. */
+#define  QEMUD_POOL_MAX_FREE      64
+
+/* A reference-counted buffer holding an encoded outgoing message. */
+typedef struct QemudBuffer  QemudBuffer;
+
+struct QemudBuffer {
+    int           refcount;
+    /* Number of bytes used in 'data' */
+    int           size;
+    int           capacity;
+    uint8_t*      data;
+    QemudBuffer*  next_free;
+};
+
+/* Descriptor for a data buffer pending to be sent to a qemud pipe client.
+ *
+ * When a service decides to send data to the client, there could be cases when
+ * client is not ready to read them. In this case there is no GoldfishPipeBuffer
+ * available to write service's data to, So, we need to cache that data into the
+ * client descriptor, and "send" them over to the client in _qemudPipe_recvBuffers
+ * callback. Pending service data is stored in the client descriptor as a list
+ * of QemudPipeMessage instances.
+ */
+typedef struct QemudPipeMessage QemudPipeMessage;
+
+struct QemudPipeMessage {
+    /* Buffer holding the message data. */
+    QemudBuffer*        buffer;
+    /* Message to send. */
+    uint8_t*            message;
+    /* Message size. */
+    size_t              size;
+    /* Offset in the message buffer of the chunk, that has not been sent
+     * to the pipe yet. */
+    size_t              offset;
+    /* Links next message in the client. */
+    QemudPipeMessage*   next;
+};
+
+/* Return a buffer that can hold at least 'size' bytes, with a reference
+ * count of 1. */
+extern QemudBuffer*  qemud_buffer_alloc( int  size );
+
+/* Take a new reference to 'buf'. */
+extern void  qemud_buffer_ref( QemudBuffer*  buf );
+
+/* Drop a reference to 'buf', and recycle or free it when it was the last
+ * one. */
+extern void  qemud_buffer_unref( QemudBuffer*  buf );
+
+/* Encode a message made of 'iovcnt' segments into a new buffer. The buffer
+ * starts with the QEMUD_FRAME_HEADER_SIZE-byte frame header for 'msglen',
+ * which must be the total size of the segments. */
+extern QemudBuffer*  qemud_buffer_encode( const struct iovec*  iov,
+                                          int                  iovcnt,
+                                          int                  msglen );
+
+/* Return a new pipe message descriptor for 'size' bytes of 'buf', starting
+ * at 'message'. This takes a new reference to 'buf'. */
+extern QemudPipeMessage*  qemud_pipe_message_new( QemudBuffer*  buf,
+                                                  uint8_t*      message,
+                                                  size_t        size );
+
+/* Free 'msg' and drop its reference to its buffer. */
+extern void  qemud_pipe_message_free( QemudPipeMessage*  msg );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _android_qemud_buffer_h */
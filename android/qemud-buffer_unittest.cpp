@@ -0,0 +1,245 @@
+// Copyright 2015 The Android Open Source Project
+//
+// This software is licensed under the terms of the GNU General Public
+// License version 2, as published by the Free Software Foundation, and
+// may be copied, distributed, and modified under those terms.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+#include "android/qemud-buffer.h"
+
+#include <gtest/gtest.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/uio.h>
+#include <time.h>
+
+namespace {
+
+struct iovec makeIov(const void* data, size_t size) {
+    struct iovec iov;
+    iov.iov_base = const_cast<void*>(data);
+    iov.iov_len = size;
+    return iov;
+}
+
+}  // namespace
+
+TEST(QemudBuffer, EncodeAddsFrameHeader) {
+    struct iovec iov[2] = { makeIov("hello ", 6), makeIov("world", 5) };
+    QemudBuffer* buf = qemud_buffer_encode(iov, 2, 11);
+    ASSERT_EQ(QEMUD_FRAME_HEADER_SIZE + 11, buf->size);
+    EXPECT_EQ(0, memcmp("000bhello world", buf->data, buf->size));
+    EXPECT_EQ(1, buf->refcount);
+    qemud_buffer_unref(buf);
+}
+
+TEST(QemudBuffer, SmallBuffersAreRecycled) {
+    QemudBuffer* buf = qemud_buffer_alloc(10);
+    EXPECT_EQ(QEMUD_POOL_BUFFER_SIZE, buf->capacity);
+    qemud_buffer_unref(buf);
+    QemudBuffer* buf2 = qemud_buffer_alloc(QEMUD_POOL_BUFFER_SIZE);
+    EXPECT_EQ(buf, buf2);
+    EXPECT_EQ(QEMUD_POOL_BUFFER_SIZE, buf2->size);
+    qemud_buffer_unref(buf2);
+}
+
+TEST(QemudBuffer, LargeBuffersAreNotPooled) {
+    QemudBuffer* buf = qemud_buffer_alloc(QEMUD_POOL_BUFFER_SIZE + 1);
+    EXPECT_EQ(QEMUD_POOL_BUFFER_SIZE + 1, buf->capacity);
+    EXPECT_EQ(QEMUD_POOL_BUFFER_SIZE + 1, buf->size);
+    memset(buf->data, 0x55, buf->size);
+    qemud_buffer_unref(buf);
+}
+
+TEST(QemudBuffer, MessagesShareTheirBuffer) {
+    struct iovec iov = makeIov("ping", 4);
+    QemudBuffer* buf = qemud_buffer_encode(&iov, 1, 4);
+
+    // A framed client and an unframed one, as in qemud_service_broadcast().
+    QemudPipeMessage* framed =
+            qemud_pipe_message_new(buf, buf->data, buf->size);
+    QemudPipeMessage* unframed =
+            qemud_pipe_message_new(buf, buf->data + QEMUD_FRAME_HEADER_SIZE,
+                                   buf->size - QEMUD_FRAME_HEADER_SIZE);
+    qemud_buffer_unref(buf);
+    EXPECT_EQ(2, buf->refcount);
+    EXPECT_EQ(buf, framed->buffer);
+    EXPECT_EQ(8U, framed->size);
+    EXPECT_EQ(0U, framed->offset);
+    EXPECT_EQ(0, memcmp("ping", unframed->message, unframed->size));
+
+    qemud_pipe_message_free(framed);
+    EXPECT_EQ(1, buf->refcount);
+
+    // The descriptor and the buffer are recycled once both are freed.
+    qemud_pipe_message_free(unframed);
+    EXPECT_EQ(buf, qemud_buffer_alloc(1));
+    QemudPipeMessage* msg = qemud_pipe_message_new(buf, buf->data, 1);
+    EXPECT_EQ(unframed, msg);
+    qemud_buffer_unref(buf);
+    qemud_pipe_message_free(msg);
+}
+
+namespace {
+
+// How pipe clients queued messages before QemudBuffer: a separate copy of
+// the frame header and of each 4000-byte chunk, appended by walking the
+// client's list.
+struct LegacyMessage {
+    uint8_t* message;
+    size_t size;
+    size_t offset;
+    LegacyMessage* next;
+};
+
+const int kLegacyChunkSize = 4000;
+
+void legacyCache(LegacyMessage** list, const uint8_t* msg, int msglen) {
+    LegacyMessage* buf =
+            (LegacyMessage*)malloc(msglen + sizeof(LegacyMessage));
+    buf->message = (uint8_t*)buf + sizeof(LegacyMessage);
+    buf->size = msglen;
+    memcpy(buf->message, msg, msglen);
+    buf->offset = 0;
+    buf->next = NULL;
+    while (*list != NULL) {
+        list = &(*list)->next;
+    }
+    *list = buf;
+}
+
+void legacySend(LegacyMessage** list, const uint8_t* msg, int msglen) {
+    uint8_t frame[QEMUD_FRAME_HEADER_SIZE + 1];
+    snprintf((char*)frame, sizeof(frame), "%04x", msglen);
+    legacyCache(list, frame, QEMUD_FRAME_HEADER_SIZE);
+    while (msglen > 0) {
+        int avail = msglen < kLegacyChunkSize ? msglen : kLegacyChunkSize;
+        legacyCache(list, msg, avail);
+        msg += avail;
+        msglen -= avail;
+    }
+}
+
+// Reads everything queued, like the guest would through
+// _qemudPipe_recvBuffers().
+size_t legacyDrain(LegacyMessage** list, uint8_t* guest) {
+    size_t total = 0;
+    while (*list != NULL) {
+        LegacyMessage* msg = *list;
+        memcpy(guest, msg->message, msg->size);
+        total += msg->size;
+        *list = msg->next;
+        free(msg);
+    }
+    return total;
+}
+
+struct Queue {
+    QemudPipeMessage* head;
+    QemudPipeMessage** tail;
+};
+
+void queueSend(Queue* queues, int numQueues,
+               const struct iovec* iov, int iovcnt, int msglen) {
+    QemudBuffer* buf = qemud_buffer_encode(iov, iovcnt, msglen);
+    for (int n = 0; n < numQueues; n++) {
+        QemudPipeMessage* msg =
+                qemud_pipe_message_new(buf, buf->data, buf->size);
+        *queues[n].tail = msg;
+        queues[n].tail = &msg->next;
+    }
+    qemud_buffer_unref(buf);
+}
+
+size_t queueDrain(Queue* queue, uint8_t* guest) {
+    size_t total = 0;
+    while (queue->head != NULL) {
+        QemudPipeMessage* msg = queue->head;
+        memcpy(guest, msg->message, msg->size);
+        total += msg->size;
+        queue->head = msg->next;
+        qemud_pipe_message_free(msg);
+    }
+    queue->tail = &queue->head;
+    return total;
+}
+
+double elapsedUs(clock_t start, int count) {
+    return (double)(clock() - start) * 1e6 / CLOCKS_PER_SEC / count;
+}
+
+// Sends |count| messages made of |numSegments| segments of |segmentSize|
+// bytes to |numClients| clients, letting the guest read them every
+// |burst| messages, and prints the time per message.
+void runBenchmark(const char* name, int count, int burst, int numClients,
+                  int numSegments, int segmentSize) {
+    const int msglen = numSegments * segmentSize;
+    uint8_t* payload = (uint8_t*)calloc(1, msglen);
+    uint8_t* guest = (uint8_t*)malloc(msglen + QEMUD_FRAME_HEADER_SIZE);
+    struct iovec iov[8];
+    for (int n = 0; n < numSegments; n++) {
+        iov[n] = makeIov(payload + n * segmentSize, segmentSize);
+    }
+
+    LegacyMessage* legacy[8] = {};
+    clock_t start = clock();
+    for (int n = 0; n < count; n++) {
+        // Before sendv(), callers sent each segment as its own message,
+        // and broadcast() encoded it again for each client.
+        for (int c = 0; c < numClients; c++) {
+            for (int s = 0; s < numSegments; s++) {
+                legacySend(&legacy[c], payload + s * segmentSize,
+                           segmentSize);
+            }
+        }
+        if ((n + 1) % burst == 0) {
+            for (int c = 0; c < numClients; c++) {
+                legacyDrain(&legacy[c], guest);
+            }
+        }
+    }
+    const double legacyUs = elapsedUs(start, count);
+
+    Queue queues[8];
+    for (int c = 0; c < numClients; c++) {
+        queues[c].head = NULL;
+        queues[c].tail = &queues[c].head;
+    }
+    start = clock();
+    for (int n = 0; n < count; n++) {
+        queueSend(queues, numClients, iov, numSegments, msglen);
+        if ((n + 1) % burst == 0) {
+            for (int c = 0; c < numClients; c++) {
+                queueDrain(&queues[c], guest);
+            }
+        }
+    }
+    const double bufferUs = elapsedUs(start, count);
+
+    printf("%-28s %9.3f us/msg before, %9.3f us/msg now (%.1fx)\n",
+           name, legacyUs, bufferUs, legacyUs / bufferUs);
+    free(guest);
+    free(payload);
+}
+
+}  // namespace
+
+// Compares queuing outgoing messages to pipe clients the way hw-qemud.c did
+// before QemudBuffer with the shared, pooled buffers, for typical traffic.
+// Run with --gtest_also_run_disabled_tests.
+TEST(QemudBufferBenchmark, DISABLED_Benchmark) {
+    // Sensor events, read by the guest in bursts of 10.
+    runBenchmark("sensors, 1 client", 500000, 10, 1, 1, 40);
+    // The same, broadcast to 4 clients.
+    runBenchmark("sensors, 4 clients", 200000, 10, 4, 1, 40);
+    // Deep queues: appending used to walk the whole list.
+    runBenchmark("sensors, 200 queued", 100000, 200, 1, 1, 40);
+    // A 640x480 NV21 camera frame, sent as a header and 3 planes.
+    runBenchmark("camera frame, 4 segments", 500, 1, 1, 4, 115200);
+}
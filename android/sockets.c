@@ -992,6 +992,75 @@ socket_recv(int  fd, void*  buf, int  len)
     SOCKET_CALL(recv(fd, buf, len, 0));
 }
 
+#ifdef _WIN32
+static int
+socket_transferv(int  fd, const SocketIoVec*  vec, int  count, int  is_send)
+{
+    WSABUF  bufs[SOCKET_IOV_MAX];
+    DWORD   transferred = 0;
+    DWORD   flags = 0;
+    int     nn, ret;
+
+    if (count > SOCKET_IOV_MAX)
+        return set_errno(EINVAL);
+
+    for (nn = 0; nn < count; nn++) {
+        bufs[nn].buf = vec[nn].base;
+        bufs[nn].len = vec[nn].len;
+    }
+    if (is_send) {
+        QSOCKET_CALL(ret, WSASend(fd, bufs, count, &transferred, 0, NULL, NULL));
+    } else {
+        QSOCKET_CALL(ret, WSARecv(fd, bufs, count, &transferred, &flags, NULL, NULL));
+    }
+    if (ret != 0)
+        return fix_errno();
+
+    return (int)transferred;
+}
+#else
+static int
+socket_transferv(int  fd, const SocketIoVec*  vec, int  count, int  is_send)
+{
+    struct iovec   iov[SOCKET_IOV_MAX];
+    struct msghdr  msg;
+    int            nn, ret;
+
+    if (count > SOCKET_IOV_MAX)
+        return set_errno(EINVAL);
+
+    for (nn = 0; nn < count; nn++) {
+        iov[nn].iov_base = vec[nn].base;
+        iov[nn].iov_len  = vec[nn].len;
+    }
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov    = iov;
+    msg.msg_iovlen = count;
+
+    if (is_send) {
+        QSOCKET_CALL(ret, sendmsg(fd, &msg, 0));
+    } else {
+        QSOCKET_CALL(ret, recvmsg(fd, &msg, 0));
+    }
+    if (ret < 0)
+        return fix_errno();
+
+    return ret;
+}
+#endif
+
+int
+socket_sendv(int  fd, const SocketIoVec*  vec, int  count)
+{
+    return socket_transferv(fd, vec, count, 1);
+}
+
+int
+socket_recvv(int  fd, const SocketIoVec*  vec, int  count)
+{
+    return socket_transferv(fd, vec, count, 0);
+}
+
 int
 socket_recvfrom(int  fd, void*  buf, int  len, SockAddress*  from)
 {
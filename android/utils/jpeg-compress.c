@@ -11,11 +11,41 @@
 */
 
 #include <stdint.h>
+#include <string.h>
 #include "jinclude.h"
 #include "jpeglib.h"
 #include "jpeg-compress.h"
+#include "worker-pool.h"
 #include "panic.h"
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+/*
+ * Framebuffers are split into horizontal strips of lines that are compressed
+ * in parallel, each as a separate JPEG image. Since all strips are compressed
+ * with the same settings, and the same tables, the entropy-coded data of a
+ * strip is exactly what a single compressor would produce for the same lines
+ * right after a restart marker. So the final image is assembled from the
+ * headers of the first strip, with the image height patched, a DRI marker
+ * that sets the restart interval to the number of MCUs in a strip, and the
+ * entropy-coded data of the strips, separated with RSTn markers.
+ *
+ * The framebuffer is converted to YCbCr, and downsampled to 4:2:0 here, with
+ * SSE2 when available, and fed to jpeglib as raw data. Up to quality 90, the
+ * fast integer DCT is used, which has an SSE2 implementation in jpeglib.
+ */
+
+/* Height of an MCU with 4:2:0 downsampling. Strips are multiples of it. */
+#define JPEG_MCU_LINES      16
+/* Minimum number of lines in a strip. */
+#define JPEG_MIN_STRIP      64
+/* Maximum number of strips. */
+#define JPEG_MAX_STRIPS     8
+/* Quality above which the slow, but accurate DCT is used. */
+#define JPEG_IFAST_MAX_QUALITY  90
+
 /* Implements JPEG destination manager's init_destination routine. */
 static void _on_init_destination(j_compress_ptr cinfo);
 /* Implements JPEG destination manager's empty_output_buffer routine. */
@@ -35,8 +65,33 @@ struct AJPEGDesc {
     int                             chunk_size;
     /* Size of the header to put in front of the compressed data. */
     int                             header_size;
+    /* Number of strips to split large regions into, or 0 for one per
+     * worker pool thread. */
+    int                             strip_count;
+    /* Compressors for the strips of a framebuffer, created on demand. */
+    AJPEGDesc*                      strips[JPEG_MAX_STRIPS];
 };
 
+/* Framebuffer compression job. */
+typedef struct AJPEGJob {
+    /* Framebuffer region, and its properties. See jpeg_compressor_compress_fb.
+     */
+    int             x;
+    int             y;
+    int             w;
+    int             h;
+    int             num_lines;
+    int             bpp;
+    int             bpl;
+    const uint8_t*  fb;
+    int             jpeg_quality;
+    int             ydir;
+    /* Number of lines in a strip. */
+    int             strip_lines;
+    /* Compressors for the strips. */
+    AJPEGDesc**     strips;
+} AJPEGJob;
+
 /********************************************************************************
  *                      jpeglib callbacks.
  *******************************************************************************/
@@ -70,8 +125,11 @@ static boolean
 _on_empty_output_buffer(j_compress_ptr cinfo)
 {
     AJPEGDesc* const dst = (AJPEGDesc*)cinfo->dest;
-    /* Save already compressed data size. */
-    const int accumulated = jpeg_compressor_get_jpeg_size(dst);
+    /* The buffer is full. Don't compute the compressed data size from
+     * 'next_output_byte': the entropy encoder keeps its own copy of the output
+     * pointers while it encodes an MCU, and doesn't update ours before calling
+     * this routine. */
+    const int accumulated = dst->size - dst->header_size;
 
     /* Reallocate output buffer. */
     dst->size += dst->chunk_size;
@@ -116,6 +174,8 @@ jpeg_compressor_create(int header_size, int chunk_size)
     dsc->size                       = 0;
     dsc->chunk_size                 = chunk_size;
     dsc->header_size                = header_size;
+    dsc->strip_count                = 0;
+    memset(dsc->strips, 0, sizeof(dsc->strips));
     return dsc;
 }
 
@@ -123,6 +183,10 @@ void
 jpeg_compressor_destroy(AJPEGDesc* dsc)
 {
     if (dsc != NULL) {
+        int n;
+        for (n = 0; n < JPEG_MAX_STRIPS; n++) {
+            jpeg_compressor_destroy(dsc->strips[n]);
+        }
         if (dsc->jpeg_buf != NULL) {
             free(dsc->jpeg_buf);
         }
@@ -149,59 +213,514 @@ jpeg_compressor_get_header_size(const AJPEGDesc* dsc)
      return dsc->header_size;
 }
 
-void
-jpeg_compressor_compress_fb(AJPEGDesc* dsc,
-                            int x, int y, int w, int h, int num_lines,
-                            int bpp, int bpl,
-                            const uint8_t* fb,
-                            int jpeg_quality,
-                            int ydir){
+/********************************************************************************
+ *                      Framebuffer conversion.
+ *******************************************************************************/
+
+/*
+ * YCbCr conversion uses JFIF coefficients with 15 fractional bits. Chroma is
+ * computed from the sums of 2x2 pixel blocks, which both downsamples it, and
+ * saves multiplications.
+ */
+
+#define Y_R     9798
+#define Y_G     19235
+#define Y_B     3735
+#define CB_R    -5529
+#define CB_G    -10855
+#define CB_B    16384
+#define CR_R    16384
+#define CR_G    -13720
+#define CR_B    -2664
+
+/* Rounding, and offset added to chroma computed from 2x2 pixel sums, before
+ * shifting right by 17 bits. */
+#define CHROMA_BIAS ((1 << 16) + (128 << 17))
+
+static int
+_jpeg_min(int a, int b)
+{
+    return a < b ? a : b;
+}
+
+/* Gets a framebuffer line of a job, given its index in the framebuffer region.
+ */
+static const uint8_t*
+_job_line(const AJPEGJob* job, int line)
+{
+    const int fb_line = job->ydir >= 0 ? job->y + line :
+                                         job->num_lines - 1 - (job->y + line);
+    return job->fb + fb_line * job->bpl + job->x * job->bpp;
+}
+
+/* Gets RGB components of a framebuffer pixel. RGB565 components are expanded
+ * the same way jpeglib does. */
+static void
+_get_rgb(const uint8_t* line, int bpp, int x, int* r, int* g, int* b)
+{
+    if (bpp == 2) {
+        const uint16_t color = ((const uint16_t*)line)[x];
+        *r = ((color & 0xf800) >> 8) | ((color & 0xf800) >> 14);
+        *g = ((color & 0x7e0) >> 3) | ((color & 0x7e0) >> 9);
+        *b = ((color & 0x1f) << 3) | ((color & 0x1f) >> 2);
+    } else {
+        const uint8_t* const pixel = line + x * 4;
+        *r = pixel[0];
+        *g = pixel[1];
+        *b = pixel[2];
+    }
+}
+
+static JSAMPLE
+_luma(int r, int g, int b)
+{
+    return (JSAMPLE)((Y_R * r + Y_G * g + Y_B * b + (1 << 14)) >> 15);
+}
+
+static JSAMPLE
+_chroma(int cr, int cg, int cb, int r4, int g4, int b4)
+{
+    const int value = (cr * r4 + cg * g4 + cb * b4 + CHROMA_BIAS) >> 17;
+    return (JSAMPLE)(value > 255 ? 255 : value);
+}
+
+/* Converts two framebuffer lines, starting at column 'x', into two lines of
+ * luma, and one line of downsampled chroma. */
+static void
+_convert_lines_c(const uint8_t* line0,
+                 const uint8_t* line1,
+                 int x,
+                 int w,
+                 int bpp,
+                 JSAMPLE* y0,
+                 JSAMPLE* y1,
+                 JSAMPLE* cb,
+                 JSAMPLE* cr)
+{
+    for (; x < w; x += 2) {
+        const int x1 = _jpeg_min(x + 1, w - 1);
+        int r00, g00, b00, r01, g01, b01, r10, g10, b10, r11, g11, b11;
+        int r4, g4, b4;
+
+        _get_rgb(line0, bpp, x, &r00, &g00, &b00);
+        _get_rgb(line0, bpp, x1, &r01, &g01, &b01);
+        _get_rgb(line1, bpp, x, &r10, &g10, &b10);
+        _get_rgb(line1, bpp, x1, &r11, &g11, &b11);
+
+        y0[x] = _luma(r00, g00, b00);
+        y1[x] = _luma(r10, g10, b10);
+        if (x + 1 < w) {
+            y0[x + 1] = _luma(r01, g01, b01);
+            y1[x + 1] = _luma(r11, g11, b11);
+        }
+
+        r4 = r00 + r01 + r10 + r11;
+        g4 = g00 + g01 + g10 + g11;
+        b4 = b00 + b01 + b10 + b11;
+        cb[x / 2] = _chroma(CB_R, CB_G, CB_B, r4, g4, b4);
+        cr[x / 2] = _chroma(CR_R, CR_G, CR_B, r4, g4, b4);
+    }
+}
+
+#if defined(__SSE2__)
+
+/* Loads 8 RGBA pixels, and unpacks their components into 16-bit lanes. */
+static void
+_load_rgba_sse2(const uint8_t* p, __m128i* r, __m128i* g, __m128i* b)
+{
+    const __m128i mask = _mm_set1_epi32(0xff);
+    const __m128i a0 = _mm_loadu_si128((const __m128i*)p);
+    const __m128i a1 = _mm_loadu_si128((const __m128i*)(p + 16));
+
+    *r = _mm_packs_epi32(_mm_and_si128(a0, mask), _mm_and_si128(a1, mask));
+    *g = _mm_packs_epi32(_mm_and_si128(_mm_srli_epi32(a0, 8), mask),
+                         _mm_and_si128(_mm_srli_epi32(a1, 8), mask));
+    *b = _mm_packs_epi32(_mm_and_si128(_mm_srli_epi32(a0, 16), mask),
+                         _mm_and_si128(_mm_srli_epi32(a1, 16), mask));
+}
+
+/* Computes luma of 8 pixels. */
+static __m128i
+_luma_sse2(__m128i r, __m128i g, __m128i b)
+{
+    const __m128i k_rg = _mm_setr_epi16(Y_R, Y_G, Y_R, Y_G,
+                                        Y_R, Y_G, Y_R, Y_G);
+    const __m128i k_b = _mm_setr_epi16(Y_B, 1 << 14, Y_B, 1 << 14,
+                                       Y_B, 1 << 14, Y_B, 1 << 14);
+    const __m128i one = _mm_set1_epi16(1);
+    __m128i lo = _mm_add_epi32(_mm_madd_epi16(_mm_unpacklo_epi16(r, g), k_rg),
+                               _mm_madd_epi16(_mm_unpacklo_epi16(b, one), k_b));
+    __m128i hi = _mm_add_epi32(_mm_madd_epi16(_mm_unpackhi_epi16(r, g), k_rg),
+                               _mm_madd_epi16(_mm_unpackhi_epi16(b, one), k_b));
+    return _mm_packs_epi32(_mm_srai_epi32(lo, 15), _mm_srai_epi32(hi, 15));
+}
+
+/* Computes chroma of 4 pixel blocks, given the sums of their components,
+ * packed into 16-bit lanes. */
+static __m128i
+_chroma_sse2(__m128i rg4, __m128i b4, __m128i k_rg, __m128i k_b)
+{
+    const __m128i value = _mm_add_epi32(_mm_madd_epi16(rg4, k_rg),
+                                        _mm_madd_epi16(b4, k_b));
+    return _mm_srai_epi32(_mm_add_epi32(value, _mm_set1_epi32(CHROMA_BIAS)),
+                          17);
+}
+
+/* SSE2 version of _convert_lines_c for RGBA8888 framebuffers, that converts
+ * 8 pixels at a time. Leftover columns are converted with _convert_lines_c.
+ */
+static void
+_convert_lines_sse2(const uint8_t* line0,
+                    const uint8_t* line1,
+                    int w,
+                    JSAMPLE* y0,
+                    JSAMPLE* y1,
+                    JSAMPLE* cb,
+                    JSAMPLE* cr)
+{
+    const __m128i one = _mm_set1_epi16(1);
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i k_cb_rg = _mm_setr_epi16(CB_R, CB_G, CB_R, CB_G,
+                                           CB_R, CB_G, CB_R, CB_G);
+    const __m128i k_cb_b = _mm_setr_epi16(CB_B, 0, CB_B, 0, CB_B, 0, CB_B, 0);
+    const __m128i k_cr_rg = _mm_setr_epi16(CR_R, CR_G, CR_R, CR_G,
+                                           CR_R, CR_G, CR_R, CR_G);
+    const __m128i k_cr_b = _mm_setr_epi16(CR_B, 0, CR_B, 0, CR_B, 0, CR_B, 0);
+    int x;
+
+    for (x = 0; x + 8 <= w; x += 8) {
+        __m128i r0, g0, b0, r1, g1, b1, r4, g4, b4, rg4, luma, chroma;
+        uint32_t c;
+
+        _load_rgba_sse2(line0 + x * 4, &r0, &g0, &b0);
+        _load_rgba_sse2(line1 + x * 4, &r1, &g1, &b1);
+
+        luma = _mm_packus_epi16(_luma_sse2(r0, g0, b0), _luma_sse2(r1, g1, b1));
+        _mm_storel_epi64((__m128i*)(y0 + x), luma);
+        _mm_storel_epi64((__m128i*)(y1 + x), _mm_srli_si128(luma, 8));
+
+        /* Sums of 2x2 blocks, in 32-bit lanes, packed back to 16 bits. */
+        r4 = _mm_add_epi32(_mm_madd_epi16(r0, one), _mm_madd_epi16(r1, one));
+        g4 = _mm_add_epi32(_mm_madd_epi16(g0, one), _mm_madd_epi16(g1, one));
+        b4 = _mm_add_epi32(_mm_madd_epi16(b0, one), _mm_madd_epi16(b1, one));
+        rg4 = _mm_unpacklo_epi16(_mm_packs_epi32(r4, r4),
+                                 _mm_packs_epi32(g4, g4));
+        b4 = _mm_unpacklo_epi16(_mm_packs_epi32(b4, b4), zero);
+
+        chroma = _mm_packs_epi32(_chroma_sse2(rg4, b4, k_cb_rg, k_cb_b),
+                                 _chroma_sse2(rg4, b4, k_cr_rg, k_cr_b));
+        chroma = _mm_packus_epi16(chroma, chroma);
+        c = (uint32_t)_mm_cvtsi128_si32(chroma);
+        memcpy(cb + x / 2, &c, 4);
+        c = (uint32_t)_mm_cvtsi128_si32(_mm_srli_si128(chroma, 4));
+        memcpy(cr + x / 2, &c, 4);
+    }
+
+    _convert_lines_c(line0, line1, x, w, 4, y0, y1, cb, cr);
+}
+
+#endif  /* __SSE2__ */
+
+/* Converts two framebuffer lines into YCbCr 4:2:0. */
+static void
+_convert_lines(const uint8_t* line0,
+               const uint8_t* line1,
+               int w,
+               int bpp,
+               JSAMPLE* y0,
+               JSAMPLE* y1,
+               JSAMPLE* cb,
+               JSAMPLE* cr)
+{
+#if defined(__SSE2__)
+    if (bpp == 4) {
+        _convert_lines_sse2(line0, line1, w, y0, y1, cb, cr);
+        return;
+    }
+#endif
+    _convert_lines_c(line0, line1, 0, w, bpp, y0, y1, cb, cr);
+}
+
+/* Pads a line by replicating its last sample. */
+static void
+_pad_line(JSAMPLE* line, int width, int padded_width)
+{
+    if (padded_width > width) {
+        memset(line + width, line[width - 1], padded_width - width);
+    }
+}
+
+/********************************************************************************
+ *                      Framebuffer compression.
+ *******************************************************************************/
+
+/* Compresses lines of a job's framebuffer region into a JPEG image.
+ * Param:
+ *  dsc - Compression descriptor receiving the image.
+ *  job - Compression job.
+ *  first_line - Index of the first line to compress in the job's region.
+ *  lines - Number of lines to compress.
+ */
+static void
+_compress_lines(AJPEGDesc* dsc, const AJPEGJob* job, int first_line, int lines)
+{
     struct jpeg_compress_struct cinfo = {0};
     struct jpeg_error_mgr err_mgr;
-    const int x_shift = x * bpp;
+    const int w = job->w;
+    /* Widths of the luma and chroma planes, padded to the DCT blocks. */
+    const int luma_width = (w + DCTSIZE - 1) & ~(DCTSIZE - 1);
+    const int chroma_w = (w + 1) / 2;
+    const int chroma_width = (chroma_w + DCTSIZE - 1) & ~(DCTSIZE - 1);
+    JSAMPARRAY planes[3];
+    int line, n;
 
     /*
-     * Initialize compressin information structure, and start compression
+     * Initialize compression information structure, and start compression
      */
 
     cinfo.err = jpeg_std_error(&err_mgr);
     jpeg_create_compress(&cinfo);
     cinfo.dest = &dsc->common;
     cinfo.image_width = w;
-    cinfo.image_height = h;
-
-    /* Decode framebuffer's pixel format. There can be only three:
-     * - RGB565,
-     * - RGBA8888,
-     * - RGBX8888 */
-    if (bpp == 2) {
-        /* This is RGB565 - most commonly used pixel format for framebuffer. */
-        cinfo.input_components = 2;
-        cinfo.in_color_space = JCS_RGB_565;
-    } else {
-        /* RGBA8888, or RGBX8888 - makes no difference here. */
-        cinfo.input_components = 4;
-        cinfo.in_color_space = JCS_RGBA_8888;
-    }
+    cinfo.image_height = lines;
+    cinfo.input_components = 3;
+    cinfo.in_color_space = JCS_YCbCr;
+    /* Default sampling factors for YCbCr are 2x2 for luma, and 1x1 for
+     * chroma, i.e. 4:2:0. */
     jpeg_set_defaults(&cinfo);
-    jpeg_set_quality(&cinfo, jpeg_quality, TRUE);
+    jpeg_set_quality(&cinfo, job->jpeg_quality, TRUE);
+    cinfo.raw_data_in = TRUE;
+    cinfo.dct_method = job->jpeg_quality <= JPEG_IFAST_MAX_QUALITY ?
+                       JDCT_IFAST : JDCT_ISLOW;
     jpeg_start_compress(&cinfo, TRUE);
 
-    /* Line by line compress the region. */
-    if (ydir >= 0) {
-        while (cinfo.next_scanline < cinfo.image_height) {
-            JSAMPROW rgb = (JSAMPROW)(fb + (cinfo.next_scanline + y) * bpl + x_shift);
-            jpeg_write_scanlines(&cinfo, (JSAMPARRAY)&rgb, 1);
-        }
-    } else {
-        const int y_shift = num_lines - y - 1;
-        while (cinfo.next_scanline < cinfo.image_height) {
-            JSAMPROW rgb = (JSAMPROW)(fb + (y_shift - cinfo.next_scanline) * bpl + x_shift);
-            jpeg_write_scanlines(&cinfo, (JSAMPARRAY)&rgb, 1);
+    planes[0] = (*cinfo.mem->alloc_sarray)((j_common_ptr)&cinfo, JPOOL_IMAGE,
+                                           luma_width, JPEG_MCU_LINES);
+    planes[1] = (*cinfo.mem->alloc_sarray)((j_common_ptr)&cinfo, JPOOL_IMAGE,
+                                           chroma_width, JPEG_MCU_LINES / 2);
+    planes[2] = (*cinfo.mem->alloc_sarray)((j_common_ptr)&cinfo, JPOOL_IMAGE,
+                                           chroma_width, JPEG_MCU_LINES / 2);
+
+    /* Convert, and compress the region one MCU row at a time. Lines below the
+     * region are padded by replicating the last line, as jpeglib does. */
+    for (line = 0; line < lines; line += JPEG_MCU_LINES) {
+        for (n = 0; n < JPEG_MCU_LINES; n += 2) {
+            const int line0 = _jpeg_min(line + n, lines - 1);
+            const int line1 = _jpeg_min(line + n + 1, lines - 1);
+            _convert_lines(_job_line(job, first_line + line0),
+                           _job_line(job, first_line + line1),
+                           w, job->bpp,
+                           planes[0][n], planes[0][n + 1],
+                           planes[1][n / 2], planes[2][n / 2]);
+            _pad_line(planes[0][n], w, luma_width);
+            _pad_line(planes[0][n + 1], w, luma_width);
+            _pad_line(planes[1][n / 2], chroma_w, chroma_width);
+            _pad_line(planes[2][n / 2], chroma_w, chroma_width);
         }
+        jpeg_write_raw_data(&cinfo, planes, JPEG_MCU_LINES);
     }
 
     /* Complete the compression. */
     jpeg_finish_compress(&cinfo);
     jpeg_destroy_compress(&cinfo);
 }
+
+/* Compresses a strip of a job. This is called concurrently by the worker pool
+ * threads. */
+static void
+_compress_strip(void* opaque, int index)
+{
+    const AJPEGJob* const job = (const AJPEGJob*)opaque;
+    const int first_line = index * job->strip_lines;
+
+    _compress_lines(job->strips[index], job, first_line,
+                    _jpeg_min(job->strip_lines, job->h - first_line));
+}
+
+/* Locates the parts of a JPEG image produced by jpeglib.
+ * Param:
+ *  data, size - JPEG image.
+ *  sof - Upon success, contains offset of the SOF0 marker.
+ *  sos - Upon success, contains offset of the SOS marker.
+ *  scan - Upon success, contains offset of the entropy-coded data.
+ * Return:
+ *  0 on success, or -1 if the image is not a baseline JPEG image.
+ */
+static int
+_parse_jpeg(const uint8_t* data, int size, int* sof, int* sos, int* scan)
+{
+    int pos = 2;
+
+    *sof = -1;
+    if (size < 4 || data[0] != 0xff || data[1] != 0xd8 ||
+        data[size - 2] != 0xff || data[size - 1] != 0xd9) {
+        return -1;
+    }
+
+    while (pos + 4 <= size && data[pos] == 0xff) {
+        const int marker = data[pos + 1];
+        const int length = (data[pos + 2] << 8) | data[pos + 3];
+        if (marker == 0xc0) {
+            *sof = pos;
+        } else if (marker == 0xda) {
+            *sos = pos;
+            *scan = pos + 2 + length;
+            return (*sof < 0 || *scan > size - 2) ? -1 : 0;
+        }
+        pos += 2 + length;
+    }
+    return -1;
+}
+
+/* Makes sure that the output buffer can contain a JPEG image of the given
+ * size, and returns the beginning of the image in the buffer. */
+static uint8_t*
+_reserve_output(AJPEGDesc* dsc, int size)
+{
+    const int required = dsc->header_size + size;
+
+    if (dsc->jpeg_buf == NULL || dsc->size < required) {
+        dsc->size = (required + dsc->chunk_size - 1) / dsc->chunk_size *
+                    dsc->chunk_size;
+        dsc->jpeg_buf = realloc(dsc->jpeg_buf, dsc->size);
+        if (dsc->jpeg_buf == NULL) {
+            APANIC("Unable to allocate %d bytes for JPEG compression", dsc->size);
+        }
+    }
+    return dsc->jpeg_buf + dsc->header_size;
+}
+
+/* Assembles the JPEG image from the images of the strips.
+ * Param:
+ *  dsc - Compression descriptor receiving the image.
+ *  strips - Compression descriptors of the strips.
+ *  strip_num - Number of strips.
+ *  height - Height of the entire image.
+ *  restart_interval - Number of MCUs in a strip.
+ * Return:
+ *  0 on success, or -1 if strip images are not what was expected.
+ */
+static int
+_assemble_strips(AJPEGDesc* dsc,
+                 AJPEGDesc** strips,
+                 int strip_num,
+                 int height,
+                 int restart_interval)
+{
+    int sof[JPEG_MAX_STRIPS], sos[JPEG_MAX_STRIPS], scan[JPEG_MAX_STRIPS];
+    const uint8_t* data[JPEG_MAX_STRIPS];
+    int size[JPEG_MAX_STRIPS];
+    int total, n;
+    uint8_t* out;
+
+    for (n = 0; n < strip_num; n++) {
+        data[n] = strips[n]->jpeg_buf + strips[n]->header_size;
+        size[n] = jpeg_compressor_get_jpeg_size(strips[n]);
+        if (_parse_jpeg(data[n], size[n], &sof[n], &sos[n], &scan[n])) {
+            return -1;
+        }
+    }
+
+    /* Headers + DRI + SOS of the first strip, scans separated with RSTn, and
+     * EOI. */
+    total = scan[0] + 6 + 2;
+    for (n = 0; n < strip_num; n++) {
+        total += size[n] - 2 - scan[n] + (n > 0 ? 2 : 0);
+    }
+
+    out = _reserve_output(dsc, total);
+
+    memcpy(out, data[0], sos[0]);
+    out[sof[0] + 5] = (uint8_t)(height >> 8);
+    out[sof[0] + 6] = (uint8_t)height;
+    out += sos[0];
+
+    *out++ = 0xff;
+    *out++ = 0xdd;
+    *out++ = 0;
+    *out++ = 4;
+    *out++ = (uint8_t)(restart_interval >> 8);
+    *out++ = (uint8_t)restart_interval;
+
+    memcpy(out, data[0] + sos[0], scan[0] - sos[0]);
+    out += scan[0] - sos[0];
+
+    for (n = 0; n < strip_num; n++) {
+        if (n > 0) {
+            *out++ = 0xff;
+            *out++ = 0xd0 + ((n - 1) & 7);
+        }
+        memcpy(out, data[n] + scan[n], size[n] - 2 - scan[n]);
+        out += size[n] - 2 - scan[n];
+    }
+    *out++ = 0xff;
+    *out++ = 0xd9;
+
+    dsc->common.next_output_byte = out;
+    dsc->common.free_in_buffer = dsc->size - (out - dsc->jpeg_buf);
+    return 0;
+}
+
+void
+jpeg_compressor_set_strip_count(AJPEGDesc* dsc, int strip_count)
+{
+    dsc->strip_count = strip_count;
+}
+
+void
+jpeg_compressor_compress_fb(AJPEGDesc* dsc,
+                            int x, int y, int w, int h, int num_lines,
+                            int bpp, int bpl,
+                            const uint8_t* fb,
+                            int jpeg_quality,
+                            int ydir){
+    AJPEGJob job;
+    int strip_num = 1;
+    int restart_interval = 0;
+    int n;
+
+    job.x = x;
+    job.y = y;
+    job.w = w;
+    job.h = h;
+    job.num_lines = num_lines;
+    job.bpp = bpp;
+    job.bpl = bpl;
+    job.fb = fb;
+    job.jpeg_quality = jpeg_quality;
+    job.ydir = ydir;
+    job.strip_lines = h;
+    job.strips = dsc->strips;
+
+    /* Split large regions into strips of whole MCU rows, one per thread. */
+    if (h >= 2 * JPEG_MIN_STRIP) {
+        strip_num = dsc->strip_count > 0 ? dsc->strip_count :
+                                           worker_pool_get_count();
+        strip_num = _jpeg_min(_jpeg_min(strip_num, JPEG_MAX_STRIPS),
+                              h / JPEG_MIN_STRIP);
+    }
+    if (strip_num > 1) {
+        job.strip_lines = (h + strip_num - 1) / strip_num;
+        job.strip_lines = (job.strip_lines + JPEG_MCU_LINES - 1) /
+                          JPEG_MCU_LINES * JPEG_MCU_LINES;
+        strip_num = (h + job.strip_lines - 1) / job.strip_lines;
+        restart_interval = (w + JPEG_MCU_LINES - 1) / JPEG_MCU_LINES *
+                           (job.strip_lines / JPEG_MCU_LINES);
+    }
+
+    if (strip_num > 1 && restart_interval <= 0xffff) {
+        for (n = 0; n < strip_num; n++) {
+            if (dsc->strips[n] == NULL) {
+                dsc->strips[n] = jpeg_compressor_create(0, dsc->chunk_size);
+            }
+        }
+        worker_pool_run(_compress_strip, &job, strip_num);
+        if (!_assemble_strips(dsc, dsc->strips, strip_num, h,
+                              restart_interval)) {
+            return;
+        }
+    }
+
+    job.strip_lines = h;
+    _compress_lines(dsc, &job, 0, h);
+}
@@ -14,6 +14,8 @@
 
 #include "android/utils/compiler.h"
 
+#include <stdint.h>
+
 ANDROID_BEGIN_HEADER
 
 /*
@@ -77,6 +79,17 @@ extern void* jpeg_compressor_get_buffer(const AJPEGDesc* dsc);
  */
 extern int jpeg_compressor_get_header_size(const AJPEGDesc* dsc);
 
+/* Sets the number of strips that jpeg_compressor_compress_fb splits large
+ * regions into, to compress them in parallel on the worker pool threads (see
+ * android/utils/worker-pool.h). Each strip but the first adds a restart marker
+ * to the image.
+ * Param:
+ *  dsc - Compression descriptor, obtained with jpeg_compressor_create.
+ *  strip_count - Number of strips, or 0 for one strip per worker pool thread,
+ *      which is the default. Use 1 to compress regions in one piece.
+ */
+extern void jpeg_compressor_set_strip_count(AJPEGDesc* dsc, int strip_count);
+
 /* Compresses a framebuffer region into JPEG image.
  * Param:
  *  dsc - Compression descriptor, obtained with jpeg_compressor_create.
@@ -0,0 +1,560 @@
+// Copyright 2015 The Android Open Source Project
+//
+// This software is licensed under the terms of the GNU General Public
+// License version 2, as published by the Free Software Foundation, and
+// may be copied, distributed, and modified under those terms.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+#include "android/utils/jpeg-compress.h"
+#include "android/utils/worker-pool.h"
+
+#include "android/base/threads/Thread.h"
+
+// emulator-libjpeg is always built with the SSE2 DCTs (see
+// distrib/jpeg-6b/sources.make), which jdct.h only declares with this.
+#define ANDROID_INTELSSE2_FDCT
+
+extern "C" {
+#define JPEG_INTERNALS
+#include "jinclude.h"
+#include "jpeglib.h"
+#include "jdct.h"
+}
+
+#include <gtest/gtest.h>
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <time.h>
+
+#include <vector>
+
+namespace {
+
+const int kWidth = 480;
+const int kHeight = 800;
+
+// A framebuffer with a synthetic screen: an app bar, text-like patterns on
+// a light background, a gradient, and a noisy photo-like area.
+class Framebuffer {
+public:
+    Framebuffer(int width, int height, int bpp)
+        : mWidth(width), mHeight(height), mBpp(bpp),
+          mPixels(width * height * bpp) {
+        srand(1);
+        for (int y = 0; y < height; ++y) {
+            for (int x = 0; x < width; ++x) {
+                int r, g, b;
+                if (y < 48) {
+                    r = 0x30; g = 0x3f; b = 0x9f;
+                } else if (x > width * 3 / 4) {
+                    r = x & 255; g = y & 255; b = (x + y) & 255;
+                } else if (y > height * 2 / 3 && x > width / 10 &&
+                           x < width / 2) {
+                    r = rand() & 255; g = (r + rand() % 32) & 255;
+                    b = rand() & 255;
+                } else if (((y / 24) & 1) && (x * 7 + y * 13) % 11 < 3) {
+                    r = g = b = 0x20;
+                } else {
+                    r = g = b = 0xfa;
+                }
+                if (bpp == 2) {
+                    uint16_t color = ((r >> 3) << 11) | ((g >> 2) << 5) |
+                                     (b >> 3);
+                    memcpy(&mPixels[(y * width + x) * 2], &color, 2);
+                } else {
+                    uint8_t* p = &mPixels[(y * width + x) * 4];
+                    p[0] = r; p[1] = g; p[2] = b; p[3] = 255;
+                }
+            }
+        }
+    }
+
+    int width() const { return mWidth; }
+    int height() const { return mHeight; }
+    int bpp() const { return mBpp; }
+    int bpl() const { return mWidth * mBpp; }
+    const uint8_t* pixels() const { return &mPixels[0]; }
+
+    // Gets the RGB components of a pixel, expanding RGB565 the same way
+    // jpeglib does.
+    void getRgb(int x, int y, int* r, int* g, int* b) const {
+        if (mBpp == 2) {
+            uint16_t c;
+            memcpy(&c, &mPixels[(y * mWidth + x) * 2], 2);
+            *r = ((c & 0xf800) >> 8) | ((c & 0xf800) >> 14);
+            *g = ((c & 0x7e0) >> 3) | ((c & 0x7e0) >> 9);
+            *b = ((c & 0x1f) << 3) | ((c & 0x1f) >> 2);
+        } else {
+            const uint8_t* p = &mPixels[(y * mWidth + x) * 4];
+            *r = p[0]; *g = p[1]; *b = p[2];
+        }
+    }
+
+private:
+    int mWidth;
+    int mHeight;
+    int mBpp;
+    std::vector<uint8_t> mPixels;
+};
+
+struct Region {
+    int x;
+    int y;
+    int w;
+    int h;
+};
+
+// Gets the framebuffer line of the region line |line|.
+int fbLine(const Framebuffer& fb, const Region& r, int line, int ydir) {
+    return ydir >= 0 ? r.y + line : fb.height() - 1 - (r.y + line);
+}
+
+// jpeglib source manager for an image in memory.
+void initSource(j_decompress_ptr cinfo) {}
+
+boolean fillInputBuffer(j_decompress_ptr cinfo) {
+    // Truncated image, end it.
+    static const JOCTET kEoi[2] = { 0xFF, JPEG_EOI };
+    cinfo->src->next_input_byte = kEoi;
+    cinfo->src->bytes_in_buffer = 2;
+    return TRUE;
+}
+
+void skipInputData(j_decompress_ptr cinfo, long count) {
+    if (count > (long)cinfo->src->bytes_in_buffer) {
+        count = cinfo->src->bytes_in_buffer;
+    }
+    cinfo->src->next_input_byte += count;
+    cinfo->src->bytes_in_buffer -= count;
+}
+
+void termSource(j_decompress_ptr cinfo) {}
+
+// Decodes a JPEG image into RGB pixels.
+std::vector<uint8_t> decode(const uint8_t* data, int size,
+                            int* width, int* height) {
+    struct jpeg_decompress_struct cinfo;
+    struct jpeg_error_mgr errMgr;
+    struct jpeg_source_mgr src;
+    cinfo.err = jpeg_std_error(&errMgr);
+    jpeg_create_decompress(&cinfo);
+    src.init_source = initSource;
+    src.fill_input_buffer = fillInputBuffer;
+    src.skip_input_data = skipInputData;
+    src.resync_to_restart = jpeg_resync_to_restart;
+    src.term_source = termSource;
+    src.next_input_byte = data;
+    src.bytes_in_buffer = size;
+    cinfo.src = &src;
+    jpeg_read_header(&cinfo, TRUE);
+    cinfo.out_color_space = JCS_RGB;
+    jpeg_start_decompress(&cinfo);
+    *width = cinfo.output_width;
+    *height = cinfo.output_height;
+    std::vector<uint8_t> pixels(*width * *height * 3);
+    while (cinfo.output_scanline < cinfo.output_height) {
+        JSAMPROW row = &pixels[cinfo.output_scanline * *width * 3];
+        jpeg_read_scanlines(&cinfo, &row, 1);
+    }
+    jpeg_finish_decompress(&cinfo);
+    jpeg_destroy_decompress(&cinfo);
+    return pixels;
+}
+
+// Peak signal to noise ratio of a decoded region, in dB.
+double psnr(const Framebuffer& fb, const Region& r, int ydir,
+            const std::vector<uint8_t>& decoded) {
+    double error = 0;
+    for (int y = 0; y < r.h; ++y) {
+        const int line = fbLine(fb, r, y, ydir);
+        for (int x = 0; x < r.w; ++x) {
+            int c[3];
+            fb.getRgb(r.x + x, line, &c[0], &c[1], &c[2]);
+            for (int i = 0; i < 3; ++i) {
+                const int d = c[i] - decoded[(y * r.w + x) * 3 + i];
+                error += d * d;
+            }
+        }
+    }
+    error /= (double)r.w * r.h * 3;
+    return 10 * log10(255. * 255. / error);
+}
+
+// jpeglib destination manager that appends to a vector.
+struct VectorDest {
+    struct jpeg_destination_mgr common;
+    std::vector<JOCTET>* out;
+    JOCTET buffer[4096];
+};
+
+void initDestination(j_compress_ptr cinfo) {
+    VectorDest* dest = reinterpret_cast<VectorDest*>(cinfo->dest);
+    dest->common.next_output_byte = dest->buffer;
+    dest->common.free_in_buffer = sizeof(dest->buffer);
+}
+
+boolean emptyOutputBuffer(j_compress_ptr cinfo) {
+    VectorDest* dest = reinterpret_cast<VectorDest*>(cinfo->dest);
+    dest->out->insert(dest->out->end(), dest->buffer,
+                      dest->buffer + sizeof(dest->buffer));
+    dest->common.next_output_byte = dest->buffer;
+    dest->common.free_in_buffer = sizeof(dest->buffer);
+    return TRUE;
+}
+
+void termDestination(j_compress_ptr cinfo) {
+    VectorDest* dest = reinterpret_cast<VectorDest*>(cinfo->dest);
+    dest->out->insert(dest->out->end(), dest->buffer,
+                      dest->common.next_output_byte);
+}
+
+// Compresses a region with plain jpeglib, from RGB lines with the default
+// color conversion and DCT: the reference for size and quality.
+void referenceCompress(const Framebuffer& fb, const Region& r, int quality,
+                       int ydir, std::vector<JOCTET>* out) {
+    struct jpeg_compress_struct cinfo;
+    struct jpeg_error_mgr errMgr;
+    VectorDest dest;
+    cinfo.err = jpeg_std_error(&errMgr);
+    jpeg_create_compress(&cinfo);
+    dest.common.init_destination = initDestination;
+    dest.common.empty_output_buffer = emptyOutputBuffer;
+    dest.common.term_destination = termDestination;
+    dest.out = out;
+    out->clear();
+    cinfo.dest = &dest.common;
+    cinfo.image_width = r.w;
+    cinfo.image_height = r.h;
+    cinfo.input_components = 3;
+    cinfo.in_color_space = JCS_RGB;
+    jpeg_set_defaults(&cinfo);
+    jpeg_set_quality(&cinfo, quality, TRUE);
+    jpeg_start_compress(&cinfo, TRUE);
+    std::vector<JSAMPLE> rgb(r.w * 3);
+    while (cinfo.next_scanline < cinfo.image_height) {
+        const int line = fbLine(fb, r, cinfo.next_scanline, ydir);
+        for (int x = 0; x < r.w; ++x) {
+            int c[3];
+            fb.getRgb(r.x + x, line, &c[0], &c[1], &c[2]);
+            rgb[x * 3] = c[0];
+            rgb[x * 3 + 1] = c[1];
+            rgb[x * 3 + 2] = c[2];
+        }
+        JSAMPROW row = &rgb[0];
+        jpeg_write_scanlines(&cinfo, &row, 1);
+    }
+    jpeg_finish_compress(&cinfo);
+    jpeg_destroy_compress(&cinfo);
+}
+
+const uint8_t* jpegData(AJPEGDesc* dsc) {
+    return static_cast<const uint8_t*>(jpeg_compressor_get_buffer(dsc)) +
+           jpeg_compressor_get_header_size(dsc);
+}
+
+// Compresses regions of |fb| with various qualities and orientations, and
+// checks that they decode to images of the right size, and about the same
+// quality as the reference.
+void checkCompression(const Framebuffer& fb) {
+    const Region regions[] = {
+        { 0, 0, fb.width(), fb.height() },
+        { 100, 50, 333, 217 },
+        { 0, 0, fb.width(), 40 },
+        { 7, 3, 301, 517 },
+    };
+    const int qualities[] = { 10, 80, 95 };
+    AJPEGDesc* dsc = jpeg_compressor_create(16, 4096);
+    for (size_t ri = 0; ri < sizeof(regions) / sizeof(regions[0]); ++ri) {
+        const Region& r = regions[ri];
+        for (size_t qi = 0; qi < sizeof(qualities) / sizeof(qualities[0]);
+             ++qi) {
+            for (int ydir = -1; ydir <= 1; ydir += 2) {
+                SCOPED_TRACE(testing::Message()
+                             << r.w << "x" << r.h << "+" << r.x << "+" << r.y
+                             << " q" << qualities[qi] << " ydir " << ydir);
+                jpeg_compressor_compress_fb(dsc, r.x, r.y, r.w, r.h,
+                                            fb.height(), fb.bpp(), fb.bpl(),
+                                            fb.pixels(), qualities[qi], ydir);
+                int w, h;
+                std::vector<uint8_t> decoded =
+                        decode(jpegData(dsc),
+                               jpeg_compressor_get_jpeg_size(dsc), &w, &h);
+                ASSERT_EQ(r.w, w);
+                ASSERT_EQ(r.h, h);
+
+                std::vector<JOCTET> ref;
+                referenceCompress(fb, r, qualities[qi], ydir, &ref);
+                std::vector<uint8_t> refDecoded =
+                        decode(&ref[0], ref.size(), &w, &h);
+                EXPECT_LT(psnr(fb, r, ydir, refDecoded) - 1.0,
+                          psnr(fb, r, ydir, decoded));
+            }
+        }
+    }
+    jpeg_compressor_destroy(dsc);
+}
+
+// Compresses a region of |fb| into |dsc|, and returns the JPEG data.
+std::vector<uint8_t> compress(AJPEGDesc* dsc, const Framebuffer& fb,
+                              const Region& r, int quality, int ydir) {
+    jpeg_compressor_compress_fb(dsc, r.x, r.y, r.w, r.h, fb.height(),
+                                fb.bpp(), fb.bpl(), fb.pixels(), quality,
+                                ydir);
+    return std::vector<uint8_t>(
+            jpegData(dsc), jpegData(dsc) + jpeg_compressor_get_jpeg_size(dsc));
+}
+
+// Compresses the same region again and again, and checks that the result
+// doesn't change.
+class CompressThread : public android::base::Thread {
+public:
+    CompressThread(const Framebuffer* fb, const Region& r,
+                   const std::vector<uint8_t>* expected)
+        : mFb(fb), mRegion(r), mExpected(expected), mMismatches(0) {}
+
+    virtual intptr_t main() {
+        AJPEGDesc* dsc = jpeg_compressor_create(0, 4096);
+        jpeg_compressor_set_strip_count(dsc, 4);
+        for (int n = 0; n < 20; ++n) {
+            if (compress(dsc, *mFb, mRegion, 80, -1) != *mExpected) {
+                ++mMismatches;
+            }
+        }
+        jpeg_compressor_destroy(dsc);
+        return 0;
+    }
+
+    int mismatches() const { return mMismatches; }
+
+private:
+    const Framebuffer* mFb;
+    Region mRegion;
+    const std::vector<uint8_t>* mExpected;
+    int mMismatches;
+};
+
+// Starts the worker pool with a few workers, so that the strips run on other
+// threads even on a single CPU host. The first test to run decides.
+void startWorkerPool() {
+    worker_pool_start(3);
+}
+
+// An 8x8 block of DCT input, i.e. samples minus CENTERJSAMPLE.
+struct Block {
+    DCTELEM data[DCTSIZE2];
+};
+
+}  // namespace
+
+// These tests run the strips on the real worker pool.
+TEST(JpegCompress, Rgba8888) {
+    startWorkerPool();
+    checkCompression(Framebuffer(kWidth, kHeight, 4));
+}
+
+TEST(JpegCompress, Rgb565) {
+    startWorkerPool();
+    checkCompression(Framebuffer(kWidth, kHeight, 2));
+}
+
+TEST(JpegCompress, StripsDecodeLikeOneImage) {
+    startWorkerPool();
+    const int bpps[] = { 2, 4 };
+    for (size_t n = 0; n < sizeof(bpps) / sizeof(bpps[0]); ++n) {
+        Framebuffer fb(kWidth, kHeight, bpps[n]);
+        const Region r = { 5, 9, 470, 701 };
+        AJPEGDesc* single = jpeg_compressor_create(0, 4096);
+        AJPEGDesc* strips = jpeg_compressor_create(0, 4096);
+        jpeg_compressor_set_strip_count(single, 1);
+        jpeg_compressor_set_strip_count(strips, 4);
+        for (int ydir = -1; ydir <= 1; ydir += 2) {
+            jpeg_compressor_compress_fb(single, r.x, r.y, r.w, r.h,
+                                        fb.height(), fb.bpp(), fb.bpl(),
+                                        fb.pixels(), 80, ydir);
+            jpeg_compressor_compress_fb(strips, r.x, r.y, r.w, r.h,
+                                        fb.height(), fb.bpp(), fb.bpl(),
+                                        fb.pixels(), 80, ydir);
+            int w, h;
+            std::vector<uint8_t> singleDecoded =
+                    decode(jpegData(single),
+                           jpeg_compressor_get_jpeg_size(single), &w, &h);
+            std::vector<uint8_t> stripsDecoded =
+                    decode(jpegData(strips),
+                           jpeg_compressor_get_jpeg_size(strips), &w, &h);
+            EXPECT_EQ(r.w, w);
+            EXPECT_EQ(r.h, h);
+            // The strips are separated with restart markers.
+            EXPECT_NE(jpeg_compressor_get_jpeg_size(single),
+                      jpeg_compressor_get_jpeg_size(strips));
+            EXPECT_TRUE(singleDecoded == stripsDecoded);
+        }
+        jpeg_compressor_destroy(single);
+        jpeg_compressor_destroy(strips);
+    }
+}
+
+// Several threads compressing at the same time share the worker pool: the
+// ones that find it busy compress their strips themselves. Either way, the
+// images are the same as when compressed alone.
+TEST(JpegCompress, ConcurrentCompressions) {
+    startWorkerPool();
+    Framebuffer fb(kWidth, kHeight, 4);
+    const Region r = { 0, 0, kWidth, kHeight };
+    AJPEGDesc* dsc = jpeg_compressor_create(0, 4096);
+    jpeg_compressor_set_strip_count(dsc, 4);
+    const std::vector<uint8_t> expected = compress(dsc, fb, r, 80, -1);
+    jpeg_compressor_destroy(dsc);
+
+    const int kThreads = 4;
+    CompressThread* threads[kThreads];
+    for (int n = 0; n < kThreads; ++n) {
+        threads[n] = new CompressThread(&fb, r, &expected);
+        ASSERT_TRUE(threads[n]->start());
+    }
+    for (int n = 0; n < kThreads; ++n) {
+        EXPECT_TRUE(threads[n]->wait(NULL));
+        EXPECT_EQ(0, threads[n]->mismatches()) << "thread " << n;
+        delete threads[n];
+    }
+}
+
+// The SSE2 version of the fast integer DCT must give exactly the same
+// coefficients as jfdctfst.c, since the compressor uses it for all but the
+// highest qualities.
+TEST(JpegCompress, SseFdctMatchesScalar) {
+    std::vector<Block> blocks;
+    Block b;
+    // Constant blocks at the limits, and in the middle.
+    const int levels[] = { -CENTERJSAMPLE, 0, 1, MAXJSAMPLE - CENTERJSAMPLE };
+    for (size_t n = 0; n < sizeof(levels) / sizeof(levels[0]); ++n) {
+        for (int k = 0; k < DCTSIZE2; ++k) {
+            b.data[k] = levels[n];
+        }
+        blocks.push_back(b);
+    }
+    // Full scale checkerboards, stripes and impulses, which produce the
+    // largest coefficients.
+    for (int pattern = 0; pattern < 4; ++pattern) {
+        for (int k = 0; k < DCTSIZE2; ++k) {
+            const int x = k % DCTSIZE;
+            const int y = k / DCTSIZE;
+            bool high;
+            switch (pattern) {
+            case 0: high = (x + y) & 1; break;
+            case 1: high = x & 1; break;
+            case 2: high = y < DCTSIZE / 2; break;
+            default: high = k == 0 || k == DCTSIZE2 - 1; break;
+            }
+            b.data[k] = high ? MAXJSAMPLE - CENTERJSAMPLE : -CENTERJSAMPLE;
+        }
+        blocks.push_back(b);
+        for (int k = 0; k < DCTSIZE2; ++k) {
+            b.data[k] = -1 - b.data[k];
+        }
+        blocks.push_back(b);
+    }
+    // Random blocks, with full scale and small amplitudes.
+    srand(3);
+    for (int n = 0; n < 10000; ++n) {
+        const int range = (n & 1) ? MAXJSAMPLE + 1 : 8;
+        for (int k = 0; k < DCTSIZE2; ++k) {
+            b.data[k] = rand() % range - range / 2;
+        }
+        blocks.push_back(b);
+    }
+
+    for (size_t n = 0; n < blocks.size(); ++n) {
+        Block scalar = blocks[n];
+        Block sse = blocks[n];
+        jpeg_fdct_ifast(scalar.data);
+        jpeg_fdct_ifast_intelsse(sse.data);
+        for (int k = 0; k < DCTSIZE2; ++k) {
+            ASSERT_EQ(scalar.data[k], sse.data[k])
+                    << "block " << n << ", coefficient " << k;
+        }
+    }
+}
+
+namespace {
+
+double nowMs() {
+    return (double)clock() * 1000. / CLOCKS_PER_SEC;
+}
+
+double wallMs() {
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec * 1000. + tv.tv_usec / 1000.;
+}
+
+}  // namespace
+
+// Compares the time to compress a 1920x1080 screen with plain jpeglib, as
+// the compressor used to, and with jpeg_compressor_compress_fb(), on one
+// thread, and in strips on the worker pool. Run with
+// --gtest_also_run_disabled_tests.
+TEST(JpegCompress, DISABLED_Benchmark) {
+    const int kIterations = 20;
+    const int bpps[] = { 4, 2 };
+    const int qualities[] = { 10, 80, 95 };
+    for (size_t bi = 0; bi < sizeof(bpps) / sizeof(bpps[0]); ++bi) {
+        Framebuffer fb(1920, 1080, bpps[bi]);
+        const Region r = { 0, 0, fb.width(), fb.height() };
+        for (size_t qi = 0; qi < sizeof(qualities) / sizeof(qualities[0]);
+             ++qi) {
+            const int quality = qualities[qi];
+            std::vector<JOCTET> ref;
+            double start = nowMs();
+            for (int n = 0; n < kIterations; ++n) {
+                referenceCompress(fb, r, quality, 1, &ref);
+            }
+            const double refMs = (nowMs() - start) / kIterations;
+
+            AJPEGDesc* dsc = jpeg_compressor_create(0, 65536);
+            jpeg_compressor_set_strip_count(dsc, 1);
+            start = nowMs();
+            for (int n = 0; n < kIterations; ++n) {
+                jpeg_compressor_compress_fb(dsc, r.x, r.y, r.w, r.h,
+                                            fb.height(), fb.bpp(), fb.bpl(),
+                                            fb.pixels(), quality, 1);
+            }
+            const double ms = (nowMs() - start) / kIterations;
+
+            // clock() counts the time of all threads, so measure the
+            // strips in wall time.
+            AJPEGDesc* strips = jpeg_compressor_create(0, 65536);
+            start = wallMs();
+            for (int n = 0; n < kIterations; ++n) {
+                jpeg_compressor_compress_fb(strips, r.x, r.y, r.w, r.h,
+                                            fb.height(), fb.bpp(), fb.bpl(),
+                                            fb.pixels(), quality, 1);
+            }
+            const double stripsMs = (wallMs() - start) / kIterations;
+            jpeg_compressor_destroy(strips);
+
+            int w, h;
+            std::vector<uint8_t> refDecoded =
+                    decode(&ref[0], ref.size(), &w, &h);
+            std::vector<uint8_t> decoded =
+                    decode(jpegData(dsc), jpeg_compressor_get_jpeg_size(dsc),
+                           &w, &h);
+            printf("%s q%-2d jpeglib %6.2f ms %7d B %5.2f dB, "
+                   "compressor %6.2f ms %7d B %5.2f dB (%.1fx), "
+                   "%d strips %6.2f ms (%.1fx)\n",
+                   fb.bpp() == 4 ? "RGBA8888" : "RGB565  ", quality,
+                   refMs, (int)ref.size(), psnr(fb, r, 1, refDecoded),
+                   ms, jpeg_compressor_get_jpeg_size(dsc),
+                   psnr(fb, r, 1, decoded), refMs / ms,
+                   worker_pool_get_count(), stripsMs, refMs / stripsMs);
+            jpeg_compressor_destroy(dsc);
+        }
+    }
+}
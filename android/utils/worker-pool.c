@@ -0,0 +1,223 @@
+/* Copyright (C) 2015 The Android Open Source Project
+**
+** This software is licensed under the terms of the GNU General Public
+** License version 2, as published by the Free Software Foundation, and
+** may be copied, distributed, and modified under those terms.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+*/
+
+#include "android/utils/worker-pool.h"
+
+#include "qemu-common.h"
+#include "qemu/atomic.h"
+#include "qemu/thread.h"
+
+/* Pool of worker threads. */
+typedef struct WorkerPool {
+    /* Held while a batch is run by the workers. */
+    QemuMutex       run_lock;
+    /* Protects all fields below. */
+    QemuMutex       lock;
+    /* Signaled when a batch is submitted. */
+    QemuCond        batch_cond;
+    /* Signaled when all workers are done with the current batch. */
+    QemuCond        done_cond;
+    /* Number of workers. */
+    int             worker_num;
+    /* Current batch. */
+    WorkerPoolJob   job;
+    void*           opaque;
+    int             count;
+    /* Index of the next job to run in the current batch. */
+    int             next;
+    /* Incremented each time a batch is submitted. */
+    unsigned        generation;
+    /* Number of workers that are still working on the current batch. */
+    int             busy;
+} WorkerPool;
+
+static WorkerPool _worker_pool;
+
+/* Set once the pool is started. */
+static int _worker_pool_started;
+
+/* Serializes the pool initialization. QemuMutex can't be initialized
+ * statically, so the first caller creates it. */
+static QemuMutex* _worker_pool_init_lock;
+
+/* Returns the number of CPUs available on the host. */
+static int
+_get_cpu_count(void)
+{
+#ifdef _WIN32
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return (int)info.dwNumberOfProcessors;
+#else
+    const long count = sysconf(_SC_NPROCESSORS_ONLN);
+    return count > 0 ? (int)count : 1;
+#endif
+}
+
+/* Runs jobs of the current batch until there are no more jobs left. */
+static void
+_worker_pool_run_jobs(WorkerPool* pool,
+                      WorkerPoolJob job,
+                      void* opaque,
+                      int count)
+{
+    int index;
+
+    while ((index = atomic_fetch_inc(&pool->next)) < count) {
+        job(opaque, index);
+    }
+}
+
+/* Worker thread routine. */
+static void*
+_worker_pool_worker(void* opaque)
+{
+    WorkerPool* const pool = (WorkerPool*)opaque;
+    unsigned generation = 0;
+
+    for (;;) {
+        WorkerPoolJob job;
+        void* job_opaque;
+        int count;
+
+        qemu_mutex_lock(&pool->lock);
+        while (pool->generation == generation) {
+            qemu_cond_wait(&pool->batch_cond, &pool->lock);
+        }
+        generation = pool->generation;
+        job = pool->job;
+        job_opaque = pool->opaque;
+        count = pool->count;
+        qemu_mutex_unlock(&pool->lock);
+
+        _worker_pool_run_jobs(pool, job, job_opaque, count);
+
+        qemu_mutex_lock(&pool->lock);
+        if (--pool->busy == 0) {
+            qemu_cond_signal(&pool->done_cond);
+        }
+        qemu_mutex_unlock(&pool->lock);
+    }
+    return NULL;
+}
+
+/* Starts 'worker_num' worker threads. */
+static void
+_worker_pool_init(WorkerPool* pool, int worker_num)
+{
+    int n;
+
+    qemu_mutex_init(&pool->run_lock);
+    qemu_mutex_init(&pool->lock);
+    qemu_cond_init(&pool->batch_cond);
+    qemu_cond_init(&pool->done_cond);
+
+    pool->worker_num = MAX(worker_num, 0);
+    for (n = 0; n < pool->worker_num; n++) {
+        QemuThread thread;
+        qemu_thread_create(&thread, _worker_pool_worker, pool,
+                           QEMU_THREAD_DETACHED);
+    }
+}
+
+/* Gets the pool, starting it with 'worker_num' workers on first use. Threads
+ * that call this while another one starts the pool block on the
+ * initialization lock. */
+static WorkerPool*
+_worker_pool_start(int worker_num)
+{
+    QemuMutex* lock;
+
+    if (atomic_mb_read(&_worker_pool_started)) {
+        return &_worker_pool;
+    }
+
+    lock = atomic_mb_read(&_worker_pool_init_lock);
+    if (lock == NULL) {
+        QemuMutex* new_lock = g_new(QemuMutex, 1);
+        qemu_mutex_init(new_lock);
+        lock = atomic_cmpxchg(&_worker_pool_init_lock, NULL, new_lock);
+        if (lock == NULL) {
+            lock = new_lock;
+        } else {
+            qemu_mutex_destroy(new_lock);
+            g_free(new_lock);
+        }
+    }
+
+    qemu_mutex_lock(lock);
+    if (!_worker_pool_started) {
+        _worker_pool_init(&_worker_pool, worker_num);
+        atomic_mb_set(&_worker_pool_started, 1);
+    }
+    qemu_mutex_unlock(lock);
+    return &_worker_pool;
+}
+
+/* Gets the pool, starting it on first use with one worker less than there are
+ * CPUs. */
+static WorkerPool*
+_worker_pool_get(void)
+{
+    return _worker_pool_start(MIN(_get_cpu_count() - 1,
+                                  WORKER_POOL_MAX_WORKERS));
+}
+
+void
+worker_pool_start(int worker_num)
+{
+    _worker_pool_start(worker_num);
+}
+
+int
+worker_pool_get_count(void)
+{
+    return _worker_pool_get()->worker_num + 1;
+}
+
+void
+worker_pool_run(WorkerPoolJob job, void* opaque, int count)
+{
+    WorkerPool* const pool = _worker_pool_get();
+    int index;
+
+    if (pool->worker_num > 0 && count > 1 &&
+        qemu_mutex_trylock(&pool->run_lock) == 0) {
+        /* Submit the batch, take part in it, and wait for the workers to
+         * finish. */
+        qemu_mutex_lock(&pool->lock);
+        pool->job = job;
+        pool->opaque = opaque;
+        pool->count = count;
+        pool->next = 0;
+        pool->busy = pool->worker_num;
+        pool->generation++;
+        qemu_cond_broadcast(&pool->batch_cond);
+        qemu_mutex_unlock(&pool->lock);
+
+        _worker_pool_run_jobs(pool, job, opaque, count);
+
+        qemu_mutex_lock(&pool->lock);
+        while (pool->busy > 0) {
+            qemu_cond_wait(&pool->done_cond, &pool->lock);
+        }
+        pool->job = NULL;
+        qemu_mutex_unlock(&pool->lock);
+
+        qemu_mutex_unlock(&pool->run_lock);
+        return;
+    }
+
+    for (index = 0; index < count; index++) {
+        job(opaque, index);
+    }
+}
@@ -0,0 +1,64 @@
+/* Copyright (C) 2015 The Android Open Source Project
+**
+** This software is licensed under the terms of the GNU General Public
+** License version 2, as published by the Free Software Foundation, and
+** may be copied, distributed, and modified under those terms.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+*/
+
+#ifndef _ANDROID_UTILS_WORKER_POOL_H
+#define _ANDROID_UTILS_WORKER_POOL_H
+
+#include "android/utils/compiler.h"
+
+ANDROID_BEGIN_HEADER
+
+/*
+ * Contains declaration of a pool of worker threads shared by the code that
+ * splits CPU-heavy frame processing into independent jobs: the camera frame
+ * converter, and the JPEG compressor.
+ *
+ * The pool is started on first use, with one thread less than there are CPUs
+ * (and at most WORKER_POOL_MAX_WORKERS), since the thread that submits a batch
+ * of jobs runs jobs too.
+ *
+ * This header doesn't include the emulator's threading headers, so that it
+ * can be used by code that uses jpeglib (see the note in jpeg-compress.h).
+ */
+
+/* Maximum number of worker threads in the pool. */
+#define WORKER_POOL_MAX_WORKERS     4
+
+/* A job routine.
+ * Param:
+ *  opaque - Opaque pointer passed to worker_pool_run.
+ *  index - Index of the job to run, from 0 to 'count' - 1.
+ */
+typedef void (*WorkerPoolJob)(void* opaque, int index);
+
+/* Starts the pool with 'worker_num' worker threads, instead of the default
+ * number. Does nothing if the pool is already started. */
+extern void worker_pool_start(int worker_num);
+
+/* Gets the number of threads that worker_pool_run can run jobs on, including
+ * the calling thread. */
+extern int worker_pool_get_count(void);
+
+/* Runs a batch of jobs on the worker threads, and on the calling thread, and
+ * returns when all jobs are done. Jobs may run in any order. If the workers
+ * are busy with a batch submitted by another thread, all jobs are run on the
+ * calling thread instead of waiting for the workers.
+ * Param:
+ *  job - Job routine to call for each job of the batch.
+ *  opaque - Opaque pointer to pass to the job routine.
+ *  count - Number of jobs in the batch.
+ */
+extern void worker_pool_run(WorkerPoolJob job, void* opaque, int count);
+
+ANDROID_END_HEADER
+
+#endif  /* _ANDROID_UTILS_WORKER_POOL_H */
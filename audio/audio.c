@@ -27,6 +27,8 @@
 #include "monitor/monitor.h"
 #include "qemu/timer.h"
 #include "sysemu/sysemu.h"
+#include "qemu/atomic.h"
+#include "qemu/thread.h"
 
 #define AUDIO_CAP "audio"
 #include "audio_int.h"
@@ -160,6 +162,7 @@ static struct {
     int log_to_monitor;
     int try_poll_in;
     int try_poll_out;
+    int thread;
 } conf = {
     .fixed_out = { /* DAC fixed settings */
         .enabled = 1,
@@ -190,6 +193,7 @@ static struct {
     .log_to_monitor = 0,
     .try_poll_in = 1,
     .try_poll_out = 1,
+    .thread = 0,
 };
 
 static AudioState glob_audio_state;
@@ -1185,6 +1189,58 @@ static void audio_pcm_print_info (const char *cap, struct audio_pcm_info *info)
 }
 #endif
 
+/*
+ * Audio thread
+ *
+ * When enabled with QEMU_AUDIO_THREAD, output voices are mixed and played on
+ * a dedicated thread instead of the main loop timer, so that a busy main loop
+ * does not starve the host audio device. Capture voices are still run from
+ * the timer. audio_lock protects the voice lists and the state of the output
+ * voices; it is taken by the public entry points that may touch them, unless
+ * they are called from the audio thread itself (e.g. AUD_write() from a
+ * playback callback).
+ *
+ * The thread runs once per period while an output voice is enabled, and
+ * otherwise sleeps on audio_thread_sem until audio_thread_wakeup() is called
+ * because a voice was enabled, the VM started, or the thread must quit.
+ */
+static QemuMutex audio_lock;
+static QemuSemaphore audio_thread_sem;
+static QemuThread audio_thread;
+static int audio_thread_started;
+static int audio_thread_quit;
+
+static int audio_thread_must_lock (void)
+{
+    return audio_thread_started && !qemu_thread_is_self (&audio_thread);
+}
+
+static void audio_thread_lock (void)
+{
+    if (audio_thread_must_lock ()) {
+        qemu_mutex_lock (&audio_lock);
+    }
+}
+
+static void audio_thread_unlock (void)
+{
+    if (audio_thread_must_lock ()) {
+        qemu_mutex_unlock (&audio_lock);
+    }
+}
+
+static void audio_thread_wakeup (void)
+{
+    if (audio_thread_started) {
+        qemu_sem_post (&audio_thread_sem);
+    }
+}
+
+int AUD_is_threaded (void)
+{
+    return audio_thread_started;
+}
+
 #define DAC
 #include "audio_template.h"
 #undef DAC
@@ -1236,7 +1292,8 @@ static int audio_is_timer_needed (void)
     HWVoiceIn *hwi = NULL;
     HWVoiceOut *hwo = NULL;
 
-    while ((hwo = audio_pcm_hw_find_any_enabled_out (hwo))) {
+    while (!audio_thread_started &&
+           (hwo = audio_pcm_hw_find_any_enabled_out (hwo))) {
         if (!hwo->poll_mode) return 1;
     }
     while ((hwi = audio_pcm_hw_find_any_enabled_in (hwi))) {
@@ -1269,12 +1326,15 @@ int AUD_write (SWVoiceOut *sw, void *buf, int size)
         return size;
     }
 
+    audio_thread_lock ();
     if (!sw->hw->enabled) {
+        audio_thread_unlock ();
         dolog ("Writing to disabled voice %s\n", SW_NAME (sw));
         return 0;
     }
 
     bytes = sw->hw->pcm_ops->write (sw, buf, size);
+    audio_thread_unlock ();
     return bytes;
 }
 
@@ -1309,6 +1369,7 @@ void AUD_set_active_out (SWVoiceOut *sw, int on)
         return;
     }
 
+    audio_thread_lock ();
     hw = sw->hw;
     if (sw->active != on) {
         AudioState *s = &glob_audio_state;
@@ -1322,6 +1383,7 @@ void AUD_set_active_out (SWVoiceOut *sw, int on)
                 if (s->vm_running) {
                     hw->pcm_ops->ctl_out (hw, VOICE_ENABLE, conf.try_poll_out);
                     audio_reset_timer ();
+                    audio_thread_wakeup ();
                 }
             }
         }
@@ -1346,6 +1408,7 @@ void AUD_set_active_out (SWVoiceOut *sw, int on)
         }
         sw->active = on;
     }
+    audio_thread_unlock ();
 }
 
 void AUD_set_active_in (SWVoiceIn *sw, int on)
@@ -1663,9 +1726,11 @@ void audio_run (const char *msg)
 {
     AudioState *s = &glob_audio_state;
 
-    audio_run_out (s);
+    if (!audio_thread_started) {
+        audio_run_out (s);
+        audio_run_capture (s);
+    }
     audio_run_in (s);
-    audio_run_capture (s);
 #ifdef DEBUG_POLL
     {
         static double prevtime;
@@ -1772,6 +1837,12 @@ static struct audio_option audio_options[] = {
         .valp  = &conf.plive,
         .descr = "(undocumented)"
     },
+    {
+        .name  = "THREAD",
+        .tag   = AUD_OPT_BOOL,
+        .valp  = &conf.thread,
+        .descr = "Mix and play output voices on a dedicated thread"
+    },
     {
         .name  = "LOG_TO_MONITOR",
         .tag   = AUD_OPT_BOOL,
@@ -1879,10 +1950,15 @@ static void audio_vm_change_state_handler (void *opaque, int running,
     HWVoiceIn *hwi = NULL;
     int op = running ? VOICE_ENABLE : VOICE_DISABLE;
 
+    audio_thread_lock ();
     s->vm_running = running;
     while ((hwo = audio_pcm_hw_find_any_enabled_out (hwo))) {
         hwo->pcm_ops->ctl_out (hwo, op, conf.try_poll_out);
     }
+    if (running) {
+        audio_thread_wakeup ();
+    }
+    audio_thread_unlock ();
 
     while ((hwi = audio_pcm_hw_find_any_enabled_in (hwi))) {
         hwi->pcm_ops->ctl_in (hwi, op, conf.try_poll_in);
@@ -1890,6 +1966,65 @@ static void audio_vm_change_state_handler (void *opaque, int running,
     audio_reset_timer ();
 }
 
+static void *audio_thread_loop (void *opaque)
+{
+    AudioState *s = opaque;
+    int period_ms = conf.period.ticks / 1000000;
+
+    if (period_ms < 1) {
+        period_ms = 1;
+    }
+
+    while (!atomic_read (&audio_thread_quit)) {
+        int active;
+
+        qemu_mutex_lock (&audio_lock);
+        if (s->vm_running) {
+            audio_run_out (s);
+            audio_run_capture (s);
+        }
+        active = s->vm_running && audio_pcm_hw_find_any_enabled_out (NULL);
+        qemu_mutex_unlock (&audio_lock);
+
+        /* A wakeup posted after the unlock is not lost: the semaphore
+           keeps it until the next wait. */
+        if (active) {
+            qemu_sem_timedwait (&audio_thread_sem, period_ms);
+        }
+        else {
+            qemu_sem_wait (&audio_thread_sem);
+        }
+    }
+    return NULL;
+}
+
+static void audio_thread_start (AudioState *s)
+{
+    qemu_mutex_init (&audio_lock);
+    qemu_sem_init (&audio_thread_sem, 0);
+    /* Hold the lock until audio_thread is filled in, so that the thread
+       can rely on qemu_thread_is_self() from its first iteration. */
+    qemu_mutex_lock (&audio_lock);
+    audio_thread_quit = 0;
+    qemu_thread_create (&audio_thread, audio_thread_loop, s,
+                        QEMU_THREAD_JOINABLE);
+    audio_thread_started = 1;
+    qemu_mutex_unlock (&audio_lock);
+}
+
+static void audio_thread_stop (void)
+{
+    if (!audio_thread_started) {
+        return;
+    }
+    atomic_set (&audio_thread_quit, 1);
+    audio_thread_wakeup ();
+    qemu_thread_join (&audio_thread);
+    audio_thread_started = 0;
+    qemu_sem_destroy (&audio_thread_sem);
+    qemu_mutex_destroy (&audio_lock);
+}
+
 static int initialized;
 
 static void audio_atexit (void)
@@ -1901,6 +2036,8 @@ static void audio_atexit (void)
     if (!initialized) return;
     initialized = 0;
 
+    audio_thread_stop ();
+
     while ((hwo = audio_pcm_hw_find_any_enabled_out (hwo))) {
         SWVoiceCap *sc;
 
@@ -2046,6 +2183,10 @@ static void audio_init (void)
     }
     initialized = 1;
 
+    if (conf.thread) {
+        audio_thread_start (s);
+    }
+
     QLIST_INIT (&s->card_head);
     register_savevm(NULL, "audio", 0, 1, audio_save, audio_load, s);
     audio_reset_timer();
@@ -2091,9 +2232,11 @@ CaptureVoiceOut *AUD_add_capture (
     cb->ops = *ops;
     cb->opaque = cb_opaque;
 
+    audio_thread_lock ();
     cap = audio_pcm_capture_find_specific (as);
     if (cap) {
         QLIST_INSERT_HEAD (&cap->cb_head, cb, entries);
+        audio_thread_unlock ();
         return cap;
     }
     else {
@@ -2144,6 +2287,7 @@ CaptureVoiceOut *AUD_add_capture (
         while ((hw = audio_pcm_hw_find_any_out (hw))) {
             audio_attach_capture (hw);
         }
+        audio_thread_unlock ();
         return cap;
 
     err3:
@@ -2151,6 +2295,7 @@ CaptureVoiceOut *AUD_add_capture (
     err2:
         g_free (cap);
     err1:
+        audio_thread_unlock ();
         g_free (cb);
     err0:
         return NULL;
@@ -2161,6 +2306,7 @@ void AUD_del_capture (CaptureVoiceOut *cap, void *cb_opaque)
 {
     struct capture_callback *cb;
 
+    audio_thread_lock ();
     for (cb = cap->cb_head.lh_first; cb; cb = cb->entries.le_next) {
         if (cb->opaque == cb_opaque) {
             cb->ops.destroy (cb_opaque);
@@ -2189,17 +2335,20 @@ void AUD_del_capture (CaptureVoiceOut *cap, void *cb_opaque)
                 QLIST_REMOVE (cap, entries);
                 g_free (cap);
             }
-            return;
+            break;
         }
     }
+    audio_thread_unlock ();
 }
 
 void AUD_set_volume_out (SWVoiceOut *sw, int mute, uint8_t lvol, uint8_t rvol)
 {
     if (sw) {
+        audio_thread_lock ();
         sw->vol.mute = mute;
         sw->vol.l = nominal_volume.l * lvol / 255;
         sw->vol.r = nominal_volume.r * rvol / 255;
+        audio_thread_unlock ();
     }
 }
 
@@ -95,6 +95,11 @@ void AUD_log (const char *cap, const char *fmt, ...)
     ;
 
 void AUD_help (void);
+/* Returns non-zero if output voices are run on the audio thread
+   (QEMU_AUDIO_THREAD). Playback callbacks are then invoked on that thread
+   and must not touch main loop state (timers, IRQs, guest memory); they
+   may only call AUD_write() and AUD_get_buffer_size_out(). */
+int  AUD_is_threaded (void);
 void AUD_register_card (const char *name, QEMUSoundCard *card);
 void AUD_remove_card (QEMUSoundCard *card);
 CaptureVoiceOut *AUD_add_capture (
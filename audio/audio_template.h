@@ -400,11 +400,13 @@ void glue (AUD_close_, TYPE) (QEMUSoundCard *card, SW *sw)
             return;
         }
 
+        audio_thread_lock ();
         glue (audio_close_, TYPE) (sw);
+        audio_thread_unlock ();
     }
 }
 
-SW *glue (AUD_open_, TYPE) (
+static SW *glue (audio_pcm_open_, TYPE) (
     QEMUSoundCard *card,
     SW *sw,
     const char *name,
@@ -466,7 +468,7 @@ SW *glue (AUD_open_, TYPE) (
 #endif
 
     if (!glue (conf.fixed_, TYPE).enabled && sw) {
-        glue (AUD_close_, TYPE) (card, sw);
+        glue (audio_close_, TYPE) (sw);
         sw = NULL;
     }
 
@@ -523,10 +525,28 @@ SW *glue (AUD_open_, TYPE) (
     return sw;
 
  fail:
-    glue (AUD_close_, TYPE) (card, sw);
+    if (card && sw) {
+        glue (audio_close_, TYPE) (sw);
+    }
     return NULL;
 }
 
+SW *glue (AUD_open_, TYPE) (
+    QEMUSoundCard *card,
+    SW *sw,
+    const char *name,
+    void *callback_opaque ,
+    audio_callback_fn callback_fn,
+    struct audsettings *as
+    )
+{
+    audio_thread_lock ();
+    sw = glue (audio_pcm_open_, TYPE) (card, sw, name, callback_opaque,
+                                       callback_fn, as);
+    audio_thread_unlock ();
+    return sw;
+}
+
 int glue (AUD_is_active_, TYPE) (SW *sw)
 {
     return sw ? sw->active : 0;
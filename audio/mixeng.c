@@ -28,6 +28,15 @@
 #define AUDIO_CAP "mixeng"
 #include "audio_int.h"
 
+#include <math.h>
+
+/* The SSE2 code paths below only deal with the fixed point mixing engine
+ * without volume control, which is what all hosts but OS X use. */
+#if defined(__SSE2__) && !defined(FLOAT_MIXENG) && !defined(CONFIG_MIXEMU)
+#define MIXENG_SSE2
+#include <emmintrin.h>
+#endif
+
 /* 8 bit */
 #define ENDIAN_CONVERSION natural
 #define ENDIAN_CONVERT(v) (v)
@@ -143,6 +152,85 @@
 #undef IN_T
 #undef SHIFT
 
+#ifdef MIXENG_SSE2
+/*
+ * SSE2 versions of the conversions for signed 16 bit stereo samples in host
+ * byte order, the format used by nearly all voices and host backends. They
+ * give exactly the same results as the generic ones above.
+ */
+static void conv_natural_int16_t_to_stereo_sse2
+    (struct st_sample *dst, const void *src, int samples, struct mixeng_volume *vol)
+{
+    const int16_t *in = src;
+    __m128i *out = (__m128i *) dst;
+    const __m128i zero = _mm_setzero_si128 ();
+    int n = samples;
+
+    for (; n >= 4; n -= 4, in += 8, out += 4) {
+        __m128i x = _mm_loadu_si128 ((const __m128i *) in);
+        /* Putting each sample in the upper half of a 32-bit lane shifts it
+         * left by 16 bits, then sign-extend the lanes to 64 bits. */
+        __m128i lo = _mm_unpacklo_epi16 (zero, x);
+        __m128i hi = _mm_unpackhi_epi16 (zero, x);
+        __m128i lo_sign = _mm_srai_epi32 (lo, 31);
+        __m128i hi_sign = _mm_srai_epi32 (hi, 31);
+        _mm_storeu_si128 (out + 0, _mm_unpacklo_epi32 (lo, lo_sign));
+        _mm_storeu_si128 (out + 1, _mm_unpackhi_epi32 (lo, lo_sign));
+        _mm_storeu_si128 (out + 2, _mm_unpacklo_epi32 (hi, hi_sign));
+        _mm_storeu_si128 (out + 3, _mm_unpackhi_epi32 (hi, hi_sign));
+    }
+    if (n) {
+        conv_natural_int16_t_to_stereo (dst + samples - n, in, n, vol);
+    }
+}
+
+/* Clips two stereo samples to four 32-bit lanes holding 16-bit values. */
+static inline __m128i clip_int16_sse2 (const struct st_sample *in)
+{
+    const __m128i zero = _mm_setzero_si128 ();
+    __m128i a = _mm_loadu_si128 ((const __m128i *) in);
+    __m128i b = _mm_loadu_si128 ((const __m128i *) (in + 1));
+    __m128i lo, hi, fits, pos, neg, ret;
+
+    /* Gather the low and high 32-bit halves of the four 64-bit values. */
+    a = _mm_shuffle_epi32 (a, _MM_SHUFFLE (3, 1, 2, 0));
+    b = _mm_shuffle_epi32 (b, _MM_SHUFFLE (3, 1, 2, 0));
+    lo = _mm_unpacklo_epi64 (a, b);
+    hi = _mm_unpackhi_epi64 (a, b);
+
+    /* Same limits as clip_natural_int16_t(): v >= 0x7f000000 gives IN_MAX,
+     * v < INT32_MIN gives IN_MIN. */
+    fits = _mm_cmpeq_epi32 (hi, _mm_srai_epi32 (lo, 31));
+    pos = _mm_or_si128 (
+        _mm_and_si128 (fits, _mm_cmpgt_epi32 (lo, _mm_set1_epi32 (0x7effffff))),
+        _mm_andnot_si128 (fits, _mm_cmpgt_epi32 (hi, _mm_set1_epi32 (-1))));
+    neg = _mm_andnot_si128 (fits, _mm_cmplt_epi32 (hi, zero));
+
+    ret = _mm_andnot_si128 (_mm_or_si128 (pos, neg), _mm_srai_epi32 (lo, 16));
+    ret = _mm_or_si128 (ret, _mm_and_si128 (pos, _mm_set1_epi32 (SHRT_MAX)));
+    return _mm_or_si128 (ret, _mm_and_si128 (neg, _mm_set1_epi32 (SHRT_MIN)));
+}
+
+static void clip_natural_int16_t_from_stereo_sse2
+    (void *dst, const struct st_sample *src, int samples)
+{
+    int16_t *out = dst;
+    int n = samples;
+
+    for (; n >= 4; n -= 4, src += 4, out += 8) {
+        __m128i x = _mm_packs_epi32 (clip_int16_sse2 (src),
+                                     clip_int16_sse2 (src + 2));
+        _mm_storeu_si128 ((__m128i *) out, x);
+    }
+    if (n) {
+        clip_natural_int16_t_from_stereo (out, src, n);
+    }
+}
+
+#define conv_natural_int16_t_to_stereo conv_natural_int16_t_to_stereo_sse2
+#define clip_natural_int16_t_from_stereo clip_natural_int16_t_from_stereo_sse2
+#endif  /* MIXENG_SSE2 */
+
 t_sample *mixeng_conv[2][2][2][3] = {
     {
         {
@@ -253,6 +341,11 @@ f_sample *mixeng_clip[2][2][2][3] = {
     }
 };
 
+#ifdef MIXENG_SSE2
+#undef conv_natural_int16_t_to_stereo
+#undef clip_natural_int16_t_from_stereo
+#endif
+
 /*
  * August 21, 1998
  * Copyright 1998 Fabrice Bellard.
@@ -270,38 +363,129 @@ f_sample *mixeng_clip[2][2][2][3] = {
  * Sound Tools rate change effect file.
  */
 /*
- * Linear Interpolation.
- *
- * The use of fractional increment allows us to use no buffer. It
- * avoid the problems at the end of the buffer we had with the old
- * method which stored a possibly big buffer of size
- * lcm(in_rate,out_rate).
+ * Polyphase FIR interpolation.
  *
- * Limited to 16 bit samples and sampling frequency <= 65535 Hz. If
- * the input & output frequencies are equal, a delay of one sample is
- * introduced.  Limited to processing 32-bit count worth of samples.
+ * The use of fractional increment allows us to only keep the last
+ * taps input samples. Each output sample is computed from them
+ * with a windowed sinc filter, picked among RATE_PHASES precomputed
+ * ones according to the fractional output position. When downsampling,
+ * the filter cutoff follows the output rate, to avoid aliasing, and the
+ * filter gets longer so that it keeps the same number of sinc lobes.
  *
- * 1 << FRAC_BITS evaluating to zero in several places.  Changed with
- * an (unsigned long) cast to make it safe.  MarkMLl 2/1/99
+ * This introduces a delay of taps / 2 input samples. If the input
+ * and output frequencies are equal, samples are copied as is.
  */
 
+/* Filter length, in input samples, when upsampling. This is multiplied by
+ * the downsampling factor rounded up to a power of two, up to
+ * RATE_TAPS_MAX. */
+#define RATE_TAPS        16
+#define RATE_TAPS_MAX    128
+/* Number of filter phases between two input samples. */
+#define RATE_PHASE_BITS  8
+#define RATE_PHASES      (1 << RATE_PHASE_BITS)
+/* Precision of the fixed point filter coefficients. */
+#define RATE_COEF_BITS   14
+
+#ifdef FLOAT_MIXENG
+typedef mixeng_real rate_coef;
+#else
+typedef int32_t rate_coef;
+#endif
+
 /* Private data */
 struct rate {
     uint64_t opos;
     uint64_t opos_inc;
     uint32_t ipos;              /* position in the input stream (integer) */
-    struct st_sample ilast;          /* last sample in the input stream */
+    /* filter length, a power of two */
+    int taps;
+    /* last 'taps' input samples, stored twice so that they can always
+     * be read as a contiguous window starting at ipos % taps */
+    struct st_sample *hist;
+    /* filter coefficients for each phase, including the phase of the
+     * next input sample: RATE_PHASES + 1 rows of 'taps' */
+    rate_coef *coefs;
 };
 
+/* Blackman-windowed sinc spanning 'taps' input samples, 'x' is the distance
+ * to the filter center in input samples, 'cutoff' is relative to the input
+ * Nyquist frequency. */
+static double rate_filter (double x, int taps, double cutoff)
+{
+    const double half = taps / 2;
+    double sinc, window;
+
+    if (x <= -half || x >= half) {
+        return 0;
+    }
+    window = 0.42 + 0.5 * cos (M_PI * x / half) + 0.08 * cos (2 * M_PI * x / half);
+    sinc = (x == 0) ? 1 : sin (M_PI * cutoff * x) / (M_PI * cutoff * x);
+    return cutoff * sinc * window;
+}
+
+static void rate_init_coefs (struct rate *rate, int inrate, int outrate)
+{
+    /* when downsampling, leave some room for the transition band below the
+     * output Nyquist frequency */
+    const double cutoff = outrate < inrate ? 0.9 * outrate / inrate : 1.0;
+    const int taps = rate->taps;
+    int phase, k;
+
+    for (phase = 0; phase <= RATE_PHASES; phase++) {
+        const double center = taps / 2 - 1 + (double) phase / RATE_PHASES;
+        rate_coef *coefs = rate->coefs + phase * taps;
+        double h[RATE_TAPS_MAX], sum = 0;
+
+        for (k = 0; k < taps; k++) {
+            h[k] = rate_filter (k - center, taps, cutoff);
+            sum += h[k];
+        }
+        /* normalize each phase to unity gain, to keep DC levels as is */
+#ifdef FLOAT_MIXENG
+        for (k = 0; k < taps; k++) {
+            coefs[k] = h[k] / sum;
+        }
+#else
+        {
+            int32_t total = 0;
+            for (k = 0; k < taps; k++) {
+                coefs[k] = lrint (h[k] / sum * (1 << RATE_COEF_BITS));
+                total += coefs[k];
+            }
+            coefs[taps / 2 - 1 + (phase >= RATE_PHASES / 2)] +=
+                (1 << RATE_COEF_BITS) - total;
+        }
+#endif
+    }
+}
+
 /*
  * Prepare processing.
  */
 void *st_rate_start (int inrate, int outrate)
 {
-    struct rate *rate = audio_calloc (AUDIO_FUNC, 1, sizeof (*rate));
+    struct rate *rate;
+    int taps = RATE_TAPS;
+    size_t size;
+
+    if (inrate != outrate) {
+        while (taps < RATE_TAPS_MAX &&
+               (int64_t) taps * outrate < (int64_t) RATE_TAPS * inrate) {
+            taps *= 2;
+        }
+    }
 
+    /* the history and the coefficients follow the structure, which keeps
+     * them aligned, and are only needed when the rates differ */
+    size = sizeof (*rate);
+    if (inrate != outrate) {
+        size += 2 * taps * sizeof (struct st_sample) +
+            (RATE_PHASES + 1) * taps * sizeof (rate_coef);
+    }
+    rate = audio_calloc (AUDIO_FUNC, 1, size);
     if (!rate) {
-        dolog ("Could not allocate resampler (%u bytes)\n", (int)sizeof (*rate));
+        dolog ("Could not allocate resampler (%u bytes)\n", (int) size);
         return NULL;
     }
 
@@ -311,17 +495,49 @@ void *st_rate_start (int inrate, int outrate)
     rate->opos_inc = ((uint64_t) inrate << 32) / outrate;
 
     rate->ipos = 0;
-    rate->ilast.l = 0;
-    rate->ilast.r = 0;
+    rate->taps = taps;
+    if (inrate != outrate) {
+        rate->hist = (struct st_sample *) (rate + 1);
+        rate->coefs = (rate_coef *) (rate->hist + 2 * taps);
+        rate_init_coefs (rate, inrate, outrate);
+    }
     return rate;
 }
 
+/* Copies or mixes samples when the input and output rates are equal. */
+static void rate_copy (struct st_sample *obuf, const struct st_sample *ibuf,
+                       int n)
+{
+    memcpy (obuf, ibuf, n * sizeof (*obuf));
+}
+
+static void rate_mix (struct st_sample *obuf, const struct st_sample *ibuf,
+                      int n)
+{
+    int i = 0;
+#ifdef MIXENG_SSE2
+    for (; i < n; i++) {
+        __m128i *o = (__m128i *) (obuf + i);
+        _mm_storeu_si128 (o, _mm_add_epi64 (
+            _mm_loadu_si128 (o),
+            _mm_loadu_si128 ((const __m128i *) (ibuf + i))));
+    }
+#else
+    for (; i < n; i++) {
+        obuf[i].l += ibuf[i].l;
+        obuf[i].r += ibuf[i].r;
+    }
+#endif
+}
+
 #define NAME st_rate_flow_mix
 #define OP(a, b) a += b
+#define OP_BLOCK rate_mix
 #include "rate_template.h"
 
 #define NAME st_rate_flow
 #define OP(a, b) a = b
+#define OP_BLOCK rate_copy
 #include "rate_template.h"
 
 void st_rate_stop (void *opaque)
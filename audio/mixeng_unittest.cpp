@@ -0,0 +1,494 @@
+// Copyright 2015 The Android Open Source Project
+//
+// This software is licensed under the terms of the GNU General Public
+// License version 2, as published by the Free Software Foundation, and
+// may be copied, distributed, and modified under those terms.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+#include <stdint.h>
+
+extern "C" {
+#include "audio/mixeng.h"
+}
+
+#include <gtest/gtest.h>
+
+#include <math.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <vector>
+
+// Helpers used by mixeng.c, which live in audio.c.
+
+extern "C" void* audio_calloc(const char* funcname, int nmemb, size_t size) {
+    return calloc(nmemb, size);
+}
+
+extern "C" void AUD_log(const char* cap, const char* fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    fprintf(stderr, "%s: ", cap);
+    vfprintf(stderr, fmt, args);
+    va_end(args);
+}
+
+// The signed 16-bit stereo conversions in host byte order use SSE2 when
+// mixeng.c is built with it. The byte-swapped ones always use the generic
+// code, and serve as the reference.
+
+namespace {
+
+t_sample* const kConv = mixeng_conv[1][1][0][1];
+t_sample* const kConvGeneric = mixeng_conv[1][1][1][1];
+f_sample* const kClip = mixeng_clip[1][1][0][1];
+f_sample* const kClipGeneric = mixeng_clip[1][1][1][1];
+
+int16_t swap16(int16_t v) {
+    return (int16_t)(((uint16_t)v >> 8) | ((uint16_t)v << 8));
+}
+
+std::vector<int16_t> swapped(const std::vector<int16_t>& in) {
+    std::vector<int16_t> out(in.size());
+    for (size_t n = 0; n < in.size(); ++n) {
+        out[n] = swap16(in[n]);
+    }
+    return out;
+}
+
+int16_t clipReference(int64_t v) {
+    if (v >= 0x7f000000) {
+        return INT16_MAX;
+    }
+    if (v < INT32_MIN) {
+        return INT16_MIN;
+    }
+    return (int16_t)(v >> 16);
+}
+
+int64_t random64() {
+    uint64_t v = 0;
+    for (int n = 0; n < 4; ++n) {
+        v = (v << 16) ^ (rand() & 0xffff);
+    }
+    return (int64_t)v;
+}
+
+// Lengths that exercise the vector loops and their scalar tails.
+const int kLengths[] = { 0, 1, 2, 3, 4, 5, 7, 8, 9, 13, 1024, 1027 };
+
+}  // namespace
+
+TEST(Mixeng, ConvInt16StereoMatchesGeneric) {
+    srand(1);
+    for (size_t li = 0; li < sizeof(kLengths) / sizeof(kLengths[0]); ++li) {
+        const int samples = kLengths[li];
+        SCOPED_TRACE(testing::Message() << samples << " samples");
+        std::vector<int16_t> in(2 * samples + 1);
+        for (size_t n = 0; n < in.size(); ++n) {
+            switch (n % 8) {
+            case 0: in[n] = INT16_MIN; break;
+            case 1: in[n] = INT16_MAX; break;
+            case 2: in[n] = -1; break;
+            default: in[n] = (int16_t)rand(); break;
+            }
+        }
+        std::vector<int16_t> inSwapped = swapped(in);
+        struct mixeng_volume vol = { 0, 1LL << 32, 1LL << 32 };
+        // One more sample than converted, to catch overruns.
+        struct st_sample guard = { 0x1234, 0x5678 };
+        std::vector<struct st_sample> out(samples + 1, guard);
+        std::vector<struct st_sample> ref(samples + 1, guard);
+
+        kConv(&out[0], &in[0], samples, &vol);
+        kConvGeneric(&ref[0], &inSwapped[0], samples, &vol);
+        for (int n = 0; n < samples; ++n) {
+            ASSERT_EQ((int64_t)in[2 * n] << 16, out[n].l) << "sample " << n;
+            ASSERT_EQ((int64_t)in[2 * n + 1] << 16, out[n].r) << "sample " << n;
+            ASSERT_EQ(ref[n].l, out[n].l) << "sample " << n;
+            ASSERT_EQ(ref[n].r, out[n].r) << "sample " << n;
+        }
+        EXPECT_EQ(guard.l, out[samples].l);
+        EXPECT_EQ(guard.r, out[samples].r);
+    }
+}
+
+TEST(Mixeng, ClipInt16StereoMatchesGeneric) {
+    // Values around the clipping limits, and where the 64-bit values don't
+    // fit in 32 bits.
+    static const int64_t kEdges[] = {
+        0, 1, -1, 0xffff, 0x10000, -0x10000, -0x10001,
+        0x7effffff, 0x7f000000, 0x7f000001, 0x7fffffff, 0x80000000LL,
+        INT32_MIN, (int64_t)INT32_MIN - 1, (int64_t)INT32_MIN + 0x10000,
+        0xffffffffLL, 0x100000000LL, -0x100000000LL, 0x17f000000LL,
+        INT64_MAX, INT64_MIN, INT64_MIN + 0x80000000LL,
+    };
+    const int numEdges = sizeof(kEdges) / sizeof(kEdges[0]);
+
+    srand(2);
+    for (size_t li = 0; li < sizeof(kLengths) / sizeof(kLengths[0]); ++li) {
+        const int samples = kLengths[li];
+        SCOPED_TRACE(testing::Message() << samples << " samples");
+        std::vector<struct st_sample> in(samples);
+        for (int n = 0; n < samples; ++n) {
+            int64_t* v[2] = { &in[n].l, &in[n].r };
+            for (int c = 0; c < 2; ++c) {
+                const int k = 2 * n + c;
+                if (k % 3 == 0) {
+                    *v[c] = kEdges[(k / 3) % numEdges];
+                } else if (k % 3 == 1) {
+                    // Mostly in range, sometimes a bit over.
+                    *v[c] = random64() >> 31;
+                } else {
+                    *v[c] = random64() >> (rand() % 64);
+                }
+            }
+        }
+        // One more sample than clipped, to catch overruns.
+        std::vector<int16_t> out(2 * samples + 2, 0x2a2a);
+        std::vector<int16_t> ref(2 * samples + 2, 0x2a2a);
+
+        kClip(&out[0], samples ? &in[0] : NULL, samples);
+        kClipGeneric(&ref[0], samples ? &in[0] : NULL, samples);
+        ref = swapped(ref);
+        for (int n = 0; n < samples; ++n) {
+            ASSERT_EQ(clipReference(in[n].l), out[2 * n])
+                    << "sample " << n << ": " << in[n].l;
+            ASSERT_EQ(clipReference(in[n].r), out[2 * n + 1])
+                    << "sample " << n << ": " << in[n].r;
+            // The generic byte-swapped code doesn't swap the limits it
+            // clips to, so it is only a reference for the other values.
+            if (out[2 * n] != INT16_MAX && out[2 * n] != INT16_MIN) {
+                ASSERT_EQ(ref[2 * n], out[2 * n]) << "sample " << n;
+            }
+            if (out[2 * n + 1] != INT16_MAX && out[2 * n + 1] != INT16_MIN) {
+                ASSERT_EQ(ref[2 * n + 1], out[2 * n + 1]) << "sample " << n;
+            }
+        }
+        EXPECT_EQ(0x2a2a, out[2 * samples]);
+        EXPECT_EQ(0x2a2a, out[2 * samples + 1]);
+    }
+}
+
+TEST(Mixeng, ConvThenClipRoundTrips) {
+    std::vector<int16_t> in(2 * 1001);
+    for (size_t n = 0; n < in.size(); ++n) {
+        in[n] = (int16_t)(n * 65.537);
+    }
+    struct mixeng_volume vol = { 0, 1LL << 32, 1LL << 32 };
+    std::vector<struct st_sample> mix(1001);
+    std::vector<int16_t> out(in.size());
+    kConv(&mix[0], &in[0], 1001, &vol);
+    kClip(&out[0], &mix[0], 1001);
+    // Full scale positive values are clipped a bit early.
+    for (size_t n = 0; n < in.size(); ++n) {
+        ASSERT_EQ(in[n] >= 0x7f00 ? INT16_MAX : in[n], out[n]) << n;
+    }
+}
+
+namespace {
+
+// Number of input samples the resampler delays its output by: half its
+// filter length, which is 16 input samples times the downsampling factor
+// rounded up to a power of two, up to 128.
+int rateDelay(int inRate, int outRate) {
+    int taps = 16;
+    while (taps < 128 && taps * outRate < 16 * inRate) {
+        taps *= 2;
+    }
+    return taps / 2;
+}
+
+// Number of output samples that depend on the resampler's initial silence.
+size_t rateWarmup(int inRate, int outRate) {
+    return 2 * rateDelay(inRate, outRate) * outRate / inRate + 1;
+}
+
+// Runs a resampler from |inRate| to |outRate| over |in|, feeding it at most
+// |chunk| input samples at a time and asking for at most |chunk| output
+// samples, until all the input is consumed.
+std::vector<struct st_sample> resample(int inRate, int outRate,
+                                       const std::vector<struct st_sample>& in,
+                                       int chunk) {
+    void* rate = st_rate_start(inRate, outRate);
+    std::vector<struct st_sample> out;
+    struct st_sample buf[4096];
+    size_t pos = 0;
+    while (pos < in.size()) {
+        int isamp = (int)(in.size() - pos);
+        if (isamp > chunk) {
+            isamp = chunk;
+        }
+        int osamp = chunk;
+        st_rate_flow(rate, const_cast<struct st_sample*>(&in[pos]), buf,
+                     &isamp, &osamp);
+        pos += isamp;
+        out.insert(out.end(), buf, buf + osamp);
+    }
+    st_rate_stop(rate);
+    return out;
+}
+
+// Creates |count| samples of a sine of |freq| Hz at |rate| Hz, with a
+// quarter of the full scale amplitude.
+std::vector<struct st_sample> sine(int rate, double freq, int count) {
+    std::vector<struct st_sample> samples(count);
+    for (int n = 0; n < count; ++n) {
+        const double v =
+                sin(2 * M_PI * freq * n / rate) * (1LL << 29);
+        samples[n].l = llrint(v);
+        samples[n].r = -samples[n].l;
+    }
+    return samples;
+}
+
+// Resamples one second of a sine of |freq| Hz, and returns the ratio of the
+// error power to the signal power, in dB, compared to an ideal resampler.
+double resampleErrorDb(int inRate, int outRate, double freq) {
+    std::vector<struct st_sample> out =
+            resample(inRate, outRate, sine(inRate, freq, inRate), 4096);
+    // Output sample n is input sample n * inRate / outRate - delay.
+    const double step = (double)inRate / outRate;
+    const int delay = rateDelay(inRate, outRate);
+    double signal = 0;
+    double error = 0;
+    for (size_t n = rateWarmup(inRate, outRate); n < out.size(); ++n) {
+        const double t = n * step - delay;
+        const double ideal = sin(2 * M_PI * freq * t / inRate) * (1LL << 29);
+        signal += ideal * ideal * 2;
+        error += (out[n].l - ideal) * (out[n].l - ideal);
+        error += (out[n].r + ideal) * (out[n].r + ideal);
+    }
+    return 10 * log10(error / signal);
+}
+
+// Returns the power of |samples| relative to a quarter full scale sine, in
+// dB, skipping the first |skip| samples.
+double powerDb(const std::vector<struct st_sample>& samples, size_t skip) {
+    double power = 0;
+    for (size_t n = skip; n < samples.size(); ++n) {
+        power += (double)samples[n].l * samples[n].l;
+    }
+    power /= samples.size() - skip;
+    const double full = (double)(1LL << 29) * (1LL << 29) / 2;
+    return 10 * log10(power / full);
+}
+
+struct RatePair {
+    int in;
+    int out;
+};
+
+const RatePair kRatePairs[] = {
+    { 8000, 44100 },
+    { 11025, 48000 },
+    { 22050, 44100 },
+    { 44100, 48000 },
+    { 48000, 44100 },
+    { 44100, 22050 },
+    { 48000, 8000 },
+};
+
+}  // namespace
+
+TEST(MixengRate, EqualRatesCopyAndMix) {
+    std::vector<struct st_sample> in = sine(44100, 1000, 1000);
+    void* rate = st_rate_start(44100, 44100);
+
+    std::vector<struct st_sample> out(800);
+    int isamp = 1000;
+    int osamp = 800;
+    st_rate_flow(rate, &in[0], &out[0], &isamp, &osamp);
+    EXPECT_EQ(800, isamp);
+    EXPECT_EQ(800, osamp);
+    EXPECT_EQ(0, memcmp(&in[0], &out[0], 800 * sizeof(out[0])));
+
+    std::vector<struct st_sample> mix(1000);
+    for (size_t n = 0; n < mix.size(); ++n) {
+        mix[n].l = n;
+        mix[n].r = -3 * (int64_t)n;
+    }
+    isamp = 999;
+    osamp = 1000;
+    st_rate_flow_mix(rate, &in[0], &mix[0], &isamp, &osamp);
+    EXPECT_EQ(999, isamp);
+    EXPECT_EQ(999, osamp);
+    for (int n = 0; n < 999; ++n) {
+        ASSERT_EQ(in[n].l + n, mix[n].l) << n;
+        ASSERT_EQ(in[n].r - 3 * n, mix[n].r) << n;
+    }
+    EXPECT_EQ(999, mix[999].l);
+    EXPECT_EQ(-2997, mix[999].r);
+
+    st_rate_stop(rate);
+}
+
+TEST(MixengRate, KeepsDcLevel) {
+    for (size_t ri = 0; ri < sizeof(kRatePairs) / sizeof(kRatePairs[0]);
+         ++ri) {
+        const RatePair& r = kRatePairs[ri];
+        SCOPED_TRACE(testing::Message() << r.in << " -> " << r.out);
+        const struct st_sample dc = { 0x12345678, -0x7654321 };
+        std::vector<struct st_sample> in(r.in / 10, dc);
+        std::vector<struct st_sample> out = resample(r.in, r.out, in, 4096);
+        EXPECT_NEAR(r.out / 10, (int)out.size(), 2);
+        // Past the filter's initial silence, the phases have unity gain.
+        for (size_t n = rateWarmup(r.in, r.out); n < out.size(); ++n) {
+            ASSERT_EQ(dc.l, out[n].l) << n;
+            ASSERT_EQ(dc.r, out[n].r) << n;
+        }
+    }
+}
+
+TEST(MixengRate, MatchesIdealResampler) {
+    for (size_t ri = 0; ri < sizeof(kRatePairs) / sizeof(kRatePairs[0]);
+         ++ri) {
+        const RatePair& r = kRatePairs[ri];
+        // A tone well within the pass band of both rates.
+        const double freq = (r.in < r.out ? r.in : r.out) * 0.15;
+        const double db = resampleErrorDb(r.in, r.out, freq);
+        EXPECT_GT(-55, db) << r.in << " -> " << r.out << " at " << freq
+                           << " Hz";
+    }
+}
+
+TEST(MixengRate, AttenuatesAliasesWhenDownsampling) {
+    // Tones above the output Nyquist frequency would alias to audible ones.
+    const RatePair pairs[] = { { 44100, 22050 }, { 48000, 8000 } };
+    for (size_t ri = 0; ri < sizeof(pairs) / sizeof(pairs[0]); ++ri) {
+        const RatePair& r = pairs[ri];
+        const double freq = r.out * 0.7;
+        std::vector<struct st_sample> out =
+                resample(r.in, r.out, sine(r.in, freq, r.in), 4096);
+        EXPECT_GT(-50, powerDb(out, rateWarmup(r.in, r.out)))
+                << r.in << " -> " << r.out << " at " << freq << " Hz";
+    }
+}
+
+TEST(MixengRate, ChunksDontChangeOutput) {
+    srand(3);
+    for (size_t ri = 0; ri < sizeof(kRatePairs) / sizeof(kRatePairs[0]);
+         ++ri) {
+        const RatePair& r = kRatePairs[ri];
+        SCOPED_TRACE(testing::Message() << r.in << " -> " << r.out);
+        std::vector<struct st_sample> in = sine(r.in, 440, r.in / 4);
+        std::vector<struct st_sample> whole = resample(r.in, r.out, in, 4096);
+
+        // Random input and output sizes, some of them zero, and mixing
+        // into a buffer that already holds samples.
+        void* rate = st_rate_start(r.in, r.out);
+        std::vector<struct st_sample> mixed(whole.size() + 64);
+        for (size_t n = 0; n < mixed.size(); ++n) {
+            mixed[n].l = 7 * n;
+            mixed[n].r = -(int64_t)n;
+        }
+        size_t ipos = 0;
+        size_t opos = 0;
+        while (ipos < in.size()) {
+            int isamp = rand() % 50;
+            int osamp = rand() % 50;
+            if (isamp > (int)(in.size() - ipos)) {
+                isamp = in.size() - ipos;
+            }
+            if (osamp > (int)(mixed.size() - opos)) {
+                osamp = mixed.size() - opos;
+            }
+            st_rate_flow_mix(rate, &in[ipos], &mixed[opos], &isamp, &osamp);
+            ipos += isamp;
+            opos += osamp;
+        }
+        st_rate_stop(rate);
+
+        ASSERT_EQ(whole.size(), opos);
+        for (size_t n = 0; n < whole.size(); ++n) {
+            ASSERT_EQ(whole[n].l + 7 * (int64_t)n, mixed[n].l) << n;
+            ASSERT_EQ(whole[n].r - (int64_t)n, mixed[n].r) << n;
+        }
+    }
+}
+
+namespace {
+
+double nowMs() {
+    return (double)clock() * 1000. / CLOCKS_PER_SEC;
+}
+
+}  // namespace
+
+// Compares the int16 stereo conversion and clipping, which use SSE2 when
+// available, with the generic code of the byte-swapped ones, and prints the
+// cost of resampling one second of stereo audio. Run with
+// --gtest_also_run_disabled_tests.
+TEST(MixengBenchmark, DISABLED_Benchmark) {
+    const int kSamples = 4096;
+    const int kIterations = 20000;
+    std::vector<int16_t> pcm(2 * kSamples);
+    for (size_t n = 0; n < pcm.size(); ++n) {
+        pcm[n] = (int16_t)rand();
+    }
+    std::vector<struct st_sample> mix(kSamples);
+    struct mixeng_volume vol = { 0, 1LL << 32, 1LL << 32 };
+
+    double start = nowMs();
+    for (int n = 0; n < kIterations; ++n) {
+        kConvGeneric(&mix[0], &pcm[0], kSamples, &vol);
+    }
+    double genericMs = nowMs() - start;
+    start = nowMs();
+    for (int n = 0; n < kIterations; ++n) {
+        kConv(&mix[0], &pcm[0], kSamples, &vol);
+    }
+    double ms = nowMs() - start;
+    printf("conv int16 stereo  generic %7.2f ns/sample, now %7.2f ns/sample "
+           "(%.1fx)\n",
+           genericMs * 1e6 / kIterations / kSamples,
+           ms * 1e6 / kIterations / kSamples, genericMs / ms);
+
+    for (int n = 0; n < kSamples; ++n) {
+        mix[n].l = random64() >> 30;
+        mix[n].r = random64() >> 31;
+    }
+    start = nowMs();
+    for (int n = 0; n < kIterations; ++n) {
+        kClipGeneric(&pcm[0], &mix[0], kSamples);
+    }
+    genericMs = nowMs() - start;
+    start = nowMs();
+    for (int n = 0; n < kIterations; ++n) {
+        kClip(&pcm[0], &mix[0], kSamples);
+    }
+    ms = nowMs() - start;
+    printf("clip int16 stereo  generic %7.2f ns/sample, now %7.2f ns/sample "
+           "(%.1fx)\n",
+           genericMs * 1e6 / kIterations / kSamples,
+           ms * 1e6 / kIterations / kSamples, genericMs / ms);
+
+    const RatePair pairs[] = {
+        { 44100, 44100 }, { 8000, 44100 }, { 44100, 48000 }, { 44100, 22050 },
+        { 48000, 8000 },
+    };
+    const int kSeconds = 20;
+    for (size_t ri = 0; ri < sizeof(pairs) / sizeof(pairs[0]); ++ri) {
+        const RatePair& r = pairs[ri];
+        std::vector<struct st_sample> in = sine(r.in, 440, r.in);
+        std::vector<struct st_sample> out(r.out + 1);
+        void* rate = st_rate_start(r.in, r.out);
+        start = nowMs();
+        for (int n = 0; n < kSeconds; ++n) {
+            int isamp = r.in;
+            int osamp = r.out + 1;
+            st_rate_flow_mix(rate, &in[0], &out[0], &isamp, &osamp);
+        }
+        ms = nowMs() - start;
+        st_rate_stop(rate);
+        printf("resample %5d -> %5d  %7.3f ms per second of audio\n",
+               r.in, r.out, ms / kSeconds);
+    }
+}
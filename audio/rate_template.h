@@ -31,16 +31,9 @@ void NAME (void *opaque, struct st_sample *ibuf, struct st_sample *obuf,
            int *isamp, int *osamp)
 {
     struct rate *rate = opaque;
+    const int taps = rate->taps;
     struct st_sample *istart, *iend;
     struct st_sample *ostart, *oend;
-    struct st_sample ilast, icur, out;
-#ifdef FLOAT_MIXENG
-    mixeng_real t;
-#else
-    int64_t t;
-#endif
-
-    ilast = rate->ilast;
 
     istart = ibuf;
     iend = ibuf + *isamp;
@@ -49,63 +42,70 @@ void NAME (void *opaque, struct st_sample *ibuf, struct st_sample *obuf,
     oend = obuf + *osamp;
 
     if (rate->opos_inc == (1ULL + UINT_MAX)) {
-        int i, n = *isamp > *osamp ? *osamp : *isamp;
-        for (i = 0; i < n; i++) {
-            OP (obuf[i].l, ibuf[i].l);
-            OP (obuf[i].r, ibuf[i].r);
-        }
+        int n = *isamp > *osamp ? *osamp : *isamp;
+        OP_BLOCK (obuf, ibuf, n);
         *isamp = n;
         *osamp = n;
         return;
     }
 
     while (obuf < oend) {
-
-        /* Safety catch to make sure we have input samples.  */
-        if (ibuf >= iend) {
-            break;
-        }
+        const struct st_sample *window;
+        unsigned int phase;
+        int k;
+        const rate_coef *coefs;
+#ifdef FLOAT_MIXENG
+        mixeng_real l = 0, r = 0;
+#else
+        int64_t l = 0, r = 0;
+#endif
 
         /* read as many input samples so that ipos > opos */
 
         while (rate->ipos <= (rate->opos >> 32)) {
-            ilast = *ibuf++;
-            rate->ipos++;
             /* See if we finished the input buffer yet */
             if (ibuf >= iend) {
                 goto the_end;
             }
+            k = rate->ipos & (taps - 1);
+            rate->hist[k] = rate->hist[k + taps] = *ibuf++;
+            rate->ipos++;
         }
 
-        icur = *ibuf;
+        /* filter the last 'taps' input samples with the coefficients of
+         * the phase nearest to the output position */
+        phase = ((rate->opos & UINT_MAX) + (1U << (31 - RATE_PHASE_BITS)))
+                >> (32 - RATE_PHASE_BITS);
+        coefs = rate->coefs + phase * taps;
+        window = rate->hist + (rate->ipos & (taps - 1));
+        for (k = 0; k < taps; k++) {
+            l += window[k].l * coefs[k];
+            r += window[k].r * coefs[k];
+        }
 
-        /* interpolate */
+        /* output sample & increment position */
 #ifdef FLOAT_MIXENG
-#ifdef RECIPROCAL
-        t = (rate->opos & UINT_MAX) * (1.f / UINT_MAX);
+        OP (obuf->l, l);
+        OP (obuf->r, r);
 #else
-        t = (rate->opos & UINT_MAX) / (mixeng_real) UINT_MAX;
+        OP (obuf->l, l >> RATE_COEF_BITS);
+        OP (obuf->r, r >> RATE_COEF_BITS);
 #endif
-        out.l = (ilast.l * (1.0 - t)) + icur.l * t;
-        out.r = (ilast.r * (1.0 - t)) + icur.r * t;
-#else
-        t = rate->opos & 0xffffffff;
-        out.l = (ilast.l * ((int64_t) UINT_MAX - t) + icur.l * t) >> 32;
-        out.r = (ilast.r * ((int64_t) UINT_MAX - t) + icur.r * t) >> 32;
-#endif
-
-        /* output sample & increment position */
-        OP (obuf->l, out.l);
-        OP (obuf->r, out.r);
         obuf += 1;
         rate->opos += rate->opos_inc;
     }
 
 the_end:
+    /* keep the positions far from overflowing, without changing the
+     * history window alignment */
+    if (rate->ipos >= (1U << 31)) {
+        rate->ipos -= 1U << 31;
+        rate->opos -= (uint64_t) (1U << 31) << 32;
+    }
     *isamp = ibuf - istart;
     *osamp = obuf - ostart;
-    rate->ilast = ilast;
 }
 
 #undef NAME
 #undef OP
+#undef OP_BLOCK
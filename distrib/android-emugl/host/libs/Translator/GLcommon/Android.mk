@@ -8,6 +8,7 @@ host_common_SRC_FILES :=     \
      GLESpointer.cpp         \
      GLESbuffer.cpp          \
      RangeManip.cpp          \
+     TextureDecoder.cpp      \
      TextureUtils.cpp        \
      PaletteTexture.cpp      \
      etc1.cpp                \
@@ -54,3 +55,25 @@ $(call emugl-export,C_INCLUDES,$(LOCAL_PATH)/../include $(EMUGL_PATH)/shared)
 $(call emugl-export,STATIC_LIBRARIES, lib64emugl_common)
 
 $(call emugl-end-module)
+
+
+### GLcommon unit tests ############################################
+# Only covers the texture decoders, which don't need a GL implementation.
+
+host_unittests_SRC_FILES := \
+    etc1.cpp \
+    PaletteTexture.cpp \
+    TextureDecoder.cpp \
+    TextureDecoder_unittest.cpp \
+
+$(call emugl-begin-host-executable,libGLcommon_unittests)
+LOCAL_SRC_FILES := $(host_unittests_SRC_FILES)
+LOCAL_C_INCLUDES += $(LOCAL_PATH)/../include $(EMUGL_PATH)/shared
+$(call emugl-import,libemugl_common libemugl_gtest)
+$(call emugl-end-module)
+
+$(call emugl-begin-host64-executable,lib64GLcommon_unittests)
+LOCAL_SRC_FILES := $(host_unittests_SRC_FILES)
+LOCAL_C_INCLUDES += $(LOCAL_PATH)/../include $(EMUGL_PATH)/shared
+$(call emugl-import,lib64emugl_common lib64emugl_gtest)
+$(call emugl-end-module)
@@ -15,6 +15,7 @@
 */
 #include "GLcommon/PaletteTexture.h"
 #include <stdio.h>
+#include <string.h>
 
 
 
@@ -105,6 +106,32 @@ Color paletteColor(const unsigned char* pallete,unsigned int index,GLenum format
     }
 }
 
+// Write the colors of the first |count| pixels of |indices| to |out|, with
+// kSize bytes per pixel.
+template <int kSize>
+static void expandIndices(unsigned char* out,const unsigned char colors[][4],
+                          const unsigned char* indices,unsigned int indexSizeBits,
+                          int count) {
+    if(indexSizeBits == 4) {
+        // Two pixels per byte, upper bits first.
+        int i = 0;
+        for(; i + 1 < count; i += 2) {
+            unsigned char pair = indices[i/2];
+            memcpy(out, colors[pair >> 4], kSize);
+            memcpy(out + kSize, colors[pair & 0xf], kSize);
+            out += 2 * kSize;
+        }
+        if(i < count) {
+            memcpy(out, colors[indices[i/2] >> 4], kSize);
+        }
+    } else {
+        for(int i = 0; i < count; i++) {
+            memcpy(out, colors[indices[i]], kSize);
+            out += kSize;
+        }
+    }
+}
+
 unsigned char* uncompressTexture(GLenum internalformat,GLenum& formatOut,GLsizei width,GLsizei height,GLsizei imageSize, const GLvoid* data,GLint level) {
 
     unsigned int indexSizeBits;  //the size of the color index in the pallete
@@ -143,28 +170,21 @@ unsigned char* uncompressTexture(GLenum internalformat,GLenum& formatOut,GLsizei
 
     int maxIndices = (leftPixels < nPixels) ? leftPixels:nPixels;
 
-    //filling the pixels array
-    for(int i =0 ; i < maxIndices ; i++) {
-        int paletteIndex = 0;
-        int indexOut = i*colorSizeOut;
-        if(indexSizeBits == 4) {
-            paletteIndex = (i%2) == 0 ?
-                           imageIndices[i/2] >> 4:  //upper bits
-                           imageIndices[i/2] & 0xf; //lower bits
-        } else {
-            paletteIndex = imageIndices[i];
-        }
-
-        paletteIndex*=colorSizeBytes;
-        Color c = paletteColor(palette,paletteIndex,internalformat);
+    // Convert each palette entry once, rather than once per pixel.
+    unsigned char colors[256][4];
+    for(int i = 0; i < nColors; i++) {
+        Color c = paletteColor(palette,i*colorSizeBytes,internalformat);
+        colors[i][0] = c.red;
+        colors[i][1] = c.green;
+        colors[i][2] = c.blue;
+        colors[i][3] = c.alpha;
+    }
 
-        pixelsOut[indexOut] = c.red;
-        pixelsOut[indexOut+1] = c.green;
-        pixelsOut[indexOut+2] = c.blue;
-        if(formatOut == GL_RGBA) {
-            pixelsOut[indexOut+3] = c.alpha;
-        }
+    //filling the pixels array
+    if(colorSizeOut == 4) {
+        expandIndices<4>(pixelsOut,colors,imageIndices,indexSizeBits,maxIndices);
+    } else {
+        expandIndices<3>(pixelsOut,colors,imageIndices,indexSizeBits,maxIndices);
     }
     return pixelsOut;
 }
-
@@ -0,0 +1,272 @@
+/*
+* Copyright (C) 2015 The Android Open Source Project
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+#include <GLcommon/TextureDecoder.h>
+#include <GLcommon/etc1.h>
+
+#include "emugl/common/lazy_instance.h"
+#include "emugl/common/thread.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+
+#include <string.h>
+
+namespace {
+
+// Decoding smaller images isn't worth starting threads.
+const int kMinPixelsPerThread = 256 * 256;
+const int kMaxThreads = 4;
+
+int getCpuCount() {
+#ifdef _WIN32
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return static_cast<int>(info.dwNumberOfProcessors);
+#else
+    long count = sysconf(_SC_NPROCESSORS_ONLN);
+    return count > 0 ? static_cast<int>(count) : 1;
+#endif
+}
+
+// A band of whole block rows of an ETC1 image.
+struct Etc1Band {
+    const unsigned char* in;
+    unsigned char* out;
+    int width;
+    int height;
+    int stride;
+
+    int decode() const {
+        return etc1_decode_image(in, out, width, height, 3, stride);
+    }
+};
+
+class Etc1BandThread : public emugl::Thread {
+public:
+    explicit Etc1BandThread(const Etc1Band& band) :
+            emugl::Thread(), m_band(band) {}
+
+    virtual intptr_t main() {
+        return m_band.decode();
+    }
+
+private:
+    Etc1Band m_band;
+};
+
+}  // namespace
+
+int decodeEtc1Image(const unsigned char* in,
+                    unsigned char* out,
+                    int width,
+                    int height,
+                    int stride,
+                    int maxThreads) {
+    if (maxThreads <= 0) {
+        static const int sCpuCount = getCpuCount();
+        maxThreads = sCpuCount < kMaxThreads ? sCpuCount : kMaxThreads;
+    }
+    if (maxThreads > kMaxThreads) {
+        maxThreads = kMaxThreads;
+    }
+    int blockRows = (height + 3) / 4;
+    int numBands = (width * height) / kMinPixelsPerThread;
+    if (numBands > maxThreads) {
+        numBands = maxThreads;
+    }
+    if (numBands > blockRows) {
+        numBands = blockRows;
+    }
+    if (numBands <= 1) {
+        return etc1_decode_image(in, out, width, height, 3, stride);
+    }
+
+    // Split the block rows evenly, and start a thread for each band but
+    // the first one, which this thread decodes.
+    Etc1Band bands[kMaxThreads];
+    Etc1BandThread* threads[kMaxThreads] = { NULL };
+    const size_t blockRowBytes = ((width + 3) / 4) * ETC1_ENCODED_BLOCK_SIZE;
+    int row = 0;
+    for (int n = 0; n < numBands; ++n) {
+        int rows = blockRows / numBands + (n < blockRows % numBands);
+        Etc1Band& band = bands[n];
+        band.in = in + row * blockRowBytes;
+        band.out = out + row * 4 * stride;
+        band.width = width;
+        band.height = rows * 4;
+        if (row * 4 + band.height > height) {
+            band.height = height - row * 4;
+        }
+        band.stride = stride;
+        if (n > 0) {
+            threads[n] = new Etc1BandThread(band);
+            if (!threads[n]->start()) {
+                delete threads[n];
+                threads[n] = NULL;
+            }
+        }
+        row += rows;
+    }
+
+    int result = bands[0].decode();
+    for (int n = 1; n < numBands; ++n) {
+        intptr_t bandResult = 0;
+        if (threads[n]) {
+            threads[n]->wait(&bandResult);
+            delete threads[n];
+        } else {
+            bandResult = bands[n].decode();
+        }
+        if (bandResult) {
+            result = static_cast<int>(bandResult);
+        }
+    }
+    return result;
+}
+
+static emugl::LazyInstance<DecodedTextureCache> s_cache = LAZY_INSTANCE_INIT;
+
+// static
+DecodedTextureCache* DecodedTextureCache::get() {
+    return s_cache.ptr();
+}
+
+DecodedTextureCache::DecodedTextureCache(size_t maxBytes) :
+        m_lock(),
+        m_maxBytes(maxBytes),
+        m_bytes(0),
+        m_lru(),
+        m_map(),
+        m_hits(0),
+        m_misses(0) {}
+
+DecodedTextureCache::~DecodedTextureCache() {}
+
+// static
+uint64_t DecodedTextureCache::hash(const void* data, size_t size) {
+    // FNV-1a over 64-bit words, with a final mix. Only used to find
+    // candidate entries, which are then compared with memcmp().
+    const unsigned char* bytes = static_cast<const unsigned char*>(data);
+    uint64_t h = 0xcbf29ce484222325ULL ^ size;
+    size_t n = 0;
+    for (; n + 8 <= size; n += 8) {
+        uint64_t word;
+        memcpy(&word, bytes + n, sizeof(word));
+        h = (h ^ word) * 0x100000001b3ULL;
+    }
+    for (; n < size; ++n) {
+        h = (h ^ bytes[n]) * 0x100000001b3ULL;
+    }
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    return h;
+}
+
+// static
+uint64_t DecodedTextureCache::keyOf(GLenum format,
+                                    GLsizei width,
+                                    GLsizei height,
+                                    int layout,
+                                    const void* data,
+                                    size_t size) {
+    uint64_t params = ((uint64_t)format << 32) ^ ((uint64_t)width << 16) ^
+            height ^ ((uint64_t)layout << 48);
+    return hash(data, size) ^ (params * 0x9e3779b97f4a7c15ULL);
+}
+
+// static
+size_t DecodedTextureCache::entryBytes(const Entry& entry) {
+    return entry.compressed.size() + entry.pixels.size();
+}
+
+DecodedTextureCache::EntryPtr DecodedTextureCache::find(GLenum format,
+                                                        GLsizei width,
+                                                        GLsizei height,
+                                                        int layout,
+                                                        const void* data,
+                                                        size_t size) {
+    uint64_t key = keyOf(format, width, height, layout, data, size);
+
+    emugl::Mutex::AutoLock lock(m_lock);
+    std::pair<ItemMap::iterator, ItemMap::iterator> range =
+            m_map.equal_range(key);
+    for (ItemMap::iterator it = range.first; it != range.second; ++it) {
+        const Entry& entry = *it->second->entry;
+        if (entry.format == format && entry.width == width &&
+            entry.height == height && entry.layout == layout &&
+            entry.compressed.size() == size &&
+            (size == 0 || !memcmp(&entry.compressed[0], data, size))) {
+            // Move it to the front of the LRU list.
+            m_lru.splice(m_lru.begin(), m_lru, it->second);
+            m_hits++;
+            return m_lru.front().entry;
+        }
+    }
+    m_misses++;
+    return EntryPtr();
+}
+
+void DecodedTextureCache::add(const EntryPtr& entry) {
+    size_t bytes = entryBytes(*entry);
+    // Don't let a single texture flush most of the cache.
+    if (bytes > m_maxBytes / 4) {
+        return;
+    }
+    uint64_t key = keyOf(entry->format,
+                         entry->width,
+                         entry->height,
+                         entry->layout,
+                         entry->compressed.empty() ? NULL
+                                                   : &entry->compressed[0],
+                         entry->compressed.size());
+
+    emugl::Mutex::AutoLock lock(m_lock);
+    Item item;
+    item.key = key;
+    item.entry = entry;
+    m_lru.push_front(item);
+    m_map.insert(std::make_pair(key, m_lru.begin()));
+    m_bytes += bytes;
+    evict_locked();
+}
+
+void DecodedTextureCache::evict_locked() {
+    while (m_bytes > m_maxBytes && !m_lru.empty()) {
+        ItemList::iterator last = --m_lru.end();
+        std::pair<ItemMap::iterator, ItemMap::iterator> range =
+                m_map.equal_range(last->key);
+        for (ItemMap::iterator it = range.first; it != range.second; ++it) {
+            if (it->second == last) {
+                m_map.erase(it);
+                break;
+            }
+        }
+        m_bytes -= entryBytes(*last->entry);
+        m_lru.erase(last);
+    }
+}
+
+void DecodedTextureCache::getStats(Stats* stats) const {
+    emugl::Mutex::AutoLock lock(m_lock);
+    stats->hits = m_hits;
+    stats->misses = m_misses;
+    stats->entries = m_lru.size();
+    stats->bytes = m_bytes;
+}
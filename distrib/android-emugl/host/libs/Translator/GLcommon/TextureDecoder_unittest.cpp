@@ -0,0 +1,456 @@
+// Copyright (C) 2015 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <GLcommon/TextureDecoder.h>
+
+#include <GLcommon/etc1.h>
+#include <GLcommon/PaletteTexture.h>
+
+#include <GLES/glext.h>
+
+#include <gtest/gtest.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include <vector>
+
+namespace {
+
+// The straightforward ETC1 block decoder that etc1.cpp used to have, as a
+// reference for the optimized one.
+
+const int kModifierTable[] = {
+    2, 8, -2, -8,
+    5, 17, -5, -17,
+    9, 29, -9, -29,
+    13, 42, -13, -42,
+    18, 60, -18, -60,
+    24, 80, -24, -80,
+    33, 106, -33, -106,
+    47, 183, -47, -183 };
+
+const int kLookup[8] = { 0, 1, 2, 3, -4, -3, -2, -1 };
+
+unsigned char clamp(int x) {
+    return (unsigned char)(x >= 0 ? (x < 255 ? x : 255) : 0);
+}
+
+int convert4To8(int b) {
+    int c = b & 0xf;
+    return (c << 4) | c;
+}
+
+int convert5To8(int b) {
+    int c = b & 0x1f;
+    return (c << 3) | (c >> 2);
+}
+
+int convertDiff(int base, int diff) {
+    return convert5To8((0x1f & base) + kLookup[0x7 & diff]);
+}
+
+void referenceDecodeSubblock(unsigned char* out, int r, int g, int b,
+                             const int* table, unsigned low, bool second,
+                             bool flipped) {
+    int baseX = 0;
+    int baseY = 0;
+    if (second) {
+        if (flipped) {
+            baseY = 2;
+        } else {
+            baseX = 2;
+        }
+    }
+    for (int i = 0; i < 8; i++) {
+        int x, y;
+        if (flipped) {
+            x = baseX + (i >> 1);
+            y = baseY + (i & 1);
+        } else {
+            x = baseX + (i >> 2);
+            y = baseY + (i & 3);
+        }
+        int k = y + (x * 4);
+        int offset = ((low >> k) & 1) | ((low >> (k + 15)) & 2);
+        int delta = table[offset];
+        unsigned char* q = out + 3 * (x + 4 * y);
+        *q++ = clamp(r + delta);
+        *q++ = clamp(g + delta);
+        *q++ = clamp(b + delta);
+    }
+}
+
+void referenceDecodeBlock(const unsigned char* in, unsigned char* out) {
+    unsigned high = (in[0] << 24) | (in[1] << 16) | (in[2] << 8) | in[3];
+    unsigned low = (in[4] << 24) | (in[5] << 16) | (in[6] << 8) | in[7];
+    int r1, r2, g1, g2, b1, b2;
+    if (high & 2) {
+        int rBase = high >> 27;
+        int gBase = high >> 19;
+        int bBase = high >> 11;
+        r1 = convert5To8(rBase);
+        r2 = convertDiff(rBase, high >> 24);
+        g1 = convert5To8(gBase);
+        g2 = convertDiff(gBase, high >> 16);
+        b1 = convert5To8(bBase);
+        b2 = convertDiff(bBase, high >> 8);
+    } else {
+        r1 = convert4To8(high >> 28);
+        r2 = convert4To8(high >> 24);
+        g1 = convert4To8(high >> 20);
+        g2 = convert4To8(high >> 16);
+        b1 = convert4To8(high >> 12);
+        b2 = convert4To8(high >> 8);
+    }
+    const int* tableA = kModifierTable + (7 & (high >> 5)) * 4;
+    const int* tableB = kModifierTable + (7 & (high >> 2)) * 4;
+    bool flipped = (high & 1) != 0;
+    referenceDecodeSubblock(out, r1, g1, b1, tableA, low, false, flipped);
+    referenceDecodeSubblock(out, r2, g2, b2, tableB, low, true, flipped);
+}
+
+void referenceDecodeImage(const unsigned char* in, unsigned char* out,
+                          int width, int height, int pixelSize, int stride) {
+    unsigned char block[ETC1_DECODED_BLOCK_SIZE];
+    for (int y = 0; y < height; y += 4) {
+        for (int x = 0; x < width; x += 4) {
+            referenceDecodeBlock(in, block);
+            in += ETC1_ENCODED_BLOCK_SIZE;
+            for (int cy = 0; cy < 4 && y + cy < height; cy++) {
+                const unsigned char* q = block + cy * 4 * 3;
+                unsigned char* p = out + pixelSize * x + stride * (y + cy);
+                for (int cx = 0; cx < 4 && x + cx < width; cx++) {
+                    unsigned char r = *q++;
+                    unsigned char g = *q++;
+                    unsigned char b = *q++;
+                    if (pixelSize == 3) {
+                        *p++ = r;
+                        *p++ = g;
+                        *p++ = b;
+                    } else {
+                        unsigned pixel = ((r >> 3) << 11) |
+                                ((g >> 2) << 5) | (b >> 3);
+                        *p++ = (unsigned char)pixel;
+                        *p++ = (unsigned char)(pixel >> 8);
+                    }
+                }
+            }
+        }
+    }
+}
+
+// The per-pixel palette conversion that PaletteTexture.cpp used to do, as
+// a reference for the table-driven one. Mind the sign extension of |s|,
+// which is part of the behavior.
+void referencePaletteColor(const unsigned char* palette, unsigned index,
+                           GLenum format, unsigned char* out) {
+    short s;
+    switch (format) {
+    case GL_PALETTE4_RGB8_OES:
+    case GL_PALETTE8_RGB8_OES:
+        out[0] = palette[index];
+        out[1] = palette[index + 1];
+        out[2] = palette[index + 2];
+        out[3] = 0;
+        break;
+    case GL_PALETTE8_R5_G6_B5_OES:
+    case GL_PALETTE4_R5_G6_B5_OES:
+        memcpy(&s, palette + index, sizeof(s));
+        out[0] = (s >> 11) * 255 / 31;
+        out[1] = ((s >> 5) & 0x3f) * 255 / 63;
+        out[2] = (s & 0x1f) * 255 / 31;
+        out[3] = 0;
+        break;
+    case GL_PALETTE4_RGBA8_OES:
+    case GL_PALETTE8_RGBA8_OES:
+        memcpy(out, palette + index, 4);
+        break;
+    case GL_PALETTE4_RGBA4_OES:
+    case GL_PALETTE8_RGBA4_OES:
+        memcpy(&s, palette + index, sizeof(s));
+        out[0] = ((s >> 12) & 0xf) * 255 / 15;
+        out[1] = ((s >> 8) & 0xf) * 255 / 15;
+        out[2] = ((s >> 4) & 0xf) * 255 / 15;
+        out[3] = (s & 0xf) * 255 / 15;
+        break;
+    case GL_PALETTE4_RGB5_A1_OES:
+    case GL_PALETTE8_RGB5_A1_OES:
+        memcpy(&s, palette + index, sizeof(s));
+        out[0] = ((s >> 11) & 0x1f) * 255 / 31;
+        out[1] = ((s >> 6) & 0x1f) * 255 / 31;
+        out[2] = ((s >> 1) & 0x1f) * 255 / 31;
+        out[3] = (s & 0x1) * 255;
+        break;
+    }
+}
+
+struct PaletteFormat {
+    GLenum format;
+    int indexBits;
+    int colorBytes;
+    int outBytes;
+};
+
+const PaletteFormat kPaletteFormats[] = {
+    { GL_PALETTE4_RGB8_OES, 4, 3, 3 },
+    { GL_PALETTE4_RGBA8_OES, 4, 4, 4 },
+    { GL_PALETTE4_R5_G6_B5_OES, 4, 2, 3 },
+    { GL_PALETTE4_RGBA4_OES, 4, 2, 4 },
+    { GL_PALETTE4_RGB5_A1_OES, 4, 2, 4 },
+    { GL_PALETTE8_RGB8_OES, 8, 3, 3 },
+    { GL_PALETTE8_RGBA8_OES, 8, 4, 4 },
+    { GL_PALETTE8_R5_G6_B5_OES, 8, 2, 3 },
+    { GL_PALETTE8_RGBA4_OES, 8, 2, 4 },
+    { GL_PALETTE8_RGB5_A1_OES, 8, 2, 4 },
+};
+
+std::vector<unsigned char> randomBytes(size_t size, unsigned seed) {
+    std::vector<unsigned char> bytes(size);
+    // srand(0) and srand(1) give the same sequence.
+    srand(seed + 1);
+    for (size_t n = 0; n < size; ++n) {
+        bytes[n] = (unsigned char)(rand() >> 4);
+    }
+    return bytes;
+}
+
+size_t etc1Size(int width, int height) {
+    return ((width + 3) / 4) * ((height + 3) / 4) * ETC1_ENCODED_BLOCK_SIZE;
+}
+
+long long currentTimeUs() {
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec * 1000000LL + tv.tv_usec;
+}
+
+}  // namespace
+
+TEST(Etc1, DecodeBlockMatchesReference) {
+    std::vector<unsigned char> blocks = randomBytes(8 * 10000, 1);
+    for (size_t n = 0; n < blocks.size(); n += 8) {
+        unsigned char expected[ETC1_DECODED_BLOCK_SIZE];
+        unsigned char actual[ETC1_DECODED_BLOCK_SIZE];
+        referenceDecodeBlock(&blocks[n], expected);
+        etc1_decode_block(&blocks[n], actual);
+        ASSERT_EQ(0, memcmp(expected, actual, sizeof(actual)))
+                << "block " << n / 8;
+    }
+}
+
+TEST(Etc1, DecodeImageMatchesReference) {
+    for (int pixelSize = 2; pixelSize <= 3; ++pixelSize) {
+        for (int width = 1; width < 40; width += 3) {
+            for (int height = 1; height < 40; height += 5) {
+                std::vector<unsigned char> in =
+                        randomBytes(etc1Size(width, height), width * height);
+                // Padding checks that nothing is written past each row.
+                int stride = width * pixelSize + 5;
+                std::vector<unsigned char> expected(stride * height, 0xcd);
+                std::vector<unsigned char> actual(stride * height, 0xcd);
+                referenceDecodeImage(&in[0], &expected[0], width, height,
+                                     pixelSize, stride);
+                ASSERT_EQ(0, etc1_decode_image(&in[0], &actual[0], width,
+                                               height, pixelSize, stride));
+                ASSERT_TRUE(expected == actual) << pixelSize << " bytes, "
+                        << width << "x" << height;
+            }
+        }
+    }
+}
+
+TEST(Etc1, ThreadedDecodeMatchesSingleThreaded) {
+    const int kWidths[] = { 1024, 1023, 601 };
+    const int kHeights[] = { 1024, 1021, 999 };
+    for (int i = 0; i < 3; ++i) {
+        int width = kWidths[i];
+        int height = kHeights[i];
+        int stride = (width * 3 + 3) & ~3;
+        std::vector<unsigned char> in =
+                randomBytes(etc1Size(width, height), i);
+        std::vector<unsigned char> expected(stride * height);
+        ASSERT_EQ(0, etc1_decode_image(&in[0], &expected[0], width, height,
+                                       3, stride));
+        for (int threads = 0; threads <= 4; ++threads) {
+            std::vector<unsigned char> actual(stride * height);
+            ASSERT_EQ(0, decodeEtc1Image(&in[0], &actual[0], width, height,
+                                         stride, threads));
+            ASSERT_TRUE(expected == actual) << width << "x" << height
+                    << ", " << threads << " threads";
+        }
+    }
+}
+
+TEST(PaletteTexture, MatchesReference) {
+    const int kWidth = 13;
+    const int kHeight = 7;
+    for (size_t f = 0; f < sizeof(kPaletteFormats) / sizeof(kPaletteFormats[0]);
+         ++f) {
+        const PaletteFormat& fmt = kPaletteFormats[f];
+        int paletteBytes = (1 << fmt.indexBits) * fmt.colorBytes;
+        int indexBytes = (kWidth * kHeight * fmt.indexBits + 7) / 8;
+        std::vector<unsigned char> data =
+                randomBytes(paletteBytes + indexBytes, f);
+
+        // Also check truncated data, where only some pixels are written.
+        for (int size = paletteBytes + indexBytes; size > paletteBytes;
+             size -= 5) {
+            GLenum formatOut;
+            unsigned char* pixels = uncompressTexture(
+                    fmt.format, formatOut, kWidth, kHeight, size, &data[0], 0);
+            ASSERT_TRUE(pixels != NULL);
+            EXPECT_EQ(fmt.outBytes == 3 ? (GLenum)GL_RGB : (GLenum)GL_RGBA,
+                      formatOut);
+
+            int numPixels = (size - paletteBytes) * 8 / fmt.indexBits;
+            if (numPixels > kWidth * kHeight) {
+                numPixels = kWidth * kHeight;
+            }
+            for (int i = 0; i < numPixels; ++i) {
+                int index = fmt.indexBits == 8 ? data[paletteBytes + i] :
+                        (i % 2 == 0 ? data[paletteBytes + i / 2] >> 4
+                                    : data[paletteBytes + i / 2] & 0xf);
+                unsigned char expected[4];
+                referencePaletteColor(&data[0], index * fmt.colorBytes,
+                                      fmt.format, expected);
+                ASSERT_EQ(0, memcmp(expected, pixels + i * fmt.outBytes,
+                                    fmt.outBytes))
+                        << "format " << f << ", size " << size
+                        << ", pixel " << i;
+            }
+            delete[] pixels;
+        }
+    }
+}
+
+TEST(DecodedTextureCache, FindsSameDataOnly) {
+    DecodedTextureCache cache(1024 * 1024);
+    std::vector<unsigned char> data = randomBytes(512, 1);
+
+    DecodedTextureCache::EntryPtr entry(new DecodedTextureCache::Entry());
+    entry->format = GL_ETC1_RGB8_OES;
+    entry->width = 16;
+    entry->height = 16;
+    entry->layout = 3;
+    entry->compressed = data;
+    entry->pixels.resize(16 * 16 * 3, 0x42);
+
+    EXPECT_FALSE(cache.find(GL_ETC1_RGB8_OES, 16, 16, 3, &data[0],
+                            data.size()));
+    cache.add(entry);
+
+    DecodedTextureCache::EntryPtr found =
+            cache.find(GL_ETC1_RGB8_OES, 16, 16, 3, &data[0], data.size());
+    EXPECT_EQ(entry.Ptr(), found.Ptr());
+
+    // Any difference in parameters or data is a miss.
+    EXPECT_FALSE(cache.find(GL_ETC1_RGB8_OES, 16, 16, 0, &data[0],
+                            data.size()));
+    EXPECT_FALSE(cache.find(GL_ETC1_RGB8_OES, 8, 32, 3, &data[0],
+                            data.size()));
+    std::vector<unsigned char> other = data;
+    other[200] ^= 1;
+    EXPECT_FALSE(cache.find(GL_ETC1_RGB8_OES, 16, 16, 3, &other[0],
+                            other.size()));
+
+    DecodedTextureCache::Stats stats;
+    cache.getStats(&stats);
+    EXPECT_EQ(1U, stats.hits);
+    EXPECT_EQ(4U, stats.misses);
+    EXPECT_EQ(1U, stats.entries);
+    EXPECT_EQ(512U + 16U * 16U * 3U, stats.bytes);
+}
+
+TEST(DecodedTextureCache, EvictsLeastRecentlyUsed) {
+    // Room for 4 entries of 1000 bytes.
+    DecodedTextureCache cache(4000);
+    std::vector<unsigned char> data[6];
+    for (int n = 0; n < 6; ++n) {
+        data[n] = randomBytes(100, n);
+        DecodedTextureCache::EntryPtr entry(new DecodedTextureCache::Entry());
+        entry->format = GL_ETC1_RGB8_OES;
+        entry->width = 4;
+        entry->height = 4;
+        entry->layout = 0;
+        entry->compressed = data[n];
+        entry->pixels.resize(900);
+        cache.add(entry);
+        if (n == 3) {
+            // Entry 0 becomes the most recently used.
+            EXPECT_TRUE(cache.find(GL_ETC1_RGB8_OES, 4, 4, 0, &data[0][0],
+                                   100));
+        }
+    }
+
+    EXPECT_TRUE(cache.find(GL_ETC1_RGB8_OES, 4, 4, 0, &data[0][0], 100));
+    EXPECT_FALSE(cache.find(GL_ETC1_RGB8_OES, 4, 4, 0, &data[1][0], 100));
+    EXPECT_FALSE(cache.find(GL_ETC1_RGB8_OES, 4, 4, 0, &data[2][0], 100));
+    for (int n = 3; n < 6; ++n) {
+        EXPECT_TRUE(cache.find(GL_ETC1_RGB8_OES, 4, 4, 0, &data[n][0], 100));
+    }
+    DecodedTextureCache::Stats stats;
+    cache.getStats(&stats);
+    EXPECT_EQ(4U, stats.entries);
+    EXPECT_EQ(4000U, stats.bytes);
+
+    // Too large to be cached.
+    DecodedTextureCache::EntryPtr big(new DecodedTextureCache::Entry());
+    big->format = GL_ETC1_RGB8_OES;
+    big->width = 4;
+    big->height = 4;
+    big->layout = 0;
+    big->pixels.resize(1500);
+    cache.add(big);
+    cache.getStats(&stats);
+    EXPECT_EQ(4U, stats.entries);
+}
+
+// Decode throughput, in MB of decoded pixels per second. Disabled by
+// default, run with --gtest_also_run_disabled_tests.
+TEST(Etc1, DISABLED_DecodeBenchmark) {
+    const int kSize = 2048;
+    std::vector<unsigned char> in = randomBytes(etc1Size(kSize, kSize), 1);
+    std::vector<unsigned char> out(kSize * kSize * 3);
+
+    long long reference = 0x7fffffff;
+    long long single = 0x7fffffff;
+    long long threaded = 0x7fffffff;
+    for (int pass = 0; pass < 5; ++pass) {
+        long long start = currentTimeUs();
+        referenceDecodeImage(&in[0], &out[0], kSize, kSize, 3, kSize * 3);
+        long long end = currentTimeUs();
+        if (end - start < reference) {
+            reference = end - start;
+        }
+        start = currentTimeUs();
+        decodeEtc1Image(&in[0], &out[0], kSize, kSize, kSize * 3, 1);
+        end = currentTimeUs();
+        if (end - start < single) {
+            single = end - start;
+        }
+        start = currentTimeUs();
+        decodeEtc1Image(&in[0], &out[0], kSize, kSize, kSize * 3, 0);
+        end = currentTimeUs();
+        if (end - start < threaded) {
+            threaded = end - start;
+        }
+    }
+    double bytes = (double)out.size();
+    printf("ETC1 %dx%d: reference %.1f MB/s, 1 thread %.1f MB/s, "
+           "all threads %.1f MB/s\n", kSize, kSize, bytes / reference,
+           bytes / single, bytes / threaded);
+}
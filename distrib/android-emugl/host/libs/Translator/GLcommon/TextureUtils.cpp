@@ -17,6 +17,7 @@
 #include <GLcommon/GLESmacros.h>
 #include <GLcommon/GLDispatch.h>
 #include <GLcommon/GLESvalidate.h>
+#include <GLcommon/TextureDecoder.h>
 #include <stdio.h>
 #include <cmath>
 
@@ -63,11 +64,34 @@ void  doCompressedTexImage2D(GLEScontext * ctx, GLenum target, GLint level,
                 const int32_t bpr = ((width * 3) + align) & ~align;
                 const size_t size = bpr * height;
 
-                etc1_byte* pOut = new etc1_byte[size];
-                int res = etc1_decode_image((const etc1_byte*)data, pOut, width, height, 3, bpr);
-                SET_ERROR_IF(res!=0, GL_INVALID_VALUE);
+                // The same textures tend to be uploaded again and again,
+                // don't decode them each time.
+                DecodedTextureCache* cache = DecodedTextureCache::get();
+                DecodedTextureCache::EntryPtr entry = cache->find(
+                        internalformat, width, height, align, data,
+                        compressedSize);
+                if (!entry) {
+                    DecodedTextureCache::Entry* newEntry =
+                            new DecodedTextureCache::Entry();
+                    entry = DecodedTextureCache::EntryPtr(newEntry);
+                    newEntry->format = internalformat;
+                    newEntry->width = width;
+                    newEntry->height = height;
+                    newEntry->layout = align;
+                    newEntry->compressed.assign(
+                            (const unsigned char*)data,
+                            (const unsigned char*)data + compressedSize);
+                    newEntry->pixels.resize(size);
+                    int res = size ? decodeEtc1Image((const etc1_byte*)data,
+                                                     &newEntry->pixels[0],
+                                                     width, height, bpr, 0)
+                                   : 0;
+                    SET_ERROR_IF(res!=0, GL_INVALID_VALUE);
+                    cache->add(entry);
+                }
+                const etc1_byte* pOut =
+                        entry->pixels.empty() ? NULL : &entry->pixels[0];
                 glTexImage2DPtr(target,level,format,width,height,border,format,type,pOut);
-                delete [] pOut;
             }
             break;
             
@@ -16,6 +16,10 @@
 
 #include <string.h>
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
 /* From http://www.khronos.org/registry/gles/extensions/OES/OES_compressed_ETC1_RGB8_texture.txt
 
  The number of bits that represent a 4x4 texel block is 64 bits if
@@ -119,6 +123,20 @@ static const int kModifierTable[] = {
 
 static const int kLookup[8] = { 0, 1, 2, 3, -4, -3, -2, -1 };
 
+// Index of the first color of the sub-block of each pixel (x + 4 * y), see
+// decode_block_colors().
+static const etc1_byte kSubBlocks[16] = {
+    0, 0, 4, 4,
+    0, 0, 4, 4,
+    0, 0, 4, 4,
+    0, 0, 4, 4 };
+
+static const etc1_byte kFlippedSubBlocks[16] = {
+    0, 0, 0, 0,
+    0, 0, 0, 0,
+    4, 4, 4, 4,
+    4, 4, 4, 4 };
+
 static inline etc1_byte clamp(int x) {
     return (etc1_byte) (x >= 0 ? (x < 255 ? x : 255) : 0);
 }
@@ -163,41 +181,17 @@ inline int convertDiff(int base, int diff) {
     return convert5To8((0x1f & base) + kLookup[0x7 & diff]);
 }
 
-static
-void decode_subblock(etc1_byte* pOut, int r, int g, int b, const int* table,
-        etc1_uint32 low, bool second, bool flipped) {
-    int baseX = 0;
-    int baseY = 0;
-    if (second) {
-        if (flipped) {
-            baseY = 2;
-        } else {
-            baseX = 2;
-        }
-    }
-    for (int i = 0; i < 8; i++) {
-        int x, y;
-        if (flipped) {
-            x = baseX + (i >> 1);
-            y = baseY + (i & 1);
-        } else {
-            x = baseX + (i >> 2);
-            y = baseY + (i & 3);
-        }
-        int k = y + (x * 4);
-        int offset = ((low >> k) & 1) | ((low >> (k + 15)) & 2);
-        int delta = table[offset];
-        etc1_byte* q = pOut + 3 * (x + 4 * y);
-        *q++ = clamp(r + delta);
-        *q++ = clamp(g + delta);
-        *q++ = clamp(b + delta);
-    }
-}
-
-// Input is an ETC1 compressed version of the data.
-// Output is a 4 x 4 square of 3-byte pixels in form R, G, B
+// Decoding a block only ever produces 8 different colors: 4 per sub-block,
+// one per modifier of its table. They are computed first, then each pixel
+// just picks one of them.
+//
+// On return, pColors[4 * subBlock + pixelIndexValue] is the color of the
+// corresponding pixels, packed as R | G << 8 | B << 16, and pIndices[x + 4 * y]
+// is the index in pColors of pixel (x, y).
 
-void etc1_decode_block(const etc1_byte* pIn, etc1_byte* pOut) {
+static
+void decode_block_colors(const etc1_byte* pIn, etc1_uint32* pColors,
+        etc1_byte* pIndices) {
     etc1_uint32 high = (pIn[0] << 24) | (pIn[1] << 16) | (pIn[2] << 8) | pIn[3];
     etc1_uint32 low = (pIn[4] << 24) | (pIn[5] << 16) | (pIn[6] << 8) | pIn[7];
     int r1, r2, g1, g2, b1, b2;
@@ -221,13 +215,91 @@ void etc1_decode_block(const etc1_byte* pIn, etc1_byte* pOut) {
         b1 = convert4To8(high >> 12);
         b2 = convert4To8(high >> 8);
     }
-    int tableIndexA = 7 & (high >> 5);
-    int tableIndexB = 7 & (high >> 2);
-    const int* tableA = kModifierTable + tableIndexA * 4;
-    const int* tableB = kModifierTable + tableIndexB * 4;
-    bool flipped = (high & 1) != 0;
-    decode_subblock(pOut, r1, g1, b1, tableA, low, false, flipped);
-    decode_subblock(pOut, r2, g2, b2, tableB, low, true, flipped);
+    const int* tableA = kModifierTable + (7 & (high >> 5)) * 4;
+    const int* tableB = kModifierTable + (7 & (high >> 2)) * 4;
+
+#if defined(__SSE2__)
+    // Same as below, 8 colors at a time: 16-bit lanes hold the R, G and B
+    // of the colors, and the saturating pack does the clamping.
+    __m128i baseA = _mm_set_epi16(0, b1, g1, r1, 0, b1, g1, r1);
+    __m128i baseB = _mm_set_epi16(0, b2, g2, r2, 0, b2, g2, r2);
+    __m128i c01 = _mm_add_epi16(baseA, _mm_set_epi16(
+            0, tableA[1], tableA[1], tableA[1],
+            0, tableA[0], tableA[0], tableA[0]));
+    __m128i c23 = _mm_add_epi16(baseA, _mm_set_epi16(
+            0, tableA[3], tableA[3], tableA[3],
+            0, tableA[2], tableA[2], tableA[2]));
+    __m128i c45 = _mm_add_epi16(baseB, _mm_set_epi16(
+            0, tableB[1], tableB[1], tableB[1],
+            0, tableB[0], tableB[0], tableB[0]));
+    __m128i c67 = _mm_add_epi16(baseB, _mm_set_epi16(
+            0, tableB[3], tableB[3], tableB[3],
+            0, tableB[2], tableB[2], tableB[2]));
+    _mm_storeu_si128((__m128i*)pColors, _mm_packus_epi16(c01, c23));
+    _mm_storeu_si128((__m128i*)(pColors + 4), _mm_packus_epi16(c45, c67));
+#else
+    for (int i = 0; i < 4; i++) {
+        int deltaA = tableA[i];
+        int deltaB = tableB[i];
+        pColors[i] = clamp(r1 + deltaA) | (clamp(g1 + deltaA) << 8) |
+                (clamp(b1 + deltaA) << 16);
+        pColors[4 + i] = clamp(r2 + deltaB) | (clamp(g2 + deltaB) << 8) |
+                (clamp(b2 + deltaB) << 16);
+    }
+#endif
+
+    // Pixel (x, y) uses bit (y + 4 * x) of each half of |low|, and the second
+    // sub-block is the right half of the block, or its bottom half if flipped.
+    const etc1_byte* pSubBlocks = (high & 1) ? kFlippedSubBlocks : kSubBlocks;
+#if defined(__SSE2__)
+    // Lane i tests the bit of pixel i, in both halves of |low|.
+    const __m128i bits0 = _mm_set_epi16(
+            (short)(1 << 13), 1 << 9, 1 << 5, 1 << 1,
+            1 << 12, 1 << 8, 1 << 4, 1 << 0);
+    const __m128i bits1 = _mm_set_epi16(
+            (short)(1 << 15), 1 << 11, 1 << 7, 1 << 3,
+            1 << 14, 1 << 10, 1 << 6, 1 << 2);
+    const __m128i one = _mm_set1_epi16(1);
+    const __m128i two = _mm_set1_epi16(2);
+    __m128i lsbs = _mm_set1_epi16((short)low);
+    __m128i msbs = _mm_set1_epi16((short)(low >> 16));
+    __m128i offsets0 = _mm_or_si128(
+            _mm_and_si128(_mm_cmpeq_epi16(_mm_and_si128(lsbs, bits0), bits0),
+                          one),
+            _mm_and_si128(_mm_cmpeq_epi16(_mm_and_si128(msbs, bits0), bits0),
+                          two));
+    __m128i offsets1 = _mm_or_si128(
+            _mm_and_si128(_mm_cmpeq_epi16(_mm_and_si128(lsbs, bits1), bits1),
+                          one),
+            _mm_and_si128(_mm_cmpeq_epi16(_mm_and_si128(msbs, bits1), bits1),
+                          two));
+    _mm_storeu_si128((__m128i*)pIndices, _mm_or_si128(
+            _mm_packus_epi16(offsets0, offsets1),
+            _mm_loadu_si128((const __m128i*)pSubBlocks)));
+#else
+    for (int y = 0; y < 4; y++) {
+        for (int x = 0; x < 4; x++) {
+            int k = y + (x * 4);
+            int offset = ((low >> k) & 1) | ((low >> (k + 15)) & 2);
+            pIndices[x + 4 * y] = pSubBlocks[x + 4 * y] | offset;
+        }
+    }
+#endif
+}
+
+// Input is an ETC1 compressed version of the data.
+// Output is a 4 x 4 square of 3-byte pixels in form R, G, B
+
+void etc1_decode_block(const etc1_byte* pIn, etc1_byte* pOut) {
+    etc1_uint32 colors[8];
+    etc1_byte indices[16];
+    decode_block_colors(pIn, colors, indices);
+    for (int i = 0; i < 16; i++) {
+        etc1_uint32 color = colors[indices[i]];
+        *pOut++ = (etc1_byte) color;
+        *pOut++ = (etc1_byte) (color >> 8);
+        *pOut++ = (etc1_byte) (color >> 16);
+    }
 }
 
 typedef struct {
@@ -571,7 +643,9 @@ int etc1_decode_image(const etc1_byte* pIn, etc1_byte* pOut,
     if (pixelSize < 2 || pixelSize > 3) {
         return -1;
     }
-    etc1_byte block[ETC1_DECODED_BLOCK_SIZE];
+    etc1_uint32 colors[8];
+    etc1_uint32 colors565[8];
+    etc1_byte indices[16];
 
     etc1_uint32 encodedWidth = (width + 3) & ~3;
     etc1_uint32 encodedHeight = (height + 3) & ~3;
@@ -586,19 +660,29 @@ int etc1_decode_image(const etc1_byte* pIn, etc1_byte* pOut,
             if (xEnd > 4) {
                 xEnd = 4;
             }
-            etc1_decode_block(pIn, block);
+            decode_block_colors(pIn, colors, indices);
             pIn += ETC1_ENCODED_BLOCK_SIZE;
+            if (pixelSize == 2) {
+                for (int i = 0; i < 8; i++) {
+                    etc1_uint32 color = colors[i];
+                    colors565[i] = ((color & 0xf8) << 8) |
+                            ((color >> 5) & 0x7e0) | ((color >> 19) & 0x1f);
+                }
+            }
+            // Write straight to the destination, no intermediate block.
             for (etc1_uint32 cy = 0; cy < yEnd; cy++) {
-                const etc1_byte* q = block + (cy * 4) * 3;
+                const etc1_byte* q = indices + cy * 4;
                 etc1_byte* p = pOut + pixelSize * x + stride * (y + cy);
                 if (pixelSize == 3) {
-                    memcpy(p, q, xEnd * 3);
+                    for (etc1_uint32 cx = 0; cx < xEnd; cx++) {
+                        etc1_uint32 color = colors[q[cx]];
+                        *p++ = (etc1_byte) color;
+                        *p++ = (etc1_byte) (color >> 8);
+                        *p++ = (etc1_byte) (color >> 16);
+                    }
                 } else {
                     for (etc1_uint32 cx = 0; cx < xEnd; cx++) {
-                        etc1_byte r = *q++;
-                        etc1_byte g = *q++;
-                        etc1_byte b = *q++;
-                        etc1_uint32 pixel = ((r >> 3) << 11) | ((g >> 2) << 5) | (b >> 3);
+                        etc1_uint32 pixel = colors565[q[cx]];
                         *p++ = (etc1_byte) pixel;
                         *p++ = (etc1_byte) (pixel >> 8);
                     }
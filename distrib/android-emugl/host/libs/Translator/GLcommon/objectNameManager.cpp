@@ -28,7 +28,7 @@ NameSpace::~NameSpace()
 {
     for (NamesMap::iterator n = m_localToGlobalMap.begin();
          n != m_localToGlobalMap.end();
-         n++) {
+         ++n) {
         m_globalNameSpace->deleteName(m_type, (*n).second);
     }
 }
@@ -77,15 +77,17 @@ NameSpace::getGlobalName(ObjectLocalName p_localName)
 ObjectLocalName
 NameSpace::getLocalName(unsigned int p_globalName)
 {
-    for(NamesMap::iterator it = m_localToGlobalMap.begin(); it != m_localToGlobalMap.end();it++){
-        if((*it).second == p_globalName){
-            // object found - return its local name
-            return (*it).first;
+    // Several local names can share a global name after
+    // replaceGlobalName(), return the lowest one, whatever the order of
+    // the map. Returns 0 if the object does not exist.
+    ObjectLocalName localName = 0;
+    for(NamesMap::iterator it = m_localToGlobalMap.begin(); it != m_localToGlobalMap.end();++it){
+        if((*it).second == p_globalName &&
+           (!localName || (*it).first < localName)){
+            localName = (*it).first;
         }
     }
-
-    // object does not exist;
-    return 0;
+    return localName;
 }
 
 void
@@ -94,7 +96,7 @@ NameSpace::deleteName(ObjectLocalName p_localName)
     NamesMap::iterator n( m_localToGlobalMap.find(p_localName) );
     if (n != m_localToGlobalMap.end()) {
         m_globalNameSpace->deleteName(m_type, (*n).second);
-        m_localToGlobalMap.erase(p_localName);
+        m_localToGlobalMap.erase(n);
     }
 }
 
@@ -151,15 +153,10 @@ GlobalNameSpace::deleteName(NamedObjectType p_type, unsigned int p_name)
 {
 }
 
-typedef std::pair<NamedObjectType, ObjectLocalName> ObjectIDPair;
-typedef std::map<ObjectIDPair, ObjectDataPtr> ObjectDataMap;
-
 ShareGroup::ShareGroup(GlobalNameSpace *globalNameSpace) : m_lock() {
     for (int i=0; i < NUM_OBJECT_TYPES; i++) {
         m_nameSpace[i] = new NameSpace((NamedObjectType)i, globalNameSpace);
     }
-
-    m_objectsData = NULL;
 }
 
 ShareGroup::~ShareGroup()
@@ -167,9 +164,8 @@ ShareGroup::~ShareGroup()
     emugl::Mutex::AutoLock _lock(m_lock);
     for (int t = 0; t < NUM_OBJECT_TYPES; t++) {
         delete m_nameSpace[t];
+        m_objectsData[t].clear();
     }
-
-    delete (ObjectDataMap *)m_objectsData;
 }
 
 ObjectLocalName
@@ -221,10 +217,7 @@ ShareGroup::deleteName(NamedObjectType p_type, ObjectLocalName p_localName)
 
     emugl::Mutex::AutoLock _lock(m_lock);
     m_nameSpace[p_type]->deleteName(p_localName);
-    ObjectDataMap *map = (ObjectDataMap *)m_objectsData;
-    if (map) {
-        map->erase( ObjectIDPair(p_type, p_localName) );
-    }
+    m_objectsData[p_type].erase(p_localName);
 }
 
 bool
@@ -255,15 +248,8 @@ ShareGroup::setObjectData(NamedObjectType p_type,
     if (p_type >= NUM_OBJECT_TYPES) return;
 
     emugl::Mutex::AutoLock _lock(m_lock);
-
-    ObjectDataMap *map = (ObjectDataMap *)m_objectsData;
-    if (!map) {
-        map = new ObjectDataMap();
-        m_objectsData = map;
-    }
-
-    ObjectIDPair id( p_type, p_localName );
-    map->insert( std::pair<ObjectIDPair, ObjectDataPtr>(id, data) );
+    m_objectsData[p_type].insert(
+            ObjectDataMap::value_type(p_localName, data));
 }
 
 ObjectDataPtr
@@ -275,13 +261,8 @@ ShareGroup::getObjectData(NamedObjectType p_type,
     if (p_type >= NUM_OBJECT_TYPES) return ret;
 
     emugl::Mutex::AutoLock _lock(m_lock);
-
-    ObjectDataMap *map = (ObjectDataMap *)m_objectsData;
-    if (map) {
-        ObjectDataMap::iterator i =
-                map->find( ObjectIDPair(p_type, p_localName) );
-        if (i != map->end()) ret = (*i).second;
-    }
+    ObjectDataMap::iterator i = m_objectsData[p_type].find(p_localName);
+    if (i != m_objectsData[p_type].end()) ret = (*i).second;
     return ret;
 }
 
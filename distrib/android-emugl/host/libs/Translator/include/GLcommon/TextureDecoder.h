@@ -0,0 +1,126 @@
+/*
+* Copyright (C) 2015 The Android Open Source Project
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+#ifndef _GL_COMMON_TEXTURE_DECODER_H
+#define _GL_COMMON_TEXTURE_DECODER_H
+
+#include "emugl/common/mutex.h"
+#include "emugl/common/smart_ptr.h"
+
+#include <GLES/gl.h>
+
+#include <list>
+#include <map>
+#include <vector>
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Decode an ETC1 image of |width| x |height| pixels at |in| to RGB888 rows
+// of |stride| bytes at |out|. Large images are split in bands of blocks
+// decoded by up to |maxThreads| threads, including the calling one; pass 0
+// to use as many threads as there are CPUs, up to a small limit. Return 0
+// on success, like etc1_decode_image().
+int decodeEtc1Image(const unsigned char* in,
+                    unsigned char* out,
+                    int width,
+                    int height,
+                    int stride,
+                    int maxThreads);
+
+// A cache of decoded compressed textures, so that uploading a compressed
+// image that was already uploaded doesn't decode it again. Apps commonly
+// upload the same textures again, e.g. when they lose their EGL context.
+//
+// Entries are looked up by a hash of their compressed data, then compared
+// byte by byte, and the least recently used ones are evicted once the total
+// size of the cached data goes above a limit. Thread-safe.
+class DecodedTextureCache {
+public:
+    // A decoded image, with the compressed data it was decoded from.
+    // |layout| is any other parameter that the decoded data depends on,
+    // e.g. the unpack alignment.
+    struct Entry {
+        GLenum format;
+        GLsizei width;
+        GLsizei height;
+        int layout;
+        std::vector<unsigned char> compressed;
+        std::vector<unsigned char> pixels;
+    };
+    typedef emugl::SmartPtr<Entry> EntryPtr;
+
+    struct Stats {
+        unsigned hits;
+        unsigned misses;
+        size_t entries;
+        size_t bytes;
+    };
+
+    static const size_t kDefaultMaxBytes = 64 * 1024 * 1024;
+
+    explicit DecodedTextureCache(size_t maxBytes = kDefaultMaxBytes);
+    ~DecodedTextureCache();
+
+    // Return the process-wide instance.
+    static DecodedTextureCache* get();
+
+    // Return the entry matching the parameters and the |size| bytes of
+    // compressed data at |data|, or a NULL EntryPtr.
+    EntryPtr find(GLenum format,
+                  GLsizei width,
+                  GLsizei height,
+                  int layout,
+                  const void* data,
+                  size_t size);
+
+    // Add |entry|, unless it is too large to be worth caching, and evict
+    // the least recently used ones if needed. Entries are never modified
+    // once added.
+    void add(const EntryPtr& entry);
+
+    void getStats(Stats* stats) const;
+
+    // Hash function used to look up entries.
+    static uint64_t hash(const void* data, size_t size);
+
+private:
+    struct Item {
+        uint64_t key;
+        EntryPtr entry;
+    };
+    typedef std::list<Item> ItemList;
+    typedef std::multimap<uint64_t, ItemList::iterator> ItemMap;
+
+    static uint64_t keyOf(GLenum format,
+                          GLsizei width,
+                          GLsizei height,
+                          int layout,
+                          const void* data,
+                          size_t size);
+    static size_t entryBytes(const Entry& entry);
+    void evict_locked();
+
+    mutable emugl::Mutex m_lock;
+    size_t m_maxBytes;
+    size_t m_bytes;
+    // Most recently used first.
+    ItemList m_lru;
+    ItemMap m_map;
+    unsigned m_hits;
+    unsigned m_misses;
+};
+
+#endif  // _GL_COMMON_TEXTURE_DECODER_H
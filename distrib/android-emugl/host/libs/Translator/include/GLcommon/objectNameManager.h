@@ -17,6 +17,7 @@
 #define _OBJECT_NAME_MANAGER_H
 
 #include <map>
+#include "emugl/common/integer_hash_map.h"
 #include "emugl/common/mutex.h"
 #include "emugl/common/smart_ptr.h"
 
@@ -49,7 +50,8 @@ private:
 };
 typedef emugl::SmartPtr<ObjectData> ObjectDataPtr;
 typedef unsigned long long ObjectLocalName;
-typedef std::map<ObjectLocalName, unsigned int> NamesMap;
+typedef emugl::IntegerHashMap<ObjectLocalName, unsigned int> NamesMap;
+typedef emugl::IntegerHashMap<ObjectLocalName, ObjectDataPtr> ObjectDataMap;
 
 //
 // Class NameSpace - this class manages allocations and deletions of objects
@@ -206,7 +208,7 @@ private:
 private:
     emugl::Mutex m_lock;
     NameSpace *m_nameSpace[NUM_OBJECT_TYPES];
-    void *m_objectsData;
+    ObjectDataMap m_objectsData[NUM_OBJECT_TYPES];
 };
 
 typedef emugl::SmartPtr<ShareGroup> ShareGroupPtr;
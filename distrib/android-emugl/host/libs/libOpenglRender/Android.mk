@@ -26,11 +26,15 @@ host_common_SRC_FILES := \
     GLESv1Dispatch.cpp \
     GLESv2Dispatch.cpp \
     ReadBuffer.cpp \
+    ReadbackQueue.cpp \
+    ReadbackWorker.cpp \
+    RenderChannel.cpp \
     RenderContext.cpp \
     RenderControl.cpp \
     RenderServer.cpp \
     RenderThread.cpp \
     RenderThreadInfo.cpp \
+    RenderThreadPool.cpp \
     render_api.cpp \
     RenderWindow.cpp \
     TextureDraw.cpp \
@@ -84,3 +88,77 @@ LOCAL_STATIC_LIBRARIES += lib64emugl_common
 $(call emugl-export,CFLAGS,$(host_common_CFLAGS))
 
 $(call emugl-end-module)
+
+
+### host GL stream replay tool ###########################################
+# Replays the streams dumped with RENDERER_DUMP_DIR, see StreamReplayMain.cpp.
+
+host_replay_SRC_FILES := \
+    $(host_common_SRC_FILES) \
+    StreamReplay.cpp \
+    StreamReplayMain.cpp \
+
+$(call emugl-begin-host-executable,emugl_stream_replay)
+$(call emugl-import,libGLESv1_dec libGLESv2_dec lib_renderControl_dec libOpenglCodecCommon)
+LOCAL_LDLIBS += $(host_common_LDLIBS)
+LOCAL_SRC_FILES := $(host_replay_SRC_FILES)
+LOCAL_C_INCLUDES += $(LOCAL_PATH) $(EMUGL_PATH)/host/libs/Translator/include
+LOCAL_STATIC_LIBRARIES += libemugl_common
+$(call emugl-end-module)
+
+$(call emugl-begin-host64-executable,emugl64_stream_replay)
+$(call emugl-import,lib64GLESv1_dec lib64GLESv2_dec lib64_renderControl_dec lib64OpenglCodecCommon)
+LOCAL_LDLIBS += $(host_common_LDLIBS)
+LOCAL_SRC_FILES := $(host_replay_SRC_FILES)
+LOCAL_C_INCLUDES += $(LOCAL_PATH) $(EMUGL_PATH)/host/libs/Translator/include
+LOCAL_STATIC_LIBRARIES += lib64emugl_common
+$(call emugl-end-module)
+
+
+### host libOpenglRender unit tests #######################################
+# Mostly covers the parts of the library that don't need a GL implementation.
+# The decoders are used with a no-op dispatch table. ReadbackWorker_unittest
+# and the FrameBuffer tests of RenderThread_unittest use the host's EGL and
+# GLES libraries instead of the translator ones, and are skipped when they
+# are not available.
+
+host_unittests_SRC_FILES := \
+    $(host_OS_SRCS) \
+    ColorBuffer.cpp \
+    EGLDispatch.cpp \
+    FbConfig.cpp \
+    FrameBuffer.cpp \
+    GLESv1Dispatch.cpp \
+    GLESv2Dispatch.cpp \
+    ReadBuffer.cpp \
+    ReadbackQueue.cpp \
+    ReadbackQueue_unittest.cpp \
+    ReadbackWorker.cpp \
+    ReadbackWorker_unittest.cpp \
+    RenderChannel.cpp \
+    RenderChannel_unittest.cpp \
+    RenderContext.cpp \
+    RenderThread_unittest.cpp \
+    RenderThreadInfo.cpp \
+    RenderThreadPool.cpp \
+    RenderThreadPool_unittest.cpp \
+    StreamReplay.cpp \
+    StreamReplay_unittest.cpp \
+    TextureDraw.cpp \
+    WindowSurface.cpp \
+
+$(call emugl-begin-host-executable,libOpenglRender_unittests)
+LOCAL_SRC_FILES := $(host_unittests_SRC_FILES)
+LOCAL_LDLIBS += $(host_common_LDLIBS)
+$(call emugl-import,libGLESv1_dec libGLESv2_dec lib_renderControl_dec libOpenglCodecCommon libemugl_gtest)
+LOCAL_C_INCLUDES += $(LOCAL_PATH) $(EMUGL_PATH)/host/libs/Translator/include
+LOCAL_STATIC_LIBRARIES += libemugl_common
+$(call emugl-end-module)
+
+$(call emugl-begin-host64-executable,lib64OpenglRender_unittests)
+LOCAL_SRC_FILES := $(host_unittests_SRC_FILES)
+LOCAL_LDLIBS += $(host_common_LDLIBS)
+$(call emugl-import,lib64GLESv1_dec lib64GLESv2_dec lib64_renderControl_dec lib64OpenglCodecCommon lib64emugl_gtest)
+LOCAL_C_INCLUDES += $(LOCAL_PATH) $(EMUGL_PATH)/host/libs/Translator/include
+LOCAL_STATIC_LIBRARIES += lib64emugl_common
+$(call emugl-end-module)
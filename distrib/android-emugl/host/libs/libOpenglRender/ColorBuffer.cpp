@@ -358,9 +358,47 @@ void ColorBuffer::readback(unsigned char* img) {
     if (!context.isOk()) {
         return;
     }
-    if (bindFbo(&m_fbo, m_tex)) {
+    readbackFromCurrentContext(&m_fbo, img);
+}
+
+void ColorBuffer::readbackFromCurrentContext(GLuint* fbo, unsigned char* img) {
+    if (bindFbo(fbo, m_tex)) {
         s_gles2.glReadPixels(
                 0, 0, m_width, m_height, GL_RGBA, GL_UNSIGNED_BYTE, img);
         unbindFbo();
     }
 }
+
+bool ColorBuffer::copyTo(ColorBuffer* dst, EGLSyncKHR* sync) {
+    ScopedHelperContext context(m_helper);
+    if (!context.isOk()) {
+        return false;
+    }
+
+    // Don't draw with TextureDraw, which flips images vertically for
+    // display. Copy from this ColorBuffer's framebuffer object instead, so
+    // that |dst| reads back exactly like this ColorBuffer.
+    if (!bindFbo(&m_fbo, m_tex)) {
+        return false;
+    }
+
+    GLint currTexBind = 0;
+    s_gles2.glGetIntegerv(GL_TEXTURE_BINDING_2D, &currTexBind);
+    s_gles2.glBindTexture(GL_TEXTURE_2D, dst->m_tex);
+    s_gles2.glCopyTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, 0, 0,
+                                m_width < dst->m_width ? m_width
+                                                       : dst->m_width,
+                                m_height < dst->m_height ? m_height
+                                                         : dst->m_height);
+    s_gles2.glBindTexture(GL_TEXTURE_2D, currTexBind);
+    unbindFbo();
+
+    if (sync) {
+        *sync = s_egl.eglCreateSyncKHR(m_display, EGL_SYNC_FENCE_KHR, NULL);
+    }
+
+    // Submit the copy, and the fence, so that other contexts can wait for
+    // them and use |dst|.
+    s_gles2.glFlush();
+    return true;
+}
@@ -133,6 +133,21 @@ public:
     // |img| must be a buffer large enough (i.e. width * height * 4).
     void readback(unsigned char* img);
 
+    // Same as readback(), but with the current context instead of the
+    // helper one. The current context must share objects with the helper
+    // context. Framebuffer objects can't be shared though, so |*fbo| is the
+    // one to use in the current context, created on first use.
+    void readbackFromCurrentContext(GLuint* fbo, unsigned char* img);
+
+    // Copy the content of this ColorBuffer to |dst|, which should have the
+    // same size. If it doesn't, only the bottom-left pixels that both have
+    // are copied. The copy is submitted to the GPU, but not waited for. If |sync| is not
+    // NULL, it receives an EGL fence sync object that is signaled once the
+    // copy is complete, or EGL_NO_SYNC_KHR if it couldn't be created. The
+    // caller must destroy it. Only pass a non-NULL |sync| if the display
+    // supports EGL_KHR_fence_sync.
+    bool copyTo(ColorBuffer* dst, EGLSyncKHR* sync);
+
 private:
     ColorBuffer();  // no default constructor.
 
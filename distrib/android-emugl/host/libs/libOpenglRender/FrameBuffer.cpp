@@ -20,6 +20,7 @@
 #include "GLESv1Dispatch.h"
 #include "GLESv2Dispatch.h"
 #include "NativeSubWindow.h"
+#include "ReadbackWorker.h"
 #include "RenderThreadInfo.h"
 #include "TimeUtils.h"
 
@@ -66,11 +67,11 @@ public:
     ColorBufferHelper(FrameBuffer* fb) : mFb(fb) {}
 
     virtual bool setupContext() {
-        return mFb->bind_locked();
+        return mFb->bindHelperContext();
     }
 
     virtual void teardownContext() {
-        mFb->unbind_locked();
+        mFb->unbindHelperContext();
     }
 
     virtual TextureDraw* getTextureDraw() const {
@@ -150,6 +151,8 @@ static char* getGLES1ExtensionString(EGLDisplay p_dpy)
 }
 
 void FrameBuffer::finalize(){
+    delete m_readbackWorker;
+    m_readbackWorker = NULL;
     m_colorbuffers.clear();
     if (m_useSubWindow) {
         removeSubWindow();
@@ -329,6 +332,13 @@ bool FrameBuffer::initialize(int width, int height, bool useSubWindow)
         fb->m_caps.has_eglimage_renderbuffer = false;
     }
 
+    fb->m_caps.has_egl_fence_sync =
+            eglExtensions &&
+            strstr(eglExtensions, "EGL_KHR_fence_sync") != NULL &&
+            s_egl.eglCreateSyncKHR &&
+            s_egl.eglDestroySyncKHR &&
+            s_egl.eglClientWaitSyncKHR;
+
     //
     // Fail initialization if not all of the following extensions
     // exist:
@@ -437,6 +447,7 @@ FrameBuffer::FrameBuffer(int p_width, int p_height, bool useSubWindow) :
     m_onPost(NULL),
     m_onPostContext(NULL),
     m_fbImage(NULL),
+    m_readbackWorker(NULL),
     m_glVendor(NULL),
     m_glRenderer(NULL),
     m_glVersion(NULL)
@@ -445,6 +456,7 @@ FrameBuffer::FrameBuffer(int p_width, int p_height, bool useSubWindow) :
 }
 
 FrameBuffer::~FrameBuffer() {
+    delete m_readbackWorker;
     delete m_textureDraw;
     delete m_configs;
     delete m_colorBufferHelper;
@@ -454,9 +466,28 @@ FrameBuffer::~FrameBuffer() {
 void FrameBuffer::setPostCallback(OnPostFn onPost, void* onPostContext)
 {
     emugl::Mutex::AutoLock mutex(m_lock);
+    delete m_readbackWorker;
+    m_readbackWorker = NULL;
     m_onPost = onPost;
     m_onPostContext = onPostContext;
-    if (m_onPost && !m_fbImage) {
+    if (!m_onPost) {
+        return;
+    }
+    m_readbackWorker = ReadbackWorker::create(m_eglDisplay,
+                                              m_eglConfig,
+                                              m_pbufContext,
+                                              m_width,
+                                              m_height,
+                                              m_caps.has_eglimage_texture_2d,
+                                              m_caps.has_egl_fence_sync,
+                                              m_colorBufferHelper,
+                                              onPost,
+                                              onPostContext);
+    if (m_readbackWorker) {
+        return;
+    }
+    // Fall back to reading frames back synchronously in post().
+    if (!m_fbImage) {
         m_fbImage = (unsigned char*)malloc(4 * m_width * m_height);
         if (!m_fbImage) {
             ERR("out of memory, cancelling OnPost callback");
@@ -499,15 +530,14 @@ bool FrameBuffer::setupSubWindow(FBNativeWindowType p_window,
                 destroySubWindow(m_subWin);
                 m_subWin = (EGLNativeWindowType)0;
             } else {
+                m_drawLock.lock();
                 if (bindSubwin_locked()) {
                     // Subwin creation was successfull,
                     // update viewport and z rotation and draw
                     // the last posted color buffer.
                     s_gles2.glViewport(0, 0, p_width, p_height);
                     m_zRot = zRot;
-                    if (m_lastPostedColorBuffer) {
-                        post(m_lastPostedColorBuffer, false);
-                    } else {
+                    if (!m_lastPostedColorBuffer) {
                         s_gles2.glClear(GL_COLOR_BUFFER_BIT |
                                         GL_DEPTH_BUFFER_BIT |
                                         GL_STENCIL_BUFFER_BIT);
@@ -516,6 +546,10 @@ bool FrameBuffer::setupSubWindow(FBNativeWindowType p_window,
                     unbind_locked();
                     success = true;
                 }
+                m_drawLock.unlock();
+                if (success && m_lastPostedColorBuffer) {
+                    post(m_lastPostedColorBuffer, false);
+                }
             }
         }
     }
@@ -532,8 +566,10 @@ bool FrameBuffer::removeSubWindow() {
     bool removed = false;
     m_lock.lock();
     if (m_subWin) {
+        m_drawLock.lock();
         s_egl.eglMakeCurrent(m_eglDisplay, NULL, NULL, NULL);
         s_egl.eglDestroySurface(m_eglDisplay, m_eglSurface);
+        m_drawLock.unlock();
         destroySubWindow(m_subWin);
 
         m_eglSurface = EGL_NO_SURFACE;
@@ -544,22 +580,45 @@ bool FrameBuffer::removeSubWindow() {
     return removed;
 }
 
+// Must be called without holding any of the map locks.
 HandleType FrameBuffer::genHandle()
 {
     HandleType id;
+    bool used;
     do {
-        id = ++s_nextHandle;
-    } while( id == 0 ||
-             m_contexts.find(id) != m_contexts.end() ||
-             m_windows.find(id) != m_windows.end() );
+        id = __sync_add_and_fetch(&s_nextHandle, 1);
+        used = false;
+        // Only possible after the counter wrapped around.
+        if (id != 0) {
+            emugl::Mutex::AutoLock contextsMutex(m_contextsLock);
+            used = m_contexts.find(id) != m_contexts.end();
+        }
+        if (id != 0 && !used) {
+            emugl::Mutex::AutoLock windowsMutex(m_windowsLock);
+            used = m_windows.find(id) != m_windows.end();
+        }
+        if (id != 0 && !used) {
+            emugl::Mutex::AutoLock colorBuffersMutex(m_colorBuffersLock);
+            used = m_colorbuffers.find(id) != m_colorbuffers.end();
+        }
+    } while (id == 0 || used);
 
     return id;
 }
 
+ColorBufferPtr FrameBuffer::findColorBuffer(HandleType p_colorbuffer)
+{
+    emugl::Mutex::AutoLock mutex(m_colorBuffersLock);
+    ColorBufferMap::iterator c(m_colorbuffers.find(p_colorbuffer));
+    if (c == m_colorbuffers.end()) {
+        return ColorBufferPtr();
+    }
+    return (*c).second.cb;
+}
+
 HandleType FrameBuffer::createColorBuffer(int p_width, int p_height,
                                           GLenum p_internalFormat)
 {
-    emugl::Mutex::AutoLock mutex(m_lock);
     HandleType ret = 0;
 
     ColorBufferPtr cb(ColorBuffer::create(
@@ -571,6 +630,7 @@ HandleType FrameBuffer::createColorBuffer(int p_width, int p_height,
             m_colorBufferHelper));
     if (cb.Ptr() != NULL) {
         ret = genHandle();
+        emugl::Mutex::AutoLock mutex(m_colorBuffersLock);
         m_colorbuffers[ret].cb = cb;
         m_colorbuffers[ret].refcount = 1;
     }
@@ -580,7 +640,6 @@ HandleType FrameBuffer::createColorBuffer(int p_width, int p_height,
 HandleType FrameBuffer::createRenderContext(int p_config, HandleType p_share,
                                             bool p_isGL2)
 {
-    emugl::Mutex::AutoLock mutex(m_lock);
     HandleType ret = 0;
 
     const FbConfig* config = getConfigs()->get(p_config);
@@ -590,6 +649,7 @@ HandleType FrameBuffer::createRenderContext(int p_config, HandleType p_share,
 
     RenderContextPtr share(NULL);
     if (p_share != 0) {
+        emugl::Mutex::AutoLock mutex(m_contextsLock);
         RenderContextMap::iterator s(m_contexts.find(p_share));
         if (s == m_contexts.end()) {
             return ret;
@@ -603,7 +663,10 @@ HandleType FrameBuffer::createRenderContext(int p_config, HandleType p_share,
         m_eglDisplay, config->getEglConfig(), sharedContext, p_isGL2));
     if (rctx.Ptr() != NULL) {
         ret = genHandle();
-        m_contexts[ret] = rctx;
+        {
+            emugl::Mutex::AutoLock mutex(m_contextsLock);
+            m_contexts[ret] = rctx;
+        }
         RenderThreadInfo *tinfo = RenderThreadInfo::get();
         tinfo->m_contextSet.insert(ret);
     }
@@ -612,8 +675,6 @@ HandleType FrameBuffer::createRenderContext(int p_config, HandleType p_share,
 
 HandleType FrameBuffer::createWindowSurface(int p_config, int p_width, int p_height)
 {
-    emugl::Mutex::AutoLock mutex(m_lock);
-
     HandleType ret = 0;
 
     const FbConfig* config = getConfigs()->get(p_config);
@@ -625,7 +686,10 @@ HandleType FrameBuffer::createWindowSurface(int p_config, int p_width, int p_hei
             getDisplay(), config->getEglConfig(), p_width, p_height));
     if (win.Ptr() != NULL) {
         ret = genHandle();
-        m_windows[ret] = std::pair<WindowSurfacePtr, HandleType>(win,0);
+        {
+            emugl::Mutex::AutoLock mutex(m_windowsLock);
+            m_windows[ret] = std::pair<WindowSurfacePtr, HandleType>(win,0);
+        }
         RenderThreadInfo *tinfo = RenderThreadInfo::get();
         tinfo->m_windowSet.insert(ret);
     }
@@ -635,7 +699,7 @@ HandleType FrameBuffer::createWindowSurface(int p_config, int p_width, int p_hei
 
 void FrameBuffer::drainRenderContext()
 {
-    emugl::Mutex::AutoLock mutex(m_lock);
+    emugl::Mutex::AutoLock mutex(m_contextsLock);
     RenderThreadInfo *tinfo = RenderThreadInfo::get();
     if (tinfo->m_contextSet.empty()) return;
     for (std::set<HandleType>::iterator it = tinfo->m_contextSet.begin();
@@ -648,7 +712,8 @@ void FrameBuffer::drainRenderContext()
 
 void FrameBuffer::drainWindowSurface()
 {
-    emugl::Mutex::AutoLock mutex(m_lock);
+    emugl::Mutex::AutoLock windowsMutex(m_windowsLock);
+    emugl::Mutex::AutoLock colorBuffersMutex(m_colorBuffersLock);
     RenderThreadInfo *tinfo = RenderThreadInfo::get();
     if (tinfo->m_windowSet.empty()) return;
     for (std::set<HandleType>::iterator it = tinfo->m_windowSet.begin();
@@ -670,7 +735,7 @@ void FrameBuffer::drainWindowSurface()
 
 void FrameBuffer::DestroyRenderContext(HandleType p_context)
 {
-    emugl::Mutex::AutoLock mutex(m_lock);
+    emugl::Mutex::AutoLock mutex(m_contextsLock);
     m_contexts.erase(p_context);
     RenderThreadInfo *tinfo = RenderThreadInfo::get();
     if (tinfo->m_contextSet.empty()) return;
@@ -679,7 +744,7 @@ void FrameBuffer::DestroyRenderContext(HandleType p_context)
 
 void FrameBuffer::DestroyWindowSurface(HandleType p_surface)
 {
-    emugl::Mutex::AutoLock mutex(m_lock);
+    emugl::Mutex::AutoLock mutex(m_windowsLock);
     if (m_windows.find(p_surface) != m_windows.end()) {
         m_windows.erase(p_surface);
         RenderThreadInfo *tinfo = RenderThreadInfo::get();
@@ -690,7 +755,7 @@ void FrameBuffer::DestroyWindowSurface(HandleType p_surface)
 
 int FrameBuffer::openColorBuffer(HandleType p_colorbuffer)
 {
-    emugl::Mutex::AutoLock mutex(m_lock);
+    emugl::Mutex::AutoLock mutex(m_colorBuffersLock);
     ColorBufferMap::iterator c(m_colorbuffers.find(p_colorbuffer));
     if (c == m_colorbuffers.end()) {
         // bad colorbuffer handle
@@ -703,7 +768,7 @@ int FrameBuffer::openColorBuffer(HandleType p_colorbuffer)
 
 void FrameBuffer::closeColorBuffer(HandleType p_colorbuffer)
 {
-    emugl::Mutex::AutoLock mutex(m_lock);
+    emugl::Mutex::AutoLock mutex(m_colorBuffersLock);
     ColorBufferMap::iterator c(m_colorbuffers.find(p_colorbuffer));
     if (c == m_colorbuffers.end()) {
         // This is harmless: it is normal for guest system to issue
@@ -719,16 +784,19 @@ void FrameBuffer::closeColorBuffer(HandleType p_colorbuffer)
 
 bool FrameBuffer::flushWindowSurfaceColorBuffer(HandleType p_surface)
 {
-    emugl::Mutex::AutoLock mutex(m_lock);
+    WindowSurfacePtr surface;
+    {
+        emugl::Mutex::AutoLock mutex(m_windowsLock);
 
-    WindowSurfaceMap::iterator w( m_windows.find(p_surface) );
-    if (w == m_windows.end()) {
-        ERR("FB::flushWindowSurfaceColorBuffer: window handle %#x not found\n", p_surface);
-        // bad surface handle
-        return false;
+        WindowSurfaceMap::iterator w( m_windows.find(p_surface) );
+        if (w == m_windows.end()) {
+            ERR("FB::flushWindowSurfaceColorBuffer: window handle %#x not found\n", p_surface);
+            // bad surface handle
+            return false;
+        }
+        surface = (*w).second.first;
     }
 
-    WindowSurface* surface = (*w).second.first.Ptr();
     surface->flushColorBuffer();
 
     return true;
@@ -737,7 +805,8 @@ bool FrameBuffer::flushWindowSurfaceColorBuffer(HandleType p_surface)
 bool FrameBuffer::setWindowSurfaceColorBuffer(HandleType p_surface,
                                               HandleType p_colorbuffer)
 {
-    emugl::Mutex::AutoLock mutex(m_lock);
+    emugl::Mutex::AutoLock windowsMutex(m_windowsLock);
+    emugl::Mutex::AutoLock colorBuffersMutex(m_colorBuffersLock);
 
     WindowSurfaceMap::iterator w( m_windows.find(p_surface) );
     if (w == m_windows.end()) {
@@ -762,66 +831,56 @@ void FrameBuffer::readColorBuffer(HandleType p_colorbuffer,
                                     int x, int y, int width, int height,
                                     GLenum format, GLenum type, void *pixels)
 {
-    emugl::Mutex::AutoLock mutex(m_lock);
-
-    ColorBufferMap::iterator c( m_colorbuffers.find(p_colorbuffer) );
-    if (c == m_colorbuffers.end()) {
+    ColorBufferPtr cb = findColorBuffer(p_colorbuffer);
+    if (cb.Ptr() == NULL) {
         // bad colorbuffer handle
         return;
     }
 
-    (*c).second.cb->readPixels(x, y, width, height, format, type, pixels);
+    cb->readPixels(x, y, width, height, format, type, pixels);
 }
 
 bool FrameBuffer::updateColorBuffer(HandleType p_colorbuffer,
                                     int x, int y, int width, int height,
                                     GLenum format, GLenum type, void *pixels)
 {
-    emugl::Mutex::AutoLock mutex(m_lock);
-
-    ColorBufferMap::iterator c( m_colorbuffers.find(p_colorbuffer) );
-    if (c == m_colorbuffers.end()) {
+    ColorBufferPtr cb = findColorBuffer(p_colorbuffer);
+    if (cb.Ptr() == NULL) {
         // bad colorbuffer handle
         return false;
     }
 
-    (*c).second.cb->subUpdate(x, y, width, height, format, type, pixels);
+    cb->subUpdate(x, y, width, height, format, type, pixels);
 
     return true;
 }
 
 bool FrameBuffer::bindColorBufferToTexture(HandleType p_colorbuffer)
 {
-    emugl::Mutex::AutoLock mutex(m_lock);
-
-    ColorBufferMap::iterator c( m_colorbuffers.find(p_colorbuffer) );
-    if (c == m_colorbuffers.end()) {
+    ColorBufferPtr cb = findColorBuffer(p_colorbuffer);
+    if (cb.Ptr() == NULL) {
         // bad colorbuffer handle
         return false;
     }
 
-    return (*c).second.cb->bindToTexture();
+    return cb->bindToTexture();
 }
 
 bool FrameBuffer::bindColorBufferToRenderbuffer(HandleType p_colorbuffer)
 {
-    emugl::Mutex::AutoLock mutex(m_lock);
-
-    ColorBufferMap::iterator c( m_colorbuffers.find(p_colorbuffer) );
-    if (c == m_colorbuffers.end()) {
+    ColorBufferPtr cb = findColorBuffer(p_colorbuffer);
+    if (cb.Ptr() == NULL) {
         // bad colorbuffer handle
         return false;
     }
 
-    return (*c).second.cb->bindToRenderbuffer();
+    return cb->bindToRenderbuffer();
 }
 
 bool FrameBuffer::bindContext(HandleType p_context,
                               HandleType p_drawSurface,
                               HandleType p_readSurface)
 {
-    emugl::Mutex::AutoLock mutex(m_lock);
-
     WindowSurfacePtr draw(NULL), read(NULL);
     RenderContextPtr ctx(NULL);
 
@@ -829,13 +888,17 @@ bool FrameBuffer::bindContext(HandleType p_context,
     // if this is not an unbind operation - make sure all handles are good
     //
     if (p_context || p_drawSurface || p_readSurface) {
-        RenderContextMap::iterator r( m_contexts.find(p_context) );
-        if (r == m_contexts.end()) {
-            // bad context handle
-            return false;
+        {
+            emugl::Mutex::AutoLock mutex(m_contextsLock);
+            RenderContextMap::iterator r( m_contexts.find(p_context) );
+            if (r == m_contexts.end()) {
+                // bad context handle
+                return false;
+            }
+            ctx = (*r).second;
         }
 
-        ctx = (*r).second;
+        emugl::Mutex::AutoLock mutex(m_windowsLock);
         WindowSurfaceMap::iterator w( m_windows.find(p_drawSurface) );
         if (w == m_windows.end()) {
             // bad surface handle
@@ -905,8 +968,24 @@ bool FrameBuffer::bindContext(HandleType p_context,
     return true;
 }
 
+bool FrameBuffer::bindHelperContext()
+{
+    m_drawLock.lock();
+    if (!bind_locked()) {
+        m_drawLock.unlock();
+        return false;
+    }
+    return true;
+}
+
+void FrameBuffer::unbindHelperContext()
+{
+    unbind_locked();
+    m_drawLock.unlock();
+}
+
 //
-// The framebuffer lock should be held when calling this function !
+// The framebuffer draw lock should be held when calling this function !
 //
 bool FrameBuffer::bind_locked()
 {
@@ -971,8 +1050,8 @@ bool FrameBuffer::post(HandleType p_colorbuffer, bool needLock)
     }
     bool ret = false;
 
-    ColorBufferMap::iterator c( m_colorbuffers.find(p_colorbuffer) );
-    if (c == m_colorbuffers.end()) {
+    ColorBufferPtr cb = findColorBuffer(p_colorbuffer);
+    if (cb.Ptr() == NULL) {
         goto EXIT;
     }
 
@@ -980,7 +1059,9 @@ bool FrameBuffer::post(HandleType p_colorbuffer, bool needLock)
 
     if (m_subWin) {
         // bind the subwindow eglSurface
+        m_drawLock.lock();
         if (!bindSubwin_locked()) {
+            m_drawLock.unlock();
             ERR("FrameBuffer::post(): eglMakeCurrent failed\n");
             goto EXIT;
         }
@@ -991,13 +1072,14 @@ bool FrameBuffer::post(HandleType p_colorbuffer, bool needLock)
         if (m_zRot != 0.0f) {
             s_gles2.glClear(GL_COLOR_BUFFER_BIT);
         }
-        ret = (*c).second.cb->post(m_zRot);
+        ret = cb->post(m_zRot);
         if (ret) {
             s_egl.eglSwapBuffers(m_eglDisplay, m_eglSurface);
         }
 
         // restore previous binding
         unbind_locked();
+        m_drawLock.unlock();
     } else {
         // If there is no sub-window, don't display anything, the client will
         // rely on m_onPost to get the pixels instead.
@@ -1021,8 +1103,10 @@ bool FrameBuffer::post(HandleType p_colorbuffer, bool needLock)
     //
     // Send framebuffer (without FPS overlay) to callback
     //
-    if (m_onPost) {
-        (*c).second.cb->readback(m_fbImage);
+    if (m_readbackWorker) {
+        m_readbackWorker->post(cb.Ptr());
+    } else if (m_onPost) {
+        cb->readback(m_fbImage);
         m_onPost(m_onPostContext,
                  m_width,
                  m_height,
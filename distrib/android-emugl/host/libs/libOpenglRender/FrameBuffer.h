@@ -17,6 +17,7 @@
 #define _LIBRENDER_FRAMEBUFFER_H
 
 #include "ColorBuffer.h"
+#include "emugl/common/integer_hash_map.h"
 #include "emugl/common/mutex.h"
 #include "FbConfig.h"
 #include "RenderContext.h"
@@ -26,10 +27,10 @@
 
 #include <EGL/egl.h>
 
-#include <map>
-
 #include <stdint.h>
 
+class ReadbackWorker;
+
 // Type of handles, a.k.a. "object names" in the GL specification.
 // These are integers used to uniquely identify a resource of a given type.
 typedef uint32_t HandleType;
@@ -38,9 +39,10 @@ struct ColorBufferRef {
     ColorBufferPtr cb;
     uint32_t refcount;  // number of client-side references
 };
-typedef std::map<HandleType, RenderContextPtr> RenderContextMap;
-typedef std::map<HandleType, std::pair<WindowSurfacePtr, HandleType> > WindowSurfaceMap;
-typedef std::map<HandleType, ColorBufferRef> ColorBufferMap;
+// These are looked up on most rendering commands, hence the hash maps.
+typedef emugl::IntegerHashMap<HandleType, RenderContextPtr> RenderContextMap;
+typedef emugl::IntegerHashMap<HandleType, std::pair<WindowSurfacePtr, HandleType> > WindowSurfaceMap;
+typedef emugl::IntegerHashMap<HandleType, ColorBufferRef> ColorBufferMap;
 
 // A structure used to list the capabilities of the underlying EGL
 // implementation that the FrameBuffer instance depends on.
@@ -48,11 +50,14 @@ typedef std::map<HandleType, ColorBufferRef> ColorBufferMap;
 // extension is supported.
 // |has_eglimage_renderbuffer| is true iff the EGL_KHR_gl_renderbuffer_image
 // extension is supported.
+// |has_egl_fence_sync| is true iff the EGL_KHR_fence_sync extension is
+// supported, and its functions could be loaded.
 // |eglMajor| and |eglMinor| are the major and minor version numbers of
 // the underlying EGL implementation.
 struct FrameBufferCaps {
     bool has_eglimage_texture_2d;
     bool has_eglimage_renderbuffer;
+    bool has_egl_fence_sync;
     EGLint eglMajor;
     EGLint eglMinor;
 };
@@ -274,11 +279,22 @@ public:
     bool bind_locked();
     bool unbind_locked();
 
+    // Used internally by ColorBuffer operations: acquire the draw lock and
+    // bind the FrameBuffer's pbuffer context, or unbind it and release the
+    // lock.
+    bool bindHelperContext();
+    void unbindHelperContext();
+
 private:
     FrameBuffer(int p_width, int p_height, bool useSubWindow);
     ~FrameBuffer();
     HandleType genHandle();
 
+    // Return the ColorBuffer for |p_colorbuffer|, or a NULL pointer if the
+    // handle is invalid. The returned reference keeps it alive even if it
+    // is closed concurrently.
+    ColorBufferPtr findColorBuffer(HandleType p_colorbuffer);
+
     bool bindSubwin_locked();
 
 private:
@@ -289,7 +305,24 @@ private:
     int m_width;
     int m_height;
     bool m_useSubWindow;
+    // Render threads decode their streams concurrently, so the state below
+    // is protected by several locks. When more than one is needed, they are
+    // always taken in the order in which they are declared here.
+    //
+    // |m_lock| protects the display: the sub-window, the post callback and
+    // the last posted ColorBuffer.
     emugl::Mutex m_lock;
+    // |m_contextsLock|, |m_windowsLock| and |m_colorBuffersLock| protect
+    // |m_contexts|, |m_windows| and |m_colorbuffers| respectively. The
+    // objects themselves are reference-counted and are used outside of the
+    // locks.
+    emugl::Mutex m_contextsLock;
+    emugl::Mutex m_windowsLock;
+    emugl::Mutex m_colorBuffersLock;
+    // |m_drawLock| serializes the use of the FrameBuffer's own EGL contexts
+    // (the pbuffer one used by ColorBuffer operations and the sub-window one
+    // used to post), and of |m_textureDraw|.
+    emugl::Mutex m_drawLock;
     FbConfigList* m_configs;
     FBNativeWindowType m_nativeWindow;
     FrameBufferCaps m_caps;
@@ -321,6 +354,9 @@ private:
     OnPostFn m_onPost;
     void* m_onPostContext;
     unsigned char* m_fbImage;
+    // Reads frames back for |m_onPost| off the posting thread, or NULL to
+    // read them back synchronously into |m_fbImage|.
+    ReadbackWorker* m_readbackWorker;
 
     const char* m_glVendor;
     const char* m_glRenderer;
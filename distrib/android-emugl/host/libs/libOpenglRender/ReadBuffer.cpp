@@ -22,6 +22,7 @@
 ReadBuffer::ReadBuffer(IOStream *stream, size_t bufsize)
 {
     m_size = bufsize;
+    m_initialSize = bufsize;
     m_stream = stream;
     m_buf = (unsigned char*)malloc(m_size*sizeof(unsigned char));
     m_validData = 0;
@@ -33,6 +34,21 @@ ReadBuffer::~ReadBuffer()
     free(m_buf);
 }
 
+void ReadBuffer::setStream(IOStream *stream)
+{
+    m_stream = stream;
+    m_validData = 0;
+    if (m_size > m_initialSize) {
+        unsigned char* new_buf =
+                (unsigned char*)realloc(m_buf, m_initialSize);
+        if (new_buf) {
+            m_buf = new_buf;
+            m_size = m_initialSize;
+        }
+    }
+    m_readPtr = m_buf;
+}
+
 int ReadBuffer::getData()
 {
     if ((m_validData > 0) && (m_readPtr > m_buf)) {
@@ -22,6 +22,10 @@ class ReadBuffer {
 public:
     ReadBuffer(IOStream *stream, size_t bufSize);
     ~ReadBuffer();
+    // Start reading from |stream|, dropping the data left from the previous
+    // stream, so that the buffer can be reused across connections. Memory
+    // grown beyond |bufSize| by the previous stream is released.
+    void setStream(IOStream *stream);
     int getData(); // get fresh data from the stream
     unsigned char *buf() { return m_readPtr; } // return the next read location
     size_t validData() { return m_validData; } // return the amount of valid data in readptr
@@ -30,6 +34,7 @@ private:
     unsigned char *m_buf;
     unsigned char *m_readPtr;
     size_t m_size;
+    size_t m_initialSize;
     size_t m_validData;
     IOStream *m_stream;
 };
@@ -0,0 +1,96 @@
+/*
+* Copyright (C) 2015 The Android Open Source Project
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+#include "ReadbackQueue.h"
+
+ReadbackQueue::ReadbackQueue(int numSlots) :
+        m_lock(),
+        m_cond(),
+        m_slots(numSlots),
+        m_serial(0),
+        m_dropped(0),
+        m_stopped(false) {
+    for (size_t n = 0; n < m_slots.size(); ++n) {
+        m_slots[n].state = kFree;
+        m_slots[n].serial = 0;
+    }
+}
+
+int ReadbackQueue::oldestFull_locked() const {
+    int oldest = -1;
+    for (size_t n = 0; n < m_slots.size(); ++n) {
+        if (m_slots[n].state == kFull &&
+            (oldest < 0 ||
+             // Wrap-around safe comparison.
+             (int)(m_slots[n].serial - m_slots[oldest].serial) < 0)) {
+            oldest = static_cast<int>(n);
+        }
+    }
+    return oldest;
+}
+
+int ReadbackQueue::acquireWrite() {
+    emugl::Mutex::AutoLock lock(m_lock);
+    for (size_t n = 0; n < m_slots.size(); ++n) {
+        if (m_slots[n].state == kFree) {
+            m_slots[n].state = kWriting;
+            return static_cast<int>(n);
+        }
+    }
+    int slot = oldestFull_locked();
+    if (slot >= 0) {
+        m_slots[slot].state = kWriting;
+        m_dropped++;
+    }
+    return slot;
+}
+
+void ReadbackQueue::commitWrite(int slot) {
+    emugl::Mutex::AutoLock lock(m_lock);
+    m_slots[slot].state = kFull;
+    m_slots[slot].serial = m_serial++;
+    m_cond.signal();
+}
+
+int ReadbackQueue::acquireRead() {
+    emugl::Mutex::AutoLock lock(m_lock);
+    for (;;) {
+        if (m_stopped) {
+            return -1;
+        }
+        int slot = oldestFull_locked();
+        if (slot >= 0) {
+            m_slots[slot].state = kReading;
+            return slot;
+        }
+        m_cond.wait(&m_lock);
+    }
+}
+
+void ReadbackQueue::release(int slot) {
+    emugl::Mutex::AutoLock lock(m_lock);
+    m_slots[slot].state = kFree;
+}
+
+void ReadbackQueue::stop() {
+    emugl::Mutex::AutoLock lock(m_lock);
+    m_stopped = true;
+    m_cond.signal();
+}
+
+int ReadbackQueue::droppedFrames() const {
+    emugl::Mutex::AutoLock lock(m_lock);
+    return m_dropped;
+}
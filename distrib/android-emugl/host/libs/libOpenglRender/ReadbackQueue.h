@@ -0,0 +1,85 @@
+/*
+* Copyright (C) 2015 The Android Open Source Project
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+#ifndef _LIB_OPENGL_RENDER_READBACK_QUEUE_H
+#define _LIB_OPENGL_RENDER_READBACK_QUEUE_H
+
+#include "emugl/common/condition_variable.h"
+#include "emugl/common/mutex.h"
+
+#include <vector>
+
+// Tracks the slots of a ReadbackWorker's staging ring.
+//
+// A single writer (the thread posting frames) fills slots, and never waits:
+// if no slot is free, it takes over the oldest frame that hasn't been read
+// yet, which is dropped. A single reader (the worker thread) waits for
+// filled slots and reads them in the order they were filled.
+//
+// With at least two slots, the writer always gets a slot, since the reader
+// only holds one at a time.
+class ReadbackQueue {
+public:
+    explicit ReadbackQueue(int numSlots);
+
+    int numSlots() const { return static_cast<int>(m_slots.size()); }
+
+    // Writer: return the index of a slot to fill, or -1 if there is none.
+    int acquireWrite();
+
+    // Writer: mark |slot| as filled, and wake up the reader.
+    void commitWrite(int slot);
+
+    // Reader: wait for the oldest filled slot and return its index, or -1
+    // once stop() has been called.
+    int acquireRead();
+
+    // Return |slot| to the free slots, once the reader has read it, or when
+    // the writer gives up filling it.
+    void release(int slot);
+
+    // Make acquireRead() return -1 from now on.
+    void stop();
+
+    // Number of frames that were dropped by acquireWrite().
+    int droppedFrames() const;
+
+private:
+    enum State {
+        kFree,
+        kWriting,
+        kFull,
+        kReading,
+    };
+
+    struct Slot {
+        State state;
+        // Order in which full slots were filled.
+        unsigned serial;
+    };
+
+    // Return the full slot with the lowest serial, or -1. Call with m_lock
+    // held.
+    int oldestFull_locked() const;
+
+    mutable emugl::Mutex m_lock;
+    emugl::ConditionVariable m_cond;
+    std::vector<Slot> m_slots;
+    unsigned m_serial;
+    int m_dropped;
+    bool m_stopped;
+};
+
+#endif  // _LIB_OPENGL_RENDER_READBACK_QUEUE_H
@@ -0,0 +1,149 @@
+// Copyright (C) 2015 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "ReadbackQueue.h"
+
+#include "emugl/common/testing/test_thread.h"
+
+#include <gtest/gtest.h>
+
+#include <vector>
+
+namespace {
+
+using emugl::TestThread;
+
+void* stopFunction(void* param) {
+    static_cast<ReadbackQueue*>(param)->stop();
+    return NULL;
+}
+
+// Reads frames from a queue until it reads |lastFrame|. Each slot holds the
+// index of the frame that was written to it.
+struct Reader {
+    ReadbackQueue* queue;
+    const int* slotFrames;
+    int lastFrame;
+    std::vector<int> frames;
+};
+
+void* readerFunction(void* param) {
+    Reader* reader = static_cast<Reader*>(param);
+    int slot;
+    while ((slot = reader->queue->acquireRead()) >= 0) {
+        int frame = reader->slotFrames[slot];
+        reader->queue->release(slot);
+        reader->frames.push_back(frame);
+        if (frame == reader->lastFrame) {
+            break;
+        }
+    }
+    return NULL;
+}
+
+}  // namespace
+
+TEST(ReadbackQueue, ReadsInOrder) {
+    ReadbackQueue queue(3);
+    int first = queue.acquireWrite();
+    queue.commitWrite(first);
+    int second = queue.acquireWrite();
+    EXPECT_NE(first, second);
+    queue.commitWrite(second);
+
+    EXPECT_EQ(first, queue.acquireRead());
+    queue.release(first);
+    EXPECT_EQ(second, queue.acquireRead());
+    queue.release(second);
+    EXPECT_EQ(0, queue.droppedFrames());
+}
+
+TEST(ReadbackQueue, DropsOldestFrameWhenFull) {
+    ReadbackQueue queue(3);
+    int slots[3];
+    for (int n = 0; n < 3; ++n) {
+        slots[n] = queue.acquireWrite();
+        ASSERT_GE(slots[n], 0);
+        queue.commitWrite(slots[n]);
+    }
+
+    // The writer doesn't wait, and takes the slot of the oldest frame.
+    EXPECT_EQ(slots[0], queue.acquireWrite());
+    EXPECT_EQ(1, queue.droppedFrames());
+    queue.commitWrite(slots[0]);
+
+    EXPECT_EQ(slots[1], queue.acquireRead());
+    queue.release(slots[1]);
+    EXPECT_EQ(slots[2], queue.acquireRead());
+    queue.release(slots[2]);
+    EXPECT_EQ(slots[0], queue.acquireRead());
+    queue.release(slots[0]);
+}
+
+TEST(ReadbackQueue, SkipsSlotBeingRead) {
+    ReadbackQueue queue(2);
+    int first = queue.acquireWrite();
+    queue.commitWrite(first);
+    EXPECT_EQ(first, queue.acquireRead());
+
+    // Only one slot can be written while the other one is being read.
+    int second = queue.acquireWrite();
+    EXPECT_NE(first, second);
+    queue.commitWrite(second);
+    EXPECT_EQ(second, queue.acquireWrite());
+    EXPECT_EQ(1, queue.droppedFrames());
+
+    // Giving up on a slot frees it without making it readable.
+    queue.release(second);
+    queue.release(first);
+    EXPECT_EQ(first, queue.acquireWrite());
+}
+
+TEST(ReadbackQueue, StopWakesUpReader) {
+    ReadbackQueue queue(2);
+    TestThread* thread = new TestThread(stopFunction, &queue);
+    EXPECT_EQ(-1, queue.acquireRead());
+    thread->join();
+    delete thread;
+
+    // Even with frames left.
+    queue.commitWrite(queue.acquireWrite());
+    EXPECT_EQ(-1, queue.acquireRead());
+}
+
+TEST(ReadbackQueue, ConcurrentReaderSeesIncreasingFrames) {
+    const int kNumFrames = 20000;
+    ReadbackQueue queue(3);
+    int slotFrames[3] = { -1, -1, -1 };
+    Reader reader = { &queue, slotFrames, kNumFrames - 1, std::vector<int>() };
+    TestThread* thread = new TestThread(readerFunction, &reader);
+
+    for (int n = 0; n < kNumFrames; ++n) {
+        int slot = queue.acquireWrite();
+        ASSERT_GE(slot, 0);
+        slotFrames[slot] = n;
+        queue.commitWrite(slot);
+    }
+    // The last frame is never dropped, since nothing is written after it.
+    thread->join();
+    delete thread;
+
+    ASSERT_FALSE(reader.frames.empty());
+    EXPECT_EQ(kNumFrames - 1, reader.frames.back());
+    for (size_t n = 1; n < reader.frames.size(); ++n) {
+        EXPECT_LT(reader.frames[n - 1], reader.frames[n]);
+    }
+    EXPECT_EQ(kNumFrames,
+              static_cast<int>(reader.frames.size()) + queue.droppedFrames());
+}
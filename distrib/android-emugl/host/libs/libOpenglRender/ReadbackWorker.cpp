@@ -0,0 +1,202 @@
+/*
+* Copyright (C) 2015 The Android Open Source Project
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+#include "ReadbackWorker.h"
+
+#include "EGLDispatch.h"
+#include "GLESv2Dispatch.h"
+
+#include <stdlib.h>
+
+// static
+ReadbackWorker* ReadbackWorker::create(EGLDisplay display,
+                                       EGLConfig config,
+                                       EGLContext shareContext,
+                                       int width,
+                                       int height,
+                                       bool hasEglImageTexture2d,
+                                       bool useFenceSync,
+                                       ColorBuffer::Helper* helper,
+                                       OnPostFn onPost,
+                                       void* onPostContext) {
+    ReadbackWorker* worker = new ReadbackWorker(display,
+                                                width,
+                                                height,
+                                                useFenceSync,
+                                                onPost,
+                                                onPostContext);
+
+    static const GLint glContextAttribs[] = {
+        EGL_CONTEXT_CLIENT_VERSION, 2,
+        EGL_NONE
+    };
+    worker->m_context = s_egl.eglCreateContext(display,
+                                               config,
+                                               shareContext,
+                                               glContextAttribs);
+    if (worker->m_context == EGL_NO_CONTEXT) {
+        ERR("%s: Failed to create context 0x%x\n", __FUNCTION__,
+            s_egl.eglGetError());
+        delete worker;
+        return NULL;
+    }
+
+    static const EGLint pbufAttribs[] = {
+        EGL_WIDTH, 1,
+        EGL_HEIGHT, 1,
+        EGL_NONE
+    };
+    worker->m_surface = s_egl.eglCreatePbufferSurface(display,
+                                                      config,
+                                                      pbufAttribs);
+    if (worker->m_surface == EGL_NO_SURFACE) {
+        ERR("%s: Failed to create pbuffer 0x%x\n", __FUNCTION__,
+            s_egl.eglGetError());
+        delete worker;
+        return NULL;
+    }
+
+    worker->m_image = (unsigned char*)malloc(4 * width * height);
+    if (!worker->m_image) {
+        ERR("%s: out of memory\n", __FUNCTION__);
+        delete worker;
+        return NULL;
+    }
+
+    for (int n = 0; n < kNumSlots; ++n) {
+        worker->m_staging[n] = ColorBuffer::create(display,
+                                                   width,
+                                                   height,
+                                                   GL_RGBA,
+                                                   hasEglImageTexture2d,
+                                                   helper);
+        if (!worker->m_staging[n]) {
+            ERR("%s: Failed to create staging buffer\n", __FUNCTION__);
+            delete worker;
+            return NULL;
+        }
+    }
+
+    if (!worker->start()) {
+        ERR("%s: Failed to start thread\n", __FUNCTION__);
+        delete worker;
+        return NULL;
+    }
+    worker->m_started = true;
+    return worker;
+}
+
+ReadbackWorker::ReadbackWorker(EGLDisplay display,
+                               int width,
+                               int height,
+                               bool useFenceSync,
+                               OnPostFn onPost,
+                               void* onPostContext) :
+        emugl::Thread(),
+        m_display(display),
+        m_context(EGL_NO_CONTEXT),
+        m_surface(EGL_NO_SURFACE),
+        m_width(width),
+        m_height(height),
+        m_onPost(onPost),
+        m_onPostContext(onPostContext),
+        m_queue(kNumSlots),
+        m_useFenceSync(useFenceSync),
+        m_image(NULL),
+        m_started(false) {
+    for (int n = 0; n < kNumSlots; ++n) {
+        m_staging[n] = NULL;
+        m_fbos[n] = 0;
+        m_syncs[n] = EGL_NO_SYNC_KHR;
+    }
+}
+
+ReadbackWorker::~ReadbackWorker() {
+    if (m_started) {
+        m_queue.stop();
+        wait(NULL);
+    }
+
+    for (int n = 0; n < kNumSlots; ++n) {
+        destroySync(n);
+        delete m_staging[n];
+    }
+    if (m_surface != EGL_NO_SURFACE) {
+        s_egl.eglDestroySurface(m_display, m_surface);
+    }
+    if (m_context != EGL_NO_CONTEXT) {
+        s_egl.eglDestroyContext(m_display, m_context);
+    }
+    free(m_image);
+}
+
+void ReadbackWorker::post(ColorBuffer* cb) {
+    int slot = m_queue.acquireWrite();
+    if (slot < 0) {
+        return;
+    }
+    // The slot may hold a frame that is dropped.
+    destroySync(slot);
+    if (cb->copyTo(m_staging[slot], m_useFenceSync ? &m_syncs[slot] : NULL)) {
+        m_queue.commitWrite(slot);
+    } else {
+        m_queue.release(slot);
+    }
+}
+
+void ReadbackWorker::destroySync(int slot) {
+    if (m_syncs[slot] != EGL_NO_SYNC_KHR) {
+        s_egl.eglDestroySyncKHR(m_display, m_syncs[slot]);
+        m_syncs[slot] = EGL_NO_SYNC_KHR;
+    }
+}
+
+intptr_t ReadbackWorker::main() {
+    if (!s_egl.eglMakeCurrent(m_display, m_surface, m_surface, m_context)) {
+        ERR("%s: Failed to make context current 0x%x\n", __FUNCTION__,
+            s_egl.eglGetError());
+        return -1;
+    }
+
+    int slot;
+    while ((slot = m_queue.acquireRead()) >= 0) {
+        // Wait for the copy submitted by post(). This only blocks this
+        // thread. Without a fence, glReadPixels() waits for it.
+        if (m_syncs[slot] != EGL_NO_SYNC_KHR) {
+            s_egl.eglClientWaitSyncKHR(m_display,
+                                       m_syncs[slot],
+                                       EGL_SYNC_FLUSH_COMMANDS_BIT_KHR,
+                                       EGL_FOREVER_KHR);
+            destroySync(slot);
+        }
+        m_staging[slot]->readbackFromCurrentContext(&m_fbos[slot], m_image);
+        m_queue.release(slot);
+        m_onPost(m_onPostContext,
+                 m_width,
+                 m_height,
+                 -1,
+                 GL_RGBA,
+                 GL_UNSIGNED_BYTE,
+                 m_image);
+    }
+
+    for (int n = 0; n < kNumSlots; ++n) {
+        if (m_fbos[n]) {
+            s_gles2.glDeleteFramebuffers(1, &m_fbos[n]);
+        }
+    }
+    s_egl.eglMakeCurrent(m_display, NULL, NULL, NULL);
+    return 0;
+}
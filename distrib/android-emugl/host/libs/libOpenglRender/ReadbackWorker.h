@@ -0,0 +1,104 @@
+/*
+* Copyright (C) 2015 The Android Open Source Project
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+#ifndef _LIB_OPENGL_RENDER_READBACK_WORKER_H
+#define _LIB_OPENGL_RENDER_READBACK_WORKER_H
+
+#include "ColorBuffer.h"
+#include "ReadbackQueue.h"
+#include "render_api.h"
+
+#include "emugl/common/thread.h"
+
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+
+// Reads posted frames back to host memory without stalling the thread that
+// posts them, and passes them to the post callback.
+//
+// post() only submits a GPU copy of the posted ColorBuffer to a ring of
+// staging ColorBuffers. A worker thread, with its own EGL context sharing
+// objects with the FrameBuffer's ones, reads the staging buffers back with
+// glReadPixels() and calls the callback. Frames are delivered in order, at
+// least one frame late; if the callback can't keep up, older frames are
+// dropped rather than blocking post().
+//
+// When the display supports EGL_KHR_fence_sync, post() also inserts a fence
+// after each copy, and the worker waits for it before reading the staging
+// buffer. Otherwise, it relies on glReadPixels() waiting for the copy.
+//
+// GLES 2.0 has no pixel pack buffers, so the staging buffers play their role.
+class ReadbackWorker : public emugl::Thread {
+public:
+    // Create and start a new worker for frames of |width| x |height| pixels.
+    // |shareContext| is the context that ColorBuffers are created with, and
+    // |config| its EGL config. |hasEglImageTexture2d| and |helper| are used
+    // to create the staging ColorBuffers, see ColorBuffer::create().
+    // |useFenceSync| must only be true if the display supports
+    // EGL_KHR_fence_sync. Return NULL on failure.
+    static ReadbackWorker* create(EGLDisplay display,
+                                  EGLConfig config,
+                                  EGLContext shareContext,
+                                  int width,
+                                  int height,
+                                  bool hasEglImageTexture2d,
+                                  bool useFenceSync,
+                                  ColorBuffer::Helper* helper,
+                                  OnPostFn onPost,
+                                  void* onPostContext);
+
+    // Stop the worker thread and wait for it. Frames that have not been read
+    // yet are dropped.
+    virtual ~ReadbackWorker();
+
+    // Queue a copy of |cb| to be read back. Doesn't wait for the GPU nor
+    // for the worker thread. Must not be called concurrently.
+    void post(ColorBuffer* cb);
+
+    virtual intptr_t main();
+
+private:
+    ReadbackWorker(EGLDisplay display,
+                   int width,
+                   int height,
+                   bool useFenceSync,
+                   OnPostFn onPost,
+                   void* onPostContext);
+
+    // Destroy the fence of |slot|, if any. Call with the slot held.
+    void destroySync(int slot);
+
+    static const int kNumSlots = 3;
+
+    EGLDisplay m_display;
+    EGLContext m_context;
+    EGLSurface m_surface;
+    int m_width;
+    int m_height;
+    OnPostFn m_onPost;
+    void* m_onPostContext;
+    ReadbackQueue m_queue;
+    ColorBuffer* m_staging[kNumSlots];
+    // Framebuffer objects of |m_context|, one per staging buffer.
+    GLuint m_fbos[kNumSlots];
+    bool m_useFenceSync;
+    // Fences signaled when the copies to the staging buffers are complete,
+    // or EGL_NO_SYNC_KHR. Owned by whoever holds the slot.
+    EGLSyncKHR m_syncs[kNumSlots];
+    unsigned char* m_image;
+    bool m_started;
+};
+
+#endif  // _LIB_OPENGL_RENDER_READBACK_WORKER_H
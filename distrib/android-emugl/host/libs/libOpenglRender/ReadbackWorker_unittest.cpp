@@ -0,0 +1,346 @@
+// Copyright (C) 2015 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Include this before the EGL headers, which include X11 headers that define
+// None on Linux.
+#include <gtest/gtest.h>
+
+#include "ReadbackWorker.h"
+
+#include "EGLDispatch.h"
+#include "GLESv2Dispatch.h"
+#include "TextureDraw.h"
+
+#include "emugl/common/condition_variable.h"
+#include "emugl/common/mutex.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <vector>
+
+// These tests need a real GL implementation. They use the host's EGL and
+// GLES 2.0 libraries, as selected with ANDROID_EGL_LIB and
+// ANDROID_GLESv2_LIB. On Linux, they default to Mesa's, which renders with
+// llvmpipe when there is no GPU, on the surfaceless platform when there is
+// no X display. The tests are skipped when these libraries can't be loaded,
+// or don't provide GLES 2.0 pbuffer contexts.
+
+namespace {
+
+const int kWidth = 64;
+const int kHeight = 48;
+
+// The helper context, and a pbuffer to make it current, like the
+// FrameBuffer's ones.
+class TestHelper : public ColorBuffer::Helper {
+public:
+    TestHelper() :
+            mDisplay(EGL_NO_DISPLAY),
+            mConfig(NULL),
+            mContext(EGL_NO_CONTEXT),
+            mSurface(EGL_NO_SURFACE),
+            mTextureDraw(NULL),
+            mHasEglImageTexture2d(false),
+            mHasFenceSync(false) {}
+
+    // Load the GL libraries and create the context. Return false if the
+    // tests must be skipped.
+    bool init() {
+#ifdef __linux__
+        setenv("ANDROID_EGL_LIB", "libEGL.so.1", 0);
+        setenv("ANDROID_GLESv2_LIB", "libGLESv2.so.2", 0);
+        if (!getenv("DISPLAY")) {
+            setenv("EGL_PLATFORM", "surfaceless", 0);
+        }
+#else
+        if (!getenv("ANDROID_EGL_LIB") || !getenv("ANDROID_GLESv2_LIB")) {
+            return false;
+        }
+#endif
+        if (!init_egl_dispatch() || !init_gles2_dispatch()) {
+            return false;
+        }
+        mDisplay = s_egl.eglGetDisplay(EGL_DEFAULT_DISPLAY);
+        if (mDisplay == EGL_NO_DISPLAY ||
+            !s_egl.eglInitialize(mDisplay, NULL, NULL)) {
+            return false;
+        }
+        s_egl.eglBindAPI(EGL_OPENGL_ES_API);
+
+        static const EGLint configAttribs[] = {
+            EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
+            EGL_RENDERABLE_TYPE, EGL_OPENGL_ES2_BIT,
+            EGL_RED_SIZE, 8,
+            EGL_GREEN_SIZE, 8,
+            EGL_BLUE_SIZE, 8,
+            EGL_ALPHA_SIZE, 8,
+            EGL_NONE
+        };
+        EGLint numConfigs = 0;
+        if (!s_egl.eglChooseConfig(mDisplay, configAttribs, &mConfig, 1,
+                                   &numConfigs) || numConfigs == 0) {
+            return false;
+        }
+        static const EGLint contextAttribs[] = {
+            EGL_CONTEXT_CLIENT_VERSION, 2,
+            EGL_NONE
+        };
+        mContext = s_egl.eglCreateContext(mDisplay, mConfig, EGL_NO_CONTEXT,
+                                          contextAttribs);
+        static const EGLint pbufAttribs[] = {
+            EGL_WIDTH, 1,
+            EGL_HEIGHT, 1,
+            EGL_NONE
+        };
+        mSurface = s_egl.eglCreatePbufferSurface(mDisplay, mConfig,
+                                                 pbufAttribs);
+        if (mContext == EGL_NO_CONTEXT || mSurface == EGL_NO_SURFACE ||
+            !setupContext()) {
+            return false;
+        }
+        mTextureDraw = new TextureDraw(mDisplay);
+        teardownContext();
+
+        const char* extensions = s_egl.eglQueryString(mDisplay,
+                                                      EGL_EXTENSIONS);
+        mHasEglImageTexture2d =
+                strstr(extensions, "EGL_KHR_gl_texture_2D_image") &&
+                s_egl.eglCreateImageKHR && s_egl.eglDestroyImageKHR;
+        mHasFenceSync =
+                strstr(extensions, "EGL_KHR_fence_sync") &&
+                s_egl.eglCreateSyncKHR && s_egl.eglDestroySyncKHR &&
+                s_egl.eglClientWaitSyncKHR;
+        return true;
+    }
+
+    ~TestHelper() {
+        if (mTextureDraw && setupContext()) {
+            delete mTextureDraw;
+            teardownContext();
+        }
+        if (mSurface != EGL_NO_SURFACE) {
+            s_egl.eglDestroySurface(mDisplay, mSurface);
+        }
+        if (mContext != EGL_NO_CONTEXT) {
+            s_egl.eglDestroyContext(mDisplay, mContext);
+        }
+    }
+
+    virtual bool setupContext() {
+        return s_egl.eglMakeCurrent(mDisplay, mSurface, mSurface, mContext);
+    }
+
+    virtual void teardownContext() {
+        s_egl.eglMakeCurrent(mDisplay, EGL_NO_SURFACE, EGL_NO_SURFACE,
+                             EGL_NO_CONTEXT);
+    }
+
+    virtual TextureDraw* getTextureDraw() const { return mTextureDraw; }
+
+    EGLDisplay display() const { return mDisplay; }
+    EGLConfig config() const { return mConfig; }
+    EGLContext context() const { return mContext; }
+    bool hasEglImageTexture2d() const { return mHasEglImageTexture2d; }
+    bool hasFenceSync() const { return mHasFenceSync; }
+
+private:
+    EGLDisplay mDisplay;
+    EGLConfig mConfig;
+    EGLContext mContext;
+    EGLSurface mSurface;
+    TextureDraw* mTextureDraw;
+    bool mHasEglImageTexture2d;
+    bool mHasFenceSync;
+};
+
+// Collects the frames passed to the post callback.
+class FrameReceiver {
+public:
+    FrameReceiver() : mLock(), mCond(), mFrames() {}
+
+    static void onPost(void* context, int width, int height, int ydir,
+                       int format, int type, unsigned char* pixels) {
+        FrameReceiver* receiver = static_cast<FrameReceiver*>(context);
+        EXPECT_EQ(kWidth, width);
+        EXPECT_EQ(kHeight, height);
+        EXPECT_EQ(-1, ydir);
+        EXPECT_EQ(GL_RGBA, format);
+        EXPECT_EQ(GL_UNSIGNED_BYTE, type);
+        emugl::Mutex::AutoLock lock(receiver->mLock);
+        receiver->mFrames.push_back(
+                std::vector<unsigned char>(pixels,
+                                           pixels + 4 * width * height));
+        receiver->mCond.signal();
+    }
+
+    // Wait until |count| frames have been received, and return them.
+    std::vector<std::vector<unsigned char> > waitFrames(size_t count) {
+        emugl::Mutex::AutoLock lock(mLock);
+        while (mFrames.size() < count) {
+            mCond.wait(&mLock);
+        }
+        return mFrames;
+    }
+
+private:
+    emugl::Mutex mLock;
+    emugl::ConditionVariable mCond;
+    std::vector<std::vector<unsigned char> > mFrames;
+};
+
+// Fill |cb| with a pattern that depends on |frame|.
+void fillFrame(ColorBuffer* cb, int frame) {
+    std::vector<unsigned char> pixels(4 * kWidth * kHeight);
+    for (int y = 0; y < kHeight; ++y) {
+        for (int x = 0; x < kWidth; ++x) {
+            unsigned char* p = &pixels[4 * (y * kWidth + x)];
+            p[0] = (x * 4 + frame * 17) & 255;
+            p[1] = (y * 5 + frame * 31) & 255;
+            p[2] = ((x ^ y) + frame * 53) & 255;
+            p[3] = 255;
+        }
+    }
+    cb->subUpdate(0, 0, kWidth, kHeight, GL_RGBA, GL_UNSIGNED_BYTE,
+                  &pixels[0]);
+}
+
+// Post |numFrames| frames, waiting for each to be received, and check
+// that the worker delivers what the synchronous ColorBuffer::readback()
+// reads.
+void checkFrames(TestHelper* helper, bool useFenceSync, int numFrames) {
+    ColorBuffer* cb = ColorBuffer::create(helper->display(),
+                                          kWidth,
+                                          kHeight,
+                                          GL_RGBA,
+                                          helper->hasEglImageTexture2d(),
+                                          helper);
+    ASSERT_TRUE(cb != NULL);
+
+    FrameReceiver receiver;
+    ReadbackWorker* worker =
+            ReadbackWorker::create(helper->display(),
+                                   helper->config(),
+                                   helper->context(),
+                                   kWidth,
+                                   kHeight,
+                                   helper->hasEglImageTexture2d(),
+                                   useFenceSync,
+                                   helper,
+                                   &FrameReceiver::onPost,
+                                   &receiver);
+    ASSERT_TRUE(worker != NULL);
+
+    std::vector<unsigned char> expected(4 * kWidth * kHeight);
+    for (int frame = 0; frame < numFrames; ++frame) {
+        fillFrame(cb, frame);
+        worker->post(cb);
+        std::vector<std::vector<unsigned char> > frames =
+                receiver.waitFrames(frame + 1);
+        cb->readback(&expected[0]);
+        EXPECT_TRUE(frames[frame] == expected) << "frame " << frame;
+    }
+
+    delete worker;
+    delete cb;
+}
+
+class ReadbackWorkerTest : public ::testing::Test {
+protected:
+    virtual void SetUp() {
+        mHelper = new TestHelper();
+        if (!mHelper->init()) {
+            delete mHelper;
+            mHelper = NULL;
+            printf("Skipped: no usable EGL and GLES 2.0 libraries\n");
+        }
+    }
+
+    virtual void TearDown() {
+        delete mHelper;
+    }
+
+    TestHelper* mHelper;
+};
+
+}  // namespace
+
+TEST_F(ReadbackWorkerTest, DeliversPostedFrames) {
+    if (!mHelper) {
+        return;
+    }
+    checkFrames(mHelper, false, 5);
+}
+
+TEST_F(ReadbackWorkerTest, DeliversPostedFramesWithFenceSync) {
+    if (!mHelper) {
+        return;
+    }
+    if (!mHelper->hasFenceSync()) {
+        printf("Skipped: EGL_KHR_fence_sync is not supported\n");
+        return;
+    }
+    checkFrames(mHelper, true, 5);
+}
+
+TEST_F(ReadbackWorkerTest, DropsFramesWithoutBlocking) {
+    if (!mHelper) {
+        return;
+    }
+    ColorBuffer* cb = ColorBuffer::create(mHelper->display(),
+                                          kWidth,
+                                          kHeight,
+                                          GL_RGBA,
+                                          mHelper->hasEglImageTexture2d(),
+                                          mHelper);
+    ASSERT_TRUE(cb != NULL);
+
+    FrameReceiver receiver;
+    ReadbackWorker* worker =
+            ReadbackWorker::create(mHelper->display(),
+                                   mHelper->config(),
+                                   mHelper->context(),
+                                   kWidth,
+                                   kHeight,
+                                   mHelper->hasEglImageTexture2d(),
+                                   mHelper->hasFenceSync(),
+                                   mHelper,
+                                   &FrameReceiver::onPost,
+                                   &receiver);
+    ASSERT_TRUE(worker != NULL);
+
+    // Post faster than frames are read back. The last frame is always
+    // delivered.
+    const int kNumFrames = 20;
+    for (int frame = 0; frame < kNumFrames; ++frame) {
+        fillFrame(cb, frame);
+        worker->post(cb);
+    }
+    std::vector<unsigned char> expected(4 * kWidth * kHeight);
+    cb->readback(&expected[0]);
+    size_t count = 1;
+    for (;;) {
+        std::vector<std::vector<unsigned char> > frames =
+                receiver.waitFrames(count);
+        if (frames.back() == expected) {
+            break;
+        }
+        ASSERT_LT(frames.size(), static_cast<size_t>(kNumFrames));
+        count = frames.size() + 1;
+    }
+
+    delete worker;
+    delete cb;
+}
@@ -0,0 +1,323 @@
+/*
+* Copyright (C) 2015 The Android Open Source Project
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+#include "RenderChannel.h"
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+#ifdef __linux__
+#include <sys/eventfd.h>
+#endif
+
+// The two sides of a channel synchronize with a flag in one direction, and a
+// ring position in the other. A full barrier between the store of one and the
+// load of the other makes sure that at least one side sees the other's
+// update, so that no wake-up is lost.
+#define FULL_BARRIER()  __atomic_thread_fence(__ATOMIC_SEQ_CST)
+
+namespace {
+
+#if !defined(_WIN32) && !defined(__linux__)
+bool setNonBlocking(int fd) {
+    int flags = fcntl(fd, F_GETFL);
+    return flags >= 0 && fcntl(fd, F_SETFL, flags | O_NONBLOCK) == 0;
+}
+#endif
+
+}  // namespace
+
+// static
+RenderChannel* RenderChannel::create(size_t toHostSize, size_t toGuestSize) {
+#ifdef _WIN32
+    // In-process channels aren't supported on Windows, where the emulator
+    // keeps using the socket transport.
+    (void)toHostSize;
+    (void)toGuestSize;
+    return NULL;
+#else
+    RenderChannel* channel = new RenderChannel(toHostSize, toGuestSize);
+    if (!channel->m_toHost.isValid() || !channel->m_toGuest.isValid()) {
+        ERR("%s: could not allocate %zu + %zu bytes\n", __FUNCTION__,
+            toHostSize, toGuestSize);
+        channel->unref();
+        channel->unref();
+        return NULL;
+    }
+#ifdef __linux__
+    int fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    channel->m_notifyFds[0] = channel->m_notifyFds[1] = fd;
+    if (fd < 0) {
+        ERR("%s: eventfd() failed: %s\n", __FUNCTION__, strerror(errno));
+        channel->unref();
+        channel->unref();
+        return NULL;
+    }
+#else
+    if (pipe(channel->m_notifyFds) < 0 ||
+        !setNonBlocking(channel->m_notifyFds[0]) ||
+        !setNonBlocking(channel->m_notifyFds[1])) {
+        ERR("%s: pipe() failed: %s\n", __FUNCTION__, strerror(errno));
+        channel->unref();
+        channel->unref();
+        return NULL;
+    }
+#endif
+    return channel;
+#endif  // !_WIN32
+}
+
+RenderChannel::RenderChannel(size_t toHostSize, size_t toGuestSize) :
+        m_toHost(toHostSize),
+        m_toGuest(toGuestSize),
+        m_lock(),
+        m_cond(),
+        m_hostWaiting(0),
+        m_guestWanted(0),
+        m_closed(0),
+        m_refCount(2) {
+    m_notifyFds[0] = m_notifyFds[1] = -1;
+}
+
+RenderChannel::~RenderChannel() {
+#ifndef _WIN32
+    if (m_notifyFds[0] >= 0) {
+        ::close(m_notifyFds[0]);
+    }
+    if (m_notifyFds[1] >= 0 && m_notifyFds[1] != m_notifyFds[0]) {
+        ::close(m_notifyFds[1]);
+    }
+#endif
+}
+
+void RenderChannel::unref() {
+    if (__atomic_sub_fetch(&m_refCount, 1, __ATOMIC_ACQ_REL) == 0) {
+        delete this;
+    }
+}
+
+bool RenderChannel::isClosed() const {
+    return __atomic_load_n(&m_closed, __ATOMIC_ACQUIRE) != 0;
+}
+
+void RenderChannel::close() {
+    __atomic_store_n(&m_closed, 1, __ATOMIC_SEQ_CST);
+    // Both sides must find out, whatever they are waiting for.
+    {
+        emugl::Mutex::AutoLock lock(m_lock);
+        m_cond.signal();
+    }
+    notifyGuest(kCanRead | kCanWrite | kClosed);
+}
+
+void RenderChannel::notifyGuest(unsigned events) {
+    if (!(__atomic_load_n(&m_guestWanted, __ATOMIC_SEQ_CST) & events)) {
+        return;
+    }
+    // Only signal once per request.
+    if (!(__atomic_fetch_and(&m_guestWanted, ~events, __ATOMIC_SEQ_CST) &
+          events)) {
+        return;
+    }
+#ifndef _WIN32
+    const uint64_t value = 1;
+    ssize_t ret;
+    do {
+        ret = ::write(m_notifyFds[1], &value, sizeof(value));
+    } while (ret < 0 && errno == EINTR);
+    // EAGAIN means that a notification is already pending.
+#endif
+}
+
+void RenderChannel::wakeHost() {
+    FULL_BARRIER();
+    if (__atomic_load_n(&m_hostWaiting, __ATOMIC_SEQ_CST)) {
+        emugl::Mutex::AutoLock lock(m_lock);
+        m_cond.signal();
+    }
+}
+
+void RenderChannel::waitForGuest(bool forWrite) {
+    emugl::Mutex::AutoLock lock(m_lock);
+    __atomic_store_n(&m_hostWaiting, 1, __ATOMIC_SEQ_CST);
+    FULL_BARRIER();
+    while (!isClosed() && (forWrite ? m_toGuest.writableBytes() == 0
+                                    : m_toHost.readableBytes() == 0)) {
+        m_cond.wait(&m_lock);
+    }
+    __atomic_store_n(&m_hostWaiting, 0, __ATOMIC_SEQ_CST);
+}
+
+int RenderChannel::send(const RenderChannelBuffer* buffers, int numBuffers) {
+    if (isClosed()) {
+        return -1;
+    }
+    size_t total = 0;
+    for (int n = 0; n < numBuffers; ++n) {
+        size_t count = m_toHost.write(buffers[n].data, buffers[n].size);
+        total += count;
+        if (count < buffers[n].size) {
+            break;
+        }
+    }
+    if (total) {
+        wakeHost();
+    }
+    return static_cast<int>(total);
+}
+
+int RenderChannel::recv(RenderChannelBuffer* buffers, int numBuffers) {
+    size_t total = 0;
+    for (int n = 0; n < numBuffers; ++n) {
+        size_t count = m_toGuest.read(buffers[n].data, buffers[n].size);
+        total += count;
+        if (count < buffers[n].size) {
+            break;
+        }
+    }
+    if (total) {
+        wakeHost();
+        return static_cast<int>(total);
+    }
+    return isClosed() ? -1 : 0;
+}
+
+unsigned RenderChannel::poll(unsigned wanted) {
+    if (wanted) {
+        __atomic_fetch_or(&m_guestWanted, wanted, __ATOMIC_SEQ_CST);
+        FULL_BARRIER();
+    }
+    unsigned state = 0;
+    if (m_toGuest.readableBytes() > 0) {
+        state |= kCanRead;
+    }
+    if (m_toHost.writableBytes() > 0) {
+        state |= kCanWrite;
+    }
+    if (isClosed()) {
+        state |= kClosed;
+    }
+    if (state & wanted) {
+        notifyGuest(state & wanted);
+    }
+    return state;
+}
+
+size_t RenderChannel::read(void* buf, size_t len) {
+    for (;;) {
+        size_t count = m_toHost.read(buf, len);
+        if (count) {
+            FULL_BARRIER();
+            notifyGuest(kCanWrite);
+            return count;
+        }
+        if (isClosed()) {
+            return 0;
+        }
+        waitForGuest(false);
+    }
+}
+
+bool RenderChannel::write(const void* buf, size_t len) {
+    const uint8_t* data = static_cast<const uint8_t*>(buf);
+    while (len > 0) {
+        if (isClosed()) {
+            return false;
+        }
+        size_t count = m_toGuest.write(data, len);
+        if (count) {
+            FULL_BARRIER();
+            notifyGuest(kCanRead);
+            data += count;
+            len -= count;
+        } else {
+            waitForGuest(true);
+        }
+    }
+    return true;
+}
+
+RenderChannelStream::RenderChannelStream(RenderChannel* channel,
+                                         size_t bufSize) :
+        IOStream(bufSize),
+        m_channel(channel),
+        m_bufsize(bufSize),
+        m_buf(NULL) {}
+
+RenderChannelStream::~RenderChannelStream() {
+    m_channel->close();
+    m_channel->unref();
+    free(m_buf);
+}
+
+void *RenderChannelStream::allocBuffer(size_t minSize) {
+    size_t allocSize = (m_bufsize < minSize ? minSize : m_bufsize);
+    if (!m_buf || m_bufsize < allocSize) {
+        unsigned char* p = (unsigned char*)realloc(m_buf, allocSize);
+        if (!p) {
+            ERR("%s: realloc (%zu) failed\n", __FUNCTION__, allocSize);
+            return NULL;
+        }
+        m_buf = p;
+        m_bufsize = allocSize;
+    }
+    return m_buf;
+}
+
+int RenderChannelStream::commitBuffer(size_t size) {
+    return writeFully(m_buf, size);
+}
+
+const unsigned char *RenderChannelStream::readFully(void *buf, size_t len) {
+    if (!buf) {
+        return NULL;
+    }
+    unsigned char* dst = static_cast<unsigned char*>(buf);
+    size_t done = 0;
+    while (done < len) {
+        size_t count = m_channel->read(dst + done, len - done);
+        if (!count) {
+            return NULL;
+        }
+        done += count;
+    }
+    return dst;
+}
+
+const unsigned char *RenderChannelStream::read(void *buf, size_t *inout_len) {
+    if (!buf || !inout_len) {
+        return NULL;
+    }
+    size_t count = m_channel->read(buf, *inout_len);
+    if (!count) {
+        return NULL;
+    }
+    *inout_len = count;
+    return static_cast<const unsigned char*>(buf);
+}
+
+int RenderChannelStream::writeFully(const void *buf, size_t len) {
+    return m_channel->write(buf, len) ? 0 : -1;
+}
+
+void RenderChannelStream::forceStop() {
+    m_channel->close();
+}
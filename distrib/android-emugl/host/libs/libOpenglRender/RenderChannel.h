@@ -0,0 +1,126 @@
+/*
+* Copyright (C) 2015 The Android Open Source Project
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+#ifndef _LIB_OPENGL_RENDER_RENDER_CHANNEL_H
+#define _LIB_OPENGL_RENDER_RENDER_CHANNEL_H
+
+#include "IOStream.h"
+#include "render_api.h"
+
+#include "emugl/common/condition_variable.h"
+#include "emugl/common/mutex.h"
+#include "emugl/common/ring_buffer.h"
+
+// An in-process replacement for the socket between the OpenGLES pipe device
+// and a RenderThread.
+//
+// The channel holds two rings: one carrying the guest's command stream to the
+// render thread, and one carrying replies back. The guest side (the pipe
+// device) never blocks, and is notified through a file descriptor that can be
+// watched by the emulator's main loop. The host side (the render thread)
+// blocks on a condition variable when a ring is empty or full, but the guest
+// side only takes the lock to wake it up when it is actually waiting.
+//
+// The channel is reference-counted: it is created with one reference for each
+// side, and each side releases its reference after calling close().
+class RenderChannel {
+public:
+    // State flags, see renderChannelPoll().
+    enum {
+        kCanRead = RENDER_CHANNEL_CAN_READ,
+        kCanWrite = RENDER_CHANNEL_CAN_WRITE,
+        kClosed = RENDER_CHANNEL_CLOSED,
+    };
+
+    // Create a new channel. |toHostSize| and |toGuestSize| are the sizes of
+    // the two rings. Return NULL on failure, or if the host doesn't support
+    // channels.
+    static RenderChannel* create(size_t toHostSize, size_t toGuestSize);
+
+    // Release a reference. The channel is deleted with its last reference.
+    void unref();
+
+    // Guest side, see renderChannelXXX() in render_api.entries.
+    int notifyFd() const { return m_notifyFds[0]; }
+    int send(const RenderChannelBuffer* buffers, int numBuffers);
+    int recv(RenderChannelBuffer* buffers, int numBuffers);
+    unsigned poll(unsigned wanted);
+
+    // Host side: read up to |len| bytes into |buf|, blocking until at least
+    // one byte is available. Return the number of bytes read, or 0 if the
+    // channel is closed and there is nothing left to read.
+    size_t read(void* buf, size_t len);
+
+    // Host side: write |len| bytes from |buf|, blocking while the ring is
+    // full. Return false if the channel is closed.
+    bool write(const void* buf, size_t len);
+
+    // Close the channel. Can be called from any side. The host side can still
+    // read the data that was sent before, but nothing can be written anymore.
+    void close();
+
+    bool isClosed() const;
+
+private:
+    RenderChannel(size_t toHostSize, size_t toGuestSize);
+    ~RenderChannel();
+
+    // Signal the notify file descriptor if the guest side waits for any of
+    // the |events|.
+    void notifyGuest(unsigned events);
+
+    // Wake up the host side if it is blocked.
+    void wakeHost();
+
+    // Block the host side until there is something to read, or until there
+    // is room to write if |forWrite| is true, or until the channel is closed.
+    void waitForGuest(bool forWrite);
+
+    emugl::RingBuffer m_toHost;
+    emugl::RingBuffer m_toGuest;
+    emugl::Mutex m_lock;
+    emugl::ConditionVariable m_cond;
+    // All fields below are accessed with atomic operations.
+    int m_hostWaiting;
+    unsigned m_guestWanted;
+    int m_closed;
+    int m_refCount;
+    // Read and write ends of the notification pipe. They are the same
+    // eventfd on Linux.
+    int m_notifyFds[2];
+};
+
+// An IOStream used by a RenderThread to serve a RenderChannel.
+class RenderChannelStream : public IOStream {
+public:
+    // Constructor. Takes ownership of a reference to |channel|.
+    explicit RenderChannelStream(RenderChannel* channel,
+                                 size_t bufSize = 10000);
+    virtual ~RenderChannelStream();
+
+    virtual void *allocBuffer(size_t minSize);
+    virtual int commitBuffer(size_t size);
+    virtual const unsigned char *readFully(void *buf, size_t len);
+    virtual const unsigned char *read(void *buf, size_t *inout_len);
+    virtual int writeFully(const void *buf, size_t len);
+    virtual void forceStop();
+
+private:
+    RenderChannel* m_channel;
+    size_t m_bufsize;
+    unsigned char* m_buf;
+};
+
+#endif
@@ -0,0 +1,374 @@
+// Copyright (C) 2015 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Must come before RenderChannel.h, because <X11/Xlib.h> defines 'None'.
+#include <gtest/gtest.h>
+
+#include "RenderChannel.h"
+
+#include "ReadBuffer.h"
+#include "UnixStream.h"
+
+#include "emugl/common/testing/test_thread.h"
+
+#ifndef _WIN32
+
+#include <poll.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include <vector>
+
+namespace {
+
+using emugl::TestThread;
+
+const size_t kToHostSize = 4096;
+const size_t kToGuestSize = 1024;
+
+// Wait up to |timeoutMs| for the notify fd of |channel| to be signaled, and
+// drain it. Return true if it was signaled.
+bool waitNotify(RenderChannel* channel, int timeoutMs) {
+    struct pollfd fds;
+    fds.fd = channel->notifyFd();
+    fds.events = POLLIN;
+    fds.revents = 0;
+    if (::poll(&fds, 1, timeoutMs) != 1) {
+        return false;
+    }
+    uint64_t value;
+    while (::read(fds.fd, &value, sizeof(value)) > 0) {
+    }
+    return true;
+}
+
+// Send all of |size| bytes from the guest side, waiting for room when the
+// channel is full. Return false if the channel is closed.
+bool guestSendAll(RenderChannel* channel, const void* data, size_t size) {
+    const unsigned char* ptr = static_cast<const unsigned char*>(data);
+    while (size > 0) {
+        RenderChannelBuffer buffer = { const_cast<unsigned char*>(ptr), size };
+        int ret = channel->send(&buffer, 1);
+        if (ret < 0) {
+            return false;
+        }
+        if (ret == 0) {
+            if (!(channel->poll(RenderChannel::kCanWrite) &
+                  RenderChannel::kCanWrite)) {
+                waitNotify(channel, 1000);
+            }
+            continue;
+        }
+        ptr += ret;
+        size -= ret;
+    }
+    return true;
+}
+
+struct HostWriter {
+    RenderChannelStream* stream;
+    std::vector<unsigned char> data;
+    int result;
+};
+
+void* hostWriterFunction(void* param) {
+    HostWriter* writer = static_cast<HostWriter*>(param);
+    writer->result = writer->stream->writeFully(&writer->data[0],
+                                                writer->data.size());
+    return NULL;
+}
+
+struct HostReader {
+    RenderChannelStream* stream;
+    size_t size;
+    bool ok;
+};
+
+void* hostReaderFunction(void* param) {
+    HostReader* reader = static_cast<HostReader*>(param);
+    std::vector<unsigned char> buf(reader->size);
+    reader->ok = reader->stream->readFully(&buf[0], buf.size()) != NULL;
+    return NULL;
+}
+
+}  // namespace
+
+TEST(RenderChannel, GuestToHost) {
+    RenderChannel* channel = RenderChannel::create(kToHostSize, kToGuestSize);
+    ASSERT_TRUE(channel);
+    RenderChannelStream stream(channel);
+
+    unsigned char data[] = "hello renderer";
+    RenderChannelBuffer buffers[2] = {
+        { data, 6 },
+        { data + 6, sizeof(data) - 6 },
+    };
+    EXPECT_EQ((int)sizeof(data), channel->send(buffers, 2));
+
+    char buf[sizeof(data)];
+    ASSERT_TRUE(stream.readFully(buf, sizeof(buf)));
+    EXPECT_STREQ("hello renderer", buf);
+
+    channel->close();
+    channel->unref();
+}
+
+TEST(RenderChannel, SendReturnsZeroWhenFull) {
+    RenderChannel* channel = RenderChannel::create(kToHostSize, kToGuestSize);
+    ASSERT_TRUE(channel);
+    RenderChannelStream stream(channel);
+
+    std::vector<unsigned char> data(kToHostSize + 100);
+    RenderChannelBuffer buffer = { &data[0], data.size() };
+    EXPECT_EQ((int)kToHostSize, channel->send(&buffer, 1));
+    EXPECT_EQ(0, channel->send(&buffer, 1));
+    EXPECT_FALSE(channel->poll(0) & RenderChannel::kCanWrite);
+
+    // Reading on the host side notifies the guest that it can write again.
+    EXPECT_FALSE(channel->poll(RenderChannel::kCanWrite) &
+                 RenderChannel::kCanWrite);
+    char buf[100];
+    size_t len = sizeof(buf);
+    ASSERT_TRUE(stream.read(buf, &len));
+    EXPECT_TRUE(waitNotify(channel, 1000));
+    EXPECT_TRUE(channel->poll(0) & RenderChannel::kCanWrite);
+
+    channel->close();
+    channel->unref();
+}
+
+TEST(RenderChannel, HostToGuestLargerThanRing) {
+    RenderChannel* channel = RenderChannel::create(kToHostSize, kToGuestSize);
+    ASSERT_TRUE(channel);
+    HostWriter writer;
+    writer.stream = new RenderChannelStream(channel);
+    writer.data.resize(kToGuestSize * 10 + 17);
+    for (size_t n = 0; n < writer.data.size(); ++n) {
+        writer.data[n] = (unsigned char)(n * 13);
+    }
+    writer.result = -1;
+    TestThread* thread = new TestThread(hostWriterFunction, &writer);
+
+    std::vector<unsigned char> received;
+    while (received.size() < writer.data.size()) {
+        unsigned char buf[300];
+        RenderChannelBuffer buffer = { buf, sizeof(buf) };
+        int ret = channel->recv(&buffer, 1);
+        ASSERT_GE(ret, 0);
+        if (ret == 0) {
+            if (!(channel->poll(RenderChannel::kCanRead) &
+                  RenderChannel::kCanRead)) {
+                ASSERT_TRUE(waitNotify(channel, 1000));
+            }
+            continue;
+        }
+        received.insert(received.end(), buf, buf + ret);
+    }
+    thread->join();
+    delete thread;
+
+    EXPECT_EQ(0, writer.result);
+    EXPECT_TRUE(received == writer.data);
+
+    delete writer.stream;
+    channel->close();
+    channel->unref();
+}
+
+TEST(RenderChannel, GuestCloseStopsHostRead) {
+    RenderChannel* channel = RenderChannel::create(kToHostSize, kToGuestSize);
+    ASSERT_TRUE(channel);
+    HostReader reader;
+    reader.stream = new RenderChannelStream(channel);
+    reader.size = 100;
+    reader.ok = true;
+    TestThread* thread = new TestThread(hostReaderFunction, &reader);
+
+    unsigned char data[10] = {};
+    RenderChannelBuffer buffer = { data, sizeof(data) };
+    EXPECT_EQ(10, channel->send(&buffer, 1));
+    channel->close();
+    channel->unref();
+
+    thread->join();
+    delete thread;
+    EXPECT_FALSE(reader.ok);
+    delete reader.stream;
+}
+
+TEST(RenderChannel, HostCloseNotifiesGuest) {
+    RenderChannel* channel = RenderChannel::create(kToHostSize, kToGuestSize);
+    ASSERT_TRUE(channel);
+    RenderChannelStream* stream = new RenderChannelStream(channel);
+
+    EXPECT_FALSE(channel->poll(RenderChannel::kCanRead) &
+                 RenderChannel::kClosed);
+    delete stream;
+
+    EXPECT_TRUE(waitNotify(channel, 1000));
+    EXPECT_TRUE(channel->poll(0) & RenderChannel::kClosed);
+    unsigned char data[10];
+    RenderChannelBuffer buffer = { data, sizeof(data) };
+    EXPECT_EQ(-1, channel->send(&buffer, 1));
+    EXPECT_EQ(-1, channel->recv(&buffer, 1));
+
+    channel->close();
+    channel->unref();
+}
+
+// Replays a GL command stream, as recorded by RenderThread in the file
+// named by RENDERER_REPLAY_FILE (see RENDERER_DUMP_DIR), or a synthetic one,
+// through a RenderChannel and through a UNIX socket. The host side uses a
+// ReadBuffer and a stub dispatch that only walks the commands, so this only
+// measures the transport.
+namespace {
+
+const size_t kGuestChunkSize = 4096;  // One guest page per pipe buffer.
+
+std::vector<unsigned char> loadReplayStream() {
+    std::vector<unsigned char> data;
+    const char* path = getenv("RENDERER_REPLAY_FILE");
+    if (path) {
+        FILE* file = fopen(path, "rb");
+        if (file) {
+            unsigned char buf[65536];
+            size_t count;
+            while ((count = fread(buf, 1, sizeof(buf), file)) > 0) {
+                data.insert(data.end(), buf, buf + count);
+            }
+            fclose(file);
+            return data;
+        }
+        fprintf(stderr, "Could not open %s, using a synthetic stream\n", path);
+    }
+    // Mostly small commands, some vertex data, and a few texture uploads.
+    srand(1);
+    while (data.size() < 64 * 1024 * 1024) {
+        int r = rand() % 100;
+        uint32_t size = r < 70 ? 8 + (rand() % 14) * 4 :
+                        r < 98 ? 256 + (rand() % 192) * 4 :
+                                 64 * 1024;
+        uint32_t header[2] = { (uint32_t)(1024 + rand() % 400), size };
+        data.insert(data.end(), (unsigned char*)header,
+                    (unsigned char*)(header + 2));
+        data.resize(data.size() + size - sizeof(header), (unsigned char)r);
+    }
+    return data;
+}
+
+// Walks the commands available in |buf|, like the generated decoders do.
+// Return the number of bytes consumed.
+size_t stubDecode(const unsigned char* buf, size_t len, size_t* commands) {
+    size_t pos = 0;
+    while (len - pos >= 8) {
+        uint32_t size;
+        memcpy(&size, buf + pos + 4, sizeof(size));
+        if (size < 8 || size > len - pos) {
+            break;
+        }
+        pos += size;
+        (*commands)++;
+    }
+    return pos;
+}
+
+struct ReplayHost {
+    IOStream* stream;
+    size_t bytes;
+    size_t commands;
+};
+
+void* replayHostFunction(void* param) {
+    ReplayHost* host = static_cast<ReplayHost*>(param);
+    ReadBuffer readBuf(host->stream, 4 * 1024 * 1024);
+    while (readBuf.getData() > 0) {
+        size_t last = stubDecode(readBuf.buf(), readBuf.validData(),
+                                 &host->commands);
+        host->bytes += last;
+        readBuf.consume(last);
+    }
+    return NULL;
+}
+
+double nowMs() {
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec * 1e3 + tv.tv_usec / 1e3;
+}
+
+}  // namespace
+
+TEST(RenderChannel, DISABLED_ReplayBenchmark) {
+    std::vector<unsigned char> data = loadReplayStream();
+    ASSERT_FALSE(data.empty());
+
+    // In-process channel, fed in pipe-buffer sized chunks.
+    RenderChannel* channel = RenderChannel::create(1024 * 1024, 256 * 1024);
+    ASSERT_TRUE(channel);
+    ReplayHost host = { new RenderChannelStream(channel), 0, 0 };
+    TestThread* thread = new TestThread(replayHostFunction, &host);
+    double t0 = nowMs();
+    for (size_t pos = 0; pos < data.size(); pos += kGuestChunkSize) {
+        size_t size = data.size() - pos;
+        if (size > kGuestChunkSize) {
+            size = kGuestChunkSize;
+        }
+        ASSERT_TRUE(guestSendAll(channel, &data[pos], size));
+    }
+    channel->close();
+    thread->join();
+    double channelMs = nowMs() - t0;
+    delete thread;
+    delete host.stream;
+    channel->unref();
+    EXPECT_EQ(data.size(), host.bytes);
+    size_t commands = host.commands;
+
+    // UNIX socket, as used by the pipe device without channels.
+    UnixStream server;
+    char addr[SocketStream::MAX_ADDRSTR_LEN];
+    ASSERT_EQ(0, server.listen(addr));
+    UnixStream client;
+    ASSERT_EQ(0, client.connect(addr));
+    ReplayHost socketHost = { server.accept(), 0, 0 };
+    ASSERT_TRUE(socketHost.stream);
+    thread = new TestThread(replayHostFunction, &socketHost);
+    t0 = nowMs();
+    for (size_t pos = 0; pos < data.size(); pos += kGuestChunkSize) {
+        size_t size = data.size() - pos;
+        if (size > kGuestChunkSize) {
+            size = kGuestChunkSize;
+        }
+        ASSERT_EQ(0, client.writeFully(&data[pos], size));
+    }
+    client.forceStop();
+    thread->join();
+    double socketMs = nowMs() - t0;
+    delete thread;
+    delete socketHost.stream;
+    EXPECT_EQ(data.size(), socketHost.bytes);
+
+    double mb = data.size() / (1024.0 * 1024.0);
+    printf("Replayed %.1f MB, %zu commands\n", mb, commands);
+    printf("  channel: %8.1f ms  %8.1f MB/s\n", channelMs,
+           mb * 1000. / channelMs);
+    printf("  socket:  %8.1f ms  %8.1f MB/s\n", socketMs,
+           mb * 1000. / socketMs);
+}
+
+#endif  // !_WIN32
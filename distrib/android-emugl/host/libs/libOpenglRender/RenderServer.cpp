@@ -15,6 +15,7 @@
 */
 #include "RenderServer.h"
 
+#include "RenderChannel.h"
 #include "RenderThread.h"
 #include "render_api.h"
 #include "TcpStream.h"
@@ -27,16 +28,29 @@
 #include "Win32PipeStream.h"
 #endif
 
-#include <set>
-
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
-typedef std::set<RenderThread *> RenderThreadsSet;
+// Sizes of the rings of in-process channels. Guest command buffers are
+// streamed through the first one, and can be much larger than replies.
+#define CHANNEL_TO_HOST_SIZE   (1024 * 1024)
+#define CHANNEL_TO_GUEST_SIZE  (256 * 1024)
+
+// Initial size of the buffer that each render thread reads its stream into.
+#define STREAM_BUFFER_SIZE (4 * 1024 * 1024)
+
+// Number of render threads kept, with their stream buffer, while no guest
+// connection needs them. A guest usually has a few long-lived connections,
+// e.g. SurfaceFlinger's, and opens short-lived ones for each app process.
+#define MAX_IDLE_RENDER_THREADS 4
 
 RenderServer::RenderServer() :
-    m_lock(),
     m_listenSock(NULL),
-    m_exiting(false)
+    m_exiting(false),
+    m_threadPool(RenderThread::serveStream,
+                 MAX_IDLE_RENDER_THREADS,
+                 STREAM_BUFFER_SIZE)
 {
 }
 
@@ -86,8 +100,6 @@ RenderServer *RenderServer::create(char* addr, size_t addrLen)
 
 intptr_t RenderServer::main()
 {
-    RenderThreadsSet threads;
-
 #ifndef _WIN32
     sigset_t set;
     sigfillset(&set);
@@ -117,57 +129,54 @@ intptr_t RenderServer::main()
             break;
         }
 
-        RenderThread *rt = RenderThread::create(stream, &m_lock);
-        if (!rt) {
-            fprintf(stderr,"Failed to create RenderThread\n");
-            delete stream;
-        } else if (!rt->start()) {
+        if (!m_threadPool.serve(stream, false)) {
             fprintf(stderr,"Failed to start RenderThread\n");
-            delete rt;
             delete stream;
         }
-
-        //
-        // remove from the threads list threads which are
-        // no longer running
-        //
-        for (RenderThreadsSet::iterator n,t = threads.begin();
-             t != threads.end();
-             t = n) {
-            // first find next iterator
-            n = t;
-            n++;
-
-            // delete and erase the current iterator
-            // if thread is no longer running
-            if ((*t)->isFinished()) {
-                delete (*t);
-                threads.erase(t);
-            }
-        }
-
-        // if the thread has been created and started, insert it to the list
-        if (rt) {
-            threads.insert(rt);
-            DBG("Started new RenderThread\n");
-        }
     }
 
     //
-    // Wait for all threads to finish
+    // Stop all the streams, including the in-process channels, and wait
+    // for their threads to finish
     //
-    for (RenderThreadsSet::iterator t = threads.begin();
-         t != threads.end();
-         t++) {
-#ifndef _WIN32
-        // Note: temporarily disable following steps so emulator does not
-        // freeze on windows when it is shut down, will fix in 1.2
-        (*t)->forceStop();
-        (*t)->wait(NULL);
-#endif
-        delete (*t);
+    m_threadPool.stop();
+
+    //
+    // output render thread statistics
+    //
+    if (getenv("SHOW_RENDER_THREAD_STATS") != NULL) {
+        RenderThreadPool::Stats stats = m_threadPool.stats();
+        printf("RenderServer: %u streams served by %u threads, "
+               "setup time %llu us on average, %llu us max\n",
+               stats.streams, stats.threadsCreated,
+               stats.streams ? (unsigned long long)(stats.totalSetupUs /
+                                                    stats.streams) : 0ULL,
+               (unsigned long long)stats.maxSetupUs);
     }
-    threads.clear();
 
     return 0;
 }
+
+RenderChannel *RenderServer::openChannel()
+{
+    if (m_exiting) {
+        return NULL;
+    }
+
+    RenderChannel *channel = RenderChannel::create(CHANNEL_TO_HOST_SIZE,
+                                                   CHANNEL_TO_GUEST_SIZE);
+    if (!channel) {
+        return NULL;
+    }
+
+    // The stream owns the host side's reference to the channel.
+    RenderChannelStream *stream = new RenderChannelStream(channel);
+    if (!m_threadPool.serve(stream, true)) {
+        ERR("Failed to start RenderThread for channel\n");
+        delete stream;
+        channel->unref();
+        return NULL;
+    }
+    DBG("Started serving new channel\n");
+    return channel;
+}
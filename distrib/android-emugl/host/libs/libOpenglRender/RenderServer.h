@@ -16,10 +16,12 @@
 #ifndef _LIB_OPENGL_RENDER_RENDER_SERVER_H
 #define _LIB_OPENGL_RENDER_RENDER_SERVER_H
 
+#include "RenderThreadPool.h"
 #include "SocketStream.h"
-#include "emugl/common/mutex.h"
 #include "emugl/common/thread.h"
 
+class RenderChannel;
+
 class RenderServer : public emugl::Thread
 {
 public:
@@ -30,13 +32,23 @@ public:
 
     bool isExiting() const { return m_exiting; }
 
+    // Create an in-process channel, and serve it on a render thread.
+    // Return NULL on failure. The caller owns a reference to the channel.
+    RenderChannel* openChannel();
+
+    // Statistics of the render threads, e.g. connection setup times.
+    RenderThreadPool::Stats threadStats() const {
+        return m_threadPool.stats();
+    }
+
 private:
     RenderServer();
 
 private:
-    emugl::Mutex m_lock;
     SocketStream *m_listenSock;
     bool m_exiting;
+    // Serves both socket connections and in-process channels.
+    RenderThreadPool m_threadPool;
 };
 
 #endif
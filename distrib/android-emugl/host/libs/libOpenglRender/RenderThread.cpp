@@ -24,27 +24,17 @@
 #include "RenderThreadInfo.h"
 #include "TimeUtils.h"
 
-#define STREAM_BUFFER_SIZE 4*1024*1024
-
-RenderThread::RenderThread(IOStream *stream, emugl::Mutex *lock) :
-        emugl::Thread(),
-        m_lock(lock),
-        m_stream(stream) {}
-
-RenderThread::~RenderThread() {
-    delete m_stream;
-}
-
 // static
-RenderThread* RenderThread::create(IOStream *stream, emugl::Mutex *lock) {
-    return new RenderThread(stream, lock);
-}
-
-void RenderThread::forceStop() {
-    m_stream->forceStop();
-}
+void RenderThread::serveStream(IOStream* stream,
+                               bool readClientFlags,
+                               ReadBuffer* readBuf) {
+    if (readClientFlags) {
+        unsigned int clientFlags;
+        if (!stream->readFully(&clientFlags, sizeof(clientFlags))) {
+            return;
+        }
+    }
 
-intptr_t RenderThread::main() {
     RenderThreadInfo tInfo;
 
     //
@@ -54,20 +44,19 @@ intptr_t RenderThread::main() {
     tInfo.m_gl2Dec.initGL(gles2_dispatch_get_proc_func, NULL);
     initRenderControlContext(&tInfo.m_rcDec);
 
-    ReadBuffer readBuf(m_stream, STREAM_BUFFER_SIZE);
-
     int stats_totalBytes = 0;
     long long stats_t0 = GetCurrentTimeMS();
 
     //
-    // open dump file if RENDER_DUMP_DIR is defined
+    // open dump file if RENDERER_DUMP_DIR is defined, the dumps can be
+    // replayed with emugl_stream_replay
     //
     const char *dump_dir = getenv("RENDERER_DUMP_DIR");
     FILE *dumpFP = NULL;
     if (dump_dir) {
         size_t bsize = strlen(dump_dir) + 32;
         char *fname = new char[bsize];
-        snprintf(fname,bsize,"%s/stream_%p", dump_dir, this);
+        snprintf(fname,bsize,"%s/stream_%p", dump_dir, stream);
         dumpFP = fopen(fname, "wb");
         if (!dumpFP) {
             fprintf(stderr,"Warning: stream dump failed to open file %s\n",fname);
@@ -77,7 +66,7 @@ intptr_t RenderThread::main() {
 
     while (1) {
 
-        int stat = readBuf.getData();
+        int stat = readBuf->getData();
         if (stat <= 0) {
             break;
         }
@@ -85,7 +74,7 @@ intptr_t RenderThread::main() {
         //
         // log received bandwidth statistics
         //
-        stats_totalBytes += readBuf.validData();
+        stats_totalBytes += readBuf->validData();
         long long dt = GetCurrentTimeMS() - stats_t0;
         if (dt > 1000) {
             //float dts = (float)dt / 1000.0f;
@@ -98,47 +87,33 @@ intptr_t RenderThread::main() {
         // dump stream to file if needed
         //
         if (dumpFP) {
-            int skip = readBuf.validData() - stat;
-            fwrite(readBuf.buf()+skip, 1, readBuf.validData()-skip, dumpFP);
+            int skip = readBuf->validData() - stat;
+            fwrite(readBuf->buf()+skip, 1, readBuf->validData()-skip, dumpFP);
             fflush(dumpFP);
         }
 
-        bool progress;
-        do {
-            progress = false;
-
-            m_lock->lock();
-            //
-            // try to process some of the command buffer using the GLESv1 decoder
-            //
-            size_t last = tInfo.m_glDec.decode(readBuf.buf(), readBuf.validData(), m_stream);
-            if (last > 0) {
-                progress = true;
-                readBuf.consume(last);
-            }
-
-            //
-            // try to process some of the command buffer using the GLESv2 decoder
-            //
-            last = tInfo.m_gl2Dec.decode(readBuf.buf(), readBuf.validData(), m_stream);
-            if (last > 0) {
-                progress = true;
-                readBuf.consume(last);
+        //
+        // dispatch each run of commands to the decoder that owns its opcode
+        // range, until an incomplete command or an unknown opcode is found.
+        //
+        while (readBuf->validData() >= 8) {
+            uint32_t opcode = *(const uint32_t *)readBuf->buf();
+            size_t last = 0;
+            if (GLESv2Decoder::handles(opcode)) {
+                last = tInfo.m_gl2Dec.decode(readBuf->buf(),
+                                             readBuf->validData(), stream);
+            } else if (GLESv1Decoder::handles(opcode)) {
+                last = tInfo.m_glDec.decode(readBuf->buf(),
+                                            readBuf->validData(), stream);
+            } else if (renderControl_decoder_context_t::handles(opcode)) {
+                last = tInfo.m_rcDec.decode(readBuf->buf(),
+                                            readBuf->validData(), stream);
             }
-
-            //
-            // try to process some of the command buffer using the
-            // renderControl decoder
-            //
-            last = tInfo.m_rcDec.decode(readBuf.buf(), readBuf.validData(), m_stream);
-            if (last > 0) {
-                readBuf.consume(last);
-                progress = true;
+            if (!last) {
+                break;
             }
-
-            m_lock->unlock();
-
-        } while( progress );
+            readBuf->consume(last);
+        }
 
     }
 
@@ -157,6 +132,4 @@ intptr_t RenderThread::main() {
     FrameBuffer::getFB()->drainWindowSurface();
 
     FrameBuffer::getFB()->drainRenderContext();
-
-    return 0;
 }
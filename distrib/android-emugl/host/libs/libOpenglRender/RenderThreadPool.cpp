@@ -0,0 +1,188 @@
+/*
+* Copyright (C) 2015 The Android Open Source Project
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+#include "RenderThreadPool.h"
+
+#include "ReadBuffer.h"
+#include "TimeUtils.h"
+
+#include "emugl/common/condition_variable.h"
+#include "emugl/common/thread.h"
+
+#include <string.h>
+
+class RenderThreadPool::Worker : public emugl::Thread {
+public:
+    explicit Worker(RenderThreadPool* pool) :
+            emugl::Thread(),
+            m_pool(pool),
+            m_stream(NULL),
+            m_readClientFlags(false),
+            m_queuedNs(0),
+            m_cond() {}
+
+    virtual intptr_t main() {
+        ReadBuffer readBuf(NULL, m_pool->m_bufferSize);
+        bool readClientFlags;
+        IOStream* stream = NULL;
+        while ((stream = m_pool->waitForStream(this, stream,
+                                               &readClientFlags))) {
+            readBuf.setStream(stream);
+            m_pool->m_serve(stream, readClientFlags, &readBuf);
+        }
+        return 0;
+    }
+
+private:
+    friend class RenderThreadPool;
+
+    RenderThreadPool* m_pool;
+    // The fields below are protected by the pool's lock.
+    IOStream* m_stream;
+    bool m_readClientFlags;
+    // When m_stream was passed to serve().
+    long long m_queuedNs;
+    // Signaled when m_stream is set, or when the pool stops.
+    emugl::ConditionVariable m_cond;
+};
+
+RenderThreadPool::RenderThreadPool(ServeFunc serve,
+                                   int maxIdleThreads,
+                                   size_t bufferSize) :
+        m_serve(serve),
+        m_maxIdleThreads(maxIdleThreads),
+        m_bufferSize(bufferSize),
+        m_lock(),
+        m_threads(),
+        m_idleThreads(),
+        m_exitedThreads(),
+        m_stopped(false) {
+    memset(&m_stats, 0, sizeof(m_stats));
+}
+
+RenderThreadPool::~RenderThreadPool() {
+    stop();
+}
+
+bool RenderThreadPool::serve(IOStream* stream, bool readClientFlags) {
+    long long queuedNs = GetCurrentTimeNS();
+    emugl::Mutex::AutoLock lock(m_lock);
+    if (m_stopped) {
+        return false;
+    }
+    reapExitedThreads();
+
+    Worker* worker;
+    if (!m_idleThreads.empty()) {
+        worker = m_idleThreads.back();
+        m_idleThreads.pop_back();
+    } else {
+        // The new thread blocks in waitForStream() until the lock is
+        // released, and then finds its stream.
+        worker = new Worker(this);
+        if (!worker->start()) {
+            delete worker;
+            return false;
+        }
+        m_threads.insert(worker);
+        m_stats.threadsCreated++;
+    }
+    worker->m_stream = stream;
+    worker->m_readClientFlags = readClientFlags;
+    worker->m_queuedNs = queuedNs;
+    worker->m_cond.signal();
+    m_stats.streams++;
+    return true;
+}
+
+IOStream* RenderThreadPool::waitForStream(Worker* worker,
+                                          IOStream* doneStream,
+                                          bool* readClientFlags) {
+    emugl::Mutex::AutoLock lock(m_lock);
+    if (doneStream) {
+        delete doneStream;
+        worker->m_stream = NULL;
+        if (m_stopped ||
+            (int)m_idleThreads.size() >= m_maxIdleThreads) {
+            m_threads.erase(worker);
+            m_exitedThreads.push_back(worker);
+            return NULL;
+        }
+        m_idleThreads.push_back(worker);
+    }
+    while (!worker->m_stream && !m_stopped) {
+        worker->m_cond.wait(&m_lock);
+    }
+    if (!worker->m_stream) {
+        return NULL;
+    }
+
+    uint64_t setupUs = (GetCurrentTimeNS() - worker->m_queuedNs) / 1000;
+    m_stats.totalSetupUs += setupUs;
+    if (setupUs > m_stats.maxSetupUs) {
+        m_stats.maxSetupUs = setupUs;
+    }
+    *readClientFlags = worker->m_readClientFlags;
+    return worker->m_stream;
+}
+
+void RenderThreadPool::reapExitedThreads() {
+    // These threads are returning from main(), so this doesn't block.
+    for (size_t n = 0; n < m_exitedThreads.size(); ++n) {
+        m_exitedThreads[n]->wait(NULL);
+        delete m_exitedThreads[n];
+    }
+    m_exitedThreads.clear();
+}
+
+void RenderThreadPool::stop() {
+    std::vector<Worker*> threads;
+    {
+        emugl::Mutex::AutoLock lock(m_lock);
+        m_stopped = true;
+        for (std::set<Worker*>::iterator it = m_threads.begin();
+             it != m_threads.end(); ++it) {
+            Worker* worker = *it;
+            if (worker->m_stream) {
+                worker->m_stream->forceStop();
+            }
+            worker->m_cond.signal();
+            threads.push_back(worker);
+        }
+    }
+    // Busy threads move themselves to m_exitedThreads once done with their
+    // stream, so wait for them without holding the lock.
+    for (size_t n = 0; n < threads.size(); ++n) {
+        threads[n]->wait(NULL);
+    }
+
+    emugl::Mutex::AutoLock lock(m_lock);
+    // Only the threads that were idle are left.
+    for (std::set<Worker*>::iterator it = m_threads.begin();
+         it != m_threads.end(); ++it) {
+        delete *it;
+    }
+    m_threads.clear();
+    m_idleThreads.clear();
+    reapExitedThreads();
+}
+
+RenderThreadPool::Stats RenderThreadPool::stats() const {
+    emugl::Mutex::AutoLock lock(m_lock);
+    Stats stats = m_stats;
+    stats.idleThreads = m_idleThreads.size();
+    stats.busyThreads = m_threads.size() - m_idleThreads.size();
+    return stats;
+}
@@ -0,0 +1,110 @@
+/*
+* Copyright (C) 2015 The Android Open Source Project
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+#ifndef _LIB_OPENGL_RENDER_RENDER_THREAD_POOL_H
+#define _LIB_OPENGL_RENDER_RENDER_THREAD_POOL_H
+
+#include "IOStream.h"
+
+#include "emugl/common/mutex.h"
+
+#include <set>
+#include <vector>
+
+#include <stdint.h>
+
+class ReadBuffer;
+
+// The threads of the RenderServer. Each guest connection is served by one
+// thread from start to end, so that the GL contexts it makes current always
+// stay on the same thread. When a connection ends, its thread and its stream
+// buffer are kept for the next one, instead of being destroyed, since guests
+// open many short-lived connections (e.g. one per process that calls
+// eglInitialize()).
+//
+// The number of idle threads kept is bounded. The number of busy threads is
+// not: a new connection never waits for another one to end, since guest
+// threads may wait for each other.
+class RenderThreadPool {
+public:
+    // Serve |stream| until it ends, reading it through |readBuf|.
+    // |readClientFlags| is the value passed to serve().
+    typedef void (*ServeFunc)(IOStream* stream,
+                              bool readClientFlags,
+                              ReadBuffer* readBuf);
+
+    struct Stats {
+        // Number of streams passed to serve().
+        unsigned streams;
+        // Number of threads created, i.e. streams that couldn't reuse an
+        // idle thread.
+        unsigned threadsCreated;
+        unsigned busyThreads;
+        unsigned idleThreads;
+        // Time between serve() and the start of serving a stream, which
+        // includes creating a thread and its buffer if none is idle.
+        uint64_t totalSetupUs;
+        uint64_t maxSetupUs;
+    };
+
+    // |serve| is called on a pool thread for each stream. At most
+    // |maxIdleThreads| threads are kept when they have no stream to serve,
+    // each with a stream buffer of |bufferSize| bytes.
+    RenderThreadPool(ServeFunc serve, int maxIdleThreads, size_t bufferSize);
+
+    // Calls stop().
+    ~RenderThreadPool();
+
+    // Serve |stream| on an idle thread, or on a new one. The pool takes
+    // ownership of the stream and deletes it once served. Return false on
+    // failure, in which case the caller keeps it.
+    bool serve(IOStream* stream, bool readClientFlags);
+
+    // Force all the streams being served to stop, and wait for the threads
+    // to exit. serve() fails after this.
+    void stop();
+
+    Stats stats() const;
+
+private:
+    class Worker;
+    friend class Worker;
+
+    // Called on |worker|'s thread, first when it starts, then each time it
+    // is done with a stream, which is passed as |doneStream| and deleted.
+    // Wait for the next stream, and return it, or NULL if the thread must
+    // exit.
+    IOStream* waitForStream(Worker* worker,
+                            IOStream* doneStream,
+                            bool* readClientFlags);
+
+    // Delete the threads that exited. Must be called with m_lock held.
+    void reapExitedThreads();
+
+    ServeFunc m_serve;
+    int m_maxIdleThreads;
+    size_t m_bufferSize;
+    mutable emugl::Mutex m_lock;
+    // All the threads that haven't exited, busy or idle.
+    std::set<Worker*> m_threads;
+    // Most recently used last, so that they are reused first while their
+    // buffer is still warm.
+    std::vector<Worker*> m_idleThreads;
+    std::vector<Worker*> m_exitedThreads;
+    bool m_stopped;
+    Stats m_stats;
+};
+
+#endif  // _LIB_OPENGL_RENDER_RENDER_THREAD_POOL_H
@@ -0,0 +1,249 @@
+// Copyright (C) 2015 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <gtest/gtest.h>
+
+#include "RenderThreadPool.h"
+
+#include "ReadBuffer.h"
+#include "TimeUtils.h"
+
+#include "emugl/common/condition_variable.h"
+#include "emugl/common/mutex.h"
+
+#include <set>
+#include <vector>
+
+#include <stdio.h>
+#include <string.h>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+
+namespace {
+
+using emugl::ConditionVariable;
+using emugl::Mutex;
+
+const size_t kBufferSize = 1024;
+
+void sleepMs(int ms) {
+#ifdef _WIN32
+    ::Sleep(ms);
+#else
+    ::usleep(ms * 1000);
+#endif
+}
+
+// A stream that the test feeds, and that blocks reads until it is fed or
+// closed. Counts its instances in |*liveCount|.
+class TestStream : public IOStream {
+public:
+    explicit TestStream(int* liveCount) :
+            IOStream(16), m_liveCount(liveCount), m_closed(false) {
+        Mutex::AutoLock lock(s_countLock);
+        (*m_liveCount)++;
+    }
+
+    virtual ~TestStream() {
+        Mutex::AutoLock lock(s_countLock);
+        (*m_liveCount)--;
+    }
+
+    void feed(const char* data) {
+        Mutex::AutoLock lock(m_lock);
+        m_data.insert(m_data.end(), data, data + strlen(data));
+        m_cond.signal();
+    }
+
+    void close() {
+        Mutex::AutoLock lock(m_lock);
+        m_closed = true;
+        m_cond.signal();
+    }
+
+    virtual const unsigned char* read(void* buf, size_t* inout_len) {
+        Mutex::AutoLock lock(m_lock);
+        while (m_data.empty() && !m_closed) {
+            m_cond.wait(&m_lock);
+        }
+        if (m_data.empty()) {
+            return NULL;
+        }
+        size_t len = *inout_len < m_data.size() ? *inout_len : m_data.size();
+        memcpy(buf, &m_data[0], len);
+        m_data.erase(m_data.begin(), m_data.begin() + len);
+        *inout_len = len;
+        return static_cast<const unsigned char*>(buf);
+    }
+
+    virtual void forceStop() { close(); }
+
+    virtual void* allocBuffer(size_t minSize) { return NULL; }
+    virtual int commitBuffer(size_t size) { return 0; }
+    virtual const unsigned char* readFully(void* buf, size_t len) {
+        return NULL;
+    }
+    virtual int writeFully(const void* buf, size_t len) { return 0; }
+
+    static Mutex s_countLock;
+
+private:
+    int* m_liveCount;
+    Mutex m_lock;
+    ConditionVariable m_cond;
+    std::vector<char> m_data;
+    bool m_closed;
+};
+
+Mutex TestStream::s_countLock;
+
+// What serveTestStream() saw.
+Mutex sServedLock;
+size_t sServedBytes = 0;
+std::set<ReadBuffer*> sReadBuffers;
+
+void serveTestStream(IOStream* stream,
+                     bool readClientFlags,
+                     ReadBuffer* readBuf) {
+    size_t bytes = 0;
+    while (readBuf->getData() > 0) {
+        bytes += readBuf->validData();
+        readBuf->consume(readBuf->validData());
+    }
+    Mutex::AutoLock lock(sServedLock);
+    sServedBytes += bytes;
+    sReadBuffers.insert(readBuf);
+}
+
+class RenderThreadPoolTest : public ::testing::Test {
+protected:
+    virtual void SetUp() {
+        mLiveStreams = 0;
+        Mutex::AutoLock lock(sServedLock);
+        sServedBytes = 0;
+        sReadBuffers.clear();
+    }
+
+    // Wait until no thread of |pool| is busy. Return false on timeout.
+    bool waitUntilIdle(const RenderThreadPool& pool) {
+        for (int n = 0; n < 5000; ++n) {
+            if (pool.stats().busyThreads == 0) {
+                return true;
+            }
+            sleepMs(1);
+        }
+        return false;
+    }
+
+    int liveStreams() {
+        Mutex::AutoLock lock(TestStream::s_countLock);
+        return mLiveStreams;
+    }
+
+    int mLiveStreams;
+};
+
+}  // namespace
+
+TEST_F(RenderThreadPoolTest, ReusesIdleThreadAndBuffer) {
+    RenderThreadPool pool(serveTestStream, 2, kBufferSize);
+    for (int n = 0; n < 10; ++n) {
+        TestStream* stream = new TestStream(&mLiveStreams);
+        ASSERT_TRUE(pool.serve(stream, false));
+        stream->feed("hello");
+        stream->close();
+        ASSERT_TRUE(waitUntilIdle(pool));
+    }
+    RenderThreadPool::Stats stats = pool.stats();
+    EXPECT_EQ(10U, stats.streams);
+    EXPECT_EQ(1U, stats.threadsCreated);
+    EXPECT_EQ(1U, stats.idleThreads);
+    EXPECT_EQ(0, liveStreams());
+
+    Mutex::AutoLock lock(sServedLock);
+    EXPECT_EQ(50U, sServedBytes);
+    EXPECT_EQ(1U, sReadBuffers.size());
+}
+
+TEST_F(RenderThreadPoolTest, KeepsAtMostMaxIdleThreads) {
+    RenderThreadPool pool(serveTestStream, 2, kBufferSize);
+    std::vector<TestStream*> streams;
+    for (int n = 0; n < 5; ++n) {
+        streams.push_back(new TestStream(&mLiveStreams));
+        ASSERT_TRUE(pool.serve(streams.back(), false));
+    }
+    // Busy threads are never reused.
+    EXPECT_EQ(5U, pool.stats().threadsCreated);
+    EXPECT_EQ(5U, pool.stats().busyThreads);
+
+    for (size_t n = 0; n < streams.size(); ++n) {
+        streams[n]->close();
+    }
+    ASSERT_TRUE(waitUntilIdle(pool));
+    EXPECT_EQ(2U, pool.stats().idleThreads);
+    EXPECT_EQ(0, liveStreams());
+
+    TestStream* stream = new TestStream(&mLiveStreams);
+    ASSERT_TRUE(pool.serve(stream, false));
+    stream->close();
+    ASSERT_TRUE(waitUntilIdle(pool));
+    EXPECT_EQ(5U, pool.stats().threadsCreated);
+}
+
+TEST_F(RenderThreadPoolTest, StopForcesStreamsToEnd) {
+    RenderThreadPool pool(serveTestStream, 1, kBufferSize);
+    for (int n = 0; n < 3; ++n) {
+        ASSERT_TRUE(pool.serve(new TestStream(&mLiveStreams), false));
+    }
+    TestStream* stream = new TestStream(&mLiveStreams);
+    ASSERT_TRUE(pool.serve(stream, false));
+    stream->close();
+
+    pool.stop();
+    EXPECT_EQ(0, liveStreams());
+    EXPECT_EQ(0U, pool.stats().busyThreads);
+    EXPECT_EQ(0U, pool.stats().idleThreads);
+
+    stream = new TestStream(&mLiveStreams);
+    EXPECT_FALSE(pool.serve(stream, false));
+    delete stream;
+}
+
+// Compares the setup time of short-lived connections, served one after the
+// other, with and without idle threads, i.e. with a new thread and buffer
+// for each connection. Run with --gtest_also_run_disabled_tests.
+TEST_F(RenderThreadPoolTest, DISABLED_ConnectionChurnBenchmark) {
+    const int kConnections = 2000;
+    const size_t kStreamBufferSize = 4 * 1024 * 1024;
+    const int kMaxIdle[] = { 0, 4 };
+    for (size_t n = 0; n < sizeof(kMaxIdle) / sizeof(kMaxIdle[0]); ++n) {
+        RenderThreadPool pool(serveTestStream, kMaxIdle[n], kStreamBufferSize);
+        for (int c = 0; c < kConnections; ++c) {
+            TestStream* stream = new TestStream(&mLiveStreams);
+            ASSERT_TRUE(pool.serve(stream, false));
+            stream->feed("a short-lived connection");
+            stream->close();
+            ASSERT_TRUE(waitUntilIdle(pool));
+        }
+        RenderThreadPool::Stats stats = pool.stats();
+        printf("max idle %d: %u threads created, setup %.1f us average, "
+               "%llu us max\n",
+               kMaxIdle[n], stats.threadsCreated,
+               (double)stats.totalSetupUs / stats.streams,
+               (unsigned long long)stats.maxSetupUs);
+    }
+}
@@ -0,0 +1,485 @@
+// Copyright (C) 2015 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Most of these tests run several GLESv2 decoders concurrently, the way
+// render threads do, against a no-op dispatch table, so that they don't need
+// a GPU or a GLES translator library.
+//
+// The FrameBuffer tests call the FrameBuffer concurrently, the way render
+// threads do when they decode renderControl and EGL commands. Like
+// ReadbackWorker_unittest, they use the host's EGL and GLES libraries, as
+// selected with ANDROID_EGL_LIB, ANDROID_GLESv1_LIB and ANDROID_GLESv2_LIB,
+// and are skipped when these can't be loaded.
+
+// Include this before the EGL headers, which include X11 headers that define
+// None on Linux.
+#include <gtest/gtest.h>
+
+#include "EGLDispatch.h"
+#include "FrameBuffer.h"
+#include "GLESv1Dispatch.h"
+#include "GLESv2Decoder.h"
+#include "GLESv2Dispatch.h"
+#include "RenderThreadInfo.h"
+#include "TimeUtils.h"
+#include "gles2_opcodes.h"
+
+#include "emugl/common/mutex.h"
+#include "emugl/common/testing/test_thread.h"
+#include "emugl/common/thread.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <vector>
+
+namespace {
+
+using emugl::Mutex;
+using emugl::TestThread;
+
+// The decoder only calls these, see makeStream().
+void gles2_APIENTRY stubBindTexture(GLenum, GLuint) {}
+void gles2_APIENTRY stubClearColor(GLclampf, GLclampf, GLclampf, GLclampf) {}
+void gles2_APIENTRY stubDrawArrays(GLenum, GLint, GLsizei) {}
+void gles2_APIENTRY stubUniform4f(GLint, GLfloat, GLfloat, GLfloat, GLfloat) {}
+
+void* stubGetProc(const char* name, void*) {
+    static const struct {
+        const char* name;
+        void* func;
+    } kStubs[] = {
+        { "glBindTexture", (void*)stubBindTexture },
+        { "glClearColor", (void*)stubClearColor },
+        { "glDrawArrays", (void*)stubDrawArrays },
+        { "glUniform4f", (void*)stubUniform4f },
+    };
+    for (size_t n = 0; n < sizeof(kStubs) / sizeof(kStubs[0]); ++n) {
+        if (!strcmp(name, kStubs[n].name)) {
+            return kStubs[n].func;
+        }
+    }
+    return NULL;
+}
+
+void appendCommand(std::vector<uint8_t>* stream,
+                   uint32_t opcode,
+                   const uint32_t* args,
+                   size_t numArgs) {
+    uint32_t header[2] = {
+        opcode, static_cast<uint32_t>(8 + 4 * numArgs)
+    };
+    const uint8_t* bytes = reinterpret_cast<const uint8_t*>(header);
+    stream->insert(stream->end(), bytes, bytes + sizeof(header));
+    bytes = reinterpret_cast<const uint8_t*>(args);
+    stream->insert(stream->end(), bytes, bytes + 4 * numArgs);
+}
+
+// Build a stream of at least |size| bytes of typical per-draw commands, with
+// |numUniforms| glUniform4f() calls before each draw. Return the number of
+// commands in the stream.
+size_t makeStream(std::vector<uint8_t>* stream,
+                  size_t size,
+                  int numUniforms = 1) {
+    float color[4] = { 0.25f, 0.5f, 0.75f, 1.0f };
+    uint32_t colorArgs[4];
+    memcpy(colorArgs, color, sizeof(color));
+    uint32_t uniformArgs[5] = { 3 };
+    memcpy(uniformArgs + 1, color, sizeof(color));
+
+    stream->clear();
+    size_t numCommands = 0;
+    for (uint32_t n = 0; stream->size() < size; ++n) {
+        uint32_t bindArgs[2] = { 0x0DE1 /* GL_TEXTURE_2D */, n & 15 };
+        uint32_t drawArgs[3] = { 4 /* GL_TRIANGLES */, 0, 6 };
+        appendCommand(stream, OP_glBindTexture, bindArgs, 2);
+        for (int u = 0; u < numUniforms; ++u) {
+            appendCommand(stream, OP_glUniform4f, uniformArgs, 5);
+        }
+        appendCommand(stream, OP_glDrawArrays, drawArgs, 3);
+        numCommands += 2 + numUniforms;
+        if ((n & 63) == 0) {
+            appendCommand(stream, OP_glClearColor, colorArgs, 4);
+            numCommands++;
+        }
+    }
+    return numCommands;
+}
+
+struct Decoding {
+    const std::vector<uint8_t>* stream;
+    // If not NULL, taken around each decoding pass, like RenderThread used
+    // to do.
+    Mutex* lock;
+    size_t decoded;
+};
+
+// Feed the stream to a decoder in 64 KB windows, like the ReadBuffer of a
+// RenderThread would.
+void* decodeFunction(void* param) {
+    Decoding* decoding = static_cast<Decoding*>(param);
+    GLESv2Decoder decoder;
+    decoder.initGL(stubGetProc, NULL);
+
+    const size_t kWindowSize = 65536;
+    const std::vector<uint8_t>& stream = *decoding->stream;
+    size_t pos = 0;
+    while (pos < stream.size()) {
+        size_t len = stream.size() - pos;
+        if (len > kWindowSize) {
+            len = kWindowSize;
+        }
+        if (decoding->lock) {
+            decoding->lock->lock();
+        }
+        size_t last = decoder.decode(
+                const_cast<uint8_t*>(&stream[pos]), len, NULL);
+        if (decoding->lock) {
+            decoding->lock->unlock();
+        }
+        if (!last) {
+            break;
+        }
+        pos += last;
+    }
+    decoding->decoded = pos;
+    return NULL;
+}
+
+// Decode |stream| concurrently from |numThreads| threads. Return the elapsed
+// time in milliseconds, and set |*ok| to true if all streams were fully
+// decoded.
+double decodeStreams(const std::vector<uint8_t>& stream,
+                     int numThreads,
+                     Mutex* lock,
+                     bool* ok) {
+    std::vector<Decoding> decodings(numThreads);
+    std::vector<TestThread*> threads(numThreads);
+
+    long long t0 = GetCurrentTimeMS();
+    for (int n = 0; n < numThreads; ++n) {
+        decodings[n].stream = &stream;
+        decodings[n].lock = lock;
+        decodings[n].decoded = 0;
+        threads[n] = new TestThread(decodeFunction, &decodings[n]);
+    }
+    *ok = true;
+    for (int n = 0; n < numThreads; ++n) {
+        threads[n]->join();
+        delete threads[n];
+        if (decodings[n].decoded != stream.size()) {
+            *ok = false;
+        }
+    }
+
+    return static_cast<double>(GetCurrentTimeMS() - t0);
+}
+
+}  // namespace
+
+TEST(RenderThread, DecodeStopsAtForeignOpcode) {
+    std::vector<uint8_t> stream;
+    size_t numCommands = makeStream(&stream, 4096, 4);
+    size_t gles2Size = stream.size();
+    // A renderControl command, which the GLESv2 decoder must leave alone.
+    uint32_t rcArgs[1] = { 0 };
+    appendCommand(&stream, 10000, rcArgs, 1);
+    EXPECT_FALSE(GLESv2Decoder::handles(10000));
+    EXPECT_TRUE(GLESv2Decoder::handles(OP_glUniform4f));
+    EXPECT_GT(numCommands, 0U);
+
+    GLESv2Decoder decoder;
+    decoder.initGL(stubGetProc, NULL);
+    EXPECT_EQ(gles2Size, decoder.decode(&stream[0], stream.size(), NULL));
+    // An incomplete glDrawArrays command is left for the next pass.
+    EXPECT_EQ(gles2Size - 20U,
+              decoder.decode(&stream[0], gles2Size - 1, NULL));
+}
+
+TEST(RenderThread, ConcurrentDecode) {
+    std::vector<uint8_t> stream;
+    makeStream(&stream, 1024 * 1024);
+
+    bool ok = false;
+    decodeStreams(stream, 4, NULL, &ok);
+    EXPECT_TRUE(ok);
+}
+
+// Compares decoding N streams concurrently with decoding them under a
+// single shared lock, as RenderThread used to do.
+TEST(RenderThread, DISABLED_MultiStreamDecodeBenchmark) {
+    const size_t kStreamSize = 32 * 1024 * 1024;
+    std::vector<uint8_t> stream;
+    makeStream(&stream, kStreamSize);
+
+    Mutex lock;
+    for (int numThreads = 1; numThreads <= 8; numThreads *= 2) {
+        bool ok = false;
+        double locked = decodeStreams(stream, numThreads, &lock, &ok);
+        EXPECT_TRUE(ok);
+        double unlocked = decodeStreams(stream, numThreads, NULL, &ok);
+        EXPECT_TRUE(ok);
+        double megabytes = numThreads * stream.size() / (1024. * 1024.);
+        printf("%d streams: global lock %8.1f MB/s, "
+               "concurrent %8.1f MB/s\n",
+               numThreads,
+               megabytes * 1000. / locked,
+               megabytes * 1000. / unlocked);
+    }
+}
+
+// Reports the number of commands decoded per second by a single decoder,
+// with short and long runs of the same command, best of 5 rounds.
+TEST(RenderThread, DISABLED_DecodeRateBenchmark) {
+    const size_t kStreamSize = 128 * 1024 * 1024;
+    std::vector<uint8_t> stream;
+    for (int numUniforms = 1; numUniforms <= 16; numUniforms *= 4) {
+        size_t numCommands = makeStream(&stream, kStreamSize, numUniforms);
+        double elapsed = 0.;
+        for (int round = 0; round < 5; ++round) {
+            bool ok = false;
+            double t = decodeStreams(stream, 1, NULL, &ok);
+            EXPECT_TRUE(ok);
+            if (round == 0 || t < elapsed) {
+                elapsed = t;
+            }
+        }
+        printf("%2d uniforms per draw: %8.2f M commands/s\n",
+               numUniforms,
+               numCommands / (elapsed * 1000.));
+    }
+}
+
+namespace {
+
+const int kFrameBufferWidth = 320;
+const int kFrameBufferHeight = 480;
+
+// Initialize the global FrameBuffer on first call. Return false if the
+// FrameBuffer tests must be skipped.
+bool initFrameBuffer() {
+    static int sResult = -1;
+    if (sResult < 0) {
+        sResult = 0;
+#ifdef __linux__
+        setenv("ANDROID_EGL_LIB", "libEGL.so.1", 0);
+        setenv("ANDROID_GLESv1_LIB", "libGLESv1_CM.so.1", 0);
+        setenv("ANDROID_GLESv2_LIB", "libGLESv2.so.2", 0);
+        if (!getenv("DISPLAY")) {
+            setenv("EGL_PLATFORM", "surfaceless", 0);
+        }
+#endif
+        if (getenv("ANDROID_EGL_LIB") && getenv("ANDROID_GLESv1_LIB") &&
+            getenv("ANDROID_GLESv2_LIB") &&
+            init_egl_dispatch() &&
+            init_gles1_dispatch() &&
+            init_gles2_dispatch() &&
+            FrameBuffer::initialize(kFrameBufferWidth,
+                                    kFrameBufferHeight,
+                                    false)) {
+            sResult = 1;
+        }
+    }
+    if (!sResult) {
+        printf("Skipped: no usable EGL and GLES libraries\n");
+    }
+    return sResult == 1;
+}
+
+// Return the guest id of a GLES 2.0 config, or -1.
+int findGles2Config(FrameBuffer* fb) {
+    const FbConfigList* configs = fb->getConfigs();
+    for (size_t n = 0; n < configs->size(); ++n) {
+        if (configs->get(n)->getRenderableType() & EGL_OPENGL_ES2_BIT) {
+            return static_cast<int>(n);
+        }
+    }
+    return -1;
+}
+
+struct FrameBufferClientParams {
+    int config;
+    // Color buffer created by the main thread, which all clients open and
+    // close.
+    HandleType shared;
+    int width;
+    int height;
+    int numIterations;
+    // If true, read each color buffer back and compare it with what was
+    // uploaded.
+    bool verify;
+    // If not NULL, taken around each iteration, like RenderThread used to
+    // do around each decoding pass.
+    Mutex* lock;
+};
+
+// Acts like a render thread drawing to its own color buffers: creates a
+// context and a surface, then repeatedly creates, opens, updates, reads and
+// closes a color buffer with the context bound, and opens and closes the
+// shared color buffer. This uses an emugl::Thread like RenderThread, since
+// the GL libraries need more stack than a TestThread has.
+class FrameBufferClient : public emugl::Thread {
+public:
+    FrameBufferClient(const FrameBufferClientParams& params, int index) :
+            mParams(params), mIndex(index) {}
+
+    virtual intptr_t main() {
+        FrameBuffer* fb = FrameBuffer::getFB();
+        RenderThreadInfo tInfo;
+
+        const int width = mParams.width;
+        const int height = mParams.height;
+        HandleType context = fb->createRenderContext(mParams.config, 0, true);
+        HandleType surface = fb->createWindowSurface(mParams.config,
+                                                     width, height);
+        bool ok = context && surface;
+
+        std::vector<uint8_t> pixels(4 * width * height);
+        std::vector<uint8_t> readback(4 * width * height);
+        for (int n = 0; ok && n < mParams.numIterations; ++n) {
+            for (size_t i = 0; i < pixels.size(); ++i) {
+                pixels[i] = static_cast<uint8_t>(i * 7 + mIndex * 31 +
+                                                 n * 13);
+            }
+            if (mParams.lock) {
+                mParams.lock->lock();
+            }
+            bool sharedOpen = fb->openColorBuffer(mParams.shared) == 0;
+            HandleType cb = fb->createColorBuffer(width, height, GL_RGBA);
+            ok = sharedOpen && cb &&
+                 fb->bindContext(context, surface, surface) &&
+                 fb->openColorBuffer(cb) == 0 &&
+                 fb->updateColorBuffer(cb, 0, 0, width, height,
+                                       GL_RGBA, GL_UNSIGNED_BYTE,
+                                       &pixels[0]);
+            if (ok && mParams.verify) {
+                fb->readColorBuffer(cb, 0, 0, width, height,
+                                    GL_RGBA, GL_UNSIGNED_BYTE, &readback[0]);
+                ok = readback == pixels;
+            }
+            fb->bindContext(0, 0, 0);
+            // Drop both references to |cb|, which destroys it.
+            fb->closeColorBuffer(cb);
+            fb->closeColorBuffer(cb);
+            if (sharedOpen) {
+                fb->closeColorBuffer(mParams.shared);
+            }
+            if (mParams.lock) {
+                mParams.lock->unlock();
+            }
+        }
+
+        if (surface) {
+            fb->DestroyWindowSurface(surface);
+        }
+        if (context) {
+            fb->DestroyRenderContext(context);
+        }
+        return ok ? 0 : -1;
+    }
+
+private:
+    FrameBufferClientParams mParams;
+    int mIndex;
+};
+
+// Run |numThreads| clients concurrently. Return the elapsed time in
+// milliseconds, and set |*ok| to true if all of them succeeded.
+double runFrameBufferClients(int numThreads,
+                             int width,
+                             int height,
+                             int numIterations,
+                             bool verify,
+                             Mutex* lock,
+                             bool* ok) {
+    FrameBuffer* fb = FrameBuffer::getFB();
+    FrameBufferClientParams params;
+    params.config = findGles2Config(fb);
+    params.shared = fb->createColorBuffer(64, 64, GL_RGBA);
+    params.width = width;
+    params.height = height;
+    params.numIterations = numIterations;
+    params.verify = verify;
+    params.lock = lock;
+    *ok = params.config >= 0 && params.shared != 0;
+
+    std::vector<FrameBufferClient*> clients(numThreads);
+    long long t0 = GetCurrentTimeMS();
+    for (int n = 0; n < numThreads; ++n) {
+        clients[n] = new FrameBufferClient(params, n);
+        clients[n]->start();
+    }
+    for (int n = 0; n < numThreads; ++n) {
+        intptr_t status = -1;
+        if (!clients[n]->wait(&status) || status != 0) {
+            *ok = false;
+        }
+        delete clients[n];
+    }
+    double elapsed = static_cast<double>(GetCurrentTimeMS() - t0);
+
+    // All clients closed what they opened, so the main thread holds the
+    // last reference to the shared color buffer, and closing it destroys it.
+    if (params.shared) {
+        uint8_t pixel[4] = { 0 };
+        fb->closeColorBuffer(params.shared);
+        if (fb->updateColorBuffer(params.shared, 0, 0, 1, 1,
+                                  GL_RGBA, GL_UNSIGNED_BYTE, pixel)) {
+            *ok = false;
+        }
+    }
+    return elapsed;
+}
+
+}  // namespace
+
+TEST(RenderThread, ConcurrentFrameBufferAccess) {
+    if (!initFrameBuffer()) {
+        return;
+    }
+    bool ok = false;
+    runFrameBufferClients(4, 64, 48, 50, true, NULL, &ok);
+    EXPECT_TRUE(ok);
+}
+
+// Compares render threads using the FrameBuffer concurrently with using it
+// under a single shared lock, as RenderThread used to do.
+TEST(RenderThread, DISABLED_FrameBufferBenchmark) {
+    if (!initFrameBuffer()) {
+        return;
+    }
+    const int kWidth = 256;
+    const int kHeight = 256;
+    const int kNumIterations = 200;
+    Mutex lock;
+    for (int numThreads = 1; numThreads <= 8; numThreads *= 2) {
+        bool ok = false;
+        double locked = runFrameBufferClients(numThreads, kWidth, kHeight,
+                                              kNumIterations, false, &lock,
+                                              &ok);
+        EXPECT_TRUE(ok);
+        double unlocked = runFrameBufferClients(numThreads, kWidth, kHeight,
+                                                kNumIterations, false, NULL,
+                                                &ok);
+        EXPECT_TRUE(ok);
+        double updates = numThreads * kNumIterations;
+        printf("%d threads: global lock %8.1f updates/s, "
+               "concurrent %8.1f updates/s\n",
+               numThreads,
+               updates * 1000. / locked,
+               updates * 1000. / unlocked);
+    }
+}
@@ -0,0 +1,191 @@
+/*
+* Copyright (C) 2015 The Android Open Source Project
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+#include "StreamReplay.h"
+
+#include "IOStream.h"
+#include "TimeUtils.h"
+#include "renderControl_opcodes.h"
+
+#include <stdlib.h>
+
+namespace {
+
+// An IOStream that drops everything written to it.
+class NullStream : public IOStream {
+public:
+    NullStream() : IOStream(4096), m_buf(NULL), m_size(0) {}
+
+    virtual ~NullStream() {
+        free(m_buf);
+    }
+
+    virtual void *allocBuffer(size_t minSize) {
+        if (minSize > m_size) {
+            void* buf = realloc(m_buf, minSize);
+            if (!buf) {
+                return NULL;
+            }
+            m_buf = buf;
+            m_size = minSize;
+        }
+        return m_buf;
+    }
+
+    virtual int commitBuffer(size_t size) {
+        return static_cast<int>(size);
+    }
+
+    virtual const unsigned char *readFully(void *buf, size_t len) {
+        return NULL;
+    }
+
+    virtual const unsigned char *read(void *buf, size_t *inout_len) {
+        return NULL;
+    }
+
+    virtual int writeFully(const void *buf, size_t len) {
+        return 0;
+    }
+
+    virtual void forceStop() {}
+
+private:
+    void* m_buf;
+    size_t m_size;
+};
+
+intptr_t nullFunction() {
+    return 0;
+}
+
+}  // namespace
+
+StreamReplay::StreamReplay(GLESv1Decoder* gles1,
+                           GLESv2Decoder* gles2,
+                           renderControl_decoder_context_t* rc) :
+        m_gles1(gles1),
+        m_gles2(gles2),
+        m_rc(rc),
+        m_stream(new NullStream()),
+        m_stats(),
+        m_frames(0) {}
+
+StreamReplay::~StreamReplay() {
+    delete m_stream;
+}
+
+// static
+const char* StreamReplay::commandName(uint32_t opcode) {
+    const char* name = GLESv2Decoder::commandName(opcode);
+    if (!name) {
+        name = GLESv1Decoder::commandName(opcode);
+    }
+    if (!name) {
+        name = renderControl_decoder_context_t::commandName(opcode);
+    }
+    return name;
+}
+
+// static
+void* StreamReplay::nullGetProc(const char* name, void* userData) {
+    // Calling a function through a pointer of another type is fine on the
+    // platforms we support as long as its arguments are ignored, and this
+    // is what the encoders already do for unsupported entry points.
+    return (void*)&nullFunction;
+}
+
+size_t StreamReplay::decode(const uint8_t* data, size_t size) {
+    uint32_t opcode = *(const uint32_t*)data;
+    void* buf = const_cast<uint8_t*>(data);
+    if (GLESv2Decoder::handles(opcode)) {
+        return m_gles2->decode(buf, size, m_stream);
+    }
+    if (GLESv1Decoder::handles(opcode)) {
+        return m_gles1->decode(buf, size, m_stream);
+    }
+    if (renderControl_decoder_context_t::handles(opcode)) {
+        return m_rc->decode(buf, size, m_stream);
+    }
+    return 0;
+}
+
+size_t StreamReplay::replay(const uint8_t* data, size_t size, FILE* trace) {
+    if (trace) {
+        fprintf(trace, "{\"traceEvents\":[\n");
+    }
+    const long long t0 = GetCurrentTimeNS();
+    size_t pos = 0;
+    bool firstEvent = true;
+    while (size - pos >= 8) {
+        const uint8_t* ptr = data + pos;
+        uint32_t opcode = *(const uint32_t*)ptr;
+        uint32_t packetLen = *(const uint32_t*)(ptr + 4);
+        if (packetLen < 8 || size - pos < packetLen) {
+            break;
+        }
+        // Limiting the size to a single command makes the decoder return
+        // right after it.
+        unsigned flushes = m_stream->stats().flushes;
+        long long start = GetCurrentTimeNS();
+        size_t done = decode(ptr, packetLen);
+        long long end = GetCurrentTimeNS();
+        if (!done) {
+            break;
+        }
+
+        OpcodeStats& stats = m_stats[opcode];
+        stats.count++;
+        stats.bytes += done;
+        stats.timeNs += end - start;
+        // The decoders flush the stream after each reply.
+        if (m_stream->stats().flushes != flushes) {
+            stats.replies++;
+        }
+        if (opcode == OP_rcFlushWindowColorBuffer) {
+            m_frames++;
+        }
+
+        if (trace) {
+            const char* name = commandName(opcode);
+            fprintf(trace,
+                    "%s{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":1,"
+                    "\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"bytes\":%zu}}",
+                    firstEvent ? "" : ",\n",
+                    name ? name : "unknown",
+                    (start - t0) / 1000.,
+                    (end - start) / 1000.,
+                    done);
+            firstEvent = false;
+        }
+        pos += done;
+    }
+    if (trace) {
+        fprintf(trace, "\n]}\n");
+    }
+    return pos;
+}
+
+size_t StreamReplay::replayUntimed(const uint8_t* data, size_t size) {
+    size_t pos = 0;
+    while (size - pos >= 8) {
+        size_t done = decode(data + pos, size - pos);
+        if (!done) {
+            break;
+        }
+        pos += done;
+    }
+    return pos;
+}
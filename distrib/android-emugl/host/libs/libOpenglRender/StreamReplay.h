@@ -0,0 +1,101 @@
+/*
+* Copyright (C) 2015 The Android Open Source Project
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+#ifndef _LIB_OPENGL_RENDER_STREAM_REPLAY_H
+#define _LIB_OPENGL_RENDER_STREAM_REPLAY_H
+
+#include "GLESv1Decoder.h"
+#include "GLESv2Decoder.h"
+#include "renderControl_dec.h"
+
+#include <map>
+
+#include <stdint.h>
+#include <stdio.h>
+
+// Replays a command stream that a RenderThread dumped to RENDERER_DUMP_DIR,
+// and collects statistics for each opcode.
+//
+// The decoders are provided by the caller, and can either be connected to
+// the host renderer, or to a no-op dispatch (see nullGetProc()) to measure
+// the cost of decoding alone, without a GPU.
+//
+// Replies to the guest are discarded, so a stream can only be replayed
+// faithfully against the host renderer if the handles that it returns are
+// the same as when the stream was recorded, i.e. for the first stream of a
+// fresh renderer.
+class StreamReplay {
+public:
+    // Statistics for one opcode.
+    struct OpcodeStats {
+        OpcodeStats() : count(0), bytes(0), replies(0), timeNs(0) {}
+
+        uint64_t count;
+        uint64_t bytes;
+        // Number of commands that sent a reply, i.e. that made the guest
+        // wait for a round trip to the host.
+        uint64_t replies;
+        // Time spent decoding and executing the commands.
+        uint64_t timeNs;
+    };
+
+    typedef std::map<uint32_t, OpcodeStats> StatsMap;
+
+    StreamReplay(GLESv1Decoder* gles1,
+                 GLESv2Decoder* gles2,
+                 renderControl_decoder_context_t* rc);
+    ~StreamReplay();
+
+    // Replay |size| bytes of commands from |data|, timing each command, and
+    // add the results to stats(). If |trace| is not NULL, also write a
+    // timeline of the commands to it, in the Chrome trace event format.
+    // Return the number of bytes replayed, which is less than |size| if the
+    // stream ends with an incomplete command or has an unknown opcode.
+    size_t replay(const uint8_t* data, size_t size, FILE* trace);
+
+    // Same as replay(), but decodes runs of commands the way a RenderThread
+    // does, without timing them, to measure decoding throughput. Doesn't
+    // update stats().
+    size_t replayUntimed(const uint8_t* data, size_t size);
+
+    const StatsMap& stats() const { return m_stats; }
+
+    // Return the number of frames replayed by replay(), i.e. the number of
+    // rcFlushWindowColorBuffer commands, which eglSwapBuffers() sends.
+    uint64_t frames() const { return m_frames; }
+
+    // Return the name of the command for |opcode|, or NULL if unknown.
+    static const char* commandName(uint32_t opcode);
+
+    // A get-proc function for the decoders, returning a function that does
+    // nothing and returns 0 for every GL and renderControl entry point.
+    static void* nullGetProc(const char* name, void* userData);
+
+private:
+    // Decode the commands at the start of |data|, up to |size| bytes, with
+    // the decoder that owns the first opcode. Return the number of bytes
+    // decoded, or 0 if the opcode is unknown.
+    size_t decode(const uint8_t* data, size_t size);
+
+    GLESv1Decoder* m_gles1;
+    GLESv2Decoder* m_gles2;
+    renderControl_decoder_context_t* m_rc;
+    // Discards the replies of the decoders.
+    IOStream* m_stream;
+    StatsMap m_stats;
+    uint64_t m_frames;
+};
+
+#endif  // _LIB_OPENGL_RENDER_STREAM_REPLAY_H
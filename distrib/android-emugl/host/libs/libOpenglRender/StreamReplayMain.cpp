@@ -0,0 +1,248 @@
+/*
+* Copyright (C) 2015 The Android Open Source Project
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+// emugl_stream_replay: replays a command stream dumped by the renderer
+// (run the emulator with RENDERER_DUMP_DIR=<dir> to get one file per render
+// thread), and reports, for each opcode, its count, its size, its decoding
+// time, and with -host the time spent in the host GL implementation.
+//
+// Without -host, all GL calls are dropped, so this runs without a GPU.
+
+#include "EGLDispatch.h"
+#include "FrameBuffer.h"
+#include "GLESv1Dispatch.h"
+#include "GLESv2Dispatch.h"
+#include "RenderControl.h"
+#include "RenderThreadInfo.h"
+#include "StreamReplay.h"
+#include "TimeUtils.h"
+
+#include <algorithm>
+#include <vector>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+namespace {
+
+void usage(const char* progName) {
+    fprintf(stderr,
+            "Usage: %s [options] <stream file>\n"
+            "\t-host: replay against the host renderer, default is to\n"
+            "\t       drop all GL calls\n"
+            "\t-size <width>x<height>: framebuffer size with -host,\n"
+            "\t       default is 480x800\n"
+            "\t-trace <file>: write a timeline of the commands to <file>,\n"
+            "\t       in the Chrome trace event format\n",
+            progName);
+}
+
+bool readFile(const char* path, std::vector<uint8_t>* data) {
+    FILE* fp = fopen(path, "rb");
+    if (!fp) {
+        perror(path);
+        return false;
+    }
+    uint8_t buf[65536];
+    size_t count;
+    while ((count = fread(buf, 1, sizeof(buf), fp)) > 0) {
+        data->insert(data->end(), buf, buf + count);
+    }
+    bool ok = !ferror(fp);
+    fclose(fp);
+    return ok;
+}
+
+struct Row {
+    uint32_t opcode;
+    StreamReplay::OpcodeStats stats;
+    // Time spent in the host GL implementation, or -1 without -host.
+    long long hostNs;
+};
+
+bool byTotalTime(const Row& a, const Row& b) {
+    long long ta = a.stats.timeNs + (a.hostNs > 0 ? a.hostNs : 0);
+    long long tb = b.stats.timeNs + (b.hostNs > 0 ? b.hostNs : 0);
+    return ta > tb;
+}
+
+void initNullDecoders(RenderThreadInfo* tInfo) {
+    tInfo->m_glDec.initGL(StreamReplay::nullGetProc, NULL);
+    tInfo->m_gl2Dec.initGL(StreamReplay::nullGetProc, NULL);
+    tInfo->m_rcDec.initDispatchByName(StreamReplay::nullGetProc, NULL);
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    bool useHost = false;
+    int width = 480;
+    int height = 800;
+    const char* tracePath = NULL;
+    const char* streamPath = NULL;
+
+    for (int n = 1; n < argc; ++n) {
+        if (!strcmp(argv[n], "-host")) {
+            useHost = true;
+        } else if (!strcmp(argv[n], "-size") && n + 1 < argc) {
+            if (sscanf(argv[++n], "%dx%d", &width, &height) != 2) {
+                usage(argv[0]);
+                return 1;
+            }
+        } else if (!strcmp(argv[n], "-trace") && n + 1 < argc) {
+            tracePath = argv[++n];
+        } else if (argv[n][0] != '-' && !streamPath) {
+            streamPath = argv[n];
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (!streamPath) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    std::vector<uint8_t> data;
+    if (!readFile(streamPath, &data)) {
+        return 1;
+    }
+    if (data.empty()) {
+        fprintf(stderr, "%s: empty stream\n", streamPath);
+        return 1;
+    }
+
+    if (useHost) {
+        if (!init_egl_dispatch() ||
+            !init_gles1_dispatch() ||
+            !init_gles2_dispatch()) {
+            fprintf(stderr, "Could not load the GLES translator libraries\n");
+            return 1;
+        }
+        if (!FrameBuffer::initialize(width, height, false)) {
+            fprintf(stderr, "Could not initialize the framebuffer\n");
+            return 1;
+        }
+    }
+
+    RenderThreadInfo tInfo;
+
+    // Decoding throughput, with runs of commands decoded the way a
+    // RenderThread does.
+    initNullDecoders(&tInfo);
+    StreamReplay untimed(&tInfo.m_glDec, &tInfo.m_gl2Dec, &tInfo.m_rcDec);
+    long long t0 = GetCurrentTimeNS();
+    size_t replayed = untimed.replayUntimed(&data[0], data.size());
+    long long untimedNs = GetCurrentTimeNS() - t0;
+
+    // Decoding time of each command.
+    FILE* trace = NULL;
+    if (tracePath) {
+        trace = fopen(tracePath, "w");
+        if (!trace) {
+            perror(tracePath);
+            return 1;
+        }
+    }
+    StreamReplay decodeOnly(&tInfo.m_glDec, &tInfo.m_gl2Dec, &tInfo.m_rcDec);
+    decodeOnly.replay(&data[0], data.size(), useHost ? NULL : trace);
+
+    // Host time of each command.
+    StreamReplay host(&tInfo.m_glDec, &tInfo.m_gl2Dec, &tInfo.m_rcDec);
+    if (useHost) {
+        tInfo.m_glDec.initGL(gles1_dispatch_get_proc_func, NULL);
+        tInfo.m_gl2Dec.initGL(gles2_dispatch_get_proc_func, NULL);
+        initRenderControlContext(&tInfo.m_rcDec);
+        host.replay(&data[0], data.size(), trace);
+
+        FrameBuffer::getFB()->bindContext(0, 0, 0);
+        FrameBuffer::getFB()->drainWindowSurface();
+        FrameBuffer::getFB()->drainRenderContext();
+    }
+    if (trace) {
+        fclose(trace);
+    }
+
+    std::vector<Row> rows;
+    uint64_t numCommands = 0;
+    const StreamReplay::StatsMap& stats = decodeOnly.stats();
+    for (StreamReplay::StatsMap::const_iterator it = stats.begin();
+         it != stats.end(); ++it) {
+        Row row;
+        row.opcode = it->first;
+        row.stats = it->second;
+        row.hostNs = -1;
+        if (useHost) {
+            StreamReplay::StatsMap::const_iterator hostIt =
+                    host.stats().find(it->first);
+            if (hostIt != host.stats().end()) {
+                row.hostNs = (long long)hostIt->second.timeNs -
+                             (long long)it->second.timeNs;
+                if (row.hostNs < 0) {
+                    row.hostNs = 0;
+                }
+            }
+        }
+        rows.push_back(row);
+        numCommands += row.stats.count;
+    }
+    std::sort(rows.begin(), rows.end(), byTotalTime);
+
+    printf("%s: %llu commands, %zu bytes", streamPath,
+           (unsigned long long)numCommands, replayed);
+    if (replayed < data.size()) {
+        printf(" (%zu trailing bytes not replayed)", data.size() - replayed);
+    }
+    printf("\n");
+    uint64_t numReplies = 0;
+    for (size_t n = 0; n < rows.size(); ++n) {
+        numReplies += rows[n].stats.replies;
+    }
+    printf("round trips: %llu", (unsigned long long)numReplies);
+    if (decodeOnly.frames() > 0) {
+        printf(" in %llu frames, %.1f per frame",
+               (unsigned long long)decodeOnly.frames(),
+               (double)numReplies / decodeOnly.frames());
+    }
+    printf("\n");
+    if (untimedNs > 0) {
+        printf("decoding: %.2f M commands/s, %.1f MB/s\n\n",
+               numCommands * 1000. / untimedNs,
+               replayed * 1e9 / (untimedNs * 1024. * 1024.));
+    }
+
+    printf("%6s %-36s %10s %12s %10s %12s %12s\n",
+           "opcode", "command", "count", "bytes", "replies", "decode us",
+           "host us");
+    for (size_t n = 0; n < rows.size(); ++n) {
+        const Row& row = rows[n];
+        const char* name = StreamReplay::commandName(row.opcode);
+        printf("%6u %-36s %10llu %12llu %10llu %12.1f ",
+               row.opcode,
+               name ? name : "unknown",
+               (unsigned long long)row.stats.count,
+               (unsigned long long)row.stats.bytes,
+               (unsigned long long)row.stats.replies,
+               row.stats.timeNs / 1000.);
+        if (row.hostNs >= 0) {
+            printf("%12.1f\n", row.hostNs / 1000.);
+        } else {
+            printf("%12s\n", "-");
+        }
+    }
+    return 0;
+}
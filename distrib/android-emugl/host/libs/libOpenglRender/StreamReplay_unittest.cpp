@@ -0,0 +1,148 @@
+// Copyright (C) 2015 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Must come before StreamReplay.h, see RenderThread_unittest.cpp.
+#include <gtest/gtest.h>
+
+#include "StreamReplay.h"
+
+#include "gles2_opcodes.h"
+// Both opcode headers define it.
+#undef OP_last
+#include "renderControl_opcodes.h"
+
+#include <stdint.h>
+#include <string.h>
+
+#include <string>
+#include <vector>
+
+namespace {
+
+void appendCommand(std::vector<uint8_t>* stream,
+                   uint32_t opcode,
+                   const uint32_t* args,
+                   size_t numArgs) {
+    uint32_t header[2] = {
+        opcode, static_cast<uint32_t>(8 + 4 * numArgs)
+    };
+    const uint8_t* bytes = reinterpret_cast<const uint8_t*>(header);
+    stream->insert(stream->end(), bytes, bytes + sizeof(header));
+    bytes = reinterpret_cast<const uint8_t*>(args);
+    stream->insert(stream->end(), bytes, bytes + 4 * numArgs);
+}
+
+class StreamReplayTest : public ::testing::Test {
+protected:
+    virtual void SetUp() {
+        mGles1.initGL(StreamReplay::nullGetProc, NULL);
+        mGles2.initGL(StreamReplay::nullGetProc, NULL);
+        mRc.initDispatchByName(StreamReplay::nullGetProc, NULL);
+
+        // A GLESv2 frame, with a few renderControl commands, one of which
+        // returns a value.
+        uint32_t args[3] = { 0x0DE1 /* GL_TEXTURE_2D */, 1, 6 };
+        appendCommand(&mStream, OP_rcMakeCurrent, args, 3);
+        for (int n = 0; n < 3; ++n) {
+            appendCommand(&mStream, OP_glBindTexture, args, 2);
+            appendCommand(&mStream, OP_glDrawArrays, args, 3);
+        }
+        appendCommand(&mStream, OP_glFlush, NULL, 0);
+        appendCommand(&mStream, OP_rcFlushWindowColorBuffer, args, 1);
+    }
+
+    GLESv1Decoder mGles1;
+    GLESv2Decoder mGles2;
+    renderControl_decoder_context_t mRc;
+    std::vector<uint8_t> mStream;
+};
+
+}  // namespace
+
+TEST_F(StreamReplayTest, CountsCommands) {
+    StreamReplay replay(&mGles1, &mGles2, &mRc);
+    EXPECT_EQ(mStream.size(), replay.replay(&mStream[0], mStream.size(), NULL));
+
+    const StreamReplay::StatsMap& stats = replay.stats();
+    EXPECT_EQ(5U, stats.size());
+    ASSERT_EQ(1U, stats.count(OP_glDrawArrays));
+    EXPECT_EQ(3U, stats.find(OP_glDrawArrays)->second.count);
+    EXPECT_EQ(3U * 20U, stats.find(OP_glDrawArrays)->second.bytes);
+    ASSERT_EQ(1U, stats.count(OP_rcMakeCurrent));
+    EXPECT_EQ(1U, stats.find(OP_rcMakeCurrent)->second.count);
+    ASSERT_EQ(1U, stats.count(OP_glFlush));
+    EXPECT_EQ(8U, stats.find(OP_glFlush)->second.bytes);
+}
+
+TEST_F(StreamReplayTest, CountsRepliesAndFrames) {
+    StreamReplay replay(&mGles1, &mGles2, &mRc);
+    replay.replay(&mStream[0], mStream.size(), NULL);
+    replay.replay(&mStream[0], mStream.size(), NULL);
+
+    const StreamReplay::StatsMap& stats = replay.stats();
+    EXPECT_EQ(2U, stats.find(OP_rcMakeCurrent)->second.replies);
+    EXPECT_EQ(2U, stats.find(OP_rcFlushWindowColorBuffer)->second.replies);
+    EXPECT_EQ(0U, stats.find(OP_glDrawArrays)->second.replies);
+    EXPECT_EQ(0U, stats.find(OP_glFlush)->second.replies);
+    EXPECT_EQ(2U, replay.frames());
+}
+
+TEST_F(StreamReplayTest, StopsAtUnknownOpcodeOrIncompleteCommand) {
+    size_t size = mStream.size();
+    uint32_t args[2] = { 0, 0 };
+    appendCommand(&mStream, 0xdead, args, 2);
+
+    StreamReplay replay(&mGles1, &mGles2, &mRc);
+    EXPECT_EQ(size, replay.replay(&mStream[0], mStream.size(), NULL));
+    EXPECT_EQ(size, replay.replayUntimed(&mStream[0], mStream.size()));
+
+    // The last command is 12 bytes long.
+    EXPECT_EQ(size - 12U, replay.replayUntimed(&mStream[0], size - 1));
+}
+
+TEST_F(StreamReplayTest, UntimedDoesNotUpdateStats) {
+    StreamReplay replay(&mGles1, &mGles2, &mRc);
+    EXPECT_EQ(mStream.size(),
+              replay.replayUntimed(&mStream[0], mStream.size()));
+    EXPECT_TRUE(replay.stats().empty());
+}
+
+TEST_F(StreamReplayTest, WritesTrace) {
+    FILE* trace = tmpfile();
+    ASSERT_TRUE(trace != NULL);
+    StreamReplay replay(&mGles1, &mGles2, &mRc);
+    replay.replay(&mStream[0], mStream.size(), trace);
+
+    std::string text;
+    rewind(trace);
+    char buf[256];
+    size_t count;
+    while ((count = fread(buf, 1, sizeof(buf), trace)) > 0) {
+        text.append(buf, count);
+    }
+    fclose(trace);
+
+    EXPECT_EQ(0U, text.find("{\"traceEvents\":[\n"));
+    EXPECT_NE(std::string::npos, text.find("\"name\":\"rcMakeCurrent\""));
+    EXPECT_NE(std::string::npos, text.find("\"name\":\"glDrawArrays\""));
+    EXPECT_EQ(text.size() - 4U, text.rfind("\n]}\n"));
+}
+
+TEST(StreamReplay, CommandName) {
+    EXPECT_STREQ("glDrawArrays", StreamReplay::commandName(OP_glDrawArrays));
+    EXPECT_STREQ("glFogf", StreamReplay::commandName(
+            GLESv1Decoder::kFirstOpcode + 6));
+    EXPECT_STREQ("rcGetFBParam", StreamReplay::commandName(OP_rcGetFBParam));
+    EXPECT_EQ(NULL, StreamReplay::commandName(0xdead));
+}
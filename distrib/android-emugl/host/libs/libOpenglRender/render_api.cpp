@@ -16,6 +16,7 @@
 #include "render_api.h"
 
 #include "IOStream.h"
+#include "RenderChannel.h"
 #include "RenderServer.h"
 #include "RenderWindow.h"
 #include "TimeUtils.h"
@@ -315,3 +316,41 @@ RENDER_APICALL int RENDER_APIENTRY setStreamMode(int mode)
     gRendererStreamMode = mode;
     return true;
 }
+
+RENDER_APICALL void* RENDER_APIENTRY openRenderChannel(void)
+{
+    if (!s_renderThread) {
+        return NULL;
+    }
+    return s_renderThread->openChannel();
+}
+
+RENDER_APICALL int RENDER_APIENTRY renderChannelGetNotifyFd(void* channel)
+{
+    return static_cast<RenderChannel*>(channel)->notifyFd();
+}
+
+RENDER_APICALL int RENDER_APIENTRY renderChannelSend(
+        void* channel, const RenderChannelBuffer* buffers, int numBuffers)
+{
+    return static_cast<RenderChannel*>(channel)->send(buffers, numBuffers);
+}
+
+RENDER_APICALL int RENDER_APIENTRY renderChannelRecv(
+        void* channel, RenderChannelBuffer* buffers, int numBuffers)
+{
+    return static_cast<RenderChannel*>(channel)->recv(buffers, numBuffers);
+}
+
+RENDER_APICALL unsigned RENDER_APIENTRY renderChannelPoll(
+        void* channel, unsigned wanted)
+{
+    return static_cast<RenderChannel*>(channel)->poll(wanted);
+}
+
+RENDER_APICALL void RENDER_APIENTRY closeRenderChannel(void* channel)
+{
+    RenderChannel* renderChannel = static_cast<RenderChannel*>(channel);
+    renderChannel->close();
+    renderChannel->unref();
+}
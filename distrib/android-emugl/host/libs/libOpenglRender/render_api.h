@@ -45,6 +45,11 @@ extern "C" {
 #define STREAM_MODE_UNIX      2
 #define STREAM_MODE_PIPE      3
 
+/* flags returned by renderChannelPoll() */
+#define RENDER_CHANNEL_CAN_READ   (1 << 0)
+#define RENDER_CHANNEL_CAN_WRITE  (1 << 1)
+#define RENDER_CHANNEL_CLOSED     (1 << 2)
+
 
 #define RENDER_API_DECLARE(return_type, func_name, signature) \
     typedef return_type (RENDER_APIENTRY *func_name ## Fn) signature; \
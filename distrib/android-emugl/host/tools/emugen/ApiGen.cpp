@@ -732,7 +732,14 @@ int ApiGen::genDecoderHeader(const std::string &filename)
 
     fprintf(fp, "struct %s : public %s_%s_context_t {\n\n",
             classname.c_str(), m_basename.c_str(), sideString(SERVER_SIDE));
-    fprintf(fp, "\tsize_t decode(void *buf, size_t bufsize, IOStream *stream);\n");
+    fprintf(fp, "\tsize_t decode(void *buf, size_t bufsize, IOStream *stream);\n\n");
+    fprintf(fp, "\t// Opcodes handled by decode() are in [kFirstOpcode, kLastOpcode).\n");
+    fprintf(fp, "\tstatic const uint32_t kFirstOpcode = %u;\n", (unsigned int)m_baseOpcode);
+    fprintf(fp, "\tstatic const uint32_t kLastOpcode = %u;\n",
+            (unsigned int)(size() + m_baseOpcode));
+    fprintf(fp, "\tstatic bool handles(uint32_t opcode) { return opcode - kFirstOpcode < kLastOpcode - kFirstOpcode; }\n");
+    fprintf(fp, "\t// Return the name of the command for |opcode|, or NULL if it is not handled.\n");
+    fprintf(fp, "\tstatic const char *commandName(uint32_t opcode);\n");
     fprintf(fp, "\n};\n\n");
     fprintf(fp, "#endif  // GUARD_%s\n", classname.c_str());
 
@@ -800,32 +807,16 @@ int ApiGen::genDecoderImpl(const std::string &filename)
             "#  define DEBUG(...)  ((void)0)\n"
             "#endif\n\n");
 
-    fprintf(fp,
-            "#ifdef CHECK_GLERROR\n"
-            "#  define SET_LASTCALL(name)  sprintf(lastCall, #name)\n"
-            "#else\n"
-            "#  define SET_LASTCALL(name)  ((void)0)\n"
-            "#endif\n\n");
-
     // helper templates
     fprintf(fp, "using namespace emugl;\n\n");
 
-    // decoder switch;
-    fprintf(fp, "size_t %s::decode(void *buf, size_t len, IOStream *stream)\n{\n", classname.c_str());
+    // Each command is decoded by its own handler, and decode() dispatches
+    // through a table indexed by opcode instead of a switch. The handlers
+    // read the arguments straight from the command buffer.
+    fprintf(fp, "namespace {\n\n");
     fprintf(fp,
-            "                           \n\
-\tsize_t pos = 0;\n\
-\tif (len < 8) return pos; \n\
-\tunsigned char *ptr = (unsigned char *)buf;\n\
-\tbool unknownOpcode = false;  \n\
-#ifdef CHECK_GL_ERROR \n\
-\tchar lastCall[256] = {0}; \n\
-#endif \n\
-\twhile ((len - pos >= 8) && !unknownOpcode) {   \n\
-\t\tuint32_t opcode = *(uint32_t *)ptr;   \n\
-\t\tsize_t packetLen = *(uint32_t *)(ptr + 4);\n\
-\t\tif (len - pos < packetLen)  return pos; \n\
-\t\tswitch(opcode) {\n");
+            "typedef void (*%s_decode_func_t)(%s *ctx, unsigned char *ptr, IOStream *stream);\n\n",
+            m_basename.c_str(), classname.c_str());
 
     for (size_t f = 0; f < n; f++) {
         enum Pass_t {
@@ -849,7 +840,8 @@ int ApiGen::genDecoderImpl(const std::string &filename)
         printString += "";
         // TODO - add for return value;
 
-        fprintf(fp, "\t\tcase OP_%s: {\n", e->name().c_str());
+        fprintf(fp, "void decode_%s(%s *ctx, unsigned char *ptr, IOStream *stream)\n{\n",
+                e->name().c_str(), classname.c_str());
 
         bool totalTmpBuffExist = false;
         std::string totalTmpBuffOffset = "0";
@@ -862,22 +854,19 @@ int ApiGen::genDecoderImpl(const std::string &filename)
         }
 
         for (int pass = PASS_FIRST; pass < PASS_LAST; pass++) {
-            if (pass == PASS_FunctionCall &&
-                !e->retval().isVoid() &&
-                !e->retval().isPointer()) {
-                fprintf(fp, "\t\t\t*(%s *)(&tmpBuf[%s]) = ", retvalType.c_str(),
-                        totalTmpBuffOffset.c_str());
-            }
-
-
             if (pass == PASS_FunctionCall) {
-                fprintf(fp, "\t\t\tthis->%s(", e->name().c_str());
+                fprintf(fp, "\t");
+                if (!e->retval().isVoid() && !e->retval().isPointer()) {
+                    fprintf(fp, "*(%s *)(&tmpBuf[%s]) = ", retvalType.c_str(),
+                            totalTmpBuffOffset.c_str());
+                }
+                fprintf(fp, "ctx->%s(", e->name().c_str());
                 if (e->customDecoder()) {
-                    fprintf(fp, "this"); // add a context to the call
+                    fprintf(fp, "ctx"); // add a context to the call
                 }
             } else if (pass == PASS_DebugPrint) {
                 fprintf(fp,
-                        "\t\t\tDEBUG(\"%s(%%p): %s(%s)\\n\", stream",
+                        "\tDEBUG(\"%s(%%p): %s(%s)\\n\", stream",
                         m_basename.c_str(),
                         e->name().c_str(),
                         printString.c_str());
@@ -909,7 +898,7 @@ int ApiGen::genDecoderImpl(const std::string &filename)
                 if (!v->isPointer()) {
                     if (pass == PASS_VariableDeclarations) {
                         fprintf(fp,
-                                "\t\t\t%s var_%s = Unpack<%s,uint%u_t>(ptr + %s);\n",
+                                "\t%s var_%s = Unpack<%s,uint%u_t>(ptr + %s);\n",
                                 var_type_name,
                                 var_name,
                                 var_type_name,
@@ -927,7 +916,7 @@ int ApiGen::genDecoderImpl(const std::string &filename)
 
                 if (pass == PASS_VariableDeclarations) {
                     fprintf(fp,
-                            "\t\t\tuint32_t size_%s __attribute__((unused)) = Unpack<uint32_t,uint32_t>(ptr + %s);\n",
+                            "\tuint32_t size_%s __attribute__((unused)) = Unpack<uint32_t,uint32_t>(ptr + %s);\n",
                             var_name,
                             varoffset.c_str());
                 }
@@ -937,7 +926,7 @@ int ApiGen::genDecoderImpl(const std::string &filename)
                     if (pass == PASS_VariableDeclarations) {
 #if USE_ALIGNED_BUFFERS
                         fprintf(fp,
-                                "\t\t\tInputBuffer inptr_%s(ptr + %s + 4, size_%s);\n",
+                                "\tInputBuffer inptr_%s(ptr + %s + 4, size_%s);\n",
                                 var_name,
                                 varoffset.c_str(),
                                 var_name);
@@ -995,11 +984,11 @@ int ApiGen::genDecoderImpl(const std::string &filename)
                     if (pass == PASS_TmpBuffAlloc) {
                         if (!totalTmpBuffExist) {
                             fprintf(fp,
-                                    "\t\t\tsize_t totalTmpSize = size_%s;\n",
+                                    "\tsize_t totalTmpSize = size_%s;\n",
                                     var_name);
                         } else {
                             fprintf(fp,
-                                    "\t\t\ttotalTmpSize += size_%s;\n",
+                                    "\ttotalTmpSize += size_%s;\n",
                                     var_name);
                         }
                         tmpBufOffset[j] = totalTmpBuffOffset;
@@ -1009,7 +998,7 @@ int ApiGen::genDecoderImpl(const std::string &filename)
                     } else if (pass == PASS_MemAlloc) {
 #if USE_ALIGNED_BUFFERS
                         fprintf(fp,
-                                "\t\t\tOutputBuffer outptr_%s(&tmpBuf[%s], size_%s);\n",
+                                "\tOutputBuffer outptr_%s(&tmpBuf[%s], size_%s);\n",
                                 var_name,
                                 tmpBufOffset[j].c_str(),
                                 var_name);
@@ -1035,16 +1024,16 @@ int ApiGen::genDecoderImpl(const std::string &filename)
                     }
                     if (pass == PASS_FlushOutput) {
                         fprintf(fp,
-                                "\t\t\toutptr_%s.flush();\n",
+                                "\toutptr_%s.flush();\n",
                                 var_name);
                     }
 #else  // !USE_ALIGNED_BUFFERS
                         fprintf(fp,
-                                "\t\t\tunsigned char *outptr_%s = &tmpBuf[%s];\n",
+                                "\tunsigned char *outptr_%s = &tmpBuf[%s];\n",
                                 var_name,
                                 tmpBufOffset[j].c_str());
                         fprintf(fp,
-                                "\t\t\tmemset(outptr_%s, 0, %s);\n",
+                                "\tmemset(outptr_%s, 0, %s);\n",
                                 var_name,
                                 toString(v->type()->bytes()).c_str());
                     } else if (pass == PASS_FunctionCall) {
@@ -1081,52 +1070,84 @@ int ApiGen::genDecoderImpl(const std::string &filename)
                 if (!e->retval().isVoid() && !e->retval().isPointer()) {
                     if (!totalTmpBuffExist)
                         fprintf(fp,
-                                "\t\t\tsize_t totalTmpSize = sizeof(%s);\n",
+                                "\tsize_t totalTmpSize = sizeof(%s);\n",
                                 retvalType.c_str());
                     else
                         fprintf(fp,
-                                "\t\t\ttotalTmpSize += sizeof(%s);\n",
+                                "\ttotalTmpSize += sizeof(%s);\n",
                                 retvalType.c_str());
 
                     totalTmpBuffExist = true;
                 }
                 if (totalTmpBuffExist) {
                     fprintf(fp,
-                            "\t\t\tunsigned char *tmpBuf = stream->alloc(totalTmpSize);\n");
+                            "\tunsigned char *tmpBuf = stream->alloc(totalTmpSize);\n");
                 }
             }
 
             if (pass == PASS_Epilog) {
                 // send back out pointers data as well as retval
                 if (totalTmpBuffExist) {
-                    fprintf(fp, "\t\t\tstream->flush();\n");
+                    fprintf(fp, "\tstream->flush();\n");
                 }
             }
 
         } // pass;
-        fprintf(fp, "\t\t\tSET_LASTCALL(\"%s\");\n", e->name().c_str());
-        fprintf(fp, "\t\t\tbreak;\n");
-        fprintf(fp, "\t\t}\n");
+        fprintf(fp, "}\n\n");
 
         delete [] tmpBufOffset;
     }
-    fprintf(fp, "\t\t\tdefault:\n");
-    fprintf(fp, "\t\t\t\tunknownOpcode = true;\n");
-    fprintf(fp, "\t\t} //switch\n");
-    if (strstr(m_basename.c_str(), "gl")) {
+
+    fprintf(fp, "const %s_decode_func_t s_decodeTable[] = {\n", m_basename.c_str());
+    for (size_t f = 0; f < n; f++) {
+        fprintf(fp, "\tdecode_%s,\n", at(f).name().c_str());
+    }
+    fprintf(fp, "};\n\n");
+
+    fprintf(fp, "const char* const s_commandNames[] = {\n");
+    for (size_t f = 0; f < n; f++) {
+        fprintf(fp, "\t\"%s\",\n", at(f).name().c_str());
+    }
+    fprintf(fp, "};\n\n");
+    fprintf(fp, "}  // namespace\n\n");
+
+    fprintf(fp, "const char *%s::commandName(uint32_t opcode)\n{\n", classname.c_str());
+    fprintf(fp, "\treturn handles(opcode) ? s_commandNames[opcode - kFirstOpcode] : NULL;\n");
+    fprintf(fp, "}\n\n");
+
+    bool checkGlError = strstr(m_basename.c_str(), "gl") != NULL;
+
+    // decoder loop;
+    fprintf(fp, "size_t %s::decode(void *buf, size_t len, IOStream *stream)\n{\n", classname.c_str());
+    fprintf(fp,
+            "\tsize_t pos = 0;\n"
+            "\tunsigned char *ptr = (unsigned char *)buf;\n"
+            "\twhile (len - pos >= 8) {\n"
+            "\t\tuint32_t opcode = *(uint32_t *)ptr;\n"
+            "\t\tif (!handles(opcode)) break;\n"
+            "\t\tsize_t packetLen = *(uint32_t *)(ptr + 4);\n"
+            "\t\tif (len - pos < packetLen) break;\n"
+            "\t\t%s_decode_func_t func = s_decodeTable[opcode - kFirstOpcode];\n"
+            "\t\t// Runs of the same command are decoded without another table lookup.\n"
+            "\t\tfor (;;) {\n"
+            "\t\t\tfunc(this, ptr, stream);\n",
+            m_basename.c_str());
+    if (checkGlError) {
         fprintf(fp, "#ifdef CHECK_GL_ERROR\n");
-        fprintf(fp, "\tint err = lastCall[0] ? this->glGetError() : GL_NO_ERROR;\n");
-        fprintf(fp, "\tif (err) fprintf(stderr, \"%s Error: 0x%%X in %%s\\n\", err, lastCall);\n", m_basename.c_str());
+        fprintf(fp, "\t\t\tint err = this->glGetError();\n");
+        fprintf(fp, "\t\t\tif (err) fprintf(stderr, \"%s Error: 0x%%X in %%s\\n\", err, s_commandNames[opcode - kFirstOpcode]);\n", m_basename.c_str());
         fprintf(fp, "#endif\n");
     }
-
-    fprintf(fp, "\t\tif (!unknownOpcode) {\n");
-    fprintf(fp, "\t\t\tpos += packetLen;\n");
-    fprintf(fp, "\t\t\tptr += packetLen;\n");
-    fprintf(fp, "\t\t}\n");
-    fprintf(fp, "\t} // while\n");
-    fprintf(fp, "\treturn pos;\n");
-    fprintf(fp, "}\n");
+    fprintf(fp,
+            "\t\t\tpos += packetLen;\n"
+            "\t\t\tptr += packetLen;\n"
+            "\t\t\tif (len - pos < 8 || *(uint32_t *)ptr != opcode) break;\n"
+            "\t\t\tpacketLen = *(uint32_t *)(ptr + 4);\n"
+            "\t\t\tif (len - pos < packetLen) break;\n"
+            "\t\t}\n"
+            "\t} // while\n"
+            "\treturn pos;\n"
+            "}\n");
 
     fclose(fp);
     return 0;
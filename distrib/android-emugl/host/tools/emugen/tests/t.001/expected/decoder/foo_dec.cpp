@@ -20,77 +20,95 @@ typedef unsigned int tsize_t; // Target "size_t", which is 32-bit for now. It ma
 #  define DEBUG(...)  ((void)0)
 #endif
 
-#ifdef CHECK_GLERROR
-#  define SET_LASTCALL(name)  sprintf(lastCall, #name)
-#else
-#  define SET_LASTCALL(name)  ((void)0)
-#endif
-
 using namespace emugl;
 
+namespace {
+
+typedef void (*foo_decode_func_t)(foo_decoder_context_t *ctx, unsigned char *ptr, IOStream *stream);
+
+void decode_fooAlphaFunc(foo_decoder_context_t *ctx, unsigned char *ptr, IOStream *stream)
+{
+	FooInt var_func = Unpack<FooInt,uint32_t>(ptr + 8);
+	FooFloat var_ref = Unpack<FooFloat,uint32_t>(ptr + 8 + 4);
+	DEBUG("foo(%p): fooAlphaFunc(%d %f )\n", stream,var_func, var_ref);
+	ctx->fooAlphaFunc(var_func, var_ref);
+}
+
+void decode_fooIsBuffer(foo_decoder_context_t *ctx, unsigned char *ptr, IOStream *stream)
+{
+	uint32_t size_stuff __attribute__((unused)) = Unpack<uint32_t,uint32_t>(ptr + 8);
+	InputBuffer inptr_stuff(ptr + 8 + 4, size_stuff);
+	size_t totalTmpSize = sizeof(FooBoolean);
+	unsigned char *tmpBuf = stream->alloc(totalTmpSize);
+	DEBUG("foo(%p): fooIsBuffer(%p(%u) )\n", stream,(void*)(inptr_stuff.get()), size_stuff);
+	*(FooBoolean *)(&tmpBuf[0]) = ctx->fooIsBuffer((void*)(inptr_stuff.get()));
+	stream->flush();
+}
+
+void decode_fooUnsupported(foo_decoder_context_t *ctx, unsigned char *ptr, IOStream *stream)
+{
+	uint32_t size_params __attribute__((unused)) = Unpack<uint32_t,uint32_t>(ptr + 8);
+	InputBuffer inptr_params(ptr + 8 + 4, size_params);
+	DEBUG("foo(%p): fooUnsupported(%p(%u) )\n", stream,(void*)(inptr_params.get()), size_params);
+	ctx->fooUnsupported((void*)(inptr_params.get()));
+}
+
+void decode_fooDoEncoderFlush(foo_decoder_context_t *ctx, unsigned char *ptr, IOStream *stream)
+{
+	FooInt var_param = Unpack<FooInt,uint32_t>(ptr + 8);
+	DEBUG("foo(%p): fooDoEncoderFlush(%d )\n", stream,var_param);
+	ctx->fooDoEncoderFlush(var_param);
+}
+
+void decode_fooTakeConstVoidPtrConstPtr(foo_decoder_context_t *ctx, unsigned char *ptr, IOStream *stream)
+{
+	uint32_t size_param __attribute__((unused)) = Unpack<uint32_t,uint32_t>(ptr + 8);
+	InputBuffer inptr_param(ptr + 8 + 4, size_param);
+	DEBUG("foo(%p): fooTakeConstVoidPtrConstPtr(%p(%u) )\n", stream,(const void* const*)(inptr_param.get()), size_param);
+	ctx->fooTakeConstVoidPtrConstPtr((const void* const*)(inptr_param.get()));
+}
+
+const foo_decode_func_t s_decodeTable[] = {
+	decode_fooAlphaFunc,
+	decode_fooIsBuffer,
+	decode_fooUnsupported,
+	decode_fooDoEncoderFlush,
+	decode_fooTakeConstVoidPtrConstPtr,
+};
+
+const char* const s_commandNames[] = {
+	"fooAlphaFunc",
+	"fooIsBuffer",
+	"fooUnsupported",
+	"fooDoEncoderFlush",
+	"fooTakeConstVoidPtrConstPtr",
+};
+
+}  // namespace
+
+const char *foo_decoder_context_t::commandName(uint32_t opcode)
+{
+	return handles(opcode) ? s_commandNames[opcode - kFirstOpcode] : NULL;
+}
+
 size_t foo_decoder_context_t::decode(void *buf, size_t len, IOStream *stream)
 {
-                           
 	size_t pos = 0;
-	if (len < 8) return pos; 
 	unsigned char *ptr = (unsigned char *)buf;
-	bool unknownOpcode = false;  
-#ifdef CHECK_GL_ERROR 
-	char lastCall[256] = {0}; 
-#endif 
-	while ((len - pos >= 8) && !unknownOpcode) {   
-		uint32_t opcode = *(uint32_t *)ptr;   
+	while (len - pos >= 8) {
+		uint32_t opcode = *(uint32_t *)ptr;
+		if (!handles(opcode)) break;
 		size_t packetLen = *(uint32_t *)(ptr + 4);
-		if (len - pos < packetLen)  return pos; 
-		switch(opcode) {
-		case OP_fooAlphaFunc: {
-			FooInt var_func = Unpack<FooInt,uint32_t>(ptr + 8);
-			FooFloat var_ref = Unpack<FooFloat,uint32_t>(ptr + 8 + 4);
-			DEBUG("foo(%p): fooAlphaFunc(%d %f )\n", stream,var_func, var_ref);
-			this->fooAlphaFunc(var_func, var_ref);
-			SET_LASTCALL("fooAlphaFunc");
-			break;
-		}
-		case OP_fooIsBuffer: {
-			uint32_t size_stuff __attribute__((unused)) = Unpack<uint32_t,uint32_t>(ptr + 8);
-			InputBuffer inptr_stuff(ptr + 8 + 4, size_stuff);
-			size_t totalTmpSize = sizeof(FooBoolean);
-			unsigned char *tmpBuf = stream->alloc(totalTmpSize);
-			DEBUG("foo(%p): fooIsBuffer(%p(%u) )\n", stream,(void*)(inptr_stuff.get()), size_stuff);
-			*(FooBoolean *)(&tmpBuf[0]) = 			this->fooIsBuffer((void*)(inptr_stuff.get()));
-			stream->flush();
-			SET_LASTCALL("fooIsBuffer");
-			break;
-		}
-		case OP_fooUnsupported: {
-			uint32_t size_params __attribute__((unused)) = Unpack<uint32_t,uint32_t>(ptr + 8);
-			InputBuffer inptr_params(ptr + 8 + 4, size_params);
-			DEBUG("foo(%p): fooUnsupported(%p(%u) )\n", stream,(void*)(inptr_params.get()), size_params);
-			this->fooUnsupported((void*)(inptr_params.get()));
-			SET_LASTCALL("fooUnsupported");
-			break;
-		}
-		case OP_fooDoEncoderFlush: {
-			FooInt var_param = Unpack<FooInt,uint32_t>(ptr + 8);
-			DEBUG("foo(%p): fooDoEncoderFlush(%d )\n", stream,var_param);
-			this->fooDoEncoderFlush(var_param);
-			SET_LASTCALL("fooDoEncoderFlush");
-			break;
-		}
-		case OP_fooTakeConstVoidPtrConstPtr: {
-			uint32_t size_param __attribute__((unused)) = Unpack<uint32_t,uint32_t>(ptr + 8);
-			InputBuffer inptr_param(ptr + 8 + 4, size_param);
-			DEBUG("foo(%p): fooTakeConstVoidPtrConstPtr(%p(%u) )\n", stream,(const void* const*)(inptr_param.get()), size_param);
-			this->fooTakeConstVoidPtrConstPtr((const void* const*)(inptr_param.get()));
-			SET_LASTCALL("fooTakeConstVoidPtrConstPtr");
-			break;
-		}
-			default:
-				unknownOpcode = true;
-		} //switch
-		if (!unknownOpcode) {
+		if (len - pos < packetLen) break;
+		foo_decode_func_t func = s_decodeTable[opcode - kFirstOpcode];
+		// Runs of the same command are decoded without another table lookup.
+		for (;;) {
+			func(this, ptr, stream);
 			pos += packetLen;
 			ptr += packetLen;
+			if (len - pos < 8 || *(uint32_t *)ptr != opcode) break;
+			packetLen = *(uint32_t *)(ptr + 4);
+			if (len - pos < packetLen) break;
 		}
 	} // while
 	return pos;
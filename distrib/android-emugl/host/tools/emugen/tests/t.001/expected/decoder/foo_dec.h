@@ -13,6 +13,13 @@ struct foo_decoder_context_t : public foo_server_context_t {
 
 	size_t decode(void *buf, size_t bufsize, IOStream *stream);
 
+	// Opcodes handled by decode() are in [kFirstOpcode, kLastOpcode).
+	static const uint32_t kFirstOpcode = 200;
+	static const uint32_t kLastOpcode = 205;
+	static bool handles(uint32_t opcode) { return opcode - kFirstOpcode < kLastOpcode - kFirstOpcode; }
+	// Return the name of the command for |opcode|, or NULL if it is not handled.
+	static const char *commandName(uint32_t opcode);
+
 };
 
 #endif  // GUARD_foo_decoder_context_t
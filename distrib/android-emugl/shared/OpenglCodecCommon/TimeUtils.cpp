@@ -59,6 +59,36 @@ long long GetCurrentTimeMS()
 #endif
 }
 
+long long GetCurrentTimeNS()
+{
+#ifdef _WIN32
+    static LARGE_INTEGER freq;
+    static bool bNotInit = true;
+    if ( bNotInit ) {
+        bNotInit = (QueryPerformanceFrequency( &freq ) == FALSE);
+    }
+    LARGE_INTEGER currVal;
+    QueryPerformanceCounter( &currVal );
+
+    // Split the conversion to avoid overflowing 64 bits.
+    return (currVal.QuadPart / freq.QuadPart) * 1000000000LL +
+           (currVal.QuadPart % freq.QuadPart) * 1000000000LL / freq.QuadPart;
+
+#elif defined(__linux__)
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec * 1000000000LL) + now.tv_nsec;
+
+#else /* Others, e.g. OS X */
+
+    struct timeval now;
+    gettimeofday(&now, NULL);
+    return (now.tv_sec * 1000000000LL) + now.tv_usec * 1000LL;
+
+#endif
+}
+
 void TimeSleepMS(int p_mili)
 {
 #ifdef _WIN32
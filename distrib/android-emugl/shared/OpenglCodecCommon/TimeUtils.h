@@ -17,6 +17,8 @@
 #define _TIME_UTILS_H
 
 long long GetCurrentTimeMS();
+// Same clock as GetCurrentTimeMS(), in nanoseconds.
+long long GetCurrentTimeNS();
 void TimeSleepMS(int p_mili);
 
 #endif
@@ -0,0 +1,281 @@
+// Copyright (C) 2015 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef EMUGL_COMMON_INTEGER_HASH_MAP_H
+#define EMUGL_COMMON_INTEGER_HASH_MAP_H
+
+#include <utility>
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace emugl {
+
+// A hash map from integer keys of type |K| to values of type |V|, meant to
+// replace std::map<K,V> for the object name and handle lookups done on
+// every GL call.
+//
+// It uses open addressing with linear probing in a single array of slots,
+// so that a lookup usually touches one or two cache lines instead of
+// walking a tree of heap-allocated nodes. Erasing an item shifts the
+// following items of its cluster back instead of leaving a tombstone, so
+// name churn doesn't slow down later lookups.
+//
+// The interface is a subset of std::map's, with one difference: inserting
+// or erasing items invalidates all iterators and pointers to values, and
+// iteration order is unspecified.
+template <typename K, typename V>
+class IntegerHashMap {
+    struct Slot;
+
+public:
+    typedef K key_type;
+    typedef V mapped_type;
+    typedef std::pair<K, V> value_type;
+
+    template <typename SlotType, typename ValueType>
+    class Iterator {
+    public:
+        Iterator() : mSlot(NULL), mEnd(NULL) {}
+
+        // Allow converting an iterator to a const_iterator.
+        template <typename S, typename T>
+        Iterator(const Iterator<S, T>& other) :
+                mSlot(other.mSlot), mEnd(other.mEnd) {}
+
+        ValueType& operator*() const { return mSlot->kv; }
+        ValueType* operator->() const { return &mSlot->kv; }
+
+        Iterator& operator++() {
+            mSlot = nextUsed(mSlot + 1, mEnd);
+            return *this;
+        }
+
+        template <typename S, typename T>
+        bool operator==(const Iterator<S, T>& other) const {
+            return mSlot == other.mSlot;
+        }
+        template <typename S, typename T>
+        bool operator!=(const Iterator<S, T>& other) const {
+            return mSlot != other.mSlot;
+        }
+
+    private:
+        friend class IntegerHashMap;
+        template <typename S, typename T> friend class Iterator;
+
+        Iterator(SlotType* slot, SlotType* end) : mSlot(slot), mEnd(end) {}
+
+        SlotType* mSlot;
+        SlotType* mEnd;
+    };
+
+    typedef Iterator<Slot, value_type> iterator;
+    typedef Iterator<const Slot, const value_type> const_iterator;
+
+    IntegerHashMap() : mSlots(NULL), mShift(0), mCount(0) {}
+
+    ~IntegerHashMap() { delete [] mSlots; }
+
+    size_t size() const { return mCount; }
+
+    bool empty() const { return mCount == 0; }
+
+    // Return the number of slots, for tests and benchmarks.
+    size_t capacity() const { return mSlots ? (size_t)1 << mShift : 0; }
+
+    // Remove all items and release the storage.
+    void clear() {
+        delete [] mSlots;
+        mSlots = NULL;
+        mShift = 0;
+        mCount = 0;
+    }
+
+    iterator begin() {
+        return iterator(nextUsed(mSlots, slotsEnd()), slotsEnd());
+    }
+    iterator end() { return iterator(slotsEnd(), slotsEnd()); }
+
+    const_iterator begin() const {
+        return const_iterator(nextUsed(mSlots, slotsEnd()), slotsEnd());
+    }
+    const_iterator end() const {
+        return const_iterator(slotsEnd(), slotsEnd());
+    }
+
+    iterator find(K key) {
+        Slot* slot = findSlot(key);
+        return slot ? iterator(slot, slotsEnd()) : end();
+    }
+
+    const_iterator find(K key) const {
+        const Slot* slot = findSlot(key);
+        return slot ? const_iterator(slot, slotsEnd()) : end();
+    }
+
+    size_t count(K key) const { return findSlot(key) ? 1 : 0; }
+
+    // Insert |item| unless its key is already in the map. Return an
+    // iterator to the item with that key, and true iff it was inserted.
+    std::pair<iterator, bool> insert(const value_type& item) {
+        bool inserted = false;
+        Slot* slot = findOrAddSlot(item.first, &inserted);
+        if (inserted) {
+            slot->kv.second = item.second;
+        }
+        return std::make_pair(iterator(slot, slotsEnd()), inserted);
+    }
+
+    V& operator[](K key) {
+        bool inserted;
+        return findOrAddSlot(key, &inserted)->kv.second;
+    }
+
+    // Erase the item with |key|, return the number of erased items.
+    size_t erase(K key) {
+        Slot* slot = findSlot(key);
+        if (!slot) {
+            return 0;
+        }
+        eraseSlot(slot - mSlots);
+        return 1;
+    }
+
+    void erase(iterator it) { eraseSlot(it.mSlot - mSlots); }
+
+private:
+    struct Slot {
+        Slot() : kv(), used(false) {}
+
+        value_type kv;
+        bool used;
+    };
+
+    // Same type as mShift, so that both can be mixed in expressions.
+    static const size_t kMinShift = 3;
+
+    template <typename SlotType>
+    static SlotType* nextUsed(SlotType* slot, SlotType* end) {
+        while (slot != end && !slot->used) {
+            ++slot;
+        }
+        return slot;
+    }
+
+    Slot* slotsEnd() const { return mSlots + capacity(); }
+
+    size_t mask() const { return ((size_t)1 << mShift) - 1; }
+
+    // Fibonacci hashing, so that consecutive names, which are the common
+    // case, are spread over the table.
+    size_t hash(K key) const {
+        uint64_t h = (uint64_t)key * 0x9e3779b97f4a7c15ULL;
+        return (size_t)(h >> (64 - mShift));
+    }
+
+    Slot* findSlot(K key) const {
+        if (!mCount) {
+            return NULL;
+        }
+        size_t mask = this->mask();
+        for (size_t n = hash(key); ; n = (n + 1) & mask) {
+            Slot* slot = &mSlots[n];
+            if (!slot->used) {
+                return NULL;
+            }
+            if (slot->kv.first == key) {
+                return slot;
+            }
+        }
+    }
+
+    Slot* findOrAddSlot(K key, bool* inserted) {
+        // Grow when more than half of the slots are used; linear probing
+        // degrades quickly above that.
+        if (2 * (mCount + 1) > capacity()) {
+            Slot* slot = findSlot(key);
+            if (slot) {
+                *inserted = false;
+                return slot;
+            }
+            rehash(mShift ? mShift + 1 : kMinShift);
+        }
+        size_t mask = this->mask();
+        for (size_t n = hash(key); ; n = (n + 1) & mask) {
+            Slot* slot = &mSlots[n];
+            if (!slot->used) {
+                slot->used = true;
+                slot->kv.first = key;
+                mCount++;
+                *inserted = true;
+                return slot;
+            }
+            if (slot->kv.first == key) {
+                *inserted = false;
+                return slot;
+            }
+        }
+    }
+
+    void eraseSlot(size_t hole) {
+        // Move back any following item of the cluster whose home slot is
+        // not between the hole and itself, so that lookups never stop
+        // early at the hole.
+        size_t mask = this->mask();
+        for (size_t n = (hole + 1) & mask; mSlots[n].used; n = (n + 1) & mask) {
+            size_t home = hash(mSlots[n].kv.first);
+            if (((n - home) & mask) >= ((n - hole) & mask)) {
+                mSlots[hole].kv = mSlots[n].kv;
+                hole = n;
+            }
+        }
+        // Release what the value holds right away, e.g. a smart pointer.
+        mSlots[hole].kv = value_type();
+        mSlots[hole].used = false;
+        mCount--;
+    }
+
+    void rehash(size_t newShift) {
+        Slot* oldSlots = mSlots;
+        size_t oldCapacity = capacity();
+        mSlots = new Slot[(size_t)1 << newShift];
+        mShift = newShift;
+        size_t mask = this->mask();
+        for (size_t n = 0; n < oldCapacity; ++n) {
+            if (!oldSlots[n].used) {
+                continue;
+            }
+            size_t m = hash(oldSlots[n].kv.first);
+            while (mSlots[m].used) {
+                m = (m + 1) & mask;
+            }
+            mSlots[m].kv = oldSlots[n].kv;
+            mSlots[m].used = true;
+        }
+        delete [] oldSlots;
+    }
+
+    Slot* mSlots;
+    size_t mShift;
+    size_t mCount;
+
+    // Not copyable.
+    IntegerHashMap(const IntegerHashMap&);
+    IntegerHashMap& operator=(const IntegerHashMap&);
+};
+
+}  // namespace emugl
+
+#endif  // EMUGL_COMMON_INTEGER_HASH_MAP_H
@@ -0,0 +1,221 @@
+// Copyright (C) 2015 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "emugl/common/integer_hash_map.h"
+
+#include "emugl/common/smart_ptr.h"
+
+#include <gtest/gtest.h>
+
+#include <map>
+#include <vector>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/time.h>
+
+namespace emugl {
+
+namespace {
+
+typedef IntegerHashMap<uint32_t, int> IntMap;
+
+class Counted {
+public:
+    explicit Counted(int* count) : mCount(count) { (*mCount)++; }
+    ~Counted() { (*mCount)--; }
+private:
+    int* mCount;
+};
+
+double nowMs() {
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec * 1000.0 + tv.tv_usec / 1000.0;
+}
+
+// Simulates the names a GL app uses: a working set of live objects that
+// are looked up many times per frame, while some are deleted and new ones
+// are created with increasing names. Return a checksum of the lookups.
+template <class Map>
+unsigned simulateChurn(Map* map, int liveObjects, int frames) {
+    const int kLookupsPerFrame = 2000;
+    const int kChurnPerFrame = 20;
+    std::vector<uint32_t> live;
+    uint32_t nextName = 1;
+    for (int n = 0; n < liveObjects; ++n) {
+        (*map)[nextName] = nextName;
+        live.push_back(nextName++);
+    }
+    unsigned checksum = 0;
+    // A cheap generator, so that it doesn't dominate the timings.
+    uint32_t random = 1;
+    for (int frame = 0; frame < frames; ++frame) {
+        for (int n = 0; n < kLookupsPerFrame; ++n) {
+            random = random * 1103515245 + 12345;
+            uint32_t name = live[(random >> 8) % live.size()];
+            typename Map::iterator it = map->find(name);
+            if (it != map->end()) {
+                checksum += it->second;
+            }
+        }
+        for (int n = 0; n < kChurnPerFrame; ++n) {
+            random = random * 1103515245 + 12345;
+            size_t index = (random >> 8) % live.size();
+            map->erase(live[index]);
+            (*map)[nextName] = nextName;
+            live[index] = nextName++;
+        }
+    }
+    return checksum;
+}
+
+}  // namespace
+
+TEST(IntegerHashMap, Empty) {
+    IntMap map;
+    EXPECT_TRUE(map.empty());
+    EXPECT_EQ(0U, map.size());
+    EXPECT_TRUE(map.begin() == map.end());
+    EXPECT_TRUE(map.find(0) == map.end());
+    EXPECT_EQ(0U, map.erase(1));
+}
+
+TEST(IntegerHashMap, InsertFindErase) {
+    IntMap map;
+    const uint32_t kCount = 10000;
+    for (uint32_t n = 0; n < kCount; ++n) {
+        map[n * 7] = n;
+    }
+    EXPECT_EQ(kCount, map.size());
+    EXPECT_LE(2 * map.size(), map.capacity());
+
+    for (uint32_t n = 0; n < kCount; ++n) {
+        IntMap::iterator it = map.find(n * 7);
+        ASSERT_TRUE(it != map.end()) << "For key " << n * 7;
+        EXPECT_EQ(n * 7, it->first);
+        EXPECT_EQ((int)n, it->second);
+        EXPECT_EQ(0U, map.count(n * 7 + 1));
+    }
+
+    // Erase every other item.
+    for (uint32_t n = 0; n < kCount; n += 2) {
+        EXPECT_EQ(1U, map.erase(n * 7));
+    }
+    EXPECT_EQ(kCount / 2, map.size());
+    for (uint32_t n = 0; n < kCount; ++n) {
+        EXPECT_EQ(n & 1, map.count(n * 7)) << "For key " << n * 7;
+    }
+}
+
+TEST(IntegerHashMap, InsertDoesNotReplace) {
+    IntMap map;
+    EXPECT_TRUE(map.insert(std::make_pair(5U, 1)).second);
+    std::pair<IntMap::iterator, bool> result =
+            map.insert(std::make_pair(5U, 2));
+    EXPECT_FALSE(result.second);
+    EXPECT_EQ(1, result.first->second);
+    map[5] = 3;
+    EXPECT_EQ(3, map.find(5)->second);
+    EXPECT_EQ(1U, map.size());
+}
+
+TEST(IntegerHashMap, Iterate) {
+    IntMap map;
+    int sum = 0;
+    for (int n = 1; n <= 100; ++n) {
+        map[n] = n;
+        sum += n;
+    }
+    const IntMap& constMap = map;
+    int count = 0;
+    for (IntMap::const_iterator it = constMap.begin();
+         it != constMap.end();
+         ++it) {
+        EXPECT_EQ((int)it->first, it->second);
+        sum -= it->second;
+        count++;
+    }
+    EXPECT_EQ(100, count);
+    EXPECT_EQ(0, sum);
+
+    map.erase(map.find(50));
+    EXPECT_EQ(99U, map.size());
+    EXPECT_EQ(0U, map.count(50));
+}
+
+TEST(IntegerHashMap, EraseReleasesValues) {
+    int live = 0;
+    IntegerHashMap<uint64_t, SmartPtr<Counted> > map;
+    for (uint64_t n = 0; n < 100; ++n) {
+        map[n << 32] = SmartPtr<Counted>(new Counted(&live));
+    }
+    EXPECT_EQ(100, live);
+    for (uint64_t n = 0; n < 100; n += 2) {
+        map.erase(n << 32);
+    }
+    EXPECT_EQ(50, live);
+    map.clear();
+    EXPECT_EQ(0, live);
+    EXPECT_TRUE(map.empty());
+}
+
+TEST(IntegerHashMap, MatchesStdMapUnderChurn) {
+    IntMap map;
+    std::map<uint32_t, int> expected;
+    srand(1);
+    for (int n = 0; n < 100000; ++n) {
+        // Small keys collide often, which exercises erasing in clusters.
+        uint32_t key = rand() % 512;
+        int op = rand() % 3;
+        if (op == 0) {
+            EXPECT_EQ(expected.erase(key), map.erase(key));
+        } else if (op == 1) {
+            map[key] = n;
+            expected[key] = n;
+        } else {
+            IntMap::iterator it = map.find(key);
+            std::map<uint32_t, int>::iterator it2 = expected.find(key);
+            ASSERT_EQ(it2 == expected.end(), it == map.end());
+            if (it != map.end()) {
+                EXPECT_EQ(it2->second, it->second);
+            }
+        }
+        ASSERT_EQ(expected.size(), map.size());
+    }
+}
+
+// Compares lookups with std::map for a realistic working set of names.
+// Run with --gtest_also_run_disabled_tests.
+TEST(IntegerHashMap, DISABLED_ChurnBenchmark) {
+    const int kFrames = 2000;
+    const int kSizes[] = { 64, 1024, 16384 };
+    for (size_t n = 0; n < sizeof(kSizes) / sizeof(kSizes[0]); ++n) {
+        std::map<uint32_t, uint32_t> treeMap;
+        double start = nowMs();
+        unsigned treeSum = simulateChurn(&treeMap, kSizes[n], kFrames);
+        double treeMs = nowMs() - start;
+
+        IntegerHashMap<uint32_t, uint32_t> hashMap;
+        start = nowMs();
+        unsigned hashSum = simulateChurn(&hashMap, kSizes[n], kFrames);
+        double hashMs = nowMs() - start;
+
+        EXPECT_EQ(treeSum, hashSum);
+        printf("%6d live names: std::map %.1f ms, IntegerHashMap %.1f ms\n",
+               kSizes[n], treeMs, hashMs);
+    }
+}
+
+}  // namespace emugl
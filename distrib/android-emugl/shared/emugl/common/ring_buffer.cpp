@@ -0,0 +1,114 @@
+// Copyright (C) 2015 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "emugl/common/ring_buffer.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+namespace emugl {
+
+namespace {
+
+// The positions are published with release stores, and read with acquire
+// loads, so that the bytes they cover are visible to the other side.
+size_t loadAcquire(const size_t* pos) {
+    return __atomic_load_n(pos, __ATOMIC_ACQUIRE);
+}
+
+void storeRelease(size_t* pos, size_t value) {
+    __atomic_store_n(pos, value, __ATOMIC_RELEASE);
+}
+
+size_t roundUpToPowerOf2(size_t value) {
+    size_t result = 1U;
+    while (result < value) {
+        result <<= 1;
+    }
+    return result;
+}
+
+}  // namespace
+
+RingBuffer::RingBuffer(size_t capacity) :
+        mData(NULL),
+        mMask(roundUpToPowerOf2(capacity) - 1U),
+        mWritePos(0),
+        mReadPos(0) {
+    mData = static_cast<uint8_t*>(::malloc(mMask + 1U));
+}
+
+RingBuffer::~RingBuffer() {
+    ::free(mData);
+}
+
+size_t RingBuffer::writableBytes() const {
+    return capacity() - (mWritePos - loadAcquire(&mReadPos));
+}
+
+size_t RingBuffer::write(const void* data, size_t size) {
+    size_t avail = writableBytes();
+    if (size > avail) {
+        size = avail;
+    }
+    if (!size) {
+        return 0;
+    }
+    size_t offset = mWritePos & mMask;
+    size_t first = capacity() - offset;
+    if (first > size) {
+        first = size;
+    }
+    ::memcpy(mData + offset, data, first);
+    ::memcpy(mData, static_cast<const uint8_t*>(data) + first, size - first);
+    storeRelease(&mWritePos, mWritePos + size);
+    return size;
+}
+
+size_t RingBuffer::readableBytes() const {
+    return loadAcquire(&mWritePos) - mReadPos;
+}
+
+size_t RingBuffer::read(void* data, size_t size) {
+    size_t avail = readableBytes();
+    if (size > avail) {
+        size = avail;
+    }
+    if (!size) {
+        return 0;
+    }
+    size_t offset = mReadPos & mMask;
+    size_t first = capacity() - offset;
+    if (first > size) {
+        first = size;
+    }
+    ::memcpy(data, mData + offset, first);
+    ::memcpy(static_cast<uint8_t*>(data) + first, mData, size - first);
+    storeRelease(&mReadPos, mReadPos + size);
+    return size;
+}
+
+const uint8_t* RingBuffer::peek(size_t* size) const {
+    size_t avail = readableBytes();
+    size_t offset = mReadPos & mMask;
+    size_t first = capacity() - offset;
+    *size = (avail < first) ? avail : first;
+    return mData + offset;
+}
+
+void RingBuffer::consume(size_t size) {
+    storeRelease(&mReadPos, mReadPos + size);
+}
+
+}  // namespace emugl
@@ -0,0 +1,84 @@
+// Copyright (C) 2015 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef EMUGL_COMMON_RING_BUFFER_H
+#define EMUGL_COMMON_RING_BUFFER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace emugl {
+
+// A lock-free, single-producer / single-consumer byte ring.
+//
+// One thread can call write() and writableBytes() while another one calls
+// read(), peek(), consume() and readableBytes(), without any additional
+// locking. Neither side ever blocks: when the ring is full or empty, the
+// methods simply return 0, and it is up to the caller to wait for the other
+// side, e.g. with a ConditionVariable.
+//
+// The read and write positions only grow, and wrap around naturally, so the
+// ring can be filled completely.
+class RingBuffer {
+public:
+    // Constructor. |capacity| is rounded up to the next power of 2. Check
+    // isValid() before using the ring, since allocating it can fail.
+    explicit RingBuffer(size_t capacity);
+
+    // Destructor.
+    ~RingBuffer();
+
+    // Return true if the ring could be allocated.
+    bool isValid() const { return mData != NULL; }
+
+    // Return the capacity of the ring, in bytes.
+    size_t capacity() const { return mMask + 1U; }
+
+    // Producer side: return the number of bytes that can be written.
+    size_t writableBytes() const;
+
+    // Producer side: copy up to |size| bytes from |data| into the ring,
+    // and return the number of bytes actually copied.
+    size_t write(const void* data, size_t size);
+
+    // Consumer side: return the number of bytes that can be read.
+    size_t readableBytes() const;
+
+    // Consumer side: copy up to |size| bytes from the ring to |data|,
+    // and return the number of bytes actually copied.
+    size_t read(void* data, size_t size);
+
+    // Consumer side: return a pointer to the next contiguous readable bytes
+    // in the ring, and their count in |*size|. The bytes stay in the ring
+    // until consume() is called. |*size| is 0 if the ring is empty.
+    const uint8_t* peek(size_t* size) const;
+
+    // Consumer side: release |size| bytes previously returned by peek().
+    void consume(size_t size);
+
+private:
+    RingBuffer(const RingBuffer& other);
+    RingBuffer& operator=(const RingBuffer& other);
+
+    uint8_t* mData;
+    size_t mMask;
+    // Total number of bytes written. Only modified by the producer.
+    size_t mWritePos;
+    // Total number of bytes read. Only modified by the consumer.
+    size_t mReadPos;
+};
+
+}  // namespace emugl
+
+#endif  // EMUGL_COMMON_RING_BUFFER_H
@@ -0,0 +1,173 @@
+// Copyright (C) 2015 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "emugl/common/ring_buffer.h"
+
+#include "emugl/common/testing/test_thread.h"
+
+#include <gtest/gtest.h>
+
+#include <string.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sched.h>
+#endif
+
+namespace emugl {
+
+namespace {
+
+const size_t kStreamSize = 1000000U;
+
+// Let the other thread run when the ring is full or empty.
+void yieldThread() {
+#ifdef _WIN32
+    ::Sleep(0);
+#else
+    ::sched_yield();
+#endif
+}
+
+// The byte at position |pos| of the test stream.
+uint8_t streamByte(size_t pos) {
+    return static_cast<uint8_t>((pos * 7U) ^ (pos >> 8));
+}
+
+void* producerFunction(void* param) {
+    RingBuffer* ring = static_cast<RingBuffer*>(param);
+    uint8_t chunk[97];
+    size_t pos = 0;
+    while (pos < kStreamSize) {
+        size_t size = sizeof(chunk);
+        if (size > kStreamSize - pos) {
+            size = kStreamSize - pos;
+        }
+        for (size_t n = 0; n < size; ++n) {
+            chunk[n] = streamByte(pos + n);
+        }
+        size_t done = 0;
+        while (done < size) {
+            size_t count = ring->write(chunk + done, size - done);
+            if (!count) {
+                yieldThread();
+            }
+            done += count;
+        }
+        pos += size;
+    }
+    return NULL;
+}
+
+}  // namespace
+
+TEST(RingBuffer, CapacityIsRoundedUp) {
+    EXPECT_EQ(1U, RingBuffer(1U).capacity());
+    EXPECT_EQ(64U, RingBuffer(64U).capacity());
+    EXPECT_EQ(128U, RingBuffer(65U).capacity());
+}
+
+TEST(RingBuffer, IsValid) {
+    EXPECT_TRUE(RingBuffer(16U).isValid());
+    // Larger than anything malloc() can return.
+    EXPECT_FALSE(RingBuffer(~(size_t)0 / 2U).isValid());
+}
+
+TEST(RingBuffer, Empty) {
+    RingBuffer ring(16U);
+    uint8_t buf[4];
+    size_t size = 1U;
+    EXPECT_EQ(0U, ring.readableBytes());
+    EXPECT_EQ(16U, ring.writableBytes());
+    EXPECT_EQ(0U, ring.read(buf, sizeof(buf)));
+    ring.peek(&size);
+    EXPECT_EQ(0U, size);
+}
+
+TEST(RingBuffer, FillCompletely) {
+    RingBuffer ring(8U);
+    EXPECT_EQ(8U, ring.write("0123456789", 10U));
+    EXPECT_EQ(0U, ring.writableBytes());
+    EXPECT_EQ(0U, ring.write("x", 1U));
+    EXPECT_EQ(8U, ring.readableBytes());
+
+    char buf[16] = {};
+    EXPECT_EQ(8U, ring.read(buf, sizeof(buf)));
+    EXPECT_STREQ("01234567", buf);
+    EXPECT_EQ(8U, ring.writableBytes());
+}
+
+TEST(RingBuffer, WrapAround) {
+    RingBuffer ring(8U);
+    char buf[8] = {};
+    EXPECT_EQ(6U, ring.write("abcdef", 6U));
+    EXPECT_EQ(4U, ring.read(buf, 4U));
+    // This write wraps around the end of the storage.
+    EXPECT_EQ(5U, ring.write("ghijk", 5U));
+    EXPECT_EQ(7U, ring.readableBytes());
+
+    memset(buf, 0, sizeof(buf));
+    EXPECT_EQ(7U, ring.read(buf, 7U));
+    EXPECT_STREQ("efghijk", buf);
+}
+
+TEST(RingBuffer, PeekAndConsume) {
+    RingBuffer ring(8U);
+    char buf[8];
+    EXPECT_EQ(6U, ring.write("abcdef", 6U));
+    EXPECT_EQ(6U, ring.read(buf, 6U));
+    EXPECT_EQ(5U, ring.write("ghijk", 5U));
+
+    // The first peek stops at the end of the storage.
+    size_t size = 0;
+    const uint8_t* data = ring.peek(&size);
+    ASSERT_EQ(2U, size);
+    EXPECT_EQ(0, memcmp("gh", data, size));
+    ring.consume(size);
+
+    data = ring.peek(&size);
+    ASSERT_EQ(3U, size);
+    EXPECT_EQ(0, memcmp("ijk", data, size));
+    ring.consume(size);
+    EXPECT_EQ(0U, ring.readableBytes());
+}
+
+TEST(RingBuffer, TwoThreads) {
+    RingBuffer ring(4096U);
+    TestThread* thread = new TestThread(producerFunction, &ring);
+
+    uint8_t chunk[251];
+    size_t pos = 0;
+    size_t mismatches = 0;
+    while (pos < kStreamSize) {
+        size_t size = ring.read(chunk, sizeof(chunk));
+        if (!size) {
+            yieldThread();
+        }
+        for (size_t n = 0; n < size; ++n) {
+            if (chunk[n] != streamByte(pos + n)) {
+                mismatches++;
+            }
+        }
+        pos += size;
+    }
+    thread->join();
+    delete thread;
+
+    EXPECT_EQ(0U, mismatches);
+    EXPECT_EQ(0U, ring.readableBytes());
+}
+
+}  // namespace emugl
@@ -96,6 +96,9 @@ typedef FAST_FLOAT FLOAT_MULT_TYPE; /* preferred floating type */
 
 EXTERN(void) jpeg_fdct_islow JPP((DCTELEM * data));
 EXTERN(void) jpeg_fdct_ifast JPP((DCTELEM * data));
+#ifdef ANDROID_INTELSSE2_FDCT
+EXTERN(void) jpeg_fdct_ifast_intelsse JPP((DCTELEM * data));
+#endif
 EXTERN(void) jpeg_fdct_float JPP((FAST_FLOAT * data));
 
 EXTERN(void) jpeg_idct_islow
@@ -0,0 +1,171 @@
+/*
+ * Copyright (C) 2015 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * SSE2 version of the fast integer forward DCT in jfdctfst.c.
+ *
+ * The computation is the same as jpeg_fdct_ifast(), done on eight rows (then
+ * eight columns) at once in 16-bit lanes. The input samples are in the range
+ * -128..127, which keeps all intermediate values of the AA&N method within
+ * 16 bits. jfdctfst.c multiplies by constants with 8 fractional bits and
+ * truncates the result, which is exactly what _mm_mulhi_epi16() computes when
+ * the constant is pre-shifted by 8 bits. Constants that don't fit in 16 bits
+ * once shifted are applied as (x + x * (c - 256) / 256). The output is thus
+ * identical to the one of jpeg_fdct_ifast().
+ */
+
+#define JPEG_INTERNALS
+#include "jinclude.h"
+#include "jpeglib.h"
+#include "jdct.h"		/* Private declarations for DCT subsystem */
+
+#ifdef ANDROID_INTELSSE2_FDCT
+#include <emmintrin.h>
+
+#if DCTSIZE != 8
+  Sorry, this code only copes with 8x8 DCTs. /* deliberate syntax err */
+#endif
+
+/* Constants of jfdctfst.c (CONST_BITS == 8), shifted for _mm_mulhi_epi16(). */
+#define SSE_0_382683433  (98 << 8)
+#define SSE_0_541196100  (-117 * 256)
+#define SSE_0_707106781  (-75 * 256)
+#define SSE_1_306562965  ((334 - 256) << 8)
+
+/* MULTIPLY() of jfdctfst.c for constants below 1. */
+#define MUL_LOW(x, k)   _mm_mulhi_epi16((x), _mm_set1_epi16(k))
+/* MULTIPLY() of jfdctfst.c for constants that are offset by 256. */
+#define MUL_HIGH(x, k)  _mm_add_epi16((x), _mm_mulhi_epi16((x), _mm_set1_epi16(k)))
+
+/* Transposes an 8x8 matrix of 16-bit values. */
+LOCAL(void)
+transpose_8x8 (__m128i * m)
+{
+  __m128i a0 = _mm_unpacklo_epi16(m[0], m[1]);
+  __m128i a1 = _mm_unpackhi_epi16(m[0], m[1]);
+  __m128i a2 = _mm_unpacklo_epi16(m[2], m[3]);
+  __m128i a3 = _mm_unpackhi_epi16(m[2], m[3]);
+  __m128i a4 = _mm_unpacklo_epi16(m[4], m[5]);
+  __m128i a5 = _mm_unpackhi_epi16(m[4], m[5]);
+  __m128i a6 = _mm_unpacklo_epi16(m[6], m[7]);
+  __m128i a7 = _mm_unpackhi_epi16(m[6], m[7]);
+
+  __m128i b0 = _mm_unpacklo_epi32(a0, a2);
+  __m128i b1 = _mm_unpackhi_epi32(a0, a2);
+  __m128i b2 = _mm_unpacklo_epi32(a1, a3);
+  __m128i b3 = _mm_unpackhi_epi32(a1, a3);
+  __m128i b4 = _mm_unpacklo_epi32(a4, a6);
+  __m128i b5 = _mm_unpackhi_epi32(a4, a6);
+  __m128i b6 = _mm_unpacklo_epi32(a5, a7);
+  __m128i b7 = _mm_unpackhi_epi32(a5, a7);
+
+  m[0] = _mm_unpacklo_epi64(b0, b4);
+  m[1] = _mm_unpackhi_epi64(b0, b4);
+  m[2] = _mm_unpacklo_epi64(b1, b5);
+  m[3] = _mm_unpackhi_epi64(b1, b5);
+  m[4] = _mm_unpacklo_epi64(b2, b6);
+  m[5] = _mm_unpackhi_epi64(b2, b6);
+  m[6] = _mm_unpacklo_epi64(b3, b7);
+  m[7] = _mm_unpackhi_epi64(b3, b7);
+}
+
+/* One pass of the AA&N DCT, on eight vectors of eight lanes each. Element 'k'
+ * of each lane's 1-D input is in d[k]; outputs are stored back into d[].
+ */
+LOCAL(void)
+fdct_pass (__m128i * d)
+{
+  __m128i tmp0, tmp1, tmp2, tmp3, tmp4, tmp5, tmp6, tmp7;
+  __m128i tmp10, tmp11, tmp12, tmp13;
+  __m128i z1, z2, z3, z4, z5, z11, z13;
+
+  tmp0 = _mm_add_epi16(d[0], d[7]);
+  tmp7 = _mm_sub_epi16(d[0], d[7]);
+  tmp1 = _mm_add_epi16(d[1], d[6]);
+  tmp6 = _mm_sub_epi16(d[1], d[6]);
+  tmp2 = _mm_add_epi16(d[2], d[5]);
+  tmp5 = _mm_sub_epi16(d[2], d[5]);
+  tmp3 = _mm_add_epi16(d[3], d[4]);
+  tmp4 = _mm_sub_epi16(d[3], d[4]);
+
+  /* Even part */
+
+  tmp10 = _mm_add_epi16(tmp0, tmp3);
+  tmp13 = _mm_sub_epi16(tmp0, tmp3);
+  tmp11 = _mm_add_epi16(tmp1, tmp2);
+  tmp12 = _mm_sub_epi16(tmp1, tmp2);
+
+  d[0] = _mm_add_epi16(tmp10, tmp11);
+  d[4] = _mm_sub_epi16(tmp10, tmp11);
+
+  z1 = MUL_HIGH(_mm_add_epi16(tmp12, tmp13), SSE_0_707106781);
+  d[2] = _mm_add_epi16(tmp13, z1);
+  d[6] = _mm_sub_epi16(tmp13, z1);
+
+  /* Odd part */
+
+  tmp10 = _mm_add_epi16(tmp4, tmp5);
+  tmp11 = _mm_add_epi16(tmp5, tmp6);
+  tmp12 = _mm_add_epi16(tmp6, tmp7);
+
+  z5 = MUL_LOW(_mm_sub_epi16(tmp10, tmp12), SSE_0_382683433);
+  z2 = _mm_add_epi16(MUL_HIGH(tmp10, SSE_0_541196100), z5);
+  z4 = _mm_add_epi16(MUL_HIGH(tmp12, SSE_1_306562965), z5);
+  z3 = MUL_HIGH(tmp11, SSE_0_707106781);
+
+  z11 = _mm_add_epi16(tmp7, z3);
+  z13 = _mm_sub_epi16(tmp7, z3);
+
+  d[5] = _mm_add_epi16(z13, z2);
+  d[3] = _mm_sub_epi16(z13, z2);
+  d[1] = _mm_add_epi16(z11, z4);
+  d[7] = _mm_sub_epi16(z11, z4);
+}
+
+/*
+ * Perform the forward DCT on one block of samples.
+ */
+
+GLOBAL(void)
+jpeg_fdct_ifast_intelsse (DCTELEM * data)
+{
+  __m128i m[DCTSIZE];
+  int i;
+
+  /* Load rows, narrowing samples to 16 bits. */
+  for (i = 0; i < DCTSIZE; i++) {
+    const __m128i* row = (const __m128i*) (data + i * DCTSIZE);
+    m[i] = _mm_packs_epi32(_mm_loadu_si128(row), _mm_loadu_si128(row + 1));
+  }
+
+  /* Pass 1: process rows (lane = row, vector = column). */
+  transpose_8x8(m);
+  fdct_pass(m);
+
+  /* Pass 2: process columns (lane = column, vector = row). */
+  transpose_8x8(m);
+  fdct_pass(m);
+
+  /* Store rows, widening coefficients back to DCTELEM. */
+  for (i = 0; i < DCTSIZE; i++) {
+    __m128i* row = (__m128i*) (data + i * DCTSIZE);
+    const __m128i sign = _mm_srai_epi16(m[i], 15);
+    _mm_storeu_si128(row, _mm_unpacklo_epi16(m[i], sign));
+    _mm_storeu_si128(row + 1, _mm_unpackhi_epi16(m[i], sign));
+  }
+}
+
+#endif /* ANDROID_INTELSSE2_FDCT */
@@ -14,6 +14,8 @@
 #include "hw/android/goldfish/device.h"
 #include "hw/hw.h"
 #include "audio/audio.h"
+#include "qemu/atomic.h"
+#include "qemu/timer.h"
 #include "android/qemu-debug.h"
 #include "android/globals.h"
 
@@ -69,6 +71,34 @@ enum {
     AUDIO_INT_READ_BUFFER_FULL     = 1U << 2,
 };
 
+/* When the audio subsystem runs its own thread (see AUD_is_threaded()), the
+ * output callback can't touch the device state anymore. The MMIO handlers
+ * then copy the guest buffers into a single-producer/single-consumer ring,
+ * which the output callback drains from the audio thread. A guest buffer is
+ * reported empty as soon as all its data is in the ring, so the ring size
+ * bounds the additional latency (16 KB is ~93 ms of 44.1 kHz stereo).
+ *
+ * 'head' is only written by the main thread, 'tail' only by the audio
+ * thread. To flush the ring, the main thread can't move 'tail', so it
+ * records the current 'head' in 'reset_head' and bumps 'reset_gen'; the
+ * audio thread applies the reset the next time it runs.
+ */
+#define  AUDIO_RING_SIZE   16384    /* must be a power of 2 */
+#define  AUDIO_RING_MASK   (AUDIO_RING_SIZE - 1)
+
+/* How often the ring is refilled when the guest buffers didn't fit */
+#define  AUDIO_RING_REFILL_NS  (5 * 1000 * 1000)
+
+struct goldfish_audio_ring {
+    uint8_t   data[AUDIO_RING_SIZE];
+    uint32_t  head;
+    uint32_t  tail;
+    uint32_t  reset_head;
+    uint32_t  reset_gen;
+    /* last reset_gen applied by the audio thread */
+    uint32_t  reset_seen;
+};
+
 struct goldfish_audio_buff {
     uint64_t  address;
     uint32_t  length;
@@ -109,6 +139,11 @@ struct goldfish_audio_state {
     struct goldfish_audio_buff  out_buff2[1];
     struct goldfish_audio_buff  in_buff[1];
 
+    // ring used to feed the audio thread, and timer used to refill it, or
+    // NULL if the audio subsystem isn't threaded
+    struct goldfish_audio_ring*  out_ring;
+    QEMUTimer*  out_timer;
+
     // for QEMU sound output
     QEMUSoundCard card;
     SWVoiceOut *voice;
@@ -195,6 +230,83 @@ goldfish_audio_buff_send( struct goldfish_audio_buff*  b, int  free, struct gold
     return ret;
 }
 
+/* Appends up to 'len' bytes to the ring, returns the number of bytes
+ * appended. Called from the main thread only. */
+static int
+goldfish_audio_ring_push( struct goldfish_audio_ring*  r, const uint8_t*  data, int  len )
+{
+    uint32_t  head = r->head;
+    uint32_t  avail = AUDIO_RING_SIZE - (head - atomic_mb_read(&r->tail));
+    uint32_t  first;
+
+    if ((uint32_t)len > avail)
+        len = avail;
+
+    first = AUDIO_RING_SIZE - (head & AUDIO_RING_MASK);
+    if (first > (uint32_t)len)
+        first = len;
+    memcpy(r->data + (head & AUDIO_RING_MASK), data, first);
+    memcpy(r->data, data + first, len - first);
+
+    atomic_mb_set(&r->head, head + len);
+    return len;
+}
+
+/* Drops all data currently in the ring. Called from the main thread only. */
+static void
+goldfish_audio_ring_reset( struct goldfish_audio_ring*  r )
+{
+    r->reset_head = r->head;
+    smp_wmb();
+    atomic_mb_set(&r->reset_gen, r->reset_gen + 1);
+}
+
+/* Sends up to 'free' bytes from the ring to the audio output. Called from
+ * the audio thread only. */
+static void
+goldfish_audio_ring_pop( struct goldfish_audio_ring*  r, int  free, struct goldfish_audio_state*  s )
+{
+    uint32_t  gen = atomic_mb_read(&r->reset_gen);
+    uint32_t  head, tail;
+
+    if (gen != r->reset_seen) {
+        smp_rmb();
+        atomic_mb_set(&r->tail, r->reset_head);
+        r->reset_seen = gen;
+    }
+
+    head = atomic_mb_read(&r->head);
+    tail = r->tail;
+    while (free > 0 && tail != head) {
+        uint32_t  offset = tail & AUDIO_RING_MASK;
+        int       len = head - tail;
+        int       written;
+
+        if (len > AUDIO_RING_SIZE - (int)offset)
+            len = AUDIO_RING_SIZE - offset;
+        if (len > free)
+            len = free;
+
+        written = AUD_write(s->voice, r->data + offset, len);
+        if (written == 0)
+            break;
+
+        tail += written;
+        free -= written;
+    }
+    atomic_mb_set(&r->tail, tail);
+}
+
+static int
+goldfish_audio_buff_push( struct goldfish_audio_buff*  b, struct goldfish_audio_ring*  r )
+{
+    int  ret = goldfish_audio_ring_push(r, b->data + b->offset, b->length);
+
+    b->offset += ret;
+    b->length -= ret;
+    return ret;
+}
+
 static int
 goldfish_audio_buff_available( struct goldfish_audio_buff*  b )
 {
@@ -221,6 +333,45 @@ goldfish_audio_buff_recv( struct goldfish_audio_buff*  b, int  avail, struct gol
     return read;
 }
 
+/* Moves as much data as possible from the pending guest buffers to the ring,
+ * and reports the buffers that were fully queued as empty. If the ring is
+ * full, tries again later from out_timer. */
+static void
+goldfish_audio_refill( struct goldfish_audio_state*  s )
+{
+    int  new_status = 0;
+
+    while (s->current_buffer == 1 || s->current_buffer == 2) {
+        if (s->current_buffer == 1) {
+            goldfish_audio_buff_push( s->out_buff1, s->out_ring );
+            if (goldfish_audio_buff_length( s->out_buff1 ) != 0)
+                break;
+            new_status |= AUDIO_INT_WRITE_BUFFER_1_EMPTY;
+            s->current_buffer = (goldfish_audio_buff_length( s->out_buff2 ) ? 2 : 0);
+        } else {
+            goldfish_audio_buff_push( s->out_buff2, s->out_ring );
+            if (goldfish_audio_buff_length( s->out_buff2 ) != 0)
+                break;
+            new_status |= AUDIO_INT_WRITE_BUFFER_2_EMPTY;
+            s->current_buffer = (goldfish_audio_buff_length( s->out_buff1 ) ? 1 : 0);
+        }
+    }
+
+    if (s->current_buffer)
+        timer_mod(s->out_timer, qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL) + AUDIO_RING_REFILL_NS);
+
+    if (new_status && new_status != s->int_status) {
+        s->int_status |= new_status;
+        goldfish_device_set_irq(&s->dev, 0, (s->int_status & s->int_enable));
+    }
+}
+
+static void
+goldfish_audio_refill_timer( void*  opaque )
+{
+    goldfish_audio_refill( opaque );
+}
+
 /* update this whenever you change the goldfish_audio_state structure */
 #define  AUDIO_STATE_SAVE_VERSION  3
 
@@ -289,6 +440,13 @@ static int   audio_state_load( QEMUFile*  f, void*  opaque, int  version_id )
         AUD_set_active_in(s->voicein, (s->int_enable & AUDIO_INT_READ_BUFFER_FULL) != 0);
     }
 
+    // data that was in the ring at save time is lost, but the guest
+    // buffers are still pending and will be queued again.
+    if (s->out_ring) {
+        goldfish_audio_ring_reset( s->out_ring );
+        goldfish_audio_refill( s );
+    }
+
     // upon snapshot restore we must also re signal the IRQ
     goldfish_device_set_irq(&s->dev, 0,(s->int_status & s->int_enable));
     return ret;
@@ -301,6 +459,10 @@ static void enable_audio(struct goldfish_audio_state *s, int enable)
         AUD_set_active_out(s->voice,   (enable & (AUDIO_INT_WRITE_BUFFER_1_EMPTY | AUDIO_INT_WRITE_BUFFER_2_EMPTY)) != 0);
         goldfish_audio_buff_reset( s->out_buff1 );
         goldfish_audio_buff_reset( s->out_buff2 );
+        if (s->out_ring) {
+            goldfish_audio_ring_reset( s->out_ring );
+            timer_del( s->out_timer );
+        }
     }
 
     if (s->voicein) {
@@ -466,6 +628,8 @@ static void goldfish_audio_write(void *opaque, hwaddr offset, uint32_t val)
             goldfish_audio_buff_set_length( s->out_buff1, val );
             goldfish_audio_buff_read( s->out_buff1 );
             s->int_status &= ~AUDIO_INT_WRITE_BUFFER_1_EMPTY;
+            if (s->out_ring)
+                goldfish_audio_refill( s );
             break;
         case AUDIO_WRITE_BUFFER_2:
             /* record that data in buffer 2 is ready to write */
@@ -474,6 +638,8 @@ static void goldfish_audio_write(void *opaque, hwaddr offset, uint32_t val)
             goldfish_audio_buff_set_length( s->out_buff2, val );
             goldfish_audio_buff_read( s->out_buff2 );
             s->int_status &= ~AUDIO_INT_WRITE_BUFFER_2_EMPTY;
+            if (s->out_ring)
+                goldfish_audio_refill( s );
             break;
 
         case AUDIO_SET_READ_BUFFER:
@@ -507,6 +673,11 @@ static void goldfish_audio_callback(void *opaque, int free)
     struct goldfish_audio_state *s = opaque;
     int new_status = 0;
 
+    if (s->out_ring) {
+        goldfish_audio_ring_pop( s->out_ring, free, s );
+        return;
+    }
+
     /* loop until free is zero or both buffers are empty */
     while (free && s->current_buffer) {
 
@@ -628,6 +799,11 @@ void goldfish_audio_init(uint32_t base, int id, const char* input_source)
     as.endianness = AUDIO_HOST_ENDIANNESS;
 
     if (android_hw->hw_audioOutput) {
+        if (AUD_is_threaded()) {
+            s->out_ring  = g_malloc0(sizeof(*s->out_ring));
+            s->out_timer = timer_new_ns(QEMU_CLOCK_VIRTUAL,
+                                        goldfish_audio_refill_timer, s);
+        }
         s->voice = AUD_open_out (
             &s->card,
             NULL,
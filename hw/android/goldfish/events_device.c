@@ -21,9 +21,22 @@
 #include "hw/hw.h"
 #include "hw/irq.h"
 #include "migration/qemu-file.h"
+#include "qemu/timer.h"
 #include "ui/console.h"
 
-#define MAX_EVENTS 256*4
+/* Initial number of events in the queue. Must be a power of 2. */
+#define EVENTS_QUEUE_MIN    1024
+/* Maximum number of events in the queue. Must be a power of 2. The queue grows
+ * up to this size when the guest doesn't read events as fast as they come,
+ * and events are only dropped beyond it. */
+#define EVENTS_QUEUE_MAX    65536
+
+/* Number of slots of a full-size queue only used by key and sync events. */
+#define EVENTS_QUEUE_RESERVE  256
+
+/* Maximum number of events copied to the guest with a single cpu_physical_
+ * memory_write() during a batch read. */
+#define EVENTS_BATCH_CHUNK  64
 
 enum {
     REG_READ        = 0x00,
@@ -31,11 +44,25 @@ enum {
     REG_LEN         = 0x04,
     REG_DATA        = 0x08,
 
+    /* Batched event delivery. These registers are located past the end of
+     * the largest page, so a driver probing REG_FEATURES on an older device
+     * just reads zero page data. */
+    REG_FEATURES        = 0x800,
+    REG_BATCH_ADDR_LOW  = 0x804,
+    REG_BATCH_ADDR_HIGH = 0x808,
+    REG_BATCH_SIZE      = 0x80c,
+    REG_BATCH_READ      = 0x810,
+
     PAGE_NAME       = 0x00000,
     PAGE_EVBITS     = 0x10000,
     PAGE_ABSDATA    = 0x20000 | EV_ABS,
 };
 
+/* Bits returned by REG_FEATURES. */
+enum {
+    FEATURE_BATCH   = 1 << 0,   /* REG_BATCH_XXX registers are supported */
+};
+
 /* These corresponds to the state of the driver.
  * Unfortunately, we have to buffer events coming
  * from the UI, since the kernel driver is not
@@ -51,6 +78,32 @@ enum {
  *       which events can be sent by the emulated hardware.
  */
 
+/* An event queued for the guest. This is also the layout of each event
+ * written to guest memory by REG_BATCH_READ, with little-endian fields. */
+typedef struct
+{
+    uint32_t type;
+    uint32_t code;
+    uint32_t value;
+} EventEntry;
+
+/* Event delivery counters, see events_dev_display_stats(). */
+typedef struct
+{
+    uint64_t queued;        /* events queued */
+    uint64_t delivered;     /* events read by the guest */
+    uint64_t dropped;       /* events dropped because the queue was full */
+    uint64_t reads;         /* REG_READ accesses */
+    uint64_t batch_reads;   /* REG_BATCH_READ accesses */
+    unsigned max_queued;    /* queue high-water mark */
+
+    /* Events queued per second, measured over windows of about a second. */
+    int64_t  window_start;
+    uint64_t window_queued;
+    unsigned rate;
+    unsigned max_rate;
+} EventsStats;
+
 typedef struct
 {
     uint32_t base;
@@ -58,11 +111,22 @@ typedef struct
     int pending;
     int page;
 
-    unsigned events[MAX_EVENTS];
+    /* Circular queue of events. 'capacity' is a power of 2, and the queue
+     * is empty when 'first' == 'last'. 'read_pos' is the index of the next
+     * field of events[first] to return through REG_READ. */
+    EventEntry *events;
+    unsigned capacity;
     unsigned first;
     unsigned last;
+    unsigned read_pos;
     unsigned state;
 
+    /* Guest buffer used by REG_BATCH_READ, and its size in events. */
+    uint64_t batch_addr;
+    uint32_t batch_size;
+
+    EventsStats stats;
+
     const char *name;
 
     struct {
@@ -89,47 +153,179 @@ typedef struct ABSEntry {
 /* modify this each time you change the events_device structure. you
  * will also need to upadte events_state_load and events_state_save
  */
-#define  EVENTS_STATE_SAVE_VERSION  2
+#define  EVENTS_STATE_SAVE_VERSION  3
+
+/* Size of the queue in version 2 snapshots, in 32-bit values. */
+#define  EVENTS_V2_QUEUE_SIZE  (256*4)
+
+static unsigned events_queued(events_state *s)
+{
+    return (s->last - s->first) & (s->capacity - 1);
+}
 
-#undef  QFIELD_STRUCT
-#define QFIELD_STRUCT  events_state
+/* Grows the event queue so it can hold at least 'count' events.
+ * Returns 0 on success, or -1 if 'count' exceeds EVENTS_QUEUE_MAX.
+ */
+static int events_grow_queue(events_state *s, unsigned count)
+{
+    unsigned capacity = s->capacity ? s->capacity : EVENTS_QUEUE_MIN;
+    unsigned queued, n;
+    EventEntry *events;
 
-QFIELD_BEGIN(events_state_fields)
-    QFIELD_INT32(pending),
-    QFIELD_INT32(page),
-    QFIELD_BUFFER(events),
-    QFIELD_INT32(first),
-    QFIELD_INT32(last),
-    QFIELD_INT32(state),
-QFIELD_END
+    /* One slot is always left free, to tell a full queue from an empty one. */
+    while (capacity <= count) {
+        capacity <<= 1;
+    }
+    if (capacity == s->capacity) {
+        return 0;
+    }
+    if (capacity > EVENTS_QUEUE_MAX) {
+        return -1;
+    }
+
+    events = g_malloc(capacity * sizeof(EventEntry));
+    queued = s->capacity ? events_queued(s) : 0;
+    for (n = 0; n < queued; n++) {
+        events[n] = s->events[(s->first + n) & (s->capacity - 1)];
+    }
+    g_free(s->events);
+    s->events = events;
+    s->capacity = capacity;
+    s->first = 0;
+    s->last = queued;
+    return 0;
+}
 
 static void  events_state_save(QEMUFile*  f, void*  opaque)
 {
     events_state*  s = opaque;
+    unsigned queued = events_queued(s);
+    unsigned n;
 
-    qemu_put_struct(f, events_state_fields, s);
+    qemu_put_be32(f, s->pending);
+    qemu_put_be32(f, s->page);
+    qemu_put_be32(f, s->state);
+    qemu_put_be64(f, s->batch_addr);
+    qemu_put_be32(f, s->batch_size);
+    qemu_put_be32(f, s->read_pos);
+    qemu_put_be32(f, queued);
+    for (n = 0; n < queued; n++) {
+        const EventEntry *e = &s->events[(s->first + n) & (s->capacity - 1)];
+        qemu_put_be32(f, e->type);
+        qemu_put_be32(f, e->code);
+        qemu_put_be32(f, e->value);
+    }
+}
+
+/* Loads a version 2 snapshot, which stored the queue as a circular buffer
+ * of EVENTS_V2_QUEUE_SIZE 32-bit values in host byte order. */
+static int  events_state_load_v2(QEMUFile*  f, events_state*  s)
+{
+    unsigned words[EVENTS_V2_QUEUE_SIZE];
+    unsigned first, last, count, partial, n;
+
+    s->pending = qemu_get_be32(f);
+    s->page = qemu_get_be32(f);
+    if (qemu_get_buffer(f, (uint8_t*)words, sizeof(words)) != sizeof(words))
+        return -1;
+    first = qemu_get_be32(f) & (EVENTS_V2_QUEUE_SIZE - 1);
+    last = qemu_get_be32(f) & (EVENTS_V2_QUEUE_SIZE - 1);
+    s->state = qemu_get_be32(f);
+
+    /* The guest may have read only part of the first event, in which case
+     * the fields it has already read are gone. */
+    count = (last - first) & (EVENTS_V2_QUEUE_SIZE - 1);
+    partial = count % 3;
+    s->first = s->last = 0;
+    s->read_pos = partial ? 3 - partial : 0;
+    if (events_grow_queue(s, (count + 2) / 3 + 1) < 0)
+        return -1;
+    for (n = 0; n < s->read_pos + count; n++) {
+        unsigned value = 0;
+        if (n >= s->read_pos) {
+            value = words[(first + n - s->read_pos) & (EVENTS_V2_QUEUE_SIZE - 1)];
+        }
+        ((uint32_t*)&s->events[n / 3])[n % 3] = value;
+    }
+    s->last = (s->read_pos + count) / 3;
+    return 0;
 }
 
 static int  events_state_load(QEMUFile*  f, void* opaque, int  version_id)
 {
     events_state*  s = opaque;
+    unsigned queued, n;
 
+    if (version_id == 2)
+        return events_state_load_v2(f, s);
     if (version_id != EVENTS_STATE_SAVE_VERSION)
         return -1;
 
-    return qemu_get_struct(f, events_state_fields, s);
+    s->pending = qemu_get_be32(f);
+    s->page = qemu_get_be32(f);
+    s->state = qemu_get_be32(f);
+    s->batch_addr = qemu_get_be64(f);
+    s->batch_size = qemu_get_be32(f);
+    s->read_pos = qemu_get_be32(f);
+    queued = qemu_get_be32(f);
+    if (s->read_pos > 2 || events_grow_queue(s, queued + 1) < 0)
+        return -1;
+    for (n = 0; n < queued; n++) {
+        EventEntry *e = &s->events[n];
+        e->type = qemu_get_be32(f);
+        e->code = qemu_get_be32(f);
+        e->value = qemu_get_be32(f);
+    }
+    s->first = 0;
+    s->last = queued;
+    return 0;
 }
 
-static void enqueue_event(events_state *s, unsigned int type, unsigned int code, int value)
+static void update_event_rate(EventsStats *stats)
 {
-    int  enqueued = s->last - s->first;
+    int64_t now = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
+    int64_t elapsed = now - stats->window_start;
+
+    stats->window_queued++;
+    if (elapsed >= 1000000000LL) {
+        if (stats->window_start != 0) {
+            stats->rate = (unsigned)(stats->window_queued * 1000000000ULL / elapsed);
+            if (stats->rate > stats->max_rate)
+                stats->max_rate = stats->rate;
+        }
+        stats->window_start = now;
+        stats->window_queued = 0;
+    }
+}
 
-    if (enqueued < 0)
-        enqueued += MAX_EVENTS;
+static void enqueue_event(events_state *s, unsigned int type, unsigned int code, int value)
+{
+    unsigned  enqueued = events_queued(s);
+    EventEntry *e;
+
+    /* Rather than dropping events when the guest is slow to read them, grow
+     * the queue, up to EVENTS_QUEUE_MAX events. */
+    if (enqueued + 1 >= s->capacity &&
+        events_grow_queue(s, enqueued + 1) < 0) {
+        goto drop;
+    }
 
-    if (enqueued + 3 > MAX_EVENTS) {
-        fprintf(stderr, "##KBD: Full queue, lose event\n");
-        return;
+    /* The producers can't be made to wait: they run on the main loop, which
+     * must return for the guest to read the queue. Once the queue is nearly
+     * full, drop motion events first, and keep the remaining slots for key
+     * and sync events. Losing those would leave keys or touches stuck down,
+     * while later motion events supersede lost ones. Each frame is still
+     * terminated, but empty frames are not queued. */
+    if (s->capacity == EVENTS_QUEUE_MAX &&
+        enqueued + EVENTS_QUEUE_RESERVE >= s->capacity) {
+        if (type == EV_SYN) {
+            const EventEntry *prev =
+                &s->events[(s->last - 1) & (s->capacity - 1)];
+            if (enqueued > 0 && prev->type == EV_SYN && prev->code == code)
+                goto drop;
+        } else if (type != EV_KEY) {
+            goto drop;
+        }
     }
 
     if(s->first == s->last) {
@@ -142,26 +338,27 @@ static void enqueue_event(events_state *s, unsigned int type, unsigned int code,
 
     //fprintf(stderr, "##KBD: type=%d code=%d value=%d\n", type, code, value);
 
-    s->events[s->last] = type;
-    s->last = (s->last + 1) & (MAX_EVENTS-1);
-    s->events[s->last] = code;
-    s->last = (s->last + 1) & (MAX_EVENTS-1);
-    s->events[s->last] = value;
-    s->last = (s->last + 1) & (MAX_EVENTS-1);
-}
+    e = &s->events[s->last];
+    e->type = type;
+    e->code = code;
+    e->value = value;
+    s->last = (s->last + 1) & (s->capacity - 1);
 
-static unsigned dequeue_event(events_state *s)
-{
-    unsigned n;
+    s->stats.queued++;
+    if (enqueued + 1 > s->stats.max_queued)
+        s->stats.max_queued = enqueued + 1;
+    update_event_rate(&s->stats);
+    return;
 
-    if(s->first == s->last) {
-        return 0;
+drop:
+    if (s->stats.dropped++ == 0) {
+        fprintf(stderr, "##KBD: Full queue, lose event\n");
     }
+}
 
-    n = s->events[s->first];
-
-    s->first = (s->first + 1) & (MAX_EVENTS - 1);
-
+/* Updates the IRQ after the guest has read from the queue. */
+static void events_update_irq(events_state *s)
+{
     if(s->first == s->last) {
         qemu_irq_lower(s->irq);
     }
@@ -176,15 +373,79 @@ static unsigned dequeue_event(events_state *s)
      * queue, the goldfish event device will re-assert the IRQ so that
      * the driver can be notified to fetch the event again.
      */
-    else if (((s->first + 2) & (MAX_EVENTS - 1)) < s->last ||
-               (s->first & (MAX_EVENTS - 1)) > s->last) { /* if there still is an event */
+    else if (events_queued(s) * 3 - s->read_pos > 2) { /* if there still is an event */
         qemu_irq_lower(s->irq);
         qemu_irq_raise(s->irq);
     }
 #endif
+}
+
+static unsigned dequeue_event(events_state *s)
+{
+    const EventEntry *e;
+    unsigned n;
+
+    s->stats.reads++;
+    if(s->first == s->last) {
+        return 0;
+    }
+
+    e = &s->events[s->first];
+    n = (s->read_pos == 0) ? e->type :
+        (s->read_pos == 1) ? e->code : e->value;
+
+    if (++s->read_pos == 3) {
+        s->read_pos = 0;
+        s->first = (s->first + 1) & (s->capacity - 1);
+        s->stats.delivered++;
+    }
+
+    events_update_irq(s);
     return n;
 }
 
+/* Copies as many queued events as possible to the guest buffer set up
+ * through REG_BATCH_ADDR_XXX and REG_BATCH_SIZE.
+ * Returns the number of events copied.
+ */
+static unsigned dequeue_event_batch(events_state *s)
+{
+    EventEntry chunk[EVENTS_BATCH_CHUNK];
+    hwaddr addr = s->batch_addr;
+    unsigned count, n;
+
+    s->stats.batch_reads++;
+    count = events_queued(s);
+    if (count > s->batch_size)
+        count = s->batch_size;
+    if (count == 0 || s->batch_addr == 0) {
+        return 0;
+    }
+
+    /* An event partially read through REG_READ is sent again as a whole. */
+    s->read_pos = 0;
+
+    for (n = 0; n < count; ) {
+        unsigned m = 0;
+        while (m < EVENTS_BATCH_CHUNK && n + m < count) {
+            const EventEntry *e = &s->events[s->first];
+            chunk[m].type = cpu_to_le32(e->type);
+            chunk[m].code = cpu_to_le32(e->code);
+            chunk[m].value = cpu_to_le32(e->value);
+            s->first = (s->first + 1) & (s->capacity - 1);
+            m++;
+        }
+        cpu_physical_memory_write(addr, (const uint8_t*)chunk,
+                                  m * sizeof(EventEntry));
+        addr += m * sizeof(EventEntry);
+        n += m;
+    }
+    s->stats.delivered += count;
+
+    events_update_irq(s);
+    return count;
+}
+
 static int get_page_len(events_state *s)
 {
     int page = s->page;
@@ -236,6 +497,10 @@ static uint32_t events_read(void *x, hwaddr off)
         return dequeue_event(s);
     else if (offset == REG_LEN)
         return get_page_len(s);
+    else if (offset == REG_FEATURES)
+        return FEATURE_BATCH;
+    else if (offset == REG_BATCH_READ)
+        return dequeue_event_batch(s);
     else if (offset >= REG_DATA)
         return get_page_data(s, offset - REG_DATA);
     return 0; // this shouldn't happen, if the driver does the right thing
@@ -247,6 +512,13 @@ static void events_write(void *x, hwaddr off, uint32_t val)
     int offset = off; // - s->base;
     if (offset == REG_SET_PAGE)
         s->page = val;
+    else if (offset == REG_BATCH_ADDR_LOW)
+        s->batch_addr = (s->batch_addr & ~0xFFFFFFFFULL) | val;
+    else if (offset == REG_BATCH_ADDR_HIGH)
+        s->batch_addr = (s->batch_addr & 0xFFFFFFFFULL) |
+                        ((uint64_t)val << 32);
+    else if (offset == REG_BATCH_SIZE)
+        s->batch_size = val;
 }
 
 static CPUReadMemoryFunc *events_readfn[] = {
@@ -351,6 +623,39 @@ events_clr_bit(events_state* s, int type, int bit)
     }
 }
 
+static events_state *events_dev;
+
+void events_dev_display_stats(void (* callback)(void *data, const char* string), void *data)
+{
+    events_state *s = events_dev;
+    char buffer[100];
+
+    if (s == NULL) {
+        callback(data, "no events device\r\n");
+        return;
+    }
+
+    snprintf(buffer, sizeof buffer, "queued: %llu events (%u max, %u capacity)\r\n",
+             (unsigned long long)s->stats.queued, s->stats.max_queued,
+             s->capacity - 1);
+    callback(data, buffer);
+    snprintf(buffer, sizeof buffer, "pending: %u events\r\n", events_queued(s));
+    callback(data, buffer);
+    snprintf(buffer, sizeof buffer, "delivered: %llu events\r\n",
+             (unsigned long long)s->stats.delivered);
+    callback(data, buffer);
+    snprintf(buffer, sizeof buffer, "dropped: %llu events\r\n",
+             (unsigned long long)s->stats.dropped);
+    callback(data, buffer);
+    snprintf(buffer, sizeof buffer, "register reads: %llu single, %llu batch\r\n",
+             (unsigned long long)s->stats.reads,
+             (unsigned long long)s->stats.batch_reads);
+    callback(data, buffer);
+    snprintf(buffer, sizeof buffer, "rate: %u events/s (%u max)\r\n",
+             s->stats.rate, s->stats.max_rate);
+    callback(data, buffer);
+}
+
 void events_dev_init(uint32_t base, qemu_irq irq)
 {
     events_state *s;
@@ -530,9 +835,12 @@ void events_dev_init(uint32_t base, qemu_irq irq)
 
     s->first = 0;
     s->last = 0;
+    events_grow_queue(s, EVENTS_QUEUE_MIN - 1);
     s->state = STATE_INIT;
     s->name = g_strdup(config->hw_keyboard_charmap);
 
+    events_dev = s;
+
     /* This function migh fire buffered events to the device, so
      * ensure that it is called after initialization is complete
      */
@@ -172,6 +172,9 @@ static void goldfish_tty_write(void *opaque, hwaddr offset, uint32_t value)
                     s->data_count -= s->ptr_len;
                     if(s->data_count == 0 && s->ready)
                         goldfish_device_set_irq(&s->dev, 0, 0);
+                    /* let the backend send the data it had to hold back */
+                    if(s->cs && s->ptr_len > 0)
+                        qemu_chr_accept_input(s->cs);
                     break;
 
                 default:
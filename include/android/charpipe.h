@@ -27,7 +27,19 @@ extern int  qemu_chr_open_charpipe( CharDriverState* *pfirst, CharDriverState* *
  */
 extern CharDriverState*  qemu_chr_open_buffer( CharDriverState*  endpoint );
 
-/* must be called from the main event loop to poll all charpipes */
-extern void charpipe_poll( void );
+/* callback used to release a buffer passed to charpipe_send_buffer() */
+typedef void (*CharPipeReleaseFunc)( void*  opaque, uint8_t*  buf );
+
+/* send 'len' bytes from 'buf' through one half of a charpipe, without copying
+ * them. The pipe takes ownership of 'buf', and calls 'release(opaque, buf)'
+ * once all its content has been read by the other half, or when the pipe is
+ * closed. This can happen before the function returns. If 'cs' is not a
+ * charpipe, the data is sent with qemu_chr_write() and released immediately.
+ */
+extern void charpipe_send_buffer( CharDriverState*     cs,
+                                  uint8_t*             buf,
+                                  int                  len,
+                                  CharPipeReleaseFunc  release,
+                                  void*                opaque );
 
 #endif /* _CHARPIPE_H */
@@ -372,6 +372,21 @@ int   socket_send  ( int  fd, const void*  buf, int  buflen );
 int   socket_send_oob( int  fd, const void*  buf, int  buflen );
 int   socket_sendto( int  fd, const void*  buf, int  buflen, const SockAddress*  to );
 
+/* a buffer segment for socket_sendv() and socket_recvv() */
+typedef struct {
+    void*   base;
+    int     len;
+} SocketIoVec;
+
+/* maximum number of segments accepted by socket_sendv() and socket_recvv() */
+#define  SOCKET_IOV_MAX  64
+
+/* scatter/gather variants of socket_send() and socket_recv(), these transfer
+ * data from/to up to SOCKET_IOV_MAX segments with a single system call.
+ */
+int   socket_sendv( int  fd, const SocketIoVec*  vec, int  count );
+int   socket_recvv( int  fd, const SocketIoVec*  vec, int  count );
+
 int   socket_connect( int  fd, const SockAddress*  address );
 int   socket_bind( int  fd, const SockAddress*  address );
 int   socket_get_address( int  fd, SockAddress*  address );
@@ -18,8 +18,10 @@
 extern int  qemu_tcpdump_active;
 
 /* start a new packet capture, close the current one if any.
+ * 'spec' is <file>[,snaplen=<bytes>][,filter=<expr>][,filesize=<size>][,files=<count>]
+ * see android/qemu-tcpdump.c for details.
  * returns 0 on success, and -1 on failure (see errno then) */
-extern int  qemu_tcpdump_start( const char*  filepath );
+extern int  qemu_tcpdump_start( const char*  spec );
 
 /* stop the current packet capture, if any */
 extern void qemu_tcpdump_stop( void );
@@ -28,9 +30,10 @@ extern void qemu_tcpdump_stop( void );
 extern void qemu_tcpdump_packet( const void*  base, int  len );
 
 /* returns interesting stats, like the number of packets captures,
- * and the total size of these packets. Note: the file will be larger
- * due to global and packet headers.
+ * the total size of these packets, and the number of packets that were
+ * dropped because the writer thread couldn't keep up (or failed to write
+ * them). Note: the file will be larger due to global and packet headers.
  */
-extern void  qemu_tcpdump_stats( uint64_t  *pcount, uint64_t*  psize );
+extern void  qemu_tcpdump_stats( uint64_t  *pcount, uint64_t*  psize, uint64_t*  pdropped );
 
 #endif /* _QEMU_TCPDUMP_H */
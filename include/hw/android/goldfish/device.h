@@ -55,6 +55,7 @@ int goldfish_guest_is_64bit();
 // these do not add a device
 void trace_dev_init();
 void events_dev_init(uint32_t base, qemu_irq irq);
+void events_dev_display_stats(void (* callback)(void *data, const char* string), void *data);
 void nand_dev_init(uint32_t base);
 
 #ifdef TARGET_I386
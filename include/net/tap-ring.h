@@ -0,0 +1,74 @@
+/*
+ * Frame rings for the TAP I/O thread.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+#ifndef QEMU_NET_TAP_RING_H
+#define QEMU_NET_TAP_RING_H
+
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* A single-producer/single-consumer ring of Ethernet frames, used to move
+ * frames between the main loop and the TAP I/O thread without locking.
+ * The producer only writes 'head', the consumer only writes 'tail'. Each
+ * side works on a batch of frames, and publishes it at once. */
+#define TAP_FRAME_MAX   4096
+#define TAP_RING_SIZE   256
+#define TAP_RING_MASK   (TAP_RING_SIZE - 1)
+
+typedef struct TAPFrame {
+    int size;
+    uint8_t data[TAP_FRAME_MAX];
+} TAPFrame;
+
+typedef struct TAPRing {
+    unsigned head;
+    unsigned tail;
+    TAPFrame *frames;
+} TAPRing;
+
+/* Reads one frame from 'fd' into 'buf', like read(). */
+typedef ssize_t (*TAPReadFunc)(int fd, uint8_t *buf, int maxlen);
+
+void tap_ring_init(TAPRing *ring);
+void tap_ring_destroy(TAPRing *ring);
+
+/* Producer side: number of free slots. */
+int tap_ring_space(TAPRing *ring);
+
+/* Producer side: copy the frame described by 'iov' into the ring. Returns
+ * its size, 0 if the ring is full, or -1 if it's larger than
+ * TAP_FRAME_MAX. */
+ssize_t tap_ring_put(TAPRing *ring, const struct iovec *iov, int iovcnt);
+
+/* Producer side: read as many frames as available from the non-blocking
+ * 'fd' into the free slots. Returns the number of frames read. */
+int tap_ring_fill(TAPRing *ring, int fd, TAPReadFunc read_func);
+
+/* Consumer side: number of queued frames. */
+int tap_ring_count(TAPRing *ring);
+
+/* Consumer side: the n-th queued frame, 'n' < tap_ring_count(). */
+TAPFrame *tap_ring_frame(TAPRing *ring, int n);
+
+/* Consumer side: release the 'count' oldest frames. */
+void tap_ring_consume(TAPRing *ring, int count);
+
+/* Consumer side: write the queued frames to the non-blocking 'fd', one
+ * frame per write(), until the ring is empty or 'fd' would block. Frames
+ * that fail otherwise are dropped, like a lossy link would. Returns the
+ * number of frames released. */
+int tap_ring_drain(TAPRing *ring, int fd);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* QEMU_NET_TAP_RING_H */
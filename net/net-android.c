@@ -54,6 +54,7 @@
 #include <dirent.h>
 #include <netdb.h>
 #include <sys/select.h>
+#include <poll.h>
 #ifdef CONFIG_BSD
 #include <sys/stat.h>
 #if defined(__FreeBSD__) || defined(__DragonFly__)
@@ -122,6 +123,9 @@
 #include "audio/audio.h"
 #include "qemu/sockets.h"
 #include "qemu/log.h"
+#include "qemu/atomic.h"
+#include "qemu/thread.h"
+#include "net/tap-ring.h"
 
 #if defined(CONFIG_SLIRP)
 #include "libslirp.h"
@@ -1125,15 +1129,37 @@ static void vmchannel_read(void *opaque, const uint8_t *buf, int size)
 
 #if !defined(_WIN32)
 
+/* When 'iothread=on' is used, a dedicated thread does all the I/O on the
+ * TAP device. Frames it reads are queued in the 'rx' ring and handed to
+ * the NIC model in batches from the main loop, which is woken through a
+ * pipe at most once per batch. Frames sent by the NIC model are queued in
+ * the 'tx' ring, and the thread, woken at most once per batch, writes them
+ * all to the TAP device. */
+typedef struct TAPThread {
+    QemuThread thread;
+    QemuEvent tx_space;   /* set when the thread frees 'tx' slots */
+    int wake_fds[2];      /* main loop -> I/O thread */
+    int notify_fds[2];    /* I/O thread -> main loop */
+    int notified;
+    int kicked;
+    int rx_full;          /* the I/O thread waits for 'rx' slots */
+    int quit;
+    TAPRing rx;           /* I/O thread -> main loop */
+    TAPRing tx;           /* main loop -> I/O thread */
+} TAPThread;
+
 typedef struct TAPState {
     VLANClientState *vc;
     int fd;
     char down_script[1024];
     char down_script_arg[128];
-    uint8_t buf[4096];
+    uint8_t buf[TAP_FRAME_MAX];
+    TAPThread *io;
 } TAPState;
 
 static int launch_script(const char *setup_script, const char *ifname, int fd);
+static ssize_t tap_thread_queue(TAPState *s, const struct iovec *iov,
+                                int iovcnt);
 
 static ssize_t tap_receive_iov(VLANClientState *vc, const struct iovec *iov,
                                int iovcnt)
@@ -1141,6 +1167,10 @@ static ssize_t tap_receive_iov(VLANClientState *vc, const struct iovec *iov,
     TAPState *s = vc->opaque;
     ssize_t len;
 
+    if (s->io) {
+        return tap_thread_queue(s, iov, iovcnt);
+    }
+
     do {
         len = writev(s->fd, iov, iovcnt);
     } while (len == -1 && (errno == EINTR || errno == EAGAIN));
@@ -1153,6 +1183,12 @@ static ssize_t tap_receive(VLANClientState *vc, const uint8_t *buf, size_t size)
     TAPState *s = vc->opaque;
     ssize_t len;
 
+    if (s->io) {
+        struct iovec iov = { (void *)buf, size };
+
+        return tap_thread_queue(s, &iov, 1);
+    }
+
     do {
         len = write(s->fd, buf, size);
     } while (len == -1 && (errno == EINTR || errno == EAGAIN));
@@ -1212,10 +1248,220 @@ static void tap_send(void *opaque)
     } while (size > 0);
 }
 
+static void tap_thread_deliver(void *opaque);
+
+static void tap_thread_signal(int *flag, int fd)
+{
+    static const char dummy = 0;
+    ssize_t ret;
+
+    if (atomic_xchg(flag, 1) == 0) {
+        do {
+            ret = write(fd, &dummy, 1);
+        } while (ret < 0 && errno == EINTR);
+    }
+}
+
+/* Wake the main loop, which then delivers the 'rx' frames. */
+static void tap_thread_notify(TAPThread *io)
+{
+    tap_thread_signal(&io->notified, io->notify_fds[1]);
+}
+
+/* Wake the I/O thread, which then writes the 'tx' frames, reads frames
+ * again if 'rx' was full, or exits. */
+static void tap_thread_kick(TAPThread *io)
+{
+    tap_thread_signal(&io->kicked, io->wake_fds[1]);
+}
+
+static void *tap_thread_main(void *opaque)
+{
+    TAPState *s = opaque;
+    TAPThread *io = s->io;
+    char dummy[64];
+
+    while (!atomic_read(&io->quit)) {
+        struct pollfd fds[2];
+
+        while (read(io->wake_fds[0], dummy, sizeof(dummy)) > 0) {
+            /* drain */
+        }
+        atomic_mb_set(&io->kicked, 0);
+
+        /* write everything the NIC model sent since the last wakeup */
+        if (tap_ring_drain(&io->tx, s->fd) > 0) {
+            qemu_event_set(&io->tx_space);
+        }
+
+        /* read as many frames as possible for this wakeup */
+        if (tap_ring_fill(&io->rx, s->fd, tap_read_packet) > 0) {
+            tap_thread_notify(io);
+        }
+
+        /* don't poll for reading while 'rx' is full, the main loop kicks
+         * us once it has freed slots */
+        fds[0].fd = s->fd;
+        fds[0].events = POLLIN;
+        if (tap_ring_space(&io->rx) == 0) {
+            atomic_mb_set(&io->rx_full, 1);
+            if (tap_ring_space(&io->rx) == 0) {
+                fds[0].events = 0;
+            } else {
+                atomic_set(&io->rx_full, 0);
+            }
+        }
+        if (tap_ring_count(&io->tx) > 0) {
+            fds[0].events |= POLLOUT;
+        }
+        fds[1].fd = io->wake_fds[0];
+        fds[1].events = POLLIN;
+        poll(fds, 2, -1);
+    }
+    return NULL;
+}
+
+static int tap_thread_can_deliver(void *opaque)
+{
+    TAPState *s = opaque;
+
+    return qemu_can_send_packet(s->vc);
+}
+
+static void tap_thread_send_completed(VLANClientState *vc)
+{
+    TAPState *s = vc->opaque;
+
+    qemu_set_fd_handler2(s->io->notify_fds[0], tap_thread_can_deliver,
+                         tap_thread_deliver, NULL, s);
+    tap_thread_deliver(s);
+}
+
+static void tap_thread_deliver(void *opaque)
+{
+    TAPState *s = opaque;
+    TAPThread *io = s->io;
+    char dummy[64];
+    int count, n = 0;
+    int blocked = 0;
+
+    while (read(io->notify_fds[0], dummy, sizeof(dummy)) > 0) {
+        /* drain */
+    }
+    atomic_mb_set(&io->notified, 0);
+
+    count = tap_ring_count(&io->rx);
+    while (n < count && qemu_can_send_packet(s->vc)) {
+        TAPFrame *frame = tap_ring_frame(&io->rx, n);
+        int size;
+
+        size = qemu_send_packet_async(s->vc, frame->data, frame->size,
+                                      tap_thread_send_completed);
+        /* the frame was copied or queued in both cases */
+        n++;
+        if (size == 0) {
+            qemu_set_fd_handler2(io->notify_fds[0], NULL, NULL, NULL, NULL);
+            blocked = 1;
+            break;
+        }
+    }
+
+    if (n > 0) {
+        tap_ring_consume(&io->rx, n);
+        if (atomic_xchg(&io->rx_full, 0)) {
+            tap_thread_kick(io);
+        }
+    }
+
+    /* frames are left because the NIC can't receive right now, make sure
+     * we're called again once it can */
+    if (!blocked && n < count) {
+        tap_thread_notify(io);
+    }
+}
+
+static ssize_t tap_thread_queue(TAPState *s, const struct iovec *iov,
+                                int iovcnt)
+{
+    TAPThread *io = s->io;
+    ssize_t size;
+
+    /* like the blocking write() without the I/O thread, wait for the
+     * thread to make room when the TAP device can't keep up */
+    while ((size = tap_ring_put(&io->tx, iov, iovcnt)) == 0) {
+        qemu_event_reset(&io->tx_space);
+        if (tap_ring_space(&io->tx) == 0) {
+            tap_thread_kick(io);
+            qemu_event_wait(&io->tx_space);
+        }
+    }
+    if (size > 0) {
+        tap_thread_kick(io);
+    }
+    return size;
+}
+
+static int tap_thread_start(TAPState *s)
+{
+    TAPThread *io = g_malloc0(sizeof(TAPThread));
+
+    if (qemu_pipe(io->wake_fds) < 0) {
+        g_free(io);
+        return -1;
+    }
+    if (qemu_pipe(io->notify_fds) < 0) {
+        close(io->wake_fds[0]);
+        close(io->wake_fds[1]);
+        g_free(io);
+        return -1;
+    }
+    fcntl(io->wake_fds[0], F_SETFL, O_NONBLOCK);
+    fcntl(io->wake_fds[1], F_SETFL, O_NONBLOCK);
+    fcntl(io->notify_fds[0], F_SETFL, O_NONBLOCK);
+    fcntl(io->notify_fds[1], F_SETFL, O_NONBLOCK);
+
+    tap_ring_init(&io->rx);
+    tap_ring_init(&io->tx);
+    qemu_event_init(&io->tx_space, false);
+    s->io = io;
+
+    /* the fd is now owned by the I/O thread */
+    qemu_set_fd_handler2(s->fd, NULL, NULL, NULL, NULL);
+    qemu_set_fd_handler2(io->notify_fds[0], tap_thread_can_deliver,
+                         tap_thread_deliver, NULL, s);
+    qemu_thread_create(&io->thread, tap_thread_main, s, QEMU_THREAD_JOINABLE);
+    return 0;
+}
+
+static void tap_thread_stop(TAPState *s)
+{
+    TAPThread *io = s->io;
+
+    atomic_mb_set(&io->quit, 1);
+    atomic_set(&io->kicked, 0);
+    tap_thread_kick(io);
+    qemu_thread_join(&io->thread);
+
+    qemu_set_fd_handler(io->notify_fds[0], NULL, NULL, NULL);
+    close(io->wake_fds[0]);
+    close(io->wake_fds[1]);
+    close(io->notify_fds[0]);
+    close(io->notify_fds[1]);
+    qemu_event_destroy(&io->tx_space);
+    tap_ring_destroy(&io->rx);
+    tap_ring_destroy(&io->tx);
+    g_free(io);
+    s->io = NULL;
+}
+
 static void tap_cleanup(VLANClientState *vc)
 {
     TAPState *s = vc->opaque;
 
+    if (s->io) {
+        tap_thread_stop(s);
+    }
+
     if (s->down_script[0])
         launch_script(s->down_script, s->down_script_arg, s->fd);
 
@@ -1229,7 +1475,8 @@ static void tap_cleanup(VLANClientState *vc)
 static TAPState *net_tap_fd_init(VLANState *vlan,
                                  const char *model,
                                  const char *name,
-                                 int fd)
+                                 int fd,
+                                 int iothread)
 {
     TAPState *s;
 
@@ -1238,7 +1485,12 @@ static TAPState *net_tap_fd_init(VLANState *vlan,
     s->vc = qemu_new_vlan_client(vlan, model, name, NULL, tap_receive,
                                  tap_receive_iov, tap_cleanup, s);
     qemu_set_fd_handler2(s->fd, tap_can_send, tap_send, NULL, s);
-    snprintf(s->vc->info_str, sizeof(s->vc->info_str), "fd=%d", fd);
+    if (iothread && tap_thread_start(s) < 0) {
+        fprintf(stderr, "warning: could not start TAP I/O thread\n");
+        qemu_set_fd_handler2(s->fd, tap_can_send, tap_send, NULL, s);
+    }
+    snprintf(s->vc->info_str, sizeof(s->vc->info_str), "fd=%d%s", fd,
+             s->io ? ",iothread=on" : "");
     return s;
 }
 
@@ -1478,7 +1730,8 @@ static int launch_script(const char *setup_script, const char *ifname, int fd)
 
 static int net_tap_init(VLANState *vlan, const char *model,
                         const char *name, const char *ifname1,
-                        const char *setup_script, const char *down_script)
+                        const char *setup_script, const char *down_script,
+                        int iothread)
 {
     TAPState *s;
     int fd;
@@ -1498,10 +1751,11 @@ static int net_tap_init(VLANState *vlan, const char *model,
 	if (launch_script(setup_script, ifname, fd))
 	    return -1;
     }
-    s = net_tap_fd_init(vlan, model, name, fd);
+    s = net_tap_fd_init(vlan, model, name, fd, iothread);
     snprintf(s->vc->info_str, sizeof(s->vc->info_str),
-             "ifname=%s,script=%s,downscript=%s",
-             ifname, setup_script, down_script);
+             "ifname=%s,script=%s,downscript=%s%s",
+             ifname, setup_script, down_script,
+             s->io ? ",iothread=on" : "");
     if (down_script && strcmp(down_script, "no")) {
         snprintf(s->down_script, sizeof(s->down_script), "%s", down_script);
         snprintf(s->down_script_arg, sizeof(s->down_script_arg), "%s", ifname);
@@ -2314,21 +2568,35 @@ int net_client_init(Monitor *mon, const char *device, const char *p)
     if (!strcmp(device, "tap")) {
         char ifname[64], chkbuf[64];
         char setup_script[1024], down_script[1024];
-        int fd;
+        int fd, iothread = 0;
         vlan->nb_host_devs++;
+        if (get_param_value(buf, sizeof(buf), "iothread", p) > 0) {
+            if (!strcmp(buf, "on")) {
+                iothread = 1;
+            } else if (strcmp(buf, "off")) {
+                config_error(mon, "invalid iothread value '%s', "
+                             "expected 'on' or 'off'\n", buf);
+                ret = -1;
+                goto out;
+            }
+        }
         if (get_param_value(buf, sizeof(buf), "fd", p) > 0) {
-            if (check_params(chkbuf, sizeof(chkbuf), fd_params, p) < 0) {
+            static const char * const tap_fd_params[] = {
+                "vlan", "name", "fd", "iothread", NULL
+            };
+            if (check_params(chkbuf, sizeof(chkbuf), tap_fd_params, p) < 0) {
                 config_error(mon, "invalid parameter '%s' in '%s'\n", chkbuf, p);
                 ret = -1;
                 goto out;
             }
             fd = strtol(buf, NULL, 0);
             fcntl(fd, F_SETFL, O_NONBLOCK);
-            net_tap_fd_init(vlan, device, name, fd);
+            net_tap_fd_init(vlan, device, name, fd, iothread);
             ret = 0;
         } else {
             static const char * const tap_params[] = {
-                "vlan", "name", "ifname", "script", "downscript", NULL
+                "vlan", "name", "ifname", "script", "downscript", "iothread",
+                NULL
             };
             if (check_params(chkbuf, sizeof(chkbuf), tap_params, p) < 0) {
                 config_error(mon, "invalid parameter '%s' in '%s'\n", chkbuf, p);
@@ -2344,7 +2612,8 @@ int net_client_init(Monitor *mon, const char *device, const char *p)
             if (get_param_value(down_script, sizeof(down_script), "downscript", p) == 0) {
                 pstrcpy(down_script, sizeof(down_script), DEFAULT_NETWORK_DOWN_SCRIPT);
             }
-            ret = net_tap_init(vlan, device, name, ifname, setup_script, down_script);
+            ret = net_tap_init(vlan, device, name, ifname, setup_script,
+                               down_script, iothread);
         }
     } else
 #endif
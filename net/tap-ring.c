@@ -0,0 +1,130 @@
+/*
+ * Frame rings for the TAP I/O thread.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+#include "net/tap-ring.h"
+
+#include "qemu/atomic.h"
+
+#include <errno.h>
+#include <glib.h>
+#include <string.h>
+#include <unistd.h>
+
+void tap_ring_init(TAPRing *ring)
+{
+    ring->head = 0;
+    ring->tail = 0;
+    ring->frames = g_malloc(sizeof(TAPFrame) * TAP_RING_SIZE);
+}
+
+void tap_ring_destroy(TAPRing *ring)
+{
+    g_free(ring->frames);
+    ring->frames = NULL;
+}
+
+int tap_ring_space(TAPRing *ring)
+{
+    return TAP_RING_SIZE - (ring->head - atomic_mb_read(&ring->tail));
+}
+
+/* Make the frames written since the last call visible to the consumer. */
+static void tap_ring_publish(TAPRing *ring, unsigned head)
+{
+    smp_wmb();
+    atomic_set(&ring->head, head);
+}
+
+ssize_t tap_ring_put(TAPRing *ring, const struct iovec *iov, int iovcnt)
+{
+    TAPFrame *frame;
+    size_t size = 0;
+    int i;
+
+    for (i = 0; i < iovcnt; i++) {
+        size += iov[i].iov_len;
+    }
+    if (size > TAP_FRAME_MAX) {
+        return -1;
+    }
+    if (tap_ring_space(ring) == 0) {
+        return 0;
+    }
+
+    frame = &ring->frames[ring->head & TAP_RING_MASK];
+    frame->size = 0;
+    for (i = 0; i < iovcnt; i++) {
+        memcpy(frame->data + frame->size, iov[i].iov_base, iov[i].iov_len);
+        frame->size += iov[i].iov_len;
+    }
+    tap_ring_publish(ring, ring->head + 1);
+    return size;
+}
+
+int tap_ring_fill(TAPRing *ring, int fd, TAPReadFunc read_func)
+{
+    unsigned head = ring->head;
+    int space = tap_ring_space(ring);
+    int count = 0;
+
+    while (count < space) {
+        TAPFrame *frame = &ring->frames[head & TAP_RING_MASK];
+
+        frame->size = read_func(fd, frame->data, sizeof(frame->data));
+        if (frame->size <= 0) {
+            break;
+        }
+        head++;
+        count++;
+    }
+    if (count > 0) {
+        tap_ring_publish(ring, head);
+    }
+    return count;
+}
+
+int tap_ring_count(TAPRing *ring)
+{
+    int count = atomic_read(&ring->head) - ring->tail;
+
+    /* don't read frames before their head update */
+    smp_rmb();
+    return count;
+}
+
+TAPFrame *tap_ring_frame(TAPRing *ring, int n)
+{
+    return &ring->frames[(ring->tail + n) & TAP_RING_MASK];
+}
+
+void tap_ring_consume(TAPRing *ring, int count)
+{
+    /* done with the frames before the producer can reuse their slots */
+    smp_mb();
+    atomic_set(&ring->tail, ring->tail + count);
+}
+
+int tap_ring_drain(TAPRing *ring, int fd)
+{
+    int count = tap_ring_count(ring);
+    int n;
+
+    for (n = 0; n < count; n++) {
+        TAPFrame *frame = tap_ring_frame(ring, n);
+        ssize_t len;
+
+        do {
+            len = write(fd, frame->data, frame->size);
+        } while (len < 0 && errno == EINTR);
+        if (len < 0 && errno == EAGAIN) {
+            break;
+        }
+    }
+    if (n > 0) {
+        tap_ring_consume(ring, n);
+    }
+    return n;
+}
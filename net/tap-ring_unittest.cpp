@@ -0,0 +1,420 @@
+// Copyright 2015 The Android Open Source Project
+//
+// This software is licensed under the terms of the GNU General Public
+// License version 2, as published by the Free Software Foundation, and
+// may be copied, distributed, and modified under those terms.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+#include "net/tap-ring.h"
+
+#include <gtest/gtest.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+namespace {
+
+ssize_t readFrame(int fd, uint8_t* buf, int maxlen) {
+    return read(fd, buf, maxlen);
+}
+
+// Frame |n| is |size| bytes of value |n|.
+ssize_t putFrame(TAPRing* ring, int n, size_t size = 64) {
+    uint8_t data[TAP_FRAME_MAX + 1];
+    memset(data, n & 0xff, size);
+    struct iovec iov[2];
+    iov[0].iov_base = data;
+    iov[0].iov_len = size / 2;
+    iov[1].iov_base = data + size / 2;
+    iov[1].iov_len = size - size / 2;
+    return tap_ring_put(ring, iov, 2);
+}
+
+void writeFrame(int fd, int n, size_t size = 64) {
+    uint8_t data[TAP_FRAME_MAX];
+    memset(data, n & 0xff, size);
+    ASSERT_EQ((ssize_t)size, write(fd, data, size));
+}
+
+uint64_t nowUs() {
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return (uint64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+// A socket pair standing in for a TAP device and its peer: one frame per
+// datagram, non-blocking on the TAP side.
+class TapRingTest : public ::testing::Test {
+protected:
+    virtual void SetUp() {
+        ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_DGRAM, 0, mFds));
+        fcntl(mFds[0], F_SETFL, O_NONBLOCK);
+        tap_ring_init(&mRing);
+    }
+
+    virtual void TearDown() {
+        tap_ring_destroy(&mRing);
+        close(mFds[0]);
+        close(mFds[1]);
+    }
+
+    int tapFd() const { return mFds[0]; }
+    int peerFd() const { return mFds[1]; }
+
+    int mFds[2];
+    TAPRing mRing;
+};
+
+}  // namespace
+
+TEST_F(TapRingTest, PutAndConsume) {
+    EXPECT_EQ(TAP_RING_SIZE, tap_ring_space(&mRing));
+    EXPECT_EQ(0, tap_ring_count(&mRing));
+
+    EXPECT_EQ(64, putFrame(&mRing, 1));
+    EXPECT_EQ(100, putFrame(&mRing, 2, 100));
+    EXPECT_EQ(2, tap_ring_count(&mRing));
+    EXPECT_EQ(TAP_RING_SIZE - 2, tap_ring_space(&mRing));
+
+    TAPFrame* frame = tap_ring_frame(&mRing, 1);
+    EXPECT_EQ(100, frame->size);
+    EXPECT_EQ(2, frame->data[0]);
+    EXPECT_EQ(2, frame->data[99]);
+
+    tap_ring_consume(&mRing, 1);
+    EXPECT_EQ(1, tap_ring_count(&mRing));
+    EXPECT_EQ(100, tap_ring_frame(&mRing, 0)->size);
+    tap_ring_consume(&mRing, 1);
+    EXPECT_EQ(TAP_RING_SIZE, tap_ring_space(&mRing));
+}
+
+TEST_F(TapRingTest, PutFailsWhenFullOrTooLarge) {
+    EXPECT_EQ(-1, putFrame(&mRing, 0, TAP_FRAME_MAX + 1));
+    for (int n = 0; n < TAP_RING_SIZE; n++) {
+        ASSERT_EQ(64, putFrame(&mRing, n));
+    }
+    EXPECT_EQ(0, putFrame(&mRing, 0));
+    EXPECT_EQ(TAP_RING_SIZE, tap_ring_count(&mRing));
+
+    // Slots are reused once consumed, and the ring wraps around.
+    tap_ring_consume(&mRing, 10);
+    EXPECT_EQ(64, putFrame(&mRing, 300));
+    EXPECT_EQ(300 & 0xff,
+              tap_ring_frame(&mRing, TAP_RING_SIZE - 10)->data[0]);
+}
+
+TEST_F(TapRingTest, FillReadsAllAvailableFrames) {
+    for (int n = 0; n < 10; n++) {
+        writeFrame(peerFd(), n, 60 + n);
+    }
+    EXPECT_EQ(10, tap_ring_fill(&mRing, tapFd(), readFrame));
+    ASSERT_EQ(10, tap_ring_count(&mRing));
+    for (int n = 0; n < 10; n++) {
+        EXPECT_EQ(60 + n, tap_ring_frame(&mRing, n)->size);
+        EXPECT_EQ(n, tap_ring_frame(&mRing, n)->data[0]);
+    }
+    EXPECT_EQ(0, tap_ring_fill(&mRing, tapFd(), readFrame));
+}
+
+TEST_F(TapRingTest, FillStopsWhenFull) {
+    for (int n = 0; n < TAP_RING_SIZE - 2; n++) {
+        ASSERT_EQ(64, putFrame(&mRing, n));
+    }
+    for (int n = 0; n < 5; n++) {
+        writeFrame(peerFd(), n);
+    }
+    EXPECT_EQ(2, tap_ring_fill(&mRing, tapFd(), readFrame));
+    EXPECT_EQ(0, tap_ring_space(&mRing));
+
+    // The other frames are left in the device.
+    tap_ring_consume(&mRing, TAP_RING_SIZE);
+    EXPECT_EQ(3, tap_ring_fill(&mRing, tapFd(), readFrame));
+}
+
+TEST_F(TapRingTest, DrainWritesAllFrames) {
+    for (int n = 0; n < 5; n++) {
+        ASSERT_EQ(64, putFrame(&mRing, n));
+    }
+    EXPECT_EQ(5, tap_ring_drain(&mRing, tapFd()));
+    EXPECT_EQ(0, tap_ring_count(&mRing));
+
+    uint8_t buf[TAP_FRAME_MAX];
+    for (int n = 0; n < 5; n++) {
+        ASSERT_EQ(64, read(peerFd(), buf, sizeof(buf)));
+        EXPECT_EQ(n, buf[0]);
+    }
+}
+
+TEST_F(TapRingTest, DrainStopsWhenDeviceWouldBlock) {
+    for (int n = 0; n < TAP_RING_SIZE; n++) {
+        ASSERT_EQ(TAP_FRAME_MAX, putFrame(&mRing, n, TAP_FRAME_MAX));
+    }
+    // 1 MB doesn't fit in the socket buffer.
+    int written = tap_ring_drain(&mRing, tapFd());
+    EXPECT_LT(0, written);
+    EXPECT_GT(TAP_RING_SIZE, written);
+    EXPECT_EQ(TAP_RING_SIZE - written, tap_ring_count(&mRing));
+
+    // Nothing is lost or reordered once the peer catches up.
+    uint8_t buf[TAP_FRAME_MAX];
+    int received = 0;
+    while (received < TAP_RING_SIZE) {
+        while (read(peerFd(), buf, sizeof(buf)) == TAP_FRAME_MAX) {
+            EXPECT_EQ(received & 0xff, buf[0]);
+            if (++received == written) {
+                break;
+            }
+        }
+        written += tap_ring_drain(&mRing, tapFd());
+    }
+    EXPECT_EQ(0, tap_ring_count(&mRing));
+}
+
+namespace {
+
+const int kThreadedFrames = 100000;
+
+void* producerMain(void* opaque) {
+    TAPRing* ring = static_cast<TAPRing*>(opaque);
+    for (int n = 0; n < kThreadedFrames; ) {
+        if (putFrame(ring, n, 16 + n % 64) > 0) {
+            n++;
+        } else {
+            sched_yield();
+        }
+    }
+    return NULL;
+}
+
+}  // namespace
+
+TEST_F(TapRingTest, ProducerAndConsumerThreads) {
+    pthread_t thread;
+    ASSERT_EQ(0, pthread_create(&thread, NULL, producerMain, &mRing));
+    int received = 0;
+    while (received < kThreadedFrames) {
+        int count = tap_ring_count(&mRing);
+        for (int n = 0; n < count; n++, received++) {
+            TAPFrame* frame = tap_ring_frame(&mRing, n);
+            ASSERT_EQ(16 + received % 64, frame->size);
+            ASSERT_EQ(received & 0xff, frame->data[frame->size - 1]);
+        }
+        if (count > 0) {
+            tap_ring_consume(&mRing, count);
+        } else {
+            sched_yield();
+        }
+    }
+    pthread_join(thread, NULL);
+    EXPECT_EQ(0, tap_ring_count(&mRing));
+}
+
+namespace {
+
+const int kBenchFrames = 200000;
+const size_t kBenchFrameSize = 1500;
+
+// The I/O thread of the benchmark: reads frames from the TAP side into
+// |rx| and wakes the main loop through |notify|, and writes the frames of
+// |tx|, like tap_thread_main() does.
+struct BenchIoThread {
+    int tapFd;
+    int notify[2];
+    int wake[2];
+    volatile int quit;
+    TAPRing rx;
+    TAPRing tx;
+};
+
+void* benchIoMain(void* opaque) {
+    BenchIoThread* io = static_cast<BenchIoThread*>(opaque);
+    char dummy[64];
+    while (!io->quit) {
+        while (read(io->wake[0], dummy, sizeof(dummy)) > 0) {}
+        tap_ring_drain(&io->tx, io->tapFd);
+        if (tap_ring_fill(&io->rx, io->tapFd, readFrame) > 0) {
+            if (write(io->notify[1], "", 1) < 0) {}
+        }
+        struct pollfd fds[2];
+        fds[0].fd = io->tapFd;
+        fds[0].events = tap_ring_space(&io->rx) > 0 ? POLLIN : 0;
+        if (tap_ring_count(&io->tx) > 0) {
+            fds[0].events |= POLLOUT;
+        }
+        fds[1].fd = io->wake[0];
+        fds[1].events = POLLIN;
+        poll(fds, 2, 10);
+    }
+    return NULL;
+}
+
+void* benchPeerWriterMain(void* opaque) {
+    int fd = *static_cast<int*>(opaque);
+    uint8_t data[kBenchFrameSize];
+    memset(data, 0x5a, sizeof(data));
+    for (int n = 0; n < kBenchFrames; n++) {
+        while (write(fd, data, sizeof(data)) < 0 && errno == EINTR) {}
+    }
+    return NULL;
+}
+
+void* benchPeerReaderMain(void* opaque) {
+    int fd = *static_cast<int*>(opaque);
+    uint8_t data[TAP_FRAME_MAX];
+    for (int n = 0; n < kBenchFrames; n++) {
+        while (read(fd, data, sizeof(data)) < 0 && errno == EINTR) {}
+    }
+    return NULL;
+}
+
+void makeDevice(int fds[2]) {
+    ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_DGRAM, 0, fds));
+    fcntl(fds[0], F_SETFL, O_NONBLOCK);
+}
+
+}  // namespace
+
+// Compares moving frames between a socket pair standing in for a TAP
+// device and the main loop, with the main loop doing the I/O like
+// 'iothread=off', and through an I/O thread and rings like 'iothread=on'.
+// Reports the main loop wakeups and the time spent in the main loop per
+// frame. With a single CPU, the I/O thread can only run when the main loop
+// blocks, so compare the overall time on a multi-core host. Run with
+// --gtest_also_run_disabled_tests.
+TEST(TapRingBenchmark, DISABLED_Benchmark) {
+    uint8_t buf[TAP_FRAME_MAX];
+    uint8_t sink[TAP_FRAME_MAX];
+    int fds[2];
+    pthread_t peer;
+
+    // Receive, main loop only: poll() then read() until EAGAIN.
+    makeDevice(fds);
+    pthread_create(&peer, NULL, benchPeerWriterMain, &fds[1]);
+    uint64_t busyUs = 0;
+    int wakeups = 0;
+    for (int received = 0; received < kBenchFrames; ) {
+        struct pollfd pfd = { fds[0], POLLIN, 0 };
+        poll(&pfd, 1, -1);
+        wakeups++;
+        uint64_t start = nowUs();
+        ssize_t size;
+        while ((size = read(fds[0], buf, sizeof(buf))) > 0) {
+            memcpy(sink, buf, size);  // stands in for the NIC model
+            received++;
+        }
+        busyUs += nowUs() - start;
+    }
+    pthread_join(peer, NULL);
+    close(fds[0]);
+    close(fds[1]);
+    printf("rx, iothread=off: %.2f frames/wakeup, %.3f us/frame in the "
+           "main loop\n",
+           (double)kBenchFrames / wakeups, (double)busyUs / kBenchFrames);
+
+    // Receive through the I/O thread.
+    BenchIoThread io;
+    makeDevice(fds);
+    io.tapFd = fds[0];
+    io.quit = 0;
+    ASSERT_EQ(0, pipe(io.notify));
+    ASSERT_EQ(0, pipe(io.wake));
+    fcntl(io.notify[0], F_SETFL, O_NONBLOCK);
+    fcntl(io.wake[0], F_SETFL, O_NONBLOCK);
+    tap_ring_init(&io.rx);
+    tap_ring_init(&io.tx);
+    pthread_t ioThread;
+    pthread_create(&ioThread, NULL, benchIoMain, &io);
+    pthread_create(&peer, NULL, benchPeerWriterMain, &fds[1]);
+    busyUs = 0;
+    wakeups = 0;
+    for (int received = 0; received < kBenchFrames; ) {
+        struct pollfd pfd = { io.notify[0], POLLIN, 0 };
+        poll(&pfd, 1, -1);
+        wakeups++;
+        uint64_t start = nowUs();
+        char dummy[64];
+        while (read(io.notify[0], dummy, sizeof(dummy)) > 0) {}
+        int count = tap_ring_count(&io.rx);
+        for (int n = 0; n < count; n++) {
+            TAPFrame* frame = tap_ring_frame(&io.rx, n);
+            memcpy(sink, frame->data, frame->size);
+        }
+        tap_ring_consume(&io.rx, count);
+        if (write(io.wake[1], "", 1) < 0) {}
+        received += count;
+        busyUs += nowUs() - start;
+    }
+    pthread_join(peer, NULL);
+    printf("rx, iothread=on:  %.2f frames/wakeup, %.3f us/frame in the "
+           "main loop\n",
+           (double)kBenchFrames / wakeups, (double)busyUs / kBenchFrames);
+
+    // Send, main loop only: one blocking write() per frame, like
+    // tap_receive().
+    memset(buf, 0xa5, kBenchFrameSize);
+    int mainFds[2];
+    makeDevice(mainFds);
+    pthread_create(&peer, NULL, benchPeerReaderMain, &mainFds[1]);
+    uint64_t start = nowUs();
+    for (int n = 0; n < kBenchFrames; n++) {
+        while (write(mainFds[0], buf, kBenchFrameSize) < 0 &&
+               (errno == EINTR || errno == EAGAIN)) {}
+    }
+    pthread_join(peer, NULL);
+    busyUs = nowUs() - start;
+    close(mainFds[0]);
+    close(mainFds[1]);
+    printf("tx, iothread=off: %.3f us/frame in the main loop and "
+           "overall\n", (double)busyUs / kBenchFrames);
+
+    // Send through the I/O thread: queue the frame, and kick the thread.
+    // Time spent waiting for the thread to free slots isn't busy time.
+    pthread_create(&peer, NULL, benchPeerReaderMain, &fds[1]);
+    start = nowUs();
+    uint64_t waitUs = 0;
+    int kicks = 0;
+    for (int n = 0; n < kBenchFrames; n++) {
+        struct iovec iov = { buf, kBenchFrameSize };
+        bool wasEmpty = tap_ring_space(&io.tx) == TAP_RING_SIZE;
+        if (tap_ring_put(&io.tx, &iov, 1) == 0) {
+            uint64_t waitStart = nowUs();
+            while (tap_ring_put(&io.tx, &iov, 1) == 0) {
+                sched_yield();
+            }
+            waitUs += nowUs() - waitStart;
+        }
+        if (wasEmpty) {
+            if (write(io.wake[1], "", 1) < 0) {}
+            kicks++;
+        }
+    }
+    pthread_join(peer, NULL);
+    uint64_t totalUs = nowUs() - start;
+    printf("tx, iothread=on:  %.3f us/frame in the main loop, "
+           "%.2f frames/kick, %.3f us/frame overall\n",
+           (double)(totalUs - waitUs) / kBenchFrames,
+           (double)kBenchFrames / kicks, (double)totalUs / kBenchFrames);
+
+    io.quit = 1;
+    if (write(io.wake[1], "", 1) < 0) {}
+    pthread_join(ioThread, NULL);
+    tap_ring_destroy(&io.rx);
+    tap_ring_destroy(&io.tx);
+    close(io.notify[0]);
+    close(io.notify[1]);
+    close(io.wake[0]);
+    close(io.wake[1]);
+    close(fds[0]);
+    close(fds[1]);
+}
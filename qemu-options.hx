@@ -744,12 +744,13 @@ DEF("net", HAS_ARG, QEMU_OPTION_net,
     "-net tap[,vlan=n][,name=str],ifname=name\n"
     "                connect the host TAP network interface to VLAN 'n'\n"
 #else
-    "-net tap[,vlan=n][,name=str][,fd=h][,ifname=name][,script=file][,downscript=dfile]\n"
+    "-net tap[,vlan=n][,name=str][,fd=h][,ifname=name][,script=file][,downscript=dfile][,iothread=on|off]\n"
     "                connect the host TAP network interface to VLAN 'n' and use the\n"
     "                network scripts 'file' (default=%s)\n"
     "                and 'dfile' (default=%s);\n"
     "                use '[down]script=no' to disable script execution;\n"
-    "                use 'fd=h' to connect to an already opened TAP interface\n"
+    "                use 'fd=h' to connect to an already opened TAP interface;\n"
+    "                use 'iothread=on' to read and write frames from a dedicated thread\n"
 #endif
     "-net socket[,vlan=n][,name=str][,fd=h][,listen=[host]:port][,connect=host:port]\n"
     "                connect the vlan 'n' to another VLAN using a socket connection\n"
@@ -789,7 +790,7 @@ hostname reported by the builtin DHCP server.
 @item -net channel,@var{port}:@var{dev}
 Forward @option{user} TCP connection to port @var{port} to character device @var{dev}
 
-@item -net tap[,vlan=@var{n}][,name=@var{name}][,fd=@var{h}][,ifname=@var{name}][,script=@var{file}][,downscript=@var{dfile}]
+@item -net tap[,vlan=@var{n}][,name=@var{name}][,fd=@var{h}][,ifname=@var{name}][,script=@var{file}][,downscript=@var{dfile}][,iothread=on|off]
 Connect the host TAP network interface @var{name} to VLAN @var{n}, use
 the network script @var{file} to configure it and the network script
 @var{dfile} to deconfigure it. If @var{name} is not provided, the OS
@@ -797,7 +798,11 @@ automatically provides one. @option{fd}=@var{h} can be used to specify
 the handle of an already opened host TAP interface. The default network
 configure script is @file{/etc/qemu-ifup} and the default network
 deconfigure script is @file{/etc/qemu-ifdown}. Use @option{script=no}
-or @option{downscript=no} to disable script execution. Example:
+or @option{downscript=no} to disable script execution.
+@option{iothread=on} does the TAP device I/O on a dedicated thread. It
+hands incoming frames to the NIC in batches, waking the main loop at most
+once per batch, and writes the frames sent by the NIC in batches too. The
+default is @option{iothread=off}. Example:
 
 @example
 qemu linux.img -net nic -net tap
@@ -1491,6 +1496,14 @@ STEXI
 Limits the maximum DNS connections to @var{limit}.
 ETEXI
 
+DEF("no-dns-cache", 0, QEMU_OPTION_no_dns_cache, \
+    "-no-dns-cache \n"
+    "                Forward every guest DNS query to the host resolver\n")
+STEXI
+@item -no-dns-cache
+Disable the DNS cache, forwarding every guest DNS query to the host resolver.
+ETEXI
+
 DEF("allow-udp", HAS_ARG, QEMU_OPTION_allow_udp, \
     "-allow-udp host:port \n"
     "                Allows udp connections to go through to host:port\n")
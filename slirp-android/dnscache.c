@@ -0,0 +1,676 @@
+/* Copyright (C) 2015 The Android Open Source Project
+**
+** This software is licensed under the terms of the GNU General Public
+** License version 2, as published by the Free Software Foundation, and
+** may be copied, distributed, and modified under those terms.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+*/
+#include "dnscache.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/* See RFC 1035 for the message format. Only standard queries with a
+ * single question are cached. The cache key is made of the RD/CD flags,
+ * the question with a lower-cased name, and the EDNS0 state of the query
+ * (no OPT record, OPT record, or OPT record with the DO bit), so that
+ * queries which may get different answers never share an entry.
+ *
+ * The rest of the additional section isn't part of the key: the OPT
+ * record of a reply may differ from the query's (e.g. in its payload
+ * size), and replies carry glue records. A reply is matched to its
+ * pending query by id and question, and a cached reply is only used for
+ * queries whose maximum UDP payload size it fits in (RFC 6891).
+ *
+ * Replies sent from the cache, or to coalesced queries, carry the
+ * question exactly as each client sent it, since some resolvers check
+ * the case of the name they randomized (DNS 0x20).
+ */
+
+#define  DNS_HEADER_SIZE          12
+#define  DNS_FLAG_QR              0x8000
+#define  DNS_FLAG_TC              0x0200
+#define  DNS_FLAG_RD              0x0100
+#define  DNS_FLAG_CD              0x0010
+#define  DNS_OPCODE_MASK          0x7800
+#define  DNS_RCODE_MASK           0x000f
+#define  DNS_RCODE_NOERROR        0
+#define  DNS_RCODE_NXDOMAIN       3
+#define  DNS_TYPE_OPT             41
+
+/* EDNS0 states of a query, the last byte of its cache key */
+#define  DNS_EDNS_NONE            0
+#define  DNS_EDNS_ON              1
+#define  DNS_EDNS_DO              2
+
+/* Maximum UDP payload size of queries without an OPT record */
+#define  DNS_UDP_SIZE_PLAIN       512
+
+#define  DNS_CACHE_KEY_MAX        512
+#define  DNS_CACHE_ENTRIES        256
+#define  DNS_CACHE_BUCKETS        512
+#define  DNS_CACHE_TTLS_MAX       32
+#define  DNS_CACHE_PENDING_MAX    32
+#define  DNS_CACHE_WAITERS_MAX    16
+
+/* Upper bounds for cached TTLs, in seconds */
+#define  DNS_CACHE_TTL_MAX            3600
+#define  DNS_CACHE_NEGATIVE_TTL_MAX   300
+
+/* How long to wait for the host resolver before giving up on coalescing */
+#define  DNS_CACHE_PENDING_TIMEOUT_MS 5000
+
+typedef struct {
+    int        used;
+    int        next;        /* next entry in hash bucket, or -1 */
+    uint32_t   hash;
+    int        key_len;
+    uint8_t    key[DNS_CACHE_KEY_MAX];
+    uint8_t*   reply;
+    int        reply_len;
+    int        ttl_count;
+    uint16_t   ttl_offsets[DNS_CACHE_TTLS_MAX];
+    unsigned   stored_ms;
+    unsigned   expire_ms;
+} DnsCacheEntry;
+
+typedef struct {
+    DnsCacheEndpoint  ep;
+    uint16_t          id;
+    int               udp_size;  /* maximum UDP payload size of the reply */
+    /* bit n is set if byte n of the question was upper case */
+    uint8_t           qcase[DNS_CACHE_KEY_MAX / 8];
+} DnsCacheWaiter;
+
+typedef struct {
+    int               used;
+    uint32_t          hash;
+    int               key_len;
+    uint8_t           key[DNS_CACHE_KEY_MAX];
+    uint16_t          id;        /* id of the forwarded query */
+    DnsCacheEndpoint  leader;    /* client of the forwarded query */
+    unsigned          expire_ms;
+    int               waiter_count;
+    DnsCacheWaiter    waiters[DNS_CACHE_WAITERS_MAX];
+} DnsCachePending;
+
+typedef struct {
+    int               disabled;
+    DnsCacheSendFunc  send;
+    void*             send_opaque;
+    int               buckets[DNS_CACHE_BUCKETS];
+    DnsCacheEntry     entries[DNS_CACHE_ENTRIES];
+    DnsCachePending   pending[DNS_CACHE_PENDING_MAX];
+    DnsCacheStats     stats;
+} DnsCache;
+
+static DnsCache  _dns_cache[1];
+
+static int
+dns_time_before( unsigned  a, unsigned  b )
+{
+    return (int)(a - b) < 0;
+}
+
+static unsigned
+dns_get16( const uint8_t*  p )
+{
+    return ((unsigned)p[0] << 8) | p[1];
+}
+
+static uint32_t
+dns_get32( const uint8_t*  p )
+{
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) |
+           ((uint32_t)p[2] << 8)  | p[3];
+}
+
+static void
+dns_put16( uint8_t*  p, unsigned  v )
+{
+    p[0] = (uint8_t)(v >> 8);
+    p[1] = (uint8_t) v;
+}
+
+static void
+dns_put32( uint8_t*  p, uint32_t  v )
+{
+    p[0] = (uint8_t)(v >> 24);
+    p[1] = (uint8_t)(v >> 16);
+    p[2] = (uint8_t)(v >> 8);
+    p[3] = (uint8_t) v;
+}
+
+static uint32_t
+dns_hash( const uint8_t*  key, int  len )
+{
+    uint32_t  h = 2166136261U;  /* FNV-1a */
+    int       nn;
+    for (nn = 0; nn < len; nn++) {
+        h ^= key[nn];
+        h *= 16777619U;
+    }
+    return h;
+}
+
+/* Skip a possibly compressed domain name starting at 'pos'. Returns the
+ * position following it, or -1 if the message is malformed. */
+static int
+dns_skip_name( const uint8_t*  msg, int  len, int  pos )
+{
+    while (pos < len) {
+        unsigned  c = msg[pos];
+        if (c == 0)
+            return pos + 1;
+        if ((c & 0xc0) == 0xc0)
+            return (pos + 2 <= len) ? pos + 2 : -1;
+        if (c & 0xc0)
+            return -1;
+        pos += 1 + c;
+    }
+    return -1;
+}
+
+/* Build the part of the cache key that queries and their replies share,
+ * i.e. the RD/CD flags and the question, into 'key'. Returns the key
+ * length, or -1 if the message can't be cached. The question ends at
+ * DNS_HEADER_SIZE + length - 2. */
+static int
+dns_make_key( const uint8_t*  msg, int  len, uint8_t*  key )
+{
+    unsigned  flags;
+    int       pos, qend, klen, nn;
+
+    if (len < DNS_HEADER_SIZE)
+        return -1;
+
+    flags = dns_get16(msg + 2);
+    if ((flags & DNS_OPCODE_MASK) != 0 || dns_get16(msg + 4) != 1)
+        return -1;
+
+    /* the question name must not be compressed */
+    pos = DNS_HEADER_SIZE;
+    while (pos < len && msg[pos] != 0) {
+        if (msg[pos] & 0xc0)
+            return -1;
+        pos += 1 + msg[pos];
+    }
+    qend = pos + 1 + 4;  /* terminating zero + qtype + qclass */
+    if (qend > len)
+        return -1;
+
+    /* leave room for the EDNS0 state of queries */
+    klen = 2 + (qend - DNS_HEADER_SIZE);
+    if (klen + 1 > DNS_CACHE_KEY_MAX)
+        return -1;
+
+    dns_put16(key, flags & (DNS_FLAG_RD | DNS_FLAG_CD));
+    for (nn = DNS_HEADER_SIZE; nn < qend; nn++) {
+        uint8_t  c = msg[nn];
+        if (c >= 'A' && c <= 'Z')
+            c += 'a' - 'A';
+        key[2 + nn - DNS_HEADER_SIZE] = c;
+    }
+    return klen;
+}
+
+/* Find the OPT record in the additional section of a query, which starts
+ * at 'pos'. Returns the query's DNS_EDNS_XXX state, or -1 if the query
+ * is malformed, and sets '*pudp_size' to the maximum UDP payload size of
+ * its replies. */
+static int
+dns_query_edns( const uint8_t*  msg, int  len, int  pos, int*  pudp_size )
+{
+    int  nn, count = dns_get16(msg + 10);
+
+    *pudp_size = DNS_UDP_SIZE_PLAIN;
+    for (nn = 0; nn < count; nn++) {
+        pos = dns_skip_name(msg, len, pos);
+        if (pos < 0 || pos + 10 > len)
+            return -1;
+        if (dns_get16(msg + pos) == DNS_TYPE_OPT) {
+            /* the class is the payload size, and the DO bit is the
+             * highest bit of the flags in the low half of the TTL */
+            int  udp_size = dns_get16(msg + pos + 2);
+            if (udp_size > DNS_UDP_SIZE_PLAIN)
+                *pudp_size = udp_size;
+            return (msg[pos + 6] & 0x80) ? DNS_EDNS_DO : DNS_EDNS_ON;
+        }
+        pos += 10 + dns_get16(msg + pos + 8);
+        if (pos > len)
+            return -1;
+    }
+    return DNS_EDNS_NONE;
+}
+
+/* Find the TTL fields of all non-OPT resource records of a reply. Returns
+ * their count, or -1 if the reply can't be cached. '*pmin_ttl' receives
+ * the smallest TTL of the answer and authority sections. */
+static int
+dns_find_ttls( const uint8_t*  msg, int  len, uint16_t*  offsets,
+               uint32_t*  pmin_ttl )
+{
+    int       pos, nn, count, answers, ttl_count = 0;
+    uint32_t  min_ttl = 0xffffffff;
+
+    pos = dns_skip_name(msg, len, DNS_HEADER_SIZE);
+    if (pos < 0 || pos + 4 > len)
+        return -1;
+    pos += 4;
+
+    answers = dns_get16(msg + 6) + dns_get16(msg + 8);
+    count   = answers + dns_get16(msg + 10);
+
+    for (nn = 0; nn < count; nn++) {
+        unsigned  type;
+
+        pos = dns_skip_name(msg, len, pos);
+        if (pos < 0 || pos + 10 > len)
+            return -1;
+
+        type = dns_get16(msg + pos);
+        if (type != DNS_TYPE_OPT) {
+            uint32_t  ttl = dns_get32(msg + pos + 4);
+            if (ttl_count >= DNS_CACHE_TTLS_MAX)
+                return -1;
+            offsets[ttl_count++] = (uint16_t)(pos + 4);
+            if (nn < answers && ttl < min_ttl)
+                min_ttl = ttl;
+        }
+        pos += 10 + dns_get16(msg + pos + 8);
+        if (pos > len)
+            return -1;
+    }
+    *pmin_ttl = min_ttl;
+    return ttl_count;
+}
+
+static void
+dns_cache_entry_remove( DnsCache*  cache, int  index )
+{
+    DnsCacheEntry*  e    = &cache->entries[index];
+    int*            link = &cache->buckets[e->hash % DNS_CACHE_BUCKETS];
+
+    while (*link != index)
+        link = &cache->entries[*link].next;
+    *link = e->next;
+
+    free(e->reply);
+    e->reply = NULL;
+    e->used  = 0;
+    cache->stats.entries--;
+}
+
+static int
+dns_cache_entry_find( DnsCache*  cache, const uint8_t*  key, int  key_len,
+                      uint32_t  hash, unsigned  now_ms )
+{
+    int  index = cache->buckets[hash % DNS_CACHE_BUCKETS];
+
+    while (index >= 0) {
+        DnsCacheEntry*  e = &cache->entries[index];
+        if (e->hash == hash && e->key_len == key_len &&
+            !memcmp(e->key, key, key_len)) {
+            if (!dns_time_before(now_ms, e->expire_ms)) {
+                dns_cache_entry_remove(cache, index);
+                return -1;
+            }
+            return index;
+        }
+        index = e->next;
+    }
+    return -1;
+}
+
+static void
+dns_cache_insert( DnsCache*  cache, const uint8_t*  key, int  key_len,
+                  uint32_t  hash, const uint8_t*  reply, int  len,
+                  unsigned  now_ms )
+{
+    DnsCacheEntry*  e;
+    uint16_t        offsets[DNS_CACHE_TTLS_MAX];
+    uint32_t        ttl;
+    unsigned        flags = dns_get16(reply + 2);
+    unsigned        rcode = flags & DNS_RCODE_MASK;
+    int             ttl_count, nn, index = -1;
+
+    if ((flags & DNS_FLAG_TC) ||
+        (rcode != DNS_RCODE_NOERROR && rcode != DNS_RCODE_NXDOMAIN))
+        return;
+
+    ttl_count = dns_find_ttls(reply, len, offsets, &ttl);
+    if (ttl_count < 0)
+        return;
+
+    if (dns_get16(reply + 6) == 0) {
+        /* negative answer, use the SOA record TTL from the authority
+         * section if any, see RFC 2308 */
+        if (dns_get16(reply + 8) == 0 || ttl_count == 0)
+            return;
+        ttl = dns_get32(reply + offsets[0]);
+        if (ttl > DNS_CACHE_NEGATIVE_TTL_MAX)
+            ttl = DNS_CACHE_NEGATIVE_TTL_MAX;
+    } else if (ttl > DNS_CACHE_TTL_MAX) {
+        ttl = DNS_CACHE_TTL_MAX;
+    }
+    if (ttl == 0)
+        return;
+
+    /* replace an existing entry, or find a free one, or evict the one
+     * that expires first */
+    nn = dns_cache_entry_find(cache, key, key_len, hash, now_ms);
+    if (nn >= 0)
+        dns_cache_entry_remove(cache, nn);
+
+    for (nn = 0; nn < DNS_CACHE_ENTRIES; nn++) {
+        e = &cache->entries[nn];
+        if (!e->used) {
+            index = nn;
+            break;
+        }
+        if (index < 0 ||
+            dns_time_before(e->expire_ms, cache->entries[index].expire_ms))
+            index = nn;
+    }
+    e = &cache->entries[index];
+    if (e->used) {
+        if (dns_time_before(now_ms, e->expire_ms))
+            cache->stats.evictions++;
+        dns_cache_entry_remove(cache, index);
+    }
+
+    e->reply = malloc(len);
+    if (e->reply == NULL)
+        return;
+    memcpy(e->reply, reply, len);
+    e->reply_len = len;
+    memcpy(e->key, key, key_len);
+    e->key_len   = key_len;
+    e->hash      = hash;
+    e->ttl_count = ttl_count;
+    memcpy(e->ttl_offsets, offsets, ttl_count * sizeof(offsets[0]));
+    e->stored_ms = now_ms;
+    e->expire_ms = now_ms + ttl * 1000U;
+    e->used      = 1;
+    e->next      = cache->buckets[hash % DNS_CACHE_BUCKETS];
+    cache->buckets[hash % DNS_CACHE_BUCKETS] = index;
+
+    cache->stats.entries++;
+    cache->stats.inserts++;
+}
+
+/* Record in 'qcase' which bytes of the 'qlen' bytes long 'question' are
+ * upper case letters. */
+static void
+dns_get_case( const uint8_t*  question, int  qlen, uint8_t*  qcase )
+{
+    int  nn;
+
+    memset(qcase, 0, DNS_CACHE_KEY_MAX / 8);
+    for (nn = 0; nn < qlen; nn++) {
+        if (question[nn] >= 'A' && question[nn] <= 'Z')
+            qcase[nn / 8] |= (uint8_t)(1 << (nn % 8));
+    }
+}
+
+/* Rebuild a question from its lower-cased copy 'lower' and the 'qcase'
+ * bits recorded by dns_get_case(). */
+static void
+dns_set_case( uint8_t*  question, const uint8_t*  lower, int  qlen,
+              const uint8_t*  qcase )
+{
+    int  nn;
+
+    for (nn = 0; nn < qlen; nn++) {
+        uint8_t  c = lower[nn];
+        if (qcase[nn / 8] & (1 << (nn % 8)))
+            c -= 'a' - 'A';
+        question[nn] = c;
+    }
+}
+
+/* Send 'reply' to 'ep' with the query id 'id' and the client's 'qlen'
+ * bytes long 'question'. If 'e' is not NULL, the TTLs are decremented by
+ * the time spent in the cache. A reply larger than 'udp_size' is sent
+ * truncated to its header and question, with the TC flag set, so that
+ * the client retries over TCP (RFC 1035, section 4.2.1). */
+static void
+dns_cache_send( DnsCache*  cache, const DnsCacheEntry*  e,
+                const uint8_t*  reply, int  len,
+                const DnsCacheEndpoint*  ep, uint16_t  id,
+                const uint8_t*  question, int  qlen, int  udp_size,
+                unsigned  now_ms )
+{
+    int       truncated = (len > udp_size);
+    uint8_t*  copy;
+    int       nn;
+
+    if (truncated)
+        len = DNS_HEADER_SIZE + qlen;
+
+    copy = malloc(len);
+    if (copy == NULL)
+        return;
+
+    memcpy(copy, reply, len);
+    dns_put16(copy, id);
+    memcpy(copy + DNS_HEADER_SIZE, question, qlen);
+
+    if (truncated) {
+        dns_put16(copy + 2, dns_get16(reply + 2) | DNS_FLAG_TC);
+        dns_put16(copy + 6, 0);
+        dns_put16(copy + 8, 0);
+        dns_put16(copy + 10, 0);
+        e = NULL;
+    }
+
+    if (e != NULL) {
+        uint32_t  elapsed = (now_ms - e->stored_ms) / 1000U;
+        for (nn = 0; nn < e->ttl_count; nn++) {
+            uint8_t*  p   = copy + e->ttl_offsets[nn];
+            uint32_t  ttl = dns_get32(p);
+            dns_put32(p, ttl > elapsed ? ttl - elapsed : 0);
+        }
+    }
+
+    cache->send(cache->send_opaque, ep, copy, len);
+    free(copy);
+}
+
+static int
+dns_endpoint_equal( const DnsCacheEndpoint*  a, const DnsCacheEndpoint*  b )
+{
+    return a->client_ip == b->client_ip && a->client_port == b->client_port;
+}
+
+void
+dns_cache_init( DnsCacheSendFunc  send, void*  opaque )
+{
+    DnsCache*  cache = _dns_cache;
+
+    cache->send        = send;
+    cache->send_opaque = opaque;
+    memset(&cache->stats, 0, sizeof(cache->stats));
+    dns_cache_flush();
+}
+
+void
+dns_cache_set_enabled( int  enabled )
+{
+    DnsCache*  cache = _dns_cache;
+
+    cache->disabled = !enabled;
+    if (!enabled)
+        dns_cache_flush();
+}
+
+void
+dns_cache_flush( void )
+{
+    DnsCache*  cache = _dns_cache;
+    int        nn;
+
+    for (nn = 0; nn < DNS_CACHE_ENTRIES; nn++) {
+        free(cache->entries[nn].reply);
+        cache->entries[nn].reply = NULL;
+        cache->entries[nn].used  = 0;
+    }
+    for (nn = 0; nn < DNS_CACHE_BUCKETS; nn++)
+        cache->buckets[nn] = -1;
+    for (nn = 0; nn < DNS_CACHE_PENDING_MAX; nn++)
+        cache->pending[nn].used = 0;
+
+    cache->stats.entries = 0;
+}
+
+int
+dns_cache_query( const DnsCacheEndpoint*  ep,
+                 const uint8_t*           query,
+                 int                      len,
+                 unsigned                 now_ms )
+{
+    DnsCache*         cache = _dns_cache;
+    DnsCachePending*  free_slot = NULL;
+    uint8_t           key[DNS_CACHE_KEY_MAX];
+    int               key_len, index, nn, edns, udp_size;
+    uint32_t          hash;
+    uint16_t          id;
+
+    if (cache->disabled || cache->send == NULL)
+        return 0;
+
+    if (len < DNS_HEADER_SIZE || (dns_get16(query + 2) & DNS_FLAG_QR) ||
+        dns_get16(query + 6) != 0 || dns_get16(query + 8) != 0)
+        return 0;
+
+    key_len = dns_make_key(query, len, key);
+    if (key_len < 0)
+        return 0;
+
+    edns = dns_query_edns(query, len, DNS_HEADER_SIZE + key_len - 2,
+                          &udp_size);
+    if (edns < 0)
+        return 0;
+    key[key_len++] = (uint8_t) edns;
+
+    hash = dns_hash(key, key_len);
+    id   = (uint16_t) dns_get16(query);
+
+    /* a cached reply too large for this client is fetched again */
+    index = dns_cache_entry_find(cache, key, key_len, hash, now_ms);
+    if (index >= 0 && cache->entries[index].reply_len <= udp_size) {
+        const DnsCacheEntry*  e = &cache->entries[index];
+        cache->stats.hits++;
+        dns_cache_send(cache, e, e->reply, e->reply_len, ep, id,
+                       query + DNS_HEADER_SIZE, key_len - 3, udp_size,
+                       now_ms);
+        return 1;
+    }
+
+    for (nn = 0; nn < DNS_CACHE_PENDING_MAX; nn++) {
+        DnsCachePending*  p = &cache->pending[nn];
+        int               ww;
+
+        if (p->used && !dns_time_before(now_ms, p->expire_ms))
+            p->used = 0;
+
+        if (!p->used) {
+            if (free_slot == NULL)
+                free_slot = p;
+            continue;
+        }
+        if (p->hash != hash || p->key_len != key_len ||
+            memcmp(p->key, key, key_len) != 0)
+            continue;
+
+        /* a retransmission by the original client goes to the host
+         * resolver again, in case the first query was lost */
+        if (dns_endpoint_equal(&p->leader, ep) && p->id == id) {
+            cache->stats.misses++;
+            return 0;
+        }
+        for (ww = 0; ww < p->waiter_count; ww++) {
+            if (dns_endpoint_equal(&p->waiters[ww].ep, ep) &&
+                p->waiters[ww].id == id) {
+                return 1;
+            }
+        }
+        if (p->waiter_count == DNS_CACHE_WAITERS_MAX)
+            break;
+        p->waiters[p->waiter_count].ep       = *ep;
+        p->waiters[p->waiter_count].id       = id;
+        p->waiters[p->waiter_count].udp_size = udp_size;
+        dns_get_case(query + DNS_HEADER_SIZE, key_len - 3,
+                     p->waiters[p->waiter_count].qcase);
+        p->waiter_count++;
+        cache->stats.coalesced++;
+        return 1;
+    }
+
+    cache->stats.misses++;
+    if (free_slot != NULL && nn == DNS_CACHE_PENDING_MAX) {
+        free_slot->used         = 1;
+        free_slot->hash         = hash;
+        free_slot->key_len      = key_len;
+        memcpy(free_slot->key, key, key_len);
+        free_slot->id           = id;
+        free_slot->leader       = *ep;
+        free_slot->expire_ms    = now_ms + DNS_CACHE_PENDING_TIMEOUT_MS;
+        free_slot->waiter_count = 0;
+    }
+    return 0;
+}
+
+void
+dns_cache_reply( const uint8_t*  reply, int  len, unsigned  now_ms )
+{
+    DnsCache*         cache = _dns_cache;
+    DnsCachePending*  p = NULL;
+    uint8_t           key[DNS_CACHE_KEY_MAX];
+    uint8_t           question[DNS_CACHE_KEY_MAX];
+    int               key_len, nn, ww;
+    uint16_t          id;
+
+    if (cache->disabled || cache->send == NULL)
+        return;
+
+    if (len < DNS_HEADER_SIZE || !(dns_get16(reply + 2) & DNS_FLAG_QR))
+        return;
+
+    key_len = dns_make_key(reply, len, key);
+    if (key_len < 0)
+        return;
+
+    id = (uint16_t) dns_get16(reply);
+
+    /* only accept replies to queries we've seen; their key is the same
+     * plus the EDNS0 state of the query */
+    for (nn = 0; nn < DNS_CACHE_PENDING_MAX; nn++) {
+        p = &cache->pending[nn];
+        if (p->used && p->id == id && p->key_len == key_len + 1 &&
+            !memcmp(p->key, key, key_len))
+            break;
+    }
+    if (nn == DNS_CACHE_PENDING_MAX)
+        return;
+
+    dns_cache_insert(cache, p->key, p->key_len, p->hash, reply, len, now_ms);
+
+    for (ww = 0; ww < p->waiter_count; ww++) {
+        DnsCacheWaiter*  w = &p->waiters[ww];
+        dns_set_case(question, p->key + 2, key_len - 2, w->qcase);
+        dns_cache_send(cache, NULL, reply, len, &w->ep, w->id,
+                       question, key_len - 2, w->udp_size, now_ms);
+    }
+    p->used = 0;
+}
+
+void
+dns_cache_get_stats( DnsCacheStats*  stats )
+{
+    *stats = _dns_cache->stats;
+}
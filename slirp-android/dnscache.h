@@ -0,0 +1,91 @@
+/* Copyright (C) 2015 The Android Open Source Project
+**
+** This software is licensed under the terms of the GNU General Public
+** License version 2, as published by the Free Software Foundation, and
+** may be copied, distributed, and modified under those terms.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+*/
+#ifndef _SLIRP_DNSCACHE_H
+#define _SLIRP_DNSCACHE_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* A small caching DNS proxy used by slirp for guest queries sent to port 53.
+ *
+ * Queries that can be answered from the cache are replied to directly,
+ * without touching the host resolver. Queries identical to one that is
+ * already in flight are not forwarded either; they are answered when the
+ * first reply comes back, truncated if it is larger than what their
+ * client accepts. Cached answers expire according to the smallest
+ * TTL they contain, and the TTLs sent back to the guest are decremented
+ * by the time spent in the cache.
+ *
+ * This module doesn't depend on slirp itself: replies are sent through
+ * the callback given to dns_cache_init(), and times are passed explicitly.
+ */
+
+/* Describes where a query came from, and where it was sent. All values
+ * are in host byte order. */
+typedef struct {
+    uint32_t  client_ip;
+    uint16_t  client_port;
+    uint32_t  server_ip;
+    uint16_t  server_port;
+} DnsCacheEndpoint;
+
+/* Callback used to send a DNS reply 'data' of 'len' bytes back to the
+ * client described by 'ep'. */
+typedef void (*DnsCacheSendFunc)( void*                    opaque,
+                                  const DnsCacheEndpoint*  ep,
+                                  const uint8_t*           data,
+                                  int                      len );
+
+typedef struct {
+    uint64_t  hits;        /* queries answered from the cache */
+    uint64_t  misses;      /* queries forwarded to the host resolver */
+    uint64_t  coalesced;   /* queries merged with an in-flight one */
+    uint64_t  inserts;     /* replies added to the cache */
+    uint64_t  evictions;   /* entries removed before they expired */
+    int       entries;     /* current number of cached entries */
+} DnsCacheStats;
+
+/* Initialize or reset the cache. 'send' is used to answer queries. */
+extern void dns_cache_init( DnsCacheSendFunc  send, void*  opaque );
+
+/* Enable or disable the cache. When disabled, dns_cache_query() always
+ * returns 0 and dns_cache_reply() does nothing. Enabled by default. */
+extern void dns_cache_set_enabled( int  enabled );
+
+/* Drop all cached and pending entries, keep the stats */
+extern void dns_cache_flush( void );
+
+/* Process a query sent by the guest. Returns 1 if it was handled (i.e.
+ * answered from the cache, or merged with an in-flight query), in which
+ * case it must not be forwarded; 0 otherwise. 'now_ms' is a millisecond
+ * timestamp. */
+extern int  dns_cache_query( const DnsCacheEndpoint*  ep,
+                             const uint8_t*           query,
+                             int                      len,
+                             unsigned                 now_ms );
+
+/* Process a reply received from the host resolver, before it is sent to
+ * the guest. Caches it if possible, and answers coalesced queries. */
+extern void dns_cache_reply( const uint8_t*  reply,
+                             int             len,
+                             unsigned        now_ms );
+
+extern void dns_cache_get_stats( DnsCacheStats*  stats );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _SLIRP_DNSCACHE_H */
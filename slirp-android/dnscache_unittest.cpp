@@ -0,0 +1,434 @@
+// Copyright 2015 The Android Open Source Project
+//
+// This software is licensed under the terms of the GNU General Public
+// License version 2, as published by the Free Software Foundation, and
+// may be copied, distributed, and modified under those terms.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+#include "slirp-android/dnscache.h"
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+namespace {
+
+typedef std::vector<uint8_t> Message;
+
+struct SentReply {
+    DnsCacheEndpoint ep;
+    Message data;
+};
+
+std::vector<SentReply> sSent;
+
+void recordReply(void* opaque,
+                 const DnsCacheEndpoint* ep,
+                 const uint8_t* data,
+                 int len) {
+    SentReply reply;
+    reply.ep = *ep;
+    reply.data.assign(data, data + len);
+    sSent.push_back(reply);
+}
+
+void put16(Message* msg, unsigned value) {
+    msg->push_back((uint8_t)(value >> 8));
+    msg->push_back((uint8_t)value);
+}
+
+void put32(Message* msg, uint32_t value) {
+    put16(msg, value >> 16);
+    put16(msg, value & 0xffff);
+}
+
+unsigned get16(const Message& msg, size_t pos) {
+    return (msg[pos] << 8) | msg[pos + 1];
+}
+
+uint32_t get32(const Message& msg, size_t pos) {
+    return (get16(msg, pos) << 16) | get16(msg, pos + 2);
+}
+
+void putName(Message* msg, const std::string& name) {
+    size_t start = 0;
+    while (start < name.size()) {
+        size_t dot = name.find('.', start);
+        if (dot == std::string::npos) {
+            dot = name.size();
+        }
+        msg->push_back((uint8_t)(dot - start));
+        msg->insert(msg->end(), name.begin() + start, name.begin() + dot);
+        start = dot + 1;
+    }
+    msg->push_back(0);
+}
+
+// Build a standard recursive 'A' query for |name|.
+Message makeQuery(uint16_t id, const std::string& name) {
+    Message msg;
+    put16(&msg, id);
+    put16(&msg, 0x0100);  // RD
+    put16(&msg, 1);       // QDCOUNT
+    put16(&msg, 0);
+    put16(&msg, 0);
+    put16(&msg, 0);
+    putName(&msg, name);
+    put16(&msg, 1);  // A
+    put16(&msg, 1);  // IN
+    return msg;
+}
+
+// Return the position following the question of |msg|.
+size_t questionEnd(const Message& msg) {
+    size_t pos = 12;
+    while (msg[pos] != 0) {
+        pos += 1 + msg[pos];
+    }
+    return pos + 1 + 4;
+}
+
+// The TTL of the first record following the question, i.e. the one added
+// by resolve() below.
+uint32_t getTtl(const Message& msg) {
+    return get32(msg, questionEnd(msg) + 6);
+}
+
+// Append an EDNS0 OPT record to the additional section of |msg|.
+void addOpt(Message* msg, unsigned udpSize, bool dnssecOk) {
+    msg->push_back(0);  // root name
+    put16(msg, 41);     // OPT
+    put16(msg, udpSize);
+    put16(msg, 0);      // extended rcode and version
+    put16(msg, dnssecOk ? 0x8000 : 0);
+    put16(msg, 0);      // no options
+    (*msg)[11]++;       // ARCOUNT
+}
+
+// Append an A record for |name| of |dataSize| bytes to the additional
+// section of |msg|, like the glue records of a reply.
+void addGlue(Message* msg, const std::string& name, size_t dataSize = 4) {
+    putName(msg, name);
+    put16(msg, 1);
+    put16(msg, 1);
+    put32(msg, 3600);
+    put16(msg, dataSize);
+    msg->insert(msg->end(), dataSize, 0x0a);
+    (*msg)[11]++;       // ARCOUNT
+}
+
+// A stand-in for the host resolver: answers |query| with a single A
+// record of the given |ttl|, or with NXDOMAIN and a SOA record. The
+// additional section of the query is not copied.
+Message resolve(const Message& query, uint32_t ttl, bool nxdomain = false) {
+    Message msg(query.begin(), query.begin() + questionEnd(query));
+    msg[2] = 0x81;                    // QR | RD
+    msg[3] = nxdomain ? 0x83 : 0x80;  // RA | rcode
+    msg[11] = 0;                      // ARCOUNT
+    if (nxdomain) {
+        msg[9] = 1;  // NSCOUNT
+    } else {
+        msg[7] = 1;  // ANCOUNT
+    }
+    put16(&msg, 0xc00c);  // pointer to the question name
+    put16(&msg, nxdomain ? 6 : 1);
+    put16(&msg, 1);
+    put32(&msg, ttl);
+    put16(&msg, 4);
+    put32(&msg, 0x0a000202);
+    return msg;
+}
+
+DnsCacheEndpoint makeEndpoint(uint16_t port) {
+    DnsCacheEndpoint ep;
+    ep.client_ip = 0x0a00020f;
+    ep.client_port = port;
+    ep.server_ip = 0x0a000203;
+    ep.server_port = 53;
+    return ep;
+}
+
+int query(uint16_t port, const Message& msg, unsigned now) {
+    DnsCacheEndpoint ep = makeEndpoint(port);
+    return dns_cache_query(&ep, &msg[0], (int)msg.size(), now);
+}
+
+void reply(const Message& msg, unsigned now) {
+    dns_cache_reply(&msg[0], (int)msg.size(), now);
+}
+
+class DnsCacheTest : public ::testing::Test {
+protected:
+    virtual void SetUp() {
+        sSent.clear();
+        dns_cache_set_enabled(1);
+        dns_cache_init(recordReply, NULL);
+    }
+};
+
+}  // namespace
+
+TEST_F(DnsCacheTest, MissThenHit) {
+    Message q1 = makeQuery(0x1234, "www.example.com");
+    EXPECT_EQ(0, query(1000, q1, 0));
+    reply(resolve(q1, 60), 10);
+    EXPECT_TRUE(sSent.empty());
+
+    Message q2 = makeQuery(0x4321, "www.example.com");
+    EXPECT_EQ(1, query(1001, q2, 20));
+    ASSERT_EQ(1U, sSent.size());
+    EXPECT_EQ(1001, sSent[0].ep.client_port);
+    EXPECT_EQ(53, sSent[0].ep.server_port);
+    EXPECT_EQ(0x4321U, get16(sSent[0].data, 0));
+    EXPECT_EQ(60U, getTtl(sSent[0].data));
+
+    DnsCacheStats stats;
+    dns_cache_get_stats(&stats);
+    EXPECT_EQ(1U, stats.hits);
+    EXPECT_EQ(1U, stats.misses);
+    EXPECT_EQ(1U, stats.inserts);
+    EXPECT_EQ(1, stats.entries);
+}
+
+TEST_F(DnsCacheTest, NameIsCaseInsensitive) {
+    Message q1 = makeQuery(1, "www.Example.COM");
+    EXPECT_EQ(0, query(1000, q1, 0));
+    reply(resolve(q1, 60), 0);
+    Message q2 = makeQuery(2, "WWW.example.com");
+    EXPECT_EQ(1, query(1000, q2, 0));
+
+    // The reply has the question as the client sent it.
+    ASSERT_EQ(1U, sSent.size());
+    EXPECT_TRUE(std::equal(q2.begin() + 12, q2.begin() + questionEnd(q2),
+                           sSent[0].data.begin() + 12));
+}
+
+TEST_F(DnsCacheTest, TtlIsDecrementedAndExpires) {
+    Message q = makeQuery(1, "a.test");
+    EXPECT_EQ(0, query(1000, q, 0));
+    reply(resolve(q, 30), 0);
+
+    EXPECT_EQ(1, query(1000, makeQuery(2, "a.test"), 10500));
+    ASSERT_EQ(1U, sSent.size());
+    EXPECT_EQ(20U, getTtl(sSent[0].data));
+
+    EXPECT_EQ(0, query(1000, makeQuery(3, "a.test"), 30000));
+    DnsCacheStats stats;
+    dns_cache_get_stats(&stats);
+    EXPECT_EQ(0, stats.entries);
+}
+
+TEST_F(DnsCacheTest, ZeroTtlIsNotCached) {
+    Message q = makeQuery(1, "a.test");
+    EXPECT_EQ(0, query(1000, q, 0));
+    reply(resolve(q, 0), 0);
+    EXPECT_EQ(0, query(1000, makeQuery(2, "a.test"), 0));
+}
+
+TEST_F(DnsCacheTest, NegativeAnswersAreCached) {
+    Message q = makeQuery(1, "missing.test");
+    EXPECT_EQ(0, query(1000, q, 0));
+    reply(resolve(q, 100000, true), 0);
+
+    EXPECT_EQ(1, query(1000, makeQuery(2, "missing.test"), 1000));
+    ASSERT_EQ(1U, sSent.size());
+    EXPECT_EQ(3, sSent[0].data[3] & 0x0f);
+
+    // Negative TTLs are capped.
+    EXPECT_EQ(0, query(1000, makeQuery(3, "missing.test"), 301000));
+}
+
+TEST_F(DnsCacheTest, InFlightQueriesAreCoalesced) {
+    Message q1 = makeQuery(10, "b.test");
+    EXPECT_EQ(0, query(1000, q1, 0));
+    EXPECT_EQ(1, query(2000, makeQuery(20, "b.test"), 1));
+    EXPECT_EQ(1, query(3000, makeQuery(30, "b.test"), 2));
+    // A duplicate from the same waiter is absorbed.
+    EXPECT_EQ(1, query(3000, makeQuery(30, "b.test"), 3));
+    EXPECT_TRUE(sSent.empty());
+
+    reply(resolve(q1, 60), 5);
+    ASSERT_EQ(2U, sSent.size());
+    EXPECT_EQ(2000, sSent[0].ep.client_port);
+    EXPECT_EQ(20U, get16(sSent[0].data, 0));
+    EXPECT_EQ(3000, sSent[1].ep.client_port);
+    EXPECT_EQ(30U, get16(sSent[1].data, 0));
+
+    DnsCacheStats stats;
+    dns_cache_get_stats(&stats);
+    EXPECT_EQ(2U, stats.coalesced);
+    EXPECT_EQ(1U, stats.misses);
+}
+
+TEST_F(DnsCacheTest, RetransmissionIsForwarded) {
+    Message q = makeQuery(10, "c.test");
+    EXPECT_EQ(0, query(1000, q, 0));
+    EXPECT_EQ(0, query(1000, q, 1000));
+}
+
+TEST_F(DnsCacheTest, UnsolicitedRepliesAreIgnored) {
+    Message q = makeQuery(10, "d.test");
+    reply(resolve(q, 60), 0);
+    EXPECT_EQ(0, query(1000, q, 0));
+
+    // Wrong id for a pending query.
+    Message other = makeQuery(11, "d.test");
+    reply(resolve(other, 60), 0);
+
+    DnsCacheStats stats;
+    dns_cache_get_stats(&stats);
+    EXPECT_EQ(0U, stats.inserts);
+    EXPECT_TRUE(sSent.empty());
+}
+
+TEST_F(DnsCacheTest, Disabled) {
+    dns_cache_set_enabled(0);
+    Message q = makeQuery(1, "e.test");
+    EXPECT_EQ(0, query(1000, q, 0));
+    reply(resolve(q, 60), 0);
+    EXPECT_EQ(0, query(1000, makeQuery(2, "e.test"), 0));
+    EXPECT_TRUE(sSent.empty());
+}
+
+TEST_F(DnsCacheTest, MalformedQueriesAreForwarded) {
+    Message q = makeQuery(1, "f.test");
+    q.resize(q.size() - 3);
+    EXPECT_EQ(0, query(1000, q, 0));
+
+    Message tiny(4, 0);
+    EXPECT_EQ(0, query(1000, tiny, 0));
+}
+
+TEST_F(DnsCacheTest, EdnsRepliesMatchTheirQuery) {
+    // The reply advertises another payload size than the query, and
+    // carries glue records.
+    Message q1 = makeQuery(1, "g.test");
+    addOpt(&q1, 4096, false);
+    EXPECT_EQ(0, query(1000, q1, 0));
+    Message r = resolve(q1, 60);
+    addGlue(&r, "ns1.g.test");
+    addOpt(&r, 1232, false);
+    reply(r, 10);
+
+    DnsCacheStats stats;
+    dns_cache_get_stats(&stats);
+    EXPECT_EQ(1U, stats.inserts);
+
+    sSent.clear();
+    Message q2 = makeQuery(3, "g.test");
+    addOpt(&q2, 1232, false);
+    EXPECT_EQ(1, query(1001, q2, 20));
+    ASSERT_EQ(1U, sSent.size());
+    EXPECT_EQ(r.size(), sSent[0].data.size());
+    EXPECT_EQ(3U, get16(sSent[0].data, 0));
+    EXPECT_EQ(60U, getTtl(sSent[0].data));
+}
+
+TEST_F(DnsCacheTest, WaitersGetRepliesWithGlueRecords) {
+    Message q1 = makeQuery(10, "h.test");
+    EXPECT_EQ(0, query(1000, q1, 0));
+    EXPECT_EQ(1, query(2000, makeQuery(20, "h.test"), 1));
+
+    Message r = resolve(q1, 60);
+    addGlue(&r, "ns1.h.test");
+    addGlue(&r, "ns2.h.test");
+    reply(r, 5);
+    ASSERT_EQ(1U, sSent.size());
+    EXPECT_EQ(2000, sSent[0].ep.client_port);
+    EXPECT_EQ(r.size(), sSent[0].data.size());
+
+    // The original client retransmitting now gets the cached reply.
+    EXPECT_EQ(1, query(1000, q1, 6));
+}
+
+TEST_F(DnsCacheTest, EdnsStateIsPartOfTheKey) {
+    Message plain = makeQuery(1, "i.test");
+    EXPECT_EQ(0, query(1000, plain, 0));
+    reply(resolve(plain, 60), 0);
+
+    Message edns = makeQuery(2, "i.test");
+    addOpt(&edns, 4096, false);
+    EXPECT_EQ(0, query(1000, edns, 0));
+    Message r = resolve(edns, 60);
+    addOpt(&r, 4096, false);
+    reply(r, 0);
+
+    Message dnssec = makeQuery(3, "i.test");
+    addOpt(&dnssec, 4096, true);
+    EXPECT_EQ(0, query(1000, dnssec, 0));
+
+    sSent.clear();
+    EXPECT_EQ(1, query(1000, makeQuery(4, "i.test"), 1));
+    ASSERT_EQ(1U, sSent.size());
+    EXPECT_EQ(plain.size() + 16, sSent[0].data.size());
+}
+
+TEST_F(DnsCacheTest, LargeRepliesFitTheClientPayloadSize) {
+    Message q1 = makeQuery(1, "j.test");
+    addOpt(&q1, 4096, false);
+    EXPECT_EQ(0, query(1000, q1, 0));
+    Message r = resolve(q1, 60);
+    addGlue(&r, "big.j.test", 600);
+    addOpt(&r, 4096, false);
+    ASSERT_LT(600U, r.size());
+    reply(r, 0);
+
+    Message small = makeQuery(2, "j.test");
+    addOpt(&small, 512, false);
+    EXPECT_EQ(0, query(1000, small, 1));
+
+    Message large = makeQuery(3, "j.test");
+    addOpt(&large, 1232, false);
+    EXPECT_EQ(1, query(1001, large, 1));
+}
+
+TEST_F(DnsCacheTest, WaitersGetTheirOwnQuestion) {
+    Message q1 = makeQuery(10, "l.test");
+    EXPECT_EQ(0, query(1000, q1, 0));
+    Message q2 = makeQuery(20, "L.tESt");
+    EXPECT_EQ(1, query(2000, q2, 1));
+
+    reply(resolve(q1, 60), 5);
+    ASSERT_EQ(1U, sSent.size());
+    EXPECT_TRUE(std::equal(q2.begin() + 12, q2.begin() + questionEnd(q2),
+                           sSent[0].data.begin() + 12));
+}
+
+TEST_F(DnsCacheTest, WaitersGetTruncatedRepliesTooLargeForThem) {
+    Message q1 = makeQuery(1, "m.test");
+    addOpt(&q1, 4096, false);
+    EXPECT_EQ(0, query(1000, q1, 0));
+    Message small = makeQuery(2, "m.test");
+    addOpt(&small, 512, false);
+    EXPECT_EQ(1, query(2000, small, 1));
+    Message large = makeQuery(3, "m.test");
+    addOpt(&large, 1232, false);
+    EXPECT_EQ(1, query(3000, large, 1));
+
+    Message r = resolve(q1, 60);
+    addGlue(&r, "big.m.test", 600);
+    addOpt(&r, 4096, false);
+    reply(r, 5);
+    ASSERT_EQ(2U, sSent.size());
+
+    // Only the header and question, with TC set and no records.
+    const Message& truncated = sSent[0].data;
+    EXPECT_EQ(2000, sSent[0].ep.client_port);
+    ASSERT_EQ(questionEnd(small), truncated.size());
+    EXPECT_EQ(2U, get16(truncated, 0));
+    EXPECT_EQ(0x0200U, get16(truncated, 2) & 0x0200);
+    EXPECT_EQ(1U, get16(truncated, 4));
+    EXPECT_EQ(0U, get16(truncated, 6));
+    EXPECT_EQ(0U, get16(truncated, 8));
+    EXPECT_EQ(0U, get16(truncated, 10));
+
+    EXPECT_EQ(3000, sSent[1].ep.client_port);
+    EXPECT_EQ(r.size(), sSent[1].data.size());
+    EXPECT_EQ(0U, get16(sSent[1].data, 2) & 0x0200);
+}
@@ -5,6 +5,7 @@
 #include <stdio.h>
 #include "android/sockets.h"
 #include "slirp.h"
+#include "dnscache.h"
 #ifdef _WIN32
 #  define WIN32_LEAN_AND_MEAN
 #  define socket_close  winsock2_socket_close3
@@ -79,6 +80,10 @@ int slirp_dump_dns(struct mbuf* m);
 void slirp_set_max_dns_conns(int max_dns_conns);
 /* Returns the max number of allowed DNS requests.*/
 int slirp_get_max_dns_conns();
+/** Enables or disables the DNS cache (enabled by default). */
+void slirp_set_dns_cache(int enabled);
+/** Returns hit/miss statistics of the DNS cache. */
+void slirp_get_dns_cache_stats(DnsCacheStats* stats);
 
 /**
  * Modifications for implementing "-net-forward-tcp2sink' option.
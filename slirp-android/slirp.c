@@ -1050,6 +1050,14 @@ int slirp_get_max_dns_conns() {
     return max_dns_conns;
 }
 
+void slirp_set_dns_cache(int enabled) {
+    dns_cache_set_enabled(enabled);
+}
+
+void slirp_get_dns_cache_stats(DnsCacheStats* stats) {
+    dns_cache_get_stats(stats);
+}
+
 /* generic guest network redirection functionality for ipv4 */
 struct net_forward_entry {
     QTAILQ_ENTRY(net_forward_entry) next;
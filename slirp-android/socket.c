@@ -10,6 +10,7 @@
 #include <slirp.h>
 #include "ip_icmp.h"
 #include "main.h"
+#include "dnscache.h"
 #ifdef __sun__
 #include <sys/filio.h>
 #endif
@@ -521,6 +522,9 @@ sorecvfrom(struct socket *so)
 	   * for the 4 minute (or whatever) timeout... So we time them
 	   * out much quicker (10 seconds  for now...)
 	   */
+	    if (so->so_faddr_port == 53)
+	      dns_cache_reply((const uint8_t *)m->m_data, m->m_len, curtime);
+
 	    if (so->so_expire) {
 	      if (so->so_faddr_port == 53)
 		so->so_expire = curtime + SO_EXPIREFAST;
@@ -42,6 +42,7 @@
 #include "ip_icmp.h"
 #define SLIRP_COMPILATION  1
 #include "android/sockets.h"
+#include "dnscache.h"
 
 #ifdef LOG_ENABLED
 struct udpstat udpstat;
@@ -55,6 +56,8 @@ struct socket udb;
 
 static u_int8_t udp_tos(struct socket *so);
 static void udp_emu(struct socket *so, struct mbuf *m);
+static void udp_dns_cache_send(void *opaque, const DnsCacheEndpoint *ep,
+                               const uint8_t *data, int len);
 
 /*
  * UDP protocol implementation.
@@ -73,6 +76,30 @@ udp_init(void)
 {
 	udb.so_next = udb.so_prev = &udb;
 	dns_num_conns = 0;
+	dns_cache_init(udp_dns_cache_send, NULL);
+}
+
+/*
+ * Send a reply from the DNS cache to the guest
+ */
+static void
+udp_dns_cache_send(void *opaque, const DnsCacheEndpoint *ep,
+                   const uint8_t *data, int len)
+{
+	SockAddress saddr, daddr;
+	struct mbuf *m;
+
+	if (!(m = m_get())) return;
+	m->m_data += IF_MAXLINKHDR + sizeof(struct udpiphdr);
+	if (len > M_FREEROOM(m)) {
+	  m_inc(m, (m->m_data - m->m_dat) + len + 1);
+	}
+	memcpy(m->m_data, data, len);
+	m->m_len = len;
+
+	sock_address_init_inet(&saddr, ep->server_ip, ep->server_port);
+	sock_address_init_inet(&daddr, ep->client_ip, ep->client_port);
+	udp_output2_(NULL, m, &saddr, &daddr, IPTOS_LOWDELAY);
 }
 /* m->m_data  points at ip packet header
  * m->m_len   length ip packet
@@ -209,6 +236,22 @@ udp_input(register struct mbuf *m, int iphlen)
             if (slirp_get_max_dns_conns() != -1 &&
                 dns_num_conns > (unsigned)slirp_get_max_dns_conns())
                 goto bad;
+
+            /* answer from the cache, or wait for an identical in-flight
+             * query, instead of asking the host resolver again */
+            {
+                DnsCacheEndpoint ep;
+
+                ep.client_ip   = ip_geth(ip->ip_src);
+                ep.client_port = port_geth(uh->uh_sport);
+                ep.server_ip   = ip_geth(ip->ip_dst);
+                ep.server_port = port_geth(uh->uh_dport);
+                if (dns_cache_query(&ep,
+                                    (const uint8_t *)(uh + 1),
+                                    len - sizeof(struct udphdr),
+                                    curtime))
+                    goto bad;
+            }
         }
 
 
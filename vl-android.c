@@ -2817,6 +2817,10 @@ int main(int argc, char **argv, char **envp)
                 }
                 break;
 
+            case QEMU_OPTION_no_dns_cache:
+                slirp_set_dns_cache(0);
+                break;
+
             case QEMU_OPTION_net_forward:
                 net_slirp_forward(optarg);
                 break;